@@ -0,0 +1,67 @@
+/*
+ * Burst Capture Example
+ *
+ * This example demonstrates event-triggered burst capture. Devices are read
+ * once per second; the last snapshots of each are kept. When the voltage of
+ * device 1 sags below 200 V, or when the button pin goes low, the affected
+ * device gets the bus and is read back to back (voltage and current only), then
+ * the whole window, pre-trigger history included, is printed as one record.
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#include <PZEMCapture.h>
+
+#define PZEM_RX_PIN 16
+#define PZEM_TX_PIN 17
+#define TRIGGER_PIN 0
+HardwareSerial PZEM_SERIAL(2);
+
+// Time given to the bus on every loop() iteration
+#define BUS_BUDGET_US 2000
+
+ModbusRTUTransport transport(&PZEM_SERIAL);
+PZEMBus bus(transport);
+PZEMCapture capture(bus);
+
+void IRAM_ATTR onTriggerPin(){
+  capture.trigger(0x02, PZEM_CAPTURE_TRIGGER_EXTERNAL);
+}
+
+void printCapture(const PZEMCaptureRecord* record, void* context){
+  Serial.printf("Capture of device %u (source %u): %u samples, %u before the trigger\n",
+                record->slaveAddr, record->source, record->count, record->preCount);
+  for (uint8_t i = 0; i < record->count; i++) {
+    const PZEMCaptureSample& sample = record->samples[i];
+    // Register 0x0000 is the voltage on every supported model
+    Serial.printf("%8ld ms  reg0=%u  reg1=%u\n", (long)(sample.timestamp - record->triggerTime),
+                  sample.regs[0], sample.regs[1]);
+  }
+}
+
+void setup(){
+  Serial.begin(115200);
+  PZEM_SERIAL.begin(9600, SERIAL_8N1, PZEM_RX_PIN, PZEM_TX_PIN);
+
+  bus.addDevice(0x01, PZEM_MODEL_004T);
+  bus.addDevice(0x02, PZEM_MODEL_6L24);
+  bus.setInterval(1000);
+  bus.setSnapshotCallback(PZEMCapture::onSnapshot, &capture);
+
+  // PZEM-004T voltage has 0.1 V resolution: trigger outside 200.0-250.0 V
+  capture.setThreshold(0x01, 0, 2000, 2500);
+  capture.setWindow(20, 2000);
+  capture.setCaptureCallback(printCapture, NULL);
+
+  pinMode(TRIGGER_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(TRIGGER_PIN), onTriggerPin, FALLING);
+}
+
+void loop(){
+  capture.poll(BUS_BUDGET_US);
+
+  // Other work runs here on every iteration
+}
@@ -0,0 +1,67 @@
+/*
+ * Bus Polling Example
+ *
+ * This example demonstrates cooperative polling of several devices on one RS485
+ * bus. PZEMBus::poll() works within a time budget, even when devices do not
+ * answer, so the rest of loop() (Wi-Fi, display, watchdog) gets predictable
+ * CPU time. Results are read from a register cache.
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#include <PZEMBus.h>
+
+#if defined(ESP8266)
+#include <SoftwareSerial.h>
+#define PZEM_RX_PIN 13
+#define PZEM_TX_PIN 15
+SoftwareSerial PZEM_SERIAL(PZEM_RX_PIN, PZEM_TX_PIN);
+#else
+#define PZEM_RX_PIN 16
+#define PZEM_TX_PIN 17
+HardwareSerial PZEM_SERIAL(2);
+#endif
+
+// Time given to the bus on every loop() iteration. A request frame started
+// within the budget is sent whole, so one poll() can last up to 2 ms plus
+// one frame (8 bytes at 9600 baud, about 9 ms): size watchdogs for 11 ms.
+#define BUS_BUDGET_US 2000
+
+ModbusRTUTransport transport(&PZEM_SERIAL);
+PZEMBus bus(transport);
+PZEMRegisterCache cache;
+
+void printSnapshot(const PZEMSnapshot* snapshot, void* context){
+  // Register 0x0000 is the voltage on every supported model
+  Serial.print("Device ");
+  Serial.print(snapshot->slaveAddr);
+  Serial.print(": register 0x0000 = ");
+  Serial.println(snapshot->regs[0]);
+}
+
+void setup(){
+  Serial.begin(115200);
+
+#if defined(ESP8266)
+  PZEM_SERIAL.begin(9600);
+#else
+  PZEM_SERIAL.begin(9600, SERIAL_8N1, PZEM_RX_PIN, PZEM_TX_PIN);
+#endif
+
+  bus.addDevice(0x01, PZEM_MODEL_004T);
+  bus.addDevice(0x02, PZEM_MODEL_004T);
+  bus.addDevice(0x03, PZEM_MODEL_003);
+
+  bus.setInterval(1000);
+  bus.setRegisterCache(&cache);
+  bus.setSnapshotCallback(printSnapshot, NULL);
+}
+
+void loop(){
+  bus.poll(BUS_BUDGET_US);
+
+  // Other work runs here on every iteration, whatever the bus state
+}
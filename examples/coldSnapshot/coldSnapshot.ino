@@ -0,0 +1,87 @@
+/*
+ * Cold Snapshot Example
+ *
+ * This example demonstrates a battery node that deep-sleeps between
+ * readings of a PZEM-017. The first boot reads the device settings once and
+ * keeps them, with the precomputed request frame and the learnt response
+ * latency, in RTC memory and in NVS. Every wake then sets up the UART, reads
+ * all measurement registers in one transaction that completes on its exact
+ * length, and goes back to sleep.
+ *
+ * RTC memory survives deep sleep; NVS restores the state after a power loss
+ * without reading the settings again.
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#include <Preferences.h>
+#include <PZEMColdRead.h>
+
+#define PZEM_RX_PIN 16
+#define PZEM_TX_PIN 17
+#define PZEM_ADDRESS 0x01
+HardwareSerial PZEM_SERIAL(2);
+
+// Time between two readings
+#define SLEEP_SECONDS 60
+
+// Prepare the state again after this many failed wakes in a row
+#define MAX_FAILURES 5
+
+RTC_DATA_ATTR PZEMColdState coldState;
+
+ModbusRTUTransport transport(&PZEM_SERIAL);
+PZEMColdRead cold(&transport, &coldState);
+Preferences preferences;
+
+void goToSleep(){
+  PZEM_SERIAL.end();
+  esp_sleep_enable_timer_wakeup((uint64_t)SLEEP_SECONDS * 1000000ULL);
+  esp_deep_sleep_start();
+}
+
+void setup(){
+  if (!cold.isValid()) {
+    // Power-on: restore the state from NVS
+    preferences.begin("pzemcold", true);
+    preferences.getBytes("state", &coldState, sizeof(coldState));
+    preferences.end();
+  }
+
+  PZEM_SERIAL.begin(cold.isValid() ? coldState.baudrate : 9600, SERIAL_8N2, PZEM_RX_PIN, PZEM_TX_PIN);
+
+  if (!cold.isValid()) {
+    // First boot: read the settings once
+    if (!cold.prepare(PZEM_MODEL_017, PZEM_ADDRESS, 9600)) {
+      goToSleep(); // Device not reachable, try again on the next wake
+    }
+    preferences.begin("pzemcold", false);
+    preferences.putBytes("state", &coldState, sizeof(coldState));
+    preferences.end();
+  }
+
+  PZEMSnapshot snapshot;
+  if (cold.read(&snapshot)) {
+    // PZEM-017 registers: voltage (0.01 V), current (0.01 A), power and energy (low word first)
+    float voltage = snapshot.regs[0] * 0.01f;
+    float current = snapshot.regs[1] * 0.01f;
+    uint16_t range = 0;
+    cold.getSetting(0x0003, &range); // Current range, kept from the first boot
+    // Store or send the reading here (e.g. append to an outbox, or ESP-NOW)
+    (void)voltage;
+    (void)current;
+  } else if (cold.getFailures() >= MAX_FAILURES) {
+    // Address or settings changed: read them again on the next boot
+    cold.invalidate();
+    preferences.begin("pzemcold", false);
+    preferences.remove("state");
+    preferences.end();
+  }
+  goToSleep();
+}
+
+void loop(){
+}
@@ -0,0 +1,91 @@
+/*
+ * Coroutine Reads Example
+ *
+ * This example demonstrates the optional C++20 coroutine layer: two meters on
+ * two separate RS485 buses are read concurrently by two tasks written as
+ * straight-line code. loop() only drives the executor and never blocks.
+ *
+ * Requires a C++20 toolchain (e.g. ESP32 Arduino core 3.x).
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#include <PZEMCoroutine.h>
+
+#ifndef PZEM_COROUTINES_AVAILABLE
+#error "This example requires a C++20 toolchain with <coroutine>"
+#endif
+
+#define PZEM_004T_RX_PIN 16
+#define PZEM_004T_TX_PIN 17
+#define PZEM_6L24_RX_PIN 26
+#define PZEM_6L24_TX_PIN 27
+
+HardwareSerial PZEM_004T_SERIAL(1);
+HardwareSerial PZEM_6L24_SERIAL(2);
+
+// One transport per bus
+ModbusRTUTransport bus1(&PZEM_004T_SERIAL);
+ModbusRTUTransport bus2(&PZEM_6L24_SERIAL);
+
+PZEMExecutor executor;
+PZEMAsyncMeter singlePhase(executor, bus1, 0x01, PZEM_MODEL_004T);
+PZEMAsyncMeter threePhase(executor, bus2, 0x01, PZEM_MODEL_6L24);
+
+PZEMTask readSinglePhase(){
+  PZEMSnapshot snapshot;
+  for (;;){
+    if (co_await singlePhase.readSnapshot(snapshot)){
+      // Register 0x0000: voltage (0.1 V)
+      Serial.print("PZEM-004T voltage: ");
+      Serial.print(snapshot.regs[0] * 0.1, 1);
+      Serial.println(" V");
+    }
+    else{
+      Serial.println("PZEM-004T: error reading device");
+    }
+    co_await executor.sleep(1000);
+  }
+}
+
+PZEMTask readThreePhase(){
+  PZEMSnapshot snapshot;
+  for (;;){
+    if (co_await threePhase.readSnapshot(snapshot)){
+      // Registers 0x0000-0x0002: phase A/B/C voltage (0.1 V)
+      Serial.print("PZEM-6L24 voltages: ");
+      for (uint8_t phase = 0; phase < 3; phase++){
+        Serial.print(snapshot.regs[phase] * 0.1, 1);
+        Serial.print(" V ");
+      }
+      Serial.println();
+    }
+    else{
+      Serial.println("PZEM-6L24: error reading device");
+    }
+    co_await executor.sleep(1000);
+  }
+}
+
+void setup(){
+  Serial.begin(115200);
+
+  PZEM_004T_SERIAL.begin(9600, SERIAL_8N1, PZEM_004T_RX_PIN, PZEM_004T_TX_PIN);
+  PZEM_6L24_SERIAL.begin(9600, SERIAL_8N1, PZEM_6L24_RX_PIN, PZEM_6L24_TX_PIN);
+
+  // The full 6L24 snapshot (64 registers) takes ~150 ms at 9600 baud
+  threePhase.setTimeout(300);
+
+  // Frames come from a fixed pool; spawn() fails when it is exhausted
+  if (!executor.spawn(readSinglePhase()) || !executor.spawn(readThreePhase())){
+    Serial.println("Coroutine frame pool exhausted");
+  }
+}
+
+void loop(){
+  executor.runOnce();
+  // Other work can run here
+}
@@ -0,0 +1,75 @@
+/*
+ * Modbus-TCP Gateway Example
+ *
+ * This example demonstrates how to read a PZEM-004T that sits behind an
+ * Ethernet/Wi-Fi to RS485 gateway. The device class is used unchanged: only
+ * its transport is replaced by a Modbus-TCP (MBAP) or RTU-over-TCP transport.
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#define PZEM_004T
+
+#include <WiFi.h>
+#include <PZEMPlus.h>
+
+#define WIFI_SSID     "your-ssid"
+#define WIFI_PASSWORD "your-password"
+
+// Use Modbus-TCP (gateway port 502) or raw RTU-over-TCP (transparent gateway port)
+#define USE_MODBUS_TCP
+
+IPAddress gatewayIp(192, 168, 1, 200);
+WiFiClient client;
+
+#if defined(USE_MODBUS_TCP)
+ModbusTCPTransport transport(client, gatewayIp, 502);
+#else
+ModbusRTUOverTCPTransport transport(client, gatewayIp, 4196);
+#endif
+
+// The serial port is not used once the transport is replaced
+HardwareSerial PZEM_SERIAL(2);
+PZEMPlus pzem(PZEM_SERIAL, 0x01);
+
+void setup(){
+  Serial.begin(115200);
+
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  while (WiFi.status() != WL_CONNECTED){
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println();
+
+  // Send every request through the gateway
+  pzem.setTransport(&transport);
+
+  // Allow for the network round trip
+  pzem.setTimeouts(500);
+
+  Serial.println("PZEM-004T over TCP started");
+}
+
+void loop(){
+  float voltage, current, power, energy, frequency, powerFactor;
+
+  uint32_t startTime = millis();
+  if (pzem.readAll(&voltage, &current, &power, &energy, &frequency, &powerFactor)){
+    Serial.print("Voltage: ");
+    Serial.print(voltage, 1);
+    Serial.print(" V, Power: ");
+    Serial.print(power, 1);
+    Serial.print(" W (");
+    Serial.print(millis() - startTime);
+    Serial.println("ms)");
+  }
+  else{
+    Serial.println("Error reading device");
+  }
+
+  delay(2000);
+}
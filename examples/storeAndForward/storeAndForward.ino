@@ -0,0 +1,127 @@
+/*
+ * Store-and-Forward Example
+ *
+ * This example demonstrates a durable outbox between the bus and a server.
+ * Every snapshot is appended to a log in a flash partition, whatever the
+ * state of Wi-Fi. A cursor holds the position of the last batch the server
+ * acknowledged, so after an outage or a reboot the backlog is sent from
+ * there, at a limited rate and behind the live snapshots.
+ *
+ * The partition table needs a data partition labelled "outbox", e.g. in a
+ * custom partitions.csv:
+ *   outbox, data, 0x99, , 256K
+ *
+ * Each batch is sent as a 4-byte little-endian length followed by the batch;
+ * the server answers one byte (0x06) once the batch is stored, and decodes
+ * it with PZEMOutboxDecoder and PZEMOutbox::decodeSnapshot().
+ *
+ * Author: Lucas Hudson
+ * GitHub: https://github.com/lucashudson-eng/PZEMPlus
+ *
+ * License: GPL-3.0
+ */
+
+#include <WiFi.h>
+#include <PZEMBus.h>
+#include <PZEMOutbox.h>
+
+#define PZEM_RX_PIN 16
+#define PZEM_TX_PIN 17
+HardwareSerial PZEM_SERIAL(2);
+
+#define WIFI_SSID "your-ssid"
+#define WIFI_PASSWORD "your-password"
+#define SERVER_HOST "192.168.1.10"
+#define SERVER_PORT 9000
+
+// Consumer cursor of the server
+#define SERVER_CURSOR 0
+
+// Time given to the bus on every loop() iteration
+#define BUS_BUDGET_US 2000
+
+ModbusRTUTransport transport(&PZEM_SERIAL);
+PZEMBus bus(transport);
+
+PZEMOutboxPartitionStore store;
+PZEMOutbox outbox;
+WiFiClient client;
+
+uint8_t batchBuffer[2048];
+
+void storeSnapshot(const PZEMSnapshot* snapshot, void* context){
+  outbox.appendSnapshot(snapshot, time(NULL));
+}
+
+// Send one batch and wait for its acknowledgement
+bool sendBatch(const uint8_t* data, uint32_t length){
+  uint8_t header[4] = {
+    (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24)
+  };
+  if (client.write(header, 4) != 4 || client.write(data, length) != length) {
+    return false;
+  }
+
+  unsigned long start = millis();
+  while (!client.available()) {
+    if (millis() - start > 2000 || !client.connected()) {
+      return false;
+    }
+    bus.poll(BUS_BUDGET_US);
+  }
+  return client.read() == 0x06;
+}
+
+void forward(){
+  if (WiFi.status() != WL_CONNECTED) {
+    return;
+  }
+  if (!client.connected() && !client.connect(SERVER_HOST, SERVER_PORT)) {
+    return;
+  }
+
+  PZEMOutboxBatch batch;
+  if (!outbox.takeBatch(SERVER_CURSOR, batchBuffer, sizeof(batchBuffer), &batch)) {
+    return; // Nothing to send, or the backfill rate holds the backlog back
+  }
+  if (sendBatch(batchBuffer, batch.length)) {
+    outbox.commit(SERVER_CURSOR, &batch);
+  } else {
+    client.stop(); // The batch is sent again on the next connection
+  }
+}
+
+void setup(){
+  Serial.begin(115200);
+  PZEM_SERIAL.begin(9600, SERIAL_8N1, PZEM_RX_PIN, PZEM_TX_PIN);
+
+  if (!store.begin("outbox")) {
+    Serial.println("No \"outbox\" partition");
+    while (true) delay(1000);
+  }
+  if (!outbox.begin(&store)) {
+    Serial.println("Outbox unreadable, formatting");
+    outbox.format();
+  }
+  outbox.openCursor(SERVER_CURSOR);       // Kept if already open
+  outbox.setBackfillRate(4096, 2048);     // Backlog at 4 KB/s at most
+
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+
+  bus.addDevice(0x01, PZEM_MODEL_004T);
+  bus.addDevice(0x02, PZEM_MODEL_004T);
+  bus.setInterval(1000);
+  bus.setSnapshotCallback(storeSnapshot, NULL);
+}
+
+void loop(){
+  bus.poll(BUS_BUDGET_US);
+  forward();
+
+  static unsigned long lastReport = 0;
+  if (millis() - lastReport > 10000) {
+    lastReport = millis();
+    Serial.print("Records waiting: ");
+    Serial.println(outbox.getLag(SERVER_CURSOR));
+  }
+}
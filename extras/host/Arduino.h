@@ -0,0 +1,158 @@
+/**
+ * @file Arduino.h
+ * @brief Arduino core subset for building the library on Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The bus, transport, cache and scheduler sources only need the clock, a few
+ * pin functions and the Print/Stream interfaces. This header provides them on
+ * Linux so host tools (pzemctl, gateways) compile the library sources unchanged:
+ * put extras/host ahead of src on the include path and link HostArduino.cpp
+ * and HostRealtime.cpp (the waits behind delay() and yield()).
+ * Device classes (RS485 and the PZEM* classes) need the board serial drivers
+ * and are not built on the host.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/**
+ * @defgroup HostArduinoConstants Arduino Constants
+ * @{
+ */
+#define HIGH   0x1  ///< Pin level high
+#define LOW    0x0  ///< Pin level low
+#define INPUT  0x0  ///< Pin mode input
+#define OUTPUT 0x1  ///< Pin mode output
+#define DEC    10   ///< Decimal base
+#define HEX    16   ///< Hexadecimal base
+/** @} */
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/**
+ * @brief Mask interrupts (no interrupts on the host: no effect)
+ */
+#define noInterrupts()
+
+/**
+ * @brief Unmask interrupts (no interrupts on the host: no effect)
+ */
+#define interrupts()
+
+/**
+ * @brief Milliseconds since the process started
+ * @return Time in milliseconds, 32 bits wide like on the boards so that
+ *         wraparound arithmetic behaves the same
+ */
+uint32_t millis();
+
+/**
+ * @brief Microseconds since the process started
+ * @return Time in microseconds (wraps after 71 minutes, like on the boards)
+ */
+uint32_t micros();
+
+/**
+ * @brief Sleep for a number of milliseconds
+ * @param ms Duration in milliseconds
+ */
+void delay(unsigned long ms);
+
+/**
+ * @brief Sleep for a number of microseconds
+ * @param us Duration in microseconds
+ */
+void delayMicroseconds(unsigned int us);
+
+/**
+ * @brief Let other threads run
+ * @note Sleeps briefly so that blocking loops (ModbusTransport::execute()) do not spin a core.
+ */
+void yield();
+
+/**
+ * @brief Set a pin mode (no GPIO on the host: no effect)
+ * @param pin Pin number
+ * @param mode INPUT or OUTPUT
+ */
+void pinMode(uint8_t pin, uint8_t mode);
+
+/**
+ * @brief Set a pin level (no GPIO on the host: no effect)
+ * @param pin Pin number
+ * @param level HIGH or LOW
+ * @note USB RS485 adapters switch direction by themselves: use the default auto direction.
+ */
+void digitalWrite(uint8_t pin, uint8_t level);
+
+/**
+ * @brief Read a pin level (no GPIO on the host)
+ * @param pin Pin number
+ * @return Always LOW
+ */
+int digitalRead(uint8_t pin);
+
+/**
+ * @class Print
+ * @brief Byte sink interface
+ */
+class Print {
+public:
+    virtual ~Print() {}
+
+    /**
+     * @brief Write one byte
+     * @param byte Byte to write
+     * @return Bytes written (1, or 0 on error)
+     */
+    virtual size_t write(uint8_t byte) = 0;
+
+    /**
+     * @brief Write a buffer
+     * @param buffer Bytes to write
+     * @param size Number of bytes
+     * @return Bytes written
+     */
+    virtual size_t write(const uint8_t* buffer, size_t size);
+
+    /**
+     * @brief Wait until all written bytes are sent
+     */
+    virtual void flush() {}
+};
+
+/**
+ * @class Stream
+ * @brief Byte source and sink interface
+ */
+class Stream : public Print {
+public:
+    /**
+     * @brief Get number of bytes ready to read
+     * @return Bytes ready
+     */
+    virtual int available() = 0;
+
+    /**
+     * @brief Read one byte
+     * @return Byte read, or -1 if none is ready
+     */
+    virtual int read() = 0;
+
+    /**
+     * @brief Get the next byte without consuming it
+     * @return Next byte, or -1 if none is ready
+     */
+    virtual int peek() = 0;
+};
+
+#endif // HOST_ARDUINO_H
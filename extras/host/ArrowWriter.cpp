@@ -0,0 +1,589 @@
+/**
+ * @file ArrowWriter.cpp
+ * @brief Implementation of the Arrow IPC file writer
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * File layout: "ARROW1" and two bytes of padding, the schema message, one
+ * message per record batch, the end-of-stream marker, the footer (the schema
+ * again and the position of every record batch), the footer length and
+ * "ARROW1". A message is the continuation marker 0xFFFFFFFF, the metadata
+ * length, a Message flatbuffer padded to 8 bytes, then the body. Only the
+ * tables and fields of Schema.fbs, Message.fbs and File.fbs the writer needs
+ * are encoded.
+ */
+
+#include "ArrowWriter.h"
+#include <string.h>
+#include <utility>
+
+/**
+ * @defgroup ArrowFormat Arrow Format Constants
+ * @{
+ */
+#define ARROW_METADATA_V5        4           ///< MetadataVersion.V5
+#define ARROW_HEADER_SCHEMA      1           ///< MessageHeader.Schema
+#define ARROW_HEADER_BATCH       3           ///< MessageHeader.RecordBatch
+#define ARROW_TYPE_INT           2           ///< Type.Int
+#define ARROW_TYPE_FLOAT         3           ///< Type.FloatingPoint
+#define ARROW_TYPE_TIMESTAMP     10          ///< Type.Timestamp
+#define ARROW_PRECISION_DOUBLE   2           ///< Precision.DOUBLE
+#define ARROW_UNIT_SECOND        0           ///< TimeUnit.SECOND
+#define ARROW_CONTINUATION       0xFFFFFFFFUL  ///< Marker before the metadata length
+/** @} */
+
+/**
+ * @brief Store an unsigned value in little-endian order
+ */
+static void storeLE(uint8_t* p, uint64_t value, uint8_t width) {
+    for (uint8_t i = 0; i < width; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/**
+ * @class FlatBuilder
+ * @brief Minimal FlatBuffers builder
+ *
+ * Builds back to front, as the FlatBuffers library does: an object is
+ * referred to by the buffer size right after it was prepended (its handle),
+ * which does not change while the buffer grows. Children (strings, vectors,
+ * tables) are built before the table that refers to them, and one table is
+ * built at a time.
+ */
+class FlatBuilder {
+public:
+    FlatBuilder() : _minAlign(1), _tableStart(0) {
+    }
+
+    /** @brief Current size (handle of the last object prepended) */
+    uint32_t size() const {
+        return (uint32_t)_bytes.size();
+    }
+
+    /** @brief Pad so that the size is a multiple of alignment once extra more bytes are prepended */
+    void align(uint32_t alignment, uint32_t extra = 0) {
+        if (alignment > _minAlign) {
+            _minAlign = alignment;
+        }
+        while ((size() + extra) % alignment != 0) {
+            _bytes.push_back(0);
+        }
+    }
+
+    /** @brief Prepend bytes, kept in order */
+    void prepend(const uint8_t* data, uint32_t length) {
+        for (uint32_t i = length; i-- > 0;) {
+            _bytes.push_back(data[i]);
+        }
+    }
+
+    /** @brief Prepend an aligned little-endian scalar */
+    void scalar(uint64_t value, uint8_t width) {
+        uint8_t bytes[8];
+        align(width);
+        storeLE(bytes, value, width);
+        prepend(bytes, width);
+    }
+
+    /** @brief Prepend an offset to an object already built */
+    void offset(uint32_t target) {
+        align(4);
+        scalar(size() + 4 - target, 4);
+    }
+
+    /** @brief Build a string */
+    uint32_t string(const char* text) {
+        uint32_t length = (uint32_t)strlen(text);
+        align(4, length + 1);
+        _bytes.push_back(0);
+        prepend((const uint8_t*)text, length);
+        scalar(length, 4);
+        return size();
+    }
+
+    /** @brief Build a vector of offsets to objects already built */
+    uint32_t offsetVector(const std::vector<uint32_t>& targets) {
+        align(4, 4 * (uint32_t)targets.size());
+        for (size_t i = targets.size(); i-- > 0;) {
+            offset(targets[i]);
+        }
+        scalar(targets.size(), 4);
+        return size();
+    }
+
+    /** @brief Build a vector of structs given as little-endian bytes */
+    uint32_t structVector(const uint8_t* data, uint32_t count, uint32_t structSize, uint32_t alignment) {
+        align(4, count * structSize);
+        align(alignment, count * structSize);
+        prepend(data, count * structSize);
+        scalar(count, 4);
+        return size();
+    }
+
+    /** @brief Start a table */
+    void startTable() {
+        _fields.clear();
+        _tableStart = size();
+    }
+
+    /** @brief Add a scalar field to the table */
+    void addScalar(uint16_t id, uint64_t value, uint8_t width) {
+        scalar(value, width);
+        _fields.push_back(std::make_pair(id, size()));
+    }
+
+    /** @brief Add an offset field to the table */
+    void addOffset(uint16_t id, uint32_t target) {
+        offset(target);
+        _fields.push_back(std::make_pair(id, size()));
+    }
+
+    /**
+     * @brief End the table: prepend its vtable and point the table to it
+     * @return Handle of the table
+     */
+    uint32_t endTable() {
+        scalar(0, 4);  // soffset to the vtable, patched below
+        uint32_t table = size();
+        uint16_t slots = 0;
+        for (size_t i = 0; i < _fields.size(); i++) {
+            if (_fields[i].first + 1 > slots) {
+                slots = _fields[i].first + 1;
+            }
+        }
+        std::vector<uint16_t> entries(slots, 0);
+        for (size_t i = 0; i < _fields.size(); i++) {
+            entries[_fields[i].first] = (uint16_t)(table - _fields[i].second);
+        }
+        for (size_t i = slots; i-- > 0;) {
+            scalar(entries[i], 2);
+        }
+        scalar(table - _tableStart, 2);
+        scalar(4 + 2 * slots, 2);
+        uint32_t vtable = size();
+        // The vtable lies before the table: table - soffset = vtable
+        uint32_t soffset = vtable - table;
+        for (uint8_t i = 0; i < 4; i++) {
+            _bytes[table - 1 - i] = (uint8_t)(soffset >> (8 * i));
+        }
+        return table;
+    }
+
+    /**
+     * @brief Prepend the root offset and return the finished buffer
+     * @param root Handle of the root table
+     * @param out Receives the buffer, front to back
+     */
+    void finish(uint32_t root, std::vector<uint8_t>* out) {
+        align(_minAlign, 4);
+        offset(root);
+        out->assign(_bytes.rbegin(), _bytes.rend());
+    }
+
+private:
+    std::vector<uint8_t> _bytes;  ///< Buffer, back to front
+    uint32_t _minAlign;           ///< Largest alignment used
+    uint32_t _tableStart;         ///< Size when the current table started
+    std::vector<std::pair<uint16_t, uint32_t> > _fields;  ///< Fields of the current table (id, handle)
+};
+
+/**
+ * @brief Value width of a column type
+ */
+static uint8_t columnWidth(uint8_t type) {
+    switch (type) {
+        case ARROW_COLUMN_UINT8:
+            return 1;
+        case ARROW_COLUMN_UINT16:
+            return 2;
+        case ARROW_COLUMN_UINT32:
+        case ARROW_COLUMN_INT32:
+            return 4;
+        case ARROW_COLUMN_INT64:
+        case ARROW_COLUMN_FLOAT64:
+        case ARROW_COLUMN_TIMESTAMP_S:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Build the Schema table (shared by the schema message and the footer)
+ */
+static uint32_t buildSchema(FlatBuilder* fb, const std::vector<std::string>& names, const std::vector<uint8_t>& types,
+                            const std::vector<std::string>& metadata) {
+    std::vector<uint32_t> fields;
+    for (size_t i = 0; i < names.size(); i++) {
+        uint8_t type = types[i];
+        uint32_t timezone = type == ARROW_COLUMN_TIMESTAMP_S ? fb->string("UTC") : 0;
+
+        fb->startTable();
+        uint8_t typeType;
+        if (type == ARROW_COLUMN_FLOAT64) {
+            typeType = ARROW_TYPE_FLOAT;
+            fb->addScalar(0, ARROW_PRECISION_DOUBLE, 2);  // precision
+        } else if (type == ARROW_COLUMN_TIMESTAMP_S) {
+            typeType = ARROW_TYPE_TIMESTAMP;
+            fb->addOffset(1, timezone);
+            fb->addScalar(0, ARROW_UNIT_SECOND, 2);       // unit
+        } else {
+            typeType = ARROW_TYPE_INT;
+            fb->addScalar(0, 8 * columnWidth(type), 4);   // bitWidth
+            fb->addScalar(1, type == ARROW_COLUMN_INT32 || type == ARROW_COLUMN_INT64, 1);  // is_signed
+        }
+        uint32_t typeTable = fb->endTable();
+
+        uint32_t name = fb->string(names[i].c_str());
+        uint32_t children = fb->offsetVector(std::vector<uint32_t>());
+        fb->startTable();
+        fb->addOffset(0, name);
+        fb->addOffset(3, typeTable);
+        fb->addOffset(5, children);
+        fb->addScalar(2, typeType, 1);  // type_type
+        fb->addScalar(1, 1, 1);         // nullable
+        fields.push_back(fb->endTable());
+    }
+    uint32_t fieldVector = fb->offsetVector(fields);
+
+    std::vector<uint32_t> pairs;
+    for (size_t i = 0; i + 1 < metadata.size(); i += 2) {
+        uint32_t key = fb->string(metadata[i].c_str());
+        uint32_t value = fb->string(metadata[i + 1].c_str());
+        fb->startTable();
+        fb->addOffset(0, key);
+        fb->addOffset(1, value);
+        pairs.push_back(fb->endTable());
+    }
+    uint32_t pairVector = pairs.empty() ? 0 : fb->offsetVector(pairs);
+
+    fb->startTable();
+    fb->addOffset(1, fieldVector);
+    if (pairVector != 0) {
+        fb->addOffset(2, pairVector);
+    }
+    fb->addScalar(0, 0, 2);  // endianness: Little
+    return fb->endTable();
+}
+
+/**
+ * @brief Build a Message table
+ */
+static uint32_t buildMessage(FlatBuilder* fb, uint8_t headerType, uint32_t header, int64_t bodyLength) {
+    fb->startTable();
+    fb->addScalar(3, (uint64_t)bodyLength, 8);
+    fb->addOffset(2, header);
+    fb->addScalar(0, ARROW_METADATA_V5, 2);
+    fb->addScalar(1, headerType, 1);
+    return fb->endTable();
+}
+
+/**
+ * @brief Constructor, no columns
+ */
+ArrowWriter::ArrowWriter()
+    : _file(NULL), _offset(0), _batchRows(0), _rows(0), _totalRows(0), _ok(false) {
+}
+
+/**
+ * @brief Destructor, closes the file
+ */
+ArrowWriter::~ArrowWriter() {
+    close();
+}
+
+/**
+ * @brief Declare a column
+ */
+int ArrowWriter::addColumn(const char* name, uint8_t type) {
+    if (_file != NULL || columnWidth(type) == 0 || _columns.size() >= ARROW_WRITER_MAX_COLUMNS) {
+        return -1;
+    }
+    Column column;
+    column.name = name;
+    column.type = type;
+    column.width = columnWidth(type);
+    column.nulls = 0;
+    column.set = false;
+    _columns.push_back(column);
+    return (int)_columns.size() - 1;
+}
+
+/**
+ * @brief Add a key and value to the schema metadata
+ */
+void ArrowWriter::addMetadata(const char* key, const char* value) {
+    if (_file == NULL) {
+        _metadata.push_back(key);
+        _metadata.push_back(value);
+    }
+}
+
+/**
+ * @brief Create the file and write the schema
+ *
+ * The buffers of one batch are allocated here, once: appending rows never
+ * allocates, and the memory used does not grow with the file.
+ */
+bool ArrowWriter::open(const char* path, uint32_t batchRows) {
+    close();
+    if (_columns.empty() || batchRows == 0) {
+        return false;
+    }
+    _file = fopen(path, "wb");
+    if (_file == NULL) {
+        return false;
+    }
+    _batchRows = batchRows;
+    _rows = 0;
+    _totalRows = 0;
+    _offset = 0;
+    _ok = true;
+    _blocks.clear();
+    for (size_t i = 0; i < _columns.size(); i++) {
+        Column& column = _columns[i];
+        column.values.assign((size_t)batchRows * column.width, 0);
+        column.valid.assign((batchRows + 7) / 8, 0);
+        column.nulls = 0;
+        column.set = false;
+    }
+
+    static const uint8_t magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+    put(magic, sizeof(magic));
+
+    std::vector<std::string> names;
+    std::vector<uint8_t> types;
+    for (size_t i = 0; i < _columns.size(); i++) {
+        names.push_back(_columns[i].name);
+        types.push_back(_columns[i].type);
+    }
+    FlatBuilder fb;
+    uint32_t schema = buildSchema(&fb, names, types, _metadata);
+    std::vector<uint8_t> metadata;
+    fb.finish(buildMessage(&fb, ARROW_HEADER_SCHEMA, schema, 0), &metadata);
+    putMessage(metadata);
+    return _ok;
+}
+
+/**
+ * @brief Set an integer or timestamp column of the current row
+ */
+void ArrowWriter::setInt(int column, int64_t value) {
+    if (column < 0 || (size_t)column >= _columns.size() || _file == NULL) {
+        return;
+    }
+    Column& c = _columns[column];
+    if (c.type == ARROW_COLUMN_FLOAT64) {
+        setDouble(column, (double)value);
+        return;
+    }
+    storeLE(&c.values[(size_t)_rows * c.width], (uint64_t)value, c.width);
+    c.set = true;
+}
+
+/**
+ * @brief Set a float64 column of the current row
+ */
+void ArrowWriter::setDouble(int column, double value) {
+    if (column < 0 || (size_t)column >= _columns.size() || _file == NULL) {
+        return;
+    }
+    Column& c = _columns[column];
+    if (c.type != ARROW_COLUMN_FLOAT64) {
+        setInt(column, (int64_t)value);
+        return;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    storeLE(&c.values[(size_t)_rows * c.width], bits, c.width);
+    c.set = true;
+}
+
+/**
+ * @brief End the current row, writing a record batch when it is full
+ */
+bool ArrowWriter::endRow() {
+    if (_file == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < _columns.size(); i++) {
+        Column& c = _columns[i];
+        if (c.set) {
+            c.valid[_rows / 8] |= (uint8_t)(1 << (_rows % 8));
+            c.set = false;
+        } else {
+            memset(&c.values[(size_t)_rows * c.width], 0, c.width);
+            c.nulls++;
+        }
+    }
+    _rows++;
+    _totalRows++;
+    if (_rows == _batchRows) {
+        flushBatch();
+    }
+    return _ok;
+}
+
+/**
+ * @brief Write the last record batch and the footer, and close the file
+ *
+ * The footer repeats the schema and lists the record batches, which is what
+ * lets a reader reach any batch directly in a memory-mapped file.
+ */
+bool ArrowWriter::close() {
+    if (_file == NULL) {
+        return false;
+    }
+    if (_rows > 0) {
+        flushBatch();
+    }
+    static const uint8_t eos[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    put(eos, sizeof(eos));
+
+    std::vector<std::string> names;
+    std::vector<uint8_t> types;
+    for (size_t i = 0; i < _columns.size(); i++) {
+        names.push_back(_columns[i].name);
+        types.push_back(_columns[i].type);
+    }
+    FlatBuilder fb;
+    std::vector<uint8_t> blocks(_blocks.size() * 24, 0);
+    for (size_t i = 0; i < _blocks.size(); i++) {
+        storeLE(&blocks[i * 24], (uint64_t)_blocks[i].offset, 8);
+        storeLE(&blocks[i * 24 + 8], (uint32_t)_blocks[i].metadataLength, 4);
+        storeLE(&blocks[i * 24 + 16], (uint64_t)_blocks[i].bodyLength, 8);
+    }
+    uint32_t batches = fb.structVector(blocks.empty() ? NULL : &blocks[0], (uint32_t)_blocks.size(), 24, 8);
+    uint32_t dictionaries = fb.structVector(NULL, 0, 24, 8);
+    uint32_t schema = buildSchema(&fb, names, types, _metadata);
+    fb.startTable();
+    fb.addOffset(1, schema);
+    fb.addOffset(2, dictionaries);
+    fb.addOffset(3, batches);
+    fb.addScalar(0, ARROW_METADATA_V5, 2);
+    std::vector<uint8_t> footer;
+    fb.finish(fb.endTable(), &footer);
+    put(&footer[0], footer.size());
+
+    uint8_t trailer[10];
+    storeLE(trailer, (uint32_t)footer.size(), 4);
+    memcpy(&trailer[4], "ARROW1", 6);
+    put(trailer, sizeof(trailer));
+
+    if (fclose(_file) != 0) {
+        _ok = false;
+    }
+    _file = NULL;
+    for (size_t i = 0; i < _columns.size(); i++) {
+        std::vector<uint8_t>().swap(_columns[i].values);
+        std::vector<uint8_t>().swap(_columns[i].valid);
+    }
+    return _ok;
+}
+
+/**
+ * @brief Get the number of rows written
+ */
+uint64_t ArrowWriter::getRows() const {
+    return _totalRows;
+}
+
+/**
+ * @brief Get the number of record batches written
+ */
+uint32_t ArrowWriter::getBatches() const {
+    return (uint32_t)_blocks.size();
+}
+
+/**
+ * @brief Write bytes to the file
+ */
+void ArrowWriter::put(const void* data, size_t length) {
+    if (_ok && length > 0 && fwrite(data, 1, length, _file) != length) {
+        _ok = false;
+    }
+    _offset += length;
+}
+
+/**
+ * @brief Write zero bytes up to a multiple of 8
+ */
+void ArrowWriter::pad8() {
+    static const uint8_t zeros[8] = {0};
+    put(zeros, (size_t)((8 - _offset % 8) % 8));
+}
+
+/**
+ * @brief Write an encapsulated message
+ *
+ * The metadata is padded so that the body that follows starts on an 8-byte
+ * boundary; the length written includes that padding.
+ */
+int32_t ArrowWriter::putMessage(const std::vector<uint8_t>& metadata) {
+    uint32_t padded = (uint32_t)((metadata.size() + 7) / 8 * 8);
+    uint8_t prefix[8];
+    storeLE(prefix, ARROW_CONTINUATION, 4);
+    storeLE(&prefix[4], padded, 4);
+    put(prefix, sizeof(prefix));
+    put(&metadata[0], metadata.size());
+    pad8();
+    return (int32_t)(sizeof(prefix) + padded);
+}
+
+/**
+ * @brief Write the rows of the current batch as a record batch
+ *
+ * Each column has a validity buffer (empty when the column has no null in
+ * the batch) and a value buffer, both padded to 8 bytes in the body.
+ */
+void ArrowWriter::flushBatch() {
+    std::vector<uint8_t> nodes(_columns.size() * 16, 0);
+    std::vector<uint8_t> buffers(_columns.size() * 32, 0);
+    int64_t bodyLength = 0;
+    for (size_t i = 0; i < _columns.size(); i++) {
+        const Column& c = _columns[i];
+        storeLE(&nodes[i * 16], _rows, 8);
+        storeLE(&nodes[i * 16 + 8], c.nulls, 8);
+
+        uint32_t validLength = c.nulls > 0 ? (_rows + 7) / 8 : 0;
+        storeLE(&buffers[i * 32], (uint64_t)bodyLength, 8);
+        storeLE(&buffers[i * 32 + 8], validLength, 8);
+        bodyLength += (validLength + 7) / 8 * 8;
+
+        uint64_t valueLength = (uint64_t)_rows * c.width;
+        storeLE(&buffers[i * 32 + 16], (uint64_t)bodyLength, 8);
+        storeLE(&buffers[i * 32 + 24], valueLength, 8);
+        bodyLength += (valueLength + 7) / 8 * 8;
+    }
+
+    FlatBuilder fb;
+    uint32_t bufferVector = fb.structVector(&buffers[0], (uint32_t)_columns.size() * 2, 16, 8);
+    uint32_t nodeVector = fb.structVector(&nodes[0], (uint32_t)_columns.size(), 16, 8);
+    fb.startTable();
+    fb.addScalar(0, _rows, 8);
+    fb.addOffset(1, nodeVector);
+    fb.addOffset(2, bufferVector);
+    uint32_t batch = fb.endTable();
+    std::vector<uint8_t> metadata;
+    fb.finish(buildMessage(&fb, ARROW_HEADER_BATCH, batch, bodyLength), &metadata);
+
+    Block block;
+    block.offset = _offset;
+    block.metadataLength = putMessage(metadata);
+    block.bodyLength = bodyLength;
+    for (size_t i = 0; i < _columns.size(); i++) {
+        Column& c = _columns[i];
+        if (c.nulls > 0) {
+            put(&c.valid[0], (_rows + 7) / 8);
+            pad8();
+        }
+        put(&c.values[0], (size_t)_rows * c.width);
+        pad8();
+        memset(&c.valid[0], 0, c.valid.size());
+        c.nulls = 0;
+    }
+    _blocks.push_back(block);
+    _rows = 0;
+}
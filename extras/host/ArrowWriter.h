@@ -0,0 +1,194 @@
+/**
+ * @file ArrowWriter.h
+ * @brief Streaming writer of Arrow IPC files (host tools)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Writes the Arrow IPC file format (Arrow columnar format, metadata V5)
+ * without the Arrow libraries: the FlatBuffers metadata is encoded by hand.
+ * Rows are buffered column by column and written as a record batch every
+ * batchRows rows, so memory stays bounded by one batch whatever the number
+ * of rows. Buffers are 8-byte aligned and little-endian: pyarrow, pandas,
+ * Polars and DuckDB open the file as is, and memory-map it without copying.
+ */
+
+#ifndef ARROWWRITER_H
+#define ARROWWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * @defgroup ArrowColumnTypes Arrow Column Types
+ * @{
+ */
+#define ARROW_COLUMN_UINT8        0  ///< uint8
+#define ARROW_COLUMN_UINT16       1  ///< uint16
+#define ARROW_COLUMN_UINT32       2  ///< uint32
+#define ARROW_COLUMN_INT32        3  ///< int32
+#define ARROW_COLUMN_INT64        4  ///< int64
+#define ARROW_COLUMN_FLOAT64      5  ///< float64 (double)
+#define ARROW_COLUMN_TIMESTAMP_S  6  ///< timestamp[s, tz=UTC], Unix time in seconds
+/** @} */
+
+/**
+ * @defgroup ArrowWriterConfig Arrow Writer Configuration
+ * @{
+ */
+#define ARROW_WRITER_MAX_COLUMNS   128    ///< Most columns of a file
+#define ARROW_WRITER_DEFAULT_BATCH 65536  ///< Rows per record batch
+/** @} */
+
+/**
+ * @class ArrowWriter
+ * @brief Writes rows of typed, nullable columns to an Arrow IPC file
+ *
+ * Declare the columns with addColumn() (and optional schema metadata), then
+ * open() the file. For each row, set the columns with setInt() or
+ * setDouble() and call endRow(); a column not set in a row is null. close()
+ * writes the last batch and the footer; a file not closed is not readable.
+ */
+class ArrowWriter {
+public:
+    /**
+     * @brief Constructor, no columns
+     */
+    ArrowWriter();
+
+    /**
+     * @brief Destructor, closes the file
+     */
+    ~ArrowWriter();
+
+    /**
+     * @brief Declare a column (before open())
+     * @param name Column name
+     * @param type Column type (ARROW_COLUMN_*)
+     * @return Column index, or -1 if the file is open, the type is unknown or there are too many columns
+     */
+    int addColumn(const char* name, uint8_t type);
+
+    /**
+     * @brief Add a key and value to the schema metadata (before open())
+     * @param key Key
+     * @param value Value
+     */
+    void addMetadata(const char* key, const char* value);
+
+    /**
+     * @brief Create the file and write the schema
+     * @param path File path (replaced if it exists)
+     * @param batchRows Rows per record batch (default: ARROW_WRITER_DEFAULT_BATCH)
+     * @return true if written, false if there are no columns or on an I/O error (see errno)
+     */
+    bool open(const char* path, uint32_t batchRows = ARROW_WRITER_DEFAULT_BATCH);
+
+    /**
+     * @brief Set an integer or timestamp column of the current row
+     * @param column Column index
+     * @param value Value (truncated to the column type; converted for a float64 column)
+     */
+    void setInt(int column, int64_t value);
+
+    /**
+     * @brief Set a float64 column of the current row
+     * @param column Column index
+     * @param value Value (truncated for an integer column)
+     */
+    void setDouble(int column, double value);
+
+    /**
+     * @brief End the current row, writing a record batch when it is full
+     * @return true if stored, false if the file is not open or on an I/O error
+     */
+    bool endRow();
+
+    /**
+     * @brief Write the last record batch and the footer, and close the file
+     * @return true if the file is complete, false if it was not open or on an I/O error
+     */
+    bool close();
+
+    /**
+     * @brief Get the number of rows written
+     * @return Rows ended since open()
+     */
+    uint64_t getRows() const;
+
+    /**
+     * @brief Get the number of record batches written
+     * @return Record batches, including the last one after close()
+     */
+    uint32_t getBatches() const;
+
+private:
+    /**
+     * @struct Column
+     * @brief A declared column and the buffers of the current batch
+     */
+    struct Column {
+        std::string name;             ///< Column name
+        uint8_t type;                 ///< Column type (ARROW_COLUMN_*)
+        uint8_t width;                ///< Value width in bytes
+        std::vector<uint8_t> values;  ///< Values of the batch (batchRows * width)
+        std::vector<uint8_t> valid;   ///< Validity bitmap of the batch
+        uint32_t nulls;               ///< Null values in the batch
+        bool set;                     ///< Set in the current row
+    };
+
+    /**
+     * @struct Block
+     * @brief Position of a record batch, kept for the footer
+     */
+    struct Block {
+        int64_t offset;               ///< File offset of the message
+        int32_t metadataLength;       ///< Prefix and metadata length
+        int64_t bodyLength;           ///< Body length
+    };
+
+    std::vector<Column> _columns;     ///< Declared columns
+    std::vector<std::string> _metadata;  ///< Schema metadata, key and value pairs
+    std::vector<Block> _blocks;       ///< Record batches written
+    FILE* _file;                      ///< Open file (NULL if closed)
+    int64_t _offset;                  ///< Bytes written
+    uint32_t _batchRows;              ///< Rows per record batch
+    uint32_t _rows;                   ///< Rows in the current batch
+    uint64_t _totalRows;              ///< Rows written since open()
+    bool _ok;                         ///< No I/O error since open()
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Write bytes to the file
+     * @param data Bytes
+     * @param length Length
+     */
+    void put(const void* data, size_t length);
+
+    /**
+     * @brief Write zero bytes up to a multiple of 8
+     */
+    void pad8();
+
+    /**
+     * @brief Write an encapsulated message: continuation marker, metadata length, metadata
+     * @param metadata Message flatbuffer
+     * @return Metadata length with its prefix and padding
+     */
+    int32_t putMessage(const std::vector<uint8_t>& metadata);
+
+    /**
+     * @brief Write the rows of the current batch as a record batch
+     */
+    void flushBatch();
+
+    /** @} */
+};
+
+#endif // ARROWWRITER_H
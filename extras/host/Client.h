@@ -0,0 +1,53 @@
+/**
+ * @file Client.h
+ * @brief Network client interface of the Arduino core for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef HOST_CLIENT_H
+#define HOST_CLIENT_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+/**
+ * @class Client
+ * @brief Connection-oriented byte stream (used by the Modbus-TCP transports)
+ */
+class Client : public Stream {
+public:
+    /**
+     * @brief Connect to a server
+     * @param ip Server address
+     * @param port Server port
+     * @return 1 if connected, 0 otherwise
+     */
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+
+    /**
+     * @brief Connect to a server by name
+     * @param host Server host name
+     * @param port Server port
+     * @return 1 if connected, 0 otherwise
+     */
+    virtual int connect(const char* host, uint16_t port) = 0;
+
+    /**
+     * @brief Check whether the connection is up
+     * @return Non-zero if connected
+     */
+    virtual uint8_t connected() = 0;
+
+    /**
+     * @brief Close the connection
+     */
+    virtual void stop() = 0;
+
+    /**
+     * @brief Check whether the client is usable
+     */
+    virtual operator bool() = 0;
+};
+
+#endif // HOST_CLIENT_H
@@ -0,0 +1,88 @@
+/**
+ * @file HostArduino.cpp
+ * @brief Implementation of the Arduino core subset for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "Arduino.h"
+#include "HostRealtime.h"
+
+static const uint64_t START_US = hostMonotonicUs();  ///< Process start time
+
+/**
+ * @brief Milliseconds since the process started
+ */
+uint32_t millis() {
+    return (uint32_t)((hostMonotonicUs() - START_US) / 1000);
+}
+
+/**
+ * @brief Microseconds since the process started
+ */
+uint32_t micros() {
+    return (uint32_t)(hostMonotonicUs() - START_US);
+}
+
+/**
+ * @brief Sleep for a number of milliseconds
+ */
+void delay(unsigned long ms) {
+    hostSleepUntil(hostMonotonicUs() + (uint64_t)ms * 1000ULL);
+}
+
+/**
+ * @brief Sleep for a number of microseconds
+ */
+void delayMicroseconds(unsigned int us) {
+    hostSleepUntil(hostMonotonicUs() + us);
+}
+
+/**
+ * @brief Let other threads run
+ *
+ * The default 100 us is shorter than one byte at 115200 baud, so a loop around
+ * poll() still sees every response as soon as it is complete. The wait mode and
+ * length come from hostRealtimeApply().
+ */
+void yield() {
+    hostYield();
+}
+
+/**
+ * @brief Set a pin mode (no effect)
+ */
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+/**
+ * @brief Set a pin level (no effect)
+ */
+void digitalWrite(uint8_t pin, uint8_t level) {
+    (void)pin;
+    (void)level;
+}
+
+/**
+ * @brief Read a pin level
+ */
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    return LOW;
+}
+
+/**
+ * @brief Write a buffer one byte at a time
+ */
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size--) {
+        if (write(*buffer++) == 0) {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
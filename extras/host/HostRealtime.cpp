@@ -0,0 +1,266 @@
+/**
+ * @file HostRealtime.cpp
+ * @brief Implementation of real-time scheduling and deadline waits for host poller threads
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "HostRealtime.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_PREFAULT_STACK 65536  ///< Stack touched after mlockall() so it is resident
+
+static uint8_t waitMode = HOST_WAIT_NANOSLEEP;      ///< Wait mode of the process
+static uint32_t yieldUs = HOST_YIELD_US;            ///< Wait of yield()
+static char lastError[96] = "";                     ///< Last hostRealtimeApply() failure
+static __thread HostJitter jitter;                  ///< Wake-up lateness of the thread
+static __thread int timerFd = -1;                   ///< timerfd of the thread (HOST_WAIT_TIMERFD)
+
+/**
+ * @brief Convert a monotonic time in microseconds
+ */
+static struct timespec toTimespec(uint64_t us) {
+    struct timespec ts;
+    ts.tv_sec = us / 1000000ULL;
+    ts.tv_nsec = (us % 1000000ULL) * 1000;
+    return ts;
+}
+
+/**
+ * @brief Account a wait that ended on its deadline
+ */
+static uint32_t record(uint64_t deadlineUs) {
+    uint64_t now = hostMonotonicUs();
+    uint32_t late = now > deadlineUs ? (uint32_t)(now - deadlineUs) : 0;
+    jitter.waits++;
+    jitter.totalUs += late;
+    jitter.maxUs = late > jitter.maxUs ? late : jitter.maxUs;
+    return late;
+}
+
+/**
+ * @brief Remember which step failed
+ */
+static bool fail(const char* step) {
+    snprintf(lastError, sizeof(lastError), "%s: %s", step, strerror(errno));
+    return false;
+}
+
+/**
+ * @brief Fill a configuration with the defaults
+ */
+void hostRealtimeDefaults(HostRealtimeConfig* config) {
+    config->cpu = HOST_NO_CPU;
+    config->priority = 0;
+    config->lockMemory = false;
+    config->waitMode = HOST_WAIT_NANOSLEEP;
+    config->yieldUs = HOST_YIELD_US;
+}
+
+/**
+ * @brief Parse one real-time option
+ */
+uint8_t hostRealtimeOption(int argc, char** argv, int* index, HostRealtimeConfig* config) {
+    const char* arg = argv[*index];
+    const char* value = (*index + 1 < argc) ? argv[*index + 1] : NULL;
+    char* end = NULL;
+
+    if (strcmp(arg, "--mlock") == 0) {
+        config->lockMemory = true;
+        return HOST_OPTION_OK;
+    }
+    bool known = strcmp(arg, "--cpu") == 0 || strcmp(arg, "--fifo") == 0 ||
+                 strcmp(arg, "--wait") == 0 || strcmp(arg, "--yield-us") == 0;
+    if (!known) {
+        return HOST_OPTION_NONE;
+    }
+    if (value == NULL) {
+        return HOST_OPTION_INVALID;
+    }
+    (*index)++;
+
+    if (strcmp(arg, "--wait") == 0) {
+        if (strcmp(value, "nanosleep") == 0) {
+            config->waitMode = HOST_WAIT_NANOSLEEP;
+        } else if (strcmp(value, "timerfd") == 0) {
+            config->waitMode = HOST_WAIT_TIMERFD;
+        } else if (strcmp(value, "spin") == 0) {
+            config->waitMode = HOST_WAIT_SPIN;
+        } else {
+            return HOST_OPTION_INVALID;
+        }
+        return HOST_OPTION_OK;
+    }
+
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < 0) {
+        return HOST_OPTION_INVALID;
+    }
+    if (strcmp(arg, "--cpu") == 0) {
+        config->cpu = (int)number;
+    } else if (strcmp(arg, "--fifo") == 0) {
+        if (number < 1 || number > 99) {
+            return HOST_OPTION_INVALID;
+        }
+        config->priority = (int)number;
+    } else {
+        config->yieldUs = (uint32_t)number;
+    }
+    return HOST_OPTION_OK;
+}
+
+/**
+ * @brief Apply a configuration to the calling thread
+ *
+ * Memory is locked first so that the stack prefault and everything after it
+ * runs on resident pages; the priority comes last so a failure of the other
+ * steps never leaves a SCHED_FIFO thread behind.
+ */
+bool hostRealtimeApply(const HostRealtimeConfig* config) {
+    waitMode = config->waitMode;
+    yieldUs = config->yieldUs;
+    lastError[0] = '\0';
+
+    if (config->lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            return fail("mlockall");
+        }
+        volatile uint8_t stack[HOST_PREFAULT_STACK];
+        memset((void*)stack, 0, sizeof(stack));
+    }
+
+    if (config->cpu != HOST_NO_CPU) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            return fail("sched_setaffinity");
+        }
+    }
+
+    if (config->priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            return fail("sched_setscheduler");
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Describe the last hostRealtimeApply() failure
+ */
+const char* hostRealtimeError() {
+    return lastError;
+}
+
+/**
+ * @brief Monotonic time in microseconds
+ */
+uint64_t hostMonotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Wait until an absolute monotonic time
+ *
+ * An absolute deadline does not drift when the thread is preempted between
+ * computing the wait and starting it, unlike a relative nanosleep(). The
+ * timerfd mode falls back to clock_nanosleep() if no timer can be created.
+ */
+uint32_t hostSleepUntil(uint64_t deadlineUs) {
+    struct timespec ts = toTimespec(deadlineUs);
+
+    if (waitMode == HOST_WAIT_SPIN) {
+        while (hostMonotonicUs() < deadlineUs) {
+            sched_yield();
+        }
+        return record(deadlineUs);
+    }
+
+    if (waitMode == HOST_WAIT_TIMERFD) {
+        if (timerFd < 0) {
+            timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        }
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value = ts;
+        uint64_t expirations;
+        if (timerFd >= 0 && timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+            // A deadline already past still fires once, so read() always returns
+            while (read(timerFd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {
+            }
+            return record(deadlineUs);
+        }
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+    return record(deadlineUs);
+}
+
+/**
+ * @brief Give the CPU away for the configured yield wait
+ */
+void hostYield() {
+    hostSleepUntil(hostMonotonicUs() + yieldUs);
+}
+
+/**
+ * @brief Wait for file descriptors with microsecond resolution
+ *
+ * ppoll() takes the timeout as a timespec, so waits shorter than the 1 ms
+ * resolution of poll() are kept. In spin mode descriptors are checked without
+ * sleeping.
+ */
+int hostPoll(struct pollfd* fds, nfds_t count, uint32_t timeoutUs, uint32_t* latenessUs) {
+    uint64_t deadline = hostMonotonicUs() + timeoutUs;
+    int result;
+    if (latenessUs != NULL) {
+        *latenessUs = 0;
+    }
+
+    if (waitMode == HOST_WAIT_SPIN) {
+        struct timespec zero = { 0, 0 };
+        while ((result = ppoll(fds, count, &zero, NULL)) == 0 && hostMonotonicUs() < deadline) {
+            sched_yield();
+        }
+    } else {
+        struct timespec ts = toTimespec(timeoutUs);
+        result = ppoll(fds, count, &ts, NULL);
+    }
+
+    if (result == 0) {
+        uint32_t late = record(deadline);
+        if (latenessUs != NULL) {
+            *latenessUs = late;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Clear the wake-up lateness accumulators of the calling thread
+ */
+void hostJitterReset() {
+    memset(&jitter, 0, sizeof(jitter));
+}
+
+/**
+ * @brief Get the wake-up lateness accumulators of the calling thread
+ */
+void hostJitterGet(HostJitter* out) {
+    *out = jitter;
+}
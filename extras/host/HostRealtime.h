@@ -0,0 +1,152 @@
+/**
+ * @file HostRealtime.h
+ * @brief Real-time scheduling and deadline waits for host poller threads (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A poller descheduled in the middle of an exchange comes back late: the
+ * response sits in the driver while the transport clock runs, and waits end
+ * milliseconds after their deadline. This module lets the thread that polls a
+ * bus pin itself to a CPU, run under SCHED_FIFO and lock its memory, and makes
+ * every wait of the host backend (yield(), delay(), PosixSerial::waitReadable())
+ * end at an absolute deadline with clock_nanosleep() or a timerfd.
+ *
+ * Each wait records how late the thread woke up past its deadline. The
+ * accumulators are per thread: reset them before a transaction and read them
+ * after it to get the scheduling jitter of that transaction.
+ */
+
+#ifndef HOST_REALTIME_H
+#define HOST_REALTIME_H
+
+#include <stdint.h>
+#include <poll.h>
+
+/**
+ * @defgroup HostWaitModes Wait Modes
+ * @{
+ */
+#define HOST_WAIT_SPIN       0  ///< sched_yield() until the deadline (burns the CPU)
+#define HOST_WAIT_NANOSLEEP  1  ///< clock_nanosleep() to an absolute deadline (default)
+#define HOST_WAIT_TIMERFD    2  ///< One-shot absolute timerfd per wait
+/** @} */
+
+/**
+ * @defgroup HostRealtimeDefaults Real-Time Defaults
+ * @{
+ */
+#ifndef HOST_YIELD_US
+#define HOST_YIELD_US        100  ///< Wait of yield() (shorter than one byte at 115200 baud)
+#endif
+#define HOST_NO_CPU          -1   ///< No CPU affinity
+#define HOST_OPTION_NONE     0    ///< Argument is not a real-time option
+#define HOST_OPTION_OK       1    ///< Option (and its value) taken
+#define HOST_OPTION_INVALID  2    ///< Option with a missing or invalid value
+/** @} */
+
+/**
+ * @brief Command-line help of the options parsed by hostRealtimeOption()
+ */
+#define HOST_REALTIME_USAGE \
+    "  --cpu N              Pin the poller thread to CPU N\n" \
+    "  --fifo PRIO          Run the poller under SCHED_FIFO at priority 1-99\n" \
+    "  --mlock              Lock memory (no page faults during transactions)\n" \
+    "  --wait MODE          Waits: nanosleep (default), timerfd or spin\n" \
+    "  --yield-us US        Wait of each yield (default: 100)\n"
+
+/**
+ * @struct HostRealtimeConfig
+ * @brief Scheduling of a poller thread
+ */
+struct HostRealtimeConfig {
+    int cpu;                  ///< CPU to pin the thread to, or HOST_NO_CPU
+    int priority;             ///< SCHED_FIFO priority 1-99, or 0 to keep the default policy
+    bool lockMemory;          ///< Lock current and future pages and prefault the stack
+    uint8_t waitMode;         ///< Wait mode (HOST_WAIT_*)
+    uint32_t yieldUs;         ///< Wait of yield() in microseconds
+};
+
+/**
+ * @struct HostJitter
+ * @brief Wake-up lateness of the waits of one thread
+ */
+struct HostJitter {
+    uint32_t waits;           ///< Waits that ended on their deadline
+    uint32_t maxUs;           ///< Latest wake-up past a deadline (us)
+    uint64_t totalUs;         ///< Sum of the wake-up lateness (us)
+};
+
+/**
+ * @brief Fill a configuration with the defaults (no affinity, default policy, nanosleep waits)
+ * @param config Configuration to fill
+ */
+void hostRealtimeDefaults(HostRealtimeConfig* config);
+
+/**
+ * @brief Parse one real-time option (see HOST_REALTIME_USAGE)
+ * @param argc Argument count
+ * @param argv Arguments
+ * @param index Index of the argument, advanced past its value when one is taken
+ * @param config Configuration receiving the option
+ * @return HOST_OPTION_NONE, HOST_OPTION_OK or HOST_OPTION_INVALID
+ */
+uint8_t hostRealtimeOption(int argc, char** argv, int* index, HostRealtimeConfig* config);
+
+/**
+ * @brief Apply a configuration to the calling thread
+ * @param config Configuration
+ * @return true if every setting took effect; otherwise hostRealtimeError() names the one that failed
+ *
+ * SCHED_FIFO and memory locking need CAP_SYS_NICE and CAP_IPC_LOCK (or root, or
+ * matching RLIMIT_RTPRIO and RLIMIT_MEMLOCK limits). The wait mode applies to
+ * the whole process.
+ */
+bool hostRealtimeApply(const HostRealtimeConfig* config);
+
+/**
+ * @brief Describe the last hostRealtimeApply() failure
+ * @return Step and system error, e.g. "sched_setscheduler: Operation not permitted"
+ */
+const char* hostRealtimeError();
+
+/**
+ * @brief Monotonic time in microseconds
+ * @return CLOCK_MONOTONIC time in microseconds
+ */
+uint64_t hostMonotonicUs();
+
+/**
+ * @brief Wait until an absolute monotonic time with the configured wait mode
+ * @param deadlineUs Deadline (hostMonotonicUs() time)
+ * @return Wake-up lateness past the deadline in microseconds
+ */
+uint32_t hostSleepUntil(uint64_t deadlineUs);
+
+/**
+ * @brief Give the CPU away for the configured yield wait (yield() of the host backend)
+ */
+void hostYield();
+
+/**
+ * @brief Wait for file descriptors with microsecond resolution
+ * @param fds Descriptors, as for poll()
+ * @param count Number of descriptors
+ * @param timeoutUs Timeout in microseconds
+ * @param latenessUs Receives the wake-up lateness if the wait timed out, 0 otherwise (may be NULL)
+ * @return As poll(): ready descriptors, 0 on timeout, -1 on error
+ */
+int hostPoll(struct pollfd* fds, nfds_t count, uint32_t timeoutUs, uint32_t* latenessUs);
+
+/**
+ * @brief Clear the wake-up lateness accumulators of the calling thread
+ */
+void hostJitterReset();
+
+/**
+ * @brief Get the wake-up lateness accumulators of the calling thread
+ * @param jitter Receives the accumulators since the last hostJitterReset()
+ */
+void hostJitterGet(HostJitter* jitter);
+
+#endif // HOST_REALTIME_H
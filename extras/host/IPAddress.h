@@ -0,0 +1,51 @@
+/**
+ * @file IPAddress.h
+ * @brief IPv4 address type of the Arduino core for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+
+#include "Arduino.h"
+
+/**
+ * @class IPAddress
+ * @brief IPv4 address
+ */
+class IPAddress {
+public:
+    /**
+     * @brief Constructor for 0.0.0.0
+     */
+    IPAddress() {
+        _bytes[0] = _bytes[1] = _bytes[2] = _bytes[3] = 0;
+    }
+
+    /**
+     * @brief Constructor from four octets
+     * @param a First octet
+     * @param b Second octet
+     * @param c Third octet
+     * @param d Fourth octet
+     */
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        _bytes[0] = a;
+        _bytes[1] = b;
+        _bytes[2] = c;
+        _bytes[3] = d;
+    }
+
+    /**
+     * @brief Get one octet
+     * @param index Octet index (0 = first)
+     * @return Octet value
+     */
+    uint8_t operator[](int index) const { return _bytes[index]; }
+
+private:
+    uint8_t _bytes[4];  ///< Octets, first one first
+};
+
+#endif // HOST_IPADDRESS_H
@@ -0,0 +1,128 @@
+/**
+ * @file PZEMFields.cpp
+ * @brief Named measurements of each model, decoded from snapshots (host tools)
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMFields.h"
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Fields of every model, grouped by model in identifier order
+ *
+ * Resolutions follow the device classes, in one unit per field name: energy
+ * is in Wh on every model (the PZEM-6L24 counts 0.1 kWh). The PZEM-6L24
+ * frequency and power factors are per phase in the registers; only phase A
+ * frequency and the combined power factor get unsuffixed names.
+ */
+static const PZEMField PZEM_FIELDS[] = {
+    { PZEM_MODEL_004T, "voltage",        0x00, PZEM_FIELD_U16,       0.1f,   1 },
+    { PZEM_MODEL_004T, "current",        0x01, PZEM_FIELD_U32,       0.001f, 3 },
+    { PZEM_MODEL_004T, "power",          0x03, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_004T, "energy",         0x05, PZEM_FIELD_U32,       1.0f,   0 },
+    { PZEM_MODEL_004T, "frequency",      0x07, PZEM_FIELD_U16,       0.1f,   1 },
+    { PZEM_MODEL_004T, "pf",             0x08, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_004T, "alarm",          0x09, PZEM_FIELD_U16,       1.0f,   0 },
+    { PZEM_MODEL_003,  "voltage",        0x00, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_003,  "current",        0x01, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_003,  "power",          0x02, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_003,  "energy",         0x04, PZEM_FIELD_U32,       1.0f,   0 },
+    { PZEM_MODEL_003,  "high_alarm",     0x06, PZEM_FIELD_U16,       1.0f,   0 },
+    { PZEM_MODEL_003,  "low_alarm",      0x07, PZEM_FIELD_U16,       1.0f,   0 },
+    { PZEM_MODEL_017,  "voltage",        0x00, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_017,  "current",        0x01, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_017,  "power",          0x02, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_017,  "energy",         0x04, PZEM_FIELD_U32,       1.0f,   0 },
+    { PZEM_MODEL_017,  "high_alarm",     0x06, PZEM_FIELD_U16,       1.0f,   0 },
+    { PZEM_MODEL_017,  "low_alarm",      0x07, PZEM_FIELD_U16,       1.0f,   0 },
+    { PZEM_MODEL_6L24, "voltage_a",      0x00, PZEM_FIELD_U16,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "voltage_b",      0x01, PZEM_FIELD_U16,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "voltage_c",      0x02, PZEM_FIELD_U16,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "current_a",      0x03, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_6L24, "current_b",      0x04, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_6L24, "current_c",      0x05, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_6L24, "frequency",      0x06, PZEM_FIELD_U16,       0.01f,  2 },
+    { PZEM_MODEL_6L24, "power_a",        0x0E, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "power_b",        0x10, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "power_c",        0x12, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "power",          0x20, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "reactive_power", 0x22, PZEM_FIELD_S32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "apparent_power", 0x24, PZEM_FIELD_U32,       0.1f,   1 },
+    { PZEM_MODEL_6L24, "pf_a",           0x26, PZEM_FIELD_HIGH_BYTE, 0.01f,  2 },
+    { PZEM_MODEL_6L24, "pf_b",           0x26, PZEM_FIELD_LOW_BYTE,  0.01f,  2 },
+    { PZEM_MODEL_6L24, "pf_c",           0x27, PZEM_FIELD_HIGH_BYTE, 0.01f,  2 },
+    { PZEM_MODEL_6L24, "pf",             0x27, PZEM_FIELD_LOW_BYTE,  0.01f,  2 },
+    { PZEM_MODEL_6L24, "energy",         0x3A, PZEM_FIELD_U32,       100.0f, 0 },
+};
+
+#define PZEM_FIELD_COUNT (sizeof(PZEM_FIELDS) / sizeof(PZEM_FIELDS[0]))
+
+/**
+ * @brief Get the fields of every model
+ */
+const PZEMField* pzemFieldTable(uint8_t* count) {
+    *count = PZEM_FIELD_COUNT;
+    return PZEM_FIELDS;
+}
+
+/**
+ * @brief Get the fields of one model
+ */
+const PZEMField* pzemFields(uint8_t model, uint8_t* count) {
+    const PZEMField* first = NULL;
+    *count = 0;
+    for (size_t i = 0; i < PZEM_FIELD_COUNT; i++) {
+        if (PZEM_FIELDS[i].model == model) {
+            if (first == NULL) {
+                first = &PZEM_FIELDS[i];
+            }
+            (*count)++;
+        }
+    }
+    return first;
+}
+
+/**
+ * @brief Find a field of a model by name
+ */
+const PZEMField* pzemFieldByName(uint8_t model, const char* name) {
+    for (size_t i = 0; i < PZEM_FIELD_COUNT; i++) {
+        if (PZEM_FIELDS[i].model == model && strcmp(PZEM_FIELDS[i].name, name) == 0) {
+            return &PZEM_FIELDS[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Decode a field from a snapshot
+ */
+double pzemFieldValue(const PZEMField* field, const PZEMSnapshot* snapshot) {
+    const uint16_t* regs = snapshot->regs;
+    uint32_t raw32 = ((uint32_t)regs[field->reg + 1] << 16) | regs[field->reg];
+    switch (field->type) {
+        case PZEM_FIELD_U32:       return raw32 * (double)field->scale;
+        case PZEM_FIELD_S32:       return (int32_t)raw32 * (double)field->scale;
+        case PZEM_FIELD_HIGH_BYTE: return (regs[field->reg] >> 8) * (double)field->scale;
+        case PZEM_FIELD_LOW_BYTE:  return (regs[field->reg] & 0xFF) * (double)field->scale;
+        default:                   return regs[field->reg] * (double)field->scale;
+    }
+}
+
+/**
+ * @brief Find a model by name
+ */
+uint8_t pzemModelByName(const char* name) {
+    if (strncasecmp(name, "PZEM-", 5) == 0) {
+        name += 5;
+    }
+    for (uint8_t model = 0; model < PZEM_MODEL_COUNT; model++) {
+        if (strcasecmp(name, pzemModelInfo(model)->name + 5) == 0) {
+            return model;
+        }
+    }
+    return PZEM_MODEL_UNKNOWN;
+}
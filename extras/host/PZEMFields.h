@@ -0,0 +1,82 @@
+/**
+ * @file PZEMFields.h
+ * @brief Named measurements of each model, decoded from snapshots (host tools)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Shared by pzemctl and pzemd so that both print the same field names, units
+ * and precision. A field name has the same unit on every model (energy in Wh),
+ * so the models can share a column. Like PZEMModel.h, this header has no Arduino dependency.
+ */
+
+#ifndef PZEMFIELDS_H
+#define PZEMFIELDS_H
+
+#include <stdint.h>
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMFieldTypes Field Register Types
+ * @{
+ */
+#define PZEM_FIELD_U16        0  ///< One register
+#define PZEM_FIELD_U32        1  ///< Two registers, low word first
+#define PZEM_FIELD_S32        2  ///< Two registers, low word first, signed
+#define PZEM_FIELD_HIGH_BYTE  3  ///< High byte of one register
+#define PZEM_FIELD_LOW_BYTE   4  ///< Low byte of one register
+#define PZEM_FIELD_MAX_PER_MODEL 18  ///< Most fields of one model (PZEM-6L24)
+/** @} */
+
+/**
+ * @struct PZEMField
+ * @brief One measurement of a model snapshot
+ */
+struct PZEMField {
+    uint8_t model;            ///< Model identifier (PZEM_MODEL_*)
+    const char* name;         ///< Field name (e.g. "voltage", "power_a")
+    uint8_t reg;              ///< First input register
+    uint8_t type;             ///< Register type (PZEM_FIELD_*)
+    float scale;              ///< Unit per LSB
+    uint8_t decimals;         ///< Decimals matching the resolution
+};
+
+/**
+ * @brief Get the fields of every model, grouped by model
+ * @param count Receives the number of fields
+ * @return Field table
+ */
+const PZEMField* pzemFieldTable(uint8_t* count);
+
+/**
+ * @brief Get the fields of one model
+ * @param model Model identifier (PZEM_MODEL_*)
+ * @param count Receives the number of fields (0 for an unknown model)
+ * @return First field of the model, or NULL for an unknown model
+ */
+const PZEMField* pzemFields(uint8_t model, uint8_t* count);
+
+/**
+ * @brief Find a field of a model by name
+ * @param model Model identifier (PZEM_MODEL_*)
+ * @param name Field name
+ * @return Field, or NULL if the model has no such field
+ */
+const PZEMField* pzemFieldByName(uint8_t model, const char* name);
+
+/**
+ * @brief Decode a field from a snapshot
+ * @param field Field of the snapshot model
+ * @param snapshot Snapshot holding at least the field registers (host order)
+ * @return Value in the field unit
+ */
+double pzemFieldValue(const PZEMField* field, const PZEMSnapshot* snapshot);
+
+/**
+ * @brief Find a model by name
+ * @param name Model name with or without the "PZEM-" prefix, any case (e.g. "004t", "PZEM-6L24")
+ * @return Model identifier, or PZEM_MODEL_UNKNOWN
+ */
+uint8_t pzemModelByName(const char* name);
+
+#endif // PZEMFIELDS_H
@@ -0,0 +1,97 @@
+/**
+ * @file PosixOutboxStore.cpp
+ * @brief Implementation of the outbox file store for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PosixOutboxStore.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Constructor, no file
+ */
+PosixOutboxStore::PosixOutboxStore() : _fd(-1), _size(0), _sectorSize(0) {
+}
+
+/**
+ * @brief Destructor, closes the file
+ */
+PosixOutboxStore::~PosixOutboxStore() {
+    close();
+}
+
+/**
+ * @brief Open a store file, creating it filled with 0xFF if it is missing or short
+ */
+bool PosixOutboxStore::open(const char* path, uint32_t size, uint32_t sectorSize) {
+    close();
+    if (sectorSize == 0 || size < sectorSize) {
+        return false;
+    }
+    _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        return false;
+    }
+    _sectorSize = sectorSize;
+    _size = (size / sectorSize) * sectorSize;
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+        close();
+        return false;
+    }
+    // Grow sector by sector; a sector cut short by a crash here is erased again
+    for (uint32_t offset = ((uint32_t)st.st_size / _sectorSize) * _sectorSize; offset < _size; offset += _sectorSize) {
+        if (!erase(offset)) {
+            close();
+            return false;
+        }
+    }
+    return sync();
+}
+
+/**
+ * @brief Close the file
+ */
+void PosixOutboxStore::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+uint32_t PosixOutboxStore::getSize() const {
+    return _size;
+}
+
+uint32_t PosixOutboxStore::getSectorSize() const {
+    return _sectorSize;
+}
+
+bool PosixOutboxStore::read(uint32_t offset, void* data, uint32_t length) {
+    return _fd >= 0 && pread(_fd, data, length, offset) == (ssize_t)length;
+}
+
+bool PosixOutboxStore::write(uint32_t offset, const void* data, uint32_t length) {
+    return _fd >= 0 && pwrite(_fd, data, length, offset) == (ssize_t)length;
+}
+
+bool PosixOutboxStore::erase(uint32_t offset) {
+    uint8_t erased[4096];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t done = 0; done < _sectorSize; ) {
+        uint32_t chunk = (_sectorSize - done < sizeof(erased)) ? _sectorSize - done : sizeof(erased);
+        if (!write(offset + done, erased, chunk)) {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+bool PosixOutboxStore::sync() {
+    return _fd >= 0 && fdatasync(_fd) == 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file PosixOutboxStore.h
+ * @brief Outbox store in a file for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef POSIXOUTBOXSTORE_H
+#define POSIXOUTBOXSTORE_H
+
+#include "PZEMOutbox.h"
+
+/**
+ * @class PosixOutboxStore
+ * @brief PZEMOutboxStore in a preallocated file, erased sectors filled with 0xFF
+ *
+ * sync() calls fdatasync(), so a record committed before a crash or a power
+ * cut is found again by the next mount.
+ */
+class PosixOutboxStore : public PZEMOutboxStore {
+public:
+    /**
+     * @brief Constructor, no file
+     */
+    PosixOutboxStore();
+
+    /**
+     * @brief Destructor, closes the file
+     */
+    ~PosixOutboxStore();
+
+    /**
+     * @brief Open a store file, creating it filled with 0xFF if it is missing or short
+     * @param path File path
+     * @param size Store size in bytes (rounded down to whole sectors)
+     * @param sectorSize Erase unit in bytes (default: 4096)
+     * @return true if the file is ready, false otherwise (see errno)
+     */
+    bool open(const char* path, uint32_t size, uint32_t sectorSize = 4096);
+
+    /**
+     * @brief Close the file
+     */
+    void close();
+
+    uint32_t getSize() const;
+    uint32_t getSectorSize() const;
+    bool read(uint32_t offset, void* data, uint32_t length);
+    bool write(uint32_t offset, const void* data, uint32_t length);
+    bool erase(uint32_t offset);
+    bool sync();
+
+private:
+    int _fd;                  ///< File descriptor (-1 if closed)
+    uint32_t _size;           ///< Usable size in bytes
+    uint32_t _sectorSize;     ///< Erase unit in bytes
+};
+
+#endif // POSIXOUTBOXSTORE_H
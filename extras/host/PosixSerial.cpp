@@ -0,0 +1,218 @@
+/**
+ * @file PosixSerial.cpp
+ * @brief Implementation of the serial port stream for Linux hosts
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PosixSerial.h"
+#include "HostRealtime.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * @brief Convert a baud rate to its termios speed
+ */
+static speed_t speedOf(uint32_t baudrate) {
+    switch (baudrate) {
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        default:     return B0;
+    }
+}
+
+/**
+ * @brief Constructor, port closed
+ */
+PosixSerial::PosixSerial() : _fd(-1), _baudrate(0), _head(0), _length(0) {
+}
+
+/**
+ * @brief Destructor, closes the port
+ */
+PosixSerial::~PosixSerial() {
+    close();
+}
+
+/**
+ * @brief Open a serial port
+ */
+bool PosixSerial::open(const char* path, uint32_t baudrate) {
+    close();
+    _fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (_fd < 0) {
+        return false;
+    }
+    if (!begin(baudrate)) {
+        int error = errno;
+        close();
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Change the baud rate of the open port
+ */
+bool PosixSerial::begin(uint32_t baudrate) {
+    speed_t speed = speedOf(baudrate);
+    if (_fd < 0 || speed == B0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(_fd, &tio) != 0) {
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(_fd, TCSANOW, &tio) != 0) {
+        return false;
+    }
+
+    tcflush(_fd, TCIOFLUSH);
+    _head = 0;
+    _length = 0;
+    _baudrate = baudrate;
+    return true;
+}
+
+/**
+ * @brief Close the port
+ */
+void PosixSerial::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+    _baudrate = 0;
+    _head = 0;
+    _length = 0;
+}
+
+/**
+ * @brief Get the file descriptor of the port
+ */
+int PosixSerial::getFd() const {
+    return _fd;
+}
+
+/**
+ * @brief Get the current baud rate
+ */
+uint32_t PosixSerial::getBaudrate() const {
+    return _baudrate;
+}
+
+/**
+ * @brief Wait until bytes are ready or a timeout expires
+ */
+bool PosixSerial::waitReadable(uint32_t timeoutMs) {
+    if (available() > 0) {
+        return true;
+    }
+    if (_fd < 0) {
+        return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return hostPoll(&pfd, 1, timeoutMs * 1000, NULL) > 0 && (pfd.revents & POLLIN);
+}
+
+/**
+ * @brief Get number of bytes ready to read
+ */
+int PosixSerial::available() {
+    fill();
+    return _length - _head;
+}
+
+/**
+ * @brief Read one byte
+ */
+int PosixSerial::read() {
+    fill();
+    if (_head == _length) {
+        return -1;
+    }
+    return _buffer[_head++];
+}
+
+/**
+ * @brief Get the next byte without consuming it
+ */
+int PosixSerial::peek() {
+    fill();
+    if (_head == _length) {
+        return -1;
+    }
+    return _buffer[_head];
+}
+
+/**
+ * @brief Write one byte
+ */
+size_t PosixSerial::write(uint8_t byte) {
+    return write(&byte, 1);
+}
+
+/**
+ * @brief Write a buffer, waiting for room in the driver if needed
+ */
+size_t PosixSerial::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (_fd >= 0 && written < size) {
+        ssize_t n = ::write(_fd, buffer + written, size - written);
+        if (n > 0) {
+            written += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd;
+            pfd.fd = _fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            ::poll(&pfd, 1, 10);
+        } else {
+            break;
+        }
+    }
+    return written;
+}
+
+/**
+ * @brief Wait until all written bytes are sent
+ */
+void PosixSerial::flush() {
+    if (_fd >= 0) {
+        tcdrain(_fd);
+    }
+}
+
+/**
+ * @brief Read what the driver holds into the buffer when it is empty
+ */
+void PosixSerial::fill() {
+    if (_head < _length || _fd < 0) {
+        return;
+    }
+    ssize_t n = ::read(_fd, _buffer, sizeof(_buffer));
+    _head = 0;
+    _length = (n > 0) ? (uint16_t)n : 0;
+}
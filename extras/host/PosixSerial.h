@@ -0,0 +1,102 @@
+/**
+ * @file PosixSerial.h
+ * @brief Serial port stream for Linux hosts (USB RS485 adapters, ptys)
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef POSIXSERIAL_H
+#define POSIXSERIAL_H
+
+#include "Arduino.h"
+
+/**
+ * @defgroup PosixSerialConfig Host Serial Configuration
+ * @{
+ */
+#ifndef POSIX_SERIAL_BUFFER_SIZE
+#define POSIX_SERIAL_BUFFER_SIZE 512  ///< Receive buffer size in bytes
+#endif
+/** @} */
+
+/**
+ * @class PosixSerial
+ * @brief Non-blocking 8N1 serial port, usable as the stream of a ModbusRTUTransport
+ *
+ * The port is opened raw (no echo, no line discipline). flush() waits until the
+ * driver has sent every byte, which is what the auto-direction strategy of the
+ * transport relies on before listening.
+ */
+class PosixSerial : public Stream {
+public:
+    /**
+     * @brief Constructor, port closed
+     */
+    PosixSerial();
+
+    /**
+     * @brief Destructor, closes the port
+     */
+    ~PosixSerial();
+
+    /**
+     * @brief Open a serial port
+     * @param path Device path (e.g. "/dev/ttyUSB0" or a pty slave)
+     * @param baudrate Baud rate (1200 to 115200)
+     * @return true if opened and configured, false otherwise (see errno)
+     */
+    bool open(const char* path, uint32_t baudrate);
+
+    /**
+     * @brief Change the baud rate of the open port
+     * @param baudrate Baud rate (1200 to 115200)
+     * @return true if set, false if the rate is not supported or the port is closed
+     * @note Bytes still buffered are discarded.
+     */
+    bool begin(uint32_t baudrate);
+
+    /**
+     * @brief Close the port
+     */
+    void close();
+
+    /**
+     * @brief Get the file descriptor of the port (e.g. to wait with poll())
+     * @return File descriptor, or -1 if closed
+     */
+    int getFd() const;
+
+    /**
+     * @brief Get the current baud rate
+     * @return Baud rate, or 0 if closed
+     */
+    uint32_t getBaudrate() const;
+
+    /**
+     * @brief Wait until bytes are ready or a timeout expires
+     * @param timeoutMs Longest wait in milliseconds
+     * @return true if bytes are ready
+     */
+    bool waitReadable(uint32_t timeoutMs);
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t* buffer, size_t size);
+    void flush();
+
+private:
+    int _fd;                                      ///< Port file descriptor (-1 if closed)
+    uint32_t _baudrate;                           ///< Current baud rate
+    uint8_t _buffer[POSIX_SERIAL_BUFFER_SIZE];    ///< Bytes read from the port
+    uint16_t _head;                               ///< Next byte to hand out
+    uint16_t _length;                             ///< Bytes in the buffer
+
+    /**
+     * @brief Read what the driver holds into the buffer when it is empty
+     */
+    void fill();
+};
+
+#endif // POSIXSERIAL_H
@@ -0,0 +1,530 @@
+/**
+ * @file pzemarrow.cpp
+ * @brief Export of recorded snapshots and their rollups to Arrow IPC files (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Reads the snapshot records of an outbox store file (a PosixOutboxStore
+ * file, or the PZEMOutboxFileStore file of a node's SD card) in order and
+ * writes one Arrow IPC file per model, one column per field typed by its
+ * register decoding: integer fields (energy in Wh, alarms) keep their
+ * register type, scaled fields are float64 in their unit, rounded to the
+ * resolution of the field. With --rollup, a second file per model holds the
+ * minimum, mean and maximum of every field per device and interval.
+ *
+ * Memory stays bounded whatever the size of the log: the records are read in
+ * outbox batches, rows are written in record batches of --batch-rows rows,
+ * and rollups keep one open interval per device.
+ *
+ * The store file is not modified: the outbox is mounted on a view of the file
+ * that keeps its own writes (the cursor of the export) in memory. With
+ * --cursor, the export starts where the previous export with that cursor
+ * stopped, and the cursor is written to the file once every output file is
+ * complete; an interrupted export is simply done again.
+ *
+ * Usage: pzemarrow [options] STORE PREFIX
+ *   --sector BYTES      Sector size of the store (default: 4096)
+ *   --cursor ID         Export the records since the last export with this cursor, and move it
+ *   --rollup MIN        Also write MIN-minute rollups (default: 0, none)
+ *   --batch-rows N      Rows per record batch (default: 65536)
+ *
+ * Output: PREFIX-004t.arrow, PREFIX-6l24.arrow, ... and PREFIX-004t-rollup.arrow, ...
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "ArrowWriter.h"
+#include "PosixOutboxStore.h"
+#include "PZEMFields.h"
+#include "PZEMOutbox.h"
+
+/**
+ * @defgroup PzemarrowConfig pzemarrow Configuration
+ * @{
+ */
+#define EXPORT_SCRATCH_CURSOR  (PZEM_OUTBOX_MAX_CURSORS - 1)  ///< Cursor reading the log (in memory only)
+#define EXPORT_BATCH_BYTES     262144  ///< Outbox batch buffer
+/** @} */
+
+/**
+ * @brief Options of the export
+ */
+struct ExportOptions {
+    const char* store;        ///< Store file
+    const char* prefix;       ///< Output path prefix
+    uint32_t sectorSize;      ///< Sector size of the store
+    int cursor;               ///< Export cursor, -1 for the whole log
+    uint32_t rollupMin;       ///< Rollup interval (minutes), 0 for none
+    uint32_t batchRows;       ///< Rows per record batch
+};
+
+/**
+ * @class ReadOnlyStore
+ * @brief Store file seen through a copy-on-write layer
+ *
+ * Reads come from the file; the sectors the outbox writes or erases are
+ * copied to memory first and changed there. Only the cursor records of the
+ * export are written, so one or two sectors end up in memory.
+ */
+class ReadOnlyStore : public PZEMOutboxStore {
+public:
+    ReadOnlyStore() : _fd(-1), _size(0), _sectorSize(0) {
+    }
+
+    ~ReadOnlyStore() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    bool open(const char* path, uint32_t sectorSize) {
+        struct stat st;
+        _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (_fd < 0 || fstat(_fd, &st) != 0 || sectorSize == 0 || (uint64_t)st.st_size < sectorSize) {
+            return false;
+        }
+        _sectorSize = sectorSize;
+        _size = (uint32_t)(st.st_size / sectorSize) * sectorSize;
+        return true;
+    }
+
+    uint32_t getSize() const {
+        return _size;
+    }
+
+    uint32_t getSectorSize() const {
+        return _sectorSize;
+    }
+
+    bool read(uint32_t offset, void* data, uint32_t length) {
+        uint8_t* out = (uint8_t*)data;
+        while (length > 0) {
+            uint32_t sector = offset / _sectorSize;
+            uint32_t within = offset % _sectorSize;
+            uint32_t chunk = _sectorSize - within < length ? _sectorSize - within : length;
+            std::map<uint32_t, std::vector<uint8_t> >::const_iterator copy = _copies.find(sector);
+            if (copy != _copies.end()) {
+                memcpy(out, &copy->second[within], chunk);
+            } else if (pread(_fd, out, chunk, offset) != (ssize_t)chunk) {
+                return false;
+            }
+            out += chunk;
+            offset += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    bool write(uint32_t offset, const void* data, uint32_t length) {
+        const uint8_t* in = (const uint8_t*)data;
+        while (length > 0) {
+            uint32_t within = offset % _sectorSize;
+            uint32_t chunk = _sectorSize - within < length ? _sectorSize - within : length;
+            std::vector<uint8_t>* copy = sectorCopy(offset / _sectorSize, false);
+            if (copy == NULL) {
+                return false;
+            }
+            memcpy(&(*copy)[within], in, chunk);
+            in += chunk;
+            offset += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    bool erase(uint32_t offset) {
+        return sectorCopy(offset / _sectorSize, true) != NULL;
+    }
+
+private:
+    int _fd;                  ///< Store file, read-only
+    uint32_t _size;           ///< Usable size in bytes
+    uint32_t _sectorSize;     ///< Erase unit in bytes
+    std::map<uint32_t, std::vector<uint8_t> > _copies;  ///< Sectors changed, by sector index
+
+    /**
+     * @brief Get the copy of a sector, making it on first use
+     * @param sector Sector index
+     * @param erased Fill the copy with 0xFF instead of the file content
+     * @return Copy, or NULL on a read error
+     */
+    std::vector<uint8_t>* sectorCopy(uint32_t sector, bool erased) {
+        std::vector<uint8_t>& copy = _copies[sector];
+        if (erased || copy.empty()) {
+            copy.assign(_sectorSize, 0xFF);
+            if (!erased && pread(_fd, &copy[0], _sectorSize, (off_t)sector * _sectorSize) != (ssize_t)_sectorSize) {
+                _copies.erase(sector);
+                return NULL;
+            }
+        }
+        return &copy;
+    }
+};
+
+/**
+ * @brief Open interval of one device
+ */
+struct Rollup {
+    uint32_t start;           ///< Interval start (Unix time)
+    uint32_t samples;         ///< Snapshots in the interval
+    double min[PZEM_FIELD_MAX_PER_MODEL];  ///< Smallest value of each field
+    double sum[PZEM_FIELD_MAX_PER_MODEL];  ///< Sum of each field
+    double max[PZEM_FIELD_MAX_PER_MODEL];  ///< Largest value of each field
+};
+
+/**
+ * @brief Output files of one model
+ */
+struct ModelExport {
+    const PZEMField* fields;  ///< Fields of the model
+    uint8_t fieldCount;       ///< Number of fields
+    ArrowWriter snapshots;    ///< Snapshot file
+    ArrowWriter rollups;      ///< Rollup file (with --rollup)
+    int time, seq, address, uptime;        ///< Snapshot columns
+    int field[PZEM_FIELD_MAX_PER_MODEL];   ///< Snapshot column of each field
+    int start, rollupAddress, samples;     ///< Rollup columns
+    int min[PZEM_FIELD_MAX_PER_MODEL];     ///< Rollup columns of each field
+    int avg[PZEM_FIELD_MAX_PER_MODEL];
+    int max[PZEM_FIELD_MAX_PER_MODEL];
+    std::map<uint8_t, Rollup> open;        ///< Open interval of each device, by address
+};
+
+/**
+ * @brief Column type of a field: its register type when unscaled, float64 otherwise
+ */
+static uint8_t fieldColumnType(const PZEMField* field) {
+    if (field->scale != 1.0f) {
+        return ARROW_COLUMN_FLOAT64;
+    }
+    switch (field->type) {
+        case PZEM_FIELD_U32:
+            return ARROW_COLUMN_UINT32;
+        case PZEM_FIELD_S32:
+            return ARROW_COLUMN_INT32;
+        case PZEM_FIELD_HIGH_BYTE:
+        case PZEM_FIELD_LOW_BYTE:
+            return ARROW_COLUMN_UINT8;
+        default:
+            return ARROW_COLUMN_UINT16;
+    }
+}
+
+/**
+ * @brief Decode a field, rounded to its resolution
+ *
+ * The scales are floats (0.1f is not 0.1); rounding gives 230.1 rather than
+ * 230.10000343 to the analysis tools.
+ */
+static double fieldValue(const PZEMField* field, const PZEMSnapshot* snapshot) {
+    double scale = pow(10.0, field->decimals);
+    return round(pzemFieldValue(field, snapshot) * scale) / scale;
+}
+
+/**
+ * @brief Create the output files of a model
+ */
+static ModelExport* openModel(uint8_t model, const ExportOptions& opts) {
+    ModelExport* m = new ModelExport();
+    const char* name = pzemModelInfo(model)->name;
+    m->fields = pzemFields(model, &m->fieldCount);
+
+    char suffix[16];
+    size_t n = 0;
+    for (const char* p = name + 5; *p != '\0' && n + 1 < sizeof(suffix); p++) {
+        suffix[n++] = (char)tolower((unsigned char)*p);
+    }
+    suffix[n] = '\0';
+    char path[1024];
+
+    m->time = m->snapshots.addColumn("time", ARROW_COLUMN_TIMESTAMP_S);
+    m->seq = m->snapshots.addColumn("seq", ARROW_COLUMN_UINT32);
+    m->address = m->snapshots.addColumn("address", ARROW_COLUMN_UINT8);
+    m->uptime = m->snapshots.addColumn("uptime_ms", ARROW_COLUMN_UINT32);
+    for (uint8_t f = 0; f < m->fieldCount; f++) {
+        m->field[f] = m->snapshots.addColumn(m->fields[f].name, fieldColumnType(&m->fields[f]));
+    }
+    m->snapshots.addMetadata("model", name);
+    snprintf(path, sizeof(path), "%s-%s.arrow", opts.prefix, suffix);
+    bool ok = m->snapshots.open(path, opts.batchRows);
+
+    if (ok && opts.rollupMin > 0) {
+        m->start = m->rollups.addColumn("start", ARROW_COLUMN_TIMESTAMP_S);
+        m->rollupAddress = m->rollups.addColumn("address", ARROW_COLUMN_UINT8);
+        m->samples = m->rollups.addColumn("samples", ARROW_COLUMN_UINT32);
+        for (uint8_t f = 0; f < m->fieldCount; f++) {
+            std::string field = m->fields[f].name;
+            m->min[f] = m->rollups.addColumn((field + "_min").c_str(), fieldColumnType(&m->fields[f]));
+            m->avg[f] = m->rollups.addColumn((field + "_avg").c_str(), ARROW_COLUMN_FLOAT64);
+            m->max[f] = m->rollups.addColumn((field + "_max").c_str(), fieldColumnType(&m->fields[f]));
+        }
+        char interval[16];
+        snprintf(interval, sizeof(interval), "%u", opts.rollupMin * 60);
+        m->rollups.addMetadata("model", name);
+        m->rollups.addMetadata("interval_s", interval);
+        snprintf(path, sizeof(path), "%s-%s-rollup.arrow", opts.prefix, suffix);
+        ok = m->rollups.open(path, opts.batchRows);
+    }
+    if (!ok) {
+        fprintf(stderr, "pzemarrow: cannot create %s\n", path);
+        delete m;
+        return NULL;
+    }
+    return m;
+}
+
+/**
+ * @brief Write the row of a closed interval
+ */
+static bool writeRollup(ModelExport* m, uint8_t address, const Rollup& r) {
+    m->rollups.setInt(m->start, r.start);
+    m->rollups.setInt(m->rollupAddress, address);
+    m->rollups.setInt(m->samples, r.samples);
+    for (uint8_t f = 0; f < m->fieldCount; f++) {
+        m->rollups.setDouble(m->min[f], r.min[f]);
+        m->rollups.setDouble(m->avg[f], r.sum[f] / r.samples);
+        m->rollups.setDouble(m->max[f], r.max[f]);
+    }
+    return m->rollups.endRow();
+}
+
+/**
+ * @brief Add a snapshot to the open interval of its device, closing it when the snapshot is past it
+ */
+static bool addRollup(ModelExport* m, const PZEMSnapshot* snapshot, const double* values, uint32_t epoch,
+                      uint32_t intervalS) {
+    uint32_t start = epoch - epoch % intervalS;
+    std::map<uint8_t, Rollup>::iterator it = m->open.find(snapshot->slaveAddr);
+    if (it != m->open.end() && it->second.start != start) {
+        if (!writeRollup(m, snapshot->slaveAddr, it->second)) {
+            return false;
+        }
+        m->open.erase(it);
+        it = m->open.end();
+    }
+    if (it == m->open.end()) {
+        Rollup r;
+        r.start = start;
+        r.samples = 0;
+        for (uint8_t f = 0; f < m->fieldCount; f++) {
+            r.min[f] = values[f];
+            r.sum[f] = 0;
+            r.max[f] = values[f];
+        }
+        it = m->open.insert(std::make_pair(snapshot->slaveAddr, r)).first;
+    }
+    Rollup& r = it->second;
+    r.samples++;
+    for (uint8_t f = 0; f < m->fieldCount; f++) {
+        r.min[f] = values[f] < r.min[f] ? values[f] : r.min[f];
+        r.sum[f] += values[f];
+        r.max[f] = values[f] > r.max[f] ? values[f] : r.max[f];
+    }
+    return true;
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemarrow [options] STORE PREFIX\n"
+        "  --sector BYTES      Sector size of the store (default: 4096)\n"
+        "  --cursor ID         Export the records since the last export with this cursor (0 to %d)\n"
+        "  --rollup MIN        Also write MIN-minute rollups (default: none)\n"
+        "  --batch-rows N      Rows per record batch (default: %u)\n",
+        EXPORT_SCRATCH_CURSOR - 1, (unsigned)ARROW_WRITER_DEFAULT_BATCH);
+}
+
+/**
+ * @brief Parse the options
+ */
+static bool parseOptions(int argc, char** argv, ExportOptions* opts) {
+    opts->store = NULL;
+    opts->prefix = NULL;
+    opts->sectorSize = 4096;
+    opts->cursor = -1;
+    opts->rollupMin = 0;
+    opts->batchRows = ARROW_WRITER_DEFAULT_BATCH;
+    uint32_t cursor = 0xFFFFFFFFUL;
+
+    struct { const char* name; uint32_t* value; } numbers[] = {
+        { "--sector", &opts->sectorSize }, { "--cursor", &cursor }, { "--rollup", &opts->rollupMin },
+        { "--batch-rows", &opts->batchRows },
+    };
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            if (opts->store == NULL) {
+                opts->store = argv[i];
+            } else if (opts->prefix == NULL) {
+                opts->prefix = argv[i];
+            } else {
+                return false;
+            }
+            continue;
+        }
+        bool known = false;
+        for (size_t n = 0; n < sizeof(numbers) / sizeof(numbers[0]); n++) {
+            if (strcmp(argv[i], numbers[n].name) == 0 && i + 1 < argc) {
+                char* end = NULL;
+                *numbers[n].value = strtoul(argv[++i], &end, 10);
+                known = *end == '\0';
+            }
+        }
+        if (!known) {
+            return false;
+        }
+    }
+    if (cursor != 0xFFFFFFFFUL) {
+        if (cursor >= EXPORT_SCRATCH_CURSOR) {
+            return false;
+        }
+        opts->cursor = (int)cursor;
+    }
+    return opts->store != NULL && opts->prefix != NULL && opts->sectorSize > 0 && opts->batchRows > 0 &&
+           opts->rollupMin <= 1440;
+}
+
+int main(int argc, char** argv) {
+    ExportOptions opts;
+    if (!parseOptions(argc, argv, &opts)) {
+        usage();
+        return 2;
+    }
+
+    ReadOnlyStore* store = new ReadOnlyStore();
+    PZEMOutbox* outbox = new PZEMOutbox();
+    if (!store->open(opts.store, opts.sectorSize) || !outbox->begin(store)) {
+        fprintf(stderr, "pzemarrow: cannot read the outbox in %s\n", opts.store);
+        return 1;
+    }
+    PZEMOutboxStats stats;
+    outbox->getStats(&stats);
+    uint32_t startSeq = stats.tailSeq;
+    PZEMOutboxCursor position;
+    if (opts.cursor >= 0 && outbox->getCursor(opts.cursor, &position)) {
+        startSeq = position.next;
+    }
+    if (!outbox->openCursor(EXPORT_SCRATCH_CURSOR) || !outbox->rewind(EXPORT_SCRATCH_CURSOR, startSeq)) {
+        fprintf(stderr, "pzemarrow: cannot read the outbox in %s\n", opts.store);
+        return 1;
+    }
+
+    ModelExport* models[PZEM_MODEL_COUNT] = { NULL };
+    std::vector<uint8_t> buffer(EXPORT_BATCH_BYTES);
+    PZEMOutboxBatch batch;
+    uint32_t nextSeq = startSeq;
+    uint64_t snapshots = 0;
+    uint32_t otherRecords = 0;
+    uint32_t undated = 0;
+    bool ok = true;
+
+    while (ok && outbox->takeBatch(EXPORT_SCRATCH_CURSOR, &buffer[0], buffer.size(), &batch)) {
+        PZEMOutboxDecoder decoder;
+        PZEMOutboxRecord record;
+        if (!decoder.begin(&buffer[0], batch.length)) {
+            fprintf(stderr, "pzemarrow: batch at %u does not decode\n", batch.firstSeq);
+            ok = false;
+            break;
+        }
+        while (ok && decoder.next(&record)) {
+            PZEMSnapshot snapshot;
+            uint32_t epoch;
+            if (!PZEMOutbox::decodeSnapshot(&record, &snapshot, &epoch) || snapshot.model >= PZEM_MODEL_COUNT) {
+                otherRecords++;
+                continue;
+            }
+            ModelExport*& m = models[snapshot.model];
+            if (m == NULL && (m = openModel(snapshot.model, opts)) == NULL) {
+                ok = false;
+                break;
+            }
+            double values[PZEM_FIELD_MAX_PER_MODEL];
+            if (epoch != 0) {
+                m->snapshots.setInt(m->time, epoch);
+            }
+            m->snapshots.setInt(m->seq, record.seq);
+            m->snapshots.setInt(m->address, snapshot.slaveAddr);
+            m->snapshots.setInt(m->uptime, snapshot.timestamp);
+            for (uint8_t f = 0; f < m->fieldCount; f++) {
+                values[f] = fieldValue(&m->fields[f], &snapshot);
+                m->snapshots.setDouble(m->field[f], values[f]);
+            }
+            ok = m->snapshots.endRow();
+            if (ok && opts.rollupMin > 0) {
+                if (epoch == 0) {
+                    undated++;
+                } else {
+                    ok = addRollup(m, &snapshot, values, epoch, opts.rollupMin * 60);
+                }
+            }
+            snapshots++;
+        }
+        nextSeq = batch.nextSeq;
+        ok = ok && outbox->commit(EXPORT_SCRATCH_CURSOR, &batch);
+    }
+    outbox->getStats(&stats);
+    if (ok && (nextSeq != stats.headSeq || stats.storeErrors != 0)) {
+        fprintf(stderr, "pzemarrow: read stopped at record %u of %u\n", nextSeq, stats.headSeq);
+        ok = false;
+    }
+
+    for (uint8_t model = 0; model < PZEM_MODEL_COUNT; model++) {
+        ModelExport* m = models[model];
+        if (m == NULL) {
+            continue;
+        }
+        if (opts.rollupMin > 0) {
+            for (std::map<uint8_t, Rollup>::iterator it = m->open.begin(); it != m->open.end(); ++it) {
+                ok = writeRollup(m, it->first, it->second) && ok;
+            }
+            ok = m->rollups.close() && ok;
+            printf("%s rollups: %llu rows, %u record batches\n", pzemModelInfo(model)->name,
+                   (unsigned long long)m->rollups.getRows(), m->rollups.getBatches());
+        }
+        ok = m->snapshots.close() && ok;
+        printf("%s snapshots: %llu rows, %u record batches\n", pzemModelInfo(model)->name,
+               (unsigned long long)m->snapshots.getRows(), m->snapshots.getBatches());
+        delete m;
+    }
+    delete outbox;
+    delete store;
+
+    printf("records %u to %u: %llu snapshots, %u other records", startSeq, nextSeq,
+           (unsigned long long)snapshots, otherRecords);
+    if (opts.rollupMin > 0) {
+        printf(", %u without time (not in rollups)", undated);
+    }
+    printf("\n");
+    if (!ok) {
+        fprintf(stderr, "pzemarrow: export failed%s\n", opts.cursor >= 0 ? ", cursor not moved" : "");
+        return 1;
+    }
+
+    if (opts.cursor >= 0) {
+        // Every file is complete: record where the next export starts
+        PosixOutboxStore* file = new PosixOutboxStore();
+        PZEMOutbox* durable = new PZEMOutbox();
+        struct stat st;
+        bool moved = stat(opts.store, &st) == 0 && file->open(opts.store, (uint32_t)st.st_size, opts.sectorSize) &&
+                     durable->begin(file) && durable->openCursor(opts.cursor) && durable->rewind(opts.cursor, nextSeq);
+        delete durable;
+        delete file;
+        if (!moved) {
+            fprintf(stderr, "pzemarrow: cannot move cursor %d in %s\n", opts.cursor, opts.store);
+            return 1;
+        }
+        printf("cursor %d: next export starts at record %u\n", opts.cursor, nextSeq);
+    }
+    return 0;
+}
@@ -0,0 +1,993 @@
+/**
+ * @file pzemctl.cpp
+ * @brief Command-line tool to scan, poll, benchmark and configure PZEM buses (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Built from the library sources on the host backend (extras/host): requests go
+ * through ModbusRTUTransport and PZEMBus exactly as on a board, over a USB RS485
+ * adapter or the pty of pzemsim.
+ *
+ * Usage: pzemctl [options] COMMAND [arguments]
+ *   scan                          Find devices and identify their model
+ *   poll TARGETS                  Stream snapshots as CSV or JSON lines
+ *   bench TARGETS                 Measure throughput, latency and errors
+ *   set TARGETS KEY=VALUE ...     Write settings, all queued at once
+ *   migrate-baud TARGETS BAUD     Move PZEM-6L24 devices to a new baud rate
+ *
+ * TARGETS is a list of addresses and ranges with an optional model, e.g.
+ * "1,2,5-8" or "1:004t,2:6l24"; devices without a model are identified first.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HostRealtime.h"
+#include "PosixSerial.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMFields.h"
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PzemctlConfig pzemctl Configuration
+ * @{
+ */
+#define PZEMCTL_DEFAULT_PORT        "/dev/ttyUSB0"  ///< Port used without --port
+#define PZEMCTL_DEFAULT_BAUDRATE    9600            ///< Baud rate used without --baud
+#define PZEMCTL_MAX_TARGETS         247             ///< Devices per command
+#define PZEMCTL_MAX_BAUDRATES       8               ///< Baud rates in --bauds
+#define PZEMCTL_MAX_SETTINGS        16              ///< KEY=VALUE pairs per set command
+#define PZEMCTL_DEFAULT_TIMEOUT_MS  25              ///< Device processing time allowed on top of the wire time
+#define PZEMCTL_BENCH_COUNT         200             ///< Transactions per device and baud rate
+#define PZEMCTL_MIGRATE_SETTLE_MS   200             ///< Wait before checking migrated devices
+#define PZEMCTL_MIGRATE_RETRIES     3               ///< Checks of a migrated device
+/** @} */
+
+/**
+ * @brief Device addressed by a command
+ */
+struct Target {
+    uint8_t slaveAddr;        ///< Slave address
+    uint8_t model;            ///< Model identifier (PZEM_MODEL_UNKNOWN until identified)
+};
+
+/**
+ * @brief Command-line options
+ */
+struct Options {
+    const char* port;                             ///< Serial port path
+    uint32_t baudrate;                            ///< Baud rate
+    uint32_t baudrates[PZEMCTL_MAX_BAUDRATES];    ///< Baud rates of scan and bench
+    uint8_t baudrateCount;                        ///< Entries in baudrates (0: baudrate only)
+    uint32_t timeout;                             ///< Response time allowed beyond the wire time and silence (ms)
+    int32_t silence;                              ///< End-of-frame silence in ms (-1: library default)
+    uint8_t from;                                 ///< First address scanned
+    uint8_t to;                                   ///< Last address scanned
+    double rate;                                  ///< Snapshots per second and device
+    uint32_t count;                               ///< Snapshots (poll) or transactions (bench), 0 = default
+    bool json;                                    ///< JSON lines instead of CSV
+    uint16_t regs;                                ///< Registers read by bench (0: snapshot span)
+    HostRealtimeConfig realtime;                  ///< Scheduling of the polling thread
+};
+
+/**
+ * @brief Baud rates of the PZEM-6L24, indexed by baud rate code
+ */
+static const uint32_t PZEM6L24_BAUDRATES[] = { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+#define PZEM6L24_BAUDRATE_COUNT 7
+
+static Options opts;                            ///< Command-line options
+static PosixSerial serial;                      ///< Bus port
+static ModbusRTUTransport transport(&serial);   ///< Transport over the port
+static volatile sig_atomic_t running = 1;       ///< Cleared by SIGINT/SIGTERM
+
+/**
+ * @brief Stop streaming commands
+ */
+static void onSignal(int) {
+    running = 0;
+}
+
+/**
+ * @brief Get the name of a transaction status
+ */
+static const char* statusName(uint8_t status) {
+    switch (status) {
+        case MODBUS_TRANSACTION_OK:        return "ok";
+        case MODBUS_TRANSACTION_TIMEOUT:   return "timeout";
+        case MODBUS_TRANSACTION_CRC_ERROR: return "crc error";
+        case MODBUS_TRANSACTION_EXCEPTION: return "exception";
+        case MODBUS_TRANSACTION_FAILED:    return "failed";
+        default:                           return "pending";
+    }
+}
+
+/**
+ * @brief Get the name of a model
+ */
+static const char* modelName(uint8_t model) {
+    const PZEMModelInfo* info = pzemModelInfo(model);
+    return info != NULL ? info->name : "unknown";
+}
+
+/**
+ * @brief Time to send a number of bytes at the current baud rate (8N1), in ms rounded up
+ */
+static uint32_t wireTimeMs(uint16_t bytes) {
+    uint32_t baudrate = serial.getBaudrate() ? serial.getBaudrate() : opts.baudrate;
+    return (bytes * 10UL * 1000UL + baudrate - 1) / baudrate;
+}
+
+/**
+ * @brief Response timeout of an exchange
+ *
+ * --timeout only sets the device processing time: the wire time of both frames
+ * and the frame silence are always added, so a long response at a low rate is
+ * never cut and left to arrive during the next exchange.
+ */
+static uint32_t timeoutFor(uint16_t requestBytes, uint16_t responseBytes) {
+    uint32_t silence = opts.silence >= 0 ? (uint32_t)opts.silence : MODBUS_RTU_FRAME_SILENCE_MS;
+    return wireTimeMs(requestBytes + responseBytes) + silence + opts.timeout;
+}
+
+/**
+ * @brief Open the port or change its baud rate
+ */
+static bool usePort(uint32_t baudrate) {
+    bool ok = serial.getFd() >= 0 ? serial.begin(baudrate) : serial.open(opts.port, baudrate);
+    if (!ok) {
+        fprintf(stderr, "pzemctl: cannot use %s at %u baud: %s\n", opts.port, (unsigned)baudrate, strerror(errno));
+    }
+    return ok;
+}
+
+/**
+ * @brief Run one transaction to completion
+ * @return Transaction status (MODBUS_TRANSACTION_*)
+ */
+static uint8_t transact(ModbusTransaction* txn) {
+    if (!transport.submit(txn)) {
+        return MODBUS_TRANSACTION_FAILED;
+    }
+    while (txn->status == MODBUS_TRANSACTION_PENDING) {
+        transport.poll();
+        if (txn->status == MODBUS_TRANSACTION_PENDING) {
+            serial.waitReadable(1);
+        }
+    }
+    return txn->status;
+}
+
+/**
+ * @brief Read registers into a response buffer
+ * @return Transaction status (MODBUS_TRANSACTION_*)
+ */
+static uint8_t readRegisters(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                             uint8_t* response, uint16_t responseSize) {
+    uint8_t request[8];
+    modbusBuildReadRequest(request, slaveAddr, function, startAddr, numRegs);
+    uint16_t length = modbusReadResponseLength(numRegs);
+    ModbusTransaction txn;
+    txn.prepare(request, sizeof(request), response, responseSize, length, timeoutFor(sizeof(request), length));
+    return transact(&txn);
+}
+
+/**
+ * @brief Read registers and decode them in host order
+ * @return true if read
+ */
+static bool readValues(uint8_t slaveAddr, uint8_t model, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                       uint16_t* values) {
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    if (readRegisters(slaveAddr, function, startAddr, numRegs, response, sizeof(response)) != MODBUS_TRANSACTION_OK) {
+        return false;
+    }
+    bool bigEndian = pzemModelInfo(model)->bigEndian;
+    for (uint16_t i = 0; i < numRegs; i++) {
+        uint8_t hi = response[3 + 2 * i];
+        uint8_t lo = response[4 + 2 * i];
+        values[i] = bigEndian ? (uint16_t)((hi << 8) | lo) : (uint16_t)((lo << 8) | hi);
+    }
+    return true;
+}
+
+/**
+ * @brief Identify the model of a device from the register spans it accepts
+ *
+ * Models are tried from the largest input span down, then the largest holding
+ * span: a device accepting the 64-register snapshot is a PZEM-6L24, one accepting
+ * 10 a PZEM-004T, and the PZEM-017 differs from the PZEM-003 by its current
+ * range holding register. Each span is read at most once.
+ */
+static uint8_t fingerprint(uint8_t slaveAddr) {
+    uint8_t order[PZEM_MODEL_COUNT];
+    for (uint8_t i = 0; i < PZEM_MODEL_COUNT; i++) {
+        uint8_t j = i;
+        while (j > 0) {
+            const PZEMModelInfo* a = pzemModelInfo(order[j - 1]);
+            const PZEMModelInfo* b = pzemModelInfo(i);
+            if (a->snapshotRegs > b->snapshotRegs ||
+                (a->snapshotRegs == b->snapshotRegs && a->holdingRegs >= b->holdingRegs)) {
+                break;
+            }
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    // Results of the spans already tried: 0 = not tried, 1 = accepted, 2 = refused
+    uint8_t inputTried[PZEM_SNAPSHOT_MAX_REGISTERS + 1] = { 0 };
+    uint8_t holdingTried[PZEM_SNAPSHOT_MAX_REGISTERS + 1] = { 0 };
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+
+    for (uint8_t i = 0; i < PZEM_MODEL_COUNT; i++) {
+        const PZEMModelInfo* info = pzemModelInfo(order[i]);
+        uint8_t& input = inputTried[info->snapshotRegs];
+        if (input == 0) {
+            input = readRegisters(slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0, info->snapshotRegs,
+                                  response, sizeof(response)) == MODBUS_TRANSACTION_OK ? 1 : 2;
+        }
+        if (input != 1) {
+            continue;
+        }
+        uint8_t& holding = holdingTried[info->holdingRegs];
+        if (holding == 0) {
+            holding = readRegisters(slaveAddr, MODBUS_READ_HOLDING_REGISTERS, 0, info->holdingRegs,
+                                    response, sizeof(response)) == MODBUS_TRANSACTION_OK ? 1 : 2;
+        }
+        if (holding == 1) {
+            return order[i];
+        }
+    }
+    return PZEM_MODEL_UNKNOWN;
+}
+
+/**
+ * @brief Parse a target list ("1,2,5-8", "1:004t,3-4:017")
+ */
+static bool parseTargets(const char* list, Target* targets, uint16_t* count) {
+    *count = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        unsigned long first = strtoul(p, &end, 0);
+        unsigned long last = first;
+        if (end == p) {
+            return false;
+        }
+        p = end;
+        if (*p == '-') {
+            last = strtoul(p + 1, &end, 0);
+            if (end == p + 1) {
+                return false;
+            }
+            p = end;
+        }
+
+        uint8_t model = PZEM_MODEL_UNKNOWN;
+        if (*p == ':') {
+            char name[16];
+            size_t length = strcspn(p + 1, ",");
+            if (length == 0 || length >= sizeof(name)) {
+                return false;
+            }
+            memcpy(name, p + 1, length);
+            name[length] = '\0';
+            model = pzemModelByName(name);
+            if (model == PZEM_MODEL_UNKNOWN) {
+                return false;
+            }
+            p += 1 + length;
+        }
+
+        if (first < 1 || last > 247 || first > last) {
+            return false;
+        }
+        for (unsigned long addr = first; addr <= last; addr++) {
+            if (*count >= PZEMCTL_MAX_TARGETS) {
+                return false;
+            }
+            targets[*count].slaveAddr = (uint8_t)addr;
+            targets[*count].model = model;
+            (*count)++;
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return *count > 0;
+}
+
+/**
+ * @brief Identify the targets given without a model
+ */
+static bool identifyTargets(Target* targets, uint16_t count) {
+    bool ok = true;
+    for (uint16_t i = 0; i < count; i++) {
+        if (targets[i].model != PZEM_MODEL_UNKNOWN) {
+            continue;
+        }
+        targets[i].model = fingerprint(targets[i].slaveAddr);
+        if (targets[i].model == PZEM_MODEL_UNKNOWN) {
+            fprintf(stderr, "pzemctl: device %u does not answer as a known model at %u baud\n",
+                    targets[i].slaveAddr, (unsigned)serial.getBaudrate());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Baud rates of scan and bench: --bauds, or --baud alone
+ */
+static uint8_t benchBaudrates(const uint32_t** baudrates) {
+    if (opts.baudrateCount == 0) {
+        *baudrates = &opts.baudrate;
+        return 1;
+    }
+    *baudrates = opts.baudrates;
+    return opts.baudrateCount;
+}
+
+/**
+ * @brief scan: probe every address, then identify the devices that answer
+ */
+static int cmdScan() {
+    const uint32_t* baudrates;
+    uint8_t baudrateCount = benchBaudrates(&baudrates);
+    uint16_t found = 0;
+
+    printf("%-7s %-4s %-10s %s\n", "baud", "addr", "model", "probe");
+    for (uint8_t b = 0; b < baudrateCount && running; b++) {
+        if (!usePort(baudrates[b])) {
+            return 1;
+        }
+        for (uint16_t addr = opts.from; addr <= opts.to && running; addr++) {
+            // Any answer, even an exception, means a device holds the address
+            uint8_t response[16];
+            uint32_t start = micros();
+            uint8_t status = readRegisters(addr, MODBUS_READ_INPUT_REGISTERS, 0, 1, response, sizeof(response));
+            uint32_t elapsed = micros() - start;
+            if (status != MODBUS_TRANSACTION_OK && status != MODBUS_TRANSACTION_EXCEPTION) {
+                continue;
+            }
+            uint8_t model = fingerprint(addr);
+            printf("%-7u %-4u %-10s %.1f ms%s\n", (unsigned)baudrates[b], addr, modelName(model), elapsed / 1000.0,
+                   status == MODBUS_TRANSACTION_OK ? "" : " (exception)");
+            fflush(stdout);
+            found++;
+        }
+    }
+    fprintf(stderr, "%u device(s) found\n", found);
+    return found > 0 ? 0 : 1;
+}
+
+/**
+ * @brief Columns and progress of poll
+ */
+struct PollState {
+    const char* columns[PZEM_FIELD_MAX_PER_MODEL * PZEM_MODEL_COUNT];  ///< Column names (union of the target models)
+    uint8_t columnCount;                ///< Columns in use
+    uint32_t printed;                   ///< Snapshots printed
+};
+
+/**
+ * @brief Print one snapshot as a CSV row or a JSON line
+ */
+static void onSnapshot(const PZEMSnapshot* snapshot, void* context) {
+    PollState* state = (PollState*)context;
+    if (opts.count != 0 && state->printed >= opts.count) {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    double time = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    if (opts.json) {
+        printf("{\"time\":%.3f,\"address\":%u,\"model\":\"%s\"", time, snapshot->slaveAddr, modelName(snapshot->model));
+    } else {
+        printf("%.3f,%u,%s", time, snapshot->slaveAddr, modelName(snapshot->model));
+    }
+    for (uint8_t c = 0; c < state->columnCount; c++) {
+        const PZEMField* field = pzemFieldByName(snapshot->model, state->columns[c]);
+        if (opts.json) {
+            if (field != NULL) {
+                printf(",\"%s\":%.*f", field->name, field->decimals, pzemFieldValue(field, snapshot));
+            }
+        } else if (field != NULL) {
+            printf(",%.*f", field->decimals, pzemFieldValue(field, snapshot));
+        } else {
+            printf(",");
+        }
+    }
+    printf(opts.json ? "}\n" : "\n");
+    fflush(stdout);
+    state->printed++;
+}
+
+/**
+ * @brief poll: stream snapshots of the targets through PZEMBus
+ */
+static int cmdPoll(Target* targets, uint16_t count) {
+    if (count > PZEM_BUS_MAX_DEVICES) {
+        fprintf(stderr, "pzemctl: poll takes at most %u devices\n", PZEM_BUS_MAX_DEVICES);
+        return 2;
+    }
+    if (!usePort(opts.baudrate) || !identifyTargets(targets, count)) {
+        return 1;
+    }
+
+    PollState state;
+    state.columnCount = 0;
+    state.printed = 0;
+    uint8_t fieldCount;
+    const PZEMField* fields = pzemFieldTable(&fieldCount);
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        bool wanted = false;
+        for (uint16_t t = 0; t < count; t++) {
+            wanted = wanted || targets[t].model == fields[i].model;
+        }
+        for (uint8_t c = 0; c < state.columnCount && wanted; c++) {
+            wanted = strcmp(state.columns[c], fields[i].name) != 0;
+        }
+        if (wanted) {
+            state.columns[state.columnCount++] = fields[i].name;
+        }
+    }
+
+    PZEMBus bus(transport);
+    for (uint16_t t = 0; t < count; t++) {
+        bus.addDevice(targets[t].slaveAddr, targets[t].model);
+    }
+    bus.setInterval((uint32_t)(1000.0 / opts.rate + 0.5));
+    // The bus adds the response wire time of each read to the timeout
+    bus.setBaudRate(serial.getBaudrate() ? serial.getBaudrate() : opts.baudrate);
+    bus.setTimeout(timeoutFor(8, 0));
+    bus.setSnapshotCallback(onSnapshot, &state);
+
+    if (!opts.json) {
+        printf("time,address,model");
+        for (uint8_t c = 0; c < state.columnCount; c++) {
+            printf(",%s", state.columns[c]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    while (running && (opts.count == 0 || state.printed < opts.count)) {
+        bus.poll(2000);
+        serial.waitReadable(1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Compare latencies for qsort
+ */
+static int compareLatency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Get a percentile of sorted latencies, in ms
+ */
+static double percentileMs(const uint32_t* sorted, uint32_t count, double percentile) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t index = (uint32_t)(percentile / 100.0 * (count - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+/**
+ * @brief bench: back-to-back reads of every target at every baud rate
+ */
+static int cmdBench(Target* targets, uint16_t count) {
+    const uint32_t* baudrates;
+    uint8_t baudrateCount = benchBaudrates(&baudrates);
+    uint32_t transactions = opts.count != 0 ? opts.count : PZEMCTL_BENCH_COUNT;
+    uint32_t* latencies = new uint32_t[transactions];
+    uint32_t* lateness = new uint32_t[transactions];
+    bool allOk = true;
+
+    printf("%-7s %-4s %-10s %4s %8s %8s %8s %8s %8s %7s %7s %5s %5s %7s %8s %8s\n", "baud", "addr", "model", "regs",
+           "tx/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "error%", "timeout", "crc", "exc", "failed", "jit p99",
+           "jit max");
+    for (uint8_t b = 0; b < baudrateCount && running; b++) {
+        if (!usePort(baudrates[b])) {
+            delete[] latencies;
+            delete[] lateness;
+            return 1;
+        }
+        for (uint16_t t = 0; t < count && running; t++) {
+            Target& target = targets[t];
+            if (target.model == PZEM_MODEL_UNKNOWN && !identifyTargets(&target, 1)) {
+                allOk = false;
+                target.model = PZEM_MODEL_UNKNOWN;
+                continue;
+            }
+            uint16_t regs = opts.regs != 0 ? opts.regs : pzemModelInfo(target.model)->snapshotRegs;
+
+            uint8_t request[8];
+            uint8_t response[MODBUS_MAX_ADU_SIZE];
+            modbusBuildReadRequest(request, target.slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0, regs);
+            uint16_t length = modbusReadResponseLength(regs);
+
+            uint32_t statusCount[MODBUS_TRANSACTION_FAILED + 1] = { 0 };
+            uint32_t ok = 0;
+            uint32_t done = 0;
+            uint32_t start = micros();
+            for (; done < transactions && running; done++) {
+                ModbusTransaction txn;
+                txn.prepare(request, sizeof(request), response, sizeof(response), length,
+                            timeoutFor(sizeof(request), length));
+                uint32_t sent = micros();
+                hostJitterReset();
+                uint8_t status = transact(&txn);
+                HostJitter jitter;
+                hostJitterGet(&jitter);
+                lateness[done] = jitter.maxUs;
+                statusCount[status]++;
+                if (status == MODBUS_TRANSACTION_OK) {
+                    latencies[ok++] = micros() - sent;
+                }
+            }
+            double seconds = (micros() - start) / 1e6;
+            qsort(latencies, ok, sizeof(uint32_t), compareLatency);
+            qsort(lateness, done, sizeof(uint32_t), compareLatency);
+
+            double errorRate = done != 0 ? 100.0 * (done - ok) / done : 0;
+            printf("%-7u %-4u %-10s %4u %8.1f %8.2f %8.2f %8.2f %8.2f %7.2f %7u %5u %5u %7u %8.2f %8.2f\n",
+                   (unsigned)baudrates[b], target.slaveAddr, modelName(target.model), regs,
+                   seconds > 0 ? ok / seconds : 0, percentileMs(latencies, ok, 50), percentileMs(latencies, ok, 90),
+                   percentileMs(latencies, ok, 99), percentileMs(latencies, ok, 100), errorRate,
+                   (unsigned)statusCount[MODBUS_TRANSACTION_TIMEOUT], (unsigned)statusCount[MODBUS_TRANSACTION_CRC_ERROR],
+                   (unsigned)statusCount[MODBUS_TRANSACTION_EXCEPTION], (unsigned)statusCount[MODBUS_TRANSACTION_FAILED],
+                   percentileMs(lateness, done, 99), percentileMs(lateness, done, 100));
+            fflush(stdout);
+            allOk = allOk && ok == done;
+        }
+    }
+    delete[] latencies;
+    delete[] lateness;
+    return allOk ? 0 : 1;
+}
+
+/**
+ * @brief Build a one-register write in the way of the model's device class
+ * @return Frame length
+ *
+ * The PZEM-6L24 class writes its settings with function 0x10 in little-endian
+ * order; the other models take function 0x06.
+ */
+static uint8_t buildWrite(uint8_t* frame, const Target& target, uint16_t reg, uint16_t value) {
+    uint8_t length;
+    frame[0] = target.slaveAddr;
+    if (target.model == PZEM_MODEL_6L24) {
+        frame[1] = MODBUS_WRITE_MULTIPLE_REGISTERS;
+        frame[2] = reg >> 8;
+        frame[3] = reg & 0xFF;
+        frame[4] = 0;
+        frame[5] = 1;
+        frame[6] = 2;
+        frame[7] = value & 0xFF;
+        frame[8] = value >> 8;
+        length = 9;
+    } else {
+        frame[1] = MODBUS_WRITE_SINGLE_REGISTER;
+        frame[2] = reg >> 8;
+        frame[3] = reg & 0xFF;
+        frame[4] = value >> 8;
+        frame[5] = value & 0xFF;
+        length = 6;
+    }
+    uint16_t crc = modbusCRC16(frame, length);
+    frame[length++] = crc & 0xFF;
+    frame[length++] = crc >> 8;
+    return length;
+}
+
+/**
+ * @brief Translate KEY=VALUE into a holding register write for a model
+ *
+ * Keys: address, threshold (PZEM-004T, W), high and low (PZEM-003/017, V),
+ * range (PZEM-017, A), frequency (PZEM-6L24, Hz), or a register number for a
+ * raw write of a host-order value.
+ */
+static bool settingOf(uint8_t model, const char* key, const char* text, uint16_t* reg, uint16_t* value) {
+    const PZEMModelInfo* info = pzemModelInfo(model);
+    char* end;
+    double number = strtod(text, &end);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+
+    if (key[0] >= '0' && key[0] <= '9') {
+        *reg = (uint16_t)strtoul(key, &end, 0);
+        *value = (uint16_t)strtoul(text, NULL, 0);
+        return *end == '\0' && *reg < info->holdingRegs;
+    }
+    if (strcmp(key, "address") == 0 && number >= 1 && number <= 247) {
+        *reg = (model == PZEM_MODEL_6L24) ? 0x0000 : 0x0002;
+        *value = (model == PZEM_MODEL_6L24) ? (uint16_t)(((uint16_t)number << 8) | 0x01) : (uint16_t)number;
+        return true;
+    }
+    if (strcmp(key, "threshold") == 0 && model == PZEM_MODEL_004T && number >= 0 && number <= 65535) {
+        *reg = 0x0001;
+        *value = (uint16_t)(number + 0.5);
+        return true;
+    }
+    if ((strcmp(key, "high") == 0 || strcmp(key, "low") == 0) &&
+        (model == PZEM_MODEL_003 || model == PZEM_MODEL_017) && number >= 0 && number <= 655.35) {
+        *reg = (key[0] == 'h') ? 0x0000 : 0x0001;
+        *value = (uint16_t)(number * 100 + 0.5);
+        return true;
+    }
+    if (strcmp(key, "range") == 0 && model == PZEM_MODEL_017) {
+        static const uint16_t RANGES[] = { 100, 50, 200, 300 };
+        for (uint16_t code = 0; code < 4; code++) {
+            if (number == RANGES[code]) {
+                *reg = 0x0003;
+                *value = code;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (strcmp(key, "frequency") == 0 && model == PZEM_MODEL_6L24 && (number == 50 || number == 60)) {
+        *reg = 0x0002;
+        *value = (number == 60) ? 1 : 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief One queued write of set
+ */
+struct PendingWrite {
+    const Target* target;         ///< Device written
+    const char* setting;          ///< KEY=VALUE given
+    ModbusTransaction txn;        ///< Transaction
+    uint8_t request[11];          ///< Request frame
+    uint8_t response[16];         ///< Response frame
+};
+
+/**
+ * @brief set: queue every write of every target at once, address changes last
+ */
+static int cmdSet(Target* targets, uint16_t count, char** settings, uint8_t settingCount) {
+    if (settingCount == 0 || settingCount > PZEMCTL_MAX_SETTINGS) {
+        fprintf(stderr, "pzemctl: set takes 1 to %u KEY=VALUE pairs\n", PZEMCTL_MAX_SETTINGS);
+        return 2;
+    }
+    if (!usePort(opts.baudrate) || !identifyTargets(targets, count)) {
+        return 1;
+    }
+
+    PendingWrite* writes = new PendingWrite[count * settingCount];
+    uint16_t writeCount = 0;
+    bool valid = true;
+
+    // Two passes: a device stops answering at its old address once the address is written
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        for (uint16_t t = 0; t < count; t++) {
+            for (uint8_t s = 0; s < settingCount; s++) {
+                char key[32];
+                const char* equals = strchr(settings[s], '=');
+                size_t length = equals != NULL ? (size_t)(equals - settings[s]) : 0;
+                if (length == 0 || length >= sizeof(key)) {
+                    fprintf(stderr, "pzemctl: invalid setting '%s'\n", settings[s]);
+                    valid = false;
+                    continue;
+                }
+                memcpy(key, settings[s], length);
+                key[length] = '\0';
+                if ((strcmp(key, "address") == 0) != (pass == 1)) {
+                    continue;
+                }
+                if (pass == 1 && count > 1) {
+                    fprintf(stderr, "pzemctl: address can only be set on one device at a time\n");
+                    valid = false;
+                    continue;
+                }
+
+                uint16_t reg;
+                uint16_t value;
+                if (!settingOf(targets[t].model, key, equals + 1, &reg, &value)) {
+                    fprintf(stderr, "pzemctl: '%s' is not a valid setting of %s\n", settings[s],
+                            modelName(targets[t].model));
+                    valid = false;
+                    continue;
+                }
+
+                PendingWrite& write = writes[writeCount++];
+                write.target = &targets[t];
+                write.setting = settings[s];
+                uint8_t frameLength = buildWrite(write.request, targets[t], reg, value);
+                write.txn.prepare(write.request, frameLength, write.response, sizeof(write.response), 8,
+                                  timeoutFor(frameLength, 8));
+            }
+        }
+    }
+    if (!valid) {
+        delete[] writes;
+        return 2;
+    }
+
+    for (uint16_t w = 0; w < writeCount; w++) {
+        transport.submit(&writes[w].txn);
+    }
+    while (!transport.isIdle()) {
+        transport.poll();
+        serial.waitReadable(1);
+    }
+
+    uint16_t failed = 0;
+    for (uint16_t w = 0; w < writeCount; w++) {
+        uint8_t status = writes[w].txn.status;
+        printf("%-4u %-10s %-20s %s\n", writes[w].target->slaveAddr, modelName(writes[w].target->model),
+               writes[w].setting, statusName(status));
+        failed += (status != MODBUS_TRANSACTION_OK);
+    }
+    delete[] writes;
+    return failed == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Check that a device answers the liveness probe of its model
+ */
+static bool probe(const Target& target, uint8_t attempts) {
+    const PZEMModelInfo* info = pzemModelInfo(target.model);
+    uint8_t response[16];
+    for (uint8_t i = 0; i < attempts; i++) {
+        if (readRegisters(target.slaveAddr, info->probeFunction, info->probeRegister, 1,
+                          response, sizeof(response)) == MODBUS_TRANSACTION_OK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief migrate-baud: move PZEM-6L24 devices to a new baud rate and check them
+ *
+ * Every device is first read at the current rate (its connection type shares
+ * the register and must be kept); nothing is written unless all answer. Each
+ * device acknowledges at the old rate, then switches. The port follows once all
+ * are written, and every device must answer at the new rate.
+ */
+static int cmdMigrateBaud(Target* targets, uint16_t count, const char* rateText) {
+    uint32_t newRate = strtoul(rateText, NULL, 10);
+    uint8_t code = PZEM6L24_BAUDRATE_COUNT;
+    for (uint8_t i = 0; i < PZEM6L24_BAUDRATE_COUNT; i++) {
+        if (PZEM6L24_BAUDRATES[i] == newRate) {
+            code = i;
+        }
+    }
+    if (code == PZEM6L24_BAUDRATE_COUNT) {
+        fprintf(stderr, "pzemctl: unsupported baud rate '%s'\n", rateText);
+        return 2;
+    }
+    if (!usePort(opts.baudrate) || !identifyTargets(targets, count)) {
+        return 1;
+    }
+
+    uint16_t settings[PZEMCTL_MAX_TARGETS];
+    for (uint16_t t = 0; t < count; t++) {
+        if (targets[t].model != PZEM_MODEL_6L24) {
+            fprintf(stderr, "pzemctl: %u is a %s, which only runs at 9600 baud\n", targets[t].slaveAddr,
+                    modelName(targets[t].model));
+            return 1;
+        }
+        if (!readValues(targets[t].slaveAddr, targets[t].model, MODBUS_READ_HOLDING_REGISTERS, 0x0001, 1,
+                        &settings[t])) {
+            fprintf(stderr, "pzemctl: %u does not answer at %u baud, nothing changed\n", targets[t].slaveAddr,
+                    (unsigned)opts.baudrate);
+            return 1;
+        }
+    }
+
+    for (uint16_t t = 0; t < count; t++) {
+        uint8_t request[11];
+        uint8_t response[16];
+        uint8_t length = buildWrite(request, targets[t], 0x0001, (settings[t] & 0xFF00) | code);
+        ModbusTransaction txn;
+        txn.prepare(request, length, response, sizeof(response), 8, timeoutFor(length, 8));
+        uint8_t status = transact(&txn);
+        printf("%-4u write %s\n", targets[t].slaveAddr, statusName(status));
+    }
+
+    if (!usePort(newRate)) {
+        return 1;
+    }
+    delay(PZEMCTL_MIGRATE_SETTLE_MS);
+
+    uint16_t failed = 0;
+    for (uint16_t t = 0; t < count; t++) {
+        bool migrated = probe(targets[t], PZEMCTL_MIGRATE_RETRIES);
+        printf("%-4u %s at %u baud\n", targets[t].slaveAddr, migrated ? "answers" : "does not answer",
+               (unsigned)newRate);
+        failed += !migrated;
+    }
+    if (failed != 0) {
+        // Tell a write that did not take from a device lost on the line
+        usePort(opts.baudrate);
+        for (uint16_t t = 0; t < count; t++) {
+            if (probe(targets[t], 1)) {
+                printf("%-4u still answers at %u baud\n", targets[t].slaveAddr, (unsigned)opts.baudrate);
+            }
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemctl [options] COMMAND [arguments]\n"
+        "Commands:\n"
+        "  scan                         Find devices and identify their model\n"
+        "  poll TARGETS                 Stream snapshots (CSV, or JSON lines with --json)\n"
+        "  bench TARGETS                Throughput, latency percentiles and error rates\n"
+        "  set TARGETS KEY=VALUE ...    Write settings, all queued at once\n"
+        "                               (address, threshold, high, low, range, frequency, REG)\n"
+        "  migrate-baud TARGETS BAUD    Move PZEM-6L24 devices to a new baud rate\n"
+        "TARGETS: addresses and ranges, optionally with a model: 1,2,5-8 or 1:004t,2:6l24\n"
+        "Options:\n"
+        "  -p, --port PATH      Serial port (default: " PZEMCTL_DEFAULT_PORT ")\n"
+        "  -b, --baud RATE      Baud rate (default: 9600)\n"
+        "  --bauds R1,R2,...    Baud rates tried by scan and bench\n"
+        "  --timeout MS         Device response time on top of the wire time (default: 25)\n"
+        "  --silence MS         End-of-frame silence (default: %u)\n"
+        "  --from A, --to B     Address range of scan (default: 1-247)\n"
+        "  --rate HZ            Snapshots per second and device (default: 1)\n"
+        "  --count N            Snapshots printed by poll, transactions per device by bench\n"
+        "  --regs N             Registers read by bench (default: snapshot span)\n"
+        "  --json               JSON lines instead of CSV\n"
+        HOST_REALTIME_USAGE,
+        MODBUS_RTU_FRAME_SILENCE_MS);
+}
+
+/**
+ * @brief Parse a comma-separated baud rate list
+ */
+static bool parseBaudrates(const char* list) {
+    opts.baudrateCount = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        unsigned long rate = strtoul(p, &end, 10);
+        if (end == p || rate == 0 || opts.baudrateCount >= PZEMCTL_MAX_BAUDRATES) {
+            return false;
+        }
+        opts.baudrates[opts.baudrateCount++] = rate;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return false;
+        }
+    }
+    return opts.baudrateCount > 0;
+}
+
+int main(int argc, char** argv) {
+    opts.port = PZEMCTL_DEFAULT_PORT;
+    opts.baudrate = PZEMCTL_DEFAULT_BAUDRATE;
+    opts.baudrateCount = 0;
+    opts.timeout = PZEMCTL_DEFAULT_TIMEOUT_MS;
+    opts.silence = -1;
+    opts.from = 1;
+    opts.to = 247;
+    opts.rate = 1.0;
+    opts.count = 0;
+    opts.json = false;
+    opts.regs = 0;
+    hostRealtimeDefaults(&opts.realtime);
+
+    char* args[PZEMCTL_MAX_SETTINGS + 3];
+    int argCount = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool used = true;
+        uint8_t realtime = hostRealtimeOption(argc, argv, &i, &opts.realtime);
+        if (realtime != HOST_OPTION_NONE) {
+            if (realtime == HOST_OPTION_OK) {
+                continue;
+            }
+            used = false;
+        } else if ((strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0) && value != NULL) {
+            opts.port = value;
+        } else if ((strcmp(arg, "-b") == 0 || strcmp(arg, "--baud") == 0) && value != NULL) {
+            opts.baudrate = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--bauds") == 0 && value != NULL) {
+            used = parseBaudrates(value);
+        } else if (strcmp(arg, "--timeout") == 0 && value != NULL) {
+            opts.timeout = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--silence") == 0 && value != NULL) {
+            opts.silence = strtol(value, NULL, 10);
+        } else if (strcmp(arg, "--from") == 0 && value != NULL) {
+            opts.from = (uint8_t)strtoul(value, NULL, 0);
+        } else if (strcmp(arg, "--to") == 0 && value != NULL) {
+            opts.to = (uint8_t)strtoul(value, NULL, 0);
+        } else if (strcmp(arg, "--rate") == 0 && value != NULL) {
+            opts.rate = strtod(value, NULL);
+        } else if (strcmp(arg, "--count") == 0 && value != NULL) {
+            opts.count = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--regs") == 0 && value != NULL) {
+            opts.regs = (uint16_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--json") == 0) {
+            opts.json = true;
+            continue;
+        } else if (arg[0] == '-') {
+            used = false;
+        } else if (argCount < (int)(sizeof(args) / sizeof(args[0]))) {
+            args[argCount++] = argv[i];
+            continue;
+        } else {
+            used = false;
+        }
+        if (!used) {
+            fprintf(stderr, "pzemctl: invalid option '%s'\n", arg);
+            usage();
+            return 2;
+        }
+        i++;
+    }
+
+    if (argCount == 0 || opts.rate <= 0 || opts.from < 1 || opts.to > 247 || opts.from > opts.to ||
+        opts.regs > MODBUS_MAX_READ_REGISTERS) {
+        usage();
+        return 2;
+    }
+    if (opts.silence >= 0) {
+        transport.setTimings(MODBUS_RTU_TURNAROUND_MS, opts.silence);
+    }
+    if (!hostRealtimeApply(&opts.realtime)) {
+        fprintf(stderr, "pzemctl: %s\n", hostRealtimeError());
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    const char* command = args[0];
+    if (strcmp(command, "scan") == 0 && argCount == 1) {
+        return cmdScan();
+    }
+
+    static Target targets[PZEMCTL_MAX_TARGETS];
+    uint16_t count = 0;
+    if (argCount < 2 || !parseTargets(args[1], targets, &count)) {
+        usage();
+        return 2;
+    }
+    if (strcmp(command, "poll") == 0 && argCount == 2) {
+        return cmdPoll(targets, count);
+    }
+    if (strcmp(command, "bench") == 0 && argCount == 2) {
+        return cmdBench(targets, count);
+    }
+    if (strcmp(command, "set") == 0) {
+        return cmdSet(targets, count, args + 2, argCount - 2);
+    }
+    if (strcmp(command, "migrate-baud") == 0 && argCount == 3) {
+        return cmdMigrateBaud(targets, count, args[2]);
+    }
+    usage();
+    return 2;
+}
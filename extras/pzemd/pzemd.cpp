@@ -0,0 +1,1024 @@
+/**
+ * @file pzemd.cpp
+ * @brief Polling daemon serving meter data to local clients over a Unix socket (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * pzemd owns the serial ports: each bus runs a PZEMScheduler reading the
+ * snapshot span of every device at its own period, and every read updates a
+ * latest-value table and per-minute rollups. Clients (historian, web UI, alarm
+ * service) connect to a Unix domain socket and send one request per line; each
+ * answer is one JSON object per line.
+ *
+ *   devices                  Configured devices with model and state
+ *   get DEV|*                Latest values of one or all devices
+ *   rollup DEV [MINUTES]     Min/max/avg of every field over the last minutes (default: 15)
+ *   subscribe DEV|*          Push every new reading ({"event":"update",...})
+ *   unsubscribe DEV|*        Stop pushing
+ *   cadence DEV|*            Achieved read period, jitter and staleness of one or all devices
+ *   stats                    Daemon counters
+ *
+ * DEV is BUS:ADDR (bus index in command-line order) or ADDR alone for the
+ * first bus holding that address.
+ *
+ * Everything runs in one thread around poll() and no call blocks: a client
+ * that does not read its socket only fills its own output buffer. Requests of
+ * such a client are left unread until its answers fit, and pushes that no
+ * longer fit are conflated: the client gets the latest reading of each device
+ * it missed once it catches up, never a backlog.
+ *
+ * Usage: pzemd [options] PORT[@BAUD]=ADDR:MODEL[/PERIOD_MS],... ...
+ *   --socket PATH   Unix socket path (default: /tmp/pzemd.sock)
+ *   --period MS     Read period of devices given without one (default: 1000)
+ *   --timeout MS    Device response time on top of the wire time (default: 25)
+ *   --cpu, --fifo, --mlock, --wait, --yield-us   Scheduling of the poller (HostRealtime.h)
+ *
+ * Example: pzemd /dev/ttyUSB0=1:004t,2:004t/500 /dev/ttyUSB1@19200=5:6l24
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HostRealtime.h"
+#include "PosixSerial.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+#include "PZEMFields.h"
+#include "PZEMModel.h"
+#include "PZEMRegisterCache.h"
+#include "PZEMScheduler.h"
+
+/**
+ * @defgroup PzemdConfig pzemd Configuration
+ * @{
+ */
+#define PZEMD_DEFAULT_SOCKET     "/tmp/pzemd.sock"  ///< Socket path used without --socket
+#define PZEMD_DEFAULT_PERIOD_MS  1000    ///< Read period of devices given without one
+#define PZEMD_DEFAULT_TIMEOUT_MS 25      ///< Device processing time on top of the wire time
+#define PZEMD_MAX_BUSES          8       ///< Serial ports
+#define PZEMD_MAX_DEVICES        64      ///< Devices over all buses (one bit each in client masks)
+#define PZEMD_MAX_CLIENTS        256     ///< Simultaneous client connections
+#define PZEMD_CLIENT_IN_SIZE     1024    ///< Longest request line
+#define PZEMD_CLIENT_OUT_SIZE    65536   ///< Output buffer per client
+#define PZEMD_MAX_RESPONSE       49152   ///< Room needed before a request is served (largest answer)
+#define PZEMD_UPDATE_SIZE        1024    ///< Longest update line
+#define PZEMD_ROLLUP_MINUTES     60      ///< Minutes of rollups kept per device
+#define PZEMD_DEFAULT_ROLLUP     15      ///< Minutes aggregated by rollup without MINUTES
+#define PZEMD_POLL_BUDGET_US     100     ///< Time budget of each scheduler poll (poll() waits for the port)
+#define PZEMD_BUSY_WAIT_US       1000    ///< Longest wait while a read is in flight
+#define PZEMD_JITTER_SAMPLES     1024    ///< Reads kept for the jitter percentiles of stats
+/** @} */
+
+/**
+ * @brief Aggregates of one minute of readings
+ */
+struct Rollup {
+    uint32_t minute;                          ///< Minutes since the epoch (0 = unused)
+    uint32_t count;                           ///< Readings
+    float min[PZEM_FIELD_MAX_PER_MODEL];      ///< Smallest value per field
+    float max[PZEM_FIELD_MAX_PER_MODEL];      ///< Largest value per field
+    double sum[PZEM_FIELD_MAX_PER_MODEL];     ///< Sum of the values per field
+};
+
+/**
+ * @brief One configured device
+ */
+struct Device {
+    uint8_t bus;                              ///< Bus index
+    uint8_t slaveAddr;                        ///< Slave address
+    uint8_t model;                            ///< Model identifier
+    uint32_t period;                          ///< Read period in ms
+    bool valid;                               ///< A reading was received
+    double time;                              ///< Wall-clock time of the last reading (s)
+    PZEMSnapshot snapshot;                    ///< Last reading (host order)
+    uint32_t reads;                           ///< Successful reads
+    uint32_t failures;                        ///< Failed reads
+    char update[PZEMD_UPDATE_SIZE];           ///< Last update line, pushed to subscribers
+    uint16_t updateLength;                    ///< Length of the update line
+    Rollup rollups[PZEMD_ROLLUP_MINUTES];     ///< Ring of minute rollups
+};
+
+/**
+ * @brief Direction control that returns as soon as the request is queued
+ *
+ * USB RS485 adapters switch direction by themselves, and waiting in tcdrain()
+ * for each request to leave the port would stall every client for its wire
+ * time. The request wire time is part of the read timeout instead.
+ */
+class QueuedDirection : public ModbusDirectionControl {
+public:
+    void endTransmit(Stream*) {}
+};
+
+/**
+ * @brief One serial port with its transport, bus and scheduler
+ */
+struct Bus {
+    const char* port;                         ///< Serial port path
+    uint32_t baudrate;                        ///< Baud rate
+    PosixSerial serial;                       ///< Port
+    QueuedDirection direction;                ///< Non-blocking direction control
+    ModbusRTUTransport transport;             ///< Transport over the port
+    PZEMRegisterCache cache;                  ///< Registers read by the scheduler
+    PZEMBus bus;                              ///< Bus (liveness, application transactions)
+    PZEMScheduler scheduler;                  ///< Periodic snapshot reads
+    PZEMCadence cadence;                      ///< Achieved period of the scheduled reads
+    bool busy;                                ///< A read is in flight
+    uint32_t jitterUs;                        ///< Latest wake-up past a deadline during the read in flight
+
+    Bus() : port(NULL), baudrate(9600), transport(&serial), bus(transport), scheduler(bus), busy(false), jitterUs(0) {}
+};
+
+/**
+ * @brief One client connection
+ */
+struct Connection {
+    int fd;                                   ///< Socket (-1 = free slot)
+    char in[PZEMD_CLIENT_IN_SIZE];            ///< Received bytes not yet served
+    uint16_t inLength;                        ///< Bytes in the input buffer
+    bool discarding;                          ///< Skipping the rest of an overlong line
+    char* out;                                ///< Bytes to send
+    uint32_t outStart;                        ///< First unsent byte
+    uint32_t outEnd;                          ///< End of the unsent bytes
+    uint64_t subscribed;                      ///< Devices pushed to the client (bit = device index)
+    uint64_t dirty;                           ///< Updates conflated while the buffer was full
+};
+
+/**
+ * @brief Bounded text buffer for JSON answers
+ */
+struct Writer {
+    char* data;                               ///< Buffer
+    size_t size;                              ///< Buffer size
+    size_t length;                            ///< Bytes written
+    bool overflow;                            ///< Output was cut
+
+    /**
+     * @brief Append formatted text
+     */
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        if (overflow) {
+            return;
+        }
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(data + length, size - length, format, args);
+        va_end(args);
+        if (n < 0 || (size_t)n >= size - length) {
+            overflow = true;
+            return;
+        }
+        length += n;
+    }
+};
+
+static Bus* buses[PZEMD_MAX_BUSES];           ///< Configured buses
+static uint8_t busCount = 0;                  ///< Buses in use
+static Device* devices = NULL;                ///< Configured devices
+static uint8_t deviceCount = 0;               ///< Devices in use
+static Connection* clients = NULL;            ///< Client slots
+static uint16_t clientCount = 0;              ///< Clients connected
+static int listenFd = -1;                     ///< Listening socket
+static const char* socketPath = PZEMD_DEFAULT_SOCKET;  ///< Socket path
+static uint32_t defaultPeriod = PZEMD_DEFAULT_PERIOD_MS;  ///< Period of devices given without one
+static uint32_t responseTime = PZEMD_DEFAULT_TIMEOUT_MS;  ///< Device processing time
+static volatile sig_atomic_t running = 1;     ///< Cleared by SIGINT/SIGTERM
+static char scratch[PZEMD_MAX_RESPONSE];      ///< Answer being built
+
+/**
+ * @brief Daemon counters
+ */
+static struct {
+    double started;           ///< Start time (s)
+    uint64_t reads;           ///< Successful reads
+    uint64_t failures;        ///< Failed reads
+    uint64_t requests;        ///< Requests served
+    uint64_t pushes;          ///< Updates queued to subscribers
+    uint64_t conflated;       ///< Updates replaced by a later one before being queued
+    uint64_t connections;     ///< Connections accepted
+    uint32_t loopMaxUs;       ///< Longest loop iteration outside poll()
+    uint32_t jitter[PZEMD_JITTER_SAMPLES];  ///< Scheduling jitter of the last reads (us)
+    uint32_t jitterCount;     ///< Reads recorded in jitter (ring index)
+} stats;
+
+/**
+ * @brief Stop the main loop
+ */
+static void onSignal(int) {
+    running = 0;
+}
+
+/**
+ * @brief Wall-clock time in seconds
+ */
+static double wallTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Find a device by bus and address
+ */
+static int findDevice(uint8_t bus, uint8_t slaveAddr) {
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        if (devices[i].bus == bus && devices[i].slaveAddr == slaveAddr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Find a device from BUS:ADDR or ADDR
+ */
+static int parseDevice(const char* text) {
+    char* end;
+    unsigned long first = strtoul(text, &end, 10);
+    if (end == text) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char* addrText = end + 1;
+        unsigned long addr = strtoul(addrText, &end, 10);
+        if (end == addrText || *end != '\0' || first >= busCount || addr > 247) {
+            return -1;
+        }
+        return findDevice((uint8_t)first, (uint8_t)addr);
+    }
+    if (*end != '\0' || first > 247) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        if (devices[i].slaveAddr == first) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Write the common members of a device object
+ */
+static void writeDevice(Writer& w, const Device& dev) {
+    w.printf("\"id\":\"%u:%u\",\"model\":\"%s\",\"online\":%s", dev.bus, dev.slaveAddr, pzemModelInfo(dev.model)->name,
+             buses[dev.bus]->bus.isOnline(dev.slaveAddr) ? "true" : "false");
+    if (!dev.valid) {
+        w.printf(",\"time\":null,\"values\":null");
+        return;
+    }
+    w.printf(",\"time\":%.3f,\"age_ms\":%u,\"values\":{", dev.time, (unsigned)(millis() - dev.snapshot.timestamp));
+    uint8_t count;
+    const PZEMField* fields = pzemFields(dev.model, &count);
+    for (uint8_t f = 0; f < count; f++) {
+        w.printf("%s\"%s\":%.*f", f ? "," : "", fields[f].name, fields[f].decimals,
+                 pzemFieldValue(&fields[f], &dev.snapshot));
+    }
+    w.printf("}");
+}
+
+/**
+ * @brief Bytes waiting in a client output buffer
+ */
+static uint32_t pending(const Connection& c) {
+    return c.outEnd - c.outStart;
+}
+
+/**
+ * @brief Queue bytes to a client, if they fit
+ */
+static bool enqueue(Connection& c, const char* data, size_t length) {
+    if (length > PZEMD_CLIENT_OUT_SIZE - pending(c)) {
+        return false;
+    }
+    if (c.outEnd + length > PZEMD_CLIENT_OUT_SIZE) {
+        memmove(c.out, c.out + c.outStart, pending(c));
+        c.outEnd -= c.outStart;
+        c.outStart = 0;
+    }
+    memcpy(c.out + c.outEnd, data, length);
+    c.outEnd += length;
+    return true;
+}
+
+/**
+ * @brief Queue the latest update of a device, or remember it for later
+ */
+static void push(Connection& c, uint8_t device) {
+    uint64_t bit = 1ULL << device;
+    if (enqueue(c, devices[device].update, devices[device].updateLength)) {
+        c.dirty &= ~bit;
+        stats.pushes++;
+    } else {
+        if (c.dirty & bit) {
+            stats.conflated++;
+        }
+        c.dirty |= bit;
+    }
+}
+
+/**
+ * @brief Add a reading to the rollup of its minute
+ */
+static void addToRollup(Device& dev) {
+    uint32_t minute = (uint32_t)(dev.time / 60);
+    Rollup& r = dev.rollups[minute % PZEMD_ROLLUP_MINUTES];
+    uint8_t count;
+    const PZEMField* fields = pzemFields(dev.model, &count);
+    if (r.minute != minute) {
+        r.minute = minute;
+        r.count = 0;
+    }
+    for (uint8_t f = 0; f < count; f++) {
+        float value = (float)pzemFieldValue(&fields[f], &dev.snapshot);
+        if (r.count == 0) {
+            r.min[f] = value;
+            r.max[f] = value;
+            r.sum[f] = 0;
+        }
+        r.min[f] = value < r.min[f] ? value : r.min[f];
+        r.max[f] = value > r.max[f] ? value : r.max[f];
+        r.sum[f] += value;
+    }
+    r.count++;
+}
+
+/**
+ * @brief Take a finished scheduler read into the table and push it
+ */
+static void onRead(const PZEMFieldRead* read, void* context) {
+    uint8_t busIndex = (uint8_t)(uintptr_t)context;
+    stats.jitter[stats.jitterCount++ % PZEMD_JITTER_SAMPLES] = buses[busIndex]->jitterUs;
+    buses[busIndex]->jitterUs = 0;
+
+    int index = findDevice(busIndex, read->slaveAddr);
+    if (index < 0) {
+        return;
+    }
+    Device& dev = devices[index];
+    if (!read->success) {
+        dev.failures++;
+        stats.failures++;
+        return;
+    }
+
+    // The cache holds wire order; snapshots are in host order
+    uint16_t raw[PZEM_SNAPSHOT_MAX_REGISTERS];
+    if (!buses[busIndex]->cache.read(read->slaveAddr, read->function, read->startAddr, read->numRegs, raw)) {
+        return;
+    }
+    bool bigEndian = pzemModelInfo(dev.model)->bigEndian;
+    for (uint16_t i = 0; i < read->numRegs; i++) {
+        dev.snapshot.regs[i] = bigEndian ? raw[i] : (uint16_t)((raw[i] << 8) | (raw[i] >> 8));
+    }
+    dev.snapshot.slaveAddr = dev.slaveAddr;
+    dev.snapshot.model = dev.model;
+    dev.snapshot.count = read->numRegs;
+    dev.snapshot.timestamp = read->timestamp;
+    dev.time = wallTime();
+    dev.valid = true;
+    dev.reads++;
+    stats.reads++;
+    addToRollup(dev);
+
+    Writer w = { dev.update, sizeof(dev.update), 0, false };
+    w.printf("{\"event\":\"update\",");
+    writeDevice(w, dev);
+    w.printf("}\n");
+    dev.updateLength = w.overflow ? 0 : w.length;
+
+    uint64_t bit = 1ULL << index;
+    for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS && dev.updateLength != 0; i++) {
+        if (clients[i].fd >= 0 && (clients[i].subscribed & bit)) {
+            push(clients[i], index);
+        }
+    }
+}
+
+/**
+ * @brief Sort helper for jitter samples
+ */
+static int compareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Get a percentile of the scheduling jitter of the last reads
+ */
+static uint32_t jitterPercentile(uint32_t percentile) {
+    static uint32_t sorted[PZEMD_JITTER_SAMPLES];
+    uint32_t count = stats.jitterCount < PZEMD_JITTER_SAMPLES ? stats.jitterCount : PZEMD_JITTER_SAMPLES;
+    if (count == 0) {
+        return 0;
+    }
+    memcpy(sorted, stats.jitter, count * sizeof(uint32_t));
+    qsort(sorted, count, sizeof(uint32_t), compareU32);
+    return sorted[(count - 1) * percentile / 100];
+}
+
+/**
+ * @brief Answer "rollup DEV [MINUTES]"
+ */
+static void answerRollup(Writer& w, const Device& dev, uint32_t minutes) {
+    uint8_t count;
+    const PZEMField* fields = pzemFields(dev.model, &count);
+    uint32_t now = (uint32_t)(wallTime() / 60);
+    float min[PZEM_FIELD_MAX_PER_MODEL];
+    float max[PZEM_FIELD_MAX_PER_MODEL];
+    double sum[PZEM_FIELD_MAX_PER_MODEL];
+    uint32_t samples = 0;
+
+    for (uint32_t m = 0; m < minutes; m++) {
+        const Rollup& r = dev.rollups[(now - m) % PZEMD_ROLLUP_MINUTES];
+        if (r.minute != now - m || r.count == 0) {
+            continue;
+        }
+        for (uint8_t f = 0; f < count; f++) {
+            min[f] = (samples == 0 || r.min[f] < min[f]) ? r.min[f] : min[f];
+            max[f] = (samples == 0 || r.max[f] > max[f]) ? r.max[f] : max[f];
+            sum[f] = (samples == 0 ? 0 : sum[f]) + r.sum[f];
+        }
+        samples += r.count;
+    }
+
+    w.printf("{\"id\":\"%u:%u\",\"minutes\":%u,\"samples\":%u,\"fields\":{", dev.bus, dev.slaveAddr,
+             (unsigned)minutes, (unsigned)samples);
+    for (uint8_t f = 0; f < count && samples != 0; f++) {
+        int d = fields[f].decimals;
+        w.printf("%s\"%s\":{\"min\":%.*f,\"max\":%.*f,\"avg\":%.*f}", f ? "," : "", fields[f].name,
+                 d, min[f], d, max[f], d + 1, sum[f] / samples);
+    }
+    w.printf("}}\n");
+}
+
+/**
+ * @brief Answer "cadence DEV|*" for the tracks of one device, or of every device if dev is NULL
+ */
+static void answerCadence(Writer& w, const Device* dev) {
+    w.printf("{\"buckets_pct\":[");
+    for (uint8_t k = 0; k < PZEM_CADENCE_BUCKETS; k++) {
+        w.printf(k ? ",%u" : "%u", (unsigned)PZEMCadence::getBucketLimit(k));
+    }
+    w.printf("],\"tracks\":[");
+    bool first = true;
+    for (uint8_t b = 0; b < busCount; b++) {
+        if (dev != NULL && dev->bus != b) {
+            continue;
+        }
+        PZEMCadenceStats s;
+        for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+            if (!buses[b]->cadence.getStats(i, &s) || (dev != NULL && s.slaveAddr != dev->slaveAddr)) {
+                continue;
+            }
+            w.printf("%s{\"id\":\"%u:%u\",\"function\":%u,\"start\":%u,\"registers\":%u,\"period_ms\":%u,"
+                     "\"updates\":%u,\"age_ms\":%u,\"missed\":%u,\"interval_mean_ms\":%u,\"jitter_mean_ms\":%u,"
+                     "\"jitter_max_ms\":%u,\"histogram\":[", first ? "" : ",", b, s.slaveAddr, s.function,
+                     s.startAddr, s.numRegs, (unsigned)s.periodMs, (unsigned)s.updates, (unsigned)s.ageMs,
+                     (unsigned)s.missed, (unsigned)s.meanIntervalMs, (unsigned)s.jitterMeanMs,
+                     (unsigned)s.jitterMaxMs);
+            for (uint8_t k = 0; k < PZEM_CADENCE_BUCKETS; k++) {
+                w.printf(k ? ",%u" : "%u", (unsigned)s.histogram[k]);
+            }
+            w.printf("]}");
+            first = false;
+        }
+    }
+    w.printf("]}\n");
+}
+
+/**
+ * @brief Serve one request line into an answer
+ */
+static void serve(Connection& c, char* line, Writer& w) {
+    char* save;
+    const char* command = strtok_r(line, " \t\r", &save);
+    const char* arg = strtok_r(NULL, " \t\r", &save);
+    const char* arg2 = strtok_r(NULL, " \t\r", &save);
+    stats.requests++;
+
+    if (command == NULL) {
+        w.printf("{\"error\":\"empty request\"}\n");
+        return;
+    }
+
+    if (strcmp(command, "devices") == 0) {
+        w.printf("{\"devices\":[");
+        for (uint8_t i = 0; i < deviceCount; i++) {
+            const Device& dev = devices[i];
+            w.printf("%s{\"id\":\"%u:%u\",\"bus\":\"%s\",\"address\":%u,\"model\":\"%s\",\"period\":%u,"
+                     "\"online\":%s,\"reads\":%u,\"failures\":%u}", i ? "," : "", dev.bus, dev.slaveAddr,
+                     buses[dev.bus]->port, dev.slaveAddr, pzemModelInfo(dev.model)->name, (unsigned)dev.period,
+                     buses[dev.bus]->bus.isOnline(dev.slaveAddr) ? "true" : "false",
+                     (unsigned)dev.reads, (unsigned)dev.failures);
+        }
+        w.printf("]}\n");
+        return;
+    }
+
+    if (strcmp(command, "stats") == 0) {
+        uint64_t overruns = 0;
+        uint64_t missed = 0;
+        for (uint8_t b = 0; b < busCount; b++) {
+            overruns += buses[b]->scheduler.getOverrunCount();
+            PZEMCadenceStats s;
+            for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+                if (buses[b]->cadence.getStats(i, &s)) {
+                    missed += s.missed;
+                }
+            }
+        }
+        w.printf("{\"uptime\":%.1f,\"devices\":%u,\"clients\":%u,\"connections\":%llu,\"requests\":%llu,"
+                 "\"reads\":%llu,\"failures\":%llu,\"overruns\":%llu,\"missed\":%llu,\"pushes\":%llu,"
+                 "\"conflated\":%llu,\"loop_max_us\":%u,\"jitter_p50_us\":%u,\"jitter_p99_us\":%u,\"jitter_max_us\":%u}\n",
+                 wallTime() - stats.started, deviceCount, clientCount,
+                 (unsigned long long)stats.connections, (unsigned long long)stats.requests,
+                 (unsigned long long)stats.reads, (unsigned long long)stats.failures,
+                 (unsigned long long)overruns, (unsigned long long)missed, (unsigned long long)stats.pushes,
+                 (unsigned long long)stats.conflated, (unsigned)stats.loopMaxUs, (unsigned)jitterPercentile(50),
+                 (unsigned)jitterPercentile(99), (unsigned)jitterPercentile(100));
+        return;
+    }
+
+    bool get = strcmp(command, "get") == 0;
+    bool rollup = strcmp(command, "rollup") == 0;
+    bool subscribe = strcmp(command, "subscribe") == 0;
+    bool cadence = strcmp(command, "cadence") == 0;
+    if (!get && !rollup && !subscribe && !cadence && strcmp(command, "unsubscribe") != 0) {
+        w.printf("{\"error\":\"unknown request\"}\n");
+        return;
+    }
+
+    bool all = arg != NULL && strcmp(arg, "*") == 0;
+    int index = (arg != NULL && !all) ? parseDevice(arg) : -1;
+    if (arg == NULL || (!all && index < 0)) {
+        w.printf("{\"error\":\"unknown device\"}\n");
+        return;
+    }
+    uint64_t mask = all ? (deviceCount == 64 ? ~0ULL : (1ULL << deviceCount) - 1) : (1ULL << index);
+
+    if (get) {
+        if (!all) {
+            w.printf("{");
+            writeDevice(w, devices[index]);
+            w.printf("}\n");
+            return;
+        }
+        w.printf("{\"devices\":[");
+        for (uint8_t i = 0; i < deviceCount; i++) {
+            w.printf(i ? ",{" : "{");
+            writeDevice(w, devices[i]);
+            w.printf("}");
+        }
+        w.printf("]}\n");
+    } else if (rollup) {
+        if (all) {
+            w.printf("{\"error\":\"rollup takes one device\"}\n");
+            return;
+        }
+        uint32_t minutes = arg2 != NULL ? strtoul(arg2, NULL, 10) : PZEMD_DEFAULT_ROLLUP;
+        if (minutes < 1 || minutes > PZEMD_ROLLUP_MINUTES) {
+            w.printf("{\"error\":\"minutes must be 1 to %u\"}\n", PZEMD_ROLLUP_MINUTES);
+            return;
+        }
+        answerRollup(w, devices[index], minutes);
+    } else if (cadence) {
+        answerCadence(w, all ? NULL : &devices[index]);
+    } else if (subscribe) {
+        c.subscribed |= mask;
+        w.printf("{\"subscribed\":%u}\n", (unsigned)__builtin_popcountll(c.subscribed));
+    } else {
+        c.subscribed &= ~mask;
+        c.dirty &= ~mask;
+        w.printf("{\"subscribed\":%u}\n", (unsigned)__builtin_popcountll(c.subscribed));
+    }
+}
+
+/**
+ * @brief Serve the complete request lines of a client while its answers fit
+ */
+static void serveInput(Connection& c) {
+    while (PZEMD_CLIENT_OUT_SIZE - pending(c) >= PZEMD_MAX_RESPONSE) {
+        char* newline = (char*)memchr(c.in, '\n', c.inLength);
+        if (newline == NULL) {
+            if (c.inLength == sizeof(c.in)) {
+                // Overlong line: answer once and drop it up to its end rather than stall the client
+                static const char ERROR[] = "{\"error\":\"request too long\"}\n";
+                if (!c.discarding) {
+                    enqueue(c, ERROR, sizeof(ERROR) - 1);
+                }
+                c.discarding = true;
+                c.inLength = 0;
+            }
+            return;
+        }
+        *newline = '\0';
+        uint16_t used = (uint16_t)(newline + 1 - c.in);
+        if (c.discarding) {
+            c.discarding = false;
+            memmove(c.in, newline + 1, c.inLength - used);
+            c.inLength -= used;
+            continue;
+        }
+
+        Writer w = { scratch, sizeof(scratch), 0, false };
+        serve(c, c.in, w);
+        if (w.overflow) {
+            w.length = 0;
+            w.overflow = false;
+            w.printf("{\"error\":\"answer too large\"}\n");
+        }
+        enqueue(c, w.data, w.length);
+        memmove(c.in, newline + 1, c.inLength - used);
+        c.inLength -= used;
+    }
+}
+
+/**
+ * @brief Close a client connection
+ */
+static void closeClient(Connection& c) {
+    close(c.fd);
+    c.fd = -1;
+    free(c.out);
+    c.out = NULL;
+    clientCount--;
+}
+
+/**
+ * @brief Send what a client can take, then catch up conflated updates and requests
+ * @return false if the connection failed
+ */
+static bool flushClient(Connection& c) {
+    while (pending(c) > 0) {
+        ssize_t n = send(c.fd, c.out + c.outStart, pending(c), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            c.outStart += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (pending(c) == 0) {
+        c.outStart = 0;
+        c.outEnd = 0;
+    }
+
+    // Latest reading of every device missed while the buffer was full
+    while (c.dirty != 0 && PZEMD_CLIENT_OUT_SIZE - pending(c) >= PZEMD_UPDATE_SIZE) {
+        uint8_t device = (uint8_t)__builtin_ctzll(c.dirty);
+        c.dirty &= ~(1ULL << device);
+        if (enqueue(c, devices[device].update, devices[device].updateLength)) {
+            stats.pushes++;
+        }
+    }
+    serveInput(c);
+    return true;
+}
+
+/**
+ * @brief Read what a client sent and serve it
+ * @return false if the connection closed
+ */
+static bool receiveClient(Connection& c) {
+    while (c.inLength < sizeof(c.in)) {
+        ssize_t n = recv(c.fd, c.in + c.inLength, sizeof(c.in) - c.inLength, MSG_DONTWAIT);
+        if (n > 0) {
+            c.inLength += n;
+            continue;
+        }
+        if (n == 0) {
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        return false;
+    }
+    serveInput(c);
+    return true;
+}
+
+/**
+ * @brief Accept every pending connection
+ */
+static void acceptClients() {
+    while (true) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        stats.connections++;
+
+        Connection* slot = NULL;
+        for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS && slot == NULL; i++) {
+            slot = clients[i].fd < 0 ? &clients[i] : NULL;
+        }
+        char* out = slot != NULL ? (char*)malloc(PZEMD_CLIENT_OUT_SIZE) : NULL;
+        if (out == NULL) {
+            close(fd);
+            continue;
+        }
+        slot->fd = fd;
+        slot->inLength = 0;
+        slot->discarding = false;
+        slot->out = out;
+        slot->outStart = 0;
+        slot->outEnd = 0;
+        slot->subscribed = 0;
+        slot->dirty = 0;
+        clientCount++;
+    }
+}
+
+/**
+ * @brief Parse PORT[@BAUD]=ADDR:MODEL[/PERIOD],... and add the bus and its devices
+ */
+static bool addBus(char* spec) {
+    char* equals = strchr(spec, '=');
+    if (equals == NULL || busCount >= PZEMD_MAX_BUSES) {
+        return false;
+    }
+    *equals = '\0';
+    Bus* bus = new Bus();
+    bus->port = spec;
+    char* at = strrchr(spec, '@');
+    if (at != NULL) {
+        *at = '\0';
+        bus->baudrate = strtoul(at + 1, NULL, 10);
+    }
+
+    uint8_t busIndex = busCount;
+    uint8_t onBus = 0;
+    char* save;
+    for (char* item = strtok_r(equals + 1, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char* colon = strchr(item, ':');
+        if (colon == NULL || deviceCount >= PZEMD_MAX_DEVICES || onBus >= PZEM_CACHE_MAX_DEVICES) {
+            delete bus;
+            return false;
+        }
+        *colon = '\0';
+        char* slash = strchr(colon + 1, '/');
+        uint32_t period = defaultPeriod;
+        if (slash != NULL) {
+            *slash = '\0';
+            period = strtoul(slash + 1, NULL, 10);
+        }
+        unsigned long addr = strtoul(item, NULL, 10);
+        uint8_t model = pzemModelByName(colon + 1);
+        if (addr < 1 || addr > 247 || model == PZEM_MODEL_UNKNOWN || period == 0 ||
+            findDevice(busIndex, (uint8_t)addr) >= 0) {
+            delete bus;
+            return false;
+        }
+
+        Device& dev = devices[deviceCount++];
+        memset(&dev, 0, sizeof(dev));
+        dev.bus = busIndex;
+        dev.slaveAddr = (uint8_t)addr;
+        dev.model = model;
+        dev.period = period;
+        onBus++;
+    }
+    if (onBus == 0) {
+        delete bus;
+        return false;
+    }
+    buses[busCount++] = bus;
+    return true;
+}
+
+/**
+ * @brief Open a bus and schedule its devices
+ */
+static bool startBus(uint8_t index) {
+    Bus* b = buses[index];
+    if (!b->serial.open(b->port, b->baudrate)) {
+        fprintf(stderr, "pzemd: cannot open %s at %u baud: %s\n", b->port, (unsigned)b->baudrate, strerror(errno));
+        return false;
+    }
+    b->transport.setDirectionControl(&b->direction);
+    b->bus.setInterval(PZEM_BUS_NO_SWEEP);
+    b->bus.setRegisterCache(&b->cache);
+
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        if (devices[i].bus != index) {
+            continue;
+        }
+        const PZEMModelInfo* info = pzemModelInfo(devices[i].model);
+        b->bus.addDevice(devices[i].slaveAddr, devices[i].model);
+        if (b->scheduler.subscribe(devices[i].slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0, info->snapshotRegs,
+                                   devices[i].period) == PZEM_SCHEDULER_INVALID) {
+            fprintf(stderr, "pzemd: cannot schedule device %u on %s\n", devices[i].slaveAddr, b->port);
+            return false;
+        }
+    }
+    // Timeout: request on the wire (queued, not sent), frame silence and device processing;
+    // the scheduler adds the response wire time of each read
+    b->bus.setBaudRate(b->baudrate);
+    b->scheduler.setTimeout(modbusWireTimeMs(8, b->baudrate) + MODBUS_RTU_FRAME_SILENCE_MS + responseTime);
+    b->scheduler.setReadCallback(onRead, (void*)(uintptr_t)index);
+    b->scheduler.setCadence(&b->cadence);
+    return true;
+}
+
+/**
+ * @brief Create the listening socket, replacing a stale one
+ */
+static bool listenSocket() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "pzemd: socket path too long\n");
+        return false;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socketPath);
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 128) != 0) {
+        fprintf(stderr, "pzemd: cannot listen on %s: %s\n", socketPath, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemd [options] PORT[@BAUD]=ADDR:MODEL[/PERIOD_MS],... ...\n"
+        "  --socket PATH   Unix socket path (default: " PZEMD_DEFAULT_SOCKET ")\n"
+        "  --period MS     Read period of devices given without one (default: 1000)\n"
+        "  --timeout MS    Device response time on top of the wire time (default: 25)\n"
+        HOST_REALTIME_USAGE
+        "Example: pzemd /dev/ttyUSB0=1:004t,2:004t/500 /dev/ttyUSB1@19200=5:6l24\n");
+}
+
+int main(int argc, char** argv) {
+    devices = new Device[PZEMD_MAX_DEVICES];
+    clients = new Connection[PZEMD_MAX_CLIENTS];
+    for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].out = NULL;
+    }
+
+    HostRealtimeConfig realtime;
+    hostRealtimeDefaults(&realtime);
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        const char* arg = argv[i];
+        uint8_t option = hostRealtimeOption(argc, argv, &i, &realtime);
+        if (option == HOST_OPTION_OK) {
+            continue;
+        }
+        if (option == HOST_OPTION_INVALID) {
+            fprintf(stderr, "pzemd: invalid argument '%s'\n", arg);
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--socket") == 0 && hasValue) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--period") == 0 && hasValue) {
+            defaultPeriod = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--timeout") == 0 && hasValue) {
+            responseTime = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-' || defaultPeriod == 0 || !addBus(argv[i])) {
+            fprintf(stderr, "pzemd: invalid argument '%s'\n", argv[i]);
+            usage();
+            return 2;
+        }
+    }
+    if (busCount == 0) {
+        usage();
+        return 2;
+    }
+
+    for (uint8_t b = 0; b < busCount; b++) {
+        if (!startBus(b)) {
+            return 1;
+        }
+    }
+    if (!listenSocket()) {
+        return 1;
+    }
+    if (!hostRealtimeApply(&realtime)) {
+        fprintf(stderr, "pzemd: %s\n", hostRealtimeError());
+        unlink(socketPath);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    stats.started = wallTime();
+
+    struct pollfd* fds = new struct pollfd[1 + PZEMD_MAX_BUSES + PZEMD_MAX_CLIENTS];
+    uint16_t* fdClient = new uint16_t[1 + PZEMD_MAX_BUSES + PZEMD_MAX_CLIENTS];
+    while (running) {
+        uint32_t start = micros();
+        bool busy = false;
+        for (uint8_t b = 0; b < busCount; b++) {
+            buses[b]->busy = buses[b]->scheduler.poll(PZEMD_POLL_BUDGET_US);
+            busy = busy || buses[b]->busy;
+        }
+        for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0 && (pending(clients[i]) > 0 || clients[i].dirty) && !flushClient(clients[i])) {
+                closeClient(clients[i]);
+            }
+        }
+
+        nfds_t n = 0;
+        fds[n].fd = listenFd;
+        fds[n++].events = POLLIN;
+        for (uint8_t b = 0; b < busCount; b++) {
+            fds[n].fd = buses[b]->serial.getFd();
+            fds[n++].events = POLLIN;
+        }
+        nfds_t firstClient = n;
+        for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS; i++) {
+            Connection& c = clients[i];
+            if (c.fd < 0) {
+                continue;
+            }
+            // A client whose answers would not fit is not read: it has to catch up first
+            short events = 0;
+            if (PZEMD_CLIENT_OUT_SIZE - pending(c) >= PZEMD_MAX_RESPONSE) {
+                events |= POLLIN;
+            }
+            if (pending(c) > 0) {
+                events |= POLLOUT;
+            }
+            fds[n].fd = c.fd;
+            fds[n].events = events;
+            fdClient[n++] = i;
+        }
+        uint32_t work = micros() - start;
+        stats.loopMaxUs = work > stats.loopMaxUs ? work : stats.loopMaxUs;
+
+        // A late wake-up counts against every read in flight
+        uint32_t late;
+        int ready = hostPoll(fds, n, busy ? PZEMD_BUSY_WAIT_US : PZEM_SCHEDULER_TICK_MS * 1000, &late);
+        for (uint8_t b = 0; b < busCount; b++) {
+            if (buses[b]->busy && late > buses[b]->jitterUs) {
+                buses[b]->jitterUs = late;
+            }
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        start = micros();
+        if (fds[0].revents & POLLIN) {
+            acceptClients();
+        }
+        for (nfds_t f = firstClient; f < n; f++) {
+            Connection& c = clients[fdClient[f]];
+            short revents = fds[f].revents;
+            if (revents == 0 || c.fd != fds[f].fd) {
+                continue;
+            }
+            bool ok = !(revents & (POLLERR | POLLNVAL));
+            if (ok && (revents & (POLLIN | POLLHUP))) {
+                ok = receiveClient(c);
+            }
+            if (ok && (revents & POLLOUT)) {
+                ok = flushClient(c);
+            }
+            if (!ok) {
+                closeClient(c);
+            }
+        }
+        work = micros() - start;
+        stats.loopMaxUs = work > stats.loopMaxUs ? work : stats.loopMaxUs;
+    }
+
+    for (uint16_t i = 0; i < PZEMD_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            closeClient(clients[i]);
+        }
+    }
+    close(listenFd);
+    unlink(socketPath);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/**
+ * @file pzemdbench.cpp
+ * @brief Load generator for pzemd: many concurrent local clients (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Opens every client connection from one thread and drives them with poll():
+ * query clients send a request, wait for the answer and send the next one;
+ * subscribers count pushed updates; slow subscribers never read, so their
+ * socket and daemon buffers fill up. At the end the daemon read rate over the
+ * run shows whether clients slowed the poller down; a run without clients
+ * gives the reference rate.
+ *
+ * Usage: pzemdbench [options]
+ *   --socket PATH     Daemon socket (default: /tmp/pzemd.sock)
+ *   --queries N       Query clients (default: 32)
+ *   --subscribers N   Subscribers reading their pushes (default: 32)
+ *   --slow N          Subscribers that never read (default: 0)
+ *   --request TEXT    Request sent by query clients (default: "get *")
+ *   --seconds N       Duration (default: 10)
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @defgroup PzemdbenchConfig pzemdbench Configuration
+ * @{
+ */
+#define PZEMDBENCH_MAX_CLIENTS    1024     ///< Connections of all kinds
+#define PZEMDBENCH_MAX_SAMPLES    1000000  ///< Latencies kept for percentiles
+#define PZEMDBENCH_BUFFER_SIZE    65536    ///< Receive buffer per read
+/** @} */
+
+/**
+ * @brief Kind of client connection
+ */
+enum Role { ROLE_QUERY, ROLE_SUBSCRIBER, ROLE_SLOW };
+
+/**
+ * @brief One client connection
+ */
+struct BenchClient {
+    int fd;                   ///< Socket
+    Role role;                ///< Kind of client
+    uint64_t sent;            ///< Time the pending request was sent (us), 0 if none
+    uint64_t lines;           ///< Answers or updates received
+};
+
+static const char* socketPath = "/tmp/pzemd.sock";  ///< Daemon socket
+static char request[256] = "get *\n";               ///< Query request line
+static uint32_t* samples = NULL;                    ///< Query latencies (us)
+static uint32_t sampleCount = 0;                    ///< Latencies kept
+
+/**
+ * @brief Monotonic time in microseconds
+ */
+static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Connect to the daemon
+ */
+static int connectDaemon() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Send one request and read its one-line answer (blocking)
+ */
+static bool ask(const char* line, char* answer, size_t size) {
+    int fd = connectDaemon();
+    if (fd < 0) {
+        return false;
+    }
+    size_t length = 0;
+    bool ok = send(fd, line, strlen(line), MSG_NOSIGNAL) == (ssize_t)strlen(line);
+    while (ok && length + 1 < size) {
+        ssize_t n = recv(fd, answer + length, size - 1 - length, 0);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        length += n;
+        if (memchr(answer, '\n', length) != NULL) {
+            break;
+        }
+    }
+    answer[length] = '\0';
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief Read an unsigned counter from a JSON answer
+ */
+static uint64_t counter(const char* json, const char* name) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    const char* at = strstr(json, key);
+    return at != NULL ? strtoull(at + strlen(key), NULL, 10) : 0;
+}
+
+/**
+ * @brief Sort helper for latencies
+ */
+static int compareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Send the query request of a client
+ */
+static bool sendQuery(BenchClient& c) {
+    size_t length = strlen(request);
+    c.sent = nowUs();
+    return send(c.fd, request, length, MSG_NOSIGNAL) == (ssize_t)length;
+}
+
+int main(int argc, char** argv) {
+    uint32_t queries = 32;
+    uint32_t subscribers = 32;
+    uint32_t slow = 0;
+    uint32_t seconds = 10;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--socket") == 0 && hasValue) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--queries") == 0 && hasValue) {
+            queries = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--subscribers") == 0 && hasValue) {
+            subscribers = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--slow") == 0 && hasValue) {
+            slow = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--request") == 0 && hasValue) {
+            snprintf(request, sizeof(request), "%s\n", argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            seconds = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: pzemdbench [--socket PATH] [--queries N] [--subscribers N] [--slow N]\n"
+                            "                  [--request TEXT] [--seconds N]\n");
+            return 2;
+        }
+    }
+    uint32_t total = queries + subscribers + slow;
+    if (total > PZEMDBENCH_MAX_CLIENTS) {
+        fprintf(stderr, "pzemdbench: at most %u clients\n", PZEMDBENCH_MAX_CLIENTS);
+        return 2;
+    }
+
+    char before[4096];
+    if (!ask("stats\n", before, sizeof(before))) {
+        fprintf(stderr, "pzemdbench: cannot reach pzemd at %s\n", socketPath);
+        return 1;
+    }
+
+    BenchClient* clients = new BenchClient[total];
+    struct pollfd* fds = new struct pollfd[total];
+    samples = new uint32_t[PZEMDBENCH_MAX_SAMPLES];
+    static char buffer[PZEMDBENCH_BUFFER_SIZE];
+    for (uint32_t i = 0; i < total; i++) {
+        BenchClient& c = clients[i];
+        c.role = i < queries ? ROLE_QUERY : (i < queries + subscribers ? ROLE_SUBSCRIBER : ROLE_SLOW);
+        c.sent = 0;
+        c.lines = 0;
+        c.fd = connectDaemon();
+        if (c.fd < 0) {
+            fprintf(stderr, "pzemdbench: connection %u failed: %s\n", i, strerror(errno));
+            return 1;
+        }
+        static const char SUBSCRIBE[] = "subscribe *\n";
+        bool ok = c.role == ROLE_QUERY ? sendQuery(c)
+                                       : send(c.fd, SUBSCRIBE, sizeof(SUBSCRIBE) - 1, MSG_NOSIGNAL) > 0;
+        if (!ok) {
+            fprintf(stderr, "pzemdbench: send failed: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    uint64_t start = nowUs();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint64_t answers = 0;
+    uint64_t updates = 0;
+    uint64_t maxLatency = 0;
+    while (nowUs() < end) {
+        for (uint32_t i = 0; i < total; i++) {
+            fds[i].fd = clients[i].fd;
+            fds[i].events = clients[i].role == ROLE_SLOW ? 0 : POLLIN;
+        }
+        if (poll(fds, total, 100) <= 0) {
+            continue;
+        }
+        for (uint32_t i = 0; i < total; i++) {
+            BenchClient& c = clients[i];
+            if (fds[i].revents & (POLLERR | POLLHUP)) {
+                fprintf(stderr, "pzemdbench: connection %u closed by the daemon\n", i);
+                return 1;
+            }
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            for (ssize_t b = 0; b < n; b++) {
+                if (buffer[b] != '\n') {
+                    continue;
+                }
+                c.lines++;
+                if (c.role != ROLE_QUERY) {
+                    updates += c.lines > 1;  // The first line answers "subscribe"
+                } else if (c.sent != 0) {
+                    // One request in flight: the line ends its answer
+                    uint64_t latency = nowUs() - c.sent;
+                    maxLatency = latency > maxLatency ? latency : maxLatency;
+                    if (sampleCount < PZEMDBENCH_MAX_SAMPLES) {
+                        samples[sampleCount++] = (uint32_t)latency;
+                    }
+                    answers++;
+                    c.sent = 0;
+                }
+            }
+            if (c.role == ROLE_QUERY && c.sent == 0 && !sendQuery(c)) {
+                fprintf(stderr, "pzemdbench: send failed: %s\n", strerror(errno));
+                return 1;
+            }
+        }
+    }
+    double elapsed = (nowUs() - start) / 1e6;
+
+    char after[4096];
+    if (!ask("stats\n", after, sizeof(after))) {
+        fprintf(stderr, "pzemdbench: stats request failed\n");
+        return 1;
+    }
+
+    printf("clients: %u query, %u subscriber, %u slow, %.1f s\n", queries, subscribers, slow, elapsed);
+    if (answers > 0) {
+        qsort(samples, sampleCount, sizeof(samples[0]), compareU32);
+        printf("queries: %llu (%.0f/s), latency p50 %u us, p90 %u us, p99 %u us, max %llu us\n",
+               (unsigned long long)answers, answers / elapsed, samples[sampleCount / 2],
+               samples[sampleCount * 9 / 10], samples[sampleCount * 99 / 100], (unsigned long long)maxLatency);
+    }
+    if (subscribers > 0) {
+        printf("updates: %llu (%.1f/s per subscriber)\n", (unsigned long long)updates,
+               updates / elapsed / subscribers);
+    }
+    uint64_t reads = counter(after, "reads") - counter(before, "reads");
+    printf("daemon: %.1f reads/s, %llu failures, %llu overruns, %llu conflated, loop max %llu us\n",
+           reads / elapsed, (unsigned long long)(counter(after, "failures") - counter(before, "failures")),
+           (unsigned long long)(counter(after, "overruns") - counter(before, "overruns")),
+           (unsigned long long)(counter(after, "conflated") - counter(before, "conflated")),
+           (unsigned long long)counter(after, "loop_max_us"));
+
+    for (uint32_t i = 0; i < total; i++) {
+        close(clients[i].fd);
+    }
+    return 0;
+}
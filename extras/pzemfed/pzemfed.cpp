@@ -0,0 +1,618 @@
+/**
+ * @file pzemfed.cpp
+ * @brief Gateway federation over loopback: summarizing gateways and a merging site collector (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Each gateway process simulates its devices (deterministic power and energy
+ * per device and second), summarizes them per group and per interval with
+ * PZEMSummarizer and sends every interval to the site collector over UDP or
+ * TCP. The site merges the messages with PZEMFederation and prints the site
+ * views.
+ *
+ * In test mode the program forks the gateways itself, runs the site in the
+ * parent and checks every merged view against the summary of the same data
+ * computed centrally by a single summarizer fed with every device: both must
+ * be identical, field by field and bucket by bucket.
+ *
+ * Groups: group 0 is the whole site, and each device also belongs to one of
+ * the three lines (groups 1 to 3, global device number modulo 3).
+ *
+ * Usage: pzemfed MODE [options]
+ *   test                Fork the gateways and check the site views (default)
+ *   gateway             Run one gateway (--id)
+ *   site                Run the site collector
+ * Options:
+ *   --gateways N        Gateways (default: 4)
+ *   --id N              Gateway identifier in gateway mode (0 to N - 1)
+ *   --devices N         Devices per gateway (default: 8)
+ *   --interval S        Interval length (default: 60)
+ *   --intervals N       Intervals simulated (default: 30)
+ *   --port N            Loopback port of the site (default: 47100)
+ *   --tcp               TCP instead of UDP
+ *   --pace MS           Pause between two intervals of a gateway (default: 5)
+ *   --dup PCT           Messages a gateway sends twice (default: 0)
+ *   --lateness S        Wait of the site for late gateways (default: 30)
+ *   --verbose           Print every site view
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "PZEMModel.h"
+#include "PZEMSummary.h"
+
+/**
+ * @defgroup PzemfedConfig pzemfed Configuration
+ * @{
+ */
+#define FED_EPOCH0           1767225600UL  ///< Start of the simulated time (2026-01-01 00:00 UTC)
+#define FED_GROUPS           4             ///< Site and three lines
+#define FED_MAX_MESSAGE      65000         ///< Largest message
+#define FED_IDLE_MS          3000          ///< Site gives up after this long without messages
+#define FED_DEMAND_WINDOW_S  900           ///< Demand window merged from the views
+/** @} */
+
+/**
+ * @brief Options of the run
+ */
+struct FedOptions {
+    const char* mode;         ///< test, gateway or site
+    uint32_t gateways;        ///< Gateways
+    uint32_t id;              ///< Gateway identifier (gateway mode)
+    uint32_t devices;         ///< Devices per gateway
+    uint32_t interval;        ///< Interval length (s)
+    uint32_t intervals;       ///< Intervals simulated
+    uint16_t port;            ///< Loopback port
+    bool tcp;                 ///< TCP instead of UDP
+    uint32_t paceMs;          ///< Pause between intervals
+    uint32_t dup;             ///< Messages sent twice (percent)
+    uint32_t lateness;        ///< Site lateness (s)
+    bool verbose;             ///< Print every view
+};
+
+/**
+ * @brief Simulated device
+ */
+struct SimDevice {
+    uint32_t number;          ///< Global device number
+    uint8_t model;            ///< Model identifier
+    double energyWh;          ///< Energy since the start
+};
+
+/**
+ * @brief Run-wide results of the site
+ */
+struct SiteResults {
+    uint32_t views;           ///< Views handed over
+    uint32_t matching;        ///< Views equal to the central summaries
+    uint32_t bytes;           ///< Message bytes received
+    uint32_t messages;        ///< Messages received
+    PZEMSummary total[FED_GROUPS];  ///< Every view merged, per group
+    PZEMSummary window;       ///< Site demand window in progress
+    uint32_t windowViews;     ///< Views in the window
+    float peakDemand;         ///< Highest demand over FED_DEMAND_WINDOW_S
+    const std::vector<std::string>* central;  ///< Central encoding of each interval, NULL if unchecked
+    const FedOptions* opts;   ///< Options
+};
+
+static uint32_t hash32(uint32_t a, uint32_t b) {
+    uint32_t h = a * 0x9E3779B1UL ^ (b + 0x7F4A7C15UL + (a << 6) + (a >> 2));
+    h ^= h >> 16;
+    h *= 0x85EBCA6BUL;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35UL;
+    return h ^ (h >> 16);
+}
+
+/**
+ * @brief Groups of a device: the site and its line
+ */
+static uint32_t deviceGroups(uint32_t number) {
+    return 1UL | (2UL << (number % 3));
+}
+
+/**
+ * @brief Make the snapshot of a device for one second of simulated time
+ *
+ * Power follows a slow cycle with noise, and the device is off for two
+ * minutes now and then. Energy integrates the power and is reported in the
+ * counter units of the model.
+ */
+static void makeSnapshot(SimDevice* device, uint32_t step, PZEMSnapshot* snapshot, uint32_t* epoch) {
+    const PZEMModelInfo* info = pzemModelInfo(device->model);
+    float base = device->model == PZEM_MODEL_017 ? 40 + hash32(device->number, 0) % 400
+                                                 : 200 + hash32(device->number, 0) % 2800;
+    float watts = base * (0.6f + 0.4f * sinf(6.2832f * step / 900.0f + device->number));
+    watts += (int32_t)(hash32(device->number, step + 1) % 101) - 50;
+    if (watts < 0 || hash32(device->number ^ 0xABCD, step / 120) % 10 == 0) {
+        watts = 0;
+    }
+    int32_t power = (int32_t)(watts * 10);
+    device->energyWh += watts / 3600.0;
+    uint32_t counter = (uint32_t)(device->energyWh / info->energyUnitWh);
+
+    memset(snapshot, 0, sizeof(PZEMSnapshot));
+    snapshot->slaveAddr = device->number % 247 + 1;
+    snapshot->model = device->model;
+    snapshot->count = info->snapshotRegs;
+    snapshot->timestamp = step * 1000 + (device->number * 37) % 1000;
+    snapshot->regs[0] = 2300;
+    snapshot->regs[info->powerRegister] = power & 0xFFFF;
+    snapshot->regs[info->powerRegister + 1] = (uint32_t)power >> 16;
+    snapshot->regs[info->energyRegister] = counter & 0xFFFF;
+    snapshot->regs[info->energyRegister + 1] = counter >> 16;
+    *epoch = FED_EPOCH0 + step;
+}
+
+/**
+ * @brief Model of a device, by global device number modulo 4
+ */
+static const uint8_t simModels[4] = { PZEM_MODEL_004T, PZEM_MODEL_6L24, PZEM_MODEL_017, PZEM_MODEL_004T };
+
+static void initDevices(std::vector<SimDevice>& devices, uint32_t first, uint32_t count) {
+    devices.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        devices[i].number = first + i;
+        devices[i].model = simModels[(first + i) % 4];
+        devices[i].energyWh = 0;
+    }
+}
+
+/**
+ * @brief Central summaries: one summarizer fed with every device of every gateway
+ */
+static void collectCentral(const PZEMSummary* summaries, uint8_t count, void* context) {
+    std::vector<std::string>* central = (std::vector<std::string>*)context;
+    static uint8_t message[FED_MAX_MESSAGE];
+    uint32_t length = PZEMFederation::encode(message, sizeof(message), 0, summaries, count);
+    central->push_back(std::string((const char*)message, length));
+}
+
+static void computeCentral(const FedOptions& opts, std::vector<std::string>* central) {
+    std::vector<SimDevice> devices;
+    initDevices(devices, 0, opts.gateways * opts.devices);
+    PZEMSummarizer* summarizer = new PZEMSummarizer();
+    summarizer->setInterval(opts.interval);
+    summarizer->setCallback(collectCentral, central);
+    PZEMSnapshot snapshot;
+    uint32_t epoch;
+    for (uint32_t step = 0; step < opts.intervals * opts.interval; step++) {
+        for (size_t i = 0; i < devices.size(); i++) {
+            makeSnapshot(&devices[i], step, &snapshot, &epoch);
+            summarizer->addSnapshot(devices[i].number, deviceGroups(devices[i].number), &snapshot, epoch);
+        }
+    }
+    summarizer->tick(FED_EPOCH0 + opts.intervals * opts.interval);
+    delete summarizer;
+}
+
+// ============================================================================
+// Gateway
+// ============================================================================
+
+/**
+ * @brief Connection of a gateway to the site
+ */
+struct GatewayLink {
+    int fd;                   ///< Socket
+    bool tcp;                 ///< Stream with 2-byte length prefixes
+    uint32_t id;              ///< Gateway identifier
+    uint32_t dup;             ///< Messages sent twice (percent)
+    uint32_t sent;            ///< Messages sent
+};
+
+static bool sendMessage(GatewayLink* link, const uint8_t* message, uint32_t length) {
+    if (!link->tcp) {
+        return send(link->fd, message, length, 0) == (ssize_t)length;
+    }
+    uint8_t prefix[2] = { (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+    return send(link->fd, prefix, 2, MSG_MORE) == 2 && send(link->fd, message, length, 0) == (ssize_t)length;
+}
+
+static void sendSummaries(const PZEMSummary* summaries, uint8_t count, void* context) {
+    GatewayLink* link = (GatewayLink*)context;
+    static uint8_t message[FED_MAX_MESSAGE];
+    uint32_t length = PZEMFederation::encode(message, sizeof(message), link->id, summaries, count);
+    if (length == 0 || !sendMessage(link, message, length)) {
+        fprintf(stderr, "pzemfed: gateway %u cannot send: %s\n", link->id, strerror(errno));
+        return;
+    }
+    link->sent++;
+    if (hash32(link->id, link->sent) % 100 < link->dup) {
+        sendMessage(link, message, length);
+    }
+}
+
+static int runGateway(const FedOptions& opts, uint32_t id) {
+    GatewayLink link;
+    link.fd = socket(AF_INET, opts.tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    link.tcp = opts.tcp;
+    link.id = id;
+    link.dup = opts.dup;
+    link.sent = 0;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(opts.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool connected = false;
+    for (int attempt = 0; attempt < 50 && !connected; attempt++) {
+        connected = connect(link.fd, (sockaddr*)&address, sizeof(address)) == 0;
+        if (!connected) {
+            usleep(100000);
+        }
+    }
+    if (!connected) {
+        fprintf(stderr, "pzemfed: gateway %u cannot reach port %u: %s\n", id, opts.port, strerror(errno));
+        return 1;
+    }
+
+    std::vector<SimDevice> devices;
+    initDevices(devices, id * opts.devices, opts.devices);
+    PZEMSummarizer* summarizer = new PZEMSummarizer();
+    summarizer->setInterval(opts.interval);
+    summarizer->setCallback(sendSummaries, &link);
+    PZEMSnapshot snapshot;
+    uint32_t epoch;
+    for (uint32_t step = 0; step < opts.intervals * opts.interval; step++) {
+        for (size_t i = 0; i < devices.size(); i++) {
+            makeSnapshot(&devices[i], step, &snapshot, &epoch);
+            summarizer->addSnapshot(devices[i].number, deviceGroups(devices[i].number), &snapshot, epoch);
+        }
+        if ((step + 1) % opts.interval == 0 && opts.paceMs != 0) {
+            usleep(opts.paceMs * 1000);
+        }
+    }
+    summarizer->tick(FED_EPOCH0 + opts.intervals * opts.interval);
+    delete summarizer;
+    close(link.fd);
+    return 0;
+}
+
+// ============================================================================
+// Site
+// ============================================================================
+
+/**
+ * @brief Quantile of the power of a summary, clamped to the exact extremes
+ */
+static float powerQuantile(const PZEMSummary& summary, float q) {
+    float value = summary.power.quantile(q);
+    if (summary.samples == 0) {
+        return value;
+    }
+    if (value > summary.powerMax * 0.1f) {
+        return summary.powerMax * 0.1f;
+    }
+    return value < summary.powerMin * 0.1f ? summary.powerMin * 0.1f : value;
+}
+
+static void printSummary(const char* name, const PZEMSummary& summary, float peak) {
+    printf("%-7s %4u device intervals  energy %8.2f kWh  demand %9.1f W", name, summary.devices,
+           summary.energyWh / 1000.0, summary.getDemand());
+    if (peak >= 0) {
+        printf("  peak %9.1f W", peak);
+    }
+    printf("  power p50 %7.1f W  p99 %7.1f W  max %7.1f W\n", powerQuantile(summary, 0.5f),
+           powerQuantile(summary, 0.99f), summary.powerMax * 0.1f);
+}
+
+/**
+ * @brief Check a site view against the central summaries and accumulate it
+ */
+static void onView(const PZEMSiteView* view, void* context) {
+    SiteResults* results = (SiteResults*)context;
+    const FedOptions* opts = results->opts;
+    uint32_t index = (view->start - FED_EPOCH0) / opts->interval;
+    results->views++;
+
+    if (results->central != NULL && index < results->central->size()) {
+        static uint8_t message[FED_MAX_MESSAGE];
+        uint32_t length = PZEMFederation::encode(message, sizeof(message), 0, view->groups, FED_GROUPS);
+        const std::string& expected = (*results->central)[index];
+        if (view->complete && length == expected.size() && memcmp(message, expected.data(), length) == 0) {
+            results->matching++;
+        } else {
+            printf("interval %u differs from the central summary (%s)\n", index,
+                   view->complete ? "complete" : "incomplete");
+        }
+    }
+
+    for (uint8_t g = 0; g < FED_GROUPS; g++) {
+        results->total[g].merge(view->groups[g]);
+    }
+    results->window.merge(view->groups[0]);
+    results->windowViews++;
+    if (results->windowViews * opts->interval >= FED_DEMAND_WINDOW_S) {
+        if (results->window.getDemand() > results->peakDemand) {
+            results->peakDemand = results->window.getDemand();
+        }
+        results->window.clear(0, 0, 0);
+        results->windowViews = 0;
+    }
+
+    if (opts->verbose) {
+        char name[32];
+        snprintf(name, sizeof(name), "#%u%s", index, view->complete ? "" : "*");
+        printSummary(name, view->groups[0], -1);
+    }
+}
+
+/**
+ * @brief Open the listening socket of the site
+ */
+static int openSite(const FedOptions& opts) {
+    int fd = socket(AF_INET, opts.tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int buffer = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(opts.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || (opts.tcp && listen(fd, 32) != 0)) {
+        fprintf(stderr, "pzemfed: cannot listen on port %u: %s\n", opts.port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Receive until every interval was handed over or the gateways went quiet
+ */
+static void runSite(int listenFd, const FedOptions& opts, PZEMFederation* federation, SiteResults* results) {
+    std::vector<pollfd> fds;
+    std::vector<std::string> streams;         // Partial TCP input per connection
+    pollfd listener = { listenFd, POLLIN, 0 };
+    fds.push_back(listener);
+    streams.push_back(std::string());
+    static uint8_t message[FED_MAX_MESSAGE];
+
+    while (results->views < opts.intervals) {
+        if (poll(&fds[0], fds.size(), FED_IDLE_MS) <= 0) {
+            break;
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            if (!opts.tcp) {
+                ssize_t n = recv(fds[i].fd, message, sizeof(message), 0);
+                if (n > 0) {
+                    results->messages++;
+                    results->bytes += n;
+                    federation->receive(message, n);
+                }
+            } else if (i == 0) {
+                int client = accept(listenFd, NULL, NULL);
+                if (client >= 0) {
+                    pollfd entry = { client, POLLIN, 0 };
+                    fds.push_back(entry);
+                    streams.push_back(std::string());
+                }
+            } else {
+                ssize_t n = recv(fds[i].fd, message, sizeof(message), 0);
+                if (n <= 0) {
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                    continue;
+                }
+                std::string& stream = streams[i];
+                stream.append((const char*)message, n);
+                while (stream.size() >= 2) {
+                    uint32_t length = (uint8_t)stream[0] | ((uint8_t)stream[1] << 8);
+                    if (stream.size() < 2 + length) {
+                        break;
+                    }
+                    results->messages++;
+                    results->bytes += length;
+                    federation->receive((const uint8_t*)stream.data() + 2, length);
+                    stream.erase(0, 2 + length);
+                }
+            }
+        }
+    }
+    // Hand over what is left, complete or not
+    federation->tick(0xFFFFFFF0UL);
+    for (size_t i = 1; i < fds.size(); i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+    }
+}
+
+static void printResults(const FedOptions& opts, PZEMFederation* federation, SiteResults* results) {
+    PZEMFederationStats stats;
+    federation->getStats(&stats);
+    uint64_t rawBytes = 0;
+    for (uint32_t d = 0; d < opts.gateways * opts.devices; d++) {
+        rawBytes += (uint64_t)pzemModelInfo(simModels[d % 4])->snapshotRegs * 2;
+    }
+    rawBytes *= (uint64_t)opts.intervals * opts.interval;
+
+    printf("messages: %u (%u bytes avg, %u merged, %u duplicates, %u late, %u malformed)\n", results->messages,
+           results->messages ? results->bytes / results->messages : 0, stats.messages, stats.duplicates, stats.late,
+           stats.malformed);
+    printf("views: %u complete, %u incomplete; summaries %u bytes vs %.1f MB of raw snapshots\n", stats.complete,
+           stats.incomplete, results->bytes, rawBytes / 1e6);
+    printSummary("site", results->total[0], results->peakDemand > 0 ? results->peakDemand : -1);
+    for (uint8_t g = 1; g < FED_GROUPS; g++) {
+        char name[16];
+        snprintf(name, sizeof(name), "line %u", g);
+        printSummary(name, results->total[g], -1);
+    }
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemfed [test|gateway|site] [options]\n"
+        "  --gateways N        Gateways (default: 4)\n"
+        "  --id N              Gateway identifier in gateway mode\n"
+        "  --devices N         Devices per gateway (default: 8)\n"
+        "  --interval S        Interval length (default: 60)\n"
+        "  --intervals N       Intervals simulated (default: 30)\n"
+        "  --port N            Loopback port of the site (default: 47100)\n"
+        "  --tcp               TCP instead of UDP\n"
+        "  --pace MS           Pause between two intervals of a gateway (default: 5)\n"
+        "  --dup PCT           Messages a gateway sends twice (default: 0)\n"
+        "  --lateness S        Wait of the site for late gateways (default: 30)\n"
+        "  --verbose           Print every site view\n");
+}
+
+/**
+ * @brief Parse the options
+ */
+static bool parseOptions(int argc, char** argv, FedOptions* opts) {
+    opts->mode = "test";
+    opts->gateways = 4;
+    opts->id = 0;
+    opts->devices = 8;
+    opts->interval = 60;
+    opts->intervals = 30;
+    opts->port = 47100;
+    opts->tcp = false;
+    opts->paceMs = 5;
+    opts->dup = 0;
+    opts->lateness = 30;
+    opts->verbose = false;
+
+    int i = 1;
+    if (i < argc && argv[i][0] != '-') {
+        opts->mode = argv[i++];
+    }
+    for (; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--tcp") == 0) {
+            opts->tcp = true;
+            continue;
+        }
+        if (strcmp(arg, "--verbose") == 0) {
+            opts->verbose = true;
+            continue;
+        }
+        if (value == NULL) {
+            return false;
+        }
+        uint32_t number = strtoul(value, NULL, 10);
+        if (strcmp(arg, "--gateways") == 0) {
+            opts->gateways = number;
+        } else if (strcmp(arg, "--id") == 0) {
+            opts->id = number;
+        } else if (strcmp(arg, "--devices") == 0) {
+            opts->devices = number;
+        } else if (strcmp(arg, "--interval") == 0) {
+            opts->interval = number;
+        } else if (strcmp(arg, "--intervals") == 0) {
+            opts->intervals = number;
+        } else if (strcmp(arg, "--port") == 0) {
+            opts->port = number;
+        } else if (strcmp(arg, "--pace") == 0) {
+            opts->paceMs = number;
+        } else if (strcmp(arg, "--dup") == 0) {
+            opts->dup = number;
+        } else if (strcmp(arg, "--lateness") == 0) {
+            opts->lateness = number;
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return opts->gateways >= 1 && opts->gateways <= 32 && opts->id < opts->gateways && opts->devices >= 1 &&
+           opts->gateways * opts->devices <= PZEM_SUMMARY_MAX_DEVICES && opts->interval >= 1 &&
+           opts->intervals >= 1 && opts->port != 0 &&
+           (strcmp(opts->mode, "test") == 0 || strcmp(opts->mode, "gateway") == 0 || strcmp(opts->mode, "site") == 0);
+}
+
+int main(int argc, char** argv) {
+    FedOptions opts;
+    if (!parseOptions(argc, argv, &opts)) {
+        usage();
+        return 2;
+    }
+    if (strcmp(opts.mode, "gateway") == 0) {
+        return runGateway(opts, opts.id);
+    }
+
+    int listenFd = openSite(opts);
+    if (listenFd < 0) {
+        return 1;
+    }
+    PZEMFederation* federation = new PZEMFederation();
+    SiteResults* results = new SiteResults();
+    std::vector<std::string> central;
+    results->views = 0;
+    results->matching = 0;
+    results->bytes = 0;
+    results->messages = 0;
+    results->windowViews = 0;
+    results->peakDemand = 0;
+    results->opts = &opts;
+    results->central = NULL;
+    for (uint8_t g = 0; g < FED_GROUPS; g++) {
+        results->total[g].clear(g, 0, 0);
+    }
+    results->window.clear(0, 0, 0);
+    federation->setSources(opts.gateways);
+    federation->setLateness(opts.lateness);
+    federation->setCallback(onView, results);
+
+    bool test = strcmp(opts.mode, "test") == 0;
+    std::vector<pid_t> children;
+    if (test) {
+        computeCentral(opts, &central);
+        results->central = &central;
+        printf("%u gateways x %u devices, %u intervals of %u s over %s loopback\n", opts.gateways, opts.devices,
+               opts.intervals, opts.interval, opts.tcp ? "TCP" : "UDP");
+        fflush(stdout);
+        for (uint32_t id = 0; id < opts.gateways; id++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listenFd);
+                _exit(runGateway(opts, id));
+            }
+            children.push_back(pid);
+        }
+    }
+
+    runSite(listenFd, opts, federation, results);
+    close(listenFd);
+    bool gatewaysOk = true;
+    for (size_t i = 0; i < children.size(); i++) {
+        int status = 0;
+        waitpid(children[i], &status, 0);
+        gatewaysOk = gatewaysOk && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    printResults(opts, federation, results);
+    bool pass = true;
+    if (test) {
+        pass = gatewaysOk && results->views == opts.intervals && results->matching == opts.intervals;
+        printf("merged views equal to the central summaries: %u of %u\n%s\n", results->matching, opts.intervals,
+               pass ? "PASS" : "FAIL");
+    }
+    delete results;
+    delete federation;
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,423 @@
+/**
+ * @file pzemflap.cpp
+ * @brief Store-and-forward soak test: an outbox in a file feeding a loopback sink that flaps (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A producer appends synthetic snapshots to a PZEMOutbox at a fixed rate. A
+ * loopback sink takes batches over a link of limited bandwidth, decodes them
+ * and checks every record against the snapshot the producer made for that
+ * sequence number, then acknowledges; the outbox cursor moves on the
+ * acknowledgement only. The sink goes down and up on a schedule: batches in
+ * flight when it goes down are lost, and acknowledgements can be dropped on
+ * purpose. The outbox can also be remounted from its file during the run, as
+ * after a reboot.
+ *
+ * After --seconds the producer stops and the sink stays up until the cursor
+ * has caught up. The run passes when every record was delivered and decoded
+ * intact (records the outbox reports as dropped excepted); it prints
+ * duplicates, batch sizes, compression and the latency of live records.
+ *
+ * Usage: pzemflap [options]
+ *   --store PATH        Store file (default: /tmp/pzemflap.bin)
+ *   --size KB           Store size (default: 256)
+ *   --fresh             Erase the store first
+ *   --devices N         Simulated devices, cycling through the models (default: 8)
+ *   --rate HZ           Snapshots per second and device (default: 10)
+ *   --up MS             Time the sink stays up (default: 4000)
+ *   --down MS           Time the sink stays down (default: 6000)
+ *   --link BPS          Sink link bandwidth in bytes per second (default: 16000)
+ *   --backfill BPS      Backfill rate in bytes per second, 0 for no limit (default: 6000)
+ *   --batch BYTES       Batch buffer size (default: 4096)
+ *   --ack-loss PCT      Acknowledgements lost (default: 0)
+ *   --restart-every S   Remount the outbox from the store every S seconds (default: 0, never)
+ *   --seconds N         Production time (default: 30)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#include "Arduino.h"
+#include "HostRealtime.h"
+#include "PosixOutboxStore.h"
+#include "PZEMOutbox.h"
+
+/**
+ * @defgroup PzemflapConfig pzemflap Configuration
+ * @{
+ */
+#define FLAP_CURSOR          0      ///< Outbox cursor of the sink
+#define FLAP_DRAIN_LIMIT_MS  120000 ///< Longest drain after production stops
+#define FLAP_MAX_BATCH       65536  ///< Largest batch buffer
+/** @} */
+
+/**
+ * @brief Options of the run
+ */
+struct FlapOptions {
+    const char* store;        ///< Store file
+    uint32_t sizeKb;          ///< Store size
+    bool fresh;               ///< Erase the store first
+    uint32_t devices;         ///< Simulated devices
+    uint32_t rate;            ///< Snapshots per second and device
+    uint32_t upMs;            ///< Sink up time
+    uint32_t downMs;          ///< Sink down time
+    uint32_t link;            ///< Link bandwidth (bytes/s)
+    uint32_t backfill;        ///< Backfill rate (bytes/s)
+    uint32_t batch;           ///< Batch buffer size
+    uint32_t ackLoss;         ///< Lost acknowledgements (percent)
+    uint32_t restartS;        ///< Remount period (s), 0 for none
+    uint32_t seconds;         ///< Production time
+};
+
+/**
+ * @brief Counters of the sink
+ */
+struct SinkStats {
+    uint32_t liveBatches;     ///< Live batches delivered
+    uint32_t backfillBatches; ///< Backfill batches delivered
+    uint64_t liveRecords;     ///< Records in live batches
+    uint64_t backfillRecords; ///< Records in backfill batches
+    uint64_t encoded[2];      ///< Batch bytes delivered (live, backfill)
+    uint64_t raw[2];          ///< Payload bytes delivered (live, backfill)
+    uint32_t lostInFlight;    ///< Batches cut by the sink going down
+    uint32_t lostAcks;        ///< Acknowledgements dropped on purpose
+    uint32_t duplicates;      ///< Records received more than once
+    uint32_t mismatches;      ///< Records not matching what was produced
+    uint32_t decodeErrors;    ///< Batches that did not decode
+};
+
+static const uint8_t MODELS[] = { PZEM_MODEL_004T, PZEM_MODEL_017, PZEM_MODEL_004T, PZEM_MODEL_6L24 };
+
+/**
+ * @brief Build the snapshot the producer appends as a given record
+ *
+ * Content depends only on the sequence number, so the sink checks records of
+ * earlier runs too. Successive snapshots of a device change slowly, as real
+ * measurements do.
+ */
+static void makeSnapshot(uint32_t seq, uint32_t devices, uint32_t periodMs, PZEMSnapshot* snapshot, uint32_t* epoch) {
+    uint32_t device = seq % devices;
+    uint32_t k = seq / devices;
+    uint8_t model = MODELS[device % sizeof(MODELS)];
+    snapshot->slaveAddr = device + 1;
+    snapshot->model = model;
+    snapshot->count = pzemModelInfo(model)->snapshotRegs;
+    snapshot->timestamp = k * periodMs;
+    for (uint8_t r = 0; r < snapshot->count; r++) {
+        // Every other register moves by a few counts (voltages, currents, powers), the rest holds
+        uint32_t noise = (r % 2 == 0) ? (k * 2654435761UL + r * 40503UL + device * 977UL) >> 30 : 0;
+        snapshot->regs[r] = (uint16_t)(2300 + r * 13 + device * 5 + noise);
+    }
+    // Energy counter, low word first
+    snapshot->regs[5] = (uint16_t)(k / 3 + device * 1000);
+    *epoch = 1700000000UL + k * periodMs / 1000;
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemflap [options]\n"
+        "  --store PATH        Store file (default: /tmp/pzemflap.bin)\n"
+        "  --size KB           Store size (default: 256)\n"
+        "  --fresh             Erase the store first\n"
+        "  --devices N         Simulated devices (default: 8)\n"
+        "  --rate HZ           Snapshots per second and device (default: 10)\n"
+        "  --up MS             Time the sink stays up (default: 4000)\n"
+        "  --down MS           Time the sink stays down (default: 6000)\n"
+        "  --link BPS          Sink link bandwidth in bytes per second (default: 16000)\n"
+        "  --backfill BPS      Backfill rate, 0 for no limit (default: 6000)\n"
+        "  --batch BYTES       Batch buffer size (default: 4096)\n"
+        "  --ack-loss PCT      Acknowledgements lost (default: 0)\n"
+        "  --restart-every S   Remount the outbox every S seconds (default: never)\n"
+        "  --seconds N         Production time (default: 30)\n");
+}
+
+/**
+ * @brief Parse the options
+ */
+static bool parseOptions(int argc, char** argv, FlapOptions* opts) {
+    opts->store = "/tmp/pzemflap.bin";
+    opts->sizeKb = 256;
+    opts->fresh = false;
+    opts->devices = 8;
+    opts->rate = 10;
+    opts->upMs = 4000;
+    opts->downMs = 6000;
+    opts->link = 16000;
+    opts->backfill = 6000;
+    opts->batch = 4096;
+    opts->ackLoss = 0;
+    opts->restartS = 0;
+    opts->seconds = 30;
+
+    struct { const char* name; uint32_t* value; } numbers[] = {
+        { "--size", &opts->sizeKb }, { "--devices", &opts->devices }, { "--rate", &opts->rate },
+        { "--up", &opts->upMs }, { "--down", &opts->downMs }, { "--link", &opts->link },
+        { "--backfill", &opts->backfill }, { "--batch", &opts->batch }, { "--ack-loss", &opts->ackLoss },
+        { "--restart-every", &opts->restartS }, { "--seconds", &opts->seconds },
+    };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fresh") == 0) {
+            opts->fresh = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            opts->store = argv[++i];
+            continue;
+        }
+        bool known = false;
+        for (size_t n = 0; n < sizeof(numbers) / sizeof(numbers[0]); n++) {
+            if (strcmp(argv[i], numbers[n].name) == 0 && i + 1 < argc) {
+                char* end = NULL;
+                *numbers[n].value = strtoul(argv[++i], &end, 10);
+                known = *end == '\0';
+            }
+        }
+        if (!known) {
+            return false;
+        }
+    }
+    return opts->devices > 0 && opts->devices <= 247 && opts->rate > 0 && opts->link > 0 &&
+           opts->batch >= PZEM_OUTBOX_MIN_BATCH && opts->batch <= FLAP_MAX_BATCH && opts->ackLoss <= 100;
+}
+
+/**
+ * @brief Mount the outbox from the store file and open the sink cursor
+ */
+static bool mount(PZEMOutbox* outbox, PZEMOutboxStore* store, const FlapOptions& opts) {
+    if (!outbox->begin(store) || !outbox->openCursor(FLAP_CURSOR)) {
+        return false;
+    }
+    outbox->setBackfillRate(opts.backfill, opts.batch);
+    return true;
+}
+
+/**
+ * @brief Percentile of a sorted sample set
+ */
+static uint32_t percentile(const std::vector<uint32_t>& sorted, uint32_t pct) {
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, sorted.size() * pct / 100)];
+}
+
+int main(int argc, char** argv) {
+    FlapOptions opts;
+    if (!parseOptions(argc, argv, &opts)) {
+        usage();
+        return 2;
+    }
+    if (opts.fresh) {
+        unlink(opts.store);
+    }
+
+    PosixOutboxStore* store = new PosixOutboxStore();
+    PZEMOutbox* outbox = new PZEMOutbox();
+    if (!store->open(opts.store, opts.sizeKb * 1024) || !mount(outbox, store, opts)) {
+        fprintf(stderr, "pzemflap: cannot open the outbox in %s\n", opts.store);
+        return 1;
+    }
+
+    PZEMOutboxStats stats;
+    outbox->getStats(&stats);
+    PZEMOutboxCursor cursor;
+    outbox->getCursor(FLAP_CURSOR, &cursor);
+    uint32_t startSeq = cursor.next;
+    uint32_t firstProduced = stats.headSeq;
+    printf("store %s: %u records kept from earlier runs, %u not delivered\n", opts.store,
+           stats.headSeq - stats.tailSeq, outbox->getLag(FLAP_CURSOR));
+
+    uint32_t periodMs = 1000 / opts.rate;
+    uint32_t intervalUs = 1000000 / (opts.rate * opts.devices);
+    std::vector<uint8_t> received;                    // By sequence number from startSeq
+    std::vector<uint64_t> producedAt;                 // By sequence number from firstProduced (us)
+    std::vector<uint32_t> liveLatency;                // Production to acknowledgement of live records (ms)
+    std::vector<uint32_t> backfillLatency;            // Same for backfill records
+    SinkStats sink;
+    memset(&sink, 0, sizeof(sink));
+    static uint8_t buffer[FLAP_MAX_BATCH];
+    bool inFlight = false;
+    PZEMOutboxBatch batch;
+    uint64_t arrival = 0;
+    uint32_t restarts = 0;
+    uint32_t outages = 0;
+    uint32_t appendErrors = 0;
+    uint32_t dropped = 0;                             // Dropped before the last remount
+    srand(1);
+
+    // Live records a split cursor delivered before this run
+    received.resize(cursor.live - startSeq, 0);
+    for (uint32_t seq = cursor.liveStart; seq < cursor.live; seq++) {
+        received[seq - startSeq] = 1;
+    }
+
+    uint64_t start = hostMonotonicUs();
+    uint64_t productionEnd = start + (uint64_t)opts.seconds * 1000000;
+    uint64_t nextAppend = start;
+    uint64_t nextRestart = opts.restartS ? start + (uint64_t)opts.restartS * 1000000 : 0;
+    uint64_t drainEnd = productionEnd + (uint64_t)FLAP_DRAIN_LIMIT_MS * 1000;
+    uint32_t cycleMs = opts.upMs + opts.downMs;
+    bool wasUp = true;
+
+    for (;;) {
+        uint64_t now = hostMonotonicUs();
+        bool producing = now < productionEnd;
+        if (!producing && outbox->getLag(FLAP_CURSOR) == 0 && !inFlight) {
+            break;
+        }
+        if (now > drainEnd) {
+            break;
+        }
+
+        // Producer: one snapshot per interval, device after device
+        while (producing && now >= nextAppend) {
+            PZEMSnapshot snapshot;
+            uint32_t epoch;
+            outbox->getStats(&stats);
+            makeSnapshot(stats.headSeq, opts.devices, periodMs, &snapshot, &epoch);
+            if (outbox->appendSnapshot(&snapshot, epoch)) {
+                producedAt.resize(stats.headSeq + 1 - firstProduced, 0);
+                producedAt[stats.headSeq - firstProduced] = now;
+            } else {
+                appendErrors++;
+            }
+            nextAppend += intervalUs;
+        }
+
+        // Reboot: the outbox comes back from its file, the batch in flight is gone
+        if (nextRestart != 0 && now >= nextRestart && producing) {
+            outbox->sync();
+            outbox->getStats(&stats);
+            dropped += stats.dropped;
+            delete outbox;
+            store->close();
+            if (!store->open(opts.store, opts.sizeKb * 1024)) {
+                fprintf(stderr, "pzemflap: cannot reopen %s\n", opts.store);
+                return 1;
+            }
+            outbox = new PZEMOutbox();
+            if (!mount(outbox, store, opts)) {
+                fprintf(stderr, "pzemflap: remount failed\n");
+                return 1;
+            }
+            inFlight = false;
+            restarts++;
+            nextRestart += (uint64_t)opts.restartS * 1000000;
+        }
+
+        // Sink schedule: up, then down, while producing; always up while draining
+        bool up = !producing || cycleMs == 0 || (uint32_t)((now - start) / 1000 % cycleMs) < opts.upMs;
+        if (wasUp && !up) {
+            outages++;
+        }
+        wasUp = up;
+        if (inFlight && !up) {
+            sink.lostInFlight++;
+            inFlight = false;
+        }
+
+        if (inFlight && now >= arrival) {
+            inFlight = false;
+            PZEMOutboxDecoder decoder;
+            PZEMOutboxRecord record;
+            uint32_t decoded = 0;
+            if (!decoder.begin(buffer, batch.length)) {
+                sink.decodeErrors++;
+                continue;
+            }
+            while (decoder.next(&record)) {
+                PZEMSnapshot got;
+                PZEMSnapshot expected;
+                uint32_t gotEpoch;
+                uint32_t expectedEpoch;
+                makeSnapshot(record.seq, opts.devices, periodMs, &expected, &expectedEpoch);
+                if (!PZEMOutbox::decodeSnapshot(&record, &got, &gotEpoch) || gotEpoch != expectedEpoch ||
+                    got.slaveAddr != expected.slaveAddr || got.count != expected.count ||
+                    got.timestamp != expected.timestamp ||
+                    memcmp(got.regs, expected.regs, expected.count * sizeof(uint16_t)) != 0) {
+                    sink.mismatches++;
+                }
+                if (record.seq >= startSeq) {
+                    received.resize(std::max<size_t>(received.size(), record.seq - startSeq + 1), 0);
+                    sink.duplicates += received[record.seq - startSeq] ? 1 : 0;
+                    received[record.seq - startSeq] = 1;
+                }
+                if (record.seq >= firstProduced && record.seq - firstProduced < producedAt.size()) {
+                    uint32_t latency = (uint32_t)((now - producedAt[record.seq - firstProduced]) / 1000);
+                    (batch.backfill ? backfillLatency : liveLatency).push_back(latency);
+                }
+                decoded++;
+            }
+            if (decoded != batch.count) {
+                sink.decodeErrors++;
+            }
+            if (batch.backfill) {
+                sink.backfillBatches++;
+                sink.backfillRecords += batch.count;
+            } else {
+                sink.liveBatches++;
+                sink.liveRecords += batch.count;
+            }
+            sink.encoded[batch.backfill] += batch.length;
+            sink.raw[batch.backfill] += batch.rawLength;
+            if ((uint32_t)(rand() % 100) < opts.ackLoss) {
+                sink.lostAcks++;
+            } else if (!outbox->commit(FLAP_CURSOR, &batch)) {
+                fprintf(stderr, "pzemflap: commit failed\n");
+                return 1;
+            }
+        }
+
+        // Link idle and sink up: send the next batch
+        if (up && !inFlight && outbox->takeBatch(FLAP_CURSOR, buffer, opts.batch, &batch)) {
+            inFlight = true;
+            arrival = now + (uint64_t)batch.length * 1000000 / opts.link;
+        }
+        delay(1);
+    }
+    double elapsed = (hostMonotonicUs() - start) / 1e6;
+
+    outbox->getStats(&stats);
+    dropped += stats.dropped;
+    uint32_t gaps = 0;
+    uint32_t delivered = 0;
+    for (uint32_t seq = startSeq; seq < stats.headSeq; seq++) {
+        bool got = seq - startSeq < received.size() && received[seq - startSeq];
+        delivered += got ? 1 : 0;
+        gaps += got ? 0 : 1;
+    }
+    std::sort(liveLatency.begin(), liveLatency.end());
+    std::sort(backfillLatency.begin(), backfillLatency.end());
+
+    printf("produced %u snapshots in %u s (%u devices at %u Hz), %u outages, %u restarts, %.1f s total\n",
+           stats.headSeq - firstProduced, opts.seconds, opts.devices, opts.rate, outages, restarts, elapsed);
+    printf("delivered %u of %u records, %u gaps, %u dropped by the outbox, %u duplicates, %u mismatches, %u decode errors\n",
+           delivered, stats.headSeq - startSeq, gaps, dropped, sink.duplicates, sink.mismatches, sink.decodeErrors);
+    printf("batches: %u live (%.1f records avg), %u backfill (%.1f records avg), %u lost in flight, %u acks lost\n",
+           sink.liveBatches, sink.liveBatches ? (double)sink.liveRecords / sink.liveBatches : 0.0,
+           sink.backfillBatches, sink.backfillBatches ? (double)sink.backfillRecords / sink.backfillBatches : 0.0,
+           sink.lostInFlight, sink.lostAcks);
+    printf("coding: live %llu payload bytes in %llu batch bytes (%.2f:1), backfill %llu in %llu (%.2f:1)\n",
+           (unsigned long long)sink.raw[0], (unsigned long long)sink.encoded[0],
+           sink.encoded[0] ? (double)sink.raw[0] / sink.encoded[0] : 0.0, (unsigned long long)sink.raw[1],
+           (unsigned long long)sink.encoded[1], sink.encoded[1] ? (double)sink.raw[1] / sink.encoded[1] : 0.0);
+    printf("latency of live records: p50 %u ms, p99 %u ms, max %u ms; backfill records: p50 %u ms, max %u ms\n",
+           percentile(liveLatency, 50), percentile(liveLatency, 99), liveLatency.empty() ? 0 : liveLatency.back(),
+           percentile(backfillLatency, 50), backfillLatency.empty() ? 0 : backfillLatency.back());
+    printf("outbox since the last mount: %u of %u KB used, %u erases, %u backfill polls rate limited, %u store errors, %u append errors\n",
+           stats.usedBytes / 1024, stats.capacityBytes / 1024, stats.erases, stats.rateLimited, stats.storeErrors,
+           appendErrors);
+
+    bool pass = gaps <= dropped && sink.mismatches == 0 && sink.decodeErrors == 0 && appendErrors == 0 &&
+                outbox->getLag(FLAP_CURSOR) == 0;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    delete outbox;
+    delete store;
+    return pass ? 0 : 1;
+}
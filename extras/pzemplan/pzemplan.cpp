@@ -0,0 +1,683 @@
+/**
+ * @file pzemplan.cpp
+ * @brief Offline compiler of polling plans into constexpr schedule tables, and their test runner (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Reads a manifest of the devices of one bus (address, model, fields and the
+ * period of each field) and writes a C++ header holding the polling plan of
+ * the bus for PZEMPlanScheduler: one PZEMPlanRead per read with its span,
+ * period, phase, timeout and request frame (CRC included).
+ *
+ * The plan is worked out with a wire-time model of the bus: a read of n
+ * registers keeps the line busy for its request and response frames
+ * (8 and 5 + 2n characters at the configured baud rate and character size),
+ * the device response time and the frame silence. Fields are taken by
+ * increasing period and each one either joins a read of its device at the
+ * same or a shorter period (widened if needed, within PZEM_PLAN_MAX_SPAN) or
+ * gets a read of its own, whichever adds the least bus time per second; a
+ * field may so be read more often than requested, never less. Reads are then
+ * given phases so that no two of them overlap on the line whatever the
+ * cycle: two reads of periods p and q started at phases a and b meet iff
+ * (b - a) mod gcd(p, q) falls within their durations.
+ *
+ * Manifest, one statement per line ('#' starts a comment):
+ *   baud 9600                    Line speed (required)
+ *   bits 10                      Bits per character (default: 10, 8N1; 11 for 8N2)
+ *   response 25                  Device response time in ms (default: 25)
+ *   silence 10                   Frame silence in ms (default: MODBUS_RTU_FRAME_SILENCE_MS)
+ *   period 1000                  Period of the fields given without one (default: 1000)
+ *   ADDR MODEL FIELD[,FIELD...][/PERIOD_MS] ...
+ *                                Fields of a device; 'all' for the whole snapshot span of the model
+ *
+ * With --run the plan is also walked by PZEMPlanScheduler on a serial port
+ * (a bus or pzemsim) for --seconds, and the achieved cadence of every read
+ * is printed: reads, mean interval, jitter against the period and missed
+ * periods. The exit status is 1 if a read failed, overran or missed a period.
+ *
+ * Usage: pzemplan [options] MANIFEST
+ *   --output FILE   Header to write (default: standard output, none with --run)
+ *   --name NAME     Name of the PZEMPlan constant (default: PZEM_PLAN)
+ *   --run PORT      Run the plan on a serial port and report its cadence
+ *   --seconds N     Duration of the run (default: 60)
+ *
+ * Example manifest:
+ *   baud 9600
+ *   1 004t voltage,current/200 power/1000 energy/60000
+ *   2 017 all/500
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ModbusProtocol.h"
+#include "ModbusTransport.h"
+#include "PosixSerial.h"
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+#include "PZEMFields.h"
+#include "PZEMModel.h"
+#include "PZEMPlan.h"
+
+/**
+ * @defgroup PzemplanConfig pzemplan Configuration
+ * @{
+ */
+#define PLAN_MAX_SPAN          64      ///< Largest read span (PZEM_PLAN_MAX_SPAN)
+#define PLAN_MAX_READS         32      ///< Reads of the default PZEM_PLAN_MAX_READS
+#define PLAN_REQUEST_SIZE      8       ///< Request frame of a read (PZEM_PLAN_REQUEST_SIZE)
+#define PLAN_DEFAULT_BITS      10      ///< Start, 8 data bits, 1 stop bit
+#define PLAN_DEFAULT_RESPONSE  25      ///< Device response time (ms)
+#define PLAN_DEFAULT_SILENCE   10      ///< Frame silence (ms), MODBUS_RTU_FRAME_SILENCE_MS
+#define PLAN_DEFAULT_PERIOD    1000    ///< Period of fields given without one (ms)
+#define PLAN_SCAN_LIMIT        60000   ///< Phases tried for a read that cannot avoid overlaps
+#define PLAN_MAX_LINE          1024    ///< Longest manifest line
+#define PLAN_DEFAULT_SECONDS   60      ///< Duration of --run
+#define PLAN_POLL_BUDGET_US    2000    ///< Budget of one poll() in --run
+/** @} */
+
+/**
+ * @brief Bus parameters of the wire-time model
+ */
+struct Bus {
+    uint32_t baudrate;        ///< Line speed (0 until given)
+    uint32_t bits;            ///< Bits per character
+    uint32_t responseMs;      ///< Device response time
+    uint32_t silenceMs;       ///< Frame silence
+    uint32_t periodMs;        ///< Default field period
+};
+
+/**
+ * @brief One field of a device and its requested period
+ */
+struct Request {
+    uint8_t slaveAddr;        ///< Slave address
+    uint8_t model;            ///< Model identifier
+    std::string name;         ///< Field name ("all" for the whole snapshot span)
+    uint16_t start;           ///< First register
+    uint16_t end;             ///< Past the last register
+    uint32_t periodMs;        ///< Requested period
+};
+
+/**
+ * @brief One read of the plan
+ */
+struct Read {
+    uint8_t slaveAddr;        ///< Slave address
+    uint16_t start;           ///< First register
+    uint16_t end;             ///< Past the last register
+    uint32_t periodMs;        ///< Period
+    uint32_t phaseMs;         ///< Phase
+    uint32_t busyUs;          ///< Line time of one read
+    bool overlaps;            ///< No phase avoids every other read
+    std::vector<std::string> fields;  ///< Fields served
+    std::vector<uint32_t> periods;    ///< Requested period of each field
+};
+
+/**
+ * @brief Greatest common divisor
+ */
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * @brief Line time of a read of n registers, in microseconds
+ */
+static uint32_t busyUs(const Bus& bus, uint16_t numRegs) {
+    uint32_t chars = PLAN_REQUEST_SIZE + modbusReadResponseLength(numRegs);
+    return (uint32_t)((uint64_t)chars * bus.bits * 1000000 / bus.baudrate) + (bus.responseMs + bus.silenceMs) * 1000;
+}
+
+/**
+ * @brief Line time of a read in whole milliseconds, also its timeout
+ */
+static uint32_t busyMs(const Bus& bus, uint16_t numRegs) {
+    return (busyUs(bus, numRegs) + 999) / 1000;
+}
+
+/**
+ * @brief Count the placed reads that a read at a phase would meet on the line
+ * @param skip Receives how far the phase must move to clear the first one met
+ */
+static uint32_t conflicts(const std::vector<Read*>& placed, uint32_t period, uint32_t phase, uint32_t duration,
+                          uint32_t* skip) {
+    uint32_t count = 0;
+    *skip = 0;
+    for (size_t i = 0; i < placed.size(); i++) {
+        const Read& other = *placed[i];
+        uint32_t g = gcd(period, other.periodMs);
+        uint32_t d = (other.busyUs + 999) / 1000;
+        uint32_t delta = (uint32_t)(((int64_t)phase - other.phaseMs) % g + g) % g;
+        if (delta < d) {
+            count++;
+            *skip = *skip ? *skip : d - delta;
+        } else if (g - delta < duration) {
+            count++;
+            *skip = *skip ? *skip : g - delta + d;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Find the first phase of a period that meets no placed read
+ * @return true if found
+ */
+static bool findPhase(const std::vector<Read*>& placed, uint32_t period, uint32_t duration, uint32_t* phase) {
+    uint32_t skip;
+    for (uint32_t p = 0; p < period; p += skip) {
+        if (conflicts(placed, period, p, duration, &skip) == 0) {
+            *phase = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Give a read the first phase that meets no placed read, or the least crowded one
+ *
+ * Two reads whose periods have a small common divisor meet sooner or later
+ * whatever their phases (200 and 500 ms meet every second when the reads
+ * take more than 100 ms together). Such a read is first tried at a shorter
+ * period that is a multiple of the period of a placed read, if the bus has
+ * room for it: it is then read more often than requested but never meets.
+ */
+static void place(std::vector<Read*>& placed, Read& read, double* occupancy) {
+    uint32_t duration = (read.busyUs + 999) / 1000;
+    uint32_t phase;
+    if (findPhase(placed, read.periodMs, duration, &phase)) {
+        read.phaseMs = phase;
+        read.overlaps = false;
+        placed.push_back(&read);
+        return;
+    }
+    uint32_t harmonic = 0;
+    for (size_t i = 0; i < placed.size(); i++) {
+        uint32_t candidate = read.periodMs / placed[i]->periodMs * placed[i]->periodMs;
+        double added = read.busyUs / (candidate * 1000.0) - read.busyUs / (read.periodMs * 1000.0);
+        if (candidate > harmonic && candidate < read.periodMs && *occupancy + added <= 1.0 &&
+            findPhase(placed, candidate, duration, &phase)) {
+            harmonic = candidate;
+        }
+    }
+    if (harmonic != 0) {
+        *occupancy += read.busyUs / (harmonic * 1000.0) - read.busyUs / (read.periodMs * 1000.0);
+        read.periodMs = harmonic;
+        findPhase(placed, harmonic, duration, &read.phaseMs);
+        read.overlaps = false;
+        placed.push_back(&read);
+        return;
+    }
+
+    uint32_t skip;
+    uint32_t best = 0xFFFFFFFFUL;
+    uint32_t limit = read.periodMs < PLAN_SCAN_LIMIT ? read.periodMs : PLAN_SCAN_LIMIT;
+    for (uint32_t phase = 0; phase < limit; phase++) {
+        uint32_t count = conflicts(placed, read.periodMs, phase, duration, &skip);
+        if (count < best) {
+            best = count;
+            read.phaseMs = phase;
+        }
+    }
+    read.overlaps = true;
+    placed.push_back(&read);
+}
+
+/**
+ * @brief Merge the requested fields into reads
+ *
+ * Fields come by increasing period, so every read already made has a period
+ * no longer than the field: widening it keeps the field at least as fresh as
+ * requested. The cost of an option is the bus time per second it adds.
+ */
+static std::vector<Read> planReads(const Bus& bus, std::vector<Request> requests) {
+    std::stable_sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) {
+        return a.periodMs != b.periodMs ? a.periodMs < b.periodMs : a.start < b.start;
+    });
+    std::vector<Read> reads;
+    for (size_t r = 0; r < requests.size(); r++) {
+        const Request& q = requests[r];
+        double best = (double)busyUs(bus, q.end - q.start) / q.periodMs;
+        int chosen = -1;
+        for (size_t i = 0; i < reads.size(); i++) {
+            const Read& read = reads[i];
+            if (read.slaveAddr != q.slaveAddr) {
+                continue;
+            }
+            uint16_t start = q.start < read.start ? q.start : read.start;
+            uint16_t end = q.end > read.end ? q.end : read.end;
+            if (end - start > PLAN_MAX_SPAN) {
+                continue;
+            }
+            double cost = (double)(busyUs(bus, end - start) - busyUs(bus, read.end - read.start)) / read.periodMs;
+            if (cost <= best) {
+                best = cost;
+                chosen = (int)i;
+            }
+        }
+        if (chosen < 0) {
+            Read read;
+            read.slaveAddr = q.slaveAddr;
+            read.start = q.start;
+            read.end = q.end;
+            read.periodMs = q.periodMs;
+            read.phaseMs = 0;
+            read.busyUs = 0;
+            read.overlaps = false;
+            reads.push_back(read);
+            chosen = (int)reads.size() - 1;
+        }
+        Read& read = reads[chosen];
+        read.start = q.start < read.start ? q.start : read.start;
+        read.end = q.end > read.end ? q.end : read.end;
+        read.fields.push_back(q.name);
+        read.periods.push_back(q.periodMs);
+    }
+    for (size_t i = 0; i < reads.size(); i++) {
+        reads[i].busyUs = busyUs(bus, reads[i].end - reads[i].start);
+    }
+    return reads;
+}
+
+/**
+ * @brief Parse a decimal number that must be in range
+ */
+static bool parseNumber(const char* text, uint32_t min, uint32_t max, uint32_t* value) {
+    char* end = NULL;
+    errno = 0;
+    unsigned long v = strtoul(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || v < min || v > max) {
+        return false;
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+/**
+ * @brief Add the fields of one device token (NAMES[/PERIOD]) to the requests
+ */
+static bool parseFields(const Bus& bus, uint8_t slaveAddr, uint8_t model, char* token,
+                        std::vector<Request>& requests, const char* path, unsigned line) {
+    uint32_t period = bus.periodMs;
+    char* slash = strchr(token, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        if (!parseNumber(slash + 1, 1, 0x7FFFFFFFUL, &period)) {
+            fprintf(stderr, "pzemplan: %s:%u: bad period %s\n", path, line, slash + 1);
+            return false;
+        }
+    }
+    if (*token == '\0') {
+        token = (char*)"all";  // "ADDR MODEL /500": the whole device
+    }
+    char* save;
+    for (char* name = strtok_r(token, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        Request q;
+        q.slaveAddr = slaveAddr;
+        q.model = model;
+        q.name = name;
+        q.periodMs = period;
+        if (strcmp(name, "all") == 0) {
+            q.start = 0;
+            q.end = pzemModelInfo(model)->snapshotRegs;
+        } else {
+            const PZEMField* field = pzemFieldByName(model, name);
+            if (field == NULL) {
+                fprintf(stderr, "pzemplan: %s:%u: %s has no field %s\n", path, line, pzemModelInfo(model)->name,
+                        name);
+                return false;
+            }
+            q.start = field->reg;
+            q.end = field->reg + ((field->type == PZEM_FIELD_U32 || field->type == PZEM_FIELD_S32) ? 2 : 1);
+        }
+        requests.push_back(q);
+    }
+    return true;
+}
+
+/**
+ * @brief Read the manifest
+ */
+static bool parseManifest(const char* path, Bus* bus, std::vector<Request>& requests) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "pzemplan: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    bus->baudrate = 0;
+    bus->bits = PLAN_DEFAULT_BITS;
+    bus->responseMs = PLAN_DEFAULT_RESPONSE;
+    bus->silenceMs = PLAN_DEFAULT_SILENCE;
+    bus->periodMs = PLAN_DEFAULT_PERIOD;
+
+    char text[PLAN_MAX_LINE];
+    unsigned line = 0;
+    bool used[248] = { false };
+    bool ok = true;
+    while (ok && fgets(text, sizeof(text), file) != NULL) {
+        line++;
+        char* comment = strchr(text, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char* save;
+        char* word = strtok_r(text, " \t\r\n", &save);
+        if (word == NULL) {
+            continue;
+        }
+        struct { const char* name; uint32_t* value; uint32_t min; uint32_t max; } settings[] = {
+            { "baud", &bus->baudrate, 300, 1000000 }, { "bits", &bus->bits, 10, 12 },
+            { "response", &bus->responseMs, 0, 10000 }, { "silence", &bus->silenceMs, 0, 1000 },
+            { "period", &bus->periodMs, 1, 0x7FFFFFFFUL },
+        };
+        bool setting = false;
+        for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]) && !setting; s++) {
+            if (strcmp(word, settings[s].name) == 0) {
+                const char* value = strtok_r(NULL, " \t\r\n", &save);
+                setting = true;
+                if (value == NULL || !parseNumber(value, settings[s].min, settings[s].max, settings[s].value) ||
+                    strtok_r(NULL, " \t\r\n", &save) != NULL) {
+                    fprintf(stderr, "pzemplan: %s:%u: %s takes a number from %u to %u\n", path, line, word,
+                            (unsigned)settings[s].min, (unsigned)settings[s].max);
+                    ok = false;
+                }
+            }
+        }
+        if (setting) {
+            continue;
+        }
+
+        uint32_t slaveAddr;
+        const char* modelName = strtok_r(NULL, " \t\r\n", &save);
+        uint8_t model = modelName != NULL ? pzemModelByName(modelName) : PZEM_MODEL_UNKNOWN;
+        if (!parseNumber(word, 1, 247, &slaveAddr) || model == PZEM_MODEL_UNKNOWN) {
+            fprintf(stderr, "pzemplan: %s:%u: expected a setting or ADDR MODEL FIELDS...\n", path, line);
+            ok = false;
+            break;
+        }
+        if (used[slaveAddr]) {
+            fprintf(stderr, "pzemplan: %s:%u: device %u given twice\n", path, line, (unsigned)slaveAddr);
+            ok = false;
+            break;
+        }
+        used[slaveAddr] = true;
+        size_t before = requests.size();
+        for (char* token = strtok_r(NULL, " \t\r\n", &save); ok && token != NULL;
+             token = strtok_r(NULL, " \t\r\n", &save)) {
+            ok = parseFields(*bus, (uint8_t)slaveAddr, model, token, requests, path, line);
+        }
+        if (ok && requests.size() == before) {
+            fprintf(stderr, "pzemplan: %s:%u: device %u has no fields\n", path, line, (unsigned)slaveAddr);
+            ok = false;
+        }
+    }
+    fclose(file);
+    if (ok && bus->baudrate == 0) {
+        fprintf(stderr, "pzemplan: %s: no baud rate\n", path);
+        ok = false;
+    }
+    if (ok && requests.empty()) {
+        fprintf(stderr, "pzemplan: %s: no devices\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Write the header
+ */
+static void writeHeader(FILE* out, const char* manifest, const char* name, const Bus& bus,
+                        const std::vector<Read>& reads, uint32_t utilization) {
+    double perSecond = 0;
+    for (size_t i = 0; i < reads.size(); i++) {
+        perSecond += 1000.0 / reads[i].periodMs;
+    }
+    const char* base = strrchr(manifest, '/');
+    base = base != NULL ? base + 1 : manifest;
+
+    fprintf(out, "/**\n * @file\n * @brief Polling plan compiled by pzemplan from %s (do not edit)\n *\n", base);
+    fprintf(out, " * Bus: %u baud, %u bits per character, %u ms response time, %u ms frame silence\n",
+            (unsigned)bus.baudrate, (unsigned)bus.bits, (unsigned)bus.responseMs, (unsigned)bus.silenceMs);
+    fprintf(out, " * Planned bus occupancy: %.1f %%, %.1f reads/s\n *\n", utilization / 10.0, perSecond);
+    fprintf(out, " *   Read  Device  Registers      Period      Phase     Busy  Fields (requested period if longer)\n");
+    for (size_t i = 0; i < reads.size(); i++) {
+        const Read& r = reads[i];
+        fprintf(out, " *   %-4u  %-6u  0x%04X-0x%04X  %7u ms  %6u ms  %4u ms ", (unsigned)i, r.slaveAddr, r.start,
+                r.end - 1, (unsigned)r.periodMs, (unsigned)r.phaseMs, (unsigned)busyMs(bus, r.end - r.start));
+        for (size_t f = 0; f < r.fields.size(); f++) {
+            fprintf(out, r.periods[f] == r.periodMs ? " %s" : " %s(%u)", r.fields[f].c_str(), (unsigned)r.periods[f]);
+        }
+        fprintf(out, "%s\n", r.overlaps ? "  (overlaps)" : "");
+    }
+    fprintf(out, " */\n\n#ifndef %s_H\n#define %s_H\n\n#include \"PZEMPlan.h\"\n\n", name, name);
+
+    fprintf(out, "constexpr PZEMPlanRead %s_READS[] = {\n", name);
+    for (size_t i = 0; i < reads.size(); i++) {
+        const Read& r = reads[i];
+        uint8_t frame[PLAN_REQUEST_SIZE];
+        modbusBuildReadRequest(frame, r.slaveAddr, MODBUS_READ_INPUT_REGISTERS, r.start, r.end - r.start);
+        fprintf(out, "    { 0x%02X, 0x%02X, 0x%04X, %u, %u, %u, %u, {", r.slaveAddr, MODBUS_READ_INPUT_REGISTERS,
+                r.start, r.end - r.start, (unsigned)busyMs(bus, r.end - r.start), (unsigned)r.periodMs,
+                (unsigned)r.phaseMs);
+        for (uint8_t b = 0; b < PLAN_REQUEST_SIZE; b++) {
+            fprintf(out, "%s0x%02X", b ? ", " : " ", frame[b]);
+        }
+        fprintf(out, " } },\n");
+    }
+    fprintf(out, "};\n\nconstexpr PZEMPlan %s = { %s_READS, %u, %u, %u };\n\n#endif // %s_H\n", name, name,
+            (unsigned)reads.size(), (unsigned)bus.baudrate, (unsigned)utilization, name);
+}
+
+/**
+ * @brief Count the failed reads of a run
+ */
+static void onRunRead(const PZEMFieldRead* read, void* context) {
+    if (!read->success) {
+        (*(uint32_t*)context)++;
+    }
+}
+
+/**
+ * @brief Walk the plan on a serial port and print the achieved cadence of every read
+ * @return true if no read failed, overran or missed a period
+ *
+ * The reads are the ones the header holds, so the run checks the plan as a
+ * board would walk it, waits and bus timeouts included.
+ */
+static bool runPlan(const char* port, uint32_t seconds, const Bus& bus, const std::vector<Read>& reads,
+                    uint32_t utilization) {
+    std::vector<PZEMPlanRead> table(reads.size());
+    for (size_t i = 0; i < reads.size(); i++) {
+        const Read& r = reads[i];
+        PZEMPlanRead& read = table[i];
+        read.slaveAddr = r.slaveAddr;
+        read.function = MODBUS_READ_INPUT_REGISTERS;
+        read.startAddr = r.start;
+        read.numRegs = r.end - r.start;
+        read.timeoutMs = busyMs(bus, read.numRegs);
+        read.periodMs = r.periodMs;
+        read.phaseMs = r.phaseMs;
+        modbusBuildReadRequest(read.request, r.slaveAddr, MODBUS_READ_INPUT_REGISTERS, r.start, read.numRegs);
+    }
+    PZEMPlan plan = { table.data(), (uint16_t)table.size(), bus.baudrate, (uint16_t)utilization };
+
+    static PosixSerial serial;
+    static ModbusRTUTransport transport(&serial);
+    static PZEMBus line(transport);
+    static PZEMCadence cadence;
+    if (!serial.open(port, bus.baudrate)) {
+        fprintf(stderr, "pzemplan: cannot use %s at %u baud: %s\n", port, (unsigned)bus.baudrate, strerror(errno));
+        return false;
+    }
+    line.setInterval(PZEM_BUS_NO_SWEEP);
+    PZEMPlanScheduler scheduler(line, plan);
+    uint32_t failed = 0;
+    scheduler.setReadCallback(onRunRead, &failed);
+    scheduler.setCadence(&cadence);
+    if (!scheduler.begin()) {
+        fprintf(stderr, "pzemplan: the plan does not fit PZEMPlanScheduler (%u reads, at most %u)\n",
+                (unsigned)table.size(), (unsigned)PZEM_PLAN_MAX_READS);
+        return false;
+    }
+    uint32_t start = millis();
+    while (millis() - start < seconds * 1000) {
+        scheduler.poll(PLAN_POLL_BUDGET_US);
+        serial.waitReadable(1);
+    }
+
+    uint32_t missed = 0;
+    uint32_t jitterMax = 0;
+    printf("Read  Device  Registers      Period    Reads  Mean interval  Jitter mean  Jitter max  Missed\n");
+    for (size_t i = 0; i < table.size(); i++) {
+        const PZEMPlanRead& read = table[i];
+        PZEMCadenceStats stats;
+        memset(&stats, 0, sizeof(stats));
+        for (uint8_t t = 0; t < PZEM_CADENCE_MAX_TRACKS; t++) {
+            PZEMCadenceStats candidate;
+            if (cadence.getStats(t, &candidate) && candidate.slaveAddr == read.slaveAddr &&
+                candidate.startAddr == read.startAddr && candidate.numRegs == read.numRegs) {
+                stats = candidate;
+            }
+        }
+        printf("%-4u  %-6u  0x%04X-0x%04X  %6u ms  %5u  %10u ms  %8u ms  %7u ms  %6u\n", (unsigned)i,
+               read.slaveAddr, read.startAddr, read.startAddr + read.numRegs - 1, (unsigned)read.periodMs,
+               (unsigned)stats.updates, (unsigned)stats.meanIntervalMs, (unsigned)stats.jitterMeanMs,
+               (unsigned)stats.jitterMaxMs, (unsigned)stats.missed);
+        missed += stats.missed;
+        jitterMax = stats.jitterMaxMs > jitterMax ? stats.jitterMaxMs : jitterMax;
+    }
+    printf("%u s on %s: %u reads, %u failed, %u overruns, %u missed periods, largest jitter %u ms\n",
+           (unsigned)seconds, port, (unsigned)scheduler.getReadCount(), (unsigned)failed,
+           (unsigned)scheduler.getOverrunCount(), (unsigned)missed, (unsigned)jitterMax);
+    return failed == 0 && scheduler.getOverrunCount() == 0 && missed == 0;
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemplan [options] MANIFEST\n"
+        "  --output FILE   Header to write (default: standard output, none with --run)\n"
+        "  --name NAME     Name of the PZEMPlan constant (default: PZEM_PLAN)\n"
+        "  --run PORT      Run the plan on a serial port and report its cadence\n"
+        "  --seconds N     Duration of the run (default: 60)\n");
+}
+
+/**
+ * @brief Check that a name is a C identifier
+ */
+static bool isIdentifier(const char* name) {
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_') {
+        return false;
+    }
+    for (const char* c = name; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* manifest = NULL;
+    const char* output = NULL;
+    const char* name = "PZEM_PLAN";
+    const char* port = NULL;
+    uint32_t seconds = PLAN_DEFAULT_SECONDS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+            port = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            if (!parseNumber(argv[++i], 1, 86400, &seconds)) {
+                usage();
+                return 2;
+            }
+        } else if (argv[i][0] != '-' && manifest == NULL) {
+            manifest = argv[i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (manifest == NULL || !isIdentifier(name)) {
+        usage();
+        return 2;
+    }
+
+    Bus bus;
+    std::vector<Request> requests;
+    if (!parseManifest(manifest, &bus, requests)) {
+        return 1;
+    }
+    std::vector<Read> reads = planReads(bus, requests);
+    double occupancy = 0;
+    for (size_t i = 0; i < reads.size(); i++) {
+        occupancy += reads[i].busyUs / (reads[i].periodMs * 1000.0);
+    }
+    if (occupancy > 1.0) {
+        fprintf(stderr, "pzemplan: the reads need %.1f %% of the bus; lengthen the periods or raise the baud rate\n",
+                occupancy * 100);
+        return 1;
+    }
+    if (reads.size() > PLAN_MAX_READS) {
+        fprintf(stderr, "pzemplan: warning: %u reads, define PZEM_PLAN_MAX_READS to at least that\n",
+                (unsigned)reads.size());
+    }
+
+    // Shortest periods first: they have the fewest free phases
+    std::vector<Read*> order;
+    for (size_t i = 0; i < reads.size(); i++) {
+        order.push_back(&reads[i]);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const Read* a, const Read* b) {
+        return a->periodMs != b->periodMs ? a->periodMs < b->periodMs : a->busyUs > b->busyUs;
+    });
+    std::vector<Read*> placed;
+    for (size_t i = 0; i < order.size(); i++) {
+        place(placed, *order[i], &occupancy);
+        if (order[i]->overlaps) {
+            fprintf(stderr, "pzemplan: warning: the read of device %u at 0x%04X overlaps other reads; it will queue\n",
+                    order[i]->slaveAddr, order[i]->start);
+        }
+    }
+    std::stable_sort(reads.begin(), reads.end(), [](const Read& a, const Read& b) {
+        return a.phaseMs != b.phaseMs ? a.phaseMs < b.phaseMs : a.periodMs < b.periodMs;
+    });
+    uint32_t permille = (uint32_t)(occupancy * 1000 + 0.999);
+
+    if (output != NULL || port == NULL) {
+        FILE* out = output != NULL ? fopen(output, "w") : stdout;
+        if (out == NULL) {
+            fprintf(stderr, "pzemplan: cannot create %s: %s\n", output, strerror(errno));
+            return 1;
+        }
+        writeHeader(out, manifest, name, bus, reads, permille);
+        if (output != NULL && fclose(out) != 0) {
+            fprintf(stderr, "pzemplan: cannot write %s: %s\n", output, strerror(errno));
+            return 1;
+        }
+    }
+    if (port != NULL && !runPlan(port, seconds, bus, reads, permille)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+/**
+ * @file pzemschedbench.cpp
+ * @brief Cost of the subscription scheduler with many subscriptions (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The program replaces the host clock: millis(), micros(), delay() and
+ * yield() run on a virtual clock, and a transport answering every read at
+ * once stands in for the bus, so only the scheduler and the bus code are
+ * timed. Subscriptions get random ranges of random devices at periods from
+ * 200 ms to 1 h. Three phases are timed on the real clock:
+ *  - subscribe: every subscription added to an empty scheduler;
+ *  - run: the simulated duration, one tick at a time, polling until every due
+ *    read is done; the cost is given per tick and per due subscription;
+ *  - churn: random subscriptions cancelled and replaced by new ones.
+ * With --cadence a PZEMCadence tracker is attached before the subscriptions
+ * are added, as a gateway reporting its cadence would.
+ *
+ * Usage: pzemschedbench [options]
+ *   --subscriptions N Subscriptions (default: 10000)
+ *   --devices N       Devices the subscriptions are spread over (default: 64)
+ *   --seconds N       Simulated duration (default: 3600)
+ *   --churn N         Cancel-and-replace pairs (default: 100000)
+ *   --cadence         Attach a cadence tracker
+ *   --seed N          Random seed (default: 1)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ModbusProtocol.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+#include "PZEMScheduler.h"
+
+/**
+ * @defgroup PzemschedbenchConfig pzemschedbench Configuration
+ * @{
+ */
+#define SCHEDBENCH_YIELD_US       10     ///< Virtual time spent by one yield()
+#define SCHEDBENCH_MAX_PENDING    8      ///< Reads the instant transport holds at once
+/** @} */
+
+// ============================================================================
+// Virtual clock
+// ============================================================================
+
+static uint64_t nowUs = 0;  ///< Virtual time
+
+uint32_t millis() {
+    return (uint32_t)(nowUs / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)nowUs;
+}
+
+void delay(unsigned long ms) {
+    nowUs += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    nowUs += us;
+}
+
+void yield() {
+    nowUs += SCHEDBENCH_YIELD_US;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    (void)pin;
+    (void)level;
+}
+
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    return LOW;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+// ============================================================================
+// Instant transport
+// ============================================================================
+
+/**
+ * @class InstantTransport
+ * @brief Transport answering every read on the next poll(), without bus time
+ */
+class InstantTransport : public ModbusTransport {
+public:
+    InstantTransport() : _count(0) {}
+
+    bool submit(ModbusTransaction* txn) {
+        if (_count == SCHEDBENCH_MAX_PENDING) {
+            return false;
+        }
+        txn->status = MODBUS_TRANSACTION_PENDING;
+        txn->responseLength = 0;
+        _pending[_count++] = txn;
+        return true;
+    }
+
+    void poll() {
+        // Completion callbacks may submit again: take the current batch first
+        ModbusTransaction* batch[SCHEDBENCH_MAX_PENDING];
+        uint8_t count = _count;
+        memcpy(batch, _pending, sizeof(batch[0]) * count);
+        _count = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            ModbusTransaction* txn = batch[i];
+            uint16_t numRegs = (txn->request[4] << 8) | txn->request[5];
+            uint16_t length = modbusReadResponseLength(numRegs);
+            txn->response[0] = txn->request[0];
+            txn->response[1] = txn->request[1];
+            txn->response[2] = numRegs * 2;
+            memset(txn->response + 3, 0, numRegs * 2);
+            uint16_t crc = modbusCRC16(txn->response, length - 2);
+            txn->response[length - 2] = crc & 0xFF;
+            txn->response[length - 1] = crc >> 8;
+            txn->responseLength = length;
+            complete(txn, MODBUS_TRANSACTION_OK);
+        }
+    }
+
+    bool isIdle() const {
+        return _count == 0;
+    }
+
+private:
+    ModbusTransaction* _pending[SCHEDBENCH_MAX_PENDING];  ///< Reads to answer
+    uint8_t _count;                                       ///< Reads pending
+};
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+/**
+ * @brief Read periods of the subscriptions (ms)
+ */
+static const uint32_t PERIODS[] = {200, 500, 1000, 2000, 5000, 10000, 30000, 60000, 300000, 900000, 3600000};
+
+static uint32_t deviceCount = 64;  ///< Devices the subscriptions are spread over
+static uint64_t dueServed = 0;     ///< Due subscriptions served by the reads
+
+/**
+ * @brief Real time in nanoseconds
+ */
+static uint64_t wallNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Count the subscriptions served by every read
+ */
+static void onRead(const PZEMFieldRead* read, void*) {
+    dueServed += read->subscriptions;
+}
+
+/**
+ * @brief Subscribe a random range of a random device at a random period
+ */
+static int32_t subscribeRandom(PZEMScheduler& scheduler) {
+    uint8_t slaveAddr = 1 + rand() % deviceCount;
+    uint16_t numRegs = 1 + rand() % 4;
+    uint16_t startAddr = rand() % (PZEM_SCHEDULER_MAX_SPAN - numRegs + 1);
+    uint32_t periodMs = PERIODS[rand() % (sizeof(PERIODS) / sizeof(PERIODS[0]))];
+    return scheduler.subscribe(slaveAddr, MODBUS_READ_INPUT_REGISTERS, startAddr, numRegs, periodMs);
+}
+
+/**
+ * @brief Poll until no read is left to do on this tick
+ */
+static void drain(PZEMScheduler& scheduler) {
+    uint32_t before;
+    do {
+        before = scheduler.getReadCount();
+        scheduler.poll(0);
+    } while (scheduler.getReadCount() != before);
+}
+
+int main(int argc, char** argv) {
+    uint32_t subscriptions = 10000;
+    uint32_t seconds = 3600;
+    uint32_t churn = 100000;
+    bool withCadence = false;
+    uint32_t seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--subscriptions") == 0 && hasValue) {
+            subscriptions = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--devices") == 0 && hasValue) {
+            deviceCount = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            seconds = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--churn") == 0 && hasValue) {
+            churn = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cadence") == 0) {
+            withCadence = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: pzemschedbench [--subscriptions N] [--devices N] [--seconds N] [--churn N]\n"
+                            "                      [--cadence] [--seed N]\n");
+            return 2;
+        }
+    }
+    if (subscriptions == 0 || subscriptions > PZEM_SCHEDULER_MAX_SUBSCRIPTIONS || deviceCount == 0 ||
+        deviceCount > PZEM_SCHEDULER_MAX_DEVICES || deviceCount > 247) {
+        fprintf(stderr, "pzemschedbench: 1 to %u subscriptions over 1 to %u devices (see the build line)\n",
+                (unsigned)PZEM_SCHEDULER_MAX_SUBSCRIPTIONS, (unsigned)PZEM_SCHEDULER_MAX_DEVICES);
+        return 2;
+    }
+    srand(seed);
+
+    InstantTransport transport;
+    PZEMBus bus(transport);
+    PZEMScheduler* scheduler = new PZEMScheduler(bus);
+    PZEMCadence cadence;
+    scheduler->setReadCallback(onRead, NULL);
+    if (withCadence) {
+        scheduler->setCadence(&cadence);
+    }
+
+    int32_t* ids = new int32_t[subscriptions];
+    uint64_t start = wallNs();
+    for (uint32_t i = 0; i < subscriptions; i++) {
+        ids[i] = subscribeRandom(*scheduler);
+        if (ids[i] == PZEM_SCHEDULER_INVALID) {
+            fprintf(stderr, "pzemschedbench: subscription %u refused\n", (unsigned)i);
+            return 1;
+        }
+    }
+    uint64_t subscribeNs = wallNs() - start;
+
+    uint64_t ticks = (uint64_t)seconds * 1000 / PZEM_SCHEDULER_TICK_MS;
+    start = wallNs();
+    for (uint64_t t = 0; t < ticks; t++) {
+        nowUs += PZEM_SCHEDULER_TICK_MS * 1000;
+        drain(*scheduler);
+    }
+    uint64_t runNs = wallNs() - start;
+
+    start = wallNs();
+    for (uint32_t i = 0; i < churn; i++) {
+        uint32_t victim = rand() % subscriptions;
+        scheduler->unsubscribe(ids[victim]);
+        ids[victim] = subscribeRandom(*scheduler);
+    }
+    uint64_t churnNs = wallNs() - start;
+
+    printf("subscriptions: %u over %u devices, %s, %u s simulated\n", (unsigned)subscriptions,
+           (unsigned)deviceCount, withCadence ? "cadence tracked" : "no cadence", (unsigned)seconds);
+    printf("subscribe: %.0f ns each\n", (double)subscribeNs / subscriptions);
+    printf("run: %llu ticks, %u reads, %llu due subscriptions (%.1f per read), %u overruns\n",
+           (unsigned long long)ticks, (unsigned)scheduler->getReadCount(), (unsigned long long)dueServed,
+           scheduler->getReadCount() > 0 ? (double)dueServed / scheduler->getReadCount() : 0.0,
+           (unsigned)scheduler->getOverrunCount());
+    printf("  %.2f us per tick, %.0f ns per due subscription\n", runNs / 1000.0 / ticks,
+           dueServed > 0 ? (double)runNs / dueServed : 0.0);
+    if (churn > 0) {
+        printf("churn: %u cancel-and-replace, %.0f ns each\n", (unsigned)churn, (double)churnNs / churn);
+    }
+
+    delete[] ids;
+    delete scheduler;
+    return 0;
+}
@@ -0,0 +1,647 @@
+/**
+ * @file pzemsim.cpp
+ * @brief PZEM bus simulator on a pseudo-terminal (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Creates a pty and answers on it as a bus of PZEM devices, so pzemctl, the
+ * gateways and test programs can run without hardware. Each device answers at
+ * its own baud rate only (as a real unit does), reads outside its register
+ * spans raise Modbus exceptions, settings and address changes are kept, and
+ * responses come after the time the frames would take on the wire.
+ *
+ * Usage: pzemsim [options] ADDR:MODEL[@BAUD] ...
+ *   --link PATH     Also make PATH a symlink to the pty
+ *   --delay MS      Device processing time before answering (default: 2)
+ *   --fast          Do not wait for the wire time of the frames
+ *   --drop PCT      Leave PCT percent of the requests unanswered
+ *   --corrupt PCT   Corrupt the CRC of PCT percent of the responses
+ *   --seed N        Random seed of the measurements and faults
+ *   --verbose       Print every frame
+ *
+ * MODEL is 004t, 003, 017 or 6l24; BAUD defaults to 9600.
+ * Example: pzemsim --link /tmp/pzem 1:004t 2:017 3:6l24@19200
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ModbusProtocol.h"
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PzemsimConfig Simulator Configuration
+ * @{
+ */
+#define SIM_MAX_DEVICES      32    ///< Devices on the simulated bus
+#define SIM_FRAME_GAP_US     4000  ///< Silence that discards a partial request
+#define SIM_DEFAULT_BAUDRATE 9600  ///< Baud rate of devices given without one
+/** @} */
+
+/**
+ * @brief One simulated device
+ */
+struct SimDevice {
+    uint8_t slaveAddr;        ///< Current slave address
+    uint8_t model;            ///< Model identifier (PZEM_MODEL_*)
+    uint32_t baudrate;        ///< Baud rate the device listens at
+    uint16_t holding[4];      ///< Holding registers (host order)
+    double energyWh;          ///< Active energy counter
+    double lastTime;          ///< Time the energy was last integrated (s)
+    double phase;             ///< Per-device offset of the waveforms
+};
+
+static SimDevice devices[SIM_MAX_DEVICES];  ///< Simulated devices
+static uint8_t deviceCount = 0;             ///< Devices in use
+static uint32_t delayMs = 2;                ///< Processing time before answering
+static bool fast = false;                   ///< Skip the wire time
+static uint32_t dropPercent = 0;            ///< Requests left unanswered
+static uint32_t corruptPercent = 0;         ///< Responses with a bad CRC
+static bool verbose = false;                ///< Print every frame
+static const char* linkPath = NULL;         ///< Symlink to the pty
+static volatile sig_atomic_t running = 1;   ///< Cleared by SIGINT/SIGTERM
+
+/**
+ * @brief Monotonic time in seconds
+ */
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Sleep for a number of seconds
+ */
+static void sleepFor(double seconds) {
+    if (seconds <= 0) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR && running) {
+    }
+}
+
+/**
+ * @brief Stop the main loop
+ */
+static void onSignal(int) {
+    running = 0;
+}
+
+/**
+ * @brief Find a model identifier by name ("004t", "PZEM-6L24", ...)
+ */
+static uint8_t modelByName(const char* name) {
+    if (strncasecmp(name, "PZEM-", 5) == 0) {
+        name += 5;
+    }
+    for (uint8_t model = 0; model < PZEM_MODEL_COUNT; model++) {
+        if (strcasecmp(name, pzemModelInfo(model)->name + 5) == 0) {
+            return model;
+        }
+    }
+    return PZEM_MODEL_UNKNOWN;
+}
+
+/**
+ * @brief Get the PZEM-6L24 baud rate code of a baud rate
+ */
+static int baudrateCode(uint32_t baudrate) {
+    static const uint32_t RATES[] = { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+    for (int i = 0; i < 7; i++) {
+        if (RATES[i] == baudrate) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the baud rate of a PZEM-6L24 baud rate code
+ */
+static uint32_t baudrateOfCode(uint8_t code) {
+    static const uint32_t RATES[] = { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+    return code < 7 ? RATES[code] : 0;
+}
+
+/**
+ * @brief Get the baud rate set on a terminal
+ */
+static uint32_t lineBaudrate(int fd) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        return 0;
+    }
+    switch (cfgetospeed(&tio)) {
+        case B1200:   return 1200;
+        case B2400:   return 2400;
+        case B4800:   return 4800;
+        case B9600:   return 9600;
+        case B19200:  return 19200;
+        case B38400:  return 38400;
+        case B57600:  return 57600;
+        case B115200: return 115200;
+        default:      return 0;
+    }
+}
+
+/**
+ * @brief Parse ADDR:MODEL[@BAUD] and add the device
+ */
+static bool addDevice(const char* spec) {
+    char model[16];
+    unsigned addr = 0;
+    unsigned baudrate = SIM_DEFAULT_BAUDRATE;
+    if (sscanf(spec, "%u:%15[^@]@%u", &addr, model, &baudrate) < 2 || addr < 1 || addr > 247 ||
+        deviceCount >= SIM_MAX_DEVICES) {
+        return false;
+    }
+
+    SimDevice& dev = devices[deviceCount];
+    memset(&dev, 0, sizeof(dev));
+    dev.slaveAddr = addr;
+    dev.model = modelByName(model);
+    dev.baudrate = baudrate;
+    dev.lastTime = now();
+    dev.phase = deviceCount * 1.7;
+    dev.energyWh = 1000.0 + 250.0 * deviceCount;
+
+    switch (dev.model) {
+        case PZEM_MODEL_004T:
+            dev.holding[1] = 2300;                         // Power alarm threshold (W)
+            dev.holding[2] = addr;
+            break;
+        case PZEM_MODEL_003:
+        case PZEM_MODEL_017:
+            dev.holding[0] = 30000;                        // High voltage alarm (0.01 V)
+            dev.holding[1] = 700;                          // Low voltage alarm (0.01 V)
+            dev.holding[2] = addr;
+            break;
+        case PZEM_MODEL_6L24:
+            if (baudrateCode(baudrate) < 0) {
+                return false;
+            }
+            dev.holding[0] = (uint16_t)((addr << 8) | 0x01);  // Software address
+            dev.holding[1] = (uint16_t)baudrateCode(baudrate); // 3-phase 4-wire
+            dev.holding[2] = 0;                                // 50 Hz
+            break;
+        default:
+            return false;
+    }
+    deviceCount++;
+    return true;
+}
+
+/**
+ * @brief Store a 32-bit value in two registers, low word first
+ */
+static void put32(uint16_t* regs, uint16_t reg, int32_t value) {
+    regs[reg] = (uint16_t)(value & 0xFFFF);
+    regs[reg + 1] = (uint16_t)(((uint32_t)value >> 16) & 0xFFFF);
+}
+
+/**
+ * @brief Compute the input registers of a device at the current time (host order)
+ */
+static void measure(SimDevice& dev, uint16_t* regs) {
+    double t = now();
+    double wobble = sin(t / 7.0 + dev.phase);
+    double load = 0.75 + 0.25 * sin(t / 13.0 + dev.phase);
+    memset(regs, 0, PZEM_SNAPSHOT_MAX_REGISTERS * sizeof(uint16_t));
+
+    double voltage, current, power;
+    if (dev.model == PZEM_MODEL_003 || dev.model == PZEM_MODEL_017) {
+        voltage = 48.0 + 0.5 * wobble;
+        current = 20.0 * load;
+        power = voltage * current;
+    } else if (dev.model == PZEM_MODEL_004T) {
+        voltage = 230.0 + 2.0 * wobble;
+        current = 8.0 * load;
+        power = voltage * current * 0.95;
+    } else {
+        voltage = 230.0 + 2.0 * wobble;
+        current = 30.0 * load;
+        power = 3 * voltage * current * 0.95;
+    }
+
+    dev.energyWh += power * (t - dev.lastTime) / 3600.0;
+    dev.lastTime = t;
+
+    switch (dev.model) {
+        case PZEM_MODEL_004T:
+            regs[0] = (uint16_t)lround(voltage * 10);
+            put32(regs, 1, lround(current * 1000));
+            put32(regs, 3, lround(power * 10));
+            put32(regs, 5, (int32_t)dev.energyWh);
+            regs[7] = 500;                                 // 50.0 Hz
+            regs[8] = 95;                                  // 0.95
+            regs[9] = power > dev.holding[1] ? 0xFFFF : 0;
+            break;
+        case PZEM_MODEL_003:
+        case PZEM_MODEL_017:
+            regs[0] = (uint16_t)lround(voltage * 100);
+            regs[1] = (uint16_t)lround(current * 100);
+            put32(regs, 2, lround(power * 10));
+            put32(regs, 4, (int32_t)dev.energyWh);
+            regs[6] = voltage * 100 > dev.holding[0] ? 0xFFFF : 0;
+            regs[7] = voltage * 100 < dev.holding[1] ? 0xFFFF : 0;
+            break;
+        case PZEM_MODEL_6L24: {
+            double phasePower = power / 3;
+            double phaseReactive = phasePower * 0.33;
+            double phaseApparent = voltage * current;
+            for (int p = 0; p < 3; p++) {
+                regs[0x00 + p] = (uint16_t)lround(voltage * 10);
+                regs[0x03 + p] = (uint16_t)lround(current * 100);
+                regs[0x06 + p] = dev.holding[2] ? 6000 : 5000;
+                regs[0x0B + p] = 1800;                     // 18.00 degrees
+                put32(regs, 0x0E + 2 * p, lround(phasePower * 10));
+                put32(regs, 0x14 + 2 * p, lround(phaseReactive * 10));
+                put32(regs, 0x1A + 2 * p, lround(phaseApparent * 10));
+                put32(regs, 0x28 + 2 * p, (int32_t)(dev.energyWh / 3 * 10));
+                put32(regs, 0x2E + 2 * p, (int32_t)(dev.energyWh / 3 * 3.3));
+                put32(regs, 0x34 + 2 * p, (int32_t)(dev.energyWh / 3 * 10.5));
+            }
+            regs[0x09] = 12000;                            // 120.00 degrees
+            regs[0x0A] = 24000;                            // 240.00 degrees
+            put32(regs, 0x20, lround(power * 10));
+            put32(regs, 0x22, lround(phaseReactive * 30));
+            put32(regs, 0x24, lround(phaseApparent * 30));
+            regs[0x26] = (95 << 8) | 95;
+            regs[0x27] = (95 << 8) | 95;
+            put32(regs, 0x3A, (int32_t)(dev.energyWh * 10));
+            put32(regs, 0x3C, (int32_t)(dev.energyWh * 3.3));
+            put32(regs, 0x3E, (int32_t)(dev.energyWh * 10.5));
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Append a register to a frame in the wire order of a model
+ */
+static uint16_t putReg(uint8_t* frame, uint16_t length, uint16_t value, const PZEMModelInfo* info) {
+    if (info->bigEndian) {
+        frame[length++] = value >> 8;
+        frame[length++] = value & 0xFF;
+    } else {
+        frame[length++] = value & 0xFF;
+        frame[length++] = value >> 8;
+    }
+    return length;
+}
+
+/**
+ * @brief Read a register from a frame in the wire order of a model
+ */
+static uint16_t getReg(const uint8_t* data, const PZEMModelInfo* info) {
+    return info->bigEndian ? (uint16_t)((data[0] << 8) | data[1]) : (uint16_t)((data[1] << 8) | data[0]);
+}
+
+/**
+ * @brief Build an exception response
+ */
+static uint16_t exceptionResponse(uint8_t* response, uint8_t slaveAddr, uint8_t function, uint8_t code) {
+    response[0] = slaveAddr;
+    response[1] = function | 0x80;
+    response[2] = code;
+    return 3;
+}
+
+/**
+ * @brief Apply a holding register write, possibly changing address or baud rate
+ */
+static void writeHolding(SimDevice& dev, uint16_t reg, uint16_t value) {
+    dev.holding[reg] = value;
+    if (dev.model == PZEM_MODEL_6L24) {
+        if (reg == 0 && (value & 0xFF) == 0x01 && (value >> 8) >= 1 && (value >> 8) <= 247) {
+            dev.slaveAddr = value >> 8;
+        } else if (reg == 1 && baudrateOfCode(value & 0xFF) != 0) {
+            dev.baudrate = baudrateOfCode(value & 0xFF);
+        }
+    } else if (reg == 2 && value >= 1 && value <= 247) {
+        dev.slaveAddr = (uint8_t)value;
+    }
+}
+
+/**
+ * @brief Check the value of a holding register write
+ */
+static bool validHolding(const SimDevice& dev, uint16_t reg, uint16_t value) {
+    if (dev.model == PZEM_MODEL_6L24) {
+        if (reg == 1) {
+            return baudrateOfCode(value & 0xFF) != 0 && (value >> 8) <= 1;
+        }
+        if (reg == 2) {
+            return value <= 1;
+        }
+        return true;
+    }
+    if (reg == 2) {
+        return value >= 1 && value <= 247;
+    }
+    if (dev.model == PZEM_MODEL_017 && reg == 3) {
+        return value <= 3;
+    }
+    return true;
+}
+
+/**
+ * @brief Answer one request (without CRC), returning the response length (0 = no answer)
+ *
+ * Address and baud rate changes take effect after the response, which goes
+ * out from the old address at the old rate.
+ */
+static uint16_t answer(SimDevice& dev, const uint8_t* request, uint16_t length, uint8_t* response) {
+    const PZEMModelInfo* info = pzemModelInfo(dev.model);
+    uint8_t function = request[1];
+    uint8_t slaveAddr = dev.slaveAddr;
+
+    if (function == MODBUS_READ_INPUT_REGISTERS || function == MODBUS_READ_HOLDING_REGISTERS) {
+        uint16_t start = (request[2] << 8) | request[3];
+        uint16_t count = (request[4] << 8) | request[5];
+        uint16_t span = (function == MODBUS_READ_INPUT_REGISTERS) ? info->snapshotRegs : info->holdingRegs;
+        if (count == 0 || count > MODBUS_MAX_READ_REGISTERS) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        }
+        if (start + count > span) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        }
+
+        uint16_t regs[PZEM_SNAPSHOT_MAX_REGISTERS];
+        if (function == MODBUS_READ_INPUT_REGISTERS) {
+            measure(dev, regs);
+        } else {
+            memcpy(regs, dev.holding, sizeof(dev.holding));
+        }
+        response[0] = slaveAddr;
+        response[1] = function;
+        response[2] = count * 2;
+        uint16_t n = 3;
+        for (uint16_t i = 0; i < count; i++) {
+            n = putReg(response, n, regs[start + i], info);
+        }
+        return n;
+    }
+
+    if (function == MODBUS_WRITE_SINGLE_REGISTER) {
+        uint16_t reg = (request[2] << 8) | request[3];
+        uint16_t value = getReg(request + 4, info);
+        if (reg >= info->holdingRegs) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        }
+        if (!validHolding(dev, reg, value)) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        }
+        memcpy(response, request, 6);
+        writeHolding(dev, reg, value);
+        return 6;
+    }
+
+    if (function == MODBUS_WRITE_MULTIPLE_REGISTERS) {
+        uint16_t start = (request[2] << 8) | request[3];
+        uint16_t count = (request[4] << 8) | request[5];
+        if (count == 0 || request[6] != count * 2 || length < 7 + count * 2) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        }
+        if (start + count > info->holdingRegs) {
+            return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            if (!validHolding(dev, start + i, getReg(request + 7 + 2 * i, info))) {
+                return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+            }
+        }
+        memcpy(response, request, 6);
+        for (uint16_t i = 0; i < count; i++) {
+            writeHolding(dev, start + i, getReg(request + 7 + 2 * i, info));
+        }
+        return 6;
+    }
+
+    if (function == MODBUS_RESET_ENERGY) {
+        dev.energyWh = 0;
+        response[0] = slaveAddr;
+        response[1] = function;
+        return 2;
+    }
+
+    return exceptionResponse(response, slaveAddr, function, MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+}
+
+/**
+ * @brief Get the full length of a request from its first bytes (0 = not known yet)
+ */
+static uint16_t requestLength(const uint8_t* frame, uint16_t length) {
+    if (length < 2) {
+        return 0;
+    }
+    switch (frame[1]) {
+        case MODBUS_RESET_ENERGY:
+            return 4;
+        case MODBUS_WRITE_MULTIPLE_REGISTERS:
+            return length < 7 ? 0 : 9 + frame[6];
+        default:
+            return 8;
+    }
+}
+
+/**
+ * @brief Print a frame in hex
+ */
+static void dump(const char* label, const uint8_t* frame, uint16_t length) {
+    printf("%s", label);
+    for (uint16_t i = 0; i < length; i++) {
+        printf(" %02X", frame[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief Answer a complete request from the device it addresses, if any
+ */
+static void serve(int master, int slave, const uint8_t* request, uint16_t length) {
+    if (verbose) {
+        dump("<-", request, length);
+    }
+    if (modbusCRC16(request, length - 2) != (uint16_t)(request[length - 2] | (request[length - 1] << 8))) {
+        return;
+    }
+
+    uint32_t baudrate = lineBaudrate(slave);
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        SimDevice& dev = devices[i];
+        if (dev.slaveAddr != request[0] || dev.baudrate != baudrate) {
+            continue;
+        }
+        if ((uint32_t)(rand() % 100) < dropPercent) {
+            return;
+        }
+
+        uint8_t response[MODBUS_MAX_ADU_SIZE];
+        uint16_t n = answer(dev, request, length, response);
+        uint16_t crc = modbusCRC16(response, n);
+        response[n++] = crc & 0xFF;
+        response[n++] = crc >> 8;
+        if ((uint32_t)(rand() % 100) < corruptPercent) {
+            response[n - 1] ^= 0x5A;
+        }
+
+        // The request took its wire time to arrive; the response takes its own to leave
+        double wire = fast ? 0 : (length + n) * 10.0 / baudrate;
+        sleepFor(wire + delayMs / 1000.0);
+        if (verbose) {
+            dump("->", response, n);
+        }
+        if (write(master, response, n) < 0) {
+            perror("pzemsim: write");
+        }
+        return;
+    }
+}
+
+/**
+ * @brief Print usage
+ */
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemsim [options] ADDR:MODEL[@BAUD] ...\n"
+        "  --link PATH     Also make PATH a symlink to the pty\n"
+        "  --delay MS      Device processing time before answering (default: 2)\n"
+        "  --fast          Do not wait for the wire time of the frames\n"
+        "  --drop PCT      Leave PCT percent of the requests unanswered\n"
+        "  --corrupt PCT   Corrupt the CRC of PCT percent of the responses\n"
+        "  --seed N        Random seed of the measurements and faults\n"
+        "  --verbose       Print every frame\n"
+        "MODEL: 004t, 003, 017 or 6l24. BAUD: 2400 to 115200 (default: 9600).\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned seed = (unsigned)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--link") == 0 && hasValue) {
+            linkPath = argv[++i];
+        } else if (strcmp(arg, "--delay") == 0 && hasValue) {
+            delayMs = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(arg, "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(arg, "--drop") == 0 && hasValue) {
+            dropPercent = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(arg, "--corrupt") == 0 && hasValue) {
+            corruptPercent = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(arg, "--verbose") == 0) {
+            verbose = true;
+        } else if (arg[0] == '-' || !addDevice(arg)) {
+            fprintf(stderr, "pzemsim: invalid argument '%s'\n", arg);
+            usage();
+            return 2;
+        }
+    }
+    if (deviceCount == 0) {
+        usage();
+        return 2;
+    }
+    srand(seed);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pzemsim: pty");
+        return 1;
+    }
+    const char* path = ptsname(master);
+
+    // Keep the slave open: the line settings survive clients and reads never see a hangup
+    int slave = open(path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+        perror("pzemsim: pty slave");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B9600);
+    cfsetospeed(&tio, B9600);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (linkPath != NULL) {
+        unlink(linkPath);
+        if (symlink(path, linkPath) != 0) {
+            perror("pzemsim: symlink");
+            return 1;
+        }
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("%s\n", linkPath != NULL ? linkPath : path);
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        printf("  %3u  %-10s %6u baud\n", devices[i].slaveAddr, pzemModelInfo(devices[i].model)->name,
+               (unsigned)devices[i].baudrate);
+    }
+    fflush(stdout);
+
+    uint8_t frame[MODBUS_MAX_ADU_SIZE];
+    uint16_t length = 0;
+    double lastByte = 0;
+    while (running) {
+        struct pollfd pfd;
+        pfd.fd = master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        uint8_t chunk[MODBUS_MAX_ADU_SIZE];
+        ssize_t n = read(master, chunk, sizeof(chunk));
+        if (n <= 0) {
+            continue;
+        }
+
+        // A silence longer than a frame gap starts a new request
+        double t = now();
+        if (t - lastByte > SIM_FRAME_GAP_US / 1e6) {
+            length = 0;
+        }
+        lastByte = t;
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (length < sizeof(frame)) {
+                frame[length++] = chunk[i];
+            }
+            uint16_t expected = requestLength(frame, length);
+            if (expected != 0 && length >= expected) {
+                serve(master, slave, frame, expected);
+                length = 0;
+                lastByte = now();
+            }
+        }
+    }
+
+    if (linkPath != NULL) {
+        unlink(linkPath);
+    }
+    close(slave);
+    close(master);
+    return 0;
+}
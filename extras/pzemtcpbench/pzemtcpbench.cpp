@@ -0,0 +1,391 @@
+/**
+ * @file pzemtcpbench.cpp
+ * @brief Loopback load generator for ModbusTCPServer (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Serves a PZEMRegisterCache with a ModbusTCPServer on a loopback port from one
+ * thread, while a writer thread stores every device image at a fixed rate, as
+ * the poller of a gateway would. The main thread opens every client
+ * connection and drives them with poll(): each client keeps a number of read
+ * requests in flight, round-robin over the devices, and sends the next one as
+ * soon as an answer comes back.
+ *
+ * Every register of a device image holds the slave address in its high byte
+ * and the write generation in its low byte, so each answer is checked for the
+ * transaction ID, unit ID, function and byte count of its request, and for a
+ * torn image (registers from two different writes). At the end the tool
+ * prints requests per second, latency percentiles and the server counters,
+ * and PASS when every answer was right.
+ *
+ * Usage: pzemtcpbench [options]
+ *   --clients N       Client connections (default: 16)
+ *   --pipeline N      Requests in flight per client (default: 8)
+ *   --devices N       Cached devices, unit IDs 1 to N (default: 8)
+ *   --regs N          Registers per read (default: 10)
+ *   --write-hz N      Writes of every device image per second, 0 for none (default: 1000)
+ *   --port N          Server port (default: 0, any free port)
+ *   --seconds N       Duration (default: 10)
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ModbusProtocol.h"
+#include "ModbusTCPServer.h"
+#include "PZEMRegisterCache.h"
+
+/**
+ * @defgroup PzemtcpbenchConfig pzemtcpbench Configuration
+ * @{
+ */
+#define PZEMTCPBENCH_MAX_CLIENTS    MODBUS_TCP_MAX_CLIENTS  ///< Connections the server accepts
+#define PZEMTCPBENCH_MAX_PIPELINE   32       ///< Requests in flight per client
+#define PZEMTCPBENCH_MAX_SAMPLES    1000000  ///< Latencies kept for percentiles
+#define PZEMTCPBENCH_BUFFER_SIZE    4096     ///< Receive buffer per client
+/** @} */
+
+/**
+ * @brief One request in flight
+ */
+struct BenchRequest {
+    uint16_t transactionId;   ///< MBAP transaction ID
+    uint8_t unitId;           ///< Device asked
+    uint64_t sent;            ///< Time the request was sent (us)
+};
+
+/**
+ * @brief One client connection
+ */
+struct BenchClient {
+    int fd;                                         ///< Socket
+    uint16_t nextId;                                ///< Next transaction ID
+    uint8_t nextUnit;                               ///< Next device asked
+    uint8_t head;                                   ///< Oldest request in flight
+    uint8_t inFlight;                               ///< Requests in flight
+    BenchRequest pending[PZEMTCPBENCH_MAX_PIPELINE];  ///< Requests in flight, in send order
+    uint16_t rxLength;                              ///< Bytes pending in rx
+    uint8_t rx[PZEMTCPBENCH_BUFFER_SIZE];           ///< Receive buffer
+};
+
+static PZEMRegisterCache cache;                     ///< Cache served and written
+static ModbusTCPServer server(cache);               ///< Server under load
+static bool running = true;                         ///< Cleared to stop the threads
+static uint32_t devices = 8;                        ///< Cached devices
+static uint16_t regs = 10;                          ///< Registers per read
+static uint32_t writeHz = 1000;                     ///< Image writes per second
+static uint64_t writes = 0;                         ///< Image writes done
+static uint32_t* samples = NULL;                    ///< Request latencies (us)
+static uint32_t sampleCount = 0;                    ///< Latencies kept
+
+/**
+ * @brief Monotonic time in microseconds
+ */
+static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Store every device image with one generation
+ */
+static void writeImages(uint32_t generation) {
+    uint16_t data[PZEM_CACHE_INPUT_REGISTERS];
+    for (uint32_t unit = 1; unit <= devices; unit++) {
+        for (uint16_t i = 0; i < regs; i++) {
+            data[i] = (uint16_t)((unit << 8) | (generation & 0xFF));
+        }
+        cache.store(unit, MODBUS_READ_INPUT_REGISTERS, 0x0000, regs, data, (uint32_t)(nowUs() / 1000));
+    }
+}
+
+/**
+ * @brief Server thread: answer every client until stopped
+ */
+static void* serverThread(void*) {
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        server.poll(10);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writer thread: store every device image writeHz times per second
+ */
+static void* writerThread(void*) {
+    uint64_t next = nowUs();
+    uint32_t generation = 1;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        writeImages(generation++);
+        writes++;
+        next += 1000000 / writeHz;
+        struct timespec ts;
+        ts.tv_sec = next / 1000000;
+        ts.tv_nsec = (next % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Connect to the server on loopback
+ */
+static int connectServer(uint16_t port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * @brief Sort helper for latencies
+ */
+static int compareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Send read requests until the client has a full pipeline
+ * @return false if the send failed
+ */
+static bool fillPipeline(BenchClient& c, uint8_t pipeline) {
+    uint8_t frames[PZEMTCPBENCH_MAX_PIPELINE * 12];
+    size_t length = 0;
+    uint64_t now = nowUs();
+    while (c.inFlight < pipeline) {
+        BenchRequest& r = c.pending[(c.head + c.inFlight) % PZEMTCPBENCH_MAX_PIPELINE];
+        r.transactionId = c.nextId++;
+        r.unitId = c.nextUnit;
+        r.sent = now;
+        c.nextUnit = c.nextUnit % devices + 1;
+        c.inFlight++;
+
+        uint8_t* frame = frames + length;
+        frame[0] = r.transactionId >> 8;
+        frame[1] = r.transactionId & 0xFF;
+        frame[2] = 0;
+        frame[3] = 0;
+        frame[4] = 0;
+        frame[5] = 6;
+        frame[6] = r.unitId;
+        frame[7] = MODBUS_READ_INPUT_REGISTERS;
+        frame[8] = 0;
+        frame[9] = 0;
+        frame[10] = regs >> 8;
+        frame[11] = regs & 0xFF;
+        length += 12;
+    }
+    return length == 0 || send(c.fd, frames, length, MSG_NOSIGNAL) == (ssize_t)length;
+}
+
+/**
+ * @brief Check one answer against the oldest request in flight
+ * @return true if the answer is the one expected and its image is whole
+ */
+static bool checkAnswer(const BenchRequest& r, const uint8_t* frame, uint16_t length) {
+    uint16_t transactionId = (frame[0] << 8) | frame[1];
+    if (transactionId != r.transactionId || frame[6] != r.unitId || frame[7] != MODBUS_READ_INPUT_REGISTERS ||
+        length != MODBUS_TCP_MBAP_SIZE + 2 + regs * 2 || frame[8] != regs * 2) {
+        return false;
+    }
+    const uint8_t* data = frame + 9;
+    for (uint16_t i = 0; i < regs; i++) {
+        if (data[i * 2] != r.unitId || data[i * 2 + 1] != data[1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t clientCount = 16;
+    uint32_t pipeline = 8;
+    uint32_t port = 0;
+    uint32_t seconds = 10;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--clients") == 0 && hasValue) {
+            clientCount = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--pipeline") == 0 && hasValue) {
+            pipeline = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--devices") == 0 && hasValue) {
+            devices = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--regs") == 0 && hasValue) {
+            regs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--write-hz") == 0 && hasValue) {
+            writeHz = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--port") == 0 && hasValue) {
+            port = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            seconds = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: pzemtcpbench [--clients N] [--pipeline N] [--devices N] [--regs N]\n"
+                            "                    [--write-hz N] [--port N] [--seconds N]\n");
+            return 2;
+        }
+    }
+    if (clientCount == 0 || clientCount > PZEMTCPBENCH_MAX_CLIENTS || pipeline == 0 ||
+        pipeline > PZEMTCPBENCH_MAX_PIPELINE) {
+        fprintf(stderr, "pzemtcpbench: 1 to %u clients, 1 to %u requests in flight\n", PZEMTCPBENCH_MAX_CLIENTS,
+                PZEMTCPBENCH_MAX_PIPELINE);
+        return 2;
+    }
+    if (devices == 0 || devices > PZEM_CACHE_MAX_DEVICES || regs == 0 || regs > PZEM_CACHE_INPUT_REGISTERS ||
+        regs > MODBUS_MAX_READ_REGISTERS) {
+        fprintf(stderr, "pzemtcpbench: 1 to %u devices, 1 to %u registers\n", PZEM_CACHE_MAX_DEVICES,
+                PZEM_CACHE_INPUT_REGISTERS);
+        return 2;
+    }
+
+    writeImages(0);
+    if (!server.begin(port, "127.0.0.1")) {
+        fprintf(stderr, "pzemtcpbench: cannot listen on port %u: %s\n", port, strerror(errno));
+        return 1;
+    }
+    pthread_t serving, writing;
+    pthread_create(&serving, NULL, serverThread, NULL);
+    if (writeHz > 0) {
+        pthread_create(&writing, NULL, writerThread, NULL);
+    }
+
+    BenchClient* clients = new BenchClient[clientCount];
+    struct pollfd* fds = new struct pollfd[clientCount];
+    samples = new uint32_t[PZEMTCPBENCH_MAX_SAMPLES];
+    for (uint32_t i = 0; i < clientCount; i++) {
+        BenchClient& c = clients[i];
+        c.nextId = (uint16_t)(i * 1000);
+        c.nextUnit = i % devices + 1;
+        c.head = 0;
+        c.inFlight = 0;
+        c.rxLength = 0;
+        c.fd = connectServer(server.getPort());
+        if (c.fd < 0) {
+            fprintf(stderr, "pzemtcpbench: connection %u failed: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+    for (uint32_t i = 0; i < clientCount; i++) {
+        if (!fillPipeline(clients[i], pipeline)) {
+            fprintf(stderr, "pzemtcpbench: send failed: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    uint64_t start = nowUs();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint64_t answers = 0;
+    uint64_t wrong = 0;
+    uint64_t maxLatency = 0;
+    while (nowUs() < end) {
+        for (uint32_t i = 0; i < clientCount; i++) {
+            fds[i].fd = clients[i].fd;
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, clientCount, 100) <= 0) {
+            continue;
+        }
+        for (uint32_t i = 0; i < clientCount; i++) {
+            BenchClient& c = clients[i];
+            if (fds[i].revents & (POLLERR | POLLHUP)) {
+                fprintf(stderr, "pzemtcpbench: connection %u closed by the server\n", i);
+                return 1;
+            }
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = recv(c.fd, c.rx + c.rxLength, sizeof(c.rx) - c.rxLength, MSG_DONTWAIT);
+            if (n <= 0) {
+                continue;
+            }
+            c.rxLength += n;
+            uint64_t now = nowUs();
+            uint16_t offset = 0;
+            while (c.rxLength - offset >= MODBUS_TCP_MBAP_SIZE) {
+                uint16_t length = MODBUS_TCP_MBAP_SIZE - 1 + ((c.rx[offset + 4] << 8) | c.rx[offset + 5]);
+                if (c.rxLength - offset < length) {
+                    break;
+                }
+                if (c.inFlight == 0) {
+                    fprintf(stderr, "pzemtcpbench: answer without a request on connection %u\n", i);
+                    return 1;
+                }
+                // Answers come back in request order
+                const BenchRequest& r = c.pending[c.head];
+                if (!checkAnswer(r, c.rx + offset, length)) {
+                    wrong++;
+                }
+                uint64_t latency = now - r.sent;
+                maxLatency = latency > maxLatency ? latency : maxLatency;
+                if (sampleCount < PZEMTCPBENCH_MAX_SAMPLES) {
+                    samples[sampleCount++] = (uint32_t)latency;
+                }
+                answers++;
+                c.head = (c.head + 1) % PZEMTCPBENCH_MAX_PIPELINE;
+                c.inFlight--;
+                offset += length;
+            }
+            memmove(c.rx, c.rx + offset, c.rxLength - offset);
+            c.rxLength -= offset;
+            if (!fillPipeline(c, pipeline)) {
+                fprintf(stderr, "pzemtcpbench: send failed: %s\n", strerror(errno));
+                return 1;
+            }
+        }
+    }
+    double elapsed = (nowUs() - start) / 1e6;
+
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    pthread_join(serving, NULL);
+    if (writeHz > 0) {
+        pthread_join(writing, NULL);
+    }
+
+    printf("clients: %u, %u in flight each, %u devices, %u registers, %u writes/s, %.1f s\n", clientCount, pipeline,
+           devices, regs, writeHz, elapsed);
+    if (answers > 0) {
+        qsort(samples, sampleCount, sizeof(samples[0]), compareU32);
+        printf("requests: %llu (%.0f/s), latency p50 %u us, p90 %u us, p99 %u us, max %llu us\n",
+               (unsigned long long)answers, answers / elapsed, samples[sampleCount / 2],
+               samples[sampleCount * 9 / 10], samples[sampleCount * 99 / 100], (unsigned long long)maxLatency);
+    }
+    printf("server: %u requests answered, %u clients; %llu image writes, %llu wrong answers\n",
+           (unsigned)server.getRequestCount(), (unsigned)server.getClientCount(), (unsigned long long)writes,
+           (unsigned long long)wrong);
+
+    for (uint32_t i = 0; i < clientCount; i++) {
+        close(clients[i].fd);
+    }
+    server.stop();
+    delete[] clients;
+    delete[] fds;
+    delete[] samples;
+    bool pass = answers > 0 && wrong == 0;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
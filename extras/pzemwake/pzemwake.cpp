@@ -0,0 +1,439 @@
+/**
+ * @file pzemwake.cpp
+ * @brief Wake-to-sleep time of duty-cycled reads, measured in virtual time (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The program replaces the host clock: millis(), micros(), delay() and
+ * yield() run on a virtual clock, and a simulated PZEM-017 answers on a
+ * simulated UART whose bytes take their real time on the wire. Each wake
+ * is timed from the UART setup to the moment the node could go back to
+ * sleep, without any real waiting, so runs are exact and repeatable.
+ *
+ * Two wakes are compared on the same device and line:
+ *  - classic: what a sketch using the PZEM017 class does on every wake:
+ *    begin() with clearBuffer(), the settings reads (alarm thresholds and
+ *    current range) and readAll(), each waiting for the end-of-frame silence
+ *    with the 100 ms timeout. The device classes need the board serial
+ *    drivers, so their transactions are replayed on the transport with the
+ *    same frames and timings;
+ *  - cold: PZEMColdRead::read() with the state prepared on the first boot.
+ *
+ * Usage: pzemwake [options]
+ *   --wakes N           Wakes simulated (default: 1000)
+ *   --baud N            Line speed (default: 9600, 8N2 like the PZEM-003/017)
+ *   --latency MS        Device response latency (default: 15)
+ *   --jitter MS         Latency variation, uniform 0 to MS (default: 5)
+ *   --loss PCT          Responses lost (default: 1)
+ *   --init US           UART setup time of a wake (default: 500)
+ *   --period S          Sleep period, for the awake share (default: 60)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "Arduino.h"
+#include "ModbusTransport.h"
+#include "PZEMColdRead.h"
+
+/**
+ * @defgroup PzemwakeConfig pzemwake Configuration
+ * @{
+ */
+#define WAKE_YIELD_US        20    ///< Virtual time spent by one yield()
+#define WAKE_BITS_PER_BYTE   11    ///< Start, 8 data bits, 2 stop bits
+#define WAKE_SLAVE_ADDR      0x01  ///< Address of the simulated device
+/** @} */
+
+// ============================================================================
+// Virtual clock
+// ============================================================================
+
+static uint64_t nowUs = 0;  ///< Virtual time
+
+uint32_t millis() {
+    return (uint32_t)(nowUs / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)nowUs;
+}
+
+void delay(unsigned long ms) {
+    nowUs += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    nowUs += us;
+}
+
+void yield() {
+    nowUs += WAKE_YIELD_US;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    (void)pin;
+    (void)level;
+}
+
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    return LOW;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+// ============================================================================
+// Simulated UART and PZEM-017
+// ============================================================================
+
+static uint32_t hash32(uint32_t a, uint32_t b) {
+    uint32_t h = a * 0x9E3779B1UL ^ (b + 0x7F4A7C15UL + (a << 6) + (a >> 2));
+    h ^= h >> 16;
+    h *= 0x85EBCA6BUL;
+    h ^= h >> 13;
+    return h ^ (h >> 16);
+}
+
+/**
+ * @class SimLine
+ * @brief UART wired to a simulated PZEM-017, with bytes timed at the line speed
+ *
+ * A request is seen by the device once its last byte is on the wire; the
+ * response starts after the device latency and each of its bytes becomes
+ * readable when it has fully arrived.
+ */
+class SimLine : public Stream {
+public:
+    uint32_t byteUs;          ///< Time of one byte on the wire
+    uint32_t latencyUs;       ///< Device latency
+    uint32_t jitterUs;        ///< Latency variation
+    uint32_t lossPct;         ///< Responses lost
+    uint16_t input[8];        ///< Input registers
+    uint16_t holding[4];      ///< Holding registers
+    uint32_t requests;        ///< Requests received
+    uint32_t lost;            ///< Responses dropped
+
+    SimLine() : byteUs(0), latencyUs(0), jitterUs(0), lossPct(0), requests(0), lost(0), _txEndUs(0),
+                _rxLength(0) {}
+
+    size_t write(uint8_t byte) {
+        if (_txEndUs < nowUs) {
+            _txEndUs = nowUs;
+        }
+        _txEndUs += byteUs;
+        if (_rxLength < sizeof(_rx)) {
+            _rx[_rxLength++] = byte;
+        }
+        if (_rxLength == 8) {
+            answer();
+            _rxLength = 0;
+        }
+        return 1;
+    }
+
+    void flush() {
+        if (nowUs < _txEndUs) {
+            nowUs = _txEndUs;
+        }
+    }
+
+    int available() {
+        size_t ready = 0;
+        while (ready < _pending.size() && _pending[ready].atUs <= nowUs) {
+            ready++;
+        }
+        return (int)ready;
+    }
+
+    int read() {
+        if (available() == 0) {
+            return -1;
+        }
+        uint8_t byte = _pending.front().byte;
+        _pending.erase(_pending.begin());
+        return byte;
+    }
+
+    int peek() {
+        return available() ? _pending.front().byte : -1;
+    }
+
+    /**
+     * @brief Drop everything on the line (deep sleep)
+     */
+    void reset() {
+        _pending.clear();
+        _rxLength = 0;
+        _txEndUs = 0;
+    }
+
+private:
+    struct Byte {
+        uint8_t byte;
+        uint64_t atUs;
+    };
+
+    uint64_t _txEndUs;        ///< End of the request on the wire
+    uint8_t _rx[8];           ///< Request being received
+    uint8_t _rxLength;        ///< Bytes in _rx
+    std::vector<Byte> _pending;  ///< Response bytes with their arrival time
+
+    void answer() {
+        requests++;
+        if (modbusCRC16(_rx, 8) != 0 || _rx[0] != WAKE_SLAVE_ADDR) {
+            return;
+        }
+        if (hash32(requests, 0x105) % 100 < lossPct) {
+            lost++;
+            return;
+        }
+        uint16_t start = (_rx[2] << 8) | _rx[3];
+        uint16_t count = (_rx[4] << 8) | _rx[5];
+        const uint16_t* regs = _rx[1] == MODBUS_READ_INPUT_REGISTERS ? input : holding;
+        uint16_t size = _rx[1] == MODBUS_READ_INPUT_REGISTERS ? 8 : 4;
+        uint8_t frame[64];
+        uint16_t length = 0;
+        frame[length++] = _rx[0];
+        if (start + count > size || count == 0) {
+            frame[length++] = _rx[1] | 0x80;
+            frame[length++] = 0x02;
+        } else {
+            frame[length++] = _rx[1];
+            frame[length++] = count * 2;
+            for (uint16_t i = 0; i < count; i++) {
+                frame[length++] = regs[start + i] >> 8;
+                frame[length++] = regs[start + i] & 0xFF;
+            }
+        }
+        uint16_t crc = modbusCRC16(frame, length);
+        frame[length++] = crc & 0xFF;
+        frame[length++] = crc >> 8;
+
+        uint64_t at = _txEndUs + latencyUs + (jitterUs ? hash32(requests, 0x717) % (jitterUs + 1) : 0);
+        for (uint16_t i = 0; i < length; i++) {
+            at += byteUs;
+            Byte entry = { frame[i], at };
+            _pending.push_back(entry);
+        }
+    }
+};
+
+// ============================================================================
+// Wakes
+// ============================================================================
+
+/**
+ * @brief Options of the run
+ */
+struct WakeOptions {
+    uint32_t wakes;           ///< Wakes simulated
+    uint32_t baud;            ///< Line speed
+    uint32_t latencyMs;       ///< Device latency
+    uint32_t jitterMs;        ///< Latency variation
+    uint32_t lossPct;         ///< Responses lost
+    uint32_t initUs;          ///< UART setup time
+    uint32_t periodS;         ///< Sleep period
+};
+
+/**
+ * @brief Results of one kind of wake
+ */
+struct WakeResults {
+    std::vector<uint32_t> awakeUs;  ///< Wake-to-sleep time of every wake
+    uint32_t failed;          ///< Wakes without a reading
+    uint32_t wrong;           ///< Readings that differ from the device
+};
+
+/**
+ * @brief Read registers like the RS485 device methods do (100 ms timeout, silence)
+ */
+static bool classicRead(ModbusRTUTransport* transport, uint8_t function, uint16_t start, uint16_t count,
+                        uint16_t* data) {
+    uint8_t request[8] = { WAKE_SLAVE_ADDR, function, (uint8_t)(start >> 8), (uint8_t)start, 0, (uint8_t)count };
+    uint16_t crc = modbusCRC16(request, 6);
+    request[6] = crc & 0xFF;
+    request[7] = crc >> 8;
+    uint8_t response[256];
+    ModbusTransaction txn;
+    txn.prepare(request, 8, response, sizeof(response), 5 + 2 * count, 100);
+    if (!transport->execute(&txn)) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        data[i] = (response[3 + 2 * i] << 8) | response[4 + 2 * i];
+    }
+    return true;
+}
+
+/**
+ * @brief Change the device registers between two wakes
+ */
+static void evolve(SimLine* line, uint32_t wake) {
+    line->input[0] = 1280 + hash32(wake, 1) % 120;        // 12.80 V..
+    line->input[1] = 500 + hash32(wake, 2) % 900;         // 5.00 A..
+    uint32_t power = (uint32_t)line->input[0] * line->input[1] / 1000;
+    line->input[2] = power & 0xFFFF;
+    line->input[3] = power >> 16;
+    uint32_t energy = 1000 + wake;
+    line->input[4] = energy & 0xFFFF;
+    line->input[5] = energy >> 16;
+    line->input[6] = 0;
+    line->input[7] = 0;
+}
+
+static void runWakes(const WakeOptions& opts, bool cold, WakeResults* results) {
+    SimLine line;
+    line.byteUs = (uint32_t)(1000000ULL * WAKE_BITS_PER_BYTE / opts.baud);
+    line.latencyUs = opts.latencyMs * 1000;
+    line.jitterUs = opts.jitterMs * 1000;
+    line.lossPct = opts.lossPct;
+    line.holding[0] = 30000;   // High voltage alarm 300.00 V
+    line.holding[1] = 700;     // Low voltage alarm 7.00 V
+    line.holding[2] = WAKE_SLAVE_ADDR;
+    line.holding[3] = 0x0002;  // 200 A shunt
+
+    ModbusRTUTransport transport(&line);
+    PZEMColdState state;       // RTC memory
+    memset(&state, 0xA5, sizeof(state));
+    PZEMColdRead* reader = NULL;
+    if (cold) {
+        reader = new PZEMColdRead(&transport, &state);
+        evolve(&line, 0);
+        while (!reader->prepare(PZEM_MODEL_017, WAKE_SLAVE_ADDR, opts.baud)) {
+            line.reset();
+        }
+    }
+
+    results->failed = 0;
+    results->wrong = 0;
+    for (uint32_t wake = 1; wake <= opts.wakes; wake++) {
+        evolve(&line, wake);
+        line.reset();
+        nowUs += (uint64_t)opts.periodS * 1000000ULL;  // Deep sleep
+        uint64_t wakeUs = nowUs;
+        nowUs += opts.initUs;                            // UART setup
+
+        uint16_t regs[8];
+        bool ok;
+        if (cold) {
+            PZEMSnapshot snapshot;
+            ok = reader->read(&snapshot);
+            uint16_t range = 0;
+            ok = ok && reader->getSetting(0x0003, &range) && range == line.holding[3];
+            memcpy(regs, snapshot.regs, sizeof(regs));
+        } else {
+            // begin() and clearBuffer(), then the settings and the measurements
+            while (line.available()) {
+                line.read();
+            }
+            uint16_t setting;
+            ok = classicRead(&transport, MODBUS_READ_HOLDING_REGISTERS, 0x0000, 1, &setting);
+            ok = classicRead(&transport, MODBUS_READ_HOLDING_REGISTERS, 0x0001, 1, &setting) && ok;
+            ok = classicRead(&transport, MODBUS_READ_HOLDING_REGISTERS, 0x0003, 1, &setting) && ok;
+            ok = classicRead(&transport, MODBUS_READ_INPUT_REGISTERS, 0x0000, 6, regs) && ok;
+        }
+        results->awakeUs.push_back((uint32_t)(nowUs - wakeUs));
+        if (!ok) {
+            results->failed++;
+        } else if (memcmp(regs, line.input, 6 * sizeof(uint16_t)) != 0) {
+            results->wrong++;
+        }
+    }
+    delete reader;
+}
+
+static void printResults(const char* name, WakeResults* results, const WakeOptions& opts) {
+    std::vector<uint32_t> sorted = results->awakeUs;
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total = 0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        total += sorted[i];
+    }
+    double mean = (double)total / sorted.size();
+    printf("%-8s %8.2f %8.2f %8.2f %8.2f %7u %7u %9.3f%%\n", name, mean / 1000.0,
+           sorted[sorted.size() / 2] / 1000.0, sorted[sorted.size() * 99 / 100] / 1000.0,
+           sorted.back() / 1000.0, results->failed, results->wrong, mean / (opts.periodS * 1e6) * 100.0);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: pzemwake [options]\n"
+        "  --wakes N           Wakes simulated (default: 1000)\n"
+        "  --baud N            Line speed (default: 9600)\n"
+        "  --latency MS        Device response latency (default: 15)\n"
+        "  --jitter MS         Latency variation (default: 5)\n"
+        "  --loss PCT          Responses lost (default: 1)\n"
+        "  --init US           UART setup time of a wake (default: 500)\n"
+        "  --period S          Sleep period (default: 60)\n");
+}
+
+int main(int argc, char** argv) {
+    WakeOptions opts;
+    opts.wakes = 1000;
+    opts.baud = 9600;
+    opts.latencyMs = 15;
+    opts.jitterMs = 5;
+    opts.lossPct = 1;
+    opts.initUs = 500;
+    opts.periodS = 60;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        uint32_t value = strtoul(argv[i + 1], NULL, 10);
+        if (strcmp(argv[i], "--wakes") == 0) {
+            opts.wakes = value;
+        } else if (strcmp(argv[i], "--baud") == 0) {
+            opts.baud = value;
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            opts.latencyMs = value;
+        } else if (strcmp(argv[i], "--jitter") == 0) {
+            opts.jitterMs = value;
+        } else if (strcmp(argv[i], "--loss") == 0) {
+            opts.lossPct = value;
+        } else if (strcmp(argv[i], "--init") == 0) {
+            opts.initUs = value;
+        } else if (strcmp(argv[i], "--period") == 0) {
+            opts.periodS = value;
+        } else {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    if (opts.wakes == 0 || opts.baud == 0 || opts.periodS == 0 || opts.lossPct >= 100) {
+        usage();
+        return 2;
+    }
+
+    WakeResults classic;
+    WakeResults cold;
+    runWakes(opts, false, &classic);
+    runWakes(opts, true, &cold);
+
+    printf("PZEM-017 at %u baud, latency %u+%u ms, %u%% responses lost, %u wakes every %u s, wake to sleep:\n", opts.baud,
+           opts.latencyMs, opts.jitterMs, opts.lossPct, opts.wakes, opts.periodS);
+    printf("%-8s %8s %8s %8s %8s %7s %7s %10s\n", "ms", "mean", "p50", "p99", "max", "failed", "wrong", "awake");
+    printResults("classic", &classic, opts);
+    printResults("cold", &cold, opts);
+    bool pass = cold.wrong == 0 && classic.wrong == 0;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file HostTest.h
+ * @brief Checks and virtual clock of the host tests (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Each test is one program that links TestClock.cpp instead of
+ * HostArduino.cpp: millis(), micros(), delay() and yield() run on a virtual
+ * clock that only moves when the test or the code under test waits, and
+ * digitalWrite() records every pin edge with its time. A test counts its
+ * checks with TEST_CHECK() and ends with testSummary(), which prints PASS or
+ * FAIL and gives the exit status.
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <vector>
+#include "Arduino.h"
+
+/**
+ * @defgroup HostTestConfig Host Test Configuration
+ * @{
+ */
+#define TEST_YIELD_US  10  ///< Virtual time spent by one yield()
+/** @} */
+
+/**
+ * @struct TestPinEdge
+ * @brief One digitalWrite() on the virtual clock
+ */
+struct TestPinEdge {
+    uint8_t pin;              ///< Pin number
+    uint8_t level;            ///< HIGH or LOW
+    uint64_t atUs;            ///< Virtual time of the write
+};
+
+/**
+ * @brief Hook called on every yield(), e.g. to move a simulated line
+ * @param context User context given to testSetYieldHook()
+ */
+typedef void (*TestYieldHook)(void* context);
+
+extern uint64_t testNowUs;                    ///< Virtual time in microseconds
+extern std::vector<TestPinEdge> testPinEdges;  ///< Every digitalWrite() since the last clear()
+
+/**
+ * @brief Move the virtual clock forward
+ * @param us Microseconds
+ */
+void testAdvance(uint64_t us);
+
+/**
+ * @brief Call a hook on every yield() and delay()
+ * @param hook Hook, or NULL to disable
+ * @param context User context passed to the hook
+ */
+void testSetYieldHook(TestYieldHook hook, void* context);
+
+/**
+ * @brief Count a check and report it when it fails
+ * @param ok Result of the check
+ * @param expression Text of the check
+ * @param file Source file
+ * @param line Source line
+ * @return ok
+ */
+bool testCheck(bool ok, const char* expression, const char* file, int line);
+
+/**
+ * @brief Print the check counts and the verdict
+ * @param name Test name
+ * @return Exit status: 0 if every check passed, 1 otherwise
+ */
+int testSummary(const char* name);
+
+#define TEST_CHECK(expression) testCheck((expression), #expression, __FILE__, __LINE__)
+
+#endif // HOST_TEST_H
@@ -0,0 +1,166 @@
+/**
+ * @file MockBus.h
+ * @brief Simulated RS485 line with PZEM meters for the host tests (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A UART on the virtual clock of HostTest.h: every byte written takes its
+ * time on the wire and flush() returns after the last stop bit, and the
+ * meters on the line answer reads of their input and holding registers after
+ * a fixed latency, register r of device a holding a * 256 + r plus the
+ * offset of the meter (0 unless set). Every look at the UART costs a little
+ * CPU time, so loops polling it see the clock move.
+ */
+
+#ifndef MOCK_BUS_H
+#define MOCK_BUS_H
+
+#include <string.h>
+
+#include "HostTest.h"
+#include "ModbusProtocol.h"
+
+/**
+ * @defgroup MockBusConfig Simulated Line Configuration
+ * @{
+ */
+#define LINE_BAUD          9600  ///< Line speed
+#define LINE_BITS          10    ///< Start, 8 data bits, 1 stop bit
+#define LINE_LATENCY_US    5000  ///< Meter response latency after the last stop bit of the request
+#define LINE_POLL_US       5     ///< CPU time of one available() call
+/** @} */
+
+/**
+ * @class MockBus
+ * @brief UART whose bytes take their time on the wire, with meters answering reads
+ */
+class MockBus : public Stream {
+public:
+    uint32_t byteUs;          ///< Time of one character on the wire
+    uint32_t requests;        ///< Requests seen on the line
+    uint32_t registers;       ///< Registers asked for by the requests
+
+    MockBus() : byteUs(1000000UL * LINE_BITS / LINE_BAUD), requests(0), registers(0), _txEndUs(0), _requestLength(0),
+                _rxStartUs(0), _responseLength(0), _responseRead(0) {
+        memset(_present, 0, sizeof(_present));
+        memset(_asked, 0, sizeof(_asked));
+        memset(_offset, 0, sizeof(_offset));
+    }
+
+    /**
+     * @brief Connect or disconnect a meter
+     */
+    void setPresent(uint8_t slaveAddr, bool present) {
+        _present[slaveAddr] = present;
+    }
+
+    /**
+     * @brief Shift every register of a meter, as a change of the measurement
+     */
+    void setOffset(uint8_t slaveAddr, uint16_t offset) {
+        _offset[slaveAddr] = offset;
+    }
+
+    /**
+     * @brief Requests addressed to a meter
+     */
+    uint32_t asked(uint8_t slaveAddr) const {
+        return _asked[slaveAddr];
+    }
+
+    size_t write(uint8_t byte) {
+        if (_txEndUs <= testNowUs) {
+            _txEndUs = testNowUs;
+            _requestLength = 0;
+        }
+        _txEndUs += byteUs;
+        if (_requestLength < sizeof(_request)) {
+            _request[_requestLength++] = byte;
+        }
+        if (_requestLength == 8) {
+            answer();
+        }
+        return 1;
+    }
+
+    void flush() {
+        // AVR and ESP32: returns after the last stop bit
+        if (testNowUs < _txEndUs) {
+            testNowUs = _txEndUs;
+        }
+    }
+
+    int available() {
+        // Every look at the UART costs CPU time, so poll() loops see the clock move
+        testNowUs += LINE_POLL_US;
+        uint32_t arrived = 0;
+        while (_responseRead + arrived < _responseLength &&
+               _rxStartUs + (uint64_t)(_responseRead + arrived + 1) * byteUs <= testNowUs) {
+            arrived++;
+        }
+        return arrived;
+    }
+
+    int read() {
+        if (available() == 0) {
+            return -1;
+        }
+        return _response[_responseRead++];
+    }
+
+    int peek() {
+        return available() > 0 ? _response[_responseRead] : -1;
+    }
+
+private:
+    bool _present[248];       ///< Meters on the line, by address
+    uint32_t _asked[248];     ///< Requests per address
+    uint16_t _offset[248];    ///< Register shift per address
+    uint64_t _txEndUs;        ///< Last stop bit of the request being written
+    uint8_t _request[8];      ///< Request being written
+    uint8_t _requestLength;   ///< Bytes of the request
+    uint64_t _rxStartUs;      ///< First start bit of the response
+    uint8_t _response[5 + 2 * 125];  ///< Response of the meter
+    uint16_t _responseLength; ///< Bytes of the response
+    uint16_t _responseRead;   ///< Response bytes read
+
+    /**
+     * @brief Answer a read with the register numbers, if the meter is there
+     */
+    void answer() {
+        requests++;
+        uint8_t slaveAddr = _request[0];
+        _responseLength = 0;
+        _responseRead = 0;
+        if (slaveAddr == 0 || slaveAddr > 247 || modbusCRC16(_request, 8) != 0) {
+            return;
+        }
+        _asked[slaveAddr]++;
+        uint16_t start = (_request[2] << 8) | _request[3];
+        uint16_t count = (_request[4] << 8) | _request[5];
+        registers += count;
+        if (!_present[slaveAddr] ||
+            (_request[1] != MODBUS_READ_INPUT_REGISTERS && _request[1] != MODBUS_READ_HOLDING_REGISTERS)) {
+            return;
+        }
+        if (count == 0 || count > 125) {
+            return;
+        }
+        _response[0] = slaveAddr;
+        _response[1] = _request[1];
+        _response[2] = count * 2;
+        for (uint16_t i = 0; i < count; i++) {
+            uint16_t value = slaveAddr * 256 + start + i + _offset[slaveAddr];
+            _response[3 + i * 2] = value >> 8;
+            _response[4 + i * 2] = value & 0xFF;
+        }
+        _responseLength = modbusReadResponseLength(count);
+        uint16_t crc = modbusCRC16(_response, _responseLength - 2);
+        _response[_responseLength - 2] = crc & 0xFF;
+        _response[_responseLength - 1] = crc >> 8;
+        _rxStartUs = _txEndUs + LINE_LATENCY_US;
+    }
+};
+
+#endif // MOCK_BUS_H
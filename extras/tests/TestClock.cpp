@@ -0,0 +1,141 @@
+/**
+ * @file TestClock.cpp
+ * @brief Virtual clock and pin recorder of the host tests (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "HostTest.h"
+
+uint64_t testNowUs = 0;
+std::vector<TestPinEdge> testPinEdges;
+
+static TestYieldHook yieldHook = NULL;     ///< Hook called on every wait
+static void* yieldHookContext = NULL;      ///< Hook context
+static uint32_t checks = 0;                ///< Checks run
+static uint32_t failures = 0;              ///< Checks failed
+
+/**
+ * @brief Move the virtual clock forward
+ */
+void testAdvance(uint64_t us) {
+    testNowUs += us;
+}
+
+/**
+ * @brief Call a hook on every yield() and delay()
+ */
+void testSetYieldHook(TestYieldHook hook, void* context) {
+    yieldHook = hook;
+    yieldHookContext = context;
+}
+
+/**
+ * @brief Count a check and report it when it fails
+ */
+bool testCheck(bool ok, const char* expression, const char* file, int line) {
+    checks++;
+    if (!ok) {
+        failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    }
+    return ok;
+}
+
+/**
+ * @brief Print the check counts and the verdict
+ */
+int testSummary(const char* name) {
+    printf("%s: %u checks, %u failed\n%s\n", name, (unsigned)checks, (unsigned)failures,
+           failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Milliseconds of virtual time
+ */
+uint32_t millis() {
+    return (uint32_t)(testNowUs / 1000);
+}
+
+/**
+ * @brief Microseconds of virtual time
+ */
+uint32_t micros() {
+    return (uint32_t)testNowUs;
+}
+
+/**
+ * @brief Move the virtual clock by a number of milliseconds
+ */
+void delay(unsigned long ms) {
+    testNowUs += (uint64_t)ms * 1000;
+    if (yieldHook != NULL) {
+        yieldHook(yieldHookContext);
+    }
+}
+
+/**
+ * @brief Move the virtual clock by a number of microseconds
+ */
+void delayMicroseconds(unsigned int us) {
+    testNowUs += us;
+    if (yieldHook != NULL) {
+        yieldHook(yieldHookContext);
+    }
+}
+
+/**
+ * @brief Move the virtual clock by one yield
+ */
+void yield() {
+    testNowUs += TEST_YIELD_US;
+    if (yieldHook != NULL) {
+        yieldHook(yieldHookContext);
+    }
+}
+
+/**
+ * @brief Set a pin mode (no effect)
+ */
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+/**
+ * @brief Record a pin level with its time
+ */
+void digitalWrite(uint8_t pin, uint8_t level) {
+    TestPinEdge edge;
+    edge.pin = pin;
+    edge.level = level;
+    edge.atUs = testNowUs;
+    testPinEdges.push_back(edge);
+}
+
+/**
+ * @brief Read the last level written to a pin
+ */
+int digitalRead(uint8_t pin) {
+    for (size_t i = testPinEdges.size(); i > 0; i--) {
+        if (testPinEdges[i - 1].pin == pin) {
+            return testPinEdges[i - 1].level;
+        }
+    }
+    return LOW;
+}
+
+/**
+ * @brief Write a buffer one byte at a time
+ */
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size--) {
+        if (write(*buffer++) == 0) {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
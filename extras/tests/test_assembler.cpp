@@ -0,0 +1,395 @@
+/**
+ * @file test_assembler.cpp
+ * @brief Replay of timestamped byte streams through the frame assembler (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Byte streams are laid out the way a UART at 9600 baud 8N2 delivers them,
+ * one byte every 1146 us, with the gaps of each case, then replayed through
+ * feed() and tick() as the RX interrupt would. The cases:
+ *  - silence: frames of unknown layout split on a gap longer than t3.5, and
+ *    only then, by feed() and by tick();
+ *  - length: a read response and an exception published on their last byte,
+ *    without waiting for the silence;
+ *  - CRC: a corrupted response waits for the silence and is published with
+ *    crcValid false;
+ *  - overrun: frames arriving while every slot is full are dropped and
+ *    counted, the queued ones are kept;
+ *  - too long: a frame over MODBUS_MAX_ADU_SIZE is skipped until the silence;
+ *  - wrap: the ring wraps many times around, with timestamps wrapping at 2^32,
+ *    consumer one frame behind, then with the producer and the consumer in two
+ *    threads, every frame delivered whole and in order or counted as dropped.
+ *
+ * Usage: test_assembler
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "HostTest.h"
+#include "ModbusFrameAssembler.h"
+
+/**
+ * @defgroup TestAssemblerConfig test_assembler Configuration
+ * @{
+ */
+#define REPLAY_BYTE_US     1146    ///< One character at 9600 baud 8N2
+#define REPLAY_THREADED    200000  ///< Frames of the threaded run
+#define REPLAY_PACED       150000  ///< Frames of the threaded run sent only when a slot is free
+/** @} */
+
+/**
+ * @struct ReplayByte
+ * @brief One received byte and its arrival time
+ */
+struct ReplayByte {
+    uint8_t byte;             ///< Byte
+    uint32_t atUs;            ///< Arrival time
+};
+
+/**
+ * @class Replay
+ * @brief Byte stream laid out frame by frame
+ */
+class Replay {
+public:
+    std::vector<ReplayByte> bytes;  ///< Stream
+    uint32_t nowUs;                 ///< Arrival time of the next byte
+
+    Replay(uint32_t startUs = 1000) : nowUs(startUs) {}
+
+    /**
+     * @brief Append a frame, one byte per character time
+     * @param data Frame bytes
+     * @param length Frame length
+     * @param gapUs Silence before the frame
+     */
+    void frame(const uint8_t* data, uint16_t length, uint32_t gapUs) {
+        nowUs += gapUs;
+        for (uint16_t i = 0; i < length; i++) {
+            ReplayByte b = {data[i], nowUs};
+            bytes.push_back(b);
+            nowUs += REPLAY_BYTE_US;
+        }
+        nowUs -= REPLAY_BYTE_US;
+    }
+
+    /**
+     * @brief Feed the stream, with a tick() before each byte like an RX-timeout interrupt
+     * @param assembler Assembler
+     * @param endUs Time of a last tick() after the stream (0 for none)
+     */
+    void play(ModbusFrameAssembler& assembler, uint32_t endUs) const {
+        for (size_t i = 0; i < bytes.size(); i++) {
+            assembler.tick(bytes[i].atUs);
+            assembler.feed(bytes[i].byte, bytes[i].atUs);
+        }
+        if (endUs != 0) {
+            assembler.tick(endUs);
+        }
+    }
+};
+
+/**
+ * @brief Build a read response of the register numbers plus a seed
+ * @return Frame length
+ */
+static uint16_t readResponse(uint8_t* frame, uint8_t slaveAddr, uint8_t count, uint8_t seed) {
+    frame[0] = slaveAddr;
+    frame[1] = MODBUS_READ_INPUT_REGISTERS;
+    frame[2] = count * 2;
+    for (uint8_t i = 0; i < count * 2; i++) {
+        frame[3 + i] = i + seed;
+    }
+    uint16_t length = modbusReadResponseLength(count);
+    uint16_t crc = modbusCRC16(frame, length - 2);
+    frame[length - 2] = crc & 0xFF;
+    frame[length - 1] = crc >> 8;
+    return length;
+}
+
+/**
+ * @brief Build the 4-byte reset energy reply, whose layout the assembler does not know
+ * @return Frame length
+ */
+static uint16_t resetReply(uint8_t* frame, uint8_t slaveAddr) {
+    frame[0] = slaveAddr;
+    frame[1] = 0x42;
+    uint16_t crc = modbusCRC16(frame, 2);
+    frame[2] = crc & 0xFF;
+    frame[3] = crc >> 8;
+    return 4;
+}
+
+/**
+ * @brief Check the oldest frame against the expected bytes and release it
+ */
+static bool popFrame(ModbusFrameAssembler& assembler, const uint8_t* data, uint16_t length, bool crcValid) {
+    const ModbusFrame* frame = assembler.front();
+    bool ok = frame != NULL && frame->length == length && frame->crcValid == crcValid &&
+              memcmp(frame->data, data, length) == 0;
+    assembler.pop();
+    return ok;
+}
+
+static void testSilence() {
+    ModbusFrameAssembler assembler;
+    uint32_t silence = ModbusFrameAssembler::silenceForBaudrate(9600);
+    TEST_CHECK(silence == 4010);
+    uint8_t a[4], b[4];
+    resetReply(a, 0x01);
+    resetReply(b, 0x02);
+
+    // A gap of exactly t3.5 does not end the frame: both replies come out as one
+    Replay joined;
+    joined.frame(a, 4, 0);
+    joined.frame(b, 4, silence);
+    joined.play(assembler, 0);
+    TEST_CHECK(assembler.front() == NULL);
+    assembler.tick(joined.nowUs + silence);
+    TEST_CHECK(assembler.front() == NULL);
+    assembler.tick(joined.nowUs + silence + 1);
+    uint8_t both[8];
+    memcpy(both, a, 4);
+    memcpy(both + 4, b, 4);
+    TEST_CHECK(popFrame(assembler, both, 8, false));
+
+    // One microsecond more and the next byte closes the first frame; tick() closes the second
+    Replay split(joined.nowUs + 10000);
+    split.frame(a, 4, 0);
+    split.frame(b, 4, silence + 1);
+    split.play(assembler, 0);
+    TEST_CHECK(popFrame(assembler, a, 4, true));
+    TEST_CHECK(assembler.front() == NULL);
+    assembler.tick(split.nowUs + silence + 1);
+    TEST_CHECK(popFrame(assembler, b, 4, true));
+
+    // At 115200 baud the silence is the fixed 1750 us
+    assembler.setBaudrate(115200);
+    Replay fast(split.nowUs + 10000);
+    fast.frame(a, 4, 0);
+    fast.frame(b, 4, 1751);
+    fast.play(assembler, fast.nowUs + 1751);
+    TEST_CHECK(popFrame(assembler, a, 4, true));
+    TEST_CHECK(popFrame(assembler, b, 4, true));
+    TEST_CHECK(assembler.getCRCErrors() == 1);
+}
+
+static void testLength() {
+    ModbusFrameAssembler assembler;
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    uint16_t length = readResponse(response, 0x01, 10, 0);
+
+    Replay replay;
+    replay.frame(response, length, 0);
+    replay.play(assembler, 0);
+    const ModbusFrame* frame = assembler.front();
+    TEST_CHECK(frame != NULL && frame->startUs == 1000 && frame->endUs == replay.nowUs);
+    TEST_CHECK(popFrame(assembler, response, length, true));
+
+    // Exception, then a write echo, back to back with no silence between them
+    uint8_t exception[5] = {0x01, 0x84, 0x02};
+    uint16_t crc = modbusCRC16(exception, 3);
+    exception[3] = crc & 0xFF;
+    exception[4] = crc >> 8;
+    uint8_t echo[8] = {0x01, MODBUS_WRITE_SINGLE_REGISTER, 0x00, 0x01, 0x03, 0xE8};
+    crc = modbusCRC16(echo, 6);
+    echo[6] = crc & 0xFF;
+    echo[7] = crc >> 8;
+    Replay pair(replay.nowUs + 10000);
+    pair.frame(exception, 5, 0);
+    pair.frame(echo, 8, REPLAY_BYTE_US);
+    pair.play(assembler, 0);
+    TEST_CHECK(popFrame(assembler, exception, 5, true));
+    TEST_CHECK(popFrame(assembler, echo, 8, true));
+    TEST_CHECK(assembler.front() == NULL);
+    TEST_CHECK(assembler.getCRCErrors() == 0);
+}
+
+static void testCRC() {
+    ModbusFrameAssembler assembler;
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    uint16_t length = readResponse(response, 0x01, 4, 7);
+    response[5] ^= 0x10;
+
+    Replay replay;
+    replay.frame(response, length, 0);
+    replay.play(assembler, 0);
+    TEST_CHECK(assembler.front() == NULL);
+    assembler.tick(replay.nowUs + ModbusFrameAssembler::silenceForBaudrate(9600) + 1);
+    TEST_CHECK(popFrame(assembler, response, length, false));
+    TEST_CHECK(assembler.getCRCErrors() == 1);
+
+    // A good frame right after the silence is not affected
+    uint16_t good = readResponse(response, 0x01, 4, 7);
+    Replay next(replay.nowUs + 5000);
+    next.frame(response, good, 0);
+    next.play(assembler, 0);
+    TEST_CHECK(popFrame(assembler, response, good, true));
+    TEST_CHECK(assembler.getCRCErrors() == 1);
+}
+
+static void testOverrun() {
+    ModbusFrameAssembler assembler;
+    uint8_t frames[MODBUS_FRAME_SLOTS + 1][MODBUS_MAX_ADU_SIZE];
+    uint16_t lengths[MODBUS_FRAME_SLOTS + 1];
+    Replay replay;
+    for (uint8_t i = 0; i < MODBUS_FRAME_SLOTS + 1; i++) {
+        lengths[i] = readResponse(frames[i], i + 1, 2, i);
+        replay.frame(frames[i], lengths[i], 5000);
+    }
+    replay.play(assembler, 0);
+
+    // One slot is always the frame being assembled: the last two are dropped
+    TEST_CHECK(assembler.getOverruns() == 2);
+    for (uint8_t i = 0; i < MODBUS_FRAME_SLOTS - 1; i++) {
+        TEST_CHECK(popFrame(assembler, frames[i], lengths[i], true));
+    }
+    TEST_CHECK(assembler.front() == NULL);
+
+    // Room again: the next frame goes through
+    Replay next(replay.nowUs + 5000);
+    next.frame(frames[0], lengths[0], 0);
+    next.play(assembler, 0);
+    TEST_CHECK(popFrame(assembler, frames[0], lengths[0], true));
+}
+
+static void testTooLong() {
+    ModbusFrameAssembler assembler;
+    uint8_t noise[MODBUS_MAX_ADU_SIZE + 40];
+    for (uint16_t i = 0; i < sizeof(noise); i++) {
+        noise[i] = 0x42;
+    }
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    uint16_t length = readResponse(response, 0x01, 2, 0);
+
+    Replay replay;
+    replay.frame(noise, sizeof(noise), 0);
+    replay.frame(response, length, 5000);
+    replay.play(assembler, 0);
+    TEST_CHECK(popFrame(assembler, response, length, true));
+    TEST_CHECK(assembler.front() == NULL);
+    TEST_CHECK(assembler.getCRCErrors() == 0);
+}
+
+static void testWrap() {
+    ModbusFrameAssembler assembler;
+    uint8_t frames[2][MODBUS_MAX_ADU_SIZE];
+    uint16_t lengths[2];
+
+    // Timestamps start 10 s before they wrap at 2^32 us
+    uint32_t now = 0xFFFFFFFFUL - 10000000UL;
+    uint32_t delivered = 0;
+    bool inOrder = true;
+    for (uint32_t n = 0; n < 5000; n++) {
+        uint8_t slot = n % 2;
+        lengths[slot] = readResponse(frames[slot], (n % 247) + 1, (n % 20) + 1, (uint8_t)n);
+        Replay replay(now);
+        replay.frame(frames[slot], lengths[slot], 5000);
+        replay.play(assembler, 0);
+        now = replay.nowUs;
+        // The consumer is one frame behind
+        if (n > 0) {
+            inOrder = popFrame(assembler, frames[!slot], lengths[!slot], true) && inOrder;
+            delivered++;
+        }
+    }
+    TEST_CHECK(inOrder);
+    TEST_CHECK(popFrame(assembler, frames[1], lengths[1], true));
+    TEST_CHECK(delivered == 4999);
+    TEST_CHECK(assembler.getOverruns() == 0);
+    TEST_CHECK(now < 0x80000000UL);
+}
+
+/**
+ * @brief Producer and consumer in two threads
+ *
+ * Frames carry their sequence number, so the consumer can tell a dropped
+ * frame from a torn one: every frame it sees must be whole and newer than the
+ * previous one, and the frames it misses must be the overruns. The producer
+ * first waits for a free slot before each frame, so the ring wraps without a
+ * drop, then runs free and outpaces the consumer.
+ */
+static void testThreads() {
+    static ModbusFrameAssembler assembler;
+    volatile bool done = false;
+    volatile uint32_t consumed = 0;
+    uint32_t pacedOverruns = 0;
+
+    std::thread producer([&done, &consumed, &pacedOverruns]() {
+        uint8_t frame[MODBUS_MAX_ADU_SIZE];
+        uint32_t now = 0;
+        for (uint32_t n = 0; n < REPLAY_THREADED; n++) {
+            while (n < REPLAY_PACED && n - __atomic_load_n(&consumed, __ATOMIC_ACQUIRE) >= MODBUS_FRAME_SLOTS - 1) {
+                std::this_thread::yield();
+            }
+            if (n == REPLAY_PACED) {
+                pacedOverruns = assembler.getOverruns();
+            }
+            frame[0] = 0x01;
+            frame[1] = MODBUS_READ_INPUT_REGISTERS;
+            frame[2] = 8;
+            memcpy(&frame[3], &n, 4);
+            memcpy(&frame[7], &n, 4);
+            uint16_t crc = modbusCRC16(frame, 11);
+            frame[11] = crc & 0xFF;
+            frame[12] = crc >> 8;
+            for (uint8_t i = 0; i < 13; i++) {
+                assembler.feed(frame[i], now);
+                now += 10;
+            }
+            now += 5000;
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    });
+
+    uint32_t received = 0, torn = 0, previous = 0;
+    bool first = true, ordered = true;
+    for (;;) {
+        bool finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+        const ModbusFrame* frame = assembler.front();
+        if (frame == NULL) {
+            if (finished) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        uint32_t a, b;
+        memcpy(&a, &frame->data[3], 4);
+        memcpy(&b, &frame->data[7], 4);
+        if (frame->length != 13 || !frame->crcValid || a != b) {
+            torn++;
+        } else {
+            ordered = ordered && (first || a > previous);
+            previous = a;
+            first = false;
+        }
+        received++;
+        assembler.pop();
+        __atomic_store_n(&consumed, received, __ATOMIC_RELEASE);
+    }
+    producer.join();
+
+    printf("threads: %u frames, %u received, %u dropped\n", (unsigned)REPLAY_THREADED, (unsigned)received,
+           (unsigned)assembler.getOverruns());
+    TEST_CHECK(pacedOverruns == 0);
+    TEST_CHECK(received >= REPLAY_PACED);
+    TEST_CHECK(torn == 0);
+    TEST_CHECK(ordered);
+    TEST_CHECK(received + assembler.getOverruns() == REPLAY_THREADED);
+}
+
+int main() {
+    testSilence();
+    testLength();
+    testCRC();
+    testOverrun();
+    testTooLong();
+    testWrap();
+    testThreads();
+    return testSummary("test_assembler");
+}
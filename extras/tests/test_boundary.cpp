@@ -0,0 +1,162 @@
+/**
+ * @file test_boundary.cpp
+ * @brief Billing boundary captures of meters on a simulated RS485 line (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A PZEMBoundaryCapture over a sweeping PZEMBus, the real ModbusRTUTransport
+ * and a simulated line (MockBus.h), on the virtual clock:
+ *  - planning: the boundary is the next multiple of the period in Unix time
+ *    that leaves room for the drain;
+ *  - readings: every subscribed meter reports its energy counter, the dead
+ *    one last and invalid;
+ *  - centring: once the read time is learnt from the first burst, the
+ *    readings straddle the boundary with a skew of at most half the burst;
+ *  - sweep: no snapshot completes between the drain and the end of the
+ *    burst, and the sweep resumes afterwards.
+ *
+ * Usage: test_boundary
+ */
+
+#include <stdio.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMBoundary.h"
+
+#define EPOCH_START  1700000010UL  ///< Wall clock at the start (a boundary every minute falls 30 s later)
+#define DRAIN_MS     500           ///< Default drain time
+
+/**
+ * @struct Reports
+ * @brief Reports and snapshots seen by the callbacks
+ */
+struct Reports {
+    uint8_t count;                  ///< Reports delivered
+    uint32_t doneMs[2];             ///< millis() of the first two reports
+    PZEMBoundaryReport report[2];   ///< First two reports
+    uint32_t snapshots;             ///< Snapshots delivered
+    uint32_t snapshotMs[2048];      ///< Completion time of every snapshot
+};
+
+/**
+ * @brief Keep the first two reports
+ */
+static void onReport(const PZEMBoundaryReport* report, void* context) {
+    Reports* reports = (Reports*)context;
+    if (reports->count < 2) {
+        reports->doneMs[reports->count] = millis();
+        reports->report[reports->count] = *report;
+    }
+    reports->count++;
+}
+
+/**
+ * @brief Record when every snapshot completed
+ */
+static void onSnapshot(const PZEMSnapshot* snapshot, void* context) {
+    Reports* reports = (Reports*)context;
+    if (reports->snapshots < 2048) {
+        reports->snapshotMs[reports->snapshots] = snapshot->timestamp;
+    }
+    reports->snapshots++;
+}
+
+/**
+ * @brief Snapshots completed in a time range
+ */
+static uint32_t snapshotsBetween(const Reports& reports, uint32_t fromMs, uint32_t toMs) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < reports.snapshots && i < 2048; i++) {
+        if ((int32_t)(reports.snapshotMs[i] - fromMs) >= 0 && (int32_t)(toMs - reports.snapshotMs[i]) >= 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Three meters and a dead one read around two boundaries a minute apart
+ */
+static void testBoundaries() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMBoundaryCapture boundary(bus);
+    static Reports reports;
+    bus.setInterval(200);
+    bus.setSnapshotCallback(onSnapshot, &reports);
+    boundary.setReportCallback(onReport, &reports);
+    for (uint8_t addr = 1; addr <= 4; addr++) {
+        line.setPresent(addr, addr != 4);
+        TEST_CHECK(bus.addDevice(addr, PZEM_MODEL_004T));
+    }
+
+    TEST_CHECK(boundary.getNextBoundary() == 0);
+    TEST_CHECK(!boundary.subscribe(9));
+    for (uint8_t addr = 1; addr <= 4; addr++) {
+        TEST_CHECK(boundary.subscribe(addr));
+    }
+    TEST_CHECK(!boundary.subscribe(1));
+    boundary.setPeriod(60);
+
+    // A few sweeps first, so the dead meter is known to be offline
+    uint64_t end = testNowUs + 5000000ULL;
+    while (testNowUs < end) {
+        boundary.poll(1000);
+        testAdvance(100);
+    }
+    uint32_t clockMs = millis();
+    boundary.setClock(EPOCH_START);
+    TEST_CHECK(boundary.getNextBoundary() == EPOCH_START + 30);
+    TEST_CHECK(!bus.isOnline(4));
+
+    end = testNowUs + 100000000ULL;
+    while (testNowUs < end && reports.count < 2) {
+        boundary.poll(1000);
+        testAdvance(100);
+    }
+    TEST_CHECK(reports.count == 2);
+    TEST_CHECK(boundary.getNextBoundary() == EPOCH_START + 150);
+    end = testNowUs + 2000000ULL;
+    while (testNowUs < end) {
+        boundary.poll(1000);
+        testAdvance(100);
+    }
+
+    for (uint8_t n = 0; n < 2; n++) {
+        const PZEMBoundaryReport& report = reports.report[n];
+        uint32_t boundaryMs = clockMs + (report.boundary - EPOCH_START) * 1000;
+        printf("boundary %u: %u readings, skews %d %d %d ms, max %u ms, %u snapshots during the drain and burst\n",
+               (unsigned)(report.boundary - EPOCH_START), (unsigned)report.count, (int)report.readings[0].skewMs,
+               (int)report.readings[1].skewMs, (int)report.readings[2].skewMs, (unsigned)report.maxSkewMs,
+               (unsigned)snapshotsBetween(reports, boundaryMs - DRAIN_MS + 100, reports.doneMs[n]));
+        TEST_CHECK(report.boundary == EPOCH_START + 30 + n * 60);
+        TEST_CHECK(report.count == 4);
+        for (uint8_t i = 0; i < 3; i++) {
+            const PZEMBoundaryReading& reading = report.readings[i];
+            uint32_t low = reading.slaveAddr * 256 + pzemModelInfo(PZEM_MODEL_004T)->energyRegister;
+            TEST_CHECK(reading.valid && reading.model == PZEM_MODEL_004T);
+            TEST_CHECK(reading.energy == (((low + 1) << 16) | low));
+        }
+        TEST_CHECK(report.readings[3].slaveAddr == 4 && !report.readings[3].valid);
+
+        // The sweep waits from the drain (reads in flight done) to the end of the burst, then goes on
+        TEST_CHECK(snapshotsBetween(reports, boundaryMs - DRAIN_MS + 100, reports.doneMs[n]) == 0);
+        TEST_CHECK(snapshotsBetween(reports, reports.doneMs[n], reports.doneMs[n] + 1000) >= 10);
+    }
+
+    // Centred with the learnt read time: the first reading early, the last late
+    const PZEMBoundaryReport& second = reports.report[1];
+    uint32_t burstMs = second.readings[2].skewMs - second.readings[0].skewMs;
+    TEST_CHECK(second.readings[0].skewMs < 0 && second.readings[2].skewMs > 0);
+    TEST_CHECK(second.maxSkewMs <= burstMs / 2 + 1);
+    TEST_CHECK(second.maxSkewMs <= reports.report[0].maxSkewMs);
+}
+
+int main() {
+    testBoundaries();
+    return testSummary("test_boundary");
+}
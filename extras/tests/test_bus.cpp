@@ -0,0 +1,351 @@
+/**
+ * @file test_bus.cpp
+ * @brief PZEMBus sweeps against meters on a simulated RS485 line (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A simulated UART (MockBus.h) times every byte on the wire at the line speed, and the
+ * meters on the line answer reads of their input and holding registers after
+ * a fixed latency, register r of device a holding a * 256 + r. The bus runs
+ * over the real ModbusRTUTransport on the virtual clock:
+ *  - poll budget: no poll() lasts longer than its budget plus the request
+ *    frame it may have started;
+ *  - response timeout: the 133-byte PZEM-6L24 snapshot completes with the
+ *    default timeout, which adds the response wire time;
+ *  - priority: a priority read waits at most for the exchange on the wire,
+ *    while a read without priority queues behind the sweep, and priority
+ *    traffic does not move the sweep cadence;
+ *  - heartbeat: silent devices get a one-register probe per heartbeat, and
+ *    devices answering snapshots or application reads none;
+ *  - device list changes: a removed or readdressed device leaves the
+ *    register cache, so a full cache takes the devices that replace them.
+ *
+ * Usage: test_bus
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMRegisterCache.h"
+
+/**
+ * @brief Poll the bus for a while of virtual time
+ * @param bus Bus to poll
+ * @param ms Virtual time to run
+ * @param budgetUs Budget of each poll()
+ */
+static void run(PZEMBus& bus, uint32_t ms, uint32_t budgetUs = 1000) {
+    uint64_t end = testNowUs + (uint64_t)ms * 1000;
+    while (testNowUs < end) {
+        bus.poll(budgetUs);
+        testAdvance(100);
+    }
+}
+
+/**
+ * @brief Count the snapshots of every device
+ */
+static void countSnapshot(const PZEMSnapshot* snapshot, void* context) {
+    uint32_t* counts = (uint32_t*)context;
+    counts[snapshot->slaveAddr]++;
+}
+
+/**
+ * @brief poll() returns within its budget plus one request frame
+ *
+ * Some devices are dead, so reads end in timeouts as well as responses. Each
+ * poll() is timed on the virtual clock; the only step that may cross the
+ * budget is the blocking send of one 8-byte request.
+ */
+static void testBudget() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    bus.setInterval(100);
+    for (uint8_t addr = 1; addr <= 4; addr++) {
+        line.setPresent(addr, addr % 2 == 1);
+        TEST_CHECK(bus.addDevice(addr, PZEM_MODEL_004T));
+    }
+
+    const uint32_t budgetUs = 2000;
+    uint64_t longest = 0;
+    uint32_t over = 0;
+    uint64_t end = testNowUs + 3000000ULL;
+    while (testNowUs < end) {
+        uint64_t start = testNowUs;
+        bus.poll(budgetUs);
+        uint64_t spent = testNowUs - start;
+        longest = spent > longest ? spent : longest;
+        over += spent > budgetUs ? 1 : 0;
+        testAdvance(100);
+    }
+    uint64_t bound = budgetUs + 8 * line.byteUs + 100;
+    printf("budget: %u us, longest poll %llu us (bound %llu), %u polls over budget, %u requests\n",
+           (unsigned)budgetUs, (unsigned long long)longest, (unsigned long long)bound, (unsigned)over,
+           (unsigned)line.requests);
+    TEST_CHECK(longest <= bound);
+    TEST_CHECK(line.requests > 20);
+    TEST_CHECK(line.asked(2) > 0 && line.asked(4) > 0);
+}
+
+/**
+ * @brief The default timeout covers the PZEM-6L24 snapshot
+ *
+ * 133 bytes take 139 ms at 9600 baud 8N1, more than a fixed 100 ms timeout.
+ */
+static void testLongSnapshot() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    uint32_t counts[248] = {0};
+    bus.setSnapshotCallback(countSnapshot, counts);
+    bus.setInterval(500);
+    line.setPresent(1, true);
+    line.setPresent(2, true);
+    TEST_CHECK(bus.addDevice(1, PZEM_MODEL_6L24));
+    TEST_CHECK(bus.addDevice(2, PZEM_MODEL_004T));
+
+    TEST_CHECK(bus.getTimeout(64) == modbusWireTimeMs(133, PZEM_BUS_DEFAULT_BAUDRATE) + PZEM_BUS_DEFAULT_TIMEOUT_MS);
+    TEST_CHECK(bus.getTimeout(64) > (uint32_t)(133 * line.byteUs + LINE_LATENCY_US) / 1000);
+
+    run(bus, 2100);
+    printf("timeout: %u ms for 64 registers, %u PZEM-6L24 and %u PZEM-004T snapshots in 2.1 s\n",
+           (unsigned)bus.getTimeout(64), (unsigned)counts[1], (unsigned)counts[2]);
+    TEST_CHECK(counts[1] >= 4);
+    TEST_CHECK(counts[2] >= 4);
+    TEST_CHECK(bus.isOnline(1));
+}
+
+/**
+ * @brief Completion of an application transaction
+ */
+static void countCompletion(ModbusTransaction* txn, void* context) {
+    (void)txn;
+    (*(uint32_t*)context)++;
+}
+
+/**
+ * @brief Silent devices get one-register probes, answering ones none
+ *
+ * Snapshots and application transactions count as proof of life, so a
+ * device that answers them is never probed.
+ */
+static void testHeartbeat() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    bus.setInterval(PZEM_BUS_NO_SWEEP);
+    bus.setHeartbeat(1000);
+    line.setPresent(1, true);
+    TEST_CHECK(bus.addDevice(1, PZEM_MODEL_004T));
+    TEST_CHECK(bus.addDevice(2, PZEM_MODEL_004T));
+
+    // Health monitoring only: every exchange is a probe of one register
+    run(bus, 10050);
+    printf("heartbeat: %u probes, %u requests, %u registers; online %d %d\n", (unsigned)bus.getProbeCount(),
+           (unsigned)line.requests, (unsigned)line.registers, bus.isOnline(1), bus.isOnline(2));
+    TEST_CHECK(bus.getProbeCount() == line.requests);
+    TEST_CHECK(line.registers == line.requests);
+    TEST_CHECK(line.asked(1) >= 10 && line.asked(1) <= 11);
+    TEST_CHECK(line.asked(2) >= 10 && line.asked(2) <= 11);
+    TEST_CHECK(bus.isOnline(1));
+    TEST_CHECK(!bus.isOnline(2));
+    TEST_CHECK(bus.getLastSeen(2) == 0);
+    TEST_CHECK(millis() - bus.getLastSeen(1) <= 1100);
+
+    // Application reads every 500 ms keep device 1 alive without probes
+    uint32_t probes = line.asked(1);
+    uint32_t completed = 0;
+    uint8_t request[8];
+    uint8_t response[16];
+    ModbusTransaction txn;
+    modbusBuildReadRequest(request, 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+    for (uint8_t i = 0; i < 10; i++) {
+        txn.prepare(request, sizeof(request), response, sizeof(response), modbusReadResponseLength(2), 100);
+        txn.onComplete = countCompletion;
+        txn.context = &completed;
+        TEST_CHECK(bus.submit(&txn));
+        run(bus, 500);
+    }
+    TEST_CHECK(completed == 10);
+    TEST_CHECK(line.asked(1) - probes == 10);
+
+    // So do snapshots; the dead device is still probed between its snapshots
+    bus.setInterval(500);
+    uint32_t before = bus.getProbeCount();
+    uint32_t beforeLive = line.asked(1);
+    uint32_t beforeDead = line.asked(2);
+    run(bus, 5000);
+    uint32_t probed = bus.getProbeCount() - before;
+    printf("heartbeat: sweep of 5 s, %u requests to device 1, %u to device 2, %u probes\n",
+           (unsigned)(line.asked(1) - beforeLive), (unsigned)(line.asked(2) - beforeDead), (unsigned)probed);
+    TEST_CHECK(line.asked(1) - beforeLive == 10);
+    TEST_CHECK(line.asked(2) - beforeDead == 10 + probed);
+    TEST_CHECK(probed >= 4 && probed <= 6);
+}
+
+/**
+ * @brief Count the snapshots of every device and keep the time of the first and last
+ */
+static void stampSnapshot(const PZEMSnapshot* snapshot, void* context) {
+    uint32_t (*stamps)[3] = (uint32_t (*)[3])context;
+    uint32_t* device = stamps[snapshot->slaveAddr];
+    if (device[0]++ == 0) {
+        device[1] = snapshot->timestamp;
+    }
+    device[2] = snapshot->timestamp;
+}
+
+/**
+ * @brief Completion time of an application transaction
+ */
+static void stampCompletion(ModbusTransaction* txn, void* context) {
+    (void)txn;
+    *(uint64_t*)context = testNowUs;
+}
+
+/**
+ * @brief Priority reads overtake the queued sweep without moving its cadence
+ *
+ * Two snapshot reads are queued on the transport at all times, so a read
+ * without priority waits for both; a priority read waits at most for the
+ * exchange on the wire.
+ */
+static void testPriority() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    bus.setInterval(100);
+    for (uint8_t addr = 1; addr <= 4; addr++) {
+        line.setPresent(addr, true);
+        TEST_CHECK(bus.addDevice(addr, PZEM_MODEL_004T));
+    }
+    run(bus, 1000);
+
+    // Request, latency, response and end-of-frame silence
+    uint32_t snapshotUs = (8 + modbusReadResponseLength(10)) * line.byteUs + LINE_LATENCY_US + 10000;
+    uint32_t readUs = (8 + modbusReadResponseLength(2)) * line.byteUs + LINE_LATENCY_US + 10000;
+    uint8_t request[2][8];
+    uint8_t response[2][16];
+    ModbusTransaction txn[2];
+    uint64_t doneUs[2];
+    uint64_t worst[2] = {0, 0};
+    for (uint8_t round = 0; round < 20; round++) {
+        uint64_t submitUs = testNowUs;
+        for (uint8_t i = 0; i < 2; i++) {
+            modbusBuildReadRequest(request[i], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+            txn[i].prepare(request[i], sizeof(request[i]), response[i], sizeof(response[i]),
+                           modbusReadResponseLength(2), 100);
+            txn[i].onComplete = stampCompletion;
+            txn[i].context = &doneUs[i];
+            doneUs[i] = 0;
+        }
+        TEST_CHECK(bus.submit(&txn[0]));
+        TEST_CHECK(bus.submit(&txn[1], true));
+        while (doneUs[0] == 0 || doneUs[1] == 0) {
+            run(bus, 1);
+        }
+        for (uint8_t i = 0; i < 2; i++) {
+            TEST_CHECK(txn[i].status == MODBUS_TRANSACTION_OK);
+            worst[i] = doneUs[i] - submitUs > worst[i] ? doneUs[i] - submitUs : worst[i];
+        }
+        TEST_CHECK(doneUs[1] < doneUs[0]);
+        run(bus, 250);
+    }
+    printf("priority: worst latency %llu us with priority (bound %u), %llu us without\n",
+           (unsigned long long)worst[1], (unsigned)(snapshotUs + readUs), (unsigned long long)worst[0]);
+    TEST_CHECK(worst[1] <= snapshotUs + readUs + 1000);
+    TEST_CHECK(worst[0] > worst[1] + snapshotUs);
+
+    // Bursts of priority reads hold the line long enough to delay snapshots, which keep their cadence
+    uint32_t stamps[5][3] = {};
+    uint8_t burstRequest[PZEM_BUS_MAX_USER_TRANSACTIONS][8];
+    uint8_t burstResponse[PZEM_BUS_MAX_USER_TRANSACTIONS][32];
+    ModbusTransaction burst[PZEM_BUS_MAX_USER_TRANSACTIONS];
+    uint64_t burstDoneUs[PZEM_BUS_MAX_USER_TRANSACTIONS];
+    bus.setInterval(400);
+    run(bus, 2000);
+    bus.setSnapshotCallback(stampSnapshot, stamps);
+    uint64_t end = testNowUs + 10000000ULL;
+    while (testNowUs < end) {
+        for (uint8_t i = 0; i < PZEM_BUS_MAX_USER_TRANSACTIONS; i++) {
+            modbusBuildReadRequest(burstRequest[i], 2, MODBUS_READ_INPUT_REGISTERS, 0x0000, 10);
+            burst[i].prepare(burstRequest[i], sizeof(burstRequest[i]), burstResponse[i], sizeof(burstResponse[i]),
+                             modbusReadResponseLength(10), 100);
+            burst[i].onComplete = stampCompletion;
+            burst[i].context = &burstDoneUs[i];
+            TEST_CHECK(bus.submit(&burst[i], true));
+        }
+        run(bus, 1030);
+    }
+    printf("priority: snapshots every 400 ms with a priority burst every 1030 ms, %u %u %u %u in 10 s over "
+           "%u %u %u %u ms\n", (unsigned)stamps[1][0], (unsigned)stamps[2][0], (unsigned)stamps[3][0],
+           (unsigned)stamps[4][0], (unsigned)(stamps[1][2] - stamps[1][1]), (unsigned)(stamps[2][2] - stamps[2][1]),
+           (unsigned)(stamps[3][2] - stamps[3][1]), (unsigned)(stamps[4][2] - stamps[4][1]));
+    for (uint8_t addr = 1; addr <= 4; addr++) {
+        // Due times stay on the grid: the span moves by two snapshot exchanges at most, not by every delay
+        uint32_t span = stamps[addr][2] - stamps[addr][1];
+        uint32_t expected = (stamps[addr][0] - 1) * 400;
+        uint32_t slack = 2 * snapshotUs / 1000;
+        TEST_CHECK(stamps[addr][0] >= 25 && stamps[addr][0] <= 26);
+        TEST_CHECK(span + slack >= expected && span <= expected + slack);
+    }
+}
+
+/**
+ * @brief Removed and readdressed devices leave the register cache
+ *
+ * The cache holds fewer devices than the bus. Once full, a device added or
+ * moved in place of others only finds room if their images were dropped.
+ */
+static void testRegistryCache() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMRegisterCache cache;
+    bus.setRegisterCache(&cache);
+    bus.setInterval(200);
+    for (uint8_t addr = 1; addr <= PZEM_CACHE_MAX_DEVICES; addr++) {
+        line.setPresent(addr, true);
+        TEST_CHECK(bus.addDevice(addr, PZEM_MODEL_004T));
+    }
+    run(bus, 1000);
+    for (uint8_t addr = 1; addr <= PZEM_CACHE_MAX_DEVICES; addr++) {
+        TEST_CHECK(cache.contains(addr));
+    }
+
+    // Device 1 leaves, device 2 moves to 100, device 50 joins
+    TEST_CHECK(bus.removeDevice(1));
+    TEST_CHECK(bus.readdressDevice(2, 100));
+    TEST_CHECK(bus.addDevice(50, PZEM_MODEL_004T));
+    line.setPresent(1, false);
+    line.setPresent(2, false);
+    line.setPresent(100, true);
+    line.setPresent(50, true);
+    run(bus, 1000);
+    printf("registry: cache holds 1 %d, 2 %d, 100 %d, 50 %d\n", cache.contains(1), cache.contains(2),
+           cache.contains(100), cache.contains(50));
+    TEST_CHECK(!cache.contains(1));
+    TEST_CHECK(!cache.contains(2));
+    TEST_CHECK(cache.contains(100));
+    TEST_CHECK(cache.contains(50));
+
+    uint16_t regs[2] = {0, 0};
+    TEST_CHECK(cache.read(100, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2, regs));
+    TEST_CHECK(regs[0] == 100 * 256 && regs[1] == 100 * 256 + 1);
+    TEST_CHECK(line.asked(1) > 0 && line.asked(100) > 0);
+}
+
+int main() {
+    testBudget();
+    testLongSnapshot();
+    testHeartbeat();
+    testPriority();
+    testRegistryCache();
+    return testSummary("test_bus");
+}
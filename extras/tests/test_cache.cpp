@@ -0,0 +1,177 @@
+/**
+ * @file test_cache.cpp
+ * @brief Change tracking and subscriptions of the register cache (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * PZEMRegisterCache on its own and as the mirror of a PZEMBus sweeping the
+ * simulated RS485 line of MockBus.h, on the virtual clock:
+ *  - changes: store() flags a register in every overlapping subscription
+ *    when its value changed or became known, and only then;
+ *  - visits: takeChanges() hands the flags over once, and a new subscription
+ *    sees the registers already cached as changed;
+ *  - limits: ranges outside the cache layout and a full table are refused;
+ *  - mirror: a sweep of unchanged meters dispatches nothing after the first
+ *    round, and a meter whose readings move wakes only its subscribers.
+ *
+ * Usage: test_cache
+ */
+
+#include <stdio.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMRegisterCache.h"
+
+/**
+ * @brief Registers flagged in a change, as offsets in the subscribed range
+ * @return Bit r set if register startAddr + r changed (first 32 registers)
+ */
+static uint32_t changedBits(const PZEMRegisterChange& change) {
+    return change.changed[0];
+}
+
+/**
+ * @brief Count the callbacks and registers flagged for one subscriber
+ */
+static void countChange(const PZEMRegisterChange* change, void* context) {
+    uint32_t* counts = (uint32_t*)context;
+    counts[0]++;
+    for (uint16_t r = 0; r < change->numRegs; r++) {
+        counts[1] += (change->changed[r / 32] >> (r % 32)) & 1;
+    }
+}
+
+/**
+ * @brief Flags follow the stored values, per subscription and per visit
+ */
+static void testChanges() {
+    PZEMRegisterCache cache;
+    PZEMRegisterChange change;
+    uint16_t regs[8] = {100, 101, 102, 103, 104, 105, 106, 107};
+    uint16_t holding[2] = {0x0001, 0x0002};
+
+    int8_t voltage = cache.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 1, NULL, NULL);
+    int8_t power = cache.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0002, 4, NULL, NULL);
+    int8_t config = cache.subscribe(1, MODBUS_READ_HOLDING_REGISTERS, 0x0001, 2, NULL, NULL);
+    int8_t other = cache.subscribe(2, MODBUS_READ_INPUT_REGISTERS, 0x0000, 8, NULL, NULL);
+    TEST_CHECK(voltage >= 0 && power >= 0 && config >= 0 && other >= 0);
+    TEST_CHECK(!cache.takeChanges(power, &change));
+
+    // First values are changes; the same values again are not
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 8, regs, 1000));
+    TEST_CHECK(cache.takeChanges(voltage, &change) && changedBits(change) == 0x1);
+    TEST_CHECK(cache.takeChanges(power, &change) && changedBits(change) == 0xF);
+    TEST_CHECK(change.slaveAddr == 1 && change.startAddr == 0x0002 && change.numRegs == 4);
+    TEST_CHECK(!cache.takeChanges(power, &change));
+    TEST_CHECK(!cache.takeChanges(config, &change));
+    TEST_CHECK(!cache.takeChanges(other, &change));
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 8, regs, 2000));
+    TEST_CHECK(!cache.takeChanges(voltage, &change));
+    TEST_CHECK(!cache.takeChanges(power, &change));
+
+    // One register moves: only the range holding it is flagged, at its offset
+    regs[4] = 999;
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 8, regs, 3000));
+    TEST_CHECK(!cache.takeChanges(voltage, &change));
+    TEST_CHECK(cache.takeChanges(power, &change) && changedBits(change) == 0x4);
+
+    // Flags collect until the next visit
+    regs[2] = 1;
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0002, 1, regs + 2, 4000));
+    regs[5] = 2;
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0005, 1, regs + 5, 5000));
+    TEST_CHECK(cache.takeChanges(power, &change) && changedBits(change) == 0x9);
+
+    // Holding registers have their own table
+    TEST_CHECK(cache.store(1, MODBUS_READ_HOLDING_REGISTERS, 0x0001, 2, holding, 6000));
+    TEST_CHECK(cache.takeChanges(config, &change) && changedBits(change) == 0x3);
+    TEST_CHECK(!cache.takeChanges(power, &change));
+
+    // A new consumer starts with everything already cached in its range
+    int8_t late = cache.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0006, 4, NULL, NULL);
+    TEST_CHECK(late >= 0);
+    TEST_CHECK(cache.takeChanges(late, &change) && changedBits(change) == 0x3);
+
+    // A cancelled subscription is no longer flagged
+    TEST_CHECK(cache.unsubscribe(power));
+    TEST_CHECK(!cache.unsubscribe(power));
+    regs[3] = 3;
+    TEST_CHECK(cache.store(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 8, regs, 7000));
+    TEST_CHECK(!cache.takeChanges(power, &change));
+
+    // Ranges outside the layout and a full table are refused
+    TEST_CHECK(cache.subscribe(0, MODBUS_READ_INPUT_REGISTERS, 0x0000, 1, NULL, NULL) < 0);
+    TEST_CHECK(cache.subscribe(1, MODBUS_READ_INPUT_REGISTERS, PZEM_CACHE_INPUT_REGISTERS - 1, 2, NULL, NULL) < 0);
+    TEST_CHECK(cache.subscribe(1, MODBUS_READ_HOLDING_REGISTERS, 0x0000, PZEM_CACHE_HOLDING_REGISTERS + 1, NULL,
+                               NULL) < 0);
+    uint8_t added = 0;
+    while (cache.subscribe(3, MODBUS_READ_INPUT_REGISTERS, 0x0000, 1, NULL, NULL) >= 0) {
+        added++;
+    }
+    TEST_CHECK(added == PZEM_CACHE_MAX_SUBSCRIPTIONS - 4);
+}
+
+/**
+ * @brief The cache mirrors a sweep and wakes the subscribers of what moved
+ */
+static void testBusMirror() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMRegisterCache cache;
+    uint32_t first[2] = {0, 0};
+    uint32_t second[2] = {0, 0};
+    bus.setRegisterCache(&cache);
+    bus.setInterval(200);
+    for (uint8_t addr = 1; addr <= 2; addr++) {
+        line.setPresent(addr, true);
+        TEST_CHECK(bus.addDevice(addr, PZEM_MODEL_004T));
+    }
+    uint16_t snapshotRegs = pzemModelInfo(PZEM_MODEL_004T)->snapshotRegs;
+    TEST_CHECK(cache.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, snapshotRegs, countChange, first) >= 0);
+    TEST_CHECK(cache.subscribe(2, MODBUS_READ_INPUT_REGISTERS, 0x0000, snapshotRegs, countChange, second) >= 0);
+
+    // Dispatched every 50 ms: the first round, then nothing while the meters read the same
+    uint8_t dispatches = 0;
+    for (uint8_t i = 0; i < 40; i++) {
+        uint64_t end = testNowUs + 50000;
+        while (testNowUs < end) {
+            bus.poll(1000);
+            testAdvance(100);
+        }
+        dispatches += cache.dispatch();
+    }
+    TEST_CHECK(dispatches == 2);
+    TEST_CHECK(first[0] == 1 && first[1] == snapshotRegs);
+    TEST_CHECK(second[0] == 1 && second[1] == snapshotRegs);
+
+    // Device 1 moves once: one more callback with every register, none for device 2
+    line.setOffset(1, 1);
+    for (uint8_t i = 0; i < 40; i++) {
+        uint64_t end = testNowUs + 50000;
+        while (testNowUs < end) {
+            bus.poll(1000);
+            testAdvance(100);
+        }
+        cache.dispatch();
+    }
+    printf("mirror: %u sweeps, device 1 woke %u times for %u registers, device 2 %u times\n",
+           (unsigned)(bus.getReadCount() / 2), (unsigned)first[0], (unsigned)first[1], (unsigned)second[0]);
+    TEST_CHECK(bus.getReadCount() >= 38);
+    TEST_CHECK(first[0] == 2 && first[1] == 2 * snapshotRegs);
+    TEST_CHECK(second[0] == 1);
+
+    uint16_t regs[2];
+    TEST_CHECK(cache.read(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2, regs));
+    TEST_CHECK(regs[0] == 1 * 256 + 1 && regs[1] == 1 * 256 + 2);
+}
+
+int main() {
+    testChanges();
+    testBusMirror();
+    return testSummary("test_cache");
+}
@@ -0,0 +1,163 @@
+/**
+ * @file test_cadence.cpp
+ * @brief Cadence tracks shared by the bus sweep and scheduler subscriptions (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * PZEMBus and PZEMScheduler read the meters of a simulated RS485 line
+ * (MockBus.h) over the real ModbusRTUTransport on the virtual clock, with a
+ * PZEMCadence attached to both:
+ *  - two periods on one range: a 1 s and a 5 s subscription of the same
+ *    registers keep a track each, judged against their own period, and
+ *    cancelling one leaves the other;
+ *  - shared owners: the sweep of a device and a subscription of its snapshot
+ *    span at the sweep interval share one track, which stays until both
+ *    have released it.
+ *
+ * Usage: test_cadence
+ */
+
+#include <stdio.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+#include "PZEMScheduler.h"
+
+/**
+ * @brief Poll the scheduler for a while of virtual time
+ * @param scheduler Scheduler to poll
+ * @param ms Virtual time to run
+ */
+static void run(PZEMScheduler& scheduler, uint32_t ms) {
+    uint64_t end = testNowUs + (uint64_t)ms * 1000;
+    while (testNowUs < end) {
+        scheduler.poll(1000);
+        testAdvance(100);
+    }
+}
+
+/**
+ * @brief Find the track of a range at a period
+ * @return Track index, or PZEM_CADENCE_INVALID
+ */
+static int8_t findTrack(const PZEMCadence& cadence, uint8_t slaveAddr, uint16_t numRegs, uint32_t periodMs,
+                        PZEMCadenceStats* stats) {
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        if (cadence.getStats(i, stats) && stats->slaveAddr == slaveAddr && stats->startAddr == 0 &&
+            stats->numRegs == numRegs && stats->periodMs == periodMs) {
+            return i;
+        }
+    }
+    return PZEM_CADENCE_INVALID;
+}
+
+/**
+ * @brief Count the tracks in use
+ */
+static uint8_t countTracks(const PZEMCadence& cadence) {
+    PZEMCadenceStats stats;
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        count += cadence.getStats(i, &stats) ? 1 : 0;
+    }
+    return count;
+}
+
+/**
+ * @brief A 1 s and a 5 s subscription of one range keep separate tracks
+ *
+ * With one track per range, the period of the later subscription replaced
+ * the other: the 1 s reads showed as early 5 s refreshes, or the 5 s track
+ * vanished when the 1 s subscription was cancelled.
+ */
+static void testTwoPeriods() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    bus.setInterval(PZEM_BUS_NO_SWEEP);
+    PZEMScheduler scheduler(bus);
+    PZEMCadence cadence;
+    scheduler.setCadence(&cadence);
+    line.setPresent(1, true);
+
+    int32_t fast = scheduler.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 4, 1000);
+    int32_t slow = scheduler.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 4, 5000);
+    TEST_CHECK(fast != PZEM_SCHEDULER_INVALID && slow != PZEM_SCHEDULER_INVALID);
+    TEST_CHECK(countTracks(cadence) == 2);
+
+    run(scheduler, 10500);
+    PZEMCadenceStats fastStats;
+    PZEMCadenceStats slowStats;
+    TEST_CHECK(findTrack(cadence, 1, 4, 1000, &fastStats) != PZEM_CADENCE_INVALID);
+    TEST_CHECK(findTrack(cadence, 1, 4, 5000, &slowStats) != PZEM_CADENCE_INVALID);
+    printf("two periods: 1 s track %u updates, mean %u ms, jitter max %u ms, %u missed\n",
+           (unsigned)fastStats.updates, (unsigned)fastStats.meanIntervalMs, (unsigned)fastStats.jitterMaxMs,
+           (unsigned)fastStats.missed);
+    TEST_CHECK(fastStats.updates >= 10);
+    TEST_CHECK(fastStats.meanIntervalMs >= 990 && fastStats.meanIntervalMs <= 1010);
+    TEST_CHECK(fastStats.jitterMaxMs < 50);
+    TEST_CHECK(fastStats.missed == 0);
+    TEST_CHECK(fastStats.owners == 1 && slowStats.owners == 1);
+
+    // Cancelling the fast subscription keeps the slow one tracked
+    TEST_CHECK(scheduler.unsubscribe(fast));
+    TEST_CHECK(findTrack(cadence, 1, 4, 1000, &fastStats) == PZEM_CADENCE_INVALID);
+    TEST_CHECK(findTrack(cadence, 1, 4, 5000, &slowStats) != PZEM_CADENCE_INVALID);
+    TEST_CHECK(scheduler.unsubscribe(slow));
+    TEST_CHECK(countTracks(cadence) == 0);
+}
+
+/**
+ * @brief The sweep and a subscription share the track of a snapshot span
+ *
+ * Each releases its own owner: cancelling the subscription keeps the track
+ * of the sweep, and stopping the sweep then removes it.
+ */
+static void testSharedTrack() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMScheduler scheduler(bus);
+    PZEMCadence cadence;
+    bus.setCadence(&cadence);
+    scheduler.setCadence(&cadence);
+    line.setPresent(1, true);
+    uint16_t span = pzemModelInfo(PZEM_MODEL_004T)->snapshotRegs;
+
+    TEST_CHECK(bus.addDevice(1, PZEM_MODEL_004T));
+    int32_t id = scheduler.subscribe(1, MODBUS_READ_INPUT_REGISTERS, 0x0000, span, PZEM_BUS_DEFAULT_INTERVAL_MS);
+    TEST_CHECK(id != PZEM_SCHEDULER_INVALID);
+    run(scheduler, 3000);
+
+    PZEMCadenceStats stats;
+    TEST_CHECK(countTracks(cadence) == 1);
+    TEST_CHECK(findTrack(cadence, 1, span, PZEM_BUS_DEFAULT_INTERVAL_MS, &stats) != PZEM_CADENCE_INVALID);
+    printf("shared: %u owners, %u updates\n", (unsigned)stats.owners, (unsigned)stats.updates);
+    TEST_CHECK(stats.owners == 2);
+    TEST_CHECK(stats.updates >= 3);
+
+    // The subscription goes, the sweep keeps the track
+    TEST_CHECK(scheduler.unsubscribe(id));
+    TEST_CHECK(findTrack(cadence, 1, span, PZEM_BUS_DEFAULT_INTERVAL_MS, &stats) != PZEM_CADENCE_INVALID);
+    TEST_CHECK(stats.owners == 1);
+
+    // A new interval moves the sweep to a track of its own period
+    bus.setInterval(2000);
+    TEST_CHECK(findTrack(cadence, 1, span, PZEM_BUS_DEFAULT_INTERVAL_MS, &stats) == PZEM_CADENCE_INVALID);
+    TEST_CHECK(findTrack(cadence, 1, span, 2000, &stats) != PZEM_CADENCE_INVALID);
+
+    // The device leaves with its track
+    TEST_CHECK(bus.removeDevice(1));
+    run(scheduler, 100);
+    TEST_CHECK(countTracks(cadence) == 0);
+}
+
+int main() {
+    testTwoPeriods();
+    testSharedTrack();
+    return testSummary("test_cadence");
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_capture.cpp
+ * @brief Burst capture of meters on a simulated RS485 line (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A PZEMCapture fed by the sweep of a PZEMBus over the real ModbusRTUTransport
+ * and a simulated line (MockBus.h), on the virtual clock:
+ *  - threshold: a register leaving its window starts one capture, with the
+ *    pre-trigger history at the sweep rate followed by back to back burst
+ *    reads of the burst span, while the other devices wait;
+ *  - crossings: a register staying outside its window does not trigger
+ *    again; coming back and leaving again does;
+ *  - trigger(): a second trigger is refused while a capture is pending or
+ *    running, and the burst stops at its maximum duration.
+ *
+ * Usage: test_capture
+ */
+
+#include <stdio.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMCapture.h"
+
+/**
+ * @struct Captured
+ * @brief Captures delivered to the callback
+ */
+struct Captured {
+    uint32_t count;             ///< Records delivered
+    PZEMCaptureRecord last;     ///< Last record
+};
+
+/**
+ * @brief Keep a copy of every completed capture
+ */
+static void onCapture(const PZEMCaptureRecord* record, void* context) {
+    Captured* captured = (Captured*)context;
+    captured->count++;
+    captured->last = *record;
+}
+
+/**
+ * @brief Poll the capture for a while of virtual time
+ * @param capture Capture to poll
+ * @param ms Virtual time to run
+ */
+static void run(PZEMCapture& capture, uint32_t ms) {
+    uint64_t end = testNowUs + (uint64_t)ms * 1000;
+    while (testNowUs < end) {
+        capture.poll(1000);
+        testAdvance(100);
+    }
+}
+
+/**
+ * @brief A voltage leaving its window captures the history and a dense burst
+ */
+static void testThreshold() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMCapture capture(bus);
+    Captured captured = {};
+    bus.setInterval(200);
+    bus.setSnapshotCallback(PZEMCapture::onSnapshot, &capture);
+    capture.setCaptureCallback(onCapture, &captured);
+    capture.setWindow(20, 2000);
+    line.setPresent(1, true);
+    line.setPresent(2, true);
+    TEST_CHECK(bus.addDevice(1, PZEM_MODEL_004T));
+    TEST_CHECK(bus.addDevice(2, PZEM_MODEL_004T));
+    // Register 0 of device 1 reads 0x0100
+    TEST_CHECK(capture.setThreshold(1, 0, 0x00F0, 0x0110));
+    TEST_CHECK(!capture.setThreshold(1, PZEM_CAPTURE_MAX_SPAN, 0, 0));
+
+    run(capture, 3000);
+    TEST_CHECK(captured.count == 0);
+    TEST_CHECK(!capture.isCapturing());
+
+    // Sag: the next snapshot of device 1 is outside the window
+    line.setOffset(1, 0x0100);
+    uint32_t otherBefore = line.asked(2);
+    uint64_t sagUs = testNowUs;
+    while (!capture.isCapturing() && testNowUs - sagUs < 1000000) {
+        run(capture, 1);
+    }
+    TEST_CHECK(capture.isCapturing());
+    uint32_t otherAtStart = line.asked(2);
+    while (capture.isCapturing()) {
+        run(capture, 1);
+    }
+    uint32_t otherDuring = line.asked(2) - otherAtStart;
+
+    const PZEMCaptureRecord& record = captured.last;
+    uint32_t burstMs = record.samples[record.count - 1].timestamp - record.samples[record.preCount].timestamp;
+    printf("threshold: %u samples, %u before the trigger, burst of %u reads in %u ms, %u reads of device 2\n",
+           (unsigned)record.count, (unsigned)record.preCount, (unsigned)(record.count - record.preCount),
+           (unsigned)burstMs, (unsigned)otherDuring);
+    TEST_CHECK(captured.count == 1);
+    TEST_CHECK(record.slaveAddr == 1 && record.model == PZEM_MODEL_004T);
+    TEST_CHECK(record.source == PZEM_CAPTURE_TRIGGER_THRESHOLD);
+    TEST_CHECK(record.span == pzemModelInfo(PZEM_MODEL_004T)->burstRegs);
+    TEST_CHECK(record.preCount == PZEM_CAPTURE_PRE_SAMPLES);
+    TEST_CHECK(record.count == PZEM_CAPTURE_PRE_SAMPLES + 20);
+    TEST_CHECK(otherDuring == 0);
+    TEST_CHECK(line.asked(2) > otherBefore);
+
+    // History at the sweep rate, the last one the crossing
+    for (uint8_t i = 1; i < record.preCount; i++) {
+        uint32_t gap = record.samples[i].timestamp - record.samples[i - 1].timestamp;
+        TEST_CHECK(gap >= 195 && gap <= 205);
+    }
+    TEST_CHECK(record.samples[record.preCount - 2].regs[0] == 0x0100);
+    TEST_CHECK(record.samples[record.preCount - 1].regs[0] == 0x0200);
+    TEST_CHECK(record.triggerTime == record.samples[record.preCount - 1].timestamp);
+
+    // Burst reads back to back: request, latency, an 11-byte response and the end-of-frame silence each
+    for (uint8_t i = record.preCount + 1; i < record.count; i++) {
+        uint32_t gap = record.samples[i].timestamp - record.samples[i - 1].timestamp;
+        TEST_CHECK(gap >= 34 && gap <= 36);
+    }
+    TEST_CHECK(record.samples[record.count - 1].regs[0] == 0x0200);
+    TEST_CHECK(record.samples[record.count - 1].regs[2] == 0x0202);
+    TEST_CHECK(record.samples[record.count - 1].regs[3] == 0);
+
+    // Still outside: no new capture; back inside and out again: one more
+    uint32_t otherAfter = line.asked(2);
+    run(capture, 2000);
+    TEST_CHECK(captured.count == 1);
+    TEST_CHECK(line.asked(2) - otherAfter >= 9);
+    line.setOffset(1, 0);
+    run(capture, 1000);
+    TEST_CHECK(captured.count == 1);
+    line.setOffset(1, 0x0100);
+    run(capture, 2000);
+    TEST_CHECK(captured.count == 2);
+    TEST_CHECK(capture.getCaptureCount() == 2);
+}
+
+/**
+ * @brief trigger() accepts one capture at a time and the burst stops on time
+ */
+static void testTrigger() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMBus bus(transport);
+    PZEMCapture capture(bus);
+    Captured captured = {};
+    bus.setInterval(200);
+    bus.setSnapshotCallback(PZEMCapture::onSnapshot, &capture);
+    capture.setCaptureCallback(onCapture, &captured);
+    capture.setWindow(PZEM_CAPTURE_POST_SAMPLES, 100);
+    line.setPresent(1, true);
+    line.setPresent(2, true);
+    TEST_CHECK(bus.addDevice(1, PZEM_MODEL_004T));
+    TEST_CHECK(bus.addDevice(2, PZEM_MODEL_004T));
+    run(capture, 500);
+
+    TEST_CHECK(!capture.trigger(0));
+    TEST_CHECK(capture.trigger(2, PZEM_CAPTURE_TRIGGER_EXTERNAL));
+    TEST_CHECK(!capture.trigger(1));
+    run(capture, 1);
+    TEST_CHECK(capture.isCapturing());
+    TEST_CHECK(!capture.trigger(1));
+    run(capture, 300);
+    TEST_CHECK(!capture.isCapturing());
+
+    const PZEMCaptureRecord& record = captured.last;
+    uint8_t burst = record.count - record.preCount;
+    printf("trigger: %u burst reads in the 100 ms window, %u before the trigger\n", (unsigned)burst,
+           (unsigned)record.preCount);
+    TEST_CHECK(captured.count == 1);
+    TEST_CHECK(record.slaveAddr == 2 && record.source == PZEM_CAPTURE_TRIGGER_EXTERNAL);
+    TEST_CHECK(record.preCount >= 2 && record.preCount <= 3);
+    TEST_CHECK(burst >= 2 && burst <= 3);
+    TEST_CHECK(record.samples[record.count - 1].timestamp - record.triggerTime <= 100 + 36);
+
+    // Free again
+    TEST_CHECK(capture.trigger(1));
+    run(capture, 300);
+    TEST_CHECK(captured.count == 2 && captured.last.slaveAddr == 1);
+    TEST_CHECK(captured.last.source == PZEM_CAPTURE_TRIGGER_API);
+}
+
+int main() {
+    testThreshold();
+    testTrigger();
+    return testSummary("test_capture");
+}
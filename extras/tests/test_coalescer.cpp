@@ -0,0 +1,375 @@
+/**
+ * @file test_coalescer.cpp
+ * @brief Merging, splitting and failure fan-out of the coalescing transport (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * ModbusCoalescingTransport runs in front of a scripted inner transport that
+ * records what it is handed and completes it only when the test answers, so
+ * every check sees the exact requests on the line:
+ *  - merge: overlapping and nearby reads of a slave become one request over
+ *    the covering span, distant ones and other slaves do not;
+ *  - split: each caller gets the frame the device would have sent for its
+ *    own request, CRC included;
+ *  - fan-out: a read covered by a request already handed over waits for it
+ *    instead of sending another, and waiters complete in submission order;
+ *  - partial failure: a timeout reaches every waiter, a response to another
+ *    slave, function or span fails them all, and a waiter whose buffer is too
+ *    small fails alone;
+ *  - ordering: a read submitted after a write is not served by one queued
+ *    before it, and a priority read is not merged behind a background one.
+ *
+ * Usage: test_coalescer
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "ModbusCoalescer.h"
+#include "ModbusProtocol.h"
+
+/**
+ * @defgroup TestCoalescerConfig test_coalescer Configuration
+ * @{
+ */
+#define SCRIPT_MAX_SUBMITTED  16   ///< Transactions the scripted transport remembers
+#define READ_TIMEOUT_MS       100  ///< Timeout of the test reads
+/** @} */
+
+/**
+ * @class ScriptedTransport
+ * @brief Inner transport completing its transactions when the test says so
+ */
+class ScriptedTransport : public ModbusTransport {
+public:
+    ModbusTransaction* submitted[SCRIPT_MAX_SUBMITTED];  ///< Transactions in submission order
+    uint8_t count;                                      ///< Transactions submitted
+
+    ScriptedTransport() : count(0) {}
+
+    bool submit(ModbusTransaction* txn) {
+        if (count >= SCRIPT_MAX_SUBMITTED) {
+            return false;
+        }
+        txn->status = MODBUS_TRANSACTION_PENDING;
+        submitted[count++] = txn;
+        return true;
+    }
+
+    void poll() {}
+
+    bool isIdle() const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (submitted[i]->status == MODBUS_TRANSACTION_PENDING) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Answer a read with register r holding 0x1000 + r
+     * @param index Submission index
+     * @param slaveAddr Slave address of the answer (the request's, or another to fake a stray frame)
+     * @param numRegs Registers in the answer (the request's, or fewer to fake a short frame)
+     */
+    void answer(uint8_t index, uint8_t slaveAddr, uint16_t numRegs) {
+        ModbusTransaction* txn = submitted[index];
+        uint16_t start = (txn->request[2] << 8) | txn->request[3];
+        txn->response[0] = slaveAddr;
+        txn->response[1] = txn->request[1];
+        txn->response[2] = numRegs * 2;
+        for (uint16_t i = 0; i < numRegs; i++) {
+            txn->response[3 + i * 2] = 0x10 + ((start + i) >> 8);
+            txn->response[4 + i * 2] = (start + i) & 0xFF;
+        }
+        uint16_t length = modbusReadResponseLength(numRegs);
+        uint16_t crc = modbusCRC16(txn->response, length - 2);
+        txn->response[length - 2] = crc & 0xFF;
+        txn->response[length - 1] = crc >> 8;
+        txn->responseLength = length;
+        complete(txn, MODBUS_TRANSACTION_OK);
+    }
+
+    /**
+     * @brief End a transaction without a valid answer
+     */
+    void fail(uint8_t index, uint8_t status) {
+        submitted[index]->responseLength = 0;
+        complete(submitted[index], status);
+    }
+
+    /**
+     * @brief Get the span of a submitted read
+     */
+    void span(uint8_t index, uint16_t* start, uint16_t* numRegs) const {
+        const uint8_t* request = submitted[index]->request;
+        *start = (request[2] << 8) | request[3];
+        *numRegs = (request[4] << 8) | request[5];
+    }
+};
+
+/**
+ * @struct Read
+ * @brief A caller's read and the order it completed in
+ */
+struct Read {
+    ModbusTransaction txn;    ///< Transaction
+    uint8_t request[8];       ///< Request frame
+    uint8_t response[MODBUS_MAX_ADU_SIZE];  ///< Response frame
+    int8_t order;             ///< Completion rank (-1 while pending)
+};
+
+static int8_t completions = 0;  ///< Completions seen by the current test
+
+/**
+ * @brief Record the completion rank of a read
+ */
+static void onRead(ModbusTransaction* txn, void* context) {
+    (void)txn;
+    static_cast<Read*>(context)->order = completions++;
+}
+
+/**
+ * @brief Prepare and submit a read
+ * @param responseSize Size of the caller's response buffer (0 = the whole buffer)
+ * @param priority Interactive read
+ */
+static void submit(ModbusCoalescingTransport& transport, Read& read, uint8_t slaveAddr, uint8_t function,
+                   uint16_t start, uint16_t numRegs, uint16_t responseSize = 0, bool priority = false) {
+    modbusBuildReadRequest(read.request, slaveAddr, function, start, numRegs);
+    read.txn.prepare(read.request, sizeof(read.request), read.response,
+                     responseSize > 0 ? responseSize : sizeof(read.response), modbusReadResponseLength(numRegs),
+                     READ_TIMEOUT_MS);
+    read.txn.onComplete = onRead;
+    read.txn.context = &read;
+    read.txn.priority = priority;
+    read.order = -1;
+    TEST_CHECK(transport.submit(&read.txn));
+}
+
+/**
+ * @brief Check that a read got the frame of its own request from the device
+ */
+static bool ownFrame(const Read& read) {
+    uint16_t start = (read.request[2] << 8) | read.request[3];
+    uint16_t numRegs = (read.request[4] << 8) | read.request[5];
+    if (read.txn.status != MODBUS_TRANSACTION_OK || read.txn.responseLength != modbusReadResponseLength(numRegs) ||
+        read.response[0] != read.request[0] || read.response[1] != read.request[1] ||
+        read.response[2] != numRegs * 2 || modbusCRC16(read.response, read.txn.responseLength) != 0) {
+        return false;
+    }
+    for (uint16_t i = 0; i < numRegs; i++) {
+        if (modbusResponseRegister(read.response, i, true) != 0x1000 + start + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Overlapping and nearby reads merge, and each gets its own frame
+ */
+static void testMergeSplit() {
+    ScriptedTransport inner;
+    ModbusCoalescingTransport transport(inner);
+    Read reads[5];
+    completions = 0;
+
+    submit(transport, reads[0], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);   // voltage
+    submit(transport, reads[1], 1, MODBUS_READ_INPUT_REGISTERS, 0x0001, 4);   // overlapping
+    submit(transport, reads[2], 1, MODBUS_READ_INPUT_REGISTERS, 0x0008, 2);   // nearby: 3 registers of gap
+    submit(transport, reads[3], 1, MODBUS_READ_INPUT_REGISTERS, 0x0040, 2);   // too far to be worth it
+    submit(transport, reads[4], 2, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);   // another slave
+    transport.poll();
+
+    // MODBUS_COALESCE_IN_FLIGHT requests at a time: answer them one by one
+    uint8_t answered = 0;
+    while (answered < inner.count || !transport.isIdle()) {
+        if (answered == inner.count) {
+            transport.poll();
+            continue;
+        }
+        inner.answer(answered, inner.submitted[answered]->request[0],
+                     (inner.submitted[answered]->request[4] << 8) | inner.submitted[answered]->request[5]);
+        answered++;
+        transport.poll();
+    }
+
+    uint16_t start = 0;
+    uint16_t numRegs = 0;
+    inner.span(0, &start, &numRegs);
+    printf("merge: 5 reads, %u requests, first 0x%04X+%u, %u merged\n", (unsigned)inner.count, (unsigned)start,
+           (unsigned)numRegs, (unsigned)transport.getMergedCount());
+    TEST_CHECK(inner.count == 3);
+    TEST_CHECK(start == 0x0000 && numRegs == 10);
+    TEST_CHECK(transport.getMergedCount() == 2);
+    for (uint8_t i = 0; i < 5; i++) {
+        TEST_CHECK(ownFrame(reads[i]));
+    }
+    TEST_CHECK(reads[0].order < reads[1].order && reads[1].order < reads[2].order);
+}
+
+/**
+ * @brief A read covered by a request on the wire waits for it
+ *
+ * A read that would extend it cannot join it any more and goes on its own.
+ */
+static void testFanOut() {
+    ScriptedTransport inner;
+    ModbusCoalescingTransport transport(inner);
+    Read reads[4];
+    completions = 0;
+
+    submit(transport, reads[0], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 10);  // snapshot
+    transport.poll();
+    TEST_CHECK(inner.count == 1);
+
+    submit(transport, reads[1], 1, MODBUS_READ_INPUT_REGISTERS, 0x0003, 2);   // covered: waits
+    submit(transport, reads[2], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 1);   // covered: waits
+    submit(transport, reads[3], 1, MODBUS_READ_INPUT_REGISTERS, 0x0008, 4);   // extends: own request
+    transport.poll();
+    TEST_CHECK(inner.count == 1);
+
+    inner.answer(0, 1, 10);
+    transport.poll();
+    printf("fan-out: %u waiters on one request, completion order %d %d %d\n", 3, reads[0].order, reads[1].order,
+           reads[2].order);
+    TEST_CHECK(ownFrame(reads[0]) && ownFrame(reads[1]) && ownFrame(reads[2]));
+    TEST_CHECK(reads[0].order == 0 && reads[1].order == 1 && reads[2].order == 2);
+    TEST_CHECK(reads[3].order == -1);
+
+    TEST_CHECK(inner.count == 2);
+    uint16_t start = 0;
+    uint16_t numRegs = 0;
+    inner.span(1, &start, &numRegs);
+    TEST_CHECK(start == 0x0008 && numRegs == 4);
+    inner.answer(1, 1, 4);
+    transport.poll();
+    TEST_CHECK(ownFrame(reads[3]));
+    TEST_CHECK(transport.isIdle());
+}
+
+/**
+ * @brief Failures of a merged request reach every waiter, and only them
+ */
+static void testPartialFailure() {
+    completions = 0;
+
+    // A timeout fails every waiter of the request with its status
+    {
+        ScriptedTransport inner;
+        ModbusCoalescingTransport transport(inner);
+        Read reads[3];
+        submit(transport, reads[0], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+        submit(transport, reads[1], 1, MODBUS_READ_INPUT_REGISTERS, 0x0002, 2);
+        submit(transport, reads[2], 2, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+        transport.poll();
+        inner.fail(0, MODBUS_TRANSACTION_TIMEOUT);
+        transport.poll();
+        inner.answer(1, 2, 2);
+        transport.poll();
+        TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_TIMEOUT);
+        TEST_CHECK(reads[1].txn.status == MODBUS_TRANSACTION_TIMEOUT);
+        TEST_CHECK(ownFrame(reads[2]));
+    }
+
+    // A frame of another slave, or a short one, is never sliced
+    for (uint8_t stray = 0; stray < 2; stray++) {
+        ScriptedTransport inner;
+        ModbusCoalescingTransport transport(inner);
+        Read reads[2];
+        submit(transport, reads[0], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+        submit(transport, reads[1], 1, MODBUS_READ_INPUT_REGISTERS, 0x0004, 4);
+        transport.poll();
+        if (stray == 0) {
+            inner.answer(0, 7, 8);
+        } else {
+            inner.answer(0, 1, 3);
+        }
+        transport.poll();
+        printf("partial: %s answer gives statuses %u %u\n", stray == 0 ? "foreign" : "short",
+               reads[0].txn.status, reads[1].txn.status);
+        TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_FAILED && reads[0].txn.responseLength == 0);
+        TEST_CHECK(reads[1].txn.status == MODBUS_TRANSACTION_FAILED && reads[1].txn.responseLength == 0);
+    }
+
+    // A waiter whose buffer cannot hold its frame fails alone
+    {
+        ScriptedTransport inner;
+        ModbusCoalescingTransport transport(inner);
+        Read reads[2];
+        submit(transport, reads[0], 1, MODBUS_READ_INPUT_REGISTERS, 0x0000, 2);
+        submit(transport, reads[1], 1, MODBUS_READ_INPUT_REGISTERS, 0x0002, 4, modbusReadResponseLength(4) - 1);
+        transport.poll();
+        inner.answer(0, 1, 6);
+        transport.poll();
+        TEST_CHECK(ownFrame(reads[0]));
+        TEST_CHECK(reads[1].txn.status == MODBUS_TRANSACTION_FAILED);
+    }
+}
+
+/**
+ * @brief Writes and priority reads keep their order against queued reads
+ */
+static void testOrdering() {
+    ScriptedTransport inner;
+    ModbusCoalescingTransport transport(inner);
+    Read reads[3];
+    completions = 0;
+
+    submit(transport, reads[0], 1, MODBUS_READ_HOLDING_REGISTERS, 0x0000, 2);
+    uint8_t write[8];
+    uint8_t writeResponse[8];
+    write[0] = 1;
+    write[1] = MODBUS_WRITE_SINGLE_REGISTER;
+    write[2] = 0x00;
+    write[3] = 0x01;
+    write[4] = 0x00;
+    write[5] = 0x64;
+    uint16_t crc = modbusCRC16(write, 6);
+    write[6] = crc & 0xFF;
+    write[7] = crc >> 8;
+    ModbusTransaction writeTxn;
+    writeTxn.prepare(write, sizeof(write), writeResponse, sizeof(writeResponse), 8, READ_TIMEOUT_MS);
+    TEST_CHECK(transport.submit(&writeTxn));
+    // Submitted after the write: must not be served by the read queued before it
+    submit(transport, reads[1], 1, MODBUS_READ_HOLDING_REGISTERS, 0x0000, 2);
+    // A priority read is not held behind a background one: it goes first, on its own
+    submit(transport, reads[2], 1, MODBUS_READ_HOLDING_REGISTERS, 0x0002, 2, 0, true);
+    transport.poll();
+
+    uint8_t answered = 0;
+    while (!transport.isIdle() || answered < inner.count) {
+        if (answered < inner.count) {
+            if (inner.submitted[answered] == &writeTxn) {
+                inner.fail(answered, MODBUS_TRANSACTION_OK);
+            } else {
+                inner.answer(answered, inner.submitted[answered]->request[0],
+                             (inner.submitted[answered]->request[4] << 8) | inner.submitted[answered]->request[5]);
+            }
+            answered++;
+        }
+        transport.poll();
+    }
+    printf("ordering: %u requests for 2 reads around a write and a priority read\n", (unsigned)inner.count);
+    TEST_CHECK(inner.count == 4);
+    uint16_t start = 0;
+    uint16_t numRegs = 0;
+    inner.span(0, &start, &numRegs);
+    TEST_CHECK(inner.submitted[0]->priority && start == 0x0002 && numRegs == 2);
+    TEST_CHECK(inner.submitted[2] == &writeTxn);
+    TEST_CHECK(ownFrame(reads[0]) && ownFrame(reads[1]) && ownFrame(reads[2]));
+    TEST_CHECK(reads[2].order < reads[0].order && reads[0].order < reads[1].order);
+    TEST_CHECK(transport.getMergedCount() == 0);
+}
+
+int main() {
+    testMergeSplit();
+    testFanOut();
+    testPartialFailure();
+    testOrdering();
+    return testSummary("test_coalescer");
+}
@@ -0,0 +1,96 @@
+/**
+ * @file test_coldread.cpp
+ * @brief Cold snapshot reads of every model on a simulated RS485 line (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * PZEMColdRead prepares its state and reads a snapshot of a meter of the
+ * simulated line (MockBus.h) through the real ModbusRTUTransport on the
+ * virtual clock:
+ *  - every model completes its first read, which uses the full timeout
+ *    (the 133-byte PZEM-6L24 snapshot is longer than 100 ms at 9600 baud);
+ *  - registers come back in host order, low byte first on the PZEM-6L24;
+ *  - the full timeout grows with the response and shrinks with the rate.
+ *
+ * Usage: test_coldread
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMColdRead.h"
+
+/**
+ * @brief Prepare and read a meter of a model twice, cold then learnt
+ */
+static void testModel(uint8_t model) {
+    const PZEMModelInfo* info = pzemModelInfo(model);
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMColdState state;
+    PZEMColdRead cold(&transport, &state);
+    line.setPresent(1, true);
+
+    TEST_CHECK(cold.prepare(model, 0x01, LINE_BAUD));
+    uint32_t full = cold.getTimeout();
+    uint32_t wireMs = (uint32_t)(modbusReadResponseLength(info->snapshotRegs) * line.byteUs / 1000);
+    TEST_CHECK(full > wireMs + LINE_LATENCY_US / 1000);
+
+    PZEMSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    bool first = cold.read(&snapshot);
+    bool second = cold.read(&snapshot);
+    printf("%s: %u registers, %u ms on the wire, full timeout %u ms, learnt %u ms, reads %d %d\n", info->name,
+           (unsigned)info->snapshotRegs, (unsigned)wireMs, (unsigned)full, (unsigned)cold.getTimeout(), first,
+           second);
+    TEST_CHECK(first && second);
+    TEST_CHECK(snapshot.count == info->snapshotRegs);
+
+    bool decoded = true;
+    for (uint8_t i = 0; i < info->snapshotRegs; i++) {
+        uint16_t value = 1 * 256 + i;
+        decoded = decoded && snapshot.regs[i] == (info->bigEndian ? value : (uint16_t)((value << 8) | (value >> 8)));
+    }
+    TEST_CHECK(decoded);
+    TEST_CHECK(cold.getTimeout() <= full);
+
+    // The holding registers read by prepare() are kept too
+    uint16_t setting = 0;
+    TEST_CHECK(cold.getSetting(0x0000, &setting));
+    TEST_CHECK(setting == (info->bigEndian ? 0x0100 : 0x0001));
+}
+
+/**
+ * @brief The full timeout follows the response length and the baud rate
+ */
+static void testFullTimeout() {
+    MockBus line;
+    ModbusRTUTransport transport(&line);
+    PZEMColdState state;
+    PZEMColdRead cold(&transport, &state);
+    line.setPresent(1, true);
+
+    TEST_CHECK(cold.prepare(PZEM_MODEL_6L24, 0x01, 9600));
+    uint32_t slow = cold.getTimeout();
+    TEST_CHECK(cold.prepare(PZEM_MODEL_004T, 0x01, 9600));
+    uint32_t shortResponse = cold.getTimeout();
+    state.baudrate = 115200;
+    uint32_t fast = cold.getTimeout();
+    printf("full timeout: PZEM-6L24 %u ms, PZEM-004T %u ms, PZEM-004T at 115200 %u ms\n", (unsigned)slow,
+           (unsigned)shortResponse, (unsigned)fast);
+    TEST_CHECK(slow == modbusWireTimeMs(133, 9600) + PZEM_COLD_FULL_TIMEOUT_MS);
+    TEST_CHECK(shortResponse < slow);
+    TEST_CHECK(fast < shortResponse && fast >= PZEM_COLD_FULL_TIMEOUT_MS);
+}
+
+int main() {
+    for (uint8_t model = 0; model < PZEM_MODEL_COUNT; model++) {
+        testModel(model);
+    }
+    testFullTimeout();
+    return testSummary("test_coldread");
+}
@@ -0,0 +1,153 @@
+/**
+ * @file test_coroutine.cpp
+ * @brief Coroutine reads of meters on two simulated RS485 lines (Linux, C++20)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A PZEMExecutor runs one task per line (MockBus.h) over the real
+ * ModbusRTUTransport on the virtual clock:
+ *  - concurrency: the two lines are read at the same time, so a round takes
+ *    as long as the slower line, not the sum of both;
+ *  - results: snapshots and register reads come back in host order, low
+ *    byte first on the PZEM-6L24;
+ *  - failures: a read of a dead meter yields false after its timeout and the
+ *    task goes on;
+ *  - timers: sleep() resumes a task on time;
+ *  - frames: every coroutine frame returns to the pool when its task ends,
+ *    and spawn() fails once the pool is exhausted.
+ *
+ * Usage: test_coroutine
+ */
+
+#include <stdio.h>
+
+#include "HostTest.h"
+#include "MockBus.h"
+#include "ModbusTransport.h"
+#include "PZEMCoroutine.h"
+
+/**
+ * @struct LineResult
+ * @brief What the task of one line saw
+ */
+struct LineResult {
+    uint8_t reads;            ///< Successful snapshots
+    uint8_t failures;         ///< Failed reads
+    uint64_t doneUs;          ///< Virtual time the task ended
+    uint64_t wokeUs;          ///< Virtual time the task woke from its sleep
+    PZEMSnapshot snapshot;    ///< Last snapshot
+};
+
+/**
+ * @brief Read a live and a dead meter of a line, sleep, read the live one again
+ */
+static PZEMTask lineTask(PZEMExecutor& executor, PZEMAsyncMeter& live, PZEMAsyncMeter& dead, LineResult& result) {
+    for (uint8_t round = 0; round < 2; round++) {
+        if (co_await live.readSnapshot(result.snapshot)) {
+            result.reads++;
+        } else {
+            result.failures++;
+        }
+        if (round == 0) {
+            uint16_t regs[2];
+            if (!co_await dead.readInputRegisters(0x0000, 2, regs)) {
+                result.failures++;
+            }
+            uint64_t sleptUs = testNowUs;
+            co_await executor.sleep(500);
+            result.wokeUs = testNowUs - sleptUs;
+        }
+    }
+    result.doneUs = testNowUs;
+}
+
+/**
+ * @brief Wait forever, to hold a frame of the pool
+ */
+static PZEMTask idleTask(PZEMExecutor& executor) {
+    co_await executor.sleep(1000000);
+}
+
+/**
+ * @brief Two lines read concurrently, with a dead meter on each
+ */
+static void testTwoLines() {
+    MockBus lineA;
+    MockBus lineB;
+    ModbusRTUTransport transportA(&lineA);
+    ModbusRTUTransport transportB(&lineB);
+    PZEMExecutor executor;
+    PZEMAsyncMeter single(executor, transportA, 0x01, PZEM_MODEL_004T);
+    PZEMAsyncMeter deadA(executor, transportA, 0x09, PZEM_MODEL_004T);
+    PZEMAsyncMeter threePhase(executor, transportB, 0x02, PZEM_MODEL_6L24);
+    PZEMAsyncMeter deadB(executor, transportB, 0x09, PZEM_MODEL_004T);
+    threePhase.setTimeout(300);  // 64 registers take 139 ms at 9600 baud
+    lineA.setPresent(0x01, true);
+    lineB.setPresent(0x02, true);
+
+    LineResult a = {};
+    LineResult b = {};
+    uint64_t startUs = testNowUs;
+    TEST_CHECK(executor.spawn(lineTask(executor, single, deadA, a)));
+    TEST_CHECK(executor.spawn(lineTask(executor, threePhase, deadB, b)));
+    TEST_CHECK(PZEMFramePool::getUsed() == 2);
+    while (executor.runOnce()) {
+        testAdvance(100);
+    }
+    uint64_t elapsedUs = testNowUs - startUs;
+    uint64_t aUs = a.doneUs - startUs;
+    uint64_t bUs = b.doneUs - startUs;
+    printf("two lines: PZEM-004T line %llu ms, PZEM-6L24 line %llu ms, both %llu ms, slept %llu us\n",
+           (unsigned long long)(aUs / 1000), (unsigned long long)(bUs / 1000),
+           (unsigned long long)(elapsedUs / 1000), (unsigned long long)a.wokeUs);
+
+    TEST_CHECK(a.reads == 2 && a.failures == 1);
+    TEST_CHECK(b.reads == 2 && b.failures == 1);
+    TEST_CHECK(elapsedUs < aUs + bUs - 500000);
+    // Timers run on millis(): a sleep ends within a millisecond of its duration
+    TEST_CHECK(a.wokeUs >= 499000 && a.wokeUs < 502000);
+    TEST_CHECK(b.wokeUs >= 499000 && b.wokeUs < 502000);
+
+    TEST_CHECK(a.snapshot.slaveAddr == 0x01 && a.snapshot.count == pzemModelInfo(PZEM_MODEL_004T)->snapshotRegs);
+    TEST_CHECK(a.snapshot.regs[3] == 0x0103);
+    TEST_CHECK(b.snapshot.slaveAddr == 0x02 && b.snapshot.count == 64);
+    TEST_CHECK(b.snapshot.regs[3] == 0x0302);  // Low byte first on the wire
+    TEST_CHECK(lineA.asked(0x09) == 1 && lineB.asked(0x09) == 1);
+
+    TEST_CHECK(executor.getTaskCount() == 0);
+    TEST_CHECK(PZEMFramePool::getUsed() == 0);
+}
+
+/**
+ * @brief spawn() fails without a free frame and succeeds again once one is back
+ */
+static void testPool() {
+    PZEMExecutor executor;
+    uint8_t spawned = 0;
+    for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+        spawned += executor.spawn(idleTask(executor)) ? 1 : 0;
+    }
+    TEST_CHECK(spawned == PZEM_COROUTINE_POOL_SIZE);
+    TEST_CHECK(!executor.spawn(idleTask(executor)));
+    TEST_CHECK(PZEMFramePool::getUsed() == PZEM_COROUTINE_POOL_SIZE);
+
+    // Sleeping tasks end with the pool full; the next spawn gets a frame back
+    testAdvance(1000000ULL * 1000);
+    while (executor.runOnce()) {
+        testAdvance(1000);
+    }
+    printf("pool: %u frames spawned, %u in use after the tasks ended\n", (unsigned)spawned,
+           (unsigned)PZEMFramePool::getUsed());
+    TEST_CHECK(PZEMFramePool::getUsed() == 0);
+    TEST_CHECK(executor.spawn(idleTask(executor)));
+    testAdvance(1000000ULL * 1000);
+    executor.run();
+    TEST_CHECK(PZEMFramePool::getUsed() == 0);
+}
+
+int main() {
+    testTwoLines();
+    testPool();
+    return testSummary("test_coroutine");
+}
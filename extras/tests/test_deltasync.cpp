@@ -0,0 +1,320 @@
+/**
+ * @file test_deltasync.cpp
+ * @brief Round trips of the delta sync through lossy links (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * An encoder and a decoder exchange messages and acknowledgements through
+ * links that lose a share of them. Every image the decoder hands over must be
+ * the image the encoder sent in that message, and once the links are clean
+ * again both sides must hold the same images. The cases:
+ *  - loss: messages and acknowledgements lost at random;
+ *  - resend: a message decoded twice (deltas skipped, keyframes applied);
+ *  - decoder clear: the decoder forgets everything and asks for keyframes;
+ *  - encoder restart: a new encoder, with a new session and with the same
+ *    one, counting from sequence number 1 again.
+ *
+ * Usage: test_deltasync
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "PZEMDeltaSync.h"
+
+/**
+ * @defgroup TestDeltaSyncConfig test_deltasync Configuration
+ * @{
+ */
+#define SYNC_DEVICES       3     ///< Simulated devices
+#define SYNC_PERIOD_MS     1000  ///< Upload period
+#define SYNC_MESSAGE_SIZE  1024  ///< Message buffer
+#define SYNC_ACK_SIZE      64    ///< Acknowledgement buffer
+/** @} */
+
+static uint32_t rng = 12345;  ///< Random state
+
+static uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/**
+ * @brief Simulated devices, one per model with a wide and a narrow snapshot
+ */
+static PZEMSnapshot devices[SYNC_DEVICES];
+
+/**
+ * @brief Images sent in the message under decode, checked by the callback
+ */
+struct Expected {
+    PZEMSnapshot images[SYNC_DEVICES];  ///< Image of each device in the message
+    bool sent[SYNC_DEVICES];            ///< Device is in the message
+    uint32_t callbacks;                 ///< Images handed over
+    uint32_t keyframes;                 ///< Keyframes among them
+    uint32_t mismatches;                ///< Images that differ from the one sent
+};
+
+static void setupDevices() {
+    static const uint8_t models[SYNC_DEVICES] = {PZEM_MODEL_004T, PZEM_MODEL_6L24, PZEM_MODEL_017};
+    memset(devices, 0, sizeof(devices));
+    for (uint8_t i = 0; i < SYNC_DEVICES; i++) {
+        devices[i].slaveAddr = i + 1;
+        devices[i].model = models[i];
+        devices[i].count = pzemModelInfo(models[i])->snapshotRegs;
+        for (uint8_t r = 0; r < devices[i].count; r++) {
+            devices[i].regs[r] = nextRandom() & 0xFFFF;
+        }
+    }
+}
+
+/**
+ * @brief Move a few registers of every device, some by a lot
+ */
+static void stepDevices() {
+    for (uint8_t i = 0; i < SYNC_DEVICES; i++) {
+        for (uint8_t n = 0; n < 4; n++) {
+            uint8_t r = nextRandom() % devices[i].count;
+            uint32_t random = nextRandom();
+            devices[i].regs[r] += (random & 0x100) ? (uint16_t)random : (uint16_t)(random % 7) - 3;
+        }
+        devices[i].timestamp = millis();
+    }
+}
+
+static void onImage(const PZEMDeltaUpdate* update, void* context) {
+    Expected* expected = static_cast<Expected*>(context);
+    uint8_t i = update->snapshot.slaveAddr - 1;
+    expected->callbacks++;
+    expected->keyframes += update->keyframe ? 1 : 0;
+    if (i >= SYNC_DEVICES || !expected->sent[i] || update->snapshot.count != expected->images[i].count ||
+        memcmp(update->snapshot.regs, expected->images[i].regs, update->snapshot.count * sizeof(uint16_t)) != 0) {
+        expected->mismatches++;
+    }
+}
+
+/**
+ * @brief One upload period: new readings, a message and its acknowledgement
+ * @param messageLoss Share of messages lost, in percent
+ * @param ackLoss Share of acknowledgements lost, in percent
+ * @return true if the message reached the decoder
+ */
+static bool exchange(PZEMDeltaEncoder& encoder, PZEMDeltaDecoder& decoder, Expected& expected,
+                     uint32_t messageLoss, uint32_t ackLoss) {
+    uint8_t message[SYNC_MESSAGE_SIZE];
+    uint8_t ack[SYNC_ACK_SIZE];
+
+    testAdvance((uint64_t)SYNC_PERIOD_MS * 1000);
+    stepDevices();
+    for (uint8_t i = 0; i < SYNC_DEVICES; i++) {
+        TEST_CHECK(encoder.update(&devices[i]));
+        expected.images[i] = devices[i];
+        expected.sent[i] = true;
+    }
+    uint32_t length = encoder.encode(message, sizeof(message), 1700000000UL + millis() / 1000);
+    TEST_CHECK(length > 0);
+    if (nextRandom() % 100 < messageLoss) {
+        return false;
+    }
+    TEST_CHECK(decoder.decode(message, length));
+    uint32_t ackLength = decoder.buildAck(ack, sizeof(ack));
+    TEST_CHECK(ackLength > 0);
+    if (nextRandom() % 100 >= ackLoss) {
+        TEST_CHECK(encoder.applyAck(ack, ackLength));
+    }
+    return true;
+}
+
+/**
+ * @brief Check that the decoder holds the latest image of every device
+ */
+static bool converged(const PZEMDeltaDecoder& decoder) {
+    for (uint8_t i = 0; i < SYNC_DEVICES; i++) {
+        PZEMSnapshot image;
+        if (!decoder.getImage(devices[i].slaveAddr, &image, NULL) || image.count != devices[i].count ||
+            memcmp(image.regs, devices[i].regs, image.count * sizeof(uint16_t)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Run clean rounds until both sides agree and deltas flow again
+ * @return Rounds needed, or 0 if they did not agree within 10 rounds
+ */
+static uint32_t settle(PZEMDeltaEncoder& encoder, PZEMDeltaDecoder& decoder, Expected& expected) {
+    for (uint32_t n = 1; n <= 10; n++) {
+        PZEMDeltaStats before, after;
+        encoder.getStats(&before);
+        exchange(encoder, decoder, expected, 0, 0);
+        encoder.getStats(&after);
+        if (converged(decoder) && after.deltas - before.deltas == SYNC_DEVICES) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void testLoss() {
+    PZEMDeltaEncoder encoder;
+    PZEMDeltaDecoder decoder;
+    Expected expected;
+    memset(&expected, 0, sizeof(expected));
+    decoder.setCallback(onImage, &expected);
+    setupDevices();
+
+    uint32_t delivered = 0;
+    for (uint32_t n = 0; n < 2000; n++) {
+        delivered += exchange(encoder, decoder, expected, 30, 30) ? 1 : 0;
+    }
+    PZEMDeltaStats stats;
+    encoder.getStats(&stats);
+    printf("loss: %u of 2000 messages delivered, %u images, %u keyframes, %u missing bases, %u bytes for %u raw\n",
+           (unsigned)delivered, (unsigned)expected.callbacks, (unsigned)expected.keyframes,
+           (unsigned)decoder.getMissingBases(), (unsigned)stats.bytes, (unsigned)stats.rawBytes);
+    TEST_CHECK(expected.mismatches == 0);
+    TEST_CHECK(expected.callbacks > 0);
+    TEST_CHECK(stats.deltas > stats.keyframes);
+    TEST_CHECK(stats.bytes < stats.rawBytes * 2 / 3);
+    TEST_CHECK(settle(encoder, decoder, expected) > 0);
+    TEST_CHECK(expected.mismatches == 0);
+}
+
+static void testResend() {
+    PZEMDeltaEncoder encoder;
+    PZEMDeltaDecoder decoder;
+    Expected expected;
+    memset(&expected, 0, sizeof(expected));
+    decoder.setCallback(onImage, &expected);
+    setupDevices();
+    TEST_CHECK(settle(encoder, decoder, expected) > 0);
+
+    // A delta message decoded twice: applied once
+    uint8_t message[SYNC_MESSAGE_SIZE];
+    stepDevices();
+    for (uint8_t i = 0; i < SYNC_DEVICES; i++) {
+        encoder.update(&devices[i]);
+        expected.images[i] = devices[i];
+    }
+    uint32_t length = encoder.encode(message, sizeof(message));
+    uint32_t callbacks = expected.callbacks;
+    TEST_CHECK(decoder.decode(message, length));
+    TEST_CHECK(expected.callbacks == callbacks + SYNC_DEVICES);
+    TEST_CHECK(decoder.decode(message, length));
+    TEST_CHECK(expected.callbacks == callbacks + SYNC_DEVICES);
+
+    // A keyframe message decoded twice: applied twice
+    encoder.requestKeyframe(0);
+    length = encoder.encode(message, sizeof(message));
+    callbacks = expected.callbacks;
+    TEST_CHECK(decoder.decode(message, length));
+    TEST_CHECK(decoder.decode(message, length));
+    TEST_CHECK(expected.callbacks == callbacks + 2 * SYNC_DEVICES);
+    TEST_CHECK(expected.mismatches == 0);
+    TEST_CHECK(converged(decoder));
+}
+
+static void testDecoderClear() {
+    PZEMDeltaEncoder encoder;
+    PZEMDeltaDecoder decoder;
+    Expected expected;
+    memset(&expected, 0, sizeof(expected));
+    decoder.setCallback(onImage, &expected);
+    setupDevices();
+    TEST_CHECK(settle(encoder, decoder, expected) > 0);
+
+    decoder.clear();
+    uint32_t missing = decoder.getMissingBases();
+    uint32_t callbacks = expected.callbacks;
+    exchange(encoder, decoder, expected, 0, 0);
+    TEST_CHECK(decoder.getMissingBases() == missing + SYNC_DEVICES);
+    TEST_CHECK(expected.callbacks == callbacks);
+
+    PZEMDeltaStats stats;
+    encoder.getStats(&stats);
+    TEST_CHECK(stats.keyframeRequests == SYNC_DEVICES);
+    exchange(encoder, decoder, expected, 0, 0);
+    TEST_CHECK(expected.keyframes >= 2 * SYNC_DEVICES);
+    TEST_CHECK(converged(decoder));
+    TEST_CHECK(settle(encoder, decoder, expected) > 0);
+    TEST_CHECK(expected.mismatches == 0);
+}
+
+/**
+ * @brief Restart the encoder once the decoder is well past sequence number 1
+ * @param sameSession true to restart with the session of the previous encoder
+ */
+static void testEncoderRestart(bool sameSession) {
+    PZEMDeltaEncoder* encoder = new PZEMDeltaEncoder();
+    PZEMDeltaDecoder decoder;
+    Expected expected;
+    memset(&expected, 0, sizeof(expected));
+    decoder.setCallback(onImage, &expected);
+    setupDevices();
+    for (uint32_t n = 0; n < 50; n++) {
+        exchange(*encoder, decoder, expected, 0, 0);
+    }
+    uint32_t seq = 0;
+    PZEMSnapshot image;
+    TEST_CHECK(decoder.getImage(1, &image, &seq) && seq == 50);
+    uint32_t session = encoder->getSession();
+    TEST_CHECK(session != 0);
+
+    // An acknowledgement of the old encoder, still on its way
+    uint8_t oldAck[SYNC_ACK_SIZE];
+    stepDevices();
+    encoder->update(&devices[0]);
+    expected.images[0] = devices[0];
+    uint8_t message[SYNC_MESSAGE_SIZE];
+    uint32_t length = encoder->encode(message, sizeof(message));
+    TEST_CHECK(decoder.decode(message, length));
+    uint32_t oldAckLength = decoder.buildAck(oldAck, sizeof(oldAck));
+    delete encoder;
+
+    encoder = new PZEMDeltaEncoder();
+    testAdvance(1234);
+    if (sameSession) {
+        encoder->setSession(session);
+    }
+    exchange(*encoder, decoder, expected, 0, 0);
+    TEST_CHECK(sameSession ? encoder->getSession() == session : encoder->getSession() != session);
+    TEST_CHECK(decoder.getImage(1, &image, &seq) && seq == 1);
+    TEST_CHECK(converged(decoder));
+
+    PZEMDeltaStats stats;
+    encoder->getStats(&stats);
+    TEST_CHECK(stats.acks == SYNC_DEVICES);
+    TEST_CHECK(encoder->applyAck(oldAck, oldAckLength));
+    PZEMDeltaStats after;
+    encoder->getStats(&after);
+    if (!sameSession) {
+        TEST_CHECK(after.staleAcks == stats.staleAcks + 1);
+        TEST_CHECK(after.acks == stats.acks);
+    }
+
+    TEST_CHECK(settle(*encoder, decoder, expected) > 0);
+    TEST_CHECK(decoder.getImage(1, &image, &seq) && seq < 50);
+    TEST_CHECK(expected.mismatches == 0);
+
+    // clear() starts a new session of its own
+    session = encoder->getSession();
+    encoder->clear();
+    TEST_CHECK(encoder->getSession() != session);
+    TEST_CHECK(settle(*encoder, decoder, expected) > 0);
+    TEST_CHECK(expected.mismatches == 0);
+    delete encoder;
+}
+
+int main() {
+    testLoss();
+    testResend();
+    testDecoderClear();
+    testEncoderRestart(false);
+    testEncoderRestart(true);
+    return testSummary("test_deltasync");
+}
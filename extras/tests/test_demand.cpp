@@ -0,0 +1,71 @@
+/**
+ * @file test_demand.cpp
+ * @brief Group demand of members sampled at different times (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Two meters forward to a group meter, one sampled every second, the other
+ * every 3 s and ahead of it by 2.5 s, so their spans reach the group out of
+ * order across sub-interval ends. With every meter aligned on the same wall
+ * clock, the group demand must be the sum of the member demands after every
+ * sub-interval, and its peak the highest such sum.
+ *
+ * Usage: test_demand
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "HostTest.h"
+#include "PZEMDemand.h"
+
+/**
+ * @brief Power of the first member: steps every 10 s, on sub-interval ends
+ */
+static float powerA(uint32_t timestamp) {
+    return (timestamp / 10000) % 2 ? 1000 : 0;
+}
+
+/**
+ * @brief Power of the second member: steps every 7 s, within sub-intervals
+ */
+static float powerB(uint32_t timestamp) {
+    return (timestamp / 7000) % 3 ? 500 : 2000 + timestamp / 1000;
+}
+
+int main() {
+    PZEMDemandMeter a, b, site;
+    PZEMDemandMeter* meters[] = {&a, &b, &site};
+    for (uint8_t i = 0; i < 3; i++) {
+        TEST_CHECK(meters[i]->setWindow(60, 6));
+        meters[i]->setClock(1700000000UL);
+    }
+    a.setGroup(&site);
+    b.setGroup(&site);
+
+    uint32_t compared = 0;
+    float worst = 0, highest = 0;
+    for (uint32_t t = 0; t < 600000; t += 1000) {
+        a.addPower(powerA(t), t);
+        if (t % 3000 == 0) {
+            b.addPower(powerB(t + 2500), t + 2500);
+        }
+        // Midway through a sub-interval both members have closed the previous one
+        if (t % 10000 == 5000 && !isnan(a.getDemand()) && !isnan(b.getDemand())) {
+            float sum = a.getDemand() + b.getDemand();
+            worst = fmaxf(worst, fabsf(site.getDemand() - sum));
+            highest = fmaxf(highest, sum);
+            compared++;
+        }
+    }
+
+    PZEMDemandPeak peak;
+    TEST_CHECK(site.getPeak(&peak));
+    printf("%u windows, largest difference %.3f W, peak %.1f W (members %.1f W)\n", (unsigned)compared, worst,
+           peak.demand, highest);
+    TEST_CHECK(compared > 50);
+    TEST_CHECK(worst < 0.01f);
+    TEST_CHECK(fabsf(peak.demand - highest) < 0.01f);
+    return testSummary("test_demand");
+}
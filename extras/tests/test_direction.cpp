@@ -0,0 +1,277 @@
+/**
+ * @file test_direction.cpp
+ * @brief DE and /RE edges of the direction-control strategies (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A simulated UART times every byte on the wire at the line speed and a
+ * simulated meter answers each request after a fixed latency. The pin edges
+ * recorded on the virtual clock are checked against the first start bit and
+ * the last stop bit of the request:
+ *  - the driver is enabled (and, with split pins, the receiver disabled)
+ *    before the first start bit;
+ *  - the driver is released and the receiver enabled no earlier than the last
+ *    stop bit, and before the first start bit of the response;
+ *  - with split pins, DE goes inactive before /RE goes active.
+ * Two flush() behaviours are simulated: returning after the last stop bit
+ * (AVR, ESP32) and returning once the FIFO is empty, one character early
+ * (ESP8266), where only the guard time keeps the last byte whole.
+ *
+ * Usage: test_direction
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "ModbusDirection.h"
+#include "ModbusProtocol.h"
+#include "ModbusTransport.h"
+
+/**
+ * @defgroup TestDirectionConfig test_direction Configuration
+ * @{
+ */
+#define LINE_BAUD          9600  ///< Line speed
+#define LINE_BITS          11    ///< Start, 8 data bits, 2 stop bits
+#define LINE_LATENCY_US    1500  ///< Meter response latency after the last stop bit of the request
+#define PIN_DE             4     ///< Driver enable (or DE and /RE tied)
+#define PIN_RE             5     ///< Receiver enable (split pins)
+/** @} */
+
+/**
+ * @brief What flush() waits for
+ */
+enum FlushMode {
+    FLUSH_STOP_BIT,   ///< The last stop bit is out (AVR, ESP32)
+    FLUSH_FIFO        ///< The FIFO is empty, the last character still shifting out (ESP8266)
+};
+
+/**
+ * @class MockLine
+ * @brief UART whose bytes take their time on the wire, with a meter answering reads
+ */
+class MockLine : public Stream {
+public:
+    FlushMode flushMode;      ///< flush() behaviour
+    uint32_t byteUs;          ///< Time of one character on the wire
+    uint64_t txStartUs;       ///< First start bit of the last request
+    uint64_t txEndUs;         ///< Last stop bit of the last request
+    uint64_t rxStartUs;       ///< First start bit of the last response (0: none)
+
+    MockLine() : flushMode(FLUSH_STOP_BIT), byteUs(1000000UL * LINE_BITS / LINE_BAUD), txStartUs(0), txEndUs(0),
+                 rxStartUs(0), _requestLength(0), _responseLength(0), _responseRead(0) {}
+
+    size_t write(uint8_t byte) {
+        if (txEndUs <= testNowUs) {
+            txStartUs = testNowUs;
+            txEndUs = testNowUs;
+            _requestLength = 0;
+        }
+        txEndUs += byteUs;
+        if (_requestLength < sizeof(_request)) {
+            _request[_requestLength++] = byte;
+        }
+        if (_requestLength == 8) {
+            answer();
+        }
+        return 1;
+    }
+
+    void flush() {
+        uint64_t until = flushMode == FLUSH_STOP_BIT ? txEndUs : txEndUs - byteUs;
+        if (testNowUs < until) {
+            testNowUs = until;
+        }
+    }
+
+    int available() {
+        uint32_t arrived = 0;
+        while (_responseRead + arrived < _responseLength &&
+               rxStartUs + (uint64_t)(_responseRead + arrived + 1) * byteUs <= testNowUs) {
+            arrived++;
+        }
+        return arrived;
+    }
+
+    int read() {
+        if (available() == 0) {
+            return -1;
+        }
+        return _response[_responseRead++];
+    }
+
+    int peek() {
+        return available() > 0 ? _response[_responseRead] : -1;
+    }
+
+private:
+    uint8_t _request[8];      ///< Request being written
+    uint8_t _requestLength;   ///< Bytes of the request
+    uint8_t _response[32];    ///< Response of the meter
+    uint8_t _responseLength;  ///< Bytes of the response
+    uint8_t _responseRead;    ///< Response bytes read
+
+    /**
+     * @brief Answer a read of input registers with the register numbers
+     */
+    void answer() {
+        uint16_t count = (_request[4] << 8) | _request[5];
+        _response[0] = _request[0];
+        _response[1] = _request[1];
+        _response[2] = count * 2;
+        for (uint16_t i = 0; i < count; i++) {
+            _response[3 + i * 2] = 0;
+            _response[4 + i * 2] = i;
+        }
+        _responseLength = modbusReadResponseLength(count);
+        uint16_t crc = modbusCRC16(_response, _responseLength - 2);
+        _response[_responseLength - 2] = crc & 0xFF;
+        _response[_responseLength - 1] = crc >> 8;
+        _responseRead = 0;
+        rxStartUs = txEndUs + LINE_LATENCY_US;
+    }
+};
+
+/**
+ * @brief Time of the last edge of a pin to a level
+ * @return Edge time, or UINT64_MAX if there is none
+ */
+static uint64_t edgeAt(uint8_t pin, uint8_t level) {
+    uint64_t at = UINT64_MAX;
+    for (size_t i = 0; i < testPinEdges.size(); i++) {
+        const TestPinEdge& edge = testPinEdges[i];
+        if (edge.pin == pin && edge.level == level) {
+            at = edge.atUs;
+        }
+    }
+    return at;
+}
+
+/**
+ * @brief Index of the last edge of a pin to a level
+ */
+static int edgeIndex(uint8_t pin, uint8_t level) {
+    int index = -1;
+    for (size_t i = 0; i < testPinEdges.size(); i++) {
+        if (testPinEdges[i].pin == pin && testPinEdges[i].level == level) {
+            index = (int)i;
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief Read four registers through the transport
+ * @return true if the response was received whole
+ */
+static bool readOnce(ModbusRTUTransport& transport, MockLine& line) {
+    uint8_t request[8];
+    uint8_t response[32];
+    ModbusTransaction txn;
+    modbusBuildReadRequest(request, 0x01, MODBUS_READ_INPUT_REGISTERS, 0x0000, 4);
+    txn.prepare(request, sizeof(request), response, sizeof(response), modbusReadResponseLength(4), 100);
+    testAdvance(5000);
+    testPinEdges.clear();
+    bool ok = transport.execute(&txn);
+    printf("  request %llu-%llu us, response from %llu us\n", (unsigned long long)line.txStartUs,
+           (unsigned long long)line.txEndUs, (unsigned long long)line.rxStartUs);
+    return ok;
+}
+
+/**
+ * @brief One pin driving DE and /RE
+ * @param level Level enabling the driver
+ * @param mode flush() behaviour
+ * @param guardUs Guard time after flush()
+ * @param lastByteKept true if the pin must switch after the last stop bit
+ */
+static void testGPIO(uint8_t level, FlushMode mode, uint32_t guardUs, bool lastByteKept) {
+    MockLine line;
+    line.flushMode = mode;
+    ModbusRTUTransport transport(&line);
+    ModbusGPIODirection direction(PIN_DE, level, guardUs);
+    direction.begin();
+    transport.setDirectionControl(&direction);
+    printf("gpio: level %s, flush %s, guard %u us\n", level == HIGH ? "high" : "low",
+           mode == FLUSH_STOP_BIT ? "after the stop bit" : "on empty FIFO", (unsigned)guardUs);
+
+    TEST_CHECK(readOnce(transport, line));
+    uint64_t enabled = edgeAt(PIN_DE, level);
+    uint64_t released = edgeAt(PIN_DE, !level);
+    printf("  receive %+lld us from the last stop bit\n", (long long)(released - line.txEndUs));
+    TEST_CHECK(enabled <= line.txStartUs);
+    TEST_CHECK(released < line.rxStartUs);
+    TEST_CHECK(edgeIndex(PIN_DE, level) < edgeIndex(PIN_DE, !level));
+    if (lastByteKept) {
+        TEST_CHECK(released >= line.txEndUs);
+        TEST_CHECK(released <= line.txEndUs + guardUs + TEST_YIELD_US);
+    } else {
+        // flush() returned with the last character still on the wire: it is cut
+        TEST_CHECK(released < line.txEndUs);
+    }
+}
+
+/**
+ * @brief setEnable() with its default guard time
+ *
+ * The pin shim of sketches written before the strategies: its guard must
+ * keep the last byte whole where flush() returns early.
+ */
+static void testEnable() {
+    MockLine line;
+    line.flushMode = FLUSH_FIFO;
+    ModbusRTUTransport transport(&line);
+    transport.setEnable(PIN_DE);
+    printf("setEnable: flush on empty FIFO, guard %u us\n", (unsigned)MODBUS_RTU_ENABLE_GUARD_US);
+
+    TEST_CHECK(readOnce(transport, line));
+    uint64_t released = edgeAt(PIN_DE, LOW);
+    printf("  receive %+lld us from the last stop bit\n", (long long)(released - line.txEndUs));
+    TEST_CHECK(released >= line.txEndUs);
+    TEST_CHECK(released < line.rxStartUs);
+}
+
+/**
+ * @brief Separate DE and /RE pins
+ * @param mode flush() behaviour
+ * @param guardUs Guard time after flush()
+ */
+static void testSplit(FlushMode mode, uint32_t guardUs) {
+    MockLine line;
+    line.flushMode = mode;
+    ModbusRTUTransport transport(&line);
+    ModbusSplitDirection direction(PIN_DE, PIN_RE, HIGH, LOW, guardUs);
+    direction.begin();
+    transport.setDirectionControl(&direction);
+    printf("split: flush %s, guard %u us\n", mode == FLUSH_STOP_BIT ? "after the stop bit" : "on empty FIFO",
+           (unsigned)guardUs);
+
+    TEST_CHECK(readOnce(transport, line));
+    TEST_CHECK(edgeAt(PIN_RE, HIGH) <= line.txStartUs);
+    TEST_CHECK(edgeAt(PIN_DE, HIGH) <= line.txStartUs);
+    TEST_CHECK(edgeIndex(PIN_RE, HIGH) < edgeIndex(PIN_DE, HIGH));
+
+    uint64_t released = edgeAt(PIN_DE, LOW);
+    uint64_t listening = edgeAt(PIN_RE, LOW);
+    printf("  DE off %+lld us, /RE on %+lld us from the last stop bit\n", (long long)(released - line.txEndUs),
+           (long long)(listening - line.txEndUs));
+    TEST_CHECK(released >= line.txEndUs);
+    TEST_CHECK(listening >= released);
+    TEST_CHECK(edgeIndex(PIN_DE, LOW) < edgeIndex(PIN_RE, LOW));
+    TEST_CHECK(listening < line.rxStartUs);
+    TEST_CHECK(listening <= line.txEndUs + guardUs + TEST_YIELD_US);
+}
+
+int main() {
+    uint32_t characterUs = 1000000UL * LINE_BITS / LINE_BAUD;
+    testGPIO(HIGH, FLUSH_STOP_BIT, 0, true);
+    testGPIO(LOW, FLUSH_STOP_BIT, 0, true);
+    testGPIO(HIGH, FLUSH_FIFO, 0, false);
+    testGPIO(HIGH, FLUSH_FIFO, characterUs, true);
+    testEnable();
+    testSplit(FLUSH_STOP_BIT, 0);
+    testSplit(FLUSH_FIFO, characterUs);
+    return testSummary("test_direction");
+}
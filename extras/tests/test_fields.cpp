@@ -0,0 +1,59 @@
+/**
+ * @file test_fields.cpp
+ * @brief Units of the named fields shared by several models (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * pzemctl and pzemd print a field of every model in one column, and pzemarrow
+ * documents energy in Wh, so a field name must mean the same unit whatever
+ * the model. Each energy register is decoded from a known raw count and
+ * compared with the watt-hours that count stands for on the model (1 Wh per
+ * LSB, 0.1 kWh on the PZEM-6L24).
+ *
+ * Usage: test_fields
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "HostTest.h"
+#include "PZEMFields.h"
+
+/**
+ * @brief Energy register resolution of each model, in Wh per LSB (datasheets)
+ */
+static const double ENERGY_WH_PER_LSB[PZEM_MODEL_COUNT] = {
+    1.0,    // PZEM-004T
+    1.0,    // PZEM-003
+    1.0,    // PZEM-017
+    100.0,  // PZEM-6L24 (0.1 kWh)
+};
+
+int main() {
+    uint8_t count;
+    const PZEMField* table = pzemFieldTable(&count);
+    uint8_t energyRows = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        const PZEMField* field = &table[i];
+        if (strcmp(field->name, "energy") != 0) {
+            continue;
+        }
+        energyRows++;
+        PZEMSnapshot snapshot;
+        memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.model = field->model;
+        snapshot.count = pzemModelInfo(field->model)->snapshotRegs;
+        snapshot.regs[field->reg] = 12345;  // 12345 LSB, low word first
+        snapshot.regs[field->reg + 1] = 1;
+        double raw = 65536.0 + 12345;
+        double wh = pzemFieldValue(field, &snapshot);
+        printf("%s energy: %.0f LSB -> %.1f Wh\n", pzemModelInfo(field->model)->name, raw, wh);
+        TEST_CHECK(fabs(wh - raw * ENERGY_WH_PER_LSB[field->model]) < 0.5);
+        // Whole watt-hours: no decimals in the shared column
+        TEST_CHECK(field->decimals == 0);
+    }
+    TEST_CHECK(energyRows == PZEM_MODEL_COUNT);
+    return testSummary("test_fields");
+}
@@ -0,0 +1,558 @@
+/**
+ * @file test_tcp.cpp
+ * @brief Modbus-TCP and RTU-over-TCP transports against a simulated gateway (Linux)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A Client stands in for the network: its server end is a gateway holding
+ * eight PZEM devices with the register spans of their models, as pzemsim
+ * does, answering each request after a latency of its own on the virtual
+ * clock. Register r of device a holds (a << 8) | r, so every response is
+ * checked against its own request. The cases:
+ *  - pipelining: eight reads in flight at once, answered in reverse order,
+ *    each one completed with its own reply, in one round trip instead of eight;
+ *  - timeouts: an unanswered request times out alone, and a reply arriving
+ *    after its request timed out is not taken for the next request;
+ *  - unit ID: a reply from another unit fails the transaction;
+ *  - reconnect: a connection lost with requests in flight fails them, the
+ *    next request reconnects, and a refused connection fails the queue;
+ *  - RTU over TCP: the same reads through a transparent gateway, with the
+ *    connection opened on demand and reopened once lost, a lost reply timing
+ *    out and a corrupted one reported as a CRC error.
+ *
+ * Usage: test_tcp
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "HostTest.h"
+#include "Client.h"
+#include "ModbusProtocol.h"
+#include "ModbusTransport.h"
+#include "PZEMModel.h"
+
+/**
+ * @defgroup TestTcpConfig test_tcp Configuration
+ * @{
+ */
+#define GATEWAY_DEVICES      8    ///< Devices behind the gateway, addresses 1 to 8
+#define GATEWAY_LATENCY_MS   20   ///< Round trip of a request through the gateway
+#define GATEWAY_LATE_MS      150  ///< Latency of a reply sent late on purpose
+#define READ_TIMEOUT_MS      100  ///< Timeout of every read
+/** @} */
+
+/**
+ * @brief Framing spoken by the gateway
+ */
+enum Framing {
+    FRAMING_MBAP,     ///< Modbus-TCP
+    FRAMING_RTU       ///< RTU frames passed through unchanged
+};
+
+/**
+ * @struct GatewayReply
+ * @brief One reply on its way back
+ */
+struct GatewayReply {
+    uint64_t dueUs;               ///< Time the reply reaches the client
+    std::vector<uint8_t> bytes;   ///< Reply frame
+};
+
+/**
+ * @class Gateway
+ * @brief Client whose server end is a gateway to eight simulated PZEM devices
+ */
+class Gateway : public Client {
+public:
+    Framing framing;          ///< Framing of requests and replies
+    bool listening;           ///< Accept connections
+    uint32_t spreadMs;        ///< Latency added per place before the eighth request of a burst
+    uint32_t dropNext;        ///< Requests left unanswered
+    uint32_t lateNext;        ///< Requests answered after GATEWAY_LATE_MS
+    uint32_t wrongUnitNext;   ///< Requests answered with another unit ID
+    uint32_t corruptNext;     ///< RTU replies with a bad CRC
+    uint32_t closeAfter;      ///< Requests before the gateway closes the connection (0 = never)
+    uint32_t connects;        ///< Connections accepted
+    uint32_t requests;        ///< Requests received
+    uint32_t maxPending;      ///< Most requests awaiting a reply at once
+
+    Gateway(Framing mode)
+        : framing(mode), listening(true), spreadMs(0), dropNext(0), lateNext(0), wrongUnitNext(0), corruptNext(0),
+          closeAfter(0), connects(0), requests(0), maxPending(0), _open(false) {}
+
+    int connect(IPAddress ip, uint16_t port) {
+        (void)ip;
+        (void)port;
+        if (!listening) {
+            return 0;
+        }
+        _open = true;
+        connects++;
+        _rx.clear();
+        _replies.clear();
+        _out.clear();
+        return 1;
+    }
+
+    int connect(const char* host, uint16_t port) {
+        (void)host;
+        return connect(IPAddress(), port);
+    }
+
+    uint8_t connected() {
+        return _open;
+    }
+
+    void stop() {
+        _open = false;
+        _rx.clear();
+        _replies.clear();
+        _out.clear();
+    }
+
+    operator bool() {
+        return _open;
+    }
+
+    /**
+     * @brief Close the connection from the gateway side
+     */
+    void drop() {
+        stop();
+    }
+
+    size_t write(uint8_t byte) {
+        if (!_open) {
+            return 0;
+        }
+        _rx.push_back(byte);
+        parse();
+        return 1;
+    }
+
+    int available() {
+        // Deliver every reply that is due, earliest first
+        while (true) {
+            size_t next = _replies.size();
+            for (size_t i = 0; i < _replies.size(); i++) {
+                if (_replies[i].dueUs <= testNowUs && (next == _replies.size() || _replies[i].dueUs < _replies[next].dueUs)) {
+                    next = i;
+                }
+            }
+            if (next == _replies.size()) {
+                break;
+            }
+            _out.insert(_out.end(), _replies[next].bytes.begin(), _replies[next].bytes.end());
+            _replies.erase(_replies.begin() + next);
+        }
+        return (int)_out.size();
+    }
+
+    int read() {
+        if (available() == 0) {
+            return -1;
+        }
+        uint8_t byte = _out.front();
+        _out.erase(_out.begin());
+        return byte;
+    }
+
+    int peek() {
+        return available() > 0 ? _out.front() : -1;
+    }
+
+private:
+    bool _open;                           ///< Connection up
+    std::vector<uint8_t> _rx;             ///< Request bytes not parsed yet
+    std::vector<GatewayReply> _replies;   ///< Replies on their way back
+    std::vector<uint8_t> _out;            ///< Reply bytes ready to read
+
+    /**
+     * @brief Take every complete request from the received bytes
+     */
+    void parse() {
+        while (true) {
+            uint16_t headerLength = framing == FRAMING_MBAP ? 6 : 0;
+            if (_rx.size() < (size_t)headerLength + 2) {
+                return;
+            }
+            // Requests are reads: unit ID, function, start and count (+ CRC in RTU)
+            uint16_t length = framing == FRAMING_MBAP ? 6 + ((_rx[4] << 8) | _rx[5]) : 8;
+            if (_rx.size() < length) {
+                return;
+            }
+            std::vector<uint8_t> request(_rx.begin(), _rx.begin() + length);
+            _rx.erase(_rx.begin(), _rx.begin() + length);
+            serve(request);
+            if (!_open) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Queue the reply to one request
+     */
+    void serve(const std::vector<uint8_t>& request) {
+        uint32_t seq = requests++;
+        if (closeAfter > 0 && --closeAfter == 0) {
+            drop();
+            return;
+        }
+        if (dropNext > 0) {
+            dropNext--;
+            return;
+        }
+
+        const uint8_t* pdu = framing == FRAMING_MBAP ? &request[6] : &request[0];
+        uint8_t frame[MODBUS_MAX_ADU_SIZE];
+        uint16_t length = answer(pdu, frame);
+        if (length == 0) {
+            return;
+        }
+        if (wrongUnitNext > 0) {
+            wrongUnitNext--;
+            frame[0] = frame[0] % GATEWAY_DEVICES + 1;
+        }
+
+        GatewayReply reply;
+        uint32_t latencyMs = GATEWAY_LATENCY_MS + spreadMs * (7 - seq % 8);
+        if (lateNext > 0) {
+            lateNext--;
+            latencyMs = GATEWAY_LATE_MS;
+        }
+        reply.dueUs = testNowUs + (uint64_t)latencyMs * 1000;
+        if (framing == FRAMING_MBAP) {
+            reply.bytes.push_back(request[0]);
+            reply.bytes.push_back(request[1]);
+            reply.bytes.push_back(0);
+            reply.bytes.push_back(0);
+            reply.bytes.push_back(length >> 8);
+            reply.bytes.push_back(length & 0xFF);
+            reply.bytes.insert(reply.bytes.end(), frame, frame + length);
+        } else {
+            uint16_t crc = modbusCRC16(frame, length);
+            if (corruptNext > 0) {
+                corruptNext--;
+                crc ^= 0x0101;
+            }
+            reply.bytes.insert(reply.bytes.end(), frame, frame + length);
+            reply.bytes.push_back(crc & 0xFF);
+            reply.bytes.push_back(crc >> 8);
+        }
+        _replies.push_back(reply);
+        if (_replies.size() > maxPending) {
+            maxPending = _replies.size();
+        }
+    }
+
+    /**
+     * @brief Answer a read as a PZEM device would
+     * @param pdu Unit ID (slave address) and PDU of the request
+     * @param frame Buffer receiving unit ID and PDU of the reply
+     * @return Reply length, 0 if no device answers
+     */
+    static uint16_t answer(const uint8_t* pdu, uint8_t* frame) {
+        uint8_t slaveAddr = pdu[0];
+        uint8_t function = pdu[1];
+        if (slaveAddr < 1 || slaveAddr > GATEWAY_DEVICES) {
+            return 0;
+        }
+        const PZEMModelInfo* info = pzemModelInfo(slaveAddr % PZEM_MODEL_COUNT);
+        uint16_t start = (pdu[2] << 8) | pdu[3];
+        uint16_t count = (pdu[4] << 8) | pdu[5];
+        uint16_t span = function == MODBUS_READ_INPUT_REGISTERS ? info->snapshotRegs : info->holdingRegs;
+        frame[0] = slaveAddr;
+        if (function != MODBUS_READ_INPUT_REGISTERS && function != MODBUS_READ_HOLDING_REGISTERS) {
+            frame[1] = function | 0x80;
+            frame[2] = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+            return 3;
+        }
+        if (count == 0 || start + count > span) {
+            frame[1] = function | 0x80;
+            frame[2] = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            return 3;
+        }
+        frame[1] = function;
+        frame[2] = count * 2;
+        for (uint16_t i = 0; i < count; i++) {
+            frame[3 + i * 2] = slaveAddr;
+            frame[4 + i * 2] = start + i;
+        }
+        return 3 + count * 2;
+    }
+};
+
+/**
+ * @struct TestRead
+ * @brief One read and its buffers
+ */
+struct TestRead {
+    uint8_t request[8];               ///< RTU request
+    uint8_t response[MODBUS_MAX_ADU_SIZE];  ///< RTU response
+    ModbusTransaction txn;            ///< Transaction
+    uint8_t order;                    ///< Completion rank (1 = first)
+};
+
+static uint8_t completed = 0;         ///< Reads completed so far
+
+/**
+ * @brief Record the completion rank of a read
+ */
+static void onComplete(ModbusTransaction*, void* context) {
+    ((TestRead*)context)->order = ++completed;
+}
+
+/**
+ * @brief Prepare a read of input registers
+ */
+static void prepareRead(TestRead& read, uint8_t slaveAddr, uint16_t start, uint16_t count) {
+    modbusBuildReadRequest(read.request, slaveAddr, MODBUS_READ_INPUT_REGISTERS, start, count);
+    read.txn.prepare(read.request, sizeof(read.request), read.response, sizeof(read.response),
+                     modbusReadResponseLength(count), READ_TIMEOUT_MS);
+    read.txn.onComplete = onComplete;
+    read.txn.context = &read;
+    read.order = 0;
+}
+
+/**
+ * @brief Check a read completed with the registers of its own device and range
+ */
+static bool readBack(const TestRead& read) {
+    uint8_t slaveAddr = read.request[0];
+    uint16_t start = (read.request[2] << 8) | read.request[3];
+    uint16_t count = (read.request[4] << 8) | read.request[5];
+    if (read.txn.status != MODBUS_TRANSACTION_OK || read.txn.responseLength != modbusReadResponseLength(count) ||
+        read.response[0] != slaveAddr || read.response[2] != count * 2) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (read.response[3 + i * 2] != slaveAddr || read.response[4 + i * 2] != start + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Poll a transport until nothing is queued or in flight
+ * @return Virtual time taken in milliseconds
+ */
+static uint32_t runIdle(ModbusTransport& transport) {
+    uint64_t start = testNowUs;
+    while (!transport.isIdle()) {
+        transport.poll();
+        yield();
+    }
+    return (uint32_t)((testNowUs - start) / 1000);
+}
+
+/**
+ * @brief Eight pipelined reads answered in reverse order
+ */
+static void testPipelined() {
+    Gateway gateway(FRAMING_MBAP);
+    gateway.spreadMs = 5;
+    ModbusTCPTransport transport(gateway, IPAddress(127, 0, 0, 1));
+    TestRead reads[8];
+
+    completed = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        prepareRead(reads[i], i + 1, i % 2, 2);
+        TEST_CHECK(transport.submit(&reads[i].txn));
+    }
+    uint32_t pipelinedMs = runIdle(transport);
+    printf("pipelined: 8 reads in %u ms, %u in flight at most\n", (unsigned)pipelinedMs, (unsigned)gateway.maxPending);
+    TEST_CHECK(gateway.connects == 1);
+    TEST_CHECK(gateway.maxPending == 8);
+    for (uint8_t i = 0; i < 8; i++) {
+        TEST_CHECK(readBack(reads[i]));
+        TEST_CHECK(reads[i].order == 8 - i);
+    }
+    TEST_CHECK(pipelinedMs <= GATEWAY_LATENCY_MS + 7 * gateway.spreadMs + 1);
+
+    // The same burst one request at a time
+    transport.setMaxInFlight(1);
+    gateway.maxPending = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        prepareRead(reads[i], i + 1, 0, 3);
+        TEST_CHECK(transport.submit(&reads[i].txn));
+    }
+    uint32_t serialMs = runIdle(transport);
+    printf("  one at a time: %u ms\n", (unsigned)serialMs);
+    TEST_CHECK(gateway.maxPending == 1);
+    for (uint8_t i = 0; i < 8; i++) {
+        TEST_CHECK(readBack(reads[i]));
+        TEST_CHECK(reads[i].order == 9 + i);
+    }
+    TEST_CHECK(serialMs >= 8 * GATEWAY_LATENCY_MS);
+}
+
+/**
+ * @brief Unanswered requests and late replies
+ */
+static void testTimeouts() {
+    Gateway gateway(FRAMING_MBAP);
+    ModbusTCPTransport transport(gateway, IPAddress(127, 0, 0, 1));
+    TestRead reads[3];
+
+    // The second of three requests is never answered
+    for (uint8_t i = 0; i < 3; i++) {
+        prepareRead(reads[i], i + 1, 0, 2);
+        TEST_CHECK(transport.submit(&reads[i].txn));
+        if (i == 0) {
+            transport.poll();
+            gateway.dropNext = 1;
+        }
+    }
+    uint32_t elapsedMs = runIdle(transport);
+    printf("timeouts: unanswered request done after %u ms\n", (unsigned)elapsedMs);
+    TEST_CHECK(readBack(reads[0]));
+    TEST_CHECK(reads[1].txn.status == MODBUS_TRANSACTION_TIMEOUT);
+    TEST_CHECK(readBack(reads[2]));
+    TEST_CHECK(elapsedMs + 1 >= READ_TIMEOUT_MS);  // Timeouts count whole millis()
+
+    // A reply arriving after its request timed out is dropped, not given to the next request
+    gateway.lateNext = 1;
+    prepareRead(reads[0], 4, 0, 2);
+    TEST_CHECK(transport.submit(&reads[0].txn));
+    runIdle(transport);
+    TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_TIMEOUT);
+    prepareRead(reads[1], 5, 1, 2);
+    TEST_CHECK(transport.submit(&reads[1].txn));
+    runIdle(transport);
+    TEST_CHECK(readBack(reads[1]));
+    TEST_CHECK(gateway.connects == 1);
+}
+
+/**
+ * @brief Replies carrying another unit ID
+ */
+static void testUnitId() {
+    Gateway gateway(FRAMING_MBAP);
+    ModbusTCPTransport transport(gateway, IPAddress(127, 0, 0, 1));
+    TestRead reads[2];
+
+    gateway.wrongUnitNext = 1;
+    prepareRead(reads[0], 3, 0, 2);
+    prepareRead(reads[1], 3, 0, 2);
+    TEST_CHECK(transport.submit(&reads[0].txn));
+    TEST_CHECK(transport.submit(&reads[1].txn));
+    runIdle(transport);
+    printf("unit id: reply from unit 4 to unit 3 -> status %u\n", (unsigned)reads[0].txn.status);
+    TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_FAILED);
+    TEST_CHECK(readBack(reads[1]));
+
+    // Exceptions keep their unit ID and are still reported as such
+    prepareRead(reads[0], 1, 8, 4);
+    TEST_CHECK(transport.submit(&reads[0].txn));
+    runIdle(transport);
+    TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_EXCEPTION);
+    TEST_CHECK(reads[0].response[2] == MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+}
+
+/**
+ * @brief Connections lost and refused
+ */
+static void testReconnect() {
+    Gateway gateway(FRAMING_MBAP);
+    ModbusTCPTransport transport(gateway, IPAddress(127, 0, 0, 1));
+    TestRead reads[4];
+
+    // The gateway closes the connection on the third of four pipelined requests
+    gateway.closeAfter = 3;
+    for (uint8_t i = 0; i < 4; i++) {
+        prepareRead(reads[i], i + 1, 0, 2);
+        TEST_CHECK(transport.submit(&reads[i].txn));
+    }
+    runIdle(transport);
+    for (uint8_t i = 0; i < 4; i++) {
+        TEST_CHECK(reads[i].txn.status == MODBUS_TRANSACTION_FAILED);
+    }
+
+    // The next request opens a new connection
+    prepareRead(reads[0], 2, 0, 2);
+    TEST_CHECK(transport.submit(&reads[0].txn));
+    runIdle(transport);
+    printf("reconnect: %u connections\n", (unsigned)gateway.connects);
+    TEST_CHECK(readBack(reads[0]));
+    TEST_CHECK(gateway.connects == 2);
+
+    // Lost while idle, refused when reopened: the queue fails at once
+    gateway.drop();
+    gateway.listening = false;
+    for (uint8_t i = 0; i < 2; i++) {
+        prepareRead(reads[i], i + 1, 0, 2);
+        TEST_CHECK(transport.submit(&reads[i].txn));
+    }
+    uint32_t elapsedMs = runIdle(transport);
+    TEST_CHECK(reads[0].txn.status == MODBUS_TRANSACTION_FAILED);
+    TEST_CHECK(reads[1].txn.status == MODBUS_TRANSACTION_FAILED);
+    TEST_CHECK(elapsedMs < READ_TIMEOUT_MS);
+
+    gateway.listening = true;
+    prepareRead(reads[0], 1, 0, 2);
+    TEST_CHECK(transport.submit(&reads[0].txn));
+    runIdle(transport);
+    TEST_CHECK(readBack(reads[0]));
+    TEST_CHECK(gateway.connects == 3);
+}
+
+/**
+ * @brief RTU frames through a transparent gateway
+ */
+static void testRTUOverTCP() {
+    Gateway gateway(FRAMING_RTU);
+    ModbusRTUOverTCPTransport transport(gateway, IPAddress(127, 0, 0, 1), 4196);
+    TestRead read;
+
+    prepareRead(read, 1, 0, 4);
+    TEST_CHECK(transport.execute(&read.txn));
+    TEST_CHECK(readBack(read));
+    prepareRead(read, 6, 2, 3);
+    TEST_CHECK(transport.execute(&read.txn));
+    TEST_CHECK(readBack(read));
+    TEST_CHECK(gateway.connects == 1);
+
+    // Reopened once lost
+    gateway.drop();
+    prepareRead(read, 7, 0, 2);
+    TEST_CHECK(transport.execute(&read.txn));
+    TEST_CHECK(readBack(read));
+    printf("rtu over tcp: %u connections\n", (unsigned)gateway.connects);
+    TEST_CHECK(gateway.connects == 2);
+
+    // Lost reply, corrupted reply, then a clean one
+    gateway.dropNext = 1;
+    prepareRead(read, 2, 0, 2);
+    uint64_t start = testNowUs;
+    TEST_CHECK(!transport.execute(&read.txn));
+    TEST_CHECK(read.txn.status == MODBUS_TRANSACTION_TIMEOUT);
+    TEST_CHECK(testNowUs - start >= READ_TIMEOUT_MS * 1000);
+    gateway.corruptNext = 1;
+    prepareRead(read, 2, 0, 2);
+    TEST_CHECK(!transport.execute(&read.txn));
+    TEST_CHECK(read.txn.status == MODBUS_TRANSACTION_CRC_ERROR);
+    prepareRead(read, 2, 0, 2);
+    TEST_CHECK(transport.execute(&read.txn));
+    TEST_CHECK(readBack(read));
+
+    // Refused connection
+    gateway.drop();
+    gateway.listening = false;
+    prepareRead(read, 3, 0, 2);
+    TEST_CHECK(!transport.execute(&read.txn));
+    TEST_CHECK(read.txn.status == MODBUS_TRANSACTION_FAILED);
+}
+
+int main() {
+    testPipelined();
+    testTimeouts();
+    testUnitId();
+    testReconnect();
+    testRTUOverTCP();
+    return testSummary("test_tcp");
+}
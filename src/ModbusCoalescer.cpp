@@ -0,0 +1,259 @@
+/**
+ * @file ModbusCoalescer.cpp
+ * @brief Implementation of the coalescing transport
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "ModbusCoalescer.h"
+
+/**
+ * @brief Constructor for a coalescing transport
+ */
+ModbusCoalescingTransport::ModbusCoalescingTransport(ModbusTransport& inner)
+    : _inner(inner), _queueHead(NULL), _queueTail(NULL), _merged(0) {
+    for (uint8_t i = 0; i < MODBUS_COALESCE_GROUPS; i++) {
+        _groups[i].owner = this;
+        _groups[i].used = false;
+    }
+    for (uint8_t i = 0; i < MODBUS_COALESCE_IN_FLIGHT; i++) {
+        _dispatched[i] = NULL;
+    }
+}
+
+/**
+ * @brief Queue a transaction (non-blocking)
+ */
+bool ModbusCoalescingTransport::submit(ModbusTransaction* txn) {
+    if (txn == NULL || txn->request == NULL || txn->response == NULL || txn->requestLength < 2) {
+        return false;
+    }
+
+    txn->status = MODBUS_TRANSACTION_PENDING;
+    txn->responseLength = 0;
+
+    uint8_t function = txn->function();
+    if ((function == MODBUS_READ_HOLDING_REGISTERS || function == MODBUS_READ_INPUT_REGISTERS) &&
+        txn->requestLength == 8) {
+        uint16_t start = (txn->request[2] << 8) | txn->request[3];
+        uint16_t count = (txn->request[4] << 8) | txn->request[5];
+        if (count > 0 && count <= MODBUS_COALESCE_MAX_REGISTERS && coalesce(txn, start, count)) {
+            return true;
+        }
+    } else {
+        // Reads queued so far must not return values older than this request
+        for (uint8_t i = 0; i < MODBUS_COALESCE_GROUPS; i++) {
+            if (_groups[i].used && _groups[i].slaveAddr == txn->slaveAddr()) {
+                _groups[i].open = false;
+            }
+        }
+    }
+
+    enqueue(_queueHead, _queueTail, txn);
+    return true;
+}
+
+/**
+ * @brief Advance pending transactions (non-blocking)
+ */
+void ModbusCoalescingTransport::poll() {
+    dispatch();
+    _inner.poll();
+    dispatch();
+}
+
+/**
+ * @brief Check whether no transaction is queued or in flight
+ */
+bool ModbusCoalescingTransport::isIdle() const {
+    if (_queueHead != NULL) {
+        return false;
+    }
+    for (uint8_t i = 0; i < MODBUS_COALESCE_IN_FLIGHT; i++) {
+        if (_dispatched[i] != NULL && _dispatched[i]->status == MODBUS_TRANSACTION_PENDING) {
+            return false;
+        }
+    }
+    return _inner.isIdle();
+}
+
+/**
+ * @brief Get number of reads served without a transaction of their own
+ */
+uint32_t ModbusCoalescingTransport::getMergedCount() const {
+    return _merged;
+}
+
+/**
+ * @brief Attach a read to a compatible group, or start a new one
+ */
+bool ModbusCoalescingTransport::coalesce(ModbusTransaction* txn, uint16_t start, uint16_t count) {
+    uint8_t slaveAddr = txn->slaveAddr();
+    uint8_t function = txn->function();
+    uint32_t end = (uint32_t)start + count;
+    Group* free = NULL;
+
+    for (uint8_t i = 0; i < MODBUS_COALESCE_GROUPS; i++) {
+        Group& group = _groups[i];
+        if (!group.used) {
+            if (free == NULL) {
+                free = &group;
+            }
+            continue;
+        }
+        if (!group.open || group.slaveAddr != slaveAddr || group.function != function) {
+            continue;
+        }
+
+        uint32_t groupEnd = (uint32_t)group.start + group.count;
+        uint16_t mergedStart = start < group.start ? start : group.start;
+        uint32_t mergedEnd = end > groupEnd ? end : groupEnd;
+        uint32_t mergedCount = mergedEnd - mergedStart;
+
+        if (group.dispatched) {
+            // The request may already be on the wire: only a covered read can wait for it
+            if (mergedCount != group.count) {
+                continue;
+            }
+        } else {
+            // Extend if the added registers cost less than a transaction of its own,
+            // and never hold a priority request behind a background read
+            uint32_t added = (mergedCount - group.count) * 2;
+            if (mergedCount > MODBUS_COALESCE_MAX_REGISTERS || added > MODBUS_COALESCE_TXN_OVERHEAD + count * 2u ||
+                (txn->priority && !group.txn.priority)) {
+                continue;
+            }
+            group.start = mergedStart;
+            group.count = mergedCount;
+            if (txn->timeout > group.txn.timeout) {
+                group.txn.timeout = txn->timeout;
+            }
+        }
+
+        // Waiters complete in submission order
+        ModbusTransaction** last = &group.waiters;
+        while (*last != NULL) {
+            last = &(*last)->next;
+        }
+        txn->next = NULL;
+        *last = txn;
+        _merged++;
+        return true;
+    }
+
+    if (free == NULL) {
+        return false;
+    }
+
+    free->used = true;
+    free->open = true;
+    free->dispatched = false;
+    free->slaveAddr = slaveAddr;
+    free->function = function;
+    free->start = start;
+    free->count = count;
+    txn->next = NULL;
+    free->waiters = txn;
+    free->txn.timeout = txn->timeout;
+    free->txn.priority = txn->priority;
+    free->txn.request = free->request;
+    free->txn.onComplete = onGroupComplete;
+    free->txn.context = free;
+    enqueue(_queueHead, _queueTail, &free->txn);
+    return true;
+}
+
+/**
+ * @brief Forget finished transactions and hand queued ones to the inner transport
+ */
+void ModbusCoalescingTransport::dispatch() {
+    for (uint8_t i = 0; i < MODBUS_COALESCE_IN_FLIGHT; i++) {
+        if (_dispatched[i] != NULL && _dispatched[i]->status != MODBUS_TRANSACTION_PENDING) {
+            _dispatched[i] = NULL;
+        }
+    }
+
+    for (uint8_t i = 0; i < MODBUS_COALESCE_IN_FLIGHT && _queueHead != NULL; i++) {
+        if (_dispatched[i] != NULL) {
+            continue;
+        }
+        ModbusTransaction* txn = _queueHead;
+        _queueHead = txn->next;
+        if (_queueHead == NULL) {
+            _queueTail = NULL;
+        }
+
+        // The span of a merged read is final once it is handed over
+        if (txn->onComplete == onGroupComplete) {
+            Group* group = static_cast<Group*>(txn->context);
+            group->dispatched = true;
+            modbusBuildReadRequest(group->request, group->slaveAddr, group->function, group->start, group->count);
+            txn->prepare(group->request, sizeof(group->request), group->response, sizeof(group->response),
+                         modbusReadResponseLength(group->count), txn->timeout);
+        }
+
+        _dispatched[i] = txn;
+        if (!_inner.submit(txn)) {
+            _dispatched[i] = NULL;
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+        }
+    }
+}
+
+/**
+ * @brief Merged read completion callback, completes every waiter
+ */
+void ModbusCoalescingTransport::onGroupComplete(ModbusTransaction* txn, void* context) {
+    Group* group = static_cast<Group*>(context);
+    ModbusCoalescingTransport* owner = group->owner;
+
+    // Only the answer to the merged read is sliced: a short frame, or one of another device or function,
+    // would hand out registers of another span or bytes past the end of the response
+    bool matches = txn->responseLength == modbusReadResponseLength(group->count) &&
+                   group->response[0] == group->slaveAddr && group->response[1] == group->function &&
+                   group->response[2] == group->count * 2;
+
+    // Build every response before any callback runs: callbacks may submit new reads and reuse the group
+    for (ModbusTransaction* waiter = group->waiters; waiter != NULL; waiter = waiter->next) {
+        if (txn->status != MODBUS_TRANSACTION_OK) {
+            uint16_t length = txn->responseLength < waiter->responseSize ? txn->responseLength : waiter->responseSize;
+            memcpy(waiter->response, group->response, length);
+            waiter->responseLength = length;
+            waiter->status = txn->status;
+            continue;
+        }
+        if (!matches) {
+            waiter->responseLength = 0;
+            waiter->status = MODBUS_TRANSACTION_FAILED;
+            continue;
+        }
+
+        uint16_t start = (waiter->request[2] << 8) | waiter->request[3];
+        uint16_t count = (waiter->request[4] << 8) | waiter->request[5];
+        uint16_t length = modbusReadResponseLength(count);
+        if (length > waiter->responseSize) {
+            waiter->status = MODBUS_TRANSACTION_FAILED;
+            continue;
+        }
+
+        // The frame the device would have sent for this request alone
+        waiter->response[0] = group->slaveAddr;
+        waiter->response[1] = group->function;
+        waiter->response[2] = count * 2;
+        memcpy(&waiter->response[3], &group->response[3 + (start - group->start) * 2], count * 2);
+        uint16_t crc = modbusCRC16(waiter->response, length - 2);
+        waiter->response[length - 2] = crc & 0xFF;
+        waiter->response[length - 1] = (crc >> 8) & 0xFF;
+        waiter->responseLength = length;
+        waiter->status = MODBUS_TRANSACTION_OK;
+    }
+
+    ModbusTransaction* waiter = group->waiters;
+    group->used = false;
+    group->waiters = NULL;
+    while (waiter != NULL) {
+        ModbusTransaction* next = waiter->next;
+        owner->complete(waiter, waiter->status);
+        waiter = next;
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * @file ModbusCoalescer.h
+ * @brief Transport decorator merging overlapping read requests
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef MODBUSCOALESCER_H
+#define MODBUSCOALESCER_H
+
+#include <Arduino.h>
+#include "ModbusTransport.h"
+
+/**
+ * @defgroup ModbusCoalescerConfig Request Coalescing Configuration
+ * @brief Compile-time sizing of the coalescing transport (override before including)
+ * @{
+ */
+#ifndef MODBUS_COALESCE_GROUPS
+#define MODBUS_COALESCE_GROUPS        4   ///< Merged reads queued or in flight at once
+#endif
+#ifndef MODBUS_COALESCE_MAX_REGISTERS
+#define MODBUS_COALESCE_MAX_REGISTERS 64  ///< Largest merged register span
+#endif
+#ifndef MODBUS_COALESCE_TXN_OVERHEAD
+#define MODBUS_COALESCE_TXN_OVERHEAD  24  ///< Line cost of a separate read besides its data, in bytes
+#endif
+#ifndef MODBUS_COALESCE_IN_FLIGHT
+#define MODBUS_COALESCE_IN_FLIGHT     1   ///< Transactions handed to the inner transport at once
+#endif
+/** @} */
+
+/**
+ * @class ModbusCoalescingTransport
+ * @brief Merges read requests to the same slave into one covering transaction
+ *
+ * Transactions are held in a queue in front of the inner transport and handed
+ * over MODBUS_COALESCE_IN_FLIGHT at a time. A read (function 0x03 or 0x04)
+ * submitted while another read of the same slave and function is waiting is
+ * merged into it when the registers added to the merged span cost fewer bytes
+ * on the line than a separate transaction (MODBUS_COALESCE_TXN_OVERHEAD plus
+ * its data). A read fully covered by a transaction already handed over simply
+ * waits for it. Every waiter is completed from the single response with its
+ * own RTU frame, so callers see no difference.
+ *
+ * Writes and other requests pass through unchanged, in submission order; reads
+ * submitted after a write to a slave are never merged into reads queued before it.
+ *
+ * @note The registers between two merged spans are read as well. This is safe
+ *       on the PZEM register maps, which have no holes.
+ */
+class ModbusCoalescingTransport : public ModbusTransport {
+public:
+    /**
+     * @brief Constructor for a coalescing transport
+     * @param inner Transport carrying the merged transactions
+     */
+    ModbusCoalescingTransport(ModbusTransport& inner);
+
+    bool submit(ModbusTransaction* txn);
+    void poll();
+    bool isIdle() const;
+
+    /**
+     * @brief Get number of reads served without a transaction of their own
+     * @return Merged reads since construction
+     */
+    uint32_t getMergedCount() const;
+
+private:
+    /**
+     * @brief One merged read and the transactions waiting for it
+     */
+    struct Group {
+        ModbusCoalescingTransport* owner;   ///< Owning transport (callback context)
+        bool used;                          ///< Entry in use
+        bool open;                          ///< Still accepts new waiters
+        bool dispatched;                    ///< Handed to the inner transport
+        uint8_t slaveAddr;                  ///< Slave device address
+        uint8_t function;                   ///< Read function code
+        uint16_t start;                     ///< First register of the span
+        uint16_t count;                     ///< Registers in the span
+        ModbusTransaction* waiters;         ///< Transactions served by this read (linked by next)
+        ModbusTransaction txn;              ///< Merged transaction
+        uint8_t request[8];                 ///< Merged request frame
+        uint8_t response[5 + MODBUS_COALESCE_MAX_REGISTERS * 2];  ///< Merged response frame
+    };
+
+    ModbusTransport& _inner;                                ///< Transport carrying the reads
+    Group _groups[MODBUS_COALESCE_GROUPS];                  ///< Merged reads
+    ModbusTransaction* _queueHead;                          ///< First transaction not handed over
+    ModbusTransaction* _queueTail;                          ///< Last transaction not handed over
+    ModbusTransaction* _dispatched[MODBUS_COALESCE_IN_FLIGHT];  ///< Transactions handed over
+    uint32_t _merged;                                       ///< Reads served by another transaction
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Attach a read to a compatible group, or start a new one
+     * @param txn Read transaction
+     * @param start First register requested
+     * @param count Registers requested
+     * @return true if the read joined a group
+     */
+    bool coalesce(ModbusTransaction* txn, uint16_t start, uint16_t count);
+
+    /**
+     * @brief Forget finished transactions and hand queued ones to the inner transport
+     */
+    void dispatch();
+
+    /**
+     * @brief Merged read completion callback, completes every waiter
+     * @param txn Completed merged transaction
+     * @param context Group holding the transaction
+     */
+    static void onGroupComplete(ModbusTransaction* txn, void* context);
+
+    /** @} */
+};
+
+#endif // MODBUSCOALESCER_H
@@ -0,0 +1,93 @@
+/**
+ * @file ModbusDirection.cpp
+ * @brief Implementation of the RS485 direction-control strategies
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "ModbusDirection.h"
+
+/**
+ * @brief Wait for the transmission to complete
+ */
+void ModbusAutoDirection::endTransmit(Stream* serial) {
+    serial->flush();
+}
+
+/**
+ * @brief Constructor for single-pin direction control
+ */
+ModbusGPIODirection::ModbusGPIODirection(uint8_t pin, uint8_t transmitLevel, uint32_t guardUs)
+    : _pin(pin), _transmitLevel(transmitLevel), _guard(guardUs) {
+}
+
+/**
+ * @brief Configure the pin and put the transceiver in receive mode
+ */
+void ModbusGPIODirection::begin() {
+    pinMode(_pin, OUTPUT);
+    digitalWrite(_pin, !_transmitLevel);
+}
+
+/**
+ * @brief Enable the driver
+ */
+void ModbusGPIODirection::beginTransmit() {
+    digitalWrite(_pin, _transmitLevel);
+}
+
+/**
+ * @brief Wait for the last stop bit, then enable the receiver
+ */
+void ModbusGPIODirection::endTransmit(Stream* serial) {
+    serial->flush();
+    if (_guard > 0) {
+        delayMicroseconds(_guard);
+    }
+    digitalWrite(_pin, !_transmitLevel);
+}
+
+/**
+ * @brief Set the extra wait after flush()
+ */
+void ModbusGPIODirection::setGuardTime(uint32_t guardUs) {
+    _guard = guardUs;
+}
+
+/**
+ * @brief Constructor for two-pin direction control
+ */
+ModbusSplitDirection::ModbusSplitDirection(uint8_t dePin, uint8_t rePin, uint8_t deActiveLevel,
+                                           uint8_t reActiveLevel, uint32_t guardUs)
+    : _dePin(dePin), _rePin(rePin), _deActive(deActiveLevel), _reActive(reActiveLevel), _guard(guardUs) {
+}
+
+/**
+ * @brief Configure the pins and put the transceiver in receive mode
+ */
+void ModbusSplitDirection::begin() {
+    pinMode(_dePin, OUTPUT);
+    pinMode(_rePin, OUTPUT);
+    digitalWrite(_dePin, !_deActive);
+    digitalWrite(_rePin, _reActive);
+}
+
+/**
+ * @brief Disable the receiver and enable the driver
+ */
+void ModbusSplitDirection::beginTransmit() {
+    digitalWrite(_rePin, !_reActive);
+    digitalWrite(_dePin, _deActive);
+}
+
+/**
+ * @brief Wait for the last stop bit, release the driver and enable the receiver
+ */
+void ModbusSplitDirection::endTransmit(Stream* serial) {
+    serial->flush();
+    if (_guard > 0) {
+        delayMicroseconds(_guard);
+    }
+    digitalWrite(_dePin, !_deActive);
+    digitalWrite(_rePin, _reActive);
+}
@@ -0,0 +1,143 @@
+/**
+ * @file ModbusDirection.h
+ * @brief RS485 driver direction-control strategies
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A half-duplex RS485 transceiver must drive the line while the request is sent
+ * and listen right after its last stop bit: switching late loses the first bytes
+ * of a fast response, switching early truncates the request. Each strategy below
+ * documents when the receiver is enabled relative to the end of the request.
+ *
+ * There is no transmit-complete interrupt behind these strategies: the end of
+ * the request is the return of Stream::flush(), plus a guard time set by hand
+ * (ModbusRTUTransport::setEnable() keeps one character at 9600 baud).
+ * How close that is to the last stop bit depends on the core. On AVR and ESP32
+ * flush() waits for the shift register to empty, so the switch follows the
+ * stop bit within microseconds. On ESP8266 flush() returns once the TX FIFO
+ * is empty, while the last character is still being shifted out: without a
+ * guard time of one character (11 bits at the line speed, 1.15 ms at 9600
+ * baud 8N2) that character is cut. extras/tests/test_direction checks the
+ * edges of each strategy on a simulated line.
+ */
+
+#ifndef MODBUSDIRECTION_H
+#define MODBUSDIRECTION_H
+
+#include <Arduino.h>
+
+/**
+ * @class ModbusDirectionControl
+ * @brief Base class of the direction-control strategies
+ */
+class ModbusDirectionControl {
+public:
+    virtual ~ModbusDirectionControl() {}
+
+    /**
+     * @brief Configure pins and put the transceiver in receive mode
+     */
+    virtual void begin() {}
+
+    /**
+     * @brief Enable the driver before the request is written
+     */
+    virtual void beginTransmit() {}
+
+    /**
+     * @brief Wait until the request has left the UART, then enable the receiver
+     * @param serial Stream the request was written to
+     */
+    virtual void endTransmit(Stream* serial) = 0;
+};
+
+/**
+ * @class ModbusAutoDirection
+ * @brief No direction control: automatic-direction transceivers or plain UART
+ *
+ * For transceivers that switch by themselves (e.g. MAX13487E, or boards with an
+ * auto-direction circuit), for a UART in hardware RS485 mode (ESP32
+ * UART_MODE_RS485_HALF_DUPLEX driving RTS) and for TTL connections.
+ *
+ * Timing: no GPIO is touched. endTransmit() returns once flush() does; the
+ * transceiver releases the line within its own switching time (typically one bit).
+ */
+class ModbusAutoDirection : public ModbusDirectionControl {
+public:
+    void endTransmit(Stream* serial);
+};
+
+/**
+ * @class ModbusGPIODirection
+ * @brief One GPIO driving DE and /RE tied together (MAX485 style)
+ *
+ * Timing: the pin is set to transmit immediately before the request is written
+ * and back to receive when flush() returns, after the guard time (default: none).
+ * On cores where flush() waits for the last stop bit (AVR, ESP32) the receiver is
+ * enabled within a few microseconds of the end of the frame. On ESP8266 flush()
+ * does not wait for the shift register: set a guard time of one character so
+ * the last byte is not cut.
+ */
+class ModbusGPIODirection : public ModbusDirectionControl {
+public:
+    /**
+     * @brief Constructor for single-pin direction control
+     * @param pin GPIO connected to DE and /RE
+     * @param transmitLevel Pin level that enables the driver (HIGH, or LOW for inverting circuits)
+     * @param guardUs Extra wait after flush() in microseconds (default: 0)
+     */
+    ModbusGPIODirection(uint8_t pin, uint8_t transmitLevel = HIGH, uint32_t guardUs = 0);
+
+    void begin();
+    void beginTransmit();
+    void endTransmit(Stream* serial);
+
+    /**
+     * @brief Set the extra wait after flush()
+     * @param guardUs Guard time in microseconds
+     */
+    void setGuardTime(uint32_t guardUs);
+
+private:
+    uint8_t _pin;            ///< DE and /RE pin
+    uint8_t _transmitLevel;  ///< Level enabling the driver
+    uint32_t _guard;         ///< Guard time in microseconds
+};
+
+/**
+ * @class ModbusSplitDirection
+ * @brief Separate DE and /RE pins
+ *
+ * Timing: during transmission the receiver is disabled (/RE inactive) so the
+ * request is not echoed. When flush() returns, after the guard time, the driver
+ * is released first and the receiver enabled right after. As with
+ * ModbusGPIODirection, that is the end of the frame only where flush() waits
+ * for the last stop bit; on ESP8266 set a guard time of one character.
+ */
+class ModbusSplitDirection : public ModbusDirectionControl {
+public:
+    /**
+     * @brief Constructor for two-pin direction control
+     * @param dePin GPIO connected to DE
+     * @param rePin GPIO connected to /RE
+     * @param deActiveLevel Level enabling the driver (default: HIGH)
+     * @param reActiveLevel Level enabling the receiver (default: LOW)
+     * @param guardUs Extra wait after flush() in microseconds (default: 0)
+     */
+    ModbusSplitDirection(uint8_t dePin, uint8_t rePin, uint8_t deActiveLevel = HIGH,
+                         uint8_t reActiveLevel = LOW, uint32_t guardUs = 0);
+
+    void begin();
+    void beginTransmit();
+    void endTransmit(Stream* serial);
+
+private:
+    uint8_t _dePin;          ///< Driver enable pin
+    uint8_t _rePin;          ///< Receiver enable pin
+    uint8_t _deActive;       ///< Level enabling the driver
+    uint8_t _reActive;       ///< Level enabling the receiver
+    uint32_t _guard;         ///< Guard time in microseconds
+};
+
+#endif // MODBUSDIRECTION_H
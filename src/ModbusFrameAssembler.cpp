@@ -0,0 +1,189 @@
+/**
+ * @file ModbusFrameAssembler.cpp
+ * @brief Implementation of the interrupt-driven frame assembler
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "ModbusFrameAssembler.h"
+#include <stddef.h>
+
+/**
+ * @brief Constructor, creates an assembler with the t3.5 of 9600 baud
+ */
+ModbusFrameAssembler::ModbusFrameAssembler()
+    : _head(0), _tail(0), _silence(silenceForBaudrate(9600)), _lastByteUs(0), _crc(0xFFFF),
+      _expected(0), _discarding(false), _overruns(0), _crcErrors(0) {
+    for (uint8_t i = 0; i < MODBUS_FRAME_SLOTS; i++) {
+        _frames[i].length = 0;
+    }
+}
+
+/**
+ * @brief Set the inter-frame silence from the line speed
+ */
+void ModbusFrameAssembler::setBaudrate(uint32_t baudrate) {
+    _silence = silenceForBaudrate(baudrate);
+}
+
+/**
+ * @brief Set the inter-frame silence
+ */
+void ModbusFrameAssembler::setSilence(uint32_t silenceUs) {
+    _silence = silenceUs;
+}
+
+/**
+ * @brief Push one received byte (producer, interrupt safe)
+ */
+void MODBUS_ISR_ATTR ModbusFrameAssembler::feed(uint8_t byte, uint32_t timestampUs) {
+    ModbusFrame& frame = _frames[_head];
+
+    // A gap longer than t3.5 starts a new frame
+    if ((frame.length > 0 || _discarding) && timestampUs - _lastByteUs > _silence) {
+        close();
+    }
+    _lastByteUs = timestampUs;
+
+    ModbusFrame& current = _frames[_head];
+    if (_discarding) {
+        return;
+    }
+    if (current.length >= MODBUS_MAX_ADU_SIZE) {
+        current.length = 0;
+        _discarding = true;
+        return;
+    }
+
+    if (current.length == 0) {
+        current.startUs = timestampUs;
+        _crc = 0xFFFF;
+        _expected = 0;
+    }
+    current.data[current.length++] = byte;
+    current.endUs = timestampUs;
+    _crc = modbusCRC16Update(_crc, byte);
+
+    if (_expected == 0) {
+        _expected = expectedLength(current);
+    }
+    // CRC over a frame including its own CRC is zero: publish without waiting for t3.5
+    if (_expected != 0 && current.length == _expected && _crc == 0) {
+        close();
+    }
+}
+
+/**
+ * @brief Close the frame in progress once the line has been silent (producer)
+ */
+void MODBUS_ISR_ATTR ModbusFrameAssembler::tick(uint32_t nowUs) {
+    if ((_frames[_head].length > 0 || _discarding) && nowUs - _lastByteUs > _silence) {
+        close();
+    }
+}
+
+/**
+ * @brief Get the oldest completed frame (consumer)
+ */
+const ModbusFrame* ModbusFrameAssembler::front() const {
+    uint8_t tail = _tail;
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &_frames[tail];
+}
+
+/**
+ * @brief Release the frame returned by front() (consumer)
+ */
+void ModbusFrameAssembler::pop() {
+    uint8_t tail = _tail;
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&_tail, (uint8_t)((tail + 1) % MODBUS_FRAME_SLOTS), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get number of frames dropped because the queue was full
+ */
+uint32_t ModbusFrameAssembler::getOverruns() const {
+    return _overruns;
+}
+
+/**
+ * @brief Get number of frames completed with an invalid CRC
+ */
+uint32_t ModbusFrameAssembler::getCRCErrors() const {
+    return _crcErrors;
+}
+
+/**
+ * @brief Compute the Modbus t3.5 silence of a line speed
+ */
+uint32_t ModbusFrameAssembler::silenceForBaudrate(uint32_t baudrate) {
+    if (baudrate == 0 || baudrate > 19200) {
+        return MODBUS_SILENCE_MIN_US;
+    }
+    // 3.5 characters of 11 bits (start + 8 data + parity/stop + stop)
+    return (uint32_t)((38500ULL * 1000) / baudrate);
+}
+
+/**
+ * @brief Publish the frame in progress and start a new one
+ */
+void MODBUS_ISR_ATTR ModbusFrameAssembler::close() {
+    ModbusFrame& frame = _frames[_head];
+    bool discarding = _discarding;
+    _discarding = false;
+    _expected = 0;
+    if (discarding || frame.length == 0) {
+        frame.length = 0;
+        return;
+    }
+
+    frame.crcValid = frame.length >= 4 && _crc == 0;
+    if (!frame.crcValid) {
+        _crcErrors = _crcErrors + 1;
+    }
+
+    uint8_t next = (_head + 1) % MODBUS_FRAME_SLOTS;
+    if (next == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)) {
+        // Consumer is behind: drop this frame and reuse its buffer
+        _overruns = _overruns + 1;
+        frame.length = 0;
+        return;
+    }
+    _frames[next].length = 0;
+    __atomic_store_n(&_head, next, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Derive the response length from the frame header
+ */
+uint16_t MODBUS_ISR_ATTR ModbusFrameAssembler::expectedLength(const ModbusFrame& frame) {
+    if (frame.length < 2) {
+        return 0;
+    }
+
+    uint8_t function = frame.data[1];
+    if (function & 0x80) {
+        return 5; // Address, function, exception code, CRC
+    }
+    switch (function) {
+        case 0x01:
+        case 0x02:
+        case MODBUS_READ_HOLDING_REGISTERS:
+        case MODBUS_READ_INPUT_REGISTERS:
+            // Address, function, byte count, data, CRC
+            return frame.length < 3 ? 0 : 5 + frame.data[2];
+        case 0x05:
+        case MODBUS_WRITE_SINGLE_REGISTER:
+        case 0x0F:
+        case MODBUS_WRITE_MULTIPLE_REGISTERS:
+            return 8;
+        default:
+            // Unknown layout (including the 4 or 6 byte reset energy reply): the frame ends on silence
+            return 0;
+    }
+}
@@ -0,0 +1,160 @@
+/**
+ * @file ModbusFrameAssembler.h
+ * @brief Interrupt-driven Modbus-RTU response frame assembly
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Bytes are pushed with feed() as they arrive, typically from a UART RX
+ * interrupt, a DMA callback or the ESP32 onReceive() hook, together with their
+ * arrival time. Frames are delimited by inter-character silence (t3.5) or, as
+ * soon as possible, by the length announced in the response header; the CRC is
+ * computed byte by byte. Completed frames are handed to the consumer through a
+ * lock-free single-producer/single-consumer queue, already validated.
+ *
+ * Apart from the IRAM placement on ESP boards, this file has no Arduino
+ * dependency, so the assembler can be exercised on a host by feeding recorded
+ * byte streams, as extras/tests/test_assembler does.
+ */
+
+#ifndef MODBUSFRAMEASSEMBLER_H
+#define MODBUSFRAMEASSEMBLER_H
+
+#include <stdint.h>
+#include "ModbusProtocol.h"
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#include <Arduino.h>
+#define MODBUS_ISR_ATTR IRAM_ATTR  ///< Keep ISR code in IRAM
+#else
+#define MODBUS_ISR_ATTR
+#endif
+
+/**
+ * @defgroup ModbusFrameAssemblerConfig Frame Assembler Configuration
+ * @{
+ */
+#ifndef MODBUS_FRAME_SLOTS
+#define MODBUS_FRAME_SLOTS         3     ///< Frame buffers (one being assembled, the rest queued)
+#endif
+#define MODBUS_SILENCE_MIN_US      1750  ///< Fixed t3.5 above 19200 baud (Modbus spec)
+/** @} */
+
+/**
+ * @struct ModbusFrame
+ * @brief One received RTU frame
+ */
+struct ModbusFrame {
+    uint8_t data[MODBUS_MAX_ADU_SIZE];  ///< Frame bytes (address + PDU + CRC)
+    uint16_t length;                    ///< Frame length
+    bool crcValid;                      ///< CRC verified
+    uint32_t startUs;                   ///< Arrival time of the first byte
+    uint32_t endUs;                     ///< Arrival time of the last byte
+};
+
+/**
+ * @class ModbusFrameAssembler
+ * @brief Assembles RTU response frames from timestamped bytes
+ *
+ * feed() and tick() are the producer side and may run in interrupt context;
+ * front() and pop() are the consumer side. One producer and one consumer are
+ * supported without locks. Frames with a known layout are published on their
+ * last byte; others (or corrupted ones) wait for tick() to see the silence, so
+ * the byte source should also call tick() periodically, e.g. from an RX-timeout
+ * interrupt.
+ */
+class ModbusFrameAssembler {
+public:
+    /**
+     * @brief Constructor, creates an assembler with the t3.5 of 9600 baud
+     */
+    ModbusFrameAssembler();
+
+    /**
+     * @brief Set the inter-frame silence from the line speed
+     * @param baudrate Serial baudrate
+     */
+    void setBaudrate(uint32_t baudrate);
+
+    /**
+     * @brief Set the inter-frame silence
+     * @param silenceUs Silence in microseconds that ends a frame
+     */
+    void setSilence(uint32_t silenceUs);
+
+    /**
+     * @brief Push one received byte (producer, interrupt safe)
+     * @param byte Received byte
+     * @param timestampUs Arrival time in microseconds
+     */
+    void feed(uint8_t byte, uint32_t timestampUs);
+
+    /**
+     * @brief Close the frame in progress once the line has been silent (producer)
+     * @param nowUs Current time in microseconds
+     */
+    void tick(uint32_t nowUs);
+
+    /**
+     * @brief Get the oldest completed frame (consumer)
+     * @return Pointer to the frame, or NULL if none is ready
+     */
+    const ModbusFrame* front() const;
+
+    /**
+     * @brief Release the frame returned by front() (consumer)
+     */
+    void pop();
+
+    /**
+     * @brief Get number of frames dropped because the queue was full
+     * @return Dropped frames
+     */
+    uint32_t getOverruns() const;
+
+    /**
+     * @brief Get number of frames completed with an invalid CRC
+     * @return CRC errors
+     */
+    uint32_t getCRCErrors() const;
+
+    /**
+     * @brief Compute the Modbus t3.5 silence of a line speed
+     * @param baudrate Serial baudrate
+     * @return Silence in microseconds (3.5 characters of 11 bits, at least MODBUS_SILENCE_MIN_US above 19200 baud)
+     */
+    static uint32_t silenceForBaudrate(uint32_t baudrate);
+
+private:
+    ModbusFrame _frames[MODBUS_FRAME_SLOTS];  ///< Frame buffers (ring)
+    volatile uint8_t _head;                   ///< Slot being assembled (producer)
+    volatile uint8_t _tail;                   ///< Oldest completed slot (consumer)
+    uint32_t _silence;                        ///< Inter-frame silence in microseconds
+    uint32_t _lastByteUs;                     ///< Arrival time of the last byte
+    uint16_t _crc;                            ///< Running CRC of the frame in progress
+    uint16_t _expected;                       ///< Length announced by the header (0 = unknown)
+    bool _discarding;                         ///< Frame too long, skip until silence
+    volatile uint32_t _overruns;              ///< Frames dropped (queue full)
+    volatile uint32_t _crcErrors;             ///< Frames with invalid CRC
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Publish the frame in progress and start a new one
+     */
+    void close();
+
+    /**
+     * @brief Derive the response length from the frame header
+     * @param frame Frame in progress
+     * @return Expected length, or 0 if not known yet
+     */
+    static uint16_t expectedLength(const ModbusFrame& frame);
+
+    /** @} */
+};
+
+#endif // MODBUSFRAMEASSEMBLER_H
@@ -0,0 +1,135 @@
+/**
+ * @file ModbusProtocol.h
+ * @brief Modbus protocol constants shared by the RTU and TCP layers
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * This header has no Arduino dependency so it can also be used by host-side
+ * components (Linux gateway servers and tools).
+ */
+
+#ifndef MODBUSPROTOCOL_H
+#define MODBUSPROTOCOL_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup ModbusFunctionCodes Modbus-RTU Function Codes
+ * @brief Modbus-RTU protocol function codes
+ * @{
+ */
+#define MODBUS_READ_HOLDING_REGISTERS   0x03  ///< Read holding registers function code
+#define MODBUS_READ_INPUT_REGISTERS     0x04  ///< Read input registers function code
+#define MODBUS_WRITE_SINGLE_REGISTER    0x06  ///< Write single register function code
+#define MODBUS_WRITE_MULTIPLE_REGISTERS 0x10  ///< Write multiple registers function code
+#define MODBUS_RESET_ENERGY             0x42  ///< Reset energy counter function code
+/** @} */
+
+/**
+ * @defgroup ModbusExceptionCodes Modbus Exception Codes
+ * @brief Exception codes returned in error responses (function code | 0x80)
+ * @{
+ */
+#define MODBUS_EXCEPTION_ILLEGAL_FUNCTION      0x01  ///< Function code not supported
+#define MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS  0x02  ///< Register range not available
+#define MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE    0x03  ///< Invalid quantity or value
+#define MODBUS_EXCEPTION_GATEWAY_NO_RESPONSE   0x0B  ///< Gateway target device failed to respond
+/** @} */
+
+/**
+ * @defgroup ModbusLimits Modbus Protocol Limits
+ * @{
+ */
+#define MODBUS_MAX_READ_REGISTERS  125  ///< Maximum registers per read request
+#define MODBUS_MAX_ADU_SIZE        256  ///< Maximum RTU frame size in bytes
+#define MODBUS_RTU_CHARACTER_BITS  11   ///< Bits of the longest RTU character (start, 8 data, parity or second stop, stop)
+/** @} */
+
+/**
+ * @brief Update a Modbus CRC16 with one byte (polynomial 0xA001)
+ * @param crc Current CRC value (start with 0xFFFF)
+ * @param byte Next data byte
+ * @return Updated CRC value
+ */
+static inline uint16_t modbusCRC16Update(uint16_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (uint8_t j = 0; j < 8; j++) {
+        if (crc & 0x0001) {
+            crc = (crc >> 1) ^ 0xA001;
+        } else {
+            crc = crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Calculate the Modbus CRC16 of a buffer
+ * @param data Pointer to data buffer
+ * @param length Length of data buffer
+ * @return Calculated CRC16 value (low byte is transmitted first)
+ */
+static inline uint16_t modbusCRC16(const uint8_t* data, uint16_t length) {
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < length; i++) {
+        crc = modbusCRC16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+/**
+ * @brief Build a read registers request frame (function code 0x03 or 0x04)
+ * @param frame Buffer of at least 8 bytes receiving the frame
+ * @param slaveAddr Slave device address
+ * @param function MODBUS_READ_HOLDING_REGISTERS or MODBUS_READ_INPUT_REGISTERS
+ * @param startAddr Starting register address
+ * @param numRegs Number of registers to read
+ * @return Frame length in bytes (always 8)
+ */
+static inline uint8_t modbusBuildReadRequest(uint8_t* frame, uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs) {
+    frame[0] = slaveAddr;
+    frame[1] = function;
+    frame[2] = (startAddr >> 8) & 0xFF;  // High byte
+    frame[3] = startAddr & 0xFF;         // Low byte
+    frame[4] = (numRegs >> 8) & 0xFF;    // High byte
+    frame[5] = numRegs & 0xFF;           // Low byte
+    uint16_t crc = modbusCRC16(frame, 6);
+    frame[6] = crc & 0xFF;               // CRC Low byte
+    frame[7] = (crc >> 8) & 0xFF;        // CRC High byte
+    return 8;
+}
+
+/**
+ * @brief Get the length of a read registers response frame
+ * @param numRegs Number of registers requested
+ * @return 3 (header) + 2*numRegs (data) + 2 (CRC)
+ */
+static inline uint16_t modbusReadResponseLength(uint16_t numRegs) {
+    return 3 + 2 * numRegs + 2;
+}
+
+/**
+ * @brief Get a register of a read registers response frame
+ * @param frame Response frame
+ * @param index Register index, 0 for the first register read
+ * @param bigEndian Register byte order of the device (false: low byte first, e.g. PZEM-6L24)
+ * @return Register value in host order
+ */
+static inline uint16_t modbusResponseRegister(const uint8_t* frame, uint16_t index, bool bigEndian) {
+    uint8_t first = frame[3 + index * 2];
+    uint8_t second = frame[4 + index * 2];
+    return bigEndian ? (uint16_t)((first << 8) | second) : (uint16_t)((second << 8) | first);
+}
+
+/**
+ * @brief Get the time a frame takes on a serial line
+ * @param bytes Frame length in bytes
+ * @param baudrate Line speed in bits per second
+ * @return Transmission time in milliseconds, rounded up (MODBUS_RTU_CHARACTER_BITS per byte)
+ */
+static inline uint32_t modbusWireTimeMs(uint16_t bytes, uint32_t baudrate) {
+    return ((uint32_t)bytes * MODBUS_RTU_CHARACTER_BITS * 1000UL + baudrate - 1) / baudrate;
+}
+
+#endif // MODBUSPROTOCOL_H
@@ -0,0 +1,351 @@
+/**
+ * @file ModbusTCPServer.cpp
+ * @brief Implementation of the Modbus-TCP server answering from the register cache
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "ModbusTCPServer.h"
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @brief Constructor for Modbus-TCP server
+ */
+ModbusTCPServer::ModbusTCPServer(const PZEMRegisterCache& cache)
+    : _cache(cache), _listenFd(-1), _port(0), _clientCount(0), _requestCount(0), _connections(NULL) {
+}
+
+/**
+ * @brief Destructor, closes all sockets
+ */
+ModbusTCPServer::~ModbusTCPServer() {
+    stop();
+}
+
+/**
+ * @brief Start listening for connections
+ */
+bool ModbusTCPServer::begin(uint16_t port, const char* bindAddress) {
+    stop();
+
+    _connections = new Connection[MODBUS_TCP_MAX_CLIENTS];
+    for (uint16_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+        _connections[i].fd = -1;
+    }
+
+    _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listenFd < 0) {
+        stop();
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bindAddress != NULL && inet_pton(AF_INET, bindAddress, &addr.sin_addr) != 1) {
+        stop();
+        return false;
+    }
+
+    if (bind(_listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenFd, 64) < 0) {
+        stop();
+        return false;
+    }
+
+    // Read back the port in case an ephemeral one was requested
+    socklen_t addrLength = sizeof(addr);
+    getsockname(_listenFd, (struct sockaddr*)&addr, &addrLength);
+    _port = ntohs(addr.sin_port);
+    _requestCount = 0;
+    return true;
+}
+
+/**
+ * @brief Accept connections, answer requests and flush responses
+ */
+int ModbusTCPServer::poll(int timeoutMs) {
+    if (_listenFd < 0) {
+        return -1;
+    }
+
+    struct pollfd fds[MODBUS_TCP_MAX_CLIENTS + 1];
+    uint16_t slots[MODBUS_TCP_MAX_CLIENTS + 1];
+    nfds_t count = 0;
+
+    fds[count].fd = _listenFd;
+    fds[count].events = POLLIN;
+    count++;
+
+    for (uint16_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+        Connection& conn = _connections[i];
+        if (conn.fd < 0) {
+            continue;
+        }
+        fds[count].fd = conn.fd;
+        fds[count].events = 0;
+        // Backpressure: stop reading while a full response might not fit
+        if (conn.txLength + MODBUS_MAX_ADU_SIZE + MODBUS_TCP_MBAP_SIZE <= MODBUS_TCP_BUFFER_SIZE) {
+            fds[count].events |= POLLIN;
+        }
+        if (conn.txLength > conn.txOffset) {
+            fds[count].events |= POLLOUT;
+        }
+        slots[count] = i;
+        count++;
+    }
+
+    if (::poll(fds, count, timeoutMs) <= 0) {
+        return 0;
+    }
+
+    int served = 0;
+    for (nfds_t n = 1; n < count; n++) {
+        Connection& conn = _connections[slots[n]];
+        if (fds[n].revents & (POLLERR | POLLNVAL)) {
+            closeConnection(conn);
+            continue;
+        }
+        if (fds[n].revents & (POLLIN | POLLHUP)) {
+            served += receive(conn);
+        }
+        if (conn.fd >= 0 && conn.txLength > conn.txOffset) {
+            transmit(conn);
+            // Requests held back by a full transmit buffer can proceed now
+            if (conn.fd >= 0 && conn.txLength == 0 && conn.rxLength > 0) {
+                served += serve(conn);
+            }
+        }
+    }
+
+    if (fds[0].revents & POLLIN) {
+        acceptClients();
+    }
+
+    _requestCount += served;
+    return served;
+}
+
+/**
+ * @brief Close all client connections and the listening socket
+ */
+void ModbusTCPServer::stop() {
+    if (_connections != NULL) {
+        for (uint16_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+            closeConnection(_connections[i]);
+        }
+        delete[] _connections;
+        _connections = NULL;
+    }
+    if (_listenFd >= 0) {
+        close(_listenFd);
+        _listenFd = -1;
+    }
+    _clientCount = 0;
+}
+
+/**
+ * @brief Get number of connected clients
+ */
+uint16_t ModbusTCPServer::getClientCount() const {
+    return _clientCount;
+}
+
+/**
+ * @brief Get number of requests answered since begin()
+ */
+uint32_t ModbusTCPServer::getRequestCount() const {
+    return _requestCount;
+}
+
+/**
+ * @brief Get port the server is listening on
+ */
+uint16_t ModbusTCPServer::getPort() const {
+    return _port;
+}
+
+/**
+ * @brief Accept all pending connections
+ */
+void ModbusTCPServer::acceptClients() {
+    while (true) {
+        int fd = accept4(_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN: no more pending connections
+        }
+
+        Connection* conn = NULL;
+        for (uint16_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+            if (_connections[i].fd < 0) {
+                conn = &_connections[i];
+                break;
+            }
+        }
+        if (conn == NULL) {
+            close(fd); // Connection table full
+            continue;
+        }
+
+        // Responses are small and latency matters more than throughput
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        conn->fd = fd;
+        conn->rxLength = 0;
+        conn->txLength = 0;
+        conn->txOffset = 0;
+        _clientCount++;
+    }
+}
+
+/**
+ * @brief Read from a client and answer every complete request
+ */
+int ModbusTCPServer::receive(Connection& conn) {
+    if (conn.rxLength < sizeof(conn.rx)) {
+        ssize_t received = recv(conn.fd, conn.rx + conn.rxLength, sizeof(conn.rx) - conn.rxLength, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            closeConnection(conn);
+            return 0;
+        }
+        if (received > 0) {
+            conn.rxLength += received;
+        }
+    }
+    return serve(conn);
+}
+
+/**
+ * @brief Answer every complete request buffered for a client
+ */
+int ModbusTCPServer::serve(Connection& conn) {
+    int served = 0;
+    uint16_t offset = 0;
+    while (conn.rxLength - offset >= MODBUS_TCP_MBAP_SIZE + 1) {
+        const uint8_t* frame = conn.rx + offset;
+        uint16_t protocolId = (frame[2] << 8) | frame[3];
+        uint16_t length = (frame[4] << 8) | frame[5];  // Unit ID + PDU
+
+        if (protocolId != 0 || length < 2 || length > MODBUS_MAX_ADU_SIZE) {
+            closeConnection(conn); // Not a Modbus-TCP peer
+            return served;
+        }
+        if (conn.rxLength - offset < 6 + length) {
+            break; // Incomplete frame
+        }
+        if (conn.txLength + MODBUS_MAX_ADU_SIZE + MODBUS_TCP_MBAP_SIZE > MODBUS_TCP_BUFFER_SIZE) {
+            break; // Wait for the client to read its responses
+        }
+
+        conn.txLength += process(frame, conn.tx + conn.txLength);
+        offset += 6 + length;
+        served++;
+    }
+
+    if (offset > 0) {
+        memmove(conn.rx, conn.rx + offset, conn.rxLength - offset);
+        conn.rxLength -= offset;
+    }
+    return served;
+}
+
+/**
+ * @brief Send pending response bytes to a client
+ */
+void ModbusTCPServer::transmit(Connection& conn) {
+    ssize_t sent = send(conn.fd, conn.tx + conn.txOffset, conn.txLength - conn.txOffset, MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            closeConnection(conn);
+        }
+        return;
+    }
+
+    conn.txOffset += sent;
+    if (conn.txOffset == conn.txLength) {
+        conn.txOffset = 0;
+        conn.txLength = 0;
+    }
+}
+
+/**
+ * @brief Build the response to one request
+ */
+uint16_t ModbusTCPServer::process(const uint8_t* request, uint8_t* response) {
+    uint8_t unitId = request[6];
+    uint8_t function = request[7];
+    uint16_t length = (request[4] << 8) | request[5];
+    uint8_t exception = 0;
+
+    // Transaction ID, protocol ID and unit ID are echoed back
+    memcpy(response, request, 4);
+    response[6] = unitId;
+
+    if (function != MODBUS_READ_HOLDING_REGISTERS && function != MODBUS_READ_INPUT_REGISTERS) {
+        exception = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+    } else if (length != 6) {
+        exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    } else {
+        uint16_t startAddr = (request[8] << 8) | request[9];
+        uint16_t numRegs = (request[10] << 8) | request[11];
+        uint16_t data[MODBUS_MAX_READ_REGISTERS];
+
+        if (numRegs == 0 || numRegs > MODBUS_MAX_READ_REGISTERS) {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        } else if (!_cache.contains(unitId)) {
+            exception = MODBUS_EXCEPTION_GATEWAY_NO_RESPONSE;
+        } else if (!_cache.read(unitId, function, startAddr, numRegs, data)) {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        } else {
+            response[7] = function;
+            response[8] = 2 * numRegs;  // Byte count
+            for (uint16_t i = 0; i < numRegs; i++) {
+                response[9 + 2 * i] = (data[i] >> 8) & 0xFF;  // High byte
+                response[10 + 2 * i] = data[i] & 0xFF;        // Low byte
+            }
+            uint16_t pduLength = 2 + 2 * numRegs;
+            response[4] = ((pduLength + 1) >> 8) & 0xFF;
+            response[5] = (pduLength + 1) & 0xFF;
+            return MODBUS_TCP_MBAP_SIZE + pduLength;
+        }
+    }
+
+    // Exception response: function | 0x80, exception code
+    response[4] = 0x00;
+    response[5] = 0x03;
+    response[7] = function | 0x80;
+    response[8] = exception;
+    return MODBUS_TCP_MBAP_SIZE + 2;
+}
+
+/**
+ * @brief Close a client connection
+ */
+void ModbusTCPServer::closeConnection(Connection& conn) {
+    if (conn.fd >= 0) {
+        close(conn.fd);
+        conn.fd = -1;
+        conn.rxLength = 0;
+        conn.txLength = 0;
+        conn.txOffset = 0;
+        _clientCount--;
+    }
+}
+
+#endif // __linux__
@@ -0,0 +1,172 @@
+/**
+ * @file ModbusTCPServer.h
+ * @brief Modbus-TCP server answering from the register cache (Linux gateways)
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Only available when building for Linux. The server never touches the serial
+ * bus: read requests are answered from a PZEMRegisterCache that is kept up to
+ * date by the polling code.
+ */
+
+#ifndef MODBUSTCPSERVER_H
+#define MODBUSTCPSERVER_H
+
+#if defined(__linux__)
+
+#include <stddef.h>
+#include "ModbusProtocol.h"
+#include "PZEMRegisterCache.h"
+
+/**
+ * @defgroup ModbusTCPServerLimits Modbus-TCP Server Limits
+ * @brief Compile-time sizing of the server (override before including)
+ * @{
+ */
+#define MODBUS_TCP_DEFAULT_PORT   502   ///< Standard Modbus-TCP port
+#define MODBUS_TCP_MBAP_SIZE      7     ///< MBAP header size in bytes
+#ifndef MODBUS_TCP_MAX_CLIENTS
+#define MODBUS_TCP_MAX_CLIENTS    64    ///< Maximum simultaneous client connections
+#endif
+#ifndef MODBUS_TCP_BUFFER_SIZE
+#define MODBUS_TCP_BUFFER_SIZE    2048  ///< Per-client receive and transmit buffer size
+#endif
+/** @} */
+
+/**
+ * @class ModbusTCPServer
+ * @brief Non-blocking Modbus-TCP (MBAP) server serving cached device registers
+ *
+ * The MBAP unit identifier selects the device (unit ID = Modbus slave address).
+ * Read holding registers (0x03) and read input registers (0x04) are answered from
+ * the cache; a unit that has never been read returns exception 0x0B and a range
+ * that has not been cached returns exception 0x02. Any other function returns
+ * exception 0x01, since writes would require bus access.
+ *
+ * All sockets are non-blocking and multiplexed with poll(), so a single call to
+ * poll() services every connected client. Pipelined requests from a client are
+ * answered in order; a client that stops reading its responses is no longer read
+ * from until its transmit buffer drains.
+ */
+class ModbusTCPServer {
+public:
+    /**
+     * @brief Constructor for Modbus-TCP server
+     * @param cache Register cache used to answer requests
+     */
+    ModbusTCPServer(const PZEMRegisterCache& cache);
+
+    /**
+     * @brief Destructor, closes all sockets
+     */
+    ~ModbusTCPServer();
+
+    /**
+     * @brief Start listening for connections
+     * @param port TCP port (default: 502)
+     * @param bindAddress IPv4 address to bind to, or NULL for all interfaces
+     * @return true if successful, false otherwise
+     */
+    bool begin(uint16_t port = MODBUS_TCP_DEFAULT_PORT, const char* bindAddress = NULL);
+
+    /**
+     * @brief Accept connections, answer requests and flush responses
+     * @param timeoutMs Maximum time to wait for socket activity (0 = do not wait, -1 = wait forever)
+     * @return Number of requests answered, or -1 if the server is not running
+     */
+    int poll(int timeoutMs = 0);
+
+    /**
+     * @brief Close all client connections and the listening socket
+     */
+    void stop();
+
+    /**
+     * @brief Get number of connected clients
+     * @return Number of open client connections
+     */
+    uint16_t getClientCount() const;
+
+    /**
+     * @brief Get number of requests answered since begin()
+     * @return Request counter
+     */
+    uint32_t getRequestCount() const;
+
+    /**
+     * @brief Get port the server is listening on
+     * @return TCP port, useful when begin() was called with port 0
+     */
+    uint16_t getPort() const;
+
+private:
+    /**
+     * @brief Connection state of a single client
+     */
+    struct Connection {
+        int fd;                                 ///< Socket descriptor (-1 = free slot)
+        uint16_t rxLength;                      ///< Bytes pending in rx
+        uint16_t txLength;                      ///< Bytes pending in tx
+        uint16_t txOffset;                      ///< Bytes of tx already sent
+        uint8_t rx[MODBUS_TCP_BUFFER_SIZE];     ///< Receive buffer
+        uint8_t tx[MODBUS_TCP_BUFFER_SIZE];     ///< Transmit buffer
+    };
+
+    const PZEMRegisterCache& _cache;            ///< Register cache used to answer requests
+    int _listenFd;                              ///< Listening socket (-1 if stopped)
+    uint16_t _port;                             ///< Bound TCP port
+    uint16_t _clientCount;                      ///< Number of open connections
+    uint32_t _requestCount;                     ///< Requests answered
+    Connection* _connections;                   ///< Connection table (MODBUS_TCP_MAX_CLIENTS entries)
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Accept all pending connections
+     */
+    void acceptClients();
+
+    /**
+     * @brief Read from a client and answer every complete request
+     * @param conn Client connection
+     * @return Number of requests answered
+     */
+    int receive(Connection& conn);
+
+    /**
+     * @brief Answer every complete request buffered for a client
+     * @param conn Client connection
+     * @return Number of requests answered
+     */
+    int serve(Connection& conn);
+
+    /**
+     * @brief Send pending response bytes to a client
+     * @param conn Client connection
+     */
+    void transmit(Connection& conn);
+
+    /**
+     * @brief Build the response to one request
+     * @param request MBAP request frame
+     * @param response Buffer receiving the MBAP response frame
+     * @return Response length in bytes
+     */
+    uint16_t process(const uint8_t* request, uint8_t* response);
+
+    /**
+     * @brief Close a client connection
+     * @param conn Client connection
+     */
+    void closeConnection(Connection& conn);
+
+    /** @} */
+};
+
+#endif // __linux__
+
+#endif // MODBUSTCPSERVER_H
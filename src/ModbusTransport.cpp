@@ -0,0 +1,578 @@
+/**
+ * @file ModbusTransport.cpp
+ * @brief Implementation of the Modbus transports
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "ModbusTransport.h"
+
+/**
+ * @brief Constructor, creates an empty transaction
+ */
+ModbusTransaction::ModbusTransaction()
+    : request(NULL), requestLength(0), response(NULL), responseSize(0), responseLength(0),
+      expectedLength(0), timeout(100), startTime(0), status(MODBUS_TRANSACTION_OK),
+      transactionId(0), onComplete(NULL), context(NULL), priority(false), next(NULL) {
+}
+
+/**
+ * @brief Prepare the transaction for submission
+ */
+void ModbusTransaction::prepare(const uint8_t* requestFrame, uint16_t requestFrameLength, uint8_t* responseBuffer,
+                                uint16_t responseBufferSize, uint16_t minResponseLength, uint32_t responseTimeout) {
+    request = requestFrame;
+    requestLength = requestFrameLength;
+    response = responseBuffer;
+    responseSize = responseBufferSize;
+    responseLength = 0;
+    expectedLength = minResponseLength;
+    timeout = responseTimeout;
+}
+
+/**
+ * @brief Submit a transaction and wait for its completion
+ */
+bool ModbusTransport::execute(ModbusTransaction* txn) {
+    if (!submit(txn)) {
+        return false;
+    }
+    while (txn->status == MODBUS_TRANSACTION_PENDING) {
+        poll();
+        yield();
+    }
+    return txn->status == MODBUS_TRANSACTION_OK;
+}
+
+/**
+ * @brief Finish a transaction and invoke its callback
+ */
+void ModbusTransport::complete(ModbusTransaction* txn, uint8_t status) {
+    txn->next = NULL;
+    txn->status = status;
+    if (txn->onComplete != NULL) {
+        txn->onComplete(txn, txn->context);
+    }
+}
+
+/**
+ * @brief Classify a received RTU response frame
+ */
+uint8_t ModbusTransport::validate(const ModbusTransaction* txn) {
+    if (txn->responseLength == 0) {
+        return MODBUS_TRANSACTION_TIMEOUT;
+    }
+
+    // Check if it is an error response
+    if (txn->response[1] & 0x80) {
+        return MODBUS_TRANSACTION_EXCEPTION;
+    }
+
+    // Verify CRC
+    if (txn->responseLength < 2) {
+        return MODBUS_TRANSACTION_CRC_ERROR;
+    }
+    uint16_t calculatedCRC = modbusCRC16(txn->response, txn->responseLength - 2);
+    uint16_t receivedCRC = (txn->response[txn->responseLength - 1] << 8) | txn->response[txn->responseLength - 2];
+    if (calculatedCRC != receivedCRC) {
+        return MODBUS_TRANSACTION_CRC_ERROR;
+    }
+
+    return MODBUS_TRANSACTION_OK;
+}
+
+/**
+ * @brief Append a transaction to a queue, priority transactions ahead of the others
+ */
+void ModbusTransport::enqueue(ModbusTransaction*& head, ModbusTransaction*& tail, ModbusTransaction* txn) {
+    txn->next = NULL;
+    if (head == NULL) {
+        head = txn;
+        tail = txn;
+        return;
+    }
+
+    // Behind the last queued priority transaction, ahead of everything else
+    if (txn->priority && !tail->priority) {
+        if (!head->priority) {
+            txn->next = head;
+            head = txn;
+            return;
+        }
+        ModbusTransaction* last = head;
+        while (last->next != NULL && last->next->priority) {
+            last = last->next;
+        }
+        txn->next = last->next;
+        last->next = txn;
+        return;
+    }
+
+    tail->next = txn;
+    tail = txn;
+}
+
+/**
+ * @brief Constructor for serial RTU transport
+ */
+ModbusRTUTransport::ModbusRTUTransport(Stream* serial)
+    : _serial(serial), _pinDirection(255), _direction(&_autoDirection), _turnaround(MODBUS_RTU_TURNAROUND_MS),
+      _frameSilence(MODBUS_RTU_FRAME_SILENCE_MS), _completeOnLength(false), _state(STATE_IDLE), _stateTime(0),
+      _lastByteTime(0), _foundSlaveAddr(false), _assembler(NULL), _sentUs(0), _active(NULL), _queueHead(NULL), _queueTail(NULL) {
+}
+
+/**
+ * @brief Queue a transaction (non-blocking)
+ */
+bool ModbusRTUTransport::submit(ModbusTransaction* txn) {
+    if (txn == NULL || txn->request == NULL || txn->response == NULL) {
+        return false;
+    }
+
+    txn->status = MODBUS_TRANSACTION_PENDING;
+    txn->responseLength = 0;
+    enqueue(_queueHead, _queueTail, txn);
+    return true;
+}
+
+/**
+ * @brief Advance pending transactions (non-blocking)
+ */
+void ModbusRTUTransport::poll() {
+    if (_active == NULL) {
+        startNext();
+        if (_active == NULL) {
+            return;
+        }
+    }
+
+    if (_state == STATE_TURNAROUND) {
+        if (millis() - _stateTime < _turnaround) {
+            return;
+        }
+        _state = STATE_RECEIVING;
+        _active->startTime = millis();
+    }
+
+    if (_assembler != NULL) {
+        // Frames are assembled and checked in interrupt context
+        if (receiveFrame()) {
+            return;
+        }
+        if (millis() - _active->startTime >= _active->timeout) {
+            finish(validate(_active));
+        }
+        return;
+    }
+
+    // Collect response bytes, starting at the slave address
+    while (_serial->available()) {
+        uint8_t byte = _serial->read();
+
+        if (!_foundSlaveAddr && byte == _active->slaveAddr())
+            _foundSlaveAddr = true;
+
+        if (_foundSlaveAddr) {
+            if (_active->responseLength < _active->responseSize) {
+                _active->response[_active->responseLength] = byte;
+                _active->responseLength++;
+                _lastByteTime = millis();
+            }
+        }
+    }
+
+    // A frame of exactly the expected length (or an exception) whose CRC checks needs no silence
+    if (_completeOnLength && _active->responseLength >= 2) {
+        uint16_t length = (_active->response[1] & 0x80) ? 5 : _active->expectedLength;
+        if (_active->responseLength == length && modbusCRC16(_active->response, length) == 0) {
+            finish(validate(_active));
+            return;
+        }
+    }
+
+    // If received all expected bytes and passed time without new bytes
+    if (_active->responseLength >= _active->expectedLength && (millis() - _lastByteTime) > _frameSilence) {
+        finish(validate(_active));
+    } else if (millis() - _active->startTime >= _active->timeout) {
+        finish(validate(_active));
+    }
+}
+
+/**
+ * @brief Check whether no transaction is queued or in flight
+ */
+bool ModbusRTUTransport::isIdle() const {
+    return _active == NULL && _queueHead == NULL;
+}
+
+/**
+ * @brief Set RS485 enable pin for MAX485 transceiver
+ */
+void ModbusRTUTransport::setEnable(uint8_t enablePin, uint32_t guardUs) {
+    _pinDirection = ModbusGPIODirection(enablePin, HIGH, guardUs);
+    setDirectionControl(&_pinDirection);
+}
+
+/**
+ * @brief Set the direction-control strategy of the transceiver
+ */
+void ModbusRTUTransport::setDirectionControl(ModbusDirectionControl* direction) {
+    _direction = (direction != NULL) ? direction : &_autoDirection;
+    _direction->begin(); // Start in receive mode
+}
+
+/**
+ * @brief Set line turnaround timings
+ */
+void ModbusRTUTransport::setTimings(uint32_t turnaroundMs, uint32_t frameSilenceMs) {
+    _turnaround = turnaroundMs;
+    _frameSilence = frameSilenceMs;
+}
+
+/**
+ * @brief Complete a response as soon as its expected length has arrived with a valid CRC
+ *
+ * The end-of-frame silence guards against a response that is longer than
+ * expected; with a matching CRC at the exact length that is not the case.
+ */
+void ModbusRTUTransport::setCompleteOnLength(bool enabled) {
+    _completeOnLength = enabled;
+}
+
+/**
+ * @brief Take responses from an interrupt-fed frame assembler
+ */
+void ModbusRTUTransport::setFrameAssembler(ModbusFrameAssembler* assembler) {
+    _assembler = assembler;
+}
+
+/**
+ * @brief Get serial stream pointer
+ */
+Stream* ModbusRTUTransport::getSerial() {
+    return _serial;
+}
+
+/**
+ * @brief Called before a transaction is sent, e.g. to (re)connect
+ */
+bool ModbusRTUTransport::prepareLink() {
+    return true;
+}
+
+/**
+ * @brief Send the next queued transaction, if any
+ */
+void ModbusRTUTransport::startNext() {
+    while (_queueHead != NULL) {
+        ModbusTransaction* txn = _queueHead;
+        _queueHead = txn->next;
+        if (_queueHead == NULL) {
+            _queueTail = NULL;
+        }
+
+        if (!prepareLink()) {
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+            continue;
+        }
+
+        _active = txn;
+        _foundSlaveAddr = false;
+        _lastByteTime = 0;
+
+        // Clear any remaining data in buffer before sending
+        while (_serial->available()) {
+            _serial->read();
+        }
+        if (_assembler != NULL) {
+            while (_assembler->front() != NULL) {
+                _assembler->pop();
+            }
+        }
+
+        // Drive the line, send the request and listen as soon as its last stop bit is out
+        _direction->beginTransmit();
+        _serial->write(txn->request, txn->requestLength);
+        _direction->endTransmit(_serial);
+        _sentUs = micros();
+
+        _state = STATE_TURNAROUND;
+        _stateTime = millis();
+        return;
+    }
+}
+
+/**
+ * @brief Finish the active transaction
+ */
+void ModbusRTUTransport::finish(uint8_t status) {
+    ModbusTransaction* txn = _active;
+    _active = NULL;
+    _state = STATE_IDLE;
+    complete(txn, status);
+}
+
+/**
+ * @brief Complete the active transaction from assembled frames, if one matches
+ */
+bool ModbusRTUTransport::receiveFrame() {
+    const ModbusFrame* frame;
+    while ((frame = _assembler->front()) != NULL) {
+        // Skip noise, other slaves and anything that started before the request was sent
+        if (frame->length < 2 || frame->data[0] != _active->slaveAddr() ||
+            (int32_t)(frame->startUs - _sentUs) < 0) {
+            _assembler->pop();
+            continue;
+        }
+
+        uint16_t length = frame->length < _active->responseSize ? frame->length : _active->responseSize;
+        memcpy(_active->response, frame->data, length);
+        _active->responseLength = length;
+        bool crcValid = frame->crcValid && length == frame->length;
+        _assembler->pop();
+
+        finish(crcValid ? validate(_active) : MODBUS_TRANSACTION_CRC_ERROR);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Constructor for RTU-over-TCP transport
+ */
+ModbusRTUOverTCPTransport::ModbusRTUOverTCPTransport(Client& client, IPAddress ip, uint16_t port)
+    : ModbusRTUTransport(&client), _client(client), _ip(ip), _port(port) {
+    // The gateway delivers whole frames, no line turnaround is needed
+    setTimings(0, MODBUS_RTU_FRAME_SILENCE_MS);
+}
+
+/**
+ * @brief Open the gateway connection if needed
+ */
+bool ModbusRTUOverTCPTransport::prepareLink() {
+    if (_client.connected()) {
+        return true;
+    }
+    _client.stop();
+    return _client.connect(_ip, _port) == 1;
+}
+
+/**
+ * @brief Constructor for Modbus-TCP transport
+ */
+ModbusTCPTransport::ModbusTCPTransport(Client& client, IPAddress ip, uint16_t port)
+    : _client(client), _ip(ip), _port(port), _maxInFlight(MODBUS_TCP_MAX_IN_FLIGHT),
+      _nextTransactionId(1), _queueHead(NULL), _queueTail(NULL), _rxLength(0) {
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        _inFlight[i] = NULL;
+    }
+}
+
+/**
+ * @brief Queue a transaction (non-blocking)
+ */
+bool ModbusTCPTransport::submit(ModbusTransaction* txn) {
+    // MBAP carries address + PDU, the RTU CRC is dropped
+    if (txn == NULL || txn->request == NULL || txn->response == NULL ||
+        txn->requestLength < 4 || txn->requestLength - 2 > MODBUS_MAX_ADU_SIZE - 2) {
+        return false;
+    }
+
+    txn->status = MODBUS_TRANSACTION_PENDING;
+    txn->responseLength = 0;
+    enqueue(_queueHead, _queueTail, txn);
+    return true;
+}
+
+/**
+ * @brief Advance pending transactions (non-blocking)
+ */
+void ModbusTCPTransport::poll() {
+    if (isIdle()) {
+        return;
+    }
+
+    if (!_client.connected()) {
+        // Replies to requests sent on a lost connection will never arrive
+        for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+            if (_inFlight[i] != NULL) {
+                ModbusTransaction* txn = _inFlight[i];
+                _inFlight[i] = NULL;
+                complete(txn, MODBUS_TRANSACTION_FAILED);
+            }
+        }
+        _rxLength = 0;
+        _client.stop();
+        if (_queueHead != NULL && _client.connect(_ip, _port) != 1) {
+            disconnect();
+            return;
+        }
+    }
+
+    sendQueued();
+    receive();
+
+    // Expire requests whose reply did not arrive in time
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        ModbusTransaction* txn = _inFlight[i];
+        if (txn != NULL && millis() - txn->startTime >= txn->timeout) {
+            _inFlight[i] = NULL;
+            complete(txn, MODBUS_TRANSACTION_TIMEOUT);
+        }
+    }
+}
+
+/**
+ * @brief Check whether no transaction is queued or in flight
+ */
+bool ModbusTCPTransport::isIdle() const {
+    if (_queueHead != NULL) {
+        return false;
+    }
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        if (_inFlight[i] != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Set the number of requests kept in flight
+ */
+void ModbusTCPTransport::setMaxInFlight(uint8_t maxInFlight) {
+    if (maxInFlight < 1) {
+        maxInFlight = 1;
+    }
+    if (maxInFlight > MODBUS_TCP_MAX_IN_FLIGHT) {
+        maxInFlight = MODBUS_TCP_MAX_IN_FLIGHT;
+    }
+    _maxInFlight = maxInFlight;
+}
+
+/**
+ * @brief Close the connection and fail every pending transaction
+ */
+void ModbusTCPTransport::disconnect() {
+    _client.stop();
+    _rxLength = 0;
+
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        if (_inFlight[i] != NULL) {
+            ModbusTransaction* txn = _inFlight[i];
+            _inFlight[i] = NULL;
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+        }
+    }
+    while (_queueHead != NULL) {
+        ModbusTransaction* txn = _queueHead;
+        _queueHead = txn->next;
+        complete(txn, MODBUS_TRANSACTION_FAILED);
+    }
+    _queueTail = NULL;
+}
+
+/**
+ * @brief Send queued transactions while pipeline slots are free
+ */
+void ModbusTCPTransport::sendQueued() {
+    uint8_t inFlight = 0;
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        if (_inFlight[i] != NULL) {
+            inFlight++;
+        }
+    }
+
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT && _queueHead != NULL && inFlight < _maxInFlight; i++) {
+        if (_inFlight[i] != NULL) {
+            continue;
+        }
+
+        ModbusTransaction* txn = _queueHead;
+        _queueHead = txn->next;
+        if (_queueHead == NULL) {
+            _queueTail = NULL;
+        }
+
+        // MBAP header: transaction ID, protocol ID (0), length (unit ID + PDU)
+        uint16_t length = txn->requestLength - 2;
+        uint8_t frame[MODBUS_MAX_ADU_SIZE + 6];
+        txn->transactionId = _nextTransactionId++;
+        frame[0] = (txn->transactionId >> 8) & 0xFF;
+        frame[1] = txn->transactionId & 0xFF;
+        frame[2] = 0x00;
+        frame[3] = 0x00;
+        frame[4] = (length >> 8) & 0xFF;
+        frame[5] = length & 0xFF;
+        memcpy(frame + 6, txn->request, length);
+
+        if (_client.write(frame, 6 + length) != (size_t)(6 + length)) {
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+            continue;
+        }
+
+        txn->startTime = millis();
+        _inFlight[i] = txn;
+        inFlight++;
+    }
+}
+
+/**
+ * @brief Read reply bytes and complete matching transactions
+ */
+void ModbusTCPTransport::receive() {
+    while (_client.available()) {
+        _rx[_rxLength++] = _client.read();
+
+        if (_rxLength < 6) {
+            continue;
+        }
+
+        uint16_t length = (_rx[4] << 8) | _rx[5];
+        if (_rx[2] != 0 || _rx[3] != 0 || length < 2 || (size_t)(6 + length) > sizeof(_rx)) {
+            disconnect(); // Lost framing, start over on a fresh connection
+            return;
+        }
+        if (_rxLength == 6 + length) {
+            dispatch();
+            _rxLength = 0;
+        }
+    }
+}
+
+/**
+ * @brief Complete the in-flight transaction matching a full MBAP reply
+ */
+void ModbusTCPTransport::dispatch() {
+    uint16_t transactionId = (_rx[0] << 8) | _rx[1];
+    uint16_t length = (_rx[4] << 8) | _rx[5];
+
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_IN_FLIGHT; i++) {
+        ModbusTransaction* txn = _inFlight[i];
+        if (txn == NULL || txn->transactionId != transactionId) {
+            continue;
+        }
+        _inFlight[i] = NULL;
+
+        // A reply from another unit or to another function is not the answer to this request
+        if (_rx[6] != txn->slaveAddr() || (_rx[7] & 0x7F) != txn->function()) {
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+            return;
+        }
+
+        // Rebuild the RTU frame: unit ID + PDU + CRC
+        if (length + 2 > txn->responseSize) {
+            complete(txn, MODBUS_TRANSACTION_FAILED);
+            return;
+        }
+        memcpy(txn->response, _rx + 6, length);
+        uint16_t crc = modbusCRC16(txn->response, length);
+        txn->response[length] = crc & 0xFF;             // CRC Low byte
+        txn->response[length + 1] = (crc >> 8) & 0xFF;  // CRC High byte
+        txn->responseLength = length + 2;
+
+        complete(txn, validate(txn));
+        return;
+    }
+    // No match: reply to a request that already timed out
+}
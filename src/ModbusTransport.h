@@ -0,0 +1,387 @@
+/**
+ * @file ModbusTransport.h
+ * @brief Transports carrying Modbus-RTU transactions (serial RS485, Modbus-TCP, RTU-over-TCP)
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef MODBUSTRANSPORT_H
+#define MODBUSTRANSPORT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <IPAddress.h>
+#include "ModbusProtocol.h"
+#include "ModbusFrameAssembler.h"
+#include "ModbusDirection.h"
+
+/**
+ * @defgroup ModbusTransactionStatus Modbus Transaction Status
+ * @brief Values of ModbusTransaction::status
+ * @{
+ */
+#define MODBUS_TRANSACTION_PENDING    0  ///< Queued or in flight
+#define MODBUS_TRANSACTION_OK         1  ///< Valid response received
+#define MODBUS_TRANSACTION_TIMEOUT    2  ///< No complete response within the timeout
+#define MODBUS_TRANSACTION_CRC_ERROR  3  ///< Response received with invalid CRC
+#define MODBUS_TRANSACTION_EXCEPTION  4  ///< Device answered with an exception response
+#define MODBUS_TRANSACTION_FAILED     5  ///< Request could not be sent (e.g. connection lost)
+/** @} */
+
+/**
+ * @defgroup ModbusTransportDefaults Modbus Transport Defaults
+ * @{
+ */
+#define MODBUS_RTU_TURNAROUND_MS      0   ///< Extra wait after sending before listening (ms)
+#define MODBUS_RTU_FRAME_SILENCE_MS   10  ///< Silence that ends a response frame (ms)
+#ifndef MODBUS_RTU_ENABLE_GUARD_US
+#define MODBUS_RTU_ENABLE_GUARD_US    1200  ///< Default guard of setEnable(): one 8N2 character at 9600 baud (us)
+#endif
+#define MODBUS_TCP_PORT               502 ///< Standard Modbus-TCP port
+#ifndef MODBUS_TCP_MAX_IN_FLIGHT
+#define MODBUS_TCP_MAX_IN_FLIGHT      8   ///< Maximum pipelined Modbus-TCP requests
+#endif
+/** @} */
+
+struct ModbusTransaction;
+
+/**
+ * @brief Completion callback of a transaction
+ * @param txn Completed transaction (status is set)
+ * @param context User context given in ModbusTransaction::context
+ */
+typedef void (*ModbusCompletionCallback)(ModbusTransaction* txn, void* context);
+
+/**
+ * @struct ModbusTransaction
+ * @brief One Modbus-RTU request/response exchange
+ *
+ * Request and response are always RTU frames (address + PDU + CRC), whatever
+ * the transport, so device code parses responses the same way everywhere. The
+ * buffers belong to the caller and must stay valid until the transaction completes.
+ */
+struct ModbusTransaction {
+    const uint8_t* request;         ///< Request frame including CRC
+    uint16_t requestLength;         ///< Request frame length
+    uint8_t* response;              ///< Buffer receiving the response frame
+    uint16_t responseSize;          ///< Size of the response buffer
+    uint16_t responseLength;        ///< Bytes received
+    uint16_t expectedLength;        ///< Minimum response length of a successful reply
+    uint32_t timeout;               ///< Response timeout in milliseconds
+    uint32_t startTime;             ///< Time the request was sent (millis)
+    volatile uint8_t status;        ///< Transaction status (MODBUS_TRANSACTION_*)
+    uint16_t transactionId;         ///< MBAP transaction ID (Modbus-TCP only)
+    ModbusCompletionCallback onComplete;  ///< Called on completion (NULL if not used)
+    void* context;                  ///< User context passed to onComplete
+    bool priority;                  ///< Queued ahead of non-priority transactions (interactive requests)
+    ModbusTransaction* next;        ///< Queue link, owned by the transport
+
+    /**
+     * @brief Constructor, creates an empty transaction
+     */
+    ModbusTransaction();
+
+    /**
+     * @brief Prepare the transaction for submission
+     * @param requestFrame Request frame including CRC
+     * @param requestFrameLength Request frame length
+     * @param responseBuffer Buffer receiving the response frame
+     * @param responseBufferSize Size of the response buffer
+     * @param minResponseLength Length of a successful response
+     * @param responseTimeout Response timeout in milliseconds
+     */
+    void prepare(const uint8_t* requestFrame, uint16_t requestFrameLength, uint8_t* responseBuffer,
+                 uint16_t responseBufferSize, uint16_t minResponseLength, uint32_t responseTimeout);
+
+    /**
+     * @brief Get slave address of the request
+     * @return Slave device address
+     */
+    uint8_t slaveAddr() const { return request[0]; }
+
+    /**
+     * @brief Get function code of the request
+     * @return Modbus function code
+     */
+    uint8_t function() const { return request[1]; }
+};
+
+/**
+ * @class ModbusTransport
+ * @brief Base class of all Modbus transports
+ *
+ * A transport accepts transactions with submit() and makes progress in poll(),
+ * which never blocks. execute() is the blocking convenience used by the RS485
+ * device classes.
+ */
+class ModbusTransport {
+public:
+    virtual ~ModbusTransport() {}
+
+    /**
+     * @brief Queue a transaction (non-blocking)
+     * @param txn Prepared transaction
+     * @return true if accepted, false otherwise
+     */
+    virtual bool submit(ModbusTransaction* txn) = 0;
+
+    /**
+     * @brief Advance pending transactions (non-blocking)
+     */
+    virtual void poll() = 0;
+
+    /**
+     * @brief Check whether no transaction is queued or in flight
+     * @return true if idle
+     */
+    virtual bool isIdle() const = 0;
+
+    /**
+     * @brief Submit a transaction and wait for its completion
+     * @param txn Prepared transaction
+     * @return true if a valid response was received, false otherwise
+     */
+    bool execute(ModbusTransaction* txn);
+
+protected:
+    /**
+     * @brief Finish a transaction and invoke its callback
+     * @param txn Transaction
+     * @param status Final status (MODBUS_TRANSACTION_*)
+     */
+    void complete(ModbusTransaction* txn, uint8_t status);
+
+    /**
+     * @brief Classify a received RTU response frame
+     * @param txn Transaction holding the response
+     * @return MODBUS_TRANSACTION_OK, _TIMEOUT, _EXCEPTION or _CRC_ERROR
+     */
+    static uint8_t validate(const ModbusTransaction* txn);
+
+    /**
+     * @brief Append a transaction to a queue, priority transactions ahead of the others
+     * @param head Queue head
+     * @param tail Queue tail
+     * @param txn Transaction
+     * @note Priority transactions keep their submission order among themselves and
+     *       never overtake the transaction already on the wire.
+     */
+    static void enqueue(ModbusTransaction*& head, ModbusTransaction*& tail, ModbusTransaction* txn);
+};
+
+/**
+ * @class ModbusRTUTransport
+ * @brief Modbus-RTU over a serial Stream (RS485 or UART), one transaction at a time
+ */
+class ModbusRTUTransport : public ModbusTransport {
+public:
+    /**
+     * @brief Constructor for serial RTU transport
+     * @param serial Pointer to Stream object (HardwareSerial, SoftwareSerial or Client)
+     */
+    ModbusRTUTransport(Stream* serial);
+
+    bool submit(ModbusTransaction* txn);
+    void poll();
+    bool isIdle() const;
+
+    /**
+     * @brief Set RS485 enable pin for MAX485 transceiver
+     * @param enablePin GPIO pin number for DE/RE control
+     * @param guardUs Wait after flush() before listening, in microseconds (default: one character at 9600 baud)
+     * @note The guard keeps the last character whole where flush() returns before it is out
+     *       (ESP8266). Give one character at the line speed: 11 bits / baud, e.g. 4600 at 2400 baud.
+     */
+    void setEnable(uint8_t enablePin, uint32_t guardUs = MODBUS_RTU_ENABLE_GUARD_US);
+
+    /**
+     * @brief Set the direction-control strategy of the transceiver
+     * @param direction Strategy (e.g. ModbusSplitDirection), or NULL for none (automatic direction)
+     */
+    void setDirectionControl(ModbusDirectionControl* direction);
+
+    /**
+     * @brief Set line turnaround timings
+     * @param turnaroundMs Extra wait after sending before listening (default: 0 ms)
+     * @param frameSilenceMs Silence that ends a response frame (default: 10 ms)
+     */
+    void setTimings(uint32_t turnaroundMs, uint32_t frameSilenceMs);
+
+    /**
+     * @brief Complete a response as soon as its expected length has arrived with a valid CRC
+     * @param enabled true to skip the end-of-frame silence when the length and CRC match,
+     *        false to always wait for it (default)
+     * @note Exception responses complete on their 5 bytes. A response whose CRC does not
+     *       match at the expected length still waits for the silence.
+     */
+    void setCompleteOnLength(bool enabled);
+
+    /**
+     * @brief Take responses from an interrupt-fed frame assembler instead of reading the stream
+     * @param assembler Frame assembler fed by the UART RX interrupt, or NULL to read the stream
+     */
+    void setFrameAssembler(ModbusFrameAssembler* assembler);
+
+    /**
+     * @brief Get serial stream pointer
+     * @return Pointer to Stream object
+     */
+    Stream* getSerial();
+
+protected:
+    /**
+     * @brief Called before a transaction is sent, e.g. to (re)connect
+     * @return true if the link is usable, false to fail the transaction
+     */
+    virtual bool prepareLink();
+
+private:
+    /**
+     * @brief Transaction state machine states
+     */
+    enum State {
+        STATE_IDLE,        ///< Nothing in flight
+        STATE_TURNAROUND,  ///< Request sent, waiting before listening
+        STATE_RECEIVING    ///< Collecting response bytes
+    };
+
+    Stream* _serial;                ///< Pointer to serial communication stream
+    ModbusAutoDirection _autoDirection;  ///< Strategy used without an enable pin
+    ModbusGPIODirection _pinDirection;   ///< Strategy used by setEnable()
+    ModbusDirectionControl* _direction;  ///< Active direction-control strategy
+    uint32_t _turnaround;           ///< Turnaround time in milliseconds
+    uint32_t _frameSilence;         ///< End-of-frame silence in milliseconds
+    bool _completeOnLength;         ///< Complete without the silence once length and CRC match
+    State _state;                   ///< Current state
+    uint32_t _stateTime;            ///< Time the current state was entered
+    uint32_t _lastByteTime;         ///< Time the last response byte was received
+    bool _foundSlaveAddr;           ///< Response start (slave address) seen
+    ModbusFrameAssembler* _assembler;  ///< Frame source (NULL to read the stream)
+    uint32_t _sentUs;               ///< Time the request was sent (micros)
+    ModbusTransaction* _active;     ///< Transaction in flight
+    ModbusTransaction* _queueHead;  ///< First queued transaction
+    ModbusTransaction* _queueTail;  ///< Last queued transaction
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Send the next queued transaction, if any
+     */
+    void startNext();
+
+    /**
+     * @brief Finish the active transaction
+     * @param status Final status
+     */
+    void finish(uint8_t status);
+
+    /**
+     * @brief Complete the active transaction from assembled frames, if one matches
+     * @return true if the transaction was completed
+     */
+    bool receiveFrame();
+
+    /** @} */
+};
+
+/**
+ * @class ModbusRTUOverTCPTransport
+ * @brief Raw Modbus-RTU frames tunnelled through a TCP connection to a serial gateway
+ *
+ * The gateway forwards bytes unchanged to its RS485 port, so only one transaction
+ * can be in flight. The connection is (re)opened on demand.
+ */
+class ModbusRTUOverTCPTransport : public ModbusRTUTransport {
+public:
+    /**
+     * @brief Constructor for RTU-over-TCP transport
+     * @param client Network client (e.g. WiFiClient or EthernetClient)
+     * @param ip Gateway IP address
+     * @param port Gateway TCP port
+     */
+    ModbusRTUOverTCPTransport(Client& client, IPAddress ip, uint16_t port);
+
+protected:
+    bool prepareLink();
+
+private:
+    Client& _client;  ///< Network client
+    IPAddress _ip;    ///< Gateway address
+    uint16_t _port;   ///< Gateway port
+};
+
+/**
+ * @class ModbusTCPTransport
+ * @brief Modbus-TCP (MBAP) client with pipelined requests
+ *
+ * Up to MODBUS_TCP_MAX_IN_FLIGHT requests are sent without waiting for the
+ * previous reply; replies are matched by transaction ID, so a gateway that
+ * queues requests hides the network round trip. RTU frames given by the caller
+ * are converted to MBAP and the replies back to RTU frames (with CRC). A reply
+ * whose unit ID or function differs from its request fails the transaction
+ * (MODBUS_TRANSACTION_FAILED).
+ */
+class ModbusTCPTransport : public ModbusTransport {
+public:
+    /**
+     * @brief Constructor for Modbus-TCP transport
+     * @param client Network client (e.g. WiFiClient or EthernetClient)
+     * @param ip Server IP address
+     * @param port Server TCP port (default: 502)
+     */
+    ModbusTCPTransport(Client& client, IPAddress ip, uint16_t port = MODBUS_TCP_PORT);
+
+    bool submit(ModbusTransaction* txn);
+    void poll();
+    bool isIdle() const;
+
+    /**
+     * @brief Set the number of requests kept in flight
+     * @param maxInFlight 1 to MODBUS_TCP_MAX_IN_FLIGHT (1 disables pipelining)
+     */
+    void setMaxInFlight(uint8_t maxInFlight);
+
+    /**
+     * @brief Close the connection and fail every pending transaction
+     */
+    void disconnect();
+
+private:
+    Client& _client;                ///< Network client
+    IPAddress _ip;                  ///< Server address
+    uint16_t _port;                 ///< Server port
+    uint8_t _maxInFlight;           ///< Pipelining depth
+    uint16_t _nextTransactionId;    ///< Next MBAP transaction ID
+    ModbusTransaction* _inFlight[MODBUS_TCP_MAX_IN_FLIGHT];  ///< Requests awaiting a reply
+    ModbusTransaction* _queueHead;  ///< First queued transaction
+    ModbusTransaction* _queueTail;  ///< Last queued transaction
+    uint8_t _rx[MODBUS_MAX_ADU_SIZE + 6];  ///< Reply being assembled
+    uint16_t _rxLength;             ///< Bytes in _rx
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Send queued transactions while pipeline slots are free
+     */
+    void sendQueued();
+
+    /**
+     * @brief Read reply bytes and complete matching transactions
+     */
+    void receive();
+
+    /**
+     * @brief Complete the in-flight transaction matching a full MBAP reply
+     */
+    void dispatch();
+
+    /** @} */
+};
+
+#endif // MODBUSTRANSPORT_H
@@ -0,0 +1,305 @@
+/**
+ * @file PZEMBoundary.cpp
+ * @brief Implementation of the billing boundary capture
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMBoundary.h"
+
+/**
+ * @brief Constructor for a boundary capture
+ */
+PZEMBoundaryCapture::PZEMBoundaryCapture(PZEMBus& bus)
+    : _bus(bus), _state(STATE_IDLE), _period(PZEM_BOUNDARY_DEFAULT_PERIOD_S), _drain(PZEM_BOUNDARY_DEFAULT_DRAIN_MS),
+      _timeout(PZEM_BOUNDARY_DEFAULT_TIMEOUT_MS), _readMs(PZEM_BOUNDARY_DEFAULT_READ_MS), _clockSet(false),
+      _epochBase(0), _millisBase(0), _boundary(0), _boundaryMs(0), _burstStart(0), _burstBegan(0), _nextReading(0),
+      _done(0), _onReport(NULL), _onReportContext(NULL) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        _subscribed[i] = 0;
+    }
+    for (uint8_t i = 0; i < PZEM_BOUNDARY_IN_FLIGHT; i++) {
+        _slots[i].capture = this;
+    }
+    _report.count = 0;
+}
+
+/**
+ * @brief Read a device at every boundary
+ */
+bool PZEMBoundaryCapture::subscribe(uint8_t slaveAddr) {
+    if (_bus.getModel(slaveAddr) == PZEM_MODEL_UNKNOWN) {
+        return false;
+    }
+
+    uint8_t* free = NULL;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_subscribed[i] == slaveAddr) {
+            return false;
+        }
+        if (free == NULL && _subscribed[i] == 0) {
+            free = &_subscribed[i];
+        }
+    }
+    if (free == NULL) {
+        return false;
+    }
+    *free = slaveAddr;
+
+    // The burst gets longer: start it earlier
+    if (_state == STATE_IDLE) {
+        plan();
+    }
+    return true;
+}
+
+/**
+ * @brief Stop reading a device at boundaries
+ */
+bool PZEMBoundaryCapture::unsubscribe(uint8_t slaveAddr) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_subscribed[i] == slaveAddr && slaveAddr != 0) {
+            _subscribed[i] = 0;
+            if (_state == STATE_IDLE) {
+                plan();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Set the boundary period
+ */
+void PZEMBoundaryCapture::setPeriod(uint32_t periodS) {
+    _period = periodS > 0 ? periodS : 1;
+    if (_state == STATE_IDLE) {
+        plan();
+    }
+}
+
+/**
+ * @brief Set the wall clock
+ */
+void PZEMBoundaryCapture::setClock(uint32_t epochSeconds, uint16_t milliseconds) {
+    _epochBase = epochSeconds;
+    _millisBase = millis() - milliseconds;
+    _clockSet = true;
+
+    // A burst in progress keeps its boundary; anything planned moves with the clock
+    if (_state == STATE_DRAINING) {
+        _bus.setPaused(false);
+        _state = STATE_IDLE;
+    }
+    if (_state == STATE_IDLE) {
+        plan();
+    }
+}
+
+/**
+ * @brief Set the time given to the bus to finish its reads before a burst
+ */
+void PZEMBoundaryCapture::setDrainTime(uint32_t drainMs) {
+    _drain = drainMs;
+    if (_state == STATE_IDLE) {
+        plan();
+    }
+}
+
+/**
+ * @brief Set the response timeout of the energy reads
+ */
+void PZEMBoundaryCapture::setTimeout(uint32_t timeoutMs) {
+    _timeout = timeoutMs;
+}
+
+/**
+ * @brief Set callback receiving the report of every boundary
+ */
+void PZEMBoundaryCapture::setReportCallback(PZEMBoundaryCallback callback, void* context) {
+    _onReport = callback;
+    _onReportContext = context;
+}
+
+/**
+ * @brief Advance the boundary capture and the bus within a time budget
+ */
+bool PZEMBoundaryCapture::poll(uint32_t budgetUs) {
+    uint32_t now = millis();
+
+    if (_state == STATE_IDLE && _clockSet && (int32_t)(now - (_burstStart - _drain)) >= 0) {
+        // Let the reads in flight finish; nothing new is started until the burst
+        _bus.setPaused(true);
+        _state = STATE_DRAINING;
+
+        // Offline devices are read after the boundary, centre on the others
+        uint8_t online = 0;
+        for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+            if (_subscribed[i] != 0 && _bus.isOnline(_subscribed[i])) {
+                online++;
+            }
+        }
+        _burstStart = _boundaryMs - ((online + 1) * _readMs) / 2;
+    }
+    if (_state == STATE_DRAINING && (int32_t)(now - _burstStart) >= 0 && _bus.isDrained()) {
+        startBurst();
+    }
+    return _bus.poll(budgetUs);
+}
+
+/**
+ * @brief Get the boundary being planned
+ */
+uint32_t PZEMBoundaryCapture::getNextBoundary() const {
+    return _clockSet ? _boundary : 0;
+}
+
+/**
+ * @brief Plan the next boundary that can still be drained for
+ */
+void PZEMBoundaryCapture::plan() {
+    if (!_clockSet) {
+        return;
+    }
+
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_subscribed[i] != 0) {
+            count++;
+        }
+    }
+
+    // Centre the burst on the boundary: reading k of n completes k read times after the
+    // start, so the first one is as early as the last one is late
+    uint32_t now = millis();
+    uint32_t nowEpoch = _epochBase + (now - _millisBase) / 1000;
+    _boundary = (nowEpoch / _period + 1) * _period;
+    for (;;) {
+        _boundaryMs = _millisBase + (_boundary - _epochBase) * 1000;
+        _burstStart = _boundaryMs - ((count + 1) * _readMs) / 2;
+        if ((int32_t)(_burstStart - _drain - now) >= 0) {
+            break;
+        }
+        _boundary += _period;
+    }
+}
+
+/**
+ * @brief Order the subscribed devices and start the burst
+ */
+void PZEMBoundaryCapture::startBurst() {
+    _report.boundary = _boundary;
+    _report.count = 0;
+    _report.maxSkewMs = 0;
+
+    // Devices expected to answer first, so timeouts only delay the end of the burst
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+            uint8_t slaveAddr = _subscribed[i];
+            if (slaveAddr == 0 || _bus.isOnline(slaveAddr) != (pass == 0)) {
+                continue;
+            }
+            PZEMBoundaryReading& reading = _report.readings[_report.count++];
+            reading.slaveAddr = slaveAddr;
+            reading.model = _bus.getModel(slaveAddr);
+            reading.valid = false;
+            reading.energy = 0;
+            reading.skewMs = 0;
+        }
+    }
+
+    _state = STATE_BURST;
+    _burstBegan = millis();
+    _nextReading = 0;
+    _done = 0;
+    for (uint8_t i = 0; i < PZEM_BOUNDARY_IN_FLIGHT; i++) {
+        submitNext(&_slots[i]);
+    }
+    if (_done == _report.count) {
+        finish();
+    }
+}
+
+/**
+ * @brief Submit the next energy read into a slot
+ */
+bool PZEMBoundaryCapture::submitNext(Slot* slot) {
+    while (_nextReading < _report.count) {
+        uint8_t index = _nextReading++;
+        PZEMBoundaryReading& reading = _report.readings[index];
+        const PZEMModelInfo* info = pzemModelInfo(reading.model);
+        if (info != NULL) {
+            modbusBuildReadRequest(slot->request, reading.slaveAddr, MODBUS_READ_INPUT_REGISTERS, info->energyRegister, 2);
+            slot->txn.prepare(slot->request, sizeof(slot->request), slot->response, sizeof(slot->response),
+                              modbusReadResponseLength(2), _timeout);
+            slot->txn.onComplete = onComplete;
+            slot->txn.context = slot;
+            slot->reading = index;
+            if (_bus.submit(&slot->txn)) {
+                return true;
+            }
+        }
+        // Not sent: reported as invalid
+        _done++;
+    }
+    return false;
+}
+
+/**
+ * @brief Resume the sweep, deliver the report and plan the next boundary
+ */
+void PZEMBoundaryCapture::finish() {
+    uint8_t valid = 0;
+    int32_t lastSkew = 0;
+    for (uint8_t i = 0; i < _report.count; i++) {
+        const PZEMBoundaryReading& reading = _report.readings[i];
+        if (!reading.valid) {
+            continue;
+        }
+        uint32_t skew = reading.skewMs < 0 ? -reading.skewMs : reading.skewMs;
+        if (skew > _report.maxSkewMs) {
+            _report.maxSkewMs = skew;
+        }
+        if (valid == 0 || reading.skewMs > lastSkew) {
+            lastSkew = reading.skewMs;
+        }
+        valid++;
+    }
+
+    // The answered reads refine the estimate used to centre the next burst
+    if (valid > 0) {
+        uint32_t readMs = (_boundaryMs + lastSkew - _burstBegan) / valid;
+        _readMs = readMs > 0 ? readMs : 1;
+    }
+
+    _bus.setPaused(false);
+    _state = STATE_IDLE;
+    if (_onReport != NULL) {
+        _onReport(&_report, _onReportContext);
+    }
+    plan();
+}
+
+/**
+ * @brief Energy read completion callback
+ */
+void PZEMBoundaryCapture::onComplete(ModbusTransaction* txn, void* context) {
+    Slot* slot = static_cast<Slot*>(context);
+    PZEMBoundaryCapture* capture = slot->capture;
+    PZEMBoundaryReading& reading = capture->_report.readings[slot->reading];
+
+    if (txn->status == MODBUS_TRANSACTION_OK && slot->response[2] == 4) {
+        const PZEMModelInfo* info = pzemModelInfo(reading.model);
+        uint16_t low = modbusResponseRegister(slot->response, 0, info->bigEndian);
+        uint16_t high = modbusResponseRegister(slot->response, 1, info->bigEndian);
+        reading.energy = ((uint32_t)high << 16) | low;
+        reading.skewMs = (int32_t)(millis() - capture->_boundaryMs);
+        reading.valid = true;
+    }
+    capture->_done++;
+
+    if (!capture->submitNext(slot) && capture->_done == capture->_report.count) {
+        capture->finish();
+    }
+}
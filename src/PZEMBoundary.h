@@ -0,0 +1,218 @@
+/**
+ * @file PZEMBoundary.h
+ * @brief Energy readings aligned on billing interval boundaries
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMBOUNDARY_H
+#define PZEMBOUNDARY_H
+
+#include <Arduino.h>
+#include "PZEMBus.h"
+
+/**
+ * @defgroup PZEMBoundaryConfig Boundary Capture Configuration
+ * @brief Compile-time sizing and defaults of the boundary capture (override before including)
+ * @{
+ */
+#ifndef PZEM_BOUNDARY_IN_FLIGHT
+#define PZEM_BOUNDARY_IN_FLIGHT          2     ///< Energy reads queued on the transport at once
+#endif
+#define PZEM_BOUNDARY_DEFAULT_PERIOD_S   900   ///< Default boundary period (:00/:15/:30/:45)
+#define PZEM_BOUNDARY_DEFAULT_DRAIN_MS   500   ///< Default time given to the bus to drain
+#define PZEM_BOUNDARY_DEFAULT_TIMEOUT_MS 50    ///< Default response timeout of the energy reads
+#define PZEM_BOUNDARY_DEFAULT_READ_MS    20    ///< Initial estimate of one energy read (9600 baud)
+/** @} */
+
+/**
+ * @struct PZEMBoundaryReading
+ * @brief Energy counter of one device at a boundary
+ */
+struct PZEMBoundaryReading {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t model;            ///< Model identifier (PZEM_MODEL_*)
+    bool valid;               ///< Reading succeeded
+    uint32_t energy;          ///< Raw active energy counter (model resolution)
+    int32_t skewMs;           ///< Response time minus boundary time (negative = before)
+};
+
+/**
+ * @struct PZEMBoundaryReport
+ * @brief Energy readings of all subscribed devices at one boundary
+ */
+struct PZEMBoundaryReport {
+    uint32_t boundary;        ///< Boundary time (Unix time, seconds)
+    uint8_t count;            ///< Readings, in the order they were taken
+    uint32_t maxSkewMs;       ///< Largest absolute skew of the valid readings
+    PZEMBoundaryReading readings[PZEM_BUS_MAX_DEVICES];  ///< Readings
+};
+
+/**
+ * @brief Callback receiving the report of every boundary
+ * @param report Boundary report (valid during the call only)
+ * @param context User context given to setReportCallback()
+ */
+typedef void (*PZEMBoundaryCallback)(const PZEMBoundaryReport* report, void* context);
+
+/**
+ * @class PZEMBoundaryCapture
+ * @brief Reads the energy counters of subscribed devices as close as possible to each boundary
+ *
+ * Boundaries are multiples of the period in Unix time, so the wall clock must be
+ * given with setClock() (e.g. after an NTP sync). Each boundary is planned ahead:
+ * the sweep of the bus is paused a drain time before the burst so reads in flight
+ * finish, then the energy registers of every subscribed device are read back to
+ * back, with the burst centred on the boundary so that the largest skew is about
+ * half the burst length. Devices offline at planning time are read last, so their
+ * timeouts do not push the others away from the boundary. The sweep resumes right
+ * after the burst and the readings are reported with their skew.
+ */
+class PZEMBoundaryCapture {
+public:
+    /**
+     * @brief Constructor for a boundary capture
+     * @param bus Bus reading the devices
+     */
+    PZEMBoundaryCapture(PZEMBus& bus);
+
+    /**
+     * @brief Read a device at every boundary
+     * @param slaveAddr Slave device address (must be in the sweep of the bus)
+     * @return true if subscribed, false if the device is unknown, already subscribed or the table full
+     */
+    bool subscribe(uint8_t slaveAddr);
+
+    /**
+     * @brief Stop reading a device at boundaries
+     * @param slaveAddr Slave device address
+     * @return true if removed, false if not subscribed
+     */
+    bool unsubscribe(uint8_t slaveAddr);
+
+    /**
+     * @brief Set the boundary period
+     * @param periodS Period in seconds (default: 900)
+     */
+    void setPeriod(uint32_t periodS);
+
+    /**
+     * @brief Set the wall clock
+     * @param epochSeconds Current Unix time in seconds
+     * @param milliseconds Fraction of the current second in milliseconds (default: 0)
+     * @note Call again after every clock synchronization; a boundary already planned is re-planned.
+     */
+    void setClock(uint32_t epochSeconds, uint16_t milliseconds = 0);
+
+    /**
+     * @brief Set the time given to the bus to finish its reads before a burst
+     * @param drainMs Drain time in milliseconds (at least the bus timeout)
+     */
+    void setDrainTime(uint32_t drainMs);
+
+    /**
+     * @brief Set the response timeout of the energy reads
+     * @param timeoutMs Response timeout in milliseconds (default: 50)
+     */
+    void setTimeout(uint32_t timeoutMs);
+
+    /**
+     * @brief Set callback receiving the report of every boundary
+     * @param callback Callback, or NULL to disable
+     * @param context User context passed to the callback
+     */
+    void setReportCallback(PZEMBoundaryCallback callback, void* context);
+
+    /**
+     * @brief Advance the boundary capture and the bus within a time budget (replaces PZEMBus::poll())
+     * @param budgetUs Maximum time to spend in microseconds
+     * @return true if transactions are still in flight, false if the bus is idle
+     */
+    bool poll(uint32_t budgetUs);
+
+    /**
+     * @brief Get the boundary being planned
+     * @return Unix time in seconds, or 0 if the clock is not set
+     */
+    uint32_t getNextBoundary() const;
+
+private:
+    /**
+     * @brief Capture state
+     */
+    enum State {
+        STATE_IDLE,           ///< Waiting for the drain time
+        STATE_DRAINING,       ///< Sweep paused, waiting for the burst start
+        STATE_BURST           ///< Energy reads in flight
+    };
+
+    /**
+     * @brief Buffers of one energy read in flight
+     */
+    struct Slot {
+        PZEMBoundaryCapture* capture;   ///< Owning capture (callback context)
+        uint8_t reading;                ///< Index in the report
+        ModbusTransaction txn;          ///< Transaction
+        uint8_t request[8];             ///< Request frame
+        uint8_t response[9];            ///< Response frame (two registers)
+    };
+
+    PZEMBus& _bus;                                  ///< Bus reading the devices
+    uint8_t _subscribed[PZEM_BUS_MAX_DEVICES];      ///< Subscribed addresses (0 = free)
+    Slot _slots[PZEM_BOUNDARY_IN_FLIGHT];           ///< Reads in flight
+    uint8_t _state;                                 ///< Current state (State)
+    uint32_t _period;                               ///< Boundary period in seconds
+    uint32_t _drain;                                ///< Drain time in milliseconds
+    uint32_t _timeout;                              ///< Energy read timeout in milliseconds
+    uint32_t _readMs;                               ///< Estimated duration of one energy read
+    bool _clockSet;                                 ///< Wall clock known
+    uint32_t _epochBase;                            ///< Unix time at _millisBase (seconds)
+    uint32_t _millisBase;                           ///< millis() at the start of second _epochBase
+    uint32_t _boundary;                             ///< Planned boundary (Unix time)
+    uint32_t _boundaryMs;                           ///< Planned boundary (millis)
+    uint32_t _burstStart;                           ///< Planned burst start (millis)
+    uint32_t _burstBegan;                           ///< Actual burst start (millis)
+    uint8_t _nextReading;                           ///< Next reading to submit
+    uint8_t _done;                                  ///< Completed readings
+    PZEMBoundaryReport _report;                     ///< Report in progress
+    PZEMBoundaryCallback _onReport;                 ///< Report callback (NULL if not used)
+    void* _onReportContext;                         ///< Report callback context
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Plan the next boundary that can still be drained for
+     */
+    void plan();
+
+    /**
+     * @brief Order the subscribed devices and start the burst
+     */
+    void startBurst();
+
+    /**
+     * @brief Submit the next energy read into a slot
+     * @param slot Free slot
+     * @return true if a read was submitted
+     */
+    bool submitNext(Slot* slot);
+
+    /**
+     * @brief Resume the sweep, deliver the report and plan the next boundary
+     */
+    void finish();
+
+    /**
+     * @brief Energy read completion callback
+     * @param txn Completed transaction
+     * @param context Slot holding the transaction
+     */
+    static void onComplete(ModbusTransaction* txn, void* context);
+
+    /** @} */
+};
+
+#endif // PZEMBOUNDARY_H
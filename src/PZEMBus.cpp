@@ -0,0 +1,726 @@
+/**
+ * @file PZEMBus.cpp
+ * @brief Implementation of the non-blocking bus poller
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMBus.h"
+#include <string.h>
+
+/**
+ * @brief Constructor for a bus poller
+ */
+PZEMBus::PZEMBus(ModbusTransport& transport)
+    : _transport(transport), _next(0), _inFlight(0), _userInFlight(0), _interval(PZEM_BUS_DEFAULT_INTERVAL_MS),
+      _heartbeat(0), _probeCount(0), _timeout(PZEM_BUS_DEFAULT_TIMEOUT_MS),
+      _baudrate(PZEM_BUS_DEFAULT_BAUDRATE), _readCount(0), _cache(NULL), _cadence(NULL),
+      _onSnapshot(NULL), _onSnapshotContext(NULL), _focus(0), _focusRegs(0), _onFocus(NULL), _onFocusContext(NULL),
+      _paused(false) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        _devices[i].slaveAddr = 0;
+        _devices[i].busy = false;
+        _devices[i].tracked = false;
+    }
+    memset(_registries, 0, sizeof(_registries));
+    _published = &_registries[0];
+    _adopted = 0;
+    _updating = false;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_IN_FLIGHT; i++) {
+        _slots[i].bus = this;
+        _slots[i].busy = false;
+    }
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_USER_TRANSACTIONS; i++) {
+        _user[i].bus = this;
+        _user[i].txn = NULL;
+    }
+}
+
+/**
+ * @brief Add a device to the sweep
+ */
+bool PZEMBus::addDevice(uint8_t slaveAddr, uint8_t model) {
+    if (slaveAddr == 0 || pzemModelInfo(model) == NULL) {
+        return false;
+    }
+
+    Registry* registry = beginUpdate();
+    uint8_t free = PZEM_BUS_MAX_DEVICES;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (registry->slaveAddr[i] == slaveAddr) {
+            endUpdate(registry, false);
+            return false;
+        }
+        if (registry->slaveAddr[i] == 0 && free == PZEM_BUS_MAX_DEVICES) {
+            free = i;
+        }
+    }
+    if (free == PZEM_BUS_MAX_DEVICES) {
+        endUpdate(registry, false);
+        return false;
+    }
+
+    registry->slaveAddr[free] = slaveAddr;
+    registry->model[free] = model;
+    endUpdate(registry, true);
+    return true;
+}
+
+/**
+ * @brief Remove a device from the sweep
+ */
+bool PZEMBus::removeDevice(uint8_t slaveAddr) {
+    if (slaveAddr == 0) {
+        return false;
+    }
+
+    Registry* registry = beginUpdate();
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (registry->slaveAddr[i] == slaveAddr) {
+            registry->slaveAddr[i] = 0;
+            endUpdate(registry, true);
+            return true;
+        }
+    }
+    endUpdate(registry, false);
+    return false;
+}
+
+/**
+ * @brief Move a device of the sweep to a new address
+ */
+bool PZEMBus::readdressDevice(uint8_t slaveAddr, uint8_t newAddr) {
+    if (slaveAddr == 0 || newAddr == 0 || newAddr > 247) {
+        return false;
+    }
+
+    Registry* registry = beginUpdate();
+    uint8_t index = PZEM_BUS_MAX_DEVICES;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (registry->slaveAddr[i] == newAddr) {
+            endUpdate(registry, false);
+            return false;
+        }
+        if (registry->slaveAddr[i] == slaveAddr) {
+            index = i;
+        }
+    }
+    if (index == PZEM_BUS_MAX_DEVICES) {
+        endUpdate(registry, false);
+        return false;
+    }
+
+    registry->slaveAddr[index] = newAddr;
+    endUpdate(registry, true);
+    return true;
+}
+
+/**
+ * @brief Set how often each device is read
+ */
+void PZEMBus::setInterval(uint32_t intervalMs) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        untrack(_devices[i]);
+    }
+    _interval = intervalMs;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        track(_devices[i]);
+    }
+}
+
+/**
+ * @brief Probe devices that have been silent for a while
+ */
+void PZEMBus::setHeartbeat(uint32_t idleMs) {
+    _heartbeat = idleMs;
+}
+
+/**
+ * @brief Set response timeout
+ */
+void PZEMBus::setTimeout(uint32_t timeoutMs) {
+    _timeout = timeoutMs;
+}
+
+/**
+ * @brief Set the line speed sizing the response timeouts
+ */
+void PZEMBus::setBaudRate(uint32_t baudrate) {
+    if (baudrate > 0) {
+        _baudrate = baudrate;
+    }
+}
+
+/**
+ * @brief Get the line speed sizing the response timeouts
+ */
+uint32_t PZEMBus::getBaudRate() const {
+    return _baudrate;
+}
+
+/**
+ * @brief Get the response timeout of a read
+ *
+ * The transport starts the timeout once the request is sent, so only the
+ * response is on the wire meanwhile. A fixed timeout either cuts the long
+ * PZEM-6L24 snapshot or waits far too long for a dead PZEM-004T.
+ */
+uint32_t PZEMBus::getTimeout(uint16_t numRegs) const {
+    return modbusWireTimeMs(modbusReadResponseLength(numRegs), _baudrate) + _timeout;
+}
+
+/**
+ * @brief Record every successful snapshot in a register cache
+ */
+void PZEMBus::setRegisterCache(PZEMRegisterCache* cache) {
+    _cache = cache;
+}
+
+/**
+ * @brief Record the cadence of the snapshots of every device
+ */
+void PZEMBus::setCadence(PZEMCadence* cadence) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        untrack(_devices[i]);
+    }
+    _cadence = cadence;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        track(_devices[i]);
+    }
+}
+
+/**
+ * @brief Set callback receiving every successful snapshot
+ */
+void PZEMBus::setSnapshotCallback(PZEMSnapshotCallback callback, void* context) {
+    _onSnapshot = callback;
+    _onSnapshotContext = context;
+}
+
+/**
+ * @brief Send an application transaction through the bus (non-blocking)
+ */
+bool PZEMBus::submit(ModbusTransaction* txn, bool priority) {
+    if (txn == NULL) {
+        return false;
+    }
+    txn->priority = priority;
+
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_USER_TRANSACTIONS; i++) {
+        UserTransaction& entry = _user[i];
+        if (entry.txn != NULL) {
+            continue;
+        }
+
+        // Interpose on the completion to record proof of life
+        entry.txn = txn;
+        entry.onComplete = txn->onComplete;
+        entry.context = txn->context;
+        txn->onComplete = onUserComplete;
+        txn->context = &entry;
+        if (!_transport.submit(txn)) {
+            txn->onComplete = entry.onComplete;
+            txn->context = entry.context;
+            entry.txn = NULL;
+            return false;
+        }
+        _userInFlight++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Give the bus to one device, read back to back
+ */
+bool PZEMBus::setFocus(uint8_t slaveAddr, uint8_t numRegs, PZEMSnapshotCallback callback, void* context) {
+    if (getModel(slaveAddr) == PZEM_MODEL_UNKNOWN || numRegs == 0 || numRegs > PZEM_SNAPSHOT_MAX_REGISTERS) {
+        return false;
+    }
+    _focus = slaveAddr;
+    _focusRegs = numRegs;
+    _onFocus = callback;
+    _onFocusContext = context;
+    return true;
+}
+
+/**
+ * @brief Return the bus to the normal sweep
+ */
+void PZEMBus::clearFocus() {
+    _focus = 0;
+}
+
+/**
+ * @brief Get the device holding the bus
+ */
+uint8_t PZEMBus::getFocus() const {
+    return _focus;
+}
+
+/**
+ * @brief Stop starting snapshots, probes and focus reads
+ */
+void PZEMBus::setPaused(bool paused) {
+    _paused = paused;
+}
+
+/**
+ * @brief Check whether nothing is in flight on the bus
+ */
+bool PZEMBus::isDrained() const {
+    return _inFlight == 0 && _userInFlight == 0;
+}
+
+/**
+ * @brief Advance the bus within a time budget
+ */
+bool PZEMBus::poll(uint32_t budgetUs) {
+    uint32_t start = micros();
+
+    // Follow changes of the device list published since the previous call
+    if (__atomic_load_n(&__atomic_load_n(&_published, __ATOMIC_ACQUIRE)->epoch, __ATOMIC_ACQUIRE) != _adopted) {
+        adoptRegistry();
+    }
+
+    do {
+        _transport.poll();
+        bool submitted = scheduleNext();
+
+        // Nothing in flight and nothing due: give the time back
+        if (!submitted && _inFlight == 0 && _userInFlight == 0) {
+            break;
+        }
+    } while (micros() - start < budgetUs);
+
+    return _inFlight > 0 || _userInFlight > 0;
+}
+
+/**
+ * @brief Check whether a device answered recently
+ */
+bool PZEMBus::isOnline(uint8_t slaveAddr) const {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr && slaveAddr != 0) {
+            return _devices[i].seen && _devices[i].failures < PZEM_BUS_OFFLINE_FAILURES;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Get the time of the last successful exchange with a device
+ */
+uint32_t PZEMBus::getLastSeen(uint8_t slaveAddr) const {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr && slaveAddr != 0) {
+            return _devices[i].seen ? _devices[i].lastSeen : 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get number of liveness probes sent
+ */
+uint32_t PZEMBus::getProbeCount() const {
+    return _probeCount;
+}
+
+/**
+ * @brief Get the model of a device in the sweep
+ */
+uint8_t PZEMBus::getModel(uint8_t slaveAddr) const {
+    Registry registry;
+    readRegistry(&registry);
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (registry.slaveAddr[i] == slaveAddr && slaveAddr != 0) {
+            return registry.model[i];
+        }
+    }
+    return PZEM_MODEL_UNKNOWN;
+}
+
+/**
+ * @brief Get number of devices in the sweep
+ */
+uint8_t PZEMBus::getDeviceCount() const {
+    Registry registry;
+    readRegistry(&registry);
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (registry.slaveAddr[i] != 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Get number of completed snapshot reads
+ */
+uint32_t PZEMBus::getReadCount() const {
+    return _readCount;
+}
+
+/**
+ * @brief Get the transport of the bus
+ */
+ModbusTransport& PZEMBus::getTransport() {
+    return _transport;
+}
+
+/**
+ * @brief Get the register cache fed by the bus
+ */
+PZEMRegisterCache* PZEMBus::getRegisterCache() {
+    return _cache;
+}
+
+/**
+ * @brief Take a consistent copy of the published device list
+ *
+ * A list is only modified while it is not published, so the copy is consistent
+ * if the same list, with the same epoch, is still published once it is taken.
+ */
+void PZEMBus::readRegistry(Registry* copy) const {
+    const Registry* registry;
+    uint32_t epoch;
+    do {
+        registry = __atomic_load_n(&_published, __ATOMIC_ACQUIRE);
+        epoch = __atomic_load_n(&registry->epoch, __ATOMIC_ACQUIRE);
+        memcpy(copy, registry, sizeof(Registry));
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&_published, __ATOMIC_ACQUIRE) != registry ||
+             __atomic_load_n(&registry->epoch, __ATOMIC_ACQUIRE) != epoch);
+    copy->epoch = epoch;
+}
+
+/**
+ * @brief Start a change of the device list
+ *
+ * Writers are serialized among themselves; the poller is never held up.
+ */
+PZEMBus::Registry* PZEMBus::beginUpdate() {
+    while (__atomic_test_and_set(&_updating, __ATOMIC_ACQUIRE)) {
+        yield();
+    }
+    Registry* published = _published;
+    Registry* next = (published == &_registries[0]) ? &_registries[1] : &_registries[0];
+    memcpy(next->slaveAddr, published->slaveAddr, sizeof(next->slaveAddr));
+    memcpy(next->model, published->model, sizeof(next->model));
+    return next;
+}
+
+/**
+ * @brief Finish a change of the device list
+ */
+void PZEMBus::endUpdate(Registry* registry, bool publish) {
+    if (publish) {
+        __atomic_store_n(&registry->epoch, _published->epoch + 1, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        __atomic_store_n(&_published, registry, __ATOMIC_RELEASE);
+    }
+    __atomic_clear(&_updating, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Bring the poller state in line with the published device list
+ *
+ * Entries keeping their address keep their state. An entry given to another
+ * device starts over, but stays busy until the read of the previous device
+ * completes (that read is then dropped, its address no longer matching).
+ * The cached image of an address that left the list, or whose model changed,
+ * is dropped here, on the poller thread that writes the cache.
+ */
+void PZEMBus::adoptRegistry() {
+    Registry registry;
+    readRegistry(&registry);
+
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        Device& device = _devices[i];
+        if (device.slaveAddr == registry.slaveAddr[i] && device.model == registry.model[i]) {
+            continue;
+        }
+        if (_cache != NULL && device.slaveAddr != 0) {
+            bool listed = false;
+            for (uint8_t j = 0; j < PZEM_BUS_MAX_DEVICES && !listed; j++) {
+                listed = registry.slaveAddr[j] == device.slaveAddr && registry.model[j] == device.model;
+            }
+            if (!listed) {
+                _cache->remove(device.slaveAddr);
+            }
+        }
+        untrack(device);
+        device.slaveAddr = registry.slaveAddr[i];
+        device.model = registry.model[i];
+        device.failures = 0;
+        device.read = false;
+        device.probed = false;
+        device.seen = false;
+        device.lastStart = 0;
+        device.lastProbe = 0;
+        device.lastSeen = 0;
+        track(device);
+    }
+    _adopted = registry.epoch;
+}
+
+/**
+ * @brief Track the snapshot span of a device at the sweep interval
+ *
+ * Called when a device joins the sweep and when the tracker or the interval
+ * changes, not per snapshot. The device holds one owner of its track, which
+ * a scheduler subscription of the same span and period may share.
+ */
+void PZEMBus::track(Device& device) {
+    if (_cadence != NULL && _interval != PZEM_BUS_NO_SWEEP && device.slaveAddr != 0 && !device.tracked) {
+        device.tracked = _cadence->track(device.slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000,
+                                         pzemModelInfo(device.model)->snapshotRegs, _interval) != PZEM_CADENCE_INVALID;
+    }
+}
+
+/**
+ * @brief Release the track of a device
+ *
+ * Called before the device, the interval or the tracker change, so the track
+ * is found under the span and period it was tracked with.
+ */
+void PZEMBus::untrack(Device& device) {
+    if (device.tracked && _cadence != NULL) {
+        _cadence->untrack(device.slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000,
+                          pzemModelInfo(device.model)->snapshotRegs, _interval);
+    }
+    device.tracked = false;
+}
+
+/**
+ * @brief Submit the next due snapshot or probe, if a slot is free
+ */
+bool PZEMBus::scheduleNext() {
+    if (_paused || _inFlight >= PZEM_BUS_MAX_IN_FLIGHT) {
+        return false;
+    }
+
+    Slot* slot = NULL;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_IN_FLIGHT; i++) {
+        if (!_slots[i].busy) {
+            slot = &_slots[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        return false;
+    }
+
+    // The focus device gets every free slot; sweep and probes wait
+    if (_focus != 0) {
+        for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+            if (_devices[i].slaveAddr == _focus) {
+                return startExchange(slot, i, SLOT_FOCUS);
+            }
+        }
+        _focus = 0;
+    }
+
+    // Continue the round robin where the previous call stopped
+    uint32_t now = millis();
+    for (uint8_t n = 0; n < PZEM_BUS_MAX_DEVICES; n++) {
+        uint8_t index = (_next + n) % PZEM_BUS_MAX_DEVICES;
+        Device& device = _devices[index];
+        if (device.slaveAddr == 0 || device.busy) {
+            continue;
+        }
+
+        if (_interval != PZEM_BUS_NO_SWEEP && (!device.read || now - device.lastStart >= _interval)) {
+            return startExchange(slot, index, SLOT_SNAPSHOT);
+        }
+
+        // Probe only devices silent for a whole heartbeat, and at most once per heartbeat
+        if (_heartbeat > 0 && (!device.seen || now - device.lastSeen >= _heartbeat) &&
+            (!device.probed || now - device.lastProbe >= _heartbeat)) {
+            return startExchange(slot, index, SLOT_PROBE);
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Submit an exchange with a device into a slot
+ */
+bool PZEMBus::startExchange(Slot* slot, uint8_t index, uint8_t kind) {
+    Device& device = _devices[index];
+    const PZEMModelInfo* info = pzemModelInfo(device.model);
+
+    if (kind == SLOT_PROBE) {
+        slot->count = 1;
+        modbusBuildReadRequest(slot->request, device.slaveAddr, info->probeFunction, info->probeRegister, 1);
+    } else {
+        slot->count = (kind == SLOT_FOCUS) ? _focusRegs : info->snapshotRegs;
+        modbusBuildReadRequest(slot->request, device.slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000, slot->count);
+    }
+    slot->txn.prepare(slot->request, sizeof(slot->request), slot->response, sizeof(slot->response),
+                      modbusReadResponseLength(slot->count), getTimeout(slot->count));
+    slot->txn.onComplete = onComplete;
+    slot->txn.context = slot;
+    slot->kind = kind;
+    slot->slaveAddr = device.slaveAddr;
+    slot->device = index;
+    if (!_transport.submit(&slot->txn)) {
+        return false;
+    }
+
+    uint32_t now = millis();
+    if (kind == SLOT_PROBE) {
+        device.probed = true;
+        device.lastProbe = now;
+        _probeCount++;
+    } else if (kind == SLOT_SNAPSHOT) {
+        // Keep the cadence unless the device fell a whole interval behind
+        if (device.read && now - device.lastStart < 2 * _interval) {
+            device.lastStart += _interval;
+        } else {
+            device.lastStart = now;
+        }
+        device.read = true;
+    }
+    slot->busy = true;
+    _inFlight++;
+
+    // Focus reads may overlap each other and do not move the round robin
+    if (kind != SLOT_FOCUS) {
+        device.busy = true;
+        _next = (index + 1) % PZEM_BUS_MAX_DEVICES;
+    }
+    return true;
+}
+
+/**
+ * @brief Record the outcome of an exchange with a device
+ */
+void PZEMBus::recordOutcome(Device* device, bool success) {
+    if (success) {
+        device->failures = 0;
+        device->seen = true;
+        device->lastSeen = millis();
+    } else if (device->failures < 255) {
+        device->failures++;
+    }
+}
+
+/**
+ * @brief Find a device entry
+ */
+PZEMBus::Device* PZEMBus::findDevice(uint8_t slaveAddr) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr && slaveAddr != 0) {
+            return &_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Decode a read response into a snapshot and record it in the cache
+ */
+bool PZEMBus::decodeResponse(Slot* slot, Device* device, PZEMSnapshot* snapshot) {
+    uint8_t numRegs = slot->count;
+    if (slot->txn.status != MODBUS_TRANSACTION_OK || slot->response[2] != numRegs * 2) {
+        recordOutcome(device, false);
+        return false;
+    }
+    recordOutcome(device, true);
+
+    const PZEMModelInfo* info = pzemModelInfo(device->model);
+    snapshot->slaveAddr = device->slaveAddr;
+    snapshot->model = device->model;
+    snapshot->count = numRegs;
+    snapshot->timestamp = device->lastSeen;
+    uint16_t raw[PZEM_SNAPSHOT_MAX_REGISTERS];
+    for (uint8_t i = 0; i < numRegs; i++) {
+        uint8_t hi = slot->response[3 + i * 2];
+        uint8_t lo = slot->response[4 + i * 2];
+        raw[i] = (hi << 8) | lo;
+        snapshot->regs[i] = info->bigEndian ? raw[i] : (uint16_t)((lo << 8) | hi);
+    }
+
+    if (_cache != NULL) {
+        _cache->store(snapshot->slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000, numRegs, raw, snapshot->timestamp);
+    }
+    return true;
+}
+
+/**
+ * @brief Handle a completed snapshot read, probe or focus read
+ */
+void PZEMBus::handleCompletion(Slot* slot) {
+    slot->busy = false;
+    _inFlight--;
+
+    // An entry removed while its read was in flight is released without being updated
+    Device* device = &_devices[slot->device];
+    if (slot->kind != SLOT_FOCUS) {
+        device->busy = false;
+    }
+    if (device->slaveAddr != slot->slaveAddr) {
+        return;
+    }
+
+    if (slot->kind == SLOT_PROBE) {
+        uint8_t status = slot->txn.status;
+        recordOutcome(device, status == MODBUS_TRANSACTION_OK || status == MODBUS_TRANSACTION_EXCEPTION);
+        return;
+    }
+
+    PZEMSnapshot snapshot;
+    if (slot->kind == SLOT_FOCUS) {
+        // Reads completing after clearFocus() (or a new focus) are dropped
+        if (decodeResponse(slot, device, &snapshot) && slot->slaveAddr == _focus && _onFocus != NULL) {
+            _onFocus(&snapshot, _onFocusContext);
+        }
+        return;
+    }
+
+    _readCount++;
+    if (!decodeResponse(slot, device, &snapshot)) {
+        return;
+    }
+    if (_cadence != NULL) {
+        _cadence->record(snapshot.slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000, snapshot.count, snapshot.timestamp);
+    }
+    if (_onSnapshot != NULL) {
+        _onSnapshot(&snapshot, _onSnapshotContext);
+    }
+}
+
+/**
+ * @brief Transaction completion callback
+ */
+void PZEMBus::onComplete(ModbusTransaction*, void* context) {
+    Slot* slot = static_cast<Slot*>(context);
+    slot->bus->handleCompletion(slot);
+}
+
+/**
+ * @brief Application transaction completion callback
+ */
+void PZEMBus::onUserComplete(ModbusTransaction* txn, void* context) {
+    UserTransaction* entry = static_cast<UserTransaction*>(context);
+    PZEMBus* bus = entry->bus;
+
+    // Any valid answer, including an exception response, proves the device is alive
+    Device* device = bus->findDevice(txn->slaveAddr());
+    if (device != NULL) {
+        bool answered = txn->status == MODBUS_TRANSACTION_OK || txn->status == MODBUS_TRANSACTION_EXCEPTION;
+        bus->recordOutcome(device, answered);
+    }
+
+    // Restore the application callback before calling it, the transaction may be reused from there
+    txn->onComplete = entry->onComplete;
+    txn->context = entry->context;
+    entry->txn = NULL;
+    bus->_userInFlight--;
+    if (txn->onComplete != NULL) {
+        txn->onComplete(txn, txn->context);
+    }
+}
@@ -0,0 +1,469 @@
+/**
+ * @file PZEMBus.h
+ * @brief Non-blocking polling of all devices on one Modbus transport
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMBUS_H
+#define PZEMBUS_H
+
+#include <Arduino.h>
+#include "ModbusTransport.h"
+#include "PZEMModel.h"
+#include "PZEMRegisterCache.h"
+#include "PZEMCadence.h"
+
+/**
+ * @defgroup PZEMBusConfig Bus Configuration
+ * @brief Compile-time sizing and defaults of the bus poller (override before including)
+ * @{
+ */
+#ifndef PZEM_BUS_MAX_DEVICES
+#define PZEM_BUS_MAX_DEVICES          16    ///< Maximum number of devices per bus
+#endif
+#ifndef PZEM_BUS_MAX_IN_FLIGHT
+#define PZEM_BUS_MAX_IN_FLIGHT        2     ///< Snapshot reads submitted to the transport at once
+#endif
+#ifndef PZEM_BUS_MAX_USER_TRANSACTIONS
+#define PZEM_BUS_MAX_USER_TRANSACTIONS 4    ///< Application transactions submitted through the bus at once
+#endif
+#define PZEM_BUS_DEFAULT_INTERVAL_MS  1000  ///< Default sweep interval per device (ms)
+#define PZEM_BUS_NO_SWEEP             0     ///< Interval disabling periodic snapshots
+#define PZEM_BUS_DEFAULT_TIMEOUT_MS   100   ///< Default device response time, on top of the response wire time (ms)
+#define PZEM_BUS_DEFAULT_BAUDRATE     9600  ///< Default line speed sizing the response wire time (bps)
+#define PZEM_BUS_OFFLINE_FAILURES     3     ///< Consecutive failures before a device is offline
+/** @} */
+
+/**
+ * @brief Callback receiving every successful snapshot
+ * @param snapshot Decoded snapshot (valid during the call only)
+ * @param context User context given to setSnapshotCallback()
+ */
+typedef void (*PZEMSnapshotCallback)(const PZEMSnapshot* snapshot, void* context);
+
+/**
+ * @class PZEMBus
+ * @brief Cooperative poller reading snapshots of every device on a transport
+ *
+ * Each device is read in a single transaction (its whole snapshot span) once per
+ * interval, round robin. poll() works within a time budget:
+ * it advances transactions in flight, submits reads that are due and returns as
+ * soon as the budget is spent or nothing is left to do. State is kept between
+ * calls, so a sweep with dead devices is spread over as many calls as needed
+ * while the rest of the main loop (Wi-Fi, display, watchdog) keeps running.
+ *
+ * Every successful exchange with a device (snapshot, probe or application
+ * transaction submitted through the bus) counts as proof of life. With a
+ * heartbeat set, devices silent for longer than the heartbeat period get the
+ * cheapest valid request of their model, so health checks add almost no load.
+ *
+ * Background reads keep their cadence: a read delayed by priority requests
+ * or dead devices does not shift the following reads of the same device.
+ *
+ * setFocus() hands the bus to a single device: the sweep and the probes pause
+ * and the device is read back to back with a short span until clearFocus(),
+ * after which the sweep resumes with the devices that became due meanwhile.
+ *
+ * The device list can change while the bus is polled, from any thread. Changes
+ * are prepared in a second copy of the list and published with a new epoch;
+ * poll() picks up the latest epoch when it starts, keeping the state of the
+ * devices that stayed. It never waits for a change in progress: it copies the
+ * published list and retries only if it was republished meanwhile.
+ *
+ * @note The budget is checked between steps. Sending a request frame is a single
+ *       step (the serial write returns after the last byte), so poll() can return
+ *       up to one request frame after its budget: 8 bytes, about 9 ms at 9600 baud.
+ */
+class PZEMBus {
+public:
+    /**
+     * @brief Constructor for a bus poller
+     * @param transport Transport reaching the devices (serial, Modbus-TCP, ...)
+     */
+    PZEMBus(ModbusTransport& transport);
+
+    /**
+     * @brief Add a device to the sweep
+     * @param slaveAddr Slave device address
+     * @param model Model identifier (PZEM_MODEL_*)
+     * @return true if added, false if the table is full, the model unknown or the address already used
+     * @note Safe to call while another thread polls; the device joins the sweep on the next poll().
+     */
+    bool addDevice(uint8_t slaveAddr, uint8_t model);
+
+    /**
+     * @brief Remove a device from the sweep
+     * @param slaveAddr Slave device address
+     * @return true if removed, false if not found
+     * @note A read in flight completes without being delivered. The next poll() drops the
+     *       device from the register cache.
+     */
+    bool removeDevice(uint8_t slaveAddr);
+
+    /**
+     * @brief Move a device of the sweep to a new address (e.g. after setAddress() or a replacement unit)
+     * @param slaveAddr Current slave address
+     * @param newAddr New slave address
+     * @return true if moved, false if not found or the new address is invalid or already used
+     * @note The device keeps its model and starts over as a device never seen. The next poll()
+     *       drops the old address from the register cache.
+     */
+    bool readdressDevice(uint8_t slaveAddr, uint8_t newAddr);
+
+    /**
+     * @brief Set how often each device is read
+     * @param intervalMs Interval between two reads of the same device in milliseconds
+     *                   (PZEM_BUS_NO_SWEEP: no periodic snapshots, e.g. for health monitoring only)
+     */
+    void setInterval(uint32_t intervalMs);
+
+    /**
+     * @brief Probe devices that have been silent for a while
+     * @param idleMs Silence after which a device is probed, in milliseconds (0 = no heartbeat)
+     */
+    void setHeartbeat(uint32_t idleMs);
+
+    /**
+     * @brief Set response timeout
+     * @param timeoutMs Time a device may take to answer, in milliseconds (default: 100)
+     * @note The wire time of each response at the bus baud rate is added, so a PZEM-6L24
+     *       snapshot (133 bytes, about 150 ms at 9600 baud) gets 253 ms by default.
+     */
+    void setTimeout(uint32_t timeoutMs);
+
+    /**
+     * @brief Set the line speed sizing the response timeouts
+     * @param baudrate Line speed in bits per second (default: 9600)
+     */
+    void setBaudRate(uint32_t baudrate);
+
+    /**
+     * @brief Get the line speed sizing the response timeouts
+     * @return Line speed in bits per second
+     */
+    uint32_t getBaudRate() const;
+
+    /**
+     * @brief Get the response timeout of a read
+     * @param numRegs Number of registers read
+     * @return Wire time of the response plus the device response time, in milliseconds
+     */
+    uint32_t getTimeout(uint16_t numRegs) const;
+
+    /**
+     * @brief Record every successful snapshot in a register cache
+     * @param cache Register cache, or NULL to disable
+     */
+    void setRegisterCache(PZEMRegisterCache* cache);
+
+    /**
+     * @brief Record the cadence of the snapshots of every device
+     * @param cadence Cadence tracker, or NULL to disable
+     * @note Each device is tracked over its snapshot span at the sweep interval once the poller
+     *       takes it over (and again on setInterval()); the poller releases the track when the
+     *       device leaves, and the tracks of a previous tracker on setCadence().
+     */
+    void setCadence(PZEMCadence* cadence);
+
+    /**
+     * @brief Set callback receiving every successful snapshot
+     * @param callback Callback, or NULL to disable
+     * @param context User context passed to the callback
+     */
+    void setSnapshotCallback(PZEMSnapshotCallback callback, void* context);
+
+    /**
+     * @brief Send an application transaction through the bus (non-blocking)
+     * @param txn Prepared transaction; its callback is called on completion as usual
+     * @param priority true for an interactive request: it goes ahead of every queued
+     *                 background read, so it waits at most for the exchange on the wire
+     * @return true if accepted, false if too many application transactions are pending
+     */
+    bool submit(ModbusTransaction* txn, bool priority = false);
+
+    /**
+     * @brief Give the bus to one device, read back to back
+     * @param slaveAddr Slave device address (must be in the sweep)
+     * @param numRegs Input registers read from 0x0000 on every read (e.g. PZEMModelInfo::burstRegs)
+     * @param callback Callback receiving every successful read (snapshot with count = numRegs)
+     * @param context User context passed to the callback
+     * @return true if the focus is set, false if the device is unknown or numRegs invalid
+     */
+    bool setFocus(uint8_t slaveAddr, uint8_t numRegs, PZEMSnapshotCallback callback, void* context);
+
+    /**
+     * @brief Return the bus to the normal sweep
+     * @note Focus reads still in flight complete without being delivered.
+     */
+    void clearFocus();
+
+    /**
+     * @brief Get the device holding the bus
+     * @return Slave address, or 0 if no focus is set
+     */
+    uint8_t getFocus() const;
+
+    /**
+     * @brief Stop starting snapshots, probes and focus reads
+     * @param paused true to pause, false to resume the sweep
+     * @note Exchanges in flight complete and application transactions are still accepted.
+     */
+    void setPaused(bool paused);
+
+    /**
+     * @brief Check whether nothing is in flight on the bus
+     * @return true if no snapshot, probe, focus read or application transaction is pending
+     */
+    bool isDrained() const;
+
+    /**
+     * @brief Advance the bus within a time budget
+     * @param budgetUs Time to spend in microseconds (0 = a single step); a request frame
+     *                 sent at the end of the budget can extend it by the frame wire time
+     * @return true if transactions are still in flight, false if the bus is idle
+     */
+    bool poll(uint32_t budgetUs);
+
+    /**
+     * @brief Check whether a device answered recently
+     * @param slaveAddr Slave device address
+     * @return true if it answered once and fewer than PZEM_BUS_OFFLINE_FAILURES consecutive exchanges failed
+     */
+    bool isOnline(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Get the time of the last successful exchange with a device
+     * @param slaveAddr Slave device address
+     * @return Time in milliseconds (millis), or 0 if the device never answered
+     */
+    uint32_t getLastSeen(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Get number of liveness probes sent
+     * @return Probes since construction
+     */
+    uint32_t getProbeCount() const;
+
+    /**
+     * @brief Get the model of a device in the sweep
+     * @param slaveAddr Slave device address
+     * @return Model identifier, or PZEM_MODEL_UNKNOWN if not found
+     */
+    uint8_t getModel(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Get number of devices in the sweep
+     * @return Number of devices
+     */
+    uint8_t getDeviceCount() const;
+
+    /**
+     * @brief Get number of completed snapshot reads (successful or not)
+     * @return Completed reads since construction
+     */
+    uint32_t getReadCount() const;
+
+    /**
+     * @brief Get the transport of the bus
+     * @return Transport reference
+     */
+    ModbusTransport& getTransport();
+
+    /**
+     * @brief Get the register cache fed by the bus
+     * @return Register cache, or NULL if not used
+     */
+    PZEMRegisterCache* getRegisterCache();
+
+private:
+    /**
+     * @brief Device list published to the poller
+     */
+    struct Registry {
+        uint32_t epoch;                             ///< Publication number
+        uint8_t slaveAddr[PZEM_BUS_MAX_DEVICES];    ///< Slave address per entry (0 = free)
+        uint8_t model[PZEM_BUS_MAX_DEVICES];        ///< Model per entry
+    };
+
+    /**
+     * @brief Polling state of one device
+     */
+    struct Device {
+        uint8_t slaveAddr;      ///< Slave address (0 = free entry)
+        uint8_t model;          ///< Model identifier
+        uint8_t failures;       ///< Consecutive failed reads
+        bool busy;              ///< Read or probe in flight
+        bool read;              ///< Snapshot submitted at least once
+        bool probed;            ///< Probe submitted at least once
+        bool seen;              ///< Answered at least once
+        bool tracked;           ///< Snapshot span tracked in the cadence tracker at the sweep interval
+        uint32_t lastStart;     ///< Time the last snapshot was due (millis)
+        uint32_t lastProbe;     ///< Time the last probe was submitted (millis)
+        uint32_t lastSeen;      ///< Time of the last successful exchange (millis)
+    };
+
+    /**
+     * @brief Kind of exchange held by a slot
+     */
+    enum SlotKind {
+        SLOT_SNAPSHOT,          ///< Full snapshot read
+        SLOT_PROBE,             ///< Liveness probe
+        SLOT_FOCUS              ///< Short read of the focus device
+    };
+
+    /**
+     * @brief Application transaction forwarded by the bus
+     */
+    struct UserTransaction {
+        PZEMBus* bus;                       ///< Owning bus (callback context)
+        ModbusTransaction* txn;             ///< Transaction (NULL = free entry)
+        ModbusCompletionCallback onComplete;  ///< Original callback
+        void* context;                      ///< Original callback context
+    };
+
+    /**
+     * @brief Buffers of one snapshot read in flight
+     */
+    struct Slot {
+        PZEMBus* bus;                   ///< Owning bus (callback context)
+        bool busy;                      ///< Transaction in flight
+        uint8_t kind;                   ///< Exchange kind (SlotKind)
+        uint8_t slaveAddr;              ///< Device being read
+        uint8_t device;                 ///< Index of the device entry
+        uint8_t count;                  ///< Registers requested
+        ModbusTransaction txn;          ///< Transaction
+        uint8_t request[8];             ///< Request frame
+        uint8_t response[5 + PZEM_SNAPSHOT_MAX_REGISTERS * 2];  ///< Response frame
+    };
+
+    ModbusTransport& _transport;            ///< Transport reaching the devices
+    Device _devices[PZEM_BUS_MAX_DEVICES];  ///< Devices in the sweep (poller state)
+    Registry _registries[2];                ///< Published device list and the one being prepared
+    Registry* _published;                   ///< Device list the poller follows
+    uint32_t _adopted;                      ///< Epoch copied into _devices
+    bool _updating;                         ///< A change of the device list is being prepared
+    Slot _slots[PZEM_BUS_MAX_IN_FLIGHT];    ///< Reads in flight
+    uint8_t _next;                          ///< Next device to consider (round robin)
+    UserTransaction _user[PZEM_BUS_MAX_USER_TRANSACTIONS];  ///< Application transactions
+    uint8_t _inFlight;                      ///< Busy slots
+    uint8_t _userInFlight;                  ///< Pending application transactions
+    uint32_t _interval;                     ///< Sweep interval in milliseconds
+    uint32_t _heartbeat;                    ///< Heartbeat period in milliseconds (0 = off)
+    uint32_t _probeCount;                   ///< Probes sent
+    uint32_t _timeout;                      ///< Device response time in milliseconds
+    uint32_t _baudrate;                     ///< Line speed sizing the response wire time
+    uint32_t _readCount;                    ///< Completed reads
+    PZEMRegisterCache* _cache;              ///< Register cache (NULL if not used)
+    PZEMCadence* _cadence;                  ///< Cadence tracker (NULL if not used)
+    PZEMSnapshotCallback _onSnapshot;       ///< Snapshot callback (NULL if not used)
+    void* _onSnapshotContext;               ///< Snapshot callback context
+    uint8_t _focus;                         ///< Device holding the bus (0 = normal sweep)
+    uint8_t _focusRegs;                     ///< Registers read on every focus read
+    PZEMSnapshotCallback _onFocus;          ///< Focus read callback
+    void* _onFocusContext;                  ///< Focus read callback context
+    bool _paused;                           ///< Sweep paused
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Take a consistent copy of the published device list
+     * @param copy Receives the device list
+     */
+    void readRegistry(Registry* copy) const;
+
+    /**
+     * @brief Start a change of the device list
+     * @return Copy of the published list to modify
+     */
+    Registry* beginUpdate();
+
+    /**
+     * @brief Finish a change of the device list
+     * @param registry List returned by beginUpdate()
+     * @param publish true to publish the change, false to drop it
+     */
+    void endUpdate(Registry* registry, bool publish);
+
+    /**
+     * @brief Bring the poller state in line with the published device list
+     */
+    void adoptRegistry();
+
+    /**
+     * @brief Track the snapshot span of a device at the sweep interval
+     * @param device Device entry (ignored if free or already tracked)
+     */
+    void track(Device& device);
+
+    /**
+     * @brief Release the track of a device, if it holds one
+     * @param device Device entry
+     */
+    void untrack(Device& device);
+
+    /**
+     * @brief Submit the next due snapshot or probe, if a slot is free
+     * @return true if an exchange was submitted
+     */
+    bool scheduleNext();
+
+    /**
+     * @brief Submit an exchange with a device into a slot
+     * @param slot Free slot
+     * @param index Device index
+     * @param kind Exchange kind (SlotKind)
+     * @return true if the transport accepted it
+     */
+    bool startExchange(Slot* slot, uint8_t index, uint8_t kind);
+
+    /**
+     * @brief Record the outcome of an exchange with a device
+     * @param device Device entry
+     * @param success true if the device answered correctly
+     */
+    void recordOutcome(Device* device, bool success);
+
+    /**
+     * @brief Find a device entry
+     * @param slaveAddr Slave device address
+     * @return Pointer to the device, or NULL if not found
+     */
+    Device* findDevice(uint8_t slaveAddr);
+
+    /**
+     * @brief Decode a read response into a snapshot and record it in the cache
+     * @param slot Completed slot
+     * @param device Device entry
+     * @param snapshot Snapshot to fill
+     * @return true if the response is valid
+     */
+    bool decodeResponse(Slot* slot, Device* device, PZEMSnapshot* snapshot);
+
+    /**
+     * @brief Handle a completed snapshot read, probe or focus read
+     * @param slot Slot holding the transaction
+     */
+    void handleCompletion(Slot* slot);
+
+    /**
+     * @brief Transaction completion callback
+     * @param txn Completed transaction
+     * @param context Slot holding the transaction
+     */
+    static void onComplete(ModbusTransaction* txn, void* context);
+
+    /**
+     * @brief Application transaction completion callback
+     * @param txn Completed transaction
+     * @param context UserTransaction entry
+     */
+    static void onUserComplete(ModbusTransaction* txn, void* context);
+
+    /** @} */
+};
+
+#endif // PZEMBUS_H
@@ -0,0 +1,231 @@
+/**
+ * @file PZEMCadence.cpp
+ * @brief Implementation of the cadence tracker
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMCadence.h"
+
+/**
+ * @brief Upper limits of the histogram buckets, in percent of the period
+ *
+ * On time is 90 to 110 %; the buckets above tell a late refresh (up to 150 %)
+ * from one or more missed periods.
+ */
+static const uint16_t BUCKET_LIMITS[PZEM_CADENCE_BUCKETS] = { 50, 90, 110, 150, 200, 300, 500, 0xFFFF };
+
+/**
+ * @brief Constructor, no tracks
+ */
+PZEMCadence::PZEMCadence() {
+    clear();
+}
+
+/**
+ * @brief Track a register range at a requested period
+ *
+ * A new track counts its age from now, so a range that is never refreshed
+ * shows missed periods too. Two periods on one range (a 1 s and a 10 s
+ * subscription, or a subscription and the sweep) keep separate tracks:
+ * sharing one would judge every refresh against whichever period came last.
+ */
+int8_t PZEMCadence::track(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                          uint32_t periodMs) {
+    if (periodMs == 0 || slaveAddr == 0 || numRegs == 0) {
+        return PZEM_CADENCE_INVALID;
+    }
+    int8_t index = find(slaveAddr, function, startAddr, numRegs, periodMs);
+    if (index != PZEM_CADENCE_INVALID) {
+        _tracks[index].owners++;
+        return index;
+    }
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        Track& t = _tracks[i];
+        if (t.slaveAddr == 0) {
+            memset(&t, 0, sizeof(Track));
+            t.slaveAddr = slaveAddr;
+            t.function = function;
+            t.startAddr = startAddr;
+            t.numRegs = numRegs;
+            t.period = periodMs;
+            t.owners = 1;
+            t.last = millis();
+            return i;
+        }
+    }
+    return PZEM_CADENCE_INVALID;
+}
+
+/**
+ * @brief Release a register range tracked at a period
+ */
+bool PZEMCadence::untrack(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                          uint32_t periodMs) {
+    int8_t index = find(slaveAddr, function, startAddr, numRegs, periodMs);
+    if (index == PZEM_CADENCE_INVALID) {
+        return false;
+    }
+    if (--_tracks[index].owners == 0) {
+        _tracks[index].slaveAddr = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop tracking every range of a device
+ */
+uint8_t PZEMCadence::untrackDevice(uint8_t slaveAddr) {
+    uint8_t removed = 0;
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        if (_tracks[i].slaveAddr == slaveAddr && slaveAddr != 0) {
+            _tracks[i].slaveAddr = 0;
+            removed++;
+        }
+    }
+    return removed;
+}
+
+/**
+ * @brief Record a successful read
+ *
+ * The jitter of an interval is its distance to the nearest whole number of
+ * periods (at least one), so a missed period shows once in missed and in the
+ * histogram, not as a huge jitter.
+ */
+uint8_t PZEMCadence::record(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                            uint32_t timestamp) {
+    uint8_t refreshed = 0;
+    uint32_t end = (uint32_t)startAddr + numRegs;
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        Track& t = _tracks[i];
+        if (t.slaveAddr != slaveAddr || slaveAddr == 0 || t.function != function || t.startAddr < startAddr ||
+            (uint32_t)t.startAddr + t.numRegs > end) {
+            continue;
+        }
+        if (t.updates > 0) {
+            uint32_t interval = timestamp - t.last;
+            uint32_t missed = missedPeriods(interval, t.period);
+            uint64_t nearest = (uint64_t)t.period * (missed + 1);
+            uint32_t jitter = (uint32_t)(interval > nearest ? interval - nearest : nearest - interval);
+            uint64_t percent = (uint64_t)interval * 100 / t.period;
+            uint8_t bucket = 0;
+            while (bucket < PZEM_CADENCE_BUCKETS - 1 && percent >= BUCKET_LIMITS[bucket]) {
+                bucket++;
+            }
+            t.histogram[bucket]++;
+            t.missed += missed;
+            t.intervals++;
+            t.intervalSum += interval;
+            t.jitterSum += jitter;
+            t.jitterMax = jitter > t.jitterMax ? jitter : t.jitterMax;
+        }
+        t.last = timestamp;
+        t.updates++;
+        refreshed++;
+    }
+    return refreshed;
+}
+
+/**
+ * @brief Get the age of a register
+ */
+bool PZEMCadence::getAge(uint8_t slaveAddr, uint8_t function, uint16_t reg, uint32_t* ageMs) const {
+    uint32_t now = millis();
+    bool found = false;
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        const Track& t = _tracks[i];
+        if (t.slaveAddr != slaveAddr || slaveAddr == 0 || t.function != function || t.updates == 0 ||
+            reg < t.startAddr || reg >= (uint32_t)t.startAddr + t.numRegs) {
+            continue;
+        }
+        uint32_t age = now - t.last;
+        if (!found || age < *ageMs) {
+            *ageMs = age;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Get the cadence of a track
+ *
+ * The gap since the last refresh counts in missed as soon as it spans a
+ * period and a half, so a device that went silent shows up without waiting
+ * for its next refresh.
+ */
+bool PZEMCadence::getStats(uint8_t index, PZEMCadenceStats* stats) const {
+    if (index >= PZEM_CADENCE_MAX_TRACKS || _tracks[index].slaveAddr == 0) {
+        return false;
+    }
+    const Track& t = _tracks[index];
+    stats->slaveAddr = t.slaveAddr;
+    stats->function = t.function;
+    stats->startAddr = t.startAddr;
+    stats->numRegs = t.numRegs;
+    stats->periodMs = t.period;
+    stats->owners = t.owners;
+    stats->updates = t.updates;
+    stats->lastUpdate = t.last;
+    stats->ageMs = millis() - t.last;
+    stats->missed = t.missed + missedPeriods(stats->ageMs, t.period);
+    stats->meanIntervalMs = t.intervals > 0 ? (uint32_t)(t.intervalSum / t.intervals) : 0;
+    stats->jitterMeanMs = t.intervals > 0 ? (uint32_t)(t.jitterSum / t.intervals) : 0;
+    stats->jitterMaxMs = t.jitterMax;
+    memcpy(stats->histogram, t.histogram, sizeof(stats->histogram));
+    return true;
+}
+
+/**
+ * @brief Clear the counters of every track
+ */
+void PZEMCadence::resetStats() {
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        Track& t = _tracks[i];
+        t.updates = t.updates > 0 ? 1 : 0;  // The last refresh still anchors the next interval
+        t.missed = 0;
+        t.intervals = 0;
+        t.intervalSum = 0;
+        t.jitterSum = 0;
+        t.jitterMax = 0;
+        memset(t.histogram, 0, sizeof(t.histogram));
+    }
+}
+
+/**
+ * @brief Remove every track
+ */
+void PZEMCadence::clear() {
+    memset(_tracks, 0, sizeof(_tracks));
+}
+
+/**
+ * @brief Get the upper limit of a histogram bucket
+ */
+uint16_t PZEMCadence::getBucketLimit(uint8_t bucket) {
+    return bucket < PZEM_CADENCE_BUCKETS ? BUCKET_LIMITS[bucket] : 0xFFFF;
+}
+
+/**
+ * @brief Find the track of a range at a period
+ */
+int8_t PZEMCadence::find(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                         uint32_t periodMs) const {
+    for (uint8_t i = 0; i < PZEM_CADENCE_MAX_TRACKS; i++) {
+        const Track& t = _tracks[i];
+        if (t.slaveAddr == slaveAddr && slaveAddr != 0 && t.function == function && t.startAddr == startAddr &&
+            t.numRegs == numRegs && t.period == periodMs) {
+            return i;
+        }
+    }
+    return PZEM_CADENCE_INVALID;
+}
+
+/**
+ * @brief Count the periods an interval spans beyond the first
+ */
+uint32_t PZEMCadence::missedPeriods(uint32_t interval, uint32_t period) {
+    uint32_t periods = (uint32_t)(((uint64_t)interval + period / 2) / period);
+    return periods > 1 ? periods - 1 : 0;
+}
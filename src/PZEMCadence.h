@@ -0,0 +1,204 @@
+/**
+ * @file PZEMCadence.h
+ * @brief Achieved sampling cadence, jitter and staleness of devices and register ranges
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A requested period says how often a value should be refreshed; the tracker
+ * records how often it actually was. Each track is a register range of a
+ * device (a whole snapshot, or the range of a scheduler subscription, i.e. a
+ * field) at one requested period, shared by the owners that track the same
+ * range at the same period and removed with the last of them. Every successful read covering the range
+ * refreshes it: the interval since the previous refresh goes to a histogram
+ * of intervals relative to the period, its distance to the nearest multiple
+ * of the period is the jitter, and the periods it spans beyond the first are
+ * missed periods. Tracks are refreshed by PZEMBus and PZEMScheduler once
+ * attached with setCadence(); a refresh costs one pass over the track table
+ * and a few additions.
+ */
+
+#ifndef PZEMCADENCE_H
+#define PZEMCADENCE_H
+
+#include <Arduino.h>
+
+/**
+ * @defgroup PZEMCadenceConfig Cadence Tracker Configuration
+ * @brief Compile-time sizing of the cadence tracker (override before including)
+ * @{
+ */
+#ifndef PZEM_CADENCE_MAX_TRACKS
+#define PZEM_CADENCE_MAX_TRACKS   32    ///< Tracked ranges, at most 127 (about 80 bytes each)
+#endif
+#define PZEM_CADENCE_BUCKETS      8     ///< Interval histogram buckets (see PZEMCadence::getBucketLimit())
+#define PZEM_CADENCE_INVALID      -1    ///< Track index returned on failure
+/** @} */
+
+/**
+ * @struct PZEMCadenceStats
+ * @brief Achieved cadence of one track
+ */
+struct PZEMCadenceStats {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t function;         ///< MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+    uint16_t startAddr;       ///< First register of the range
+    uint16_t numRegs;         ///< Registers in the range
+    uint32_t periodMs;        ///< Requested period
+    uint16_t owners;          ///< Owners holding the track (track() calls not yet untracked)
+    uint32_t updates;         ///< Refreshes recorded
+    uint32_t lastUpdate;      ///< Time of the last refresh (millis), valid if updates > 0
+    uint32_t ageMs;           ///< Time since the last refresh (or since tracking started) when the stats were taken
+    uint32_t missed;          ///< Periods that passed without a refresh, the current gap included
+    uint32_t meanIntervalMs;  ///< Mean interval between refreshes (0 before the second one)
+    uint32_t jitterMeanMs;    ///< Mean distance of an interval to the nearest multiple of the period
+    uint32_t jitterMaxMs;     ///< Largest such distance
+    uint32_t histogram[PZEM_CADENCE_BUCKETS];  ///< Intervals per bucket of interval / period
+};
+
+/**
+ * @class PZEMCadence
+ * @brief Fixed table of tracked ranges and their achieved cadence
+ *
+ * A refresh updates every track of the device and register table whose range
+ * lies within the registers read, so a snapshot read also refreshes the
+ * subscriptions it covers. Call the methods from the polling context;
+ * getStats() from another thread may see a track in the middle of a refresh.
+ */
+class PZEMCadence {
+public:
+    /**
+     * @brief Constructor, no tracks
+     */
+    PZEMCadence();
+
+    /**
+     * @brief Track a register range at a requested period
+     * @param slaveAddr Slave device address
+     * @param function MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+     * @param startAddr First register
+     * @param numRegs Number of registers
+     * @param periodMs Requested period in milliseconds
+     * @return Track index, or PZEM_CADENCE_INVALID if the period is 0 or the table is full
+     * @note Tracking a range already tracked at the same period adds an owner to that track and
+     *       keeps its counters; another period gets a track of its own.
+     */
+    int8_t track(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t periodMs);
+
+    /**
+     * @brief Release a register range tracked at a period
+     * @param slaveAddr Slave device address
+     * @param function Register table
+     * @param startAddr First register
+     * @param numRegs Number of registers
+     * @param periodMs Period given to track()
+     * @return true if released, false if not tracked
+     * @note The track is removed with its last owner.
+     */
+    bool untrack(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t periodMs);
+
+    /**
+     * @brief Stop tracking every range of a device, whatever its owners
+     * @param slaveAddr Slave device address
+     * @return Number of tracks removed
+     * @note PZEMBus and PZEMScheduler release their own tracks; this is for tracks set with track().
+     */
+    uint8_t untrackDevice(uint8_t slaveAddr);
+
+    /**
+     * @brief Record a successful read
+     * @param slaveAddr Slave device address
+     * @param function Register table read
+     * @param startAddr First register read
+     * @param numRegs Number of registers read
+     * @param timestamp Time of the read in milliseconds (millis)
+     * @return Number of tracks refreshed
+     */
+    uint8_t record(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t timestamp);
+
+    /**
+     * @brief Get the age of a register
+     * @param slaveAddr Slave device address
+     * @param function Register table
+     * @param reg Register address
+     * @param ageMs Receives the time since the freshest refresh of a track holding the register
+     * @return true if a track holding the register was refreshed at least once, false otherwise
+     */
+    bool getAge(uint8_t slaveAddr, uint8_t function, uint16_t reg, uint32_t* ageMs) const;
+
+    /**
+     * @brief Get the cadence of a track
+     * @param index Track index (0 to PZEM_CADENCE_MAX_TRACKS - 1)
+     * @param stats Receives the counters, the age and missed periods as of now
+     * @return true if the index holds a track, false otherwise
+     */
+    bool getStats(uint8_t index, PZEMCadenceStats* stats) const;
+
+    /**
+     * @brief Clear the counters of every track, keeping the tracks and their last refresh
+     */
+    void resetStats();
+
+    /**
+     * @brief Remove every track
+     */
+    void clear();
+
+    /**
+     * @brief Get the upper limit of a histogram bucket
+     * @param bucket Bucket index (0 to PZEM_CADENCE_BUCKETS - 1)
+     * @return Largest interval of the bucket in percent of the period (excluded), 0xFFFF for the last bucket
+     */
+    static uint16_t getBucketLimit(uint8_t bucket);
+
+private:
+    /**
+     * @brief One tracked range
+     */
+    struct Track {
+        uint8_t slaveAddr;        ///< Slave address (0 = free entry)
+        uint8_t function;         ///< Register table
+        uint16_t startAddr;       ///< First register
+        uint16_t numRegs;         ///< Registers in the range
+        uint32_t period;          ///< Requested period (ms)
+        uint16_t owners;          ///< track() calls not yet untracked
+        uint32_t updates;         ///< Refreshes recorded
+        uint32_t last;            ///< Time of the last refresh (millis)
+        uint32_t missed;          ///< Periods without refresh between recorded refreshes
+        uint32_t intervals;       ///< Intervals in the sums below
+        uint64_t intervalSum;     ///< Sum of the intervals (ms)
+        uint64_t jitterSum;       ///< Sum of the jitter of the intervals (ms)
+        uint32_t jitterMax;       ///< Largest jitter (ms)
+        uint32_t histogram[PZEM_CADENCE_BUCKETS];  ///< Intervals per bucket
+    };
+
+    Track _tracks[PZEM_CADENCE_MAX_TRACKS];  ///< Tracked ranges
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Find the track of a range at a period
+     * @param slaveAddr Slave device address
+     * @param function Register table
+     * @param startAddr First register
+     * @param numRegs Number of registers
+     * @param periodMs Requested period
+     * @return Track index, or PZEM_CADENCE_INVALID if not tracked
+     */
+    int8_t find(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t periodMs) const;
+
+    /**
+     * @brief Count the periods an interval spans beyond the first
+     * @param interval Interval (ms)
+     * @param period Period (ms)
+     * @return Missed periods
+     */
+    static uint32_t missedPeriods(uint32_t interval, uint32_t period);
+
+    /** @} */
+};
+
+#endif // PZEMCADENCE_H
@@ -0,0 +1,248 @@
+/**
+ * @file PZEMCapture.cpp
+ * @brief Implementation of the event-triggered burst capture
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMCapture.h"
+
+/**
+ * @brief Constructor for a burst capture
+ */
+PZEMCapture::PZEMCapture(PZEMBus& bus)
+    : _bus(bus), _pending(0), _pendingSource(0), _pendingTime(0), _active(0), _start(0),
+      _postSamples(PZEM_CAPTURE_POST_SAMPLES), _maxDuration(PZEM_CAPTURE_DEFAULT_DURATION_MS), _captureCount(0),
+      _onCapture(NULL), _onCaptureContext(NULL) {
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        _devices[i].slaveAddr = 0;
+    }
+}
+
+/**
+ * @brief Trigger when a register leaves a window
+ */
+bool PZEMCapture::setThreshold(uint8_t slaveAddr, uint8_t reg, uint16_t low, uint16_t high) {
+    if (reg >= PZEM_CAPTURE_MAX_SPAN) {
+        return false;
+    }
+    Device* device = findDevice(slaveAddr, true);
+    if (device == NULL) {
+        return false;
+    }
+    device->reg = reg;
+    device->low = low;
+    device->high = high;
+    device->outside = false;
+    device->armed = true;
+    return true;
+}
+
+/**
+ * @brief Set the length of the burst after a trigger
+ */
+void PZEMCapture::setWindow(uint8_t samples, uint32_t maxDurationMs) {
+    _postSamples = samples > PZEM_CAPTURE_POST_SAMPLES ? PZEM_CAPTURE_POST_SAMPLES : samples;
+    _maxDuration = maxDurationMs;
+}
+
+/**
+ * @brief Set callback receiving every completed capture
+ */
+void PZEMCapture::setCaptureCallback(PZEMCaptureCallback callback, void* context) {
+    _onCapture = callback;
+    _onCaptureContext = context;
+}
+
+/**
+ * @brief Add a regular snapshot to the pre-trigger history
+ */
+void PZEMCapture::record(const PZEMSnapshot* snapshot) {
+    Device* device = findDevice(snapshot->slaveAddr, true);
+    if (device == NULL) {
+        return;
+    }
+
+    PZEMCaptureSample& sample = device->ring[device->head];
+    sample.timestamp = snapshot->timestamp;
+    for (uint8_t i = 0; i < PZEM_CAPTURE_MAX_SPAN; i++) {
+        sample.regs[i] = i < snapshot->count ? snapshot->regs[i] : 0;
+    }
+    device->head = (device->head + 1) % PZEM_CAPTURE_PRE_SAMPLES;
+    if (device->count < PZEM_CAPTURE_PRE_SAMPLES) {
+        device->count++;
+    }
+
+    if (crossed(device, sample.regs)) {
+        trigger(snapshot->slaveAddr, PZEM_CAPTURE_TRIGGER_THRESHOLD);
+    }
+}
+
+/**
+ * @brief Snapshot callback feeding record()
+ */
+void PZEMCapture::onSnapshot(const PZEMSnapshot* snapshot, void* context) {
+    static_cast<PZEMCapture*>(context)->record(snapshot);
+}
+
+/**
+ * @brief Request a capture of a device (interrupt safe)
+ */
+bool PZEM_ISR_ATTR PZEMCapture::trigger(uint8_t slaveAddr, uint8_t source) {
+    if (slaveAddr == 0) {
+        return false;
+    }
+    uint32_t now = millis();
+
+    // An interrupt between the check and the claim would start a second capture
+    // and mix its source and time into this one
+    noInterrupts();
+    bool accepted = _pending == 0 && _active == 0;
+    if (accepted) {
+        _pendingSource = source;
+        _pendingTime = now;
+        // Written last: poll() only looks at the other fields once this is set
+        _pending = slaveAddr;
+    }
+    interrupts();
+    return accepted;
+}
+
+/**
+ * @brief Advance the capture and the bus within a time budget
+ */
+bool PZEMCapture::poll(uint32_t budgetUs) {
+    if (_active == 0 && _pending != 0) {
+        start();
+    } else if (_active != 0 && millis() - _start >= _maxDuration) {
+        finish();
+    }
+    return _bus.poll(budgetUs);
+}
+
+/**
+ * @brief Check whether a burst is running
+ */
+bool PZEMCapture::isCapturing() const {
+    return _active != 0;
+}
+
+/**
+ * @brief Get number of delivered captures
+ */
+uint32_t PZEMCapture::getCaptureCount() const {
+    return _captureCount;
+}
+
+/**
+ * @brief Find a device entry
+ */
+PZEMCapture::Device* PZEMCapture::findDevice(uint8_t slaveAddr, bool create) {
+    Device* free = NULL;
+    for (uint8_t i = 0; i < PZEM_BUS_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr) {
+            return &_devices[i];
+        }
+        if (free == NULL && _devices[i].slaveAddr == 0) {
+            free = &_devices[i];
+        }
+    }
+    if (!create || free == NULL || slaveAddr == 0) {
+        return NULL;
+    }
+
+    free->slaveAddr = slaveAddr;
+    free->head = 0;
+    free->count = 0;
+    free->armed = false;
+    free->outside = false;
+    return free;
+}
+
+/**
+ * @brief Check the threshold of a device against a new sample
+ */
+bool PZEMCapture::crossed(Device* device, const uint16_t* regs) {
+    if (!device->armed) {
+        return false;
+    }
+    uint16_t value = regs[device->reg];
+    bool outside = value < device->low || value > device->high;
+    bool entered = outside && !device->outside;
+    device->outside = outside;
+    return entered;
+}
+
+/**
+ * @brief Copy the history and give the bus to the pending device
+ */
+void PZEMCapture::start() {
+    uint8_t slaveAddr = _pending;
+    const PZEMModelInfo* info = pzemModelInfo(_bus.getModel(slaveAddr));
+    if (info == NULL || !_bus.setFocus(slaveAddr, info->burstRegs, onBurst, this)) {
+        _pending = 0;
+        return;
+    }
+
+    _record.slaveAddr = slaveAddr;
+    _record.model = _bus.getModel(slaveAddr);
+    _record.span = info->burstRegs;
+    _record.source = _pendingSource;
+    _record.triggerTime = _pendingTime;
+    _record.preCount = 0;
+
+    // History oldest first
+    Device* device = findDevice(slaveAddr, false);
+    if (device != NULL) {
+        uint8_t first = (device->head + PZEM_CAPTURE_PRE_SAMPLES - device->count) % PZEM_CAPTURE_PRE_SAMPLES;
+        for (uint8_t i = 0; i < device->count; i++) {
+            _record.samples[i] = device->ring[(first + i) % PZEM_CAPTURE_PRE_SAMPLES];
+        }
+        _record.preCount = device->count;
+    }
+    _record.count = _record.preCount;
+
+    _active = slaveAddr;
+    _start = millis();
+    _pending = 0;
+}
+
+/**
+ * @brief Restore normal scheduling and deliver the record
+ */
+void PZEMCapture::finish() {
+    _bus.clearFocus();
+    _active = 0;
+    _captureCount++;
+    if (_onCapture != NULL) {
+        _onCapture(&_record, _onCaptureContext);
+    }
+}
+
+/**
+ * @brief Focus read callback collecting burst samples
+ */
+void PZEMCapture::onBurst(const PZEMSnapshot* snapshot, void* context) {
+    PZEMCapture* capture = static_cast<PZEMCapture*>(context);
+    if (snapshot->slaveAddr != capture->_active) {
+        return;
+    }
+
+    PZEMCaptureRecord& record = capture->_record;
+    PZEMCaptureSample& sample = record.samples[record.count];
+    sample.timestamp = snapshot->timestamp;
+    for (uint8_t i = 0; i < PZEM_CAPTURE_MAX_SPAN; i++) {
+        sample.regs[i] = i < snapshot->count ? snapshot->regs[i] : 0;
+    }
+    record.count++;
+
+    // Keep the crossing state current so the event does not re-trigger once the burst ends
+    Device* device = capture->findDevice(snapshot->slaveAddr, false);
+    if (device != NULL) {
+        crossed(device, sample.regs);
+    }
+
+    if (record.count - record.preCount >= capture->_postSamples) {
+        capture->finish();
+    }
+}
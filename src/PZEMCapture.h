@@ -0,0 +1,237 @@
+/**
+ * @file PZEMCapture.h
+ * @brief Event-triggered burst capture with a pre-trigger history
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMCAPTURE_H
+#define PZEMCAPTURE_H
+
+#include <Arduino.h>
+#include "PZEMBus.h"
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#define PZEM_ISR_ATTR IRAM_ATTR  ///< Keep ISR-callable code in IRAM
+#else
+#define PZEM_ISR_ATTR
+#endif
+
+/**
+ * @defgroup PZEMCaptureConfig Burst Capture Configuration
+ * @brief Compile-time sizing and defaults of the burst capture (override before including)
+ * @{
+ */
+#ifndef PZEM_CAPTURE_PRE_SAMPLES
+#define PZEM_CAPTURE_PRE_SAMPLES     8     ///< Snapshots kept per device before a trigger
+#endif
+#ifndef PZEM_CAPTURE_POST_SAMPLES
+#define PZEM_CAPTURE_POST_SAMPLES    32    ///< Maximum burst reads after a trigger
+#endif
+#define PZEM_CAPTURE_MAX_SPAN        6     ///< Largest burst span (PZEM-6L24 voltages and currents)
+#define PZEM_CAPTURE_DEFAULT_DURATION_MS 2000  ///< Default maximum burst duration (ms)
+/** @} */
+
+/**
+ * @defgroup PZEMCaptureTriggers Burst Capture Trigger Sources
+ * @{
+ */
+#define PZEM_CAPTURE_TRIGGER_API        0  ///< trigger() called by the application
+#define PZEM_CAPTURE_TRIGGER_THRESHOLD  1  ///< A register left its threshold window
+#define PZEM_CAPTURE_TRIGGER_EXTERNAL   2  ///< External signal (e.g. GPIO interrupt)
+/** @} */
+
+/**
+ * @struct PZEMCaptureSample
+ * @brief Voltage and current registers of one read
+ */
+struct PZEMCaptureSample {
+    uint32_t timestamp;                       ///< Time the response was received (millis)
+    uint16_t regs[PZEM_CAPTURE_MAX_SPAN];     ///< Input registers from 0x0000 (host order)
+};
+
+/**
+ * @struct PZEMCaptureRecord
+ * @brief One captured event: the pre-trigger history followed by the burst
+ */
+struct PZEMCaptureRecord {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t model;            ///< Model identifier (PZEM_MODEL_*)
+    uint8_t span;             ///< Valid registers per sample (PZEMModelInfo::burstRegs)
+    uint8_t source;           ///< Trigger source (PZEM_CAPTURE_TRIGGER_*)
+    uint32_t triggerTime;     ///< Time of the trigger (millis)
+    uint8_t preCount;         ///< Samples taken before the trigger (at the sweep rate)
+    uint8_t count;            ///< Total valid samples
+    PZEMCaptureSample samples[PZEM_CAPTURE_PRE_SAMPLES + PZEM_CAPTURE_POST_SAMPLES];  ///< Oldest first
+};
+
+/**
+ * @brief Callback receiving every completed capture
+ * @param record Captured window (valid during the call only)
+ * @param context User context given to setCaptureCallback()
+ */
+typedef void (*PZEMCaptureCallback)(const PZEMCaptureRecord* record, void* context);
+
+/**
+ * @class PZEMCapture
+ * @brief Dense capture of one device around an event
+ *
+ * Regular snapshots are fed in with record() (or by installing onSnapshot() as
+ * the bus snapshot callback); the voltage/current prefix of the last
+ * PZEM_CAPTURE_PRE_SAMPLES of each device is kept in a ring. On a trigger
+ * (threshold crossing, external signal or trigger() call) the device gets the
+ * bus through PZEMBus::setFocus() and is read back to back with its burst span
+ * (3 registers on the PZEM-004T, 2 on the PZEM-003/017, 6 on the PZEM-6L24)
+ * until the window is full or the maximum duration elapsed. Normal scheduling
+ * then resumes and the whole window is delivered as one record.
+ *
+ * One capture runs at a time; triggers arriving meanwhile are ignored.
+ */
+class PZEMCapture {
+public:
+    /**
+     * @brief Constructor for a burst capture
+     * @param bus Bus reading the devices
+     */
+    PZEMCapture(PZEMBus& bus);
+
+    /**
+     * @brief Trigger when a register leaves a window
+     * @param slaveAddr Slave device address
+     * @param reg Register index in the burst span (e.g. 0 = voltage)
+     * @param low Lowest normal raw value (host order)
+     * @param high Highest normal raw value (host order)
+     * @return true if set, false if the device table is full or reg is outside the span
+     * @note Fires on the crossing only: the register must come back inside the window
+     *       before the next threshold trigger.
+     */
+    bool setThreshold(uint8_t slaveAddr, uint8_t reg, uint16_t low, uint16_t high);
+
+    /**
+     * @brief Set the length of the burst after a trigger
+     * @param samples Burst reads to collect (at most PZEM_CAPTURE_POST_SAMPLES)
+     * @param maxDurationMs Maximum burst duration in milliseconds
+     */
+    void setWindow(uint8_t samples, uint32_t maxDurationMs);
+
+    /**
+     * @brief Set callback receiving every completed capture
+     * @param callback Callback, or NULL to disable
+     * @param context User context passed to the callback
+     */
+    void setCaptureCallback(PZEMCaptureCallback callback, void* context);
+
+    /**
+     * @brief Add a regular snapshot to the pre-trigger history
+     * @param snapshot Snapshot delivered by the bus
+     */
+    void record(const PZEMSnapshot* snapshot);
+
+    /**
+     * @brief Snapshot callback feeding record(), for PZEMBus::setSnapshotCallback()
+     * @param snapshot Snapshot delivered by the bus
+     * @param context PZEMCapture instance
+     */
+    static void onSnapshot(const PZEMSnapshot* snapshot, void* context);
+
+    /**
+     * @brief Request a capture of a device (interrupt safe)
+     * @param slaveAddr Slave device address
+     * @param source Trigger source reported in the record (default: PZEM_CAPTURE_TRIGGER_API)
+     * @return true if accepted, false if a capture is already pending or running
+     * @note The burst starts on the next poll(). The capture is claimed with interrupts
+     *       masked, so an interrupt and loop() triggering at once start one capture.
+     */
+    bool trigger(uint8_t slaveAddr, uint8_t source = PZEM_CAPTURE_TRIGGER_API);
+
+    /**
+     * @brief Advance the capture and the bus within a time budget (replaces PZEMBus::poll())
+     * @param budgetUs Maximum time to spend in microseconds
+     * @return true if transactions are still in flight, false if the bus is idle
+     */
+    bool poll(uint32_t budgetUs);
+
+    /**
+     * @brief Check whether a burst is running
+     * @return true while a device holds the bus for a capture
+     */
+    bool isCapturing() const;
+
+    /**
+     * @brief Get number of delivered captures
+     * @return Captures since construction
+     */
+    uint32_t getCaptureCount() const;
+
+private:
+    /**
+     * @brief History and trigger settings of one device
+     */
+    struct Device {
+        uint8_t slaveAddr;      ///< Slave address (0 = free entry)
+        uint8_t head;           ///< Next ring position
+        uint8_t count;          ///< Valid samples in the ring
+        bool armed;             ///< Threshold set
+        bool outside;           ///< Last sample was outside the window
+        uint8_t reg;            ///< Threshold register index
+        uint16_t low;           ///< Lowest normal value
+        uint16_t high;          ///< Highest normal value
+        PZEMCaptureSample ring[PZEM_CAPTURE_PRE_SAMPLES];  ///< Recent samples
+    };
+
+    PZEMBus& _bus;                          ///< Bus reading the devices
+    Device _devices[PZEM_BUS_MAX_DEVICES];  ///< Per-device history
+    volatile uint8_t _pending;              ///< Device waiting for a burst (0 = none)
+    volatile uint8_t _pendingSource;        ///< Trigger source of the pending capture
+    volatile uint32_t _pendingTime;         ///< Trigger time of the pending capture
+    uint8_t _active;                        ///< Device being captured (0 = none)
+    uint32_t _start;                        ///< Start of the burst (millis)
+    uint8_t _postSamples;                   ///< Burst reads to collect
+    uint32_t _maxDuration;                  ///< Maximum burst duration in milliseconds
+    uint32_t _captureCount;                 ///< Delivered captures
+    PZEMCaptureRecord _record;              ///< Capture in progress
+    PZEMCaptureCallback _onCapture;         ///< Capture callback (NULL if not used)
+    void* _onCaptureContext;                ///< Capture callback context
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Find a device entry
+     * @param slaveAddr Slave device address
+     * @param create Allocate a free entry if not found
+     * @return Pointer to the device, or NULL if not found (or the table is full)
+     */
+    Device* findDevice(uint8_t slaveAddr, bool create);
+
+    /**
+     * @brief Check the threshold of a device against a new sample
+     * @param device Device entry
+     * @param regs Sample registers
+     * @return true if the register just left its window
+     */
+    static bool crossed(Device* device, const uint16_t* regs);
+
+    /**
+     * @brief Copy the history and give the bus to the pending device
+     */
+    void start();
+
+    /**
+     * @brief Restore normal scheduling and deliver the record
+     */
+    void finish();
+
+    /**
+     * @brief Focus read callback collecting burst samples
+     * @param snapshot Short snapshot of the captured device
+     * @param context PZEMCapture instance
+     */
+    static void onBurst(const PZEMSnapshot* snapshot, void* context);
+
+    /** @} */
+};
+
+#endif // PZEMCAPTURE_H
@@ -0,0 +1,187 @@
+/**
+ * @file PZEMColdRead.cpp
+ * @brief Implementation of the single-transaction wake reads
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMColdRead.h"
+#include <stddef.h>
+
+/**
+ * @brief Constructor
+ *
+ * Wake reads know the exact length of their response, so the transport
+ * completes them without waiting for the end-of-frame silence.
+ */
+PZEMColdRead::PZEMColdRead(ModbusRTUTransport* transport, PZEMColdState* state)
+    : _transport(transport), _state(state) {
+    _transport->setCompleteOnLength(true);
+}
+
+/**
+ * @brief Read the settings of a device and prepare the state
+ *
+ * The settings read uses the full timeout: nothing is known about the
+ * device yet. The latency is learnt by the wake reads.
+ */
+bool PZEMColdRead::prepare(uint8_t model, uint8_t slaveAddr, uint32_t baudrate) {
+    const PZEMModelInfo* info = pzemModelInfo(model);
+    if (info == NULL) {
+        return false;
+    }
+    invalidate();
+
+    uint8_t count = info->holdingRegs < PZEM_COLD_SETTINGS ? info->holdingRegs : PZEM_COLD_SETTINGS;
+    uint8_t request[8];
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    modbusBuildReadRequest(request, slaveAddr, MODBUS_READ_HOLDING_REGISTERS, 0x0000, count);
+    ModbusTransaction txn;
+    txn.prepare(request, sizeof(request), response, sizeof(response), modbusReadResponseLength(count),
+                fullTimeout(modbusReadResponseLength(count), baudrate));
+    if (!_transport->execute(&txn) || response[2] != 2 * count) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        _state->settings[i] = modbusResponseRegister(response, i, info->bigEndian);
+    }
+    _state->settingsCount = count;
+    _state->slaveAddr = slaveAddr;
+    _state->model = model;
+    _state->baudrate = baudrate;
+    _state->responseLength = modbusReadResponseLength(info->snapshotRegs);
+    modbusBuildReadRequest(_state->request, slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000, info->snapshotRegs);
+    _state->magic = PZEM_COLD_MAGIC;
+    seal();
+    return true;
+}
+
+/**
+ * @brief Check the state
+ */
+bool PZEMColdRead::isValid() const {
+    return _state->magic == PZEM_COLD_MAGIC && _state->crc == stateCRC(_state) &&
+           pzemModelInfo(_state->model) != NULL;
+}
+
+/**
+ * @brief Forget the state
+ */
+void PZEMColdRead::invalidate() {
+    memset(_state, 0, sizeof(PZEMColdState));
+}
+
+/**
+ * @brief Read a snapshot with the precomputed request
+ *
+ * The response time is measured from submission to completion and folded
+ * into the learnt latency: a slower response raises it at once, faster ones
+ * lower it by an eighth of the difference, so one quick wake does not shrink
+ * the timeout below what the device needs now and then.
+ */
+bool PZEMColdRead::read(PZEMSnapshot* snapshot) {
+    if (!isValid()) {
+        return false;
+    }
+    const PZEMModelInfo* info = pzemModelInfo(_state->model);
+    uint8_t response[MODBUS_MAX_ADU_SIZE];
+    ModbusTransaction txn;
+    txn.prepare(_state->request, sizeof(_state->request), response, sizeof(response), _state->responseLength,
+                getTimeout());
+
+    uint32_t startUs = micros();
+    bool ok = _transport->execute(&txn) && txn.responseLength == _state->responseLength &&
+              response[2] == 2 * info->snapshotRegs;
+    uint32_t elapsedUs = micros() - startUs;
+
+    if (!ok) {
+        if (_state->failures < 0xFF) {
+            _state->failures++;
+        }
+        seal();
+        return false;
+    }
+
+    snapshot->slaveAddr = _state->slaveAddr;
+    snapshot->model = _state->model;
+    snapshot->count = info->snapshotRegs;
+    snapshot->timestamp = millis();
+    for (uint8_t i = 0; i < info->snapshotRegs; i++) {
+        snapshot->regs[i] = modbusResponseRegister(response, i, info->bigEndian);
+    }
+
+    if (elapsedUs > _state->latencyUs) {
+        _state->latencyUs = elapsedUs;
+    } else {
+        _state->latencyUs -= (_state->latencyUs - elapsedUs) / 8;
+    }
+    _state->failures = 0;
+    _state->wakes++;
+    seal();
+    return true;
+}
+
+/**
+ * @brief Get a setting kept in the state
+ */
+bool PZEMColdRead::getSetting(uint16_t reg, uint16_t* value) const {
+    if (!isValid() || reg >= _state->settingsCount) {
+        return false;
+    }
+    *value = _state->settings[reg];
+    return true;
+}
+
+/**
+ * @brief Get the response timeout of the next read
+ *
+ * The learnt latency plus a quarter and a margin, between
+ * PZEM_COLD_MIN_TIMEOUT_MS and the full timeout; the full timeout until a
+ * latency is known and after a failed read. The latency includes the request
+ * on the wire, which the timeout (started after it) does not need: that is
+ * headroom too.
+ */
+uint32_t PZEMColdRead::getTimeout() const {
+    uint32_t full = fullTimeout(_state->responseLength, _state->baudrate);
+    if (_state->latencyUs == 0 || _state->failures != 0) {
+        return full;
+    }
+    uint32_t latencyMs = (_state->latencyUs + 999) / 1000;
+    uint32_t timeout = latencyMs + latencyMs / 4 + PZEM_COLD_MARGIN_MS;
+    if (timeout < PZEM_COLD_MIN_TIMEOUT_MS) {
+        return PZEM_COLD_MIN_TIMEOUT_MS;
+    }
+    return timeout > full ? full : timeout;
+}
+
+/**
+ * @brief Get the number of consecutive failed reads
+ */
+uint8_t PZEMColdRead::getFailures() const {
+    return _state->failures;
+}
+
+/**
+ * @brief Get the timeout of a read nothing is learnt about
+ *
+ * PZEM_COLD_FULL_TIMEOUT_MS alone would cut the 133-byte PZEM-6L24 snapshot,
+ * which needs about 150 ms on the wire at 9600 baud.
+ */
+uint32_t PZEMColdRead::fullTimeout(uint16_t responseLength, uint32_t baudrate) {
+    return modbusWireTimeMs(responseLength, baudrate > 0 ? baudrate : 9600) + PZEM_COLD_FULL_TIMEOUT_MS;
+}
+
+/**
+ * @brief Compute the CRC of a state
+ */
+uint16_t PZEMColdRead::stateCRC(const PZEMColdState* state) {
+    return modbusCRC16((const uint8_t*)state, offsetof(PZEMColdState, crc));
+}
+
+/**
+ * @brief Update the CRC of the state after a change
+ */
+void PZEMColdRead::seal() {
+    _state->crc = stateCRC(_state);
+}
@@ -0,0 +1,163 @@
+/**
+ * @file PZEMColdRead.h
+ * @brief Single-transaction snapshot reads for duty-cycled nodes that sleep between readings
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * A node that deep-sleeps between readings pays, on every wake, for the
+ * device setup (buffer clearing, settings reads) and for timings sized for
+ * an unknown line: a 100 ms response timeout and the end-of-frame silence
+ * after the last byte. The cold read keeps what it learnt on the first boot
+ * in a PZEMColdState held in RTC memory (and optionally NVS): the device
+ * settings, the request frame with its CRC and the response latency of the
+ * device. On a wake the request goes out as soon as the UART is up, the
+ * response completes on its exact length and CRC, and the timeout is sized
+ * from the latency seen on previous wakes.
+ */
+
+#ifndef PZEMCOLDREAD_H
+#define PZEMCOLDREAD_H
+
+#include <Arduino.h>
+#include "ModbusTransport.h"
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMColdReadConfig Cold Read Configuration
+ * @{
+ */
+#define PZEM_COLD_MAGIC             0x505A4331UL  ///< Marks a prepared state ("PZC1")
+#define PZEM_COLD_SETTINGS          4      ///< Holding registers kept (PZEM-017: 4)
+#define PZEM_COLD_FULL_TIMEOUT_MS   100    ///< Device response time of the full timeout, on top of the response wire time
+#ifndef PZEM_COLD_MIN_TIMEOUT_MS
+#define PZEM_COLD_MIN_TIMEOUT_MS    5      ///< Shortest timeout of a wake read
+#endif
+#ifndef PZEM_COLD_MARGIN_MS
+#define PZEM_COLD_MARGIN_MS         3      ///< Added to the learnt latency and a quarter
+#endif
+/** @} */
+
+/**
+ * @struct PZEMColdState
+ * @brief Everything a wake read needs, kept across deep sleep
+ *
+ * Plain data: place it in RTC memory (RTC_DATA_ATTR on ESP32) and copy it to
+ * NVS to survive a power loss. A CRC guards against stale or random content.
+ */
+struct PZEMColdState {
+    uint32_t magic;                 ///< PZEM_COLD_MAGIC once prepared
+    uint8_t slaveAddr;              ///< Slave device address
+    uint8_t model;                  ///< Model identifier (PZEM_MODEL_*)
+    uint8_t settingsCount;          ///< Valid entries of settings
+    uint8_t responseLength;         ///< Length of the snapshot response frame
+    uint32_t baudrate;              ///< Line speed
+    uint8_t request[8];             ///< Snapshot request frame including its CRC
+    uint16_t settings[PZEM_COLD_SETTINGS];  ///< Holding registers from 0x0000 (host order)
+    uint32_t latencyUs;             ///< Learnt response time, request sent to last byte (0: unknown)
+    uint32_t wakes;                 ///< Successful wake reads
+    uint8_t failures;               ///< Consecutive failed wake reads
+    uint8_t reserved;               ///< Padding (0)
+    uint16_t crc;                   ///< CRC16 of the fields above
+};
+
+/**
+ * @class PZEMColdRead
+ * @brief Reads a full snapshot in one transaction right after a wake
+ *
+ * Call prepare() once (first boot, or when isValid() is false): it reads the
+ * settings with the normal timings and fills the state. Each wake then only
+ * initializes the UART and calls read(). The transport is set to complete
+ * responses on their length (ModbusRTUTransport::setCompleteOnLength()).
+ */
+class PZEMColdRead {
+public:
+    /**
+     * @brief Constructor
+     * @param transport Serial transport of the device
+     * @param state State kept across deep sleep
+     */
+    PZEMColdRead(ModbusRTUTransport* transport, PZEMColdState* state);
+
+    /**
+     * @brief Read the settings of a device and prepare the state
+     * @param model Model identifier (PZEM_MODEL_*)
+     * @param slaveAddr Slave device address
+     * @param baudrate Line speed, kept in the state for the UART setup of the wakes
+     * @return true if prepared, false if the model is unknown or the device did not answer
+     */
+    bool prepare(uint8_t model, uint8_t slaveAddr, uint32_t baudrate = 9600);
+
+    /**
+     * @brief Check the state
+     * @return true if the state is prepared and intact, false otherwise
+     */
+    bool isValid() const;
+
+    /**
+     * @brief Forget the state (the next boot prepares it again)
+     */
+    void invalidate();
+
+    /**
+     * @brief Read a snapshot with the precomputed request
+     * @param snapshot Receives every measurement register
+     * @return true if read, false on timeout, CRC error or an invalid state
+     * @note A failure makes the next read use the full timeout: the response wire time at the
+     *       baud rate of the state plus PZEM_COLD_FULL_TIMEOUT_MS.
+     */
+    bool read(PZEMSnapshot* snapshot);
+
+    /**
+     * @brief Get a setting kept in the state
+     * @param reg Holding register address
+     * @param value Receives the value (host order)
+     * @return true if the register is kept, false otherwise
+     */
+    bool getSetting(uint16_t reg, uint16_t* value) const;
+
+    /**
+     * @brief Get the response timeout of the next read
+     * @return Timeout in milliseconds
+     */
+    uint32_t getTimeout() const;
+
+    /**
+     * @brief Get the number of consecutive failed reads
+     * @return Failures since the last successful read
+     */
+    uint8_t getFailures() const;
+
+private:
+    ModbusRTUTransport* _transport;  ///< Serial transport
+    PZEMColdState* _state;           ///< State kept across deep sleep
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Get the timeout of a read nothing is learnt about
+     * @param responseLength Response frame length in bytes
+     * @param baudrate Line speed (0: 9600)
+     * @return Response wire time plus PZEM_COLD_FULL_TIMEOUT_MS, in milliseconds
+     */
+    static uint32_t fullTimeout(uint16_t responseLength, uint32_t baudrate);
+
+    /**
+     * @brief Compute the CRC of a state
+     * @param state State
+     * @return CRC16 of every field before crc
+     */
+    static uint16_t stateCRC(const PZEMColdState* state);
+
+    /**
+     * @brief Update the CRC of the state after a change
+     */
+    void seal();
+
+    /** @} */
+};
+
+#endif // PZEMCOLDREAD_H
@@ -0,0 +1,585 @@
+/**
+ * @file PZEMCoroutine.h
+ * @brief Optional C++20 coroutine front-end for asynchronous meter reads
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Lets non-blocking polling be written as straight-line code:
+ *
+ * @code
+ * PZEMExecutor executor;
+ * PZEMAsyncMeter meter(executor, transport, 0x01, PZEM_MODEL_004T);
+ *
+ * PZEMTask poller() {
+ *     PZEMSnapshot snapshot;
+ *     for (;;) {
+ *         if (co_await meter.readSnapshot(snapshot)) {
+ *             // use snapshot.regs
+ *         }
+ *         co_await executor.sleep(1000);
+ *     }
+ * }
+ *
+ * void setup() { executor.spawn(poller()); }
+ * void loop()  { executor.runOnce(); }
+ * @endcode
+ *
+ * Everything runs on the thread calling runOnce(): the executor polls the
+ * transports, and a completed transaction schedules the coroutine waiting for
+ * it. Coroutine frames come from a fixed pool (PZEM_COROUTINE_POOL_SIZE blocks of
+ * PZEM_COROUTINE_FRAME_SIZE bytes), never from the heap; spawn() fails when the
+ * pool is exhausted or the frame does not fit a block.
+ *
+ * Header-only; available when the toolchain compiles as C++20 with <coroutine>.
+ */
+
+#ifndef PZEMCOROUTINE_H
+#define PZEMCOROUTINE_H
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define PZEM_COROUTINES_AVAILABLE 1
+#endif
+#endif
+
+#ifdef PZEM_COROUTINES_AVAILABLE
+
+#include <coroutine>
+#include <stddef.h>
+#include "ModbusTransport.h"
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMCoroutineConfig Coroutine Configuration
+ * @{
+ */
+#ifndef PZEM_COROUTINE_FRAME_SIZE
+#define PZEM_COROUTINE_FRAME_SIZE     1024 ///< Size of one coroutine frame block (bytes)
+#endif
+#ifndef PZEM_COROUTINE_POOL_SIZE
+#define PZEM_COROUTINE_POOL_SIZE      8    ///< Number of frame blocks (at most 32)
+#endif
+#ifndef PZEM_EXECUTOR_MAX_TRANSPORTS
+#define PZEM_EXECUTOR_MAX_TRANSPORTS  4    ///< Transports polled by one executor
+#endif
+#define PZEM_ASYNC_MAX_REGISTERS      PZEM_SNAPSHOT_MAX_REGISTERS  ///< Registers per asynchronous read
+/** @} */
+
+/**
+ * @class PZEMFramePool
+ * @brief Fixed pool of coroutine frame blocks
+ */
+class PZEMFramePool {
+public:
+    /**
+     * @brief Take a free block
+     * @param size Requested frame size in bytes
+     * @return Pointer to the block, or NULL if the pool is exhausted or size is too large
+     */
+    static void* allocate(size_t size) noexcept {
+        if (size > PZEM_COROUTINE_FRAME_SIZE) {
+            return NULL;
+        }
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if ((_used & (1UL << i)) == 0) {
+                _used |= (1UL << i);
+                return _blocks[i].data;
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * @brief Return a block to the pool
+     * @param block Pointer returned by allocate()
+     */
+    static void release(void* block) noexcept {
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (block == _blocks[i].data) {
+                _used &= ~(1UL << i);
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the number of blocks in use
+     * @return Blocks in use
+     */
+    static uint8_t getUsed() noexcept {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (_used & (1UL << i)) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+private:
+    static_assert(PZEM_COROUTINE_POOL_SIZE <= 32, "PZEM_COROUTINE_POOL_SIZE must not exceed 32");
+
+    struct Block {
+        alignas(max_align_t) uint8_t data[PZEM_COROUTINE_FRAME_SIZE];
+    };
+
+    static inline Block _blocks[PZEM_COROUTINE_POOL_SIZE];  ///< Frame storage
+    static inline uint32_t _used = 0;                       ///< Bitmap of blocks in use
+};
+
+/**
+ * @class PZEMTask
+ * @brief Coroutine run by a PZEMExecutor
+ *
+ * A task starts suspended and begins when spawned; its frame is returned to the
+ * pool when it finishes. A default-constructed (or failed) task is invalid.
+ */
+class PZEMTask {
+public:
+    struct promise_type {
+        PZEMTask get_return_object() noexcept {
+            return PZEMTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        static PZEMTask get_return_object_on_allocation_failure() noexcept { return PZEMTask(); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+
+        static void* operator new(size_t size) noexcept { return PZEMFramePool::allocate(size); }
+        static void operator delete(void* block) noexcept { PZEMFramePool::release(block); }
+    };
+
+    PZEMTask() noexcept : _handle(nullptr) {}
+    PZEMTask(PZEMTask&& other) noexcept : _handle(other._handle) { other._handle = nullptr; }
+    PZEMTask(const PZEMTask&) = delete;
+    PZEMTask& operator=(const PZEMTask&) = delete;
+    ~PZEMTask() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    /**
+     * @brief Check whether the coroutine frame could be allocated
+     * @return true if the task can be spawned
+     */
+    bool isValid() const noexcept { return static_cast<bool>(_handle); }
+
+    /**
+     * @brief Give up ownership of the coroutine
+     * @return Coroutine handle (null for an invalid task)
+     */
+    std::coroutine_handle<promise_type> release() noexcept {
+        std::coroutine_handle<promise_type> handle = _handle;
+        _handle = nullptr;
+        return handle;
+    }
+
+private:
+    explicit PZEMTask(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;  ///< Owned coroutine
+};
+
+class PZEMExecutor;
+
+/**
+ * @class PZEMSleepAwaitable
+ * @brief Awaitable returned by PZEMExecutor::sleep()
+ */
+class PZEMSleepAwaitable {
+public:
+    PZEMSleepAwaitable(PZEMExecutor& executor, uint32_t ms) noexcept : _executor(executor), _ms(ms) {}
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept;
+    void await_resume() const noexcept {}
+
+private:
+    PZEMExecutor& _executor;  ///< Executor owning the timer
+    uint32_t _ms;             ///< Sleep duration in milliseconds
+};
+
+/**
+ * @class PZEMExecutor
+ * @brief Tiny single-threaded executor for PZEMTask coroutines
+ *
+ * runOnce() polls every registered transport, wakes sleeping tasks whose time
+ * has come and resumes tasks whose transaction completed. It never blocks, so
+ * it can be called from loop() next to other work.
+ *
+ * Tasks must not be left suspended in a transaction when the executor is destroyed.
+ */
+class PZEMExecutor {
+public:
+    /**
+     * @brief Constructor, creates an executor without tasks or transports
+     */
+    PZEMExecutor() noexcept : _transportCount(0), _readyHead(0), _readyCount(0) {
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            _tasks[i] = nullptr;
+            _timers[i].handle = nullptr;
+        }
+    }
+
+    ~PZEMExecutor() {
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (_tasks[i]) {
+                _tasks[i].destroy();
+            }
+        }
+    }
+
+    PZEMExecutor(const PZEMExecutor&) = delete;
+    PZEMExecutor& operator=(const PZEMExecutor&) = delete;
+
+    /**
+     * @brief Register a transport to be polled (duplicates are ignored)
+     * @param transport Transport used by the tasks
+     * @return true if registered, false if the transport table is full
+     */
+    bool addTransport(ModbusTransport* transport) noexcept {
+        for (uint8_t i = 0; i < _transportCount; i++) {
+            if (_transports[i] == transport) {
+                return true;
+            }
+        }
+        if (transport == NULL || _transportCount >= PZEM_EXECUTOR_MAX_TRANSPORTS) {
+            return false;
+        }
+        _transports[_transportCount++] = transport;
+        return true;
+    }
+
+    /**
+     * @brief Start a task
+     * @param task Task returned by a coroutine function
+     * @return true if started, false if the task is invalid (frame pool exhausted)
+     */
+    bool spawn(PZEMTask&& task) noexcept {
+        if (!task.isValid()) {
+            return false;
+        }
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (!_tasks[i]) {
+                _tasks[i] = task.release();
+                schedule(_tasks[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Run one round: poll transports, fire timers, resume ready tasks (non-blocking)
+     * @return true while tasks remain
+     */
+    bool runOnce() noexcept {
+        for (uint8_t i = 0; i < _transportCount; i++) {
+            _transports[i]->poll();
+        }
+
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (_timers[i].handle && (int32_t)(now - _timers[i].due) >= 0) {
+                std::coroutine_handle<> handle = _timers[i].handle;
+                _timers[i].handle = nullptr;
+                schedule(handle);
+            }
+        }
+
+        // Only tasks ready at the start of the round run, so a task cannot starve the others
+        uint8_t count = _readyCount;
+        while (count-- > 0) {
+            std::coroutine_handle<> handle = _ready[_readyHead];
+            _readyHead = (_readyHead + 1) % PZEM_COROUTINE_POOL_SIZE;
+            _readyCount--;
+            handle.resume();
+        }
+
+        bool remaining = false;
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (_tasks[i] && _tasks[i].done()) {
+                _tasks[i].destroy();
+                _tasks[i] = nullptr;
+            }
+            if (_tasks[i]) {
+                remaining = true;
+            }
+        }
+        return remaining;
+    }
+
+    /**
+     * @brief Run until every task has finished
+     */
+    void run() noexcept {
+        while (runOnce()) {
+            yield();
+        }
+    }
+
+    /**
+     * @brief Get the number of running tasks
+     * @return Tasks not yet finished
+     */
+    uint8_t getTaskCount() const noexcept {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (_tasks[i]) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Suspend the calling task for a while
+     * @param ms Duration in milliseconds
+     * @return Awaitable
+     */
+    PZEMSleepAwaitable sleep(uint32_t ms) noexcept { return PZEMSleepAwaitable(*this, ms); }
+
+    /**
+     * @brief Queue a suspended coroutine for resumption (used by awaitables)
+     * @param handle Suspended coroutine
+     */
+    void schedule(std::coroutine_handle<> handle) noexcept {
+        // Each task waits on one thing at a time, so the queue cannot overflow
+        _ready[(_readyHead + _readyCount) % PZEM_COROUTINE_POOL_SIZE] = handle;
+        _readyCount++;
+    }
+
+    /**
+     * @brief Wake a coroutine after a delay (used by PZEMSleepAwaitable)
+     * @param handle Suspended coroutine
+     * @param ms Delay in milliseconds
+     * @return true if the timer was set
+     */
+    bool scheduleAfter(std::coroutine_handle<> handle, uint32_t ms) noexcept {
+        for (uint8_t i = 0; i < PZEM_COROUTINE_POOL_SIZE; i++) {
+            if (!_timers[i].handle) {
+                _timers[i].handle = handle;
+                _timers[i].due = millis() + ms;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Timer {
+        std::coroutine_handle<> handle;  ///< Sleeping coroutine (null if free)
+        uint32_t due;                    ///< Wake-up time (millis)
+    };
+
+    ModbusTransport* _transports[PZEM_EXECUTOR_MAX_TRANSPORTS];  ///< Polled transports
+    uint8_t _transportCount;                                     ///< Registered transports
+    std::coroutine_handle<PZEMTask::promise_type> _tasks[PZEM_COROUTINE_POOL_SIZE];  ///< Running tasks
+    Timer _timers[PZEM_COROUTINE_POOL_SIZE];                     ///< Sleeping tasks
+    std::coroutine_handle<> _ready[PZEM_COROUTINE_POOL_SIZE];    ///< Ready queue (ring)
+    uint8_t _readyHead;                                          ///< First ready entry
+    uint8_t _readyCount;                                         ///< Ready entries
+};
+
+inline bool PZEMSleepAwaitable::await_suspend(std::coroutine_handle<> handle) noexcept {
+    // Resume immediately if no timer is free
+    return _executor.scheduleAfter(handle, _ms);
+}
+
+/**
+ * @class PZEMReadAwaitable
+ * @brief Awaitable register read; co_await yields true on success
+ *
+ * The request and response buffers live in the awaitable, i.e. in the
+ * coroutine frame, for the duration of the transaction.
+ */
+class PZEMReadAwaitable {
+public:
+    /**
+     * @brief Constructor for an asynchronous register read
+     * @param executor Executor resuming the coroutine
+     * @param transport Transport carrying the request
+     * @param slaveAddr Slave device address
+     * @param function MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+     * @param startReg Starting register address
+     * @param numRegs Number of registers (1 to PZEM_ASYNC_MAX_REGISTERS)
+     * @param data Destination for the register values (host order)
+     * @param bigEndian Register byte order of the device
+     * @param timeout Response timeout in milliseconds
+     */
+    PZEMReadAwaitable(PZEMExecutor& executor, ModbusTransport& transport, uint8_t slaveAddr, uint8_t function,
+                      uint16_t startReg, uint16_t numRegs, uint16_t* data, bool bigEndian, uint32_t timeout) noexcept
+        : _executor(executor), _transport(transport), _numRegs(numRegs), _data(data),
+          _bigEndian(bigEndian), _timeout(timeout), _submitted(false) {
+        modbusBuildReadRequest(_request, slaveAddr, function, startReg, numRegs);
+    }
+
+    PZEMReadAwaitable(const PZEMReadAwaitable&) = delete;
+    PZEMReadAwaitable& operator=(const PZEMReadAwaitable&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        if (_numRegs == 0 || _numRegs > PZEM_ASYNC_MAX_REGISTERS || _data == NULL) {
+            return false;
+        }
+        _handle = handle;
+        _txn.prepare(_request, sizeof(_request), _response, sizeof(_response),
+                     modbusReadResponseLength(_numRegs), _timeout);
+        _txn.onComplete = onComplete;
+        _txn.context = this;
+        _submitted = _transport.submit(&_txn);
+        return _submitted;
+    }
+
+    bool await_resume() noexcept {
+        if (!_submitted || _txn.status != MODBUS_TRANSACTION_OK || _response[2] != _numRegs * 2) {
+            return false;
+        }
+        for (uint16_t i = 0; i < _numRegs; i++) {
+            uint8_t hi = _response[3 + i * 2];
+            uint8_t lo = _response[4 + i * 2];
+            _data[i] = _bigEndian ? (uint16_t)((hi << 8) | lo) : (uint16_t)((lo << 8) | hi);
+        }
+        return true;
+    }
+
+private:
+    static void onComplete(ModbusTransaction*, void* context) noexcept {
+        PZEMReadAwaitable* self = static_cast<PZEMReadAwaitable*>(context);
+        self->_executor.schedule(self->_handle);
+    }
+
+    PZEMExecutor& _executor;            ///< Executor resuming the coroutine
+    ModbusTransport& _transport;        ///< Transport carrying the request
+    uint16_t _numRegs;                  ///< Registers requested
+    uint16_t* _data;                    ///< Destination
+    bool _bigEndian;                    ///< Register byte order
+    uint32_t _timeout;                  ///< Response timeout in milliseconds
+    bool _submitted;                    ///< Transport accepted the transaction
+    std::coroutine_handle<> _handle;    ///< Waiting coroutine
+    ModbusTransaction _txn;             ///< Transaction in flight
+    uint8_t _request[8];                ///< Request frame
+    uint8_t _response[5 + PZEM_ASYNC_MAX_REGISTERS * 2];  ///< Response frame
+};
+
+/**
+ * @class PZEMSnapshotAwaitable
+ * @brief Awaitable full snapshot read; co_await yields true on success
+ */
+class PZEMSnapshotAwaitable : public PZEMReadAwaitable {
+public:
+    PZEMSnapshotAwaitable(PZEMExecutor& executor, ModbusTransport& transport, uint8_t slaveAddr,
+                          uint8_t model, const PZEMModelInfo* info, PZEMSnapshot& snapshot,
+                          uint32_t timeout) noexcept
+        : PZEMReadAwaitable(executor, transport, slaveAddr, MODBUS_READ_INPUT_REGISTERS, 0x0000,
+                            info ? info->snapshotRegs : 0, snapshot.regs, info ? info->bigEndian : true, timeout),
+          _snapshot(snapshot), _slaveAddr(slaveAddr), _model(model), _count(info ? info->snapshotRegs : 0) {}
+
+    bool await_resume() noexcept {
+        if (!PZEMReadAwaitable::await_resume()) {
+            return false;
+        }
+        _snapshot.slaveAddr = _slaveAddr;
+        _snapshot.model = _model;
+        _snapshot.count = _count;
+        _snapshot.timestamp = millis();
+        return true;
+    }
+
+private:
+    PZEMSnapshot& _snapshot;  ///< Destination snapshot
+    uint8_t _slaveAddr;       ///< Slave device address
+    uint8_t _model;           ///< Model identifier
+    uint8_t _count;           ///< Snapshot span
+};
+
+/**
+ * @class PZEMAsyncMeter
+ * @brief One meter on a non-blocking transport, read from coroutines
+ *
+ * Meters on different transports (buses) are read concurrently by spawning one
+ * task per bus; meters sharing a transport are served in submission order.
+ */
+class PZEMAsyncMeter {
+public:
+    /**
+     * @brief Constructor for an asynchronous meter
+     * @param executor Executor running the tasks (the transport is registered with it)
+     * @param transport Transport reaching the meter
+     * @param slaveAddr Slave device address
+     * @param model Model identifier (PZEM_MODEL_*)
+     */
+    PZEMAsyncMeter(PZEMExecutor& executor, ModbusTransport& transport, uint8_t slaveAddr, uint8_t model) noexcept
+        : _executor(executor), _transport(transport), _slaveAddr(slaveAddr), _model(model),
+          _info(pzemModelInfo(model)), _timeout(100) {
+        executor.addTransport(&transport);
+    }
+
+    /**
+     * @brief Set response timeout
+     * @param timeout Response timeout in milliseconds (default: 100)
+     */
+    void setTimeout(uint32_t timeout) noexcept { _timeout = timeout; }
+
+    /**
+     * @brief Read every measurement register in one transaction
+     * @param snapshot Destination snapshot
+     * @return Awaitable yielding true on success
+     */
+    PZEMSnapshotAwaitable readSnapshot(PZEMSnapshot& snapshot) noexcept {
+        return PZEMSnapshotAwaitable(_executor, _transport, _slaveAddr, _model, _info, snapshot, _timeout);
+    }
+
+    /**
+     * @brief Read input registers
+     * @param startReg Starting register address
+     * @param numRegs Number of registers
+     * @param data Destination for the register values
+     * @return Awaitable yielding true on success
+     */
+    PZEMReadAwaitable readInputRegisters(uint16_t startReg, uint16_t numRegs, uint16_t* data) noexcept {
+        return PZEMReadAwaitable(_executor, _transport, _slaveAddr, MODBUS_READ_INPUT_REGISTERS,
+                                 startReg, numRegs, data, bigEndian(), _timeout);
+    }
+
+    /**
+     * @brief Read holding registers
+     * @param startReg Starting register address
+     * @param numRegs Number of registers
+     * @param data Destination for the register values
+     * @return Awaitable yielding true on success
+     */
+    PZEMReadAwaitable readHoldingRegisters(uint16_t startReg, uint16_t numRegs, uint16_t* data) noexcept {
+        return PZEMReadAwaitable(_executor, _transport, _slaveAddr, MODBUS_READ_HOLDING_REGISTERS,
+                                 startReg, numRegs, data, bigEndian(), _timeout);
+    }
+
+    /**
+     * @brief Get slave address
+     * @return Slave device address
+     */
+    uint8_t getSlaveAddr() const noexcept { return _slaveAddr; }
+
+    /**
+     * @brief Get model identifier
+     * @return Model identifier (PZEM_MODEL_*)
+     */
+    uint8_t getModel() const noexcept { return _model; }
+
+private:
+    bool bigEndian() const noexcept { return _info ? _info->bigEndian : true; }
+
+    PZEMExecutor& _executor;        ///< Executor running the tasks
+    ModbusTransport& _transport;    ///< Transport reaching the meter
+    uint8_t _slaveAddr;             ///< Slave device address
+    uint8_t _model;                 ///< Model identifier
+    const PZEMModelInfo* _info;     ///< Register layout
+    uint32_t _timeout;              ///< Response timeout in milliseconds
+};
+
+#endif // PZEM_COROUTINES_AVAILABLE
+
+#endif // PZEMCOROUTINE_H
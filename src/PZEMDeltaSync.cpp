@@ -0,0 +1,705 @@
+/**
+ * @file PZEMDeltaSync.cpp
+ * @brief Implementation of the register-diff sync protocol
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Message layout: magic, version, session identifier (4 bytes), Unix time
+ * (4 bytes), record count, the records, and a CRC over everything before it. Multi-byte fields are little
+ * endian; varints hold 7 bits per byte, low bits first.
+ *
+ * Device record: slave address, model, register count, flags (bit 0:
+ * keyframe), varint sequence number, varint distance to the base sequence
+ * number (deltas only), varint age of the reading in ms, change bitmap, then
+ * one varint per flagged register: the zigzagged 16-bit difference to the
+ * base register (to 0 in a keyframe). Up to 8 registers the bitmap is one
+ * byte; above, a summary byte flags the non-zero bitmap bytes that follow.
+ *
+ * Acknowledgement layout: magic, version, session identifier (4 bytes),
+ * entry count, per device its slave address, flags (bit 0: keyframe wanted) and the varint sequence number of
+ * its latest image, and a CRC.
+ */
+
+#include "PZEMDeltaSync.h"
+#include "ModbusProtocol.h"
+
+#define DELTA_MAGIC           0xD5  ///< First byte of a message
+#define DELTA_ACK_MAGIC       0xD6  ///< First byte of an acknowledgement
+#define DELTA_VERSION         2     ///< Layout version
+#define DELTA_HEADER          11    ///< Message header size
+#define DELTA_ACK_HEADER      7     ///< Acknowledgement header size
+#define DELTA_FLAG_KEYFRAME   0x01  ///< Record flag: whole image / acknowledgement flag: keyframe wanted
+#define DELTA_ACK_ENTRY_MAX   7     ///< Largest acknowledgement entry
+
+/**
+ * @brief Worst-case length of the record of a device with count registers
+ */
+#define DELTA_RECORD_BOUND(count) (28 + 3 * (uint32_t)(count))
+
+static void put32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Continue a Modbus CRC over a buffer of any length
+ */
+static uint16_t crcUpdate(uint16_t crc, const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        crc = modbusCRC16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+/**
+ * @brief Append the CRC of a message and return its full length
+ */
+static uint32_t seal(uint8_t* out, uint32_t length) {
+    uint16_t crc = crcUpdate(0xFFFF, out, length);
+    out[length] = crc & 0xFF;
+    out[length + 1] = crc >> 8;
+    return length + 2;
+}
+
+/**
+ * @brief Check the magic, version and CRC of a message
+ */
+static bool sealed(const uint8_t* data, uint32_t length, uint8_t magic, uint32_t header) {
+    if (data == NULL || length < header + 2 || data[0] != magic || data[1] != DELTA_VERSION) {
+        return false;
+    }
+    uint16_t crc = crcUpdate(0xFFFF, data, length - 2);
+    return data[length - 2] == (crc & 0xFF) && data[length - 1] == (crc >> 8);
+}
+
+static uint32_t putVarint(uint8_t* p, uint32_t value) {
+    uint32_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = value;
+    return n;
+}
+
+/**
+ * @brief Read a varint of at most 32 bits
+ * @return false if truncated or too long
+ */
+static bool getVarint(const uint8_t* data, uint32_t length, uint32_t* position, uint32_t* value) {
+    uint32_t result = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (*position >= length) {
+            return false;
+        }
+        uint8_t byte = data[(*position)++];
+        if (shift == 28 && byte > 0x0F) {
+            return false;
+        }
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Map a 16-bit difference to an unsigned value, small magnitudes first
+ */
+static uint16_t zigzag(uint16_t difference) {
+    return (uint16_t)((difference << 1) ^ (0 - (difference >> 15)));
+}
+
+static uint16_t unzigzag(uint16_t value) {
+    return (uint16_t)((value >> 1) ^ (uint16_t)(-(int16_t)(value & 1)));
+}
+
+/**
+ * @brief Check the model and register count of a record against the model layout
+ */
+static bool validLayout(uint8_t slaveAddr, uint8_t model, uint8_t count) {
+    const PZEMModelInfo* info = pzemModelInfo(model);
+    return slaveAddr != 0 && info != NULL && count > 0 && count <= info->snapshotRegs;
+}
+
+/**
+ * @brief Next sequence number, skipping 0 (no image)
+ */
+static uint32_t nextSeq(uint32_t seq) {
+    return seq + 1 == 0 ? 1 : seq + 1;
+}
+
+/**
+ * @brief Constructor for a delta encoder
+ */
+PZEMDeltaEncoder::PZEMDeltaEncoder() : _session(0), _keyframeInterval(PZEM_DELTA_KEYFRAME_MS) {
+    clear();
+}
+
+/**
+ * @brief Forget every device and start a new session
+ *
+ * Sequence numbers start from 1 again, so the session changes with them.
+ */
+void PZEMDeltaEncoder::clear() {
+    memset(_devices, 0, sizeof(_devices));
+    memset(&_stats, 0, sizeof(_stats));
+    _nextDevice = 0;
+    if (_session != 0) {
+        _session = nextSeq(_session);
+    }
+}
+
+/**
+ * @brief Set the session identifier
+ */
+void PZEMDeltaEncoder::setSession(uint32_t session) {
+    _session = session;
+}
+
+/**
+ * @brief Get the session identifier
+ */
+uint32_t PZEMDeltaEncoder::getSession() const {
+    return _session;
+}
+
+/**
+ * @brief Set the keyframe interval
+ */
+void PZEMDeltaEncoder::setKeyframeInterval(uint32_t intervalMs) {
+    _keyframeInterval = intervalMs;
+}
+
+/**
+ * @brief Find the state of a device
+ */
+PZEMDeltaEncoder::Device* PZEMDeltaEncoder::find(uint8_t slaveAddr) {
+    for (uint8_t i = 0; i < PZEM_DELTA_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr) {
+            return &_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Forget the base and the unacknowledged images of a device
+ *
+ * Every record is a keyframe until one of them is acknowledged.
+ */
+void PZEMDeltaEncoder::resetBase(Device* device) {
+    device->baseSeq = 0;
+    memset(device->sentSeq, 0, sizeof(device->sentSeq));
+}
+
+/**
+ * @brief Record the latest snapshot of a device
+ *
+ * A model or register count change restarts the device from a keyframe.
+ */
+bool PZEMDeltaEncoder::update(const PZEMSnapshot* snapshot) {
+    if (snapshot == NULL || !validLayout(snapshot->slaveAddr, snapshot->model, snapshot->count)) {
+        return false;
+    }
+    Device* device = find(snapshot->slaveAddr);
+    if (device == NULL) {
+        device = find(0);
+        if (device == NULL) {
+            return false;
+        }
+        memset(device, 0, sizeof(Device));
+        device->slaveAddr = snapshot->slaveAddr;
+        device->model = snapshot->model;
+        device->count = snapshot->count;
+        device->nextSeq = 1;
+        device->keyframeAt = millis();
+    } else if (device->model != snapshot->model || device->count != snapshot->count) {
+        device->model = snapshot->model;
+        device->count = snapshot->count;
+        resetBase(device);
+    }
+    memcpy(device->current, snapshot->regs, snapshot->count * sizeof(uint16_t));
+    device->readAt = snapshot->timestamp;
+    device->pending = true;
+    return true;
+}
+
+/**
+ * @brief Encode a message with every device updated since the previous message
+ *
+ * Devices are taken round robin from the first one left out of the previous
+ * message, so a small buffer still serves every device in turn.
+ */
+uint32_t PZEMDeltaEncoder::encode(uint8_t* out, uint32_t size, uint32_t epoch) {
+    if (out == NULL || size < PZEM_DELTA_MESSAGE_OVERHEAD) {
+        return 0;
+    }
+    uint32_t now = millis();
+    uint32_t length = DELTA_HEADER;
+    uint8_t records = 0;
+    uint8_t first = _nextDevice;
+
+    for (uint8_t n = 0; n < PZEM_DELTA_MAX_DEVICES; n++) {
+        uint8_t i = (first + n) % PZEM_DELTA_MAX_DEVICES;
+        Device* device = &_devices[i];
+        if (device->slaveAddr == 0 || !device->pending) {
+            continue;
+        }
+        if (length + DELTA_RECORD_BOUND(device->count) + 2 > size) {
+            _nextDevice = i;
+            break;
+        }
+        length += encodeRecord(device, out + length, now);
+        records++;
+    }
+    if (records == 0) {
+        return 0;
+    }
+    // Objects built at boot all see the same micros(): the first message comes late enough to differ
+    if (_session == 0) {
+        _session = nextSeq(micros());
+    }
+
+    out[0] = DELTA_MAGIC;
+    out[1] = DELTA_VERSION;
+    put32(out + 2, _session);
+    put32(out + 6, epoch);
+    out[10] = records;
+    length = seal(out, length);
+    _stats.messages++;
+    _stats.bytes += length;
+    return length;
+}
+
+/**
+ * @brief Encode the record of a device
+ *
+ * The record is a delta against the acknowledged base, or a keyframe (a delta
+ * against zero) when there is no base, when one was asked for or when the
+ * keyframe interval elapsed. The image sent is kept until acknowledged.
+ */
+uint32_t PZEMDeltaEncoder::encodeRecord(Device* device, uint8_t* out, uint32_t now) {
+    bool keyframe = device->keyframe || device->baseSeq == 0 ||
+                    (_keyframeInterval != 0 && now - device->keyframeAt >= _keyframeInterval);
+    uint32_t seq = device->nextSeq;
+    device->nextSeq = nextSeq(seq);
+
+    uint32_t length = 0;
+    out[length++] = device->slaveAddr;
+    out[length++] = device->model;
+    out[length++] = device->count;
+    out[length++] = keyframe ? DELTA_FLAG_KEYFRAME : 0;
+    length += putVarint(out + length, seq);
+    if (!keyframe) {
+        length += putVarint(out + length, seq - device->baseSeq);
+    }
+    length += putVarint(out + length, now - device->readAt);
+
+    uint8_t bitmap[PZEM_SNAPSHOT_MAX_REGISTERS / 8];
+    memset(bitmap, 0, sizeof(bitmap));
+    for (uint8_t r = 0; r < device->count; r++) {
+        uint16_t reference = keyframe ? 0 : device->base[r];
+        if (device->current[r] != reference) {
+            bitmap[r / 8] |= 1 << (r % 8);
+        }
+    }
+    uint8_t bitmapBytes = (device->count + 7) / 8;
+    if (bitmapBytes == 1) {
+        out[length++] = bitmap[0];
+    } else {
+        uint8_t* summary = out + length++;
+        *summary = 0;
+        for (uint8_t b = 0; b < bitmapBytes; b++) {
+            if (bitmap[b] != 0) {
+                *summary |= 1 << b;
+                out[length++] = bitmap[b];
+            }
+        }
+    }
+
+    for (uint8_t r = 0; r < device->count; r++) {
+        if (bitmap[r / 8] & (1 << (r % 8))) {
+            uint16_t reference = keyframe ? 0 : device->base[r];
+            length += putVarint(out + length, zigzag(device->current[r] - reference));
+            _stats.registers++;
+        }
+    }
+
+    uint8_t slot = device->sentNext;
+    device->sentNext = (slot + 1) % PZEM_DELTA_INFLIGHT;
+    device->sentSeq[slot] = seq;
+    memcpy(device->sent[slot], device->current, device->count * sizeof(uint16_t));
+
+    if (keyframe) {
+        device->keyframe = false;
+        device->keyframeAt = now;
+        _stats.keyframes++;
+    } else {
+        _stats.deltas++;
+    }
+    _stats.rawBytes += device->count * 2;
+    device->pending = false;
+    return length;
+}
+
+/**
+ * @brief Make a sent image the base of the next deltas of a device
+ *
+ * Images sent before the acknowledged one are dropped with it: the receiver
+ * only keeps a window of recent images, so older bases are not worth keeping.
+ */
+bool PZEMDeltaEncoder::acknowledge(uint8_t slaveAddr, uint32_t seq) {
+    Device* device = slaveAddr != 0 ? find(slaveAddr) : NULL;
+    if (device == NULL || seq == 0 || (device->baseSeq != 0 && (int32_t)(seq - device->baseSeq) <= 0)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < PZEM_DELTA_INFLIGHT; i++) {
+        if (device->sentSeq[i] == seq) {
+            memcpy(device->base, device->sent[i], device->count * sizeof(uint16_t));
+            device->baseSeq = seq;
+            for (uint8_t j = 0; j < PZEM_DELTA_INFLIGHT; j++) {
+                if (device->sentSeq[j] != 0 && (int32_t)(device->sentSeq[j] - seq) <= 0) {
+                    device->sentSeq[j] = 0;
+                }
+            }
+            _stats.acks++;
+            return true;
+        }
+    }
+    _stats.staleAcks++;
+    return false;
+}
+
+/**
+ * @brief Send the next record of a device as a keyframe
+ *
+ * The device is sent with the next message even without a new snapshot.
+ */
+void PZEMDeltaEncoder::requestKeyframe(uint8_t slaveAddr) {
+    for (uint8_t i = 0; i < PZEM_DELTA_MAX_DEVICES; i++) {
+        Device* device = &_devices[i];
+        if (device->slaveAddr != 0 && (slaveAddr == 0 || device->slaveAddr == slaveAddr)) {
+            device->keyframe = true;
+            device->pending = true;
+            resetBase(device);
+        }
+    }
+}
+
+/**
+ * @brief Apply an acknowledgement message
+ *
+ * An acknowledgement of another session names images of a previous run of
+ * the encoder, whose sequence numbers may be reused by this one: it is
+ * checked but not applied.
+ */
+bool PZEMDeltaEncoder::applyAck(const uint8_t* data, uint32_t length) {
+    if (!sealed(data, length, DELTA_ACK_MAGIC, DELTA_ACK_HEADER)) {
+        return false;
+    }
+    length -= 2;
+    bool current = _session != 0 && get32(data + 2) == _session;
+    uint32_t position = DELTA_ACK_HEADER;
+    for (uint8_t n = 0; n < data[6]; n++) {
+        uint32_t seq;
+        if (position + 2 > length) {
+            return false;
+        }
+        uint8_t slaveAddr = data[position];
+        uint8_t flags = data[position + 1];
+        position += 2;
+        if (!getVarint(data, length, &position, &seq)) {
+            return false;
+        }
+        if (!current) {
+            _stats.staleAcks++;
+        } else if (flags & DELTA_FLAG_KEYFRAME) {
+            if (find(slaveAddr) != NULL) {
+                requestKeyframe(slaveAddr);
+                _stats.keyframeRequests++;
+            }
+        } else {
+            acknowledge(slaveAddr, seq);
+        }
+    }
+    return position == length;
+}
+
+/**
+ * @brief Get the counters
+ */
+void PZEMDeltaEncoder::getStats(PZEMDeltaStats* stats) const {
+    if (stats != NULL) {
+        *stats = _stats;
+    }
+}
+
+/**
+ * @brief Constructor for a delta decoder
+ */
+PZEMDeltaDecoder::PZEMDeltaDecoder() : _session(0), _callback(NULL), _context(NULL), _missingBases(0) {
+    clear();
+}
+
+/**
+ * @brief Forget every device
+ */
+void PZEMDeltaDecoder::clear() {
+    memset(_devices, 0, sizeof(_devices));
+    _session = 0;
+}
+
+/**
+ * @brief Set the callback receiving the rebuilt images
+ */
+void PZEMDeltaDecoder::setCallback(PZEMDeltaCallback callback, void* context) {
+    _callback = callback;
+    _context = context;
+}
+
+/**
+ * @brief Find the images of a device
+ */
+uint8_t PZEMDeltaDecoder::indexOf(uint8_t slaveAddr) const {
+    uint8_t i = 0;
+    while (i < PZEM_DELTA_MAX_DEVICES && _devices[i].slaveAddr != slaveAddr) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief Decode a message
+ *
+ * The records are checked in a first pass, so a malformed message changes
+ * nothing, then applied in a second one. The first message of a new session
+ * drops every image: its deltas can only be based on its own keyframes.
+ */
+bool PZEMDeltaDecoder::decode(const uint8_t* data, uint32_t length) {
+    if (!sealed(data, length, DELTA_MAGIC, DELTA_HEADER)) {
+        return false;
+    }
+    uint32_t session = get32(data + 2);
+    uint32_t epoch = get32(data + 6);
+    uint8_t records = data[10];
+    if (session == 0 || !decodeRecords(data + DELTA_HEADER, length - DELTA_HEADER - 2, records, epoch, false)) {
+        return false;
+    }
+    if (session != _session) {
+        memset(_devices, 0, sizeof(_devices));
+        _session = session;
+    }
+    return decodeRecords(data + DELTA_HEADER, length - DELTA_HEADER - 2, records, epoch, true);
+}
+
+/**
+ * @brief Decode the records of a message
+ *
+ * A delta is applied to the image of its base sequence number. When that
+ * image is no longer kept (the receiver restarted, or the encoder missed
+ * acknowledgements for longer than the history), the record is skipped and
+ * the next acknowledgement asks for a keyframe. Deltas not newer than the
+ * latest image (a message sent again) are acknowledged again but not applied.
+ * A keyframe is always applied and drops the older images of its device.
+ */
+bool PZEMDeltaDecoder::decodeRecords(const uint8_t* data, uint32_t length, uint8_t records, uint32_t epoch,
+                                     bool apply) {
+    uint32_t position = 0;
+    for (uint8_t n = 0; n < records; n++) {
+        if (position + 4 > length) {
+            return false;
+        }
+        uint8_t slaveAddr = data[position];
+        uint8_t model = data[position + 1];
+        uint8_t count = data[position + 2];
+        uint8_t flags = data[position + 3];
+        position += 4;
+        bool keyframe = flags & DELTA_FLAG_KEYFRAME;
+        uint32_t seq, distance = 0, age;
+        if (!validLayout(slaveAddr, model, count) || (flags & ~DELTA_FLAG_KEYFRAME) ||
+            !getVarint(data, length, &position, &seq) || seq == 0 ||
+            (!keyframe && (!getVarint(data, length, &position, &distance) || distance == 0)) ||
+            !getVarint(data, length, &position, &age)) {
+            return false;
+        }
+
+        uint8_t bitmap[PZEM_SNAPSHOT_MAX_REGISTERS / 8];
+        memset(bitmap, 0, sizeof(bitmap));
+        uint8_t bitmapBytes = (count + 7) / 8;
+        if (position >= length) {
+            return false;
+        }
+        if (bitmapBytes == 1) {
+            bitmap[0] = data[position++];
+        } else {
+            uint8_t summary = data[position++];
+            if (summary >> bitmapBytes) {
+                return false;
+            }
+            for (uint8_t b = 0; b < bitmapBytes; b++) {
+                if (summary & (1 << b)) {
+                    if (position >= length || data[position] == 0) {
+                        return false;
+                    }
+                    bitmap[b] = data[position++];
+                }
+            }
+        }
+        if (count % 8 != 0 && (bitmap[count / 8] >> (count % 8))) {
+            return false;
+        }
+
+        uint16_t values[PZEM_SNAPSHOT_MAX_REGISTERS];
+        for (uint8_t r = 0; r < count; r++) {
+            uint32_t value = 0;
+            if ((bitmap[r / 8] & (1 << (r % 8))) &&
+                (!getVarint(data, length, &position, &value) || value > 0xFFFF)) {
+                return false;
+            }
+            values[r] = unzigzag(value);
+        }
+        if (!apply) {
+            continue;
+        }
+
+        uint8_t index = indexOf(slaveAddr);
+        if (index == PZEM_DELTA_MAX_DEVICES) {
+            index = indexOf(0);
+            if (index == PZEM_DELTA_MAX_DEVICES) {
+                continue;
+            }
+            memset(&_devices[index], 0, sizeof(Device));
+            _devices[index].slaveAddr = slaveAddr;
+        }
+        Device* device = &_devices[index];
+        device->ackPending = true;
+
+        bool hasLatest = device->seq[device->latest] != 0 && device->model == model && device->count == count;
+        if (!keyframe && hasLatest && (int32_t)(seq - device->seq[device->latest]) <= 0) {
+            continue;
+        }
+
+        const uint16_t* base = NULL;
+        if (!keyframe) {
+            for (uint8_t i = 0; i < PZEM_DELTA_HISTORY && device->model == model && device->count == count; i++) {
+                if (device->seq[i] != 0 && device->seq[i] == seq - distance) {
+                    base = device->image[i];
+                }
+            }
+            if (base == NULL) {
+                device->needKeyframe = true;
+                _missingBases++;
+                continue;
+            }
+        } else if (device->model != model || device->count != count) {
+            device->model = model;
+            device->count = count;
+            hasLatest = false;
+        }
+
+        PZEMDeltaUpdate update;
+        memset(&update, 0, sizeof(update));
+        uint8_t slot = hasLatest ? (device->latest + 1) % PZEM_DELTA_HISTORY : 0;
+        const uint16_t* previous = hasLatest ? device->image[device->latest] : NULL;
+        for (uint8_t r = 0; r < count; r++) {
+            uint16_t value = (base != NULL ? base[r] : 0) + values[r];
+            if (previous == NULL || previous[r] != value) {
+                update.changed[r / 32] |= 1UL << (r % 32);
+                update.changedCount++;
+            }
+            update.snapshot.regs[r] = value;
+        }
+        memcpy(device->image[slot], update.snapshot.regs, count * sizeof(uint16_t));
+        if (keyframe) {
+            memset(device->seq, 0, sizeof(device->seq));
+        }
+        device->seq[slot] = seq;
+        device->latest = slot;
+        device->needKeyframe = false;
+
+        if (_callback != NULL) {
+            update.snapshot.slaveAddr = slaveAddr;
+            update.snapshot.model = model;
+            update.snapshot.count = count;
+            update.seq = seq;
+            update.epoch = epoch;
+            update.age = age;
+            update.keyframe = keyframe;
+            _callback(&update, _context);
+        }
+    }
+    return position == length;
+}
+
+/**
+ * @brief Build the acknowledgement of the records decoded since the previous call
+ *
+ * Each device acknowledges its latest image, or asks for a keyframe when a
+ * delta could not be applied since.
+ */
+uint32_t PZEMDeltaDecoder::buildAck(uint8_t* out, uint32_t size) {
+    if (out == NULL || size < DELTA_ACK_HEADER + 2 || _session == 0) {
+        return 0;
+    }
+    uint32_t length = DELTA_ACK_HEADER;
+    uint8_t entries = 0;
+    for (uint8_t i = 0; i < PZEM_DELTA_MAX_DEVICES; i++) {
+        Device* device = &_devices[i];
+        if (device->slaveAddr == 0 || !device->ackPending) {
+            continue;
+        }
+        if (length + DELTA_ACK_ENTRY_MAX + 2 > size) {
+            break;
+        }
+        out[length++] = device->slaveAddr;
+        out[length++] = device->needKeyframe ? DELTA_FLAG_KEYFRAME : 0;
+        length += putVarint(out + length, device->seq[device->latest]);
+        device->ackPending = false;
+        entries++;
+    }
+    if (entries == 0) {
+        return 0;
+    }
+    out[0] = DELTA_ACK_MAGIC;
+    out[1] = DELTA_VERSION;
+    put32(out + 2, _session);
+    out[6] = entries;
+    return seal(out, length);
+}
+
+/**
+ * @brief Get the latest image of a device
+ */
+bool PZEMDeltaDecoder::getImage(uint8_t slaveAddr, PZEMSnapshot* snapshot, uint32_t* seq) const {
+    uint8_t index = slaveAddr != 0 ? indexOf(slaveAddr) : PZEM_DELTA_MAX_DEVICES;
+    if (index == PZEM_DELTA_MAX_DEVICES || snapshot == NULL || _devices[index].seq[_devices[index].latest] == 0) {
+        return false;
+    }
+    const Device* device = &_devices[index];
+    memset(snapshot, 0, sizeof(PZEMSnapshot));
+    snapshot->slaveAddr = device->slaveAddr;
+    snapshot->model = device->model;
+    snapshot->count = device->count;
+    memcpy(snapshot->regs, device->image[device->latest], device->count * sizeof(uint16_t));
+    if (seq != NULL) {
+        *seq = device->seq[device->latest];
+    }
+    return true;
+}
+
+/**
+ * @brief Get the number of delta records skipped for a missing base
+ */
+uint32_t PZEMDeltaDecoder::getMissingBases() const {
+    return _missingBases;
+}
@@ -0,0 +1,344 @@
+/**
+ * @file PZEMDeltaSync.h
+ * @brief Register-diff sync protocol between a gateway and a remote image
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The encoder runs on the gateway and turns snapshots into messages that
+ * only carry the registers that changed since the image the receiver last
+ * acknowledged. The decoder runs on the receiving side (a server, or any
+ * host) and rebuilds the full register image of every device from them.
+ *
+ * Every device record has a sequence number. A delta names the sequence
+ * number of its base, the last image acknowledged by the receiver, so a lost
+ * message or a lost acknowledgement costs nothing but a larger next delta.
+ * Keyframes carry the whole image; they go out for a new device, after a
+ * model change, when the receiver asks for one (it lost its state, or no
+ * longer has the base) and periodically (setKeyframeInterval()). A keyframe
+ * is always applied and starts the history of its device again.
+ *
+ * Sequence numbers start from 1 again when the encoder restarts, so every
+ * message carries the session identifier of the encoder: a decoder that sees
+ * a new session forgets the images of the previous one, and an encoder
+ * ignores acknowledgements of another session.
+ *
+ * Changed registers are flagged in a bitmap and their values sent as the
+ * varint of the zigzagged difference to the base, so a voltage moving by a
+ * few tenths or an energy counter moving by a few Wh costs one byte.
+ */
+
+#ifndef PZEMDELTASYNC_H
+#define PZEMDELTASYNC_H
+
+#include <Arduino.h>
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMDeltaSyncConfig Delta Sync Configuration
+ * @brief Compile-time sizing of the delta sync (override before including)
+ * @{
+ */
+#ifndef PZEM_DELTA_MAX_DEVICES
+#define PZEM_DELTA_MAX_DEVICES      8      ///< Devices tracked by an encoder or a decoder
+#endif
+#ifndef PZEM_DELTA_INFLIGHT
+#define PZEM_DELTA_INFLIGHT         4      ///< Unacknowledged images kept per device by the encoder
+#endif
+#ifndef PZEM_DELTA_HISTORY
+#define PZEM_DELTA_HISTORY          8      ///< Images kept per device by the decoder as delta bases
+#endif
+#define PZEM_DELTA_KEYFRAME_MS      60000  ///< Default keyframe interval of a device (ms)
+#define PZEM_DELTA_MESSAGE_OVERHEAD 13     ///< Message header and checksum bytes
+#define PZEM_DELTA_RECORD_MAX       (28 + 3 * PZEM_SNAPSHOT_MAX_REGISTERS)  ///< Largest device record
+/** @} */
+
+/**
+ * @struct PZEMDeltaStats
+ * @brief Counters of an encoder
+ */
+struct PZEMDeltaStats {
+    uint32_t messages;        ///< Messages encoded
+    uint32_t keyframes;       ///< Keyframe records sent
+    uint32_t deltas;          ///< Delta records sent
+    uint32_t registers;       ///< Register values sent
+    uint32_t bytes;           ///< Message bytes
+    uint32_t rawBytes;        ///< Bytes of the same snapshots sent whole (2 per register)
+    uint32_t acks;            ///< Acknowledgements that moved a base
+    uint32_t staleAcks;       ///< Acknowledgements of images no longer kept, or of another session
+    uint32_t keyframeRequests;  ///< Keyframes asked for by the receiver
+};
+
+/**
+ * @struct PZEMDeltaUpdate
+ * @brief Image of one device rebuilt by the decoder
+ */
+struct PZEMDeltaUpdate {
+    PZEMSnapshot snapshot;    ///< Full register image (timestamp is 0: see epoch and age)
+    uint32_t seq;             ///< Sequence number of the record
+    uint32_t epoch;           ///< Unix time of the message, 0 if unknown
+    uint32_t age;             ///< Age of the reading when the message was encoded (ms)
+    bool keyframe;            ///< Record carried the whole image
+    uint8_t changedCount;     ///< Registers that differ from the previous image of the device
+    uint32_t changed[PZEM_SNAPSHOT_MAX_REGISTERS / 32];  ///< Bit i set: register i differs from the previous image
+};
+
+/**
+ * @brief Callback receiving every image rebuilt by the decoder
+ * @param update Rebuilt image (valid during the call only)
+ * @param context User context given to setCallback()
+ */
+typedef void (*PZEMDeltaCallback)(const PZEMDeltaUpdate* update, void* context);
+
+/**
+ * @class PZEMDeltaEncoder
+ * @brief Gateway side: encodes the snapshots of every device as register diffs
+ *
+ * Feed every snapshot to update(), call encode() at the upload period and
+ * pass the answers of the receiver to applyAck(). A device is sent once per
+ * snapshot received since the previous message.
+ */
+class PZEMDeltaEncoder {
+public:
+    /**
+     * @brief Constructor for a delta encoder
+     */
+    PZEMDeltaEncoder();
+
+    /**
+     * @brief Forget every device and start a new session (the next records are keyframes)
+     */
+    void clear();
+
+    /**
+     * @brief Set the session identifier
+     * @param session Identifier, different on every boot (a boot counter kept in NVS, or a hardware
+     *        random number); 0 to take micros() at the next message, the default
+     * @note The identifier must change whenever the sequence numbers start again.
+     */
+    void setSession(uint32_t session);
+
+    /**
+     * @brief Get the session identifier
+     * @return Identifier of the current session, 0 before the first message unless set
+     */
+    uint32_t getSession() const;
+
+    /**
+     * @brief Set the keyframe interval
+     * @param intervalMs Time between two keyframes of a device, 0 for keyframes on request only
+     */
+    void setKeyframeInterval(uint32_t intervalMs);
+
+    /**
+     * @brief Record the latest snapshot of a device
+     * @param snapshot Snapshot of any model
+     * @return true if recorded, false if the snapshot is invalid or no device slot is free
+     */
+    bool update(const PZEMSnapshot* snapshot);
+
+    /**
+     * @brief Encode a message with every device updated since the previous message
+     * @param out Message buffer (at least PZEM_DELTA_MESSAGE_OVERHEAD + PZEM_DELTA_RECORD_MAX bytes
+     *        to be sure one record fits)
+     * @param size Buffer size in bytes
+     * @param epoch Unix time of the message, 0 if unknown
+     * @return Message length in bytes, 0 if no device was updated
+     * @note Devices that do not fit stay pending for the next message.
+     */
+    uint32_t encode(uint8_t* out, uint32_t size, uint32_t epoch = 0);
+
+    /**
+     * @brief Apply an acknowledgement message built by PZEMDeltaDecoder::buildAck()
+     * @param data Acknowledgement message
+     * @param length Message length in bytes
+     * @return true if the message is valid, false otherwise
+     */
+    bool applyAck(const uint8_t* data, uint32_t length);
+
+    /**
+     * @brief Make a sent image the base of the next deltas of a device
+     * @param slaveAddr Slave device address
+     * @param seq Sequence number acknowledged by the receiver
+     * @return true if the base moved, false if the image is unknown, already acknowledged or no longer kept
+     */
+    bool acknowledge(uint8_t slaveAddr, uint32_t seq);
+
+    /**
+     * @brief Send the next record of a device as a keyframe, and every record until one is acknowledged
+     * @param slaveAddr Slave device address, 0 for every device
+     */
+    void requestKeyframe(uint8_t slaveAddr);
+
+    /**
+     * @brief Get the counters
+     * @param stats Receives the counters
+     */
+    void getStats(PZEMDeltaStats* stats) const;
+
+private:
+    /**
+     * @brief Sync state of one device
+     */
+    struct Device {
+        uint8_t slaveAddr;                      ///< Slave address (0 = free slot)
+        uint8_t model;                          ///< Model identifier
+        uint8_t count;                          ///< Registers in the image
+        bool pending;                           ///< Snapshot received since the previous message
+        bool keyframe;                          ///< Next record is a keyframe
+        uint32_t readAt;                        ///< Time of the latest snapshot (millis)
+        uint32_t keyframeAt;                    ///< Time of the latest keyframe (millis)
+        uint32_t nextSeq;                       ///< Sequence number of the next record
+        uint32_t baseSeq;                       ///< Sequence number of the base image (0: none)
+        uint16_t current[PZEM_SNAPSHOT_MAX_REGISTERS];  ///< Latest snapshot
+        uint16_t base[PZEM_SNAPSHOT_MAX_REGISTERS];     ///< Image acknowledged by the receiver
+        uint32_t sentSeq[PZEM_DELTA_INFLIGHT];  ///< Sequence number of each unacknowledged image (0: free)
+        uint16_t sent[PZEM_DELTA_INFLIGHT][PZEM_SNAPSHOT_MAX_REGISTERS];  ///< Unacknowledged images
+        uint8_t sentNext;                       ///< Slot of the next image sent (round robin)
+    };
+
+    Device _devices[PZEM_DELTA_MAX_DEVICES];    ///< Device states
+    uint8_t _nextDevice;                        ///< First device of the next message (round robin)
+    uint32_t _session;                          ///< Session identifier (0: taken at the next message)
+    uint32_t _keyframeInterval;                 ///< Keyframe interval (ms, 0: on request only)
+    PZEMDeltaStats _stats;                      ///< Counters
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Find the state of a device
+     * @param slaveAddr Slave device address
+     * @return Pointer to the state, or NULL if unknown
+     */
+    Device* find(uint8_t slaveAddr);
+
+    /**
+     * @brief Forget the base and the unacknowledged images of a device
+     * @param device Device state
+     */
+    static void resetBase(Device* device);
+
+    /**
+     * @brief Encode the record of a device
+     * @param device Device state
+     * @param out Record buffer (at least PZEM_DELTA_RECORD_MAX bytes)
+     * @param now Current time (millis)
+     * @return Record length in bytes
+     */
+    uint32_t encodeRecord(Device* device, uint8_t* out, uint32_t now);
+
+    /** @} */
+};
+
+/**
+ * @class PZEMDeltaDecoder
+ * @brief Receiving side: rebuilds the register images from encoder messages
+ *
+ * Pass every message to decode(); each record rebuilds the image of its
+ * device and is handed to the callback. Send the message of buildAck() back
+ * to the encoder after each decode(). A decoder follows one encoder: messages
+ * of a new session replace every image.
+ */
+class PZEMDeltaDecoder {
+public:
+    /**
+     * @brief Constructor for a delta decoder
+     */
+    PZEMDeltaDecoder();
+
+    /**
+     * @brief Forget every device (the encoder is asked for keyframes)
+     */
+    void clear();
+
+    /**
+     * @brief Set the callback receiving the rebuilt images
+     * @param callback Callback function (NULL to disable)
+     * @param context User context passed to the callback
+     */
+    void setCallback(PZEMDeltaCallback callback, void* context);
+
+    /**
+     * @brief Decode a message
+     * @param data Message from PZEMDeltaEncoder::encode()
+     * @param length Message length in bytes
+     * @return true if the message is valid, false if it is malformed (nothing is applied)
+     * @note A delta whose base is no longer kept is skipped and a keyframe is asked for. A delta not
+     *       newer than the latest image (a message sent again) is skipped; a keyframe never is.
+     */
+    bool decode(const uint8_t* data, uint32_t length);
+
+    /**
+     * @brief Build the acknowledgement of the records decoded since the previous call
+     * @param out Message buffer
+     * @param size Buffer size in bytes
+     * @return Message length in bytes, 0 if there is nothing to acknowledge or the buffer is too small
+     */
+    uint32_t buildAck(uint8_t* out, uint32_t size);
+
+    /**
+     * @brief Get the latest image of a device
+     * @param slaveAddr Slave device address
+     * @param snapshot Receives the image
+     * @param seq Receives its sequence number (may be NULL)
+     * @return true if the device has an image, false otherwise
+     */
+    bool getImage(uint8_t slaveAddr, PZEMSnapshot* snapshot, uint32_t* seq) const;
+
+    /**
+     * @brief Get the number of delta records skipped for a missing base
+     * @return Records skipped since construction
+     */
+    uint32_t getMissingBases() const;
+
+private:
+    /**
+     * @brief Rebuilt images of one device
+     */
+    struct Device {
+        uint8_t slaveAddr;                      ///< Slave address (0 = free slot)
+        uint8_t model;                          ///< Model identifier
+        uint8_t count;                          ///< Registers in the image
+        bool ackPending;                        ///< Records decoded since the previous acknowledgement
+        bool needKeyframe;                      ///< A delta could not be applied
+        uint8_t latest;                         ///< Slot of the latest image
+        uint32_t seq[PZEM_DELTA_HISTORY];       ///< Sequence number of each image (0: free)
+        uint16_t image[PZEM_DELTA_HISTORY][PZEM_SNAPSHOT_MAX_REGISTERS];  ///< Latest images
+    };
+
+    Device _devices[PZEM_DELTA_MAX_DEVICES];    ///< Device images
+    uint32_t _session;                          ///< Session of the images (0: none yet)
+    PZEMDeltaCallback _callback;                ///< Image callback
+    void* _context;                             ///< Callback context
+    uint32_t _missingBases;                     ///< Deltas skipped for a missing base
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Find the images of a device
+     * @param slaveAddr Slave device address (0 for a free slot)
+     * @return Index of the device, PZEM_DELTA_MAX_DEVICES if unknown
+     */
+    uint8_t indexOf(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Decode the records of a message
+     * @param data Records
+     * @param length Length of the records in bytes
+     * @param records Record count
+     * @param epoch Unix time of the message
+     * @param apply false to only check the layout, true to apply the records
+     * @return true if every record is well formed, false otherwise
+     */
+    bool decodeRecords(const uint8_t* data, uint32_t length, uint8_t records, uint32_t epoch, bool apply);
+
+    /** @} */
+};
+
+#endif // PZEMDELTASYNC_H
@@ -0,0 +1,275 @@
+/**
+ * @file PZEMDemand.cpp
+ * @brief Implementation of the rolling demand meter
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMDemand.h"
+
+/**
+ * @brief Constructor, 15-minute window in 1-minute sub-intervals
+ */
+PZEMDemandMeter::PZEMDemandMeter()
+    : _maxHold(PZEM_DEMAND_DEFAULT_MAX_HOLD_MS), _clockSet(false), _epochBase(0), _millisBase(0), _group(NULL) {
+    setWindow(PZEM_DEMAND_DEFAULT_WINDOW_S, PZEM_DEMAND_DEFAULT_SUBINTERVALS);
+}
+
+/**
+ * @brief Set the demand window
+ */
+bool PZEMDemandMeter::setWindow(uint32_t windowS, uint8_t subIntervals) {
+    if (subIntervals == 0 || subIntervals > PZEM_DEMAND_MAX_SUBINTERVALS || windowS == 0 || windowS % subIntervals != 0) {
+        return false;
+    }
+    _subCount = subIntervals;
+    _subMs = (windowS / subIntervals) * 1000;
+    reset();
+    return true;
+}
+
+/**
+ * @brief Set the wall clock used to align the sub-intervals
+ */
+void PZEMDemandMeter::setClock(uint32_t epochSeconds, uint16_t milliseconds) {
+    _epochBase = epochSeconds;
+    _millisBase = millis() - milliseconds;
+    _clockSet = true;
+
+    // Realign on the next sample; a window straddling the change would be meaningless
+    _started = false;
+    _filled = 0;
+    _current = 0;
+    _demand = NAN;
+}
+
+/**
+ * @brief Set the longest gap between two power samples that is still integrated
+ */
+void PZEMDemandMeter::setMaxHold(uint32_t maxHoldMs) {
+    _maxHold = maxHoldMs;
+}
+
+/**
+ * @brief Forward everything integrated by this meter to a group meter
+ */
+void PZEMDemandMeter::setGroup(PZEMDemandMeter* group) {
+    _group = (group == this) ? NULL : group;
+}
+
+/**
+ * @brief Add an active power sample
+ */
+void PZEMDemandMeter::addPower(float watts, uint32_t timestamp) {
+    int32_t elapsed = (int32_t)(timestamp - _lastTime);
+    if (_haveSample && elapsed <= 0) {
+        return; // Out of order
+    }
+
+    if (_haveSample && (uint32_t)elapsed <= _maxHold) {
+        integrate((watts + _lastValue) / 2, _lastTime, timestamp);
+    } else {
+        advance(timestamp);
+    }
+    _lastValue = watts;
+    _lastTime = timestamp;
+    _haveSample = true;
+}
+
+/**
+ * @brief Add an energy counter reading
+ *
+ * The counter is exact, so the energy between two readings is always credited,
+ * at the average power over the gap.
+ */
+void PZEMDemandMeter::addEnergy(float wattHours, uint32_t timestamp) {
+    int32_t elapsed = (int32_t)(timestamp - _lastTime);
+    if (_haveSample && elapsed <= 0) {
+        return; // Out of order
+    }
+
+    if (_haveSample && wattHours >= _lastValue) {
+        integrate((wattHours - _lastValue) * 3600000.0f / elapsed, _lastTime, timestamp);
+    } else {
+        advance(timestamp);
+    }
+    _lastValue = wattHours;
+    _lastTime = timestamp;
+    _haveSample = true;
+}
+
+/**
+ * @brief Add the active power of a snapshot
+ */
+bool PZEMDemandMeter::addSnapshot(const PZEMSnapshot* snapshot) {
+    const PZEMModelInfo* info = pzemModelInfo(snapshot->model);
+    if (info == NULL || snapshot->count < info->powerRegister + 2) {
+        return false;
+    }
+
+    uint16_t reg = info->powerRegister;
+    int32_t raw = (int32_t)(((uint32_t)snapshot->regs[reg + 1] << 16) | snapshot->regs[reg]);
+    addPower(raw * 0.1f, snapshot->timestamp);
+    return true;
+}
+
+/**
+ * @brief Get the demand of the last complete window
+ */
+float PZEMDemandMeter::getDemand() const {
+    return _demand;
+}
+
+/**
+ * @brief Get the peak demand of the current billing period
+ */
+bool PZEMDemandMeter::getPeak(PZEMDemandPeak* peak) const {
+    *peak = _peak;
+    return _peak.valid;
+}
+
+/**
+ * @brief Start a new billing period
+ */
+bool PZEMDemandMeter::closePeriod(PZEMDemandPeak* peak) {
+    bool valid = _peak.valid;
+    if (peak != NULL) {
+        *peak = _peak;
+    }
+    _peak.valid = false;
+    _peak.demand = 0;
+    _peak.timestamp = 0;
+    _peak.epoch = 0;
+    return valid;
+}
+
+/**
+ * @brief Clear the window, the peak and the sample history
+ */
+void PZEMDemandMeter::reset() {
+    for (uint8_t i = 0; i < PZEM_DEMAND_MAX_SUBINTERVALS; i++) {
+        _ring[i] = 0;
+    }
+    _head = 0;
+    _filled = 0;
+    _started = false;
+    _subStart = 0;
+    _current = 0;
+    _demand = NAN;
+    _haveSample = false;
+    _lastValue = 0;
+    _lastTime = 0;
+    closePeriod(NULL);
+}
+
+/**
+ * @brief Credit constant power over a time span, splitting it at sub-interval ends
+ *
+ * A group meter gets the spans of its members out of order: a member may
+ * report a span that started before another member moved the group into the
+ * next sub-interval. The part of a span before the sub-interval in progress
+ * goes to the closed sub-interval it falls in, and the demand is summed again.
+ * Parts older than the ring are dropped.
+ */
+void PZEMDemandMeter::integrate(float watts, uint32_t from, uint32_t to) {
+    if (_group != NULL) {
+        _group->integrate(watts, from, to);
+    }
+
+    advance(from);
+    bool late = false;
+    while ((int32_t)(_subStart - from) > 0 && (int32_t)(to - from) > 0) {
+        uint32_t back = (_subStart - from + _subMs - 1) / _subMs;
+        uint32_t end = _subStart - (back - 1) * _subMs;
+        uint32_t until = ((int32_t)(to - end) < 0) ? to : end;
+        if (back <= _filled) {
+            _ring[(_head + _subCount - back) % _subCount] += watts * (int32_t)(until - from) / 1000.0f;
+            late = true;
+        }
+        from = until;
+    }
+    if (late) {
+        updateDemand();
+    }
+
+    while ((int32_t)(to - from) > 0) {
+        uint32_t end = _subStart + _subMs;
+        uint32_t until = ((int32_t)(to - end) < 0) ? to : end;
+        _current += watts * (int32_t)(until - from) / 1000.0f;
+        from = until;
+        if (until == end) {
+            closeSubInterval();
+        }
+    }
+}
+
+/**
+ * @brief Close every sub-interval ending at or before a time
+ */
+void PZEMDemandMeter::advance(uint32_t timestamp) {
+    if (!_started) {
+        // Start in the sub-interval holding the timestamp, on a wall clock multiple if known
+        uint32_t phase = 0;
+        if (_clockSet) {
+            int64_t sinceEpoch = (int64_t)(_epochBase % (_subMs / 1000)) * 1000 + (int32_t)(timestamp - _millisBase);
+            phase = (uint32_t)(((sinceEpoch % _subMs) + _subMs) % _subMs);
+        }
+        _subStart = timestamp - phase;
+        _started = true;
+        return;
+    }
+
+    int32_t behind = (int32_t)(timestamp - _subStart);
+    if (behind >= (int32_t)(_subMs * (_subCount + 1))) {
+        // Nothing was integrated for a whole window: start over, keeping the alignment
+        _subStart += (behind / _subMs) * _subMs;
+        _head = 0;
+        _filled = 0;
+        _current = 0;
+        _demand = NAN;
+        return;
+    }
+
+    while ((int32_t)(timestamp - (_subStart + _subMs)) >= 0) {
+        closeSubInterval();
+    }
+}
+
+/**
+ * @brief Store the sub-interval in progress and update demand and peak
+ *
+ * The window energy is summed again at every sub-interval instead of kept as a
+ * running total, so float rounding cannot accumulate over a billing period.
+ */
+void PZEMDemandMeter::closeSubInterval() {
+    _ring[_head] = _current;
+    _current = 0;
+    _head = (_head + 1) % _subCount;
+    _subStart += _subMs;
+    if (_filled < _subCount) {
+        _filled++;
+    }
+    updateDemand();
+}
+
+/**
+ * @brief Sum the last window into the demand and update the peak
+ */
+void PZEMDemandMeter::updateDemand() {
+    if (_filled < _subCount) {
+        return;
+    }
+
+    float energy = 0;
+    for (uint8_t i = 0; i < _subCount; i++) {
+        energy += _ring[i];
+    }
+    _demand = energy * 1000.0f / ((float)_subMs * _subCount);
+
+    if (!_peak.valid || _demand > _peak.demand) {
+        _peak.valid = true;
+        _peak.demand = _demand;
+        _peak.timestamp = _subStart;
+        _peak.epoch = _clockSet ? _epochBase + ((int32_t)(_subStart - _millisBase) + 500) / 1000 : 0;
+    }
+}
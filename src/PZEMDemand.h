@@ -0,0 +1,194 @@
+/**
+ * @file PZEMDemand.h
+ * @brief Rolling demand and peak demand tracking
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMDEMAND_H
+#define PZEMDEMAND_H
+
+#include <Arduino.h>
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMDemandConfig Demand Meter Configuration
+ * @brief Compile-time sizing and defaults of the demand meter (override before including)
+ * @{
+ */
+#ifndef PZEM_DEMAND_MAX_SUBINTERVALS
+#define PZEM_DEMAND_MAX_SUBINTERVALS     15     ///< Largest number of sub-intervals per window
+#endif
+#define PZEM_DEMAND_DEFAULT_WINDOW_S     900    ///< Default demand window (15 minutes)
+#define PZEM_DEMAND_DEFAULT_SUBINTERVALS 15     ///< Default sub-intervals per window (1 minute each)
+#define PZEM_DEMAND_DEFAULT_MAX_HOLD_MS  30000  ///< Default longest gap between power samples that is integrated
+/** @} */
+
+/**
+ * @struct PZEMDemandPeak
+ * @brief Highest demand of a billing period
+ */
+struct PZEMDemandPeak {
+    bool valid;               ///< A complete window has been seen in the period
+    float demand;             ///< Peak demand in W (average active power over the window)
+    uint32_t timestamp;       ///< End of the peak window (millis)
+    uint32_t epoch;           ///< End of the peak window (Unix time, seconds), 0 if the clock is not set
+};
+
+/**
+ * @class PZEMDemandMeter
+ * @brief Rolling demand of one device or group, with the peak of the billing period
+ *
+ * Energy is accumulated in sub-intervals kept in a ring. When a sub-interval
+ * ends, the demand is the energy of the last window divided by its length:
+ * with one sub-interval per window this is block-interval demand, with several
+ * it is sliding-window demand updated every sub-interval. Each sample costs a
+ * few additions; memory is fixed by PZEM_DEMAND_MAX_SUBINTERVALS.
+ *
+ * Samples are either active power (snapshots, or addPower()), integrated with
+ * the trapezoidal rule, or an energy counter (addEnergy()), spread evenly
+ * between readings. Feed one kind per meter. Sub-intervals are aligned on the
+ * wall clock once setClock() is called, so windows end at :00/:15/:30/:45 like
+ * the utility meter. The peak is kept until closePeriod() starts a new billing
+ * period.
+ *
+ * A meter can forward everything it integrates to a group meter (setGroup()),
+ * whose demand is then the sum over its members.
+ */
+class PZEMDemandMeter {
+public:
+    /**
+     * @brief Constructor, 15-minute window in 1-minute sub-intervals
+     */
+    PZEMDemandMeter();
+
+    /**
+     * @brief Set the demand window
+     * @param windowS Window length in seconds (default: 900)
+     * @param subIntervals Sub-intervals per window, 1 for block demand (default: 15)
+     * @return true if set, false if subIntervals is out of range or does not divide the window in whole seconds
+     * @note Clears the window and the peak.
+     */
+    bool setWindow(uint32_t windowS, uint8_t subIntervals);
+
+    /**
+     * @brief Set the wall clock used to align the sub-intervals
+     * @param epochSeconds Current Unix time in seconds
+     * @param milliseconds Fraction of the current second in milliseconds (default: 0)
+     * @note Takes effect at the start of the next window; the window in progress is cleared.
+     */
+    void setClock(uint32_t epochSeconds, uint16_t milliseconds = 0);
+
+    /**
+     * @brief Set the longest gap between two power samples that is still integrated
+     * @param maxHoldMs Gap in milliseconds (default: 30000); longer gaps count as no energy
+     */
+    void setMaxHold(uint32_t maxHoldMs);
+
+    /**
+     * @brief Forward everything integrated by this meter to a group meter
+     * @param group Group meter, or NULL to stop forwarding
+     */
+    void setGroup(PZEMDemandMeter* group);
+
+    /**
+     * @brief Add an active power sample
+     * @param watts Active power in W
+     * @param timestamp Time of the sample (millis)
+     */
+    void addPower(float watts, uint32_t timestamp);
+
+    /**
+     * @brief Add an energy counter reading
+     * @param wattHours Active energy counter in Wh
+     * @param timestamp Time of the reading (millis)
+     * @note A counter going backwards (reset) restarts the integration.
+     */
+    void addEnergy(float wattHours, uint32_t timestamp);
+
+    /**
+     * @brief Add the active power of a snapshot
+     * @param snapshot Snapshot from PZEMBus (any model)
+     * @return true if the snapshot holds the active power, false otherwise
+     */
+    bool addSnapshot(const PZEMSnapshot* snapshot);
+
+    /**
+     * @brief Get the demand of the last complete window
+     * @return Demand in W, or NAN until a full window has been seen
+     */
+    float getDemand() const;
+
+    /**
+     * @brief Get the peak demand of the current billing period
+     * @param peak Receives the peak
+     * @return true if a peak is known, false otherwise
+     */
+    bool getPeak(PZEMDemandPeak* peak) const;
+
+    /**
+     * @brief Start a new billing period
+     * @param peak Receives the peak of the period that ended (may be NULL)
+     * @return true if the ended period had a peak, false otherwise
+     * @note The rolling window is kept, only the peak is cleared.
+     */
+    bool closePeriod(PZEMDemandPeak* peak);
+
+    /**
+     * @brief Clear the window, the peak and the sample history
+     */
+    void reset();
+
+private:
+    float _ring[PZEM_DEMAND_MAX_SUBINTERVALS];  ///< Energy of the last sub-intervals (J)
+    uint8_t _subCount;                          ///< Sub-intervals per window
+    uint8_t _head;                              ///< Ring slot of the sub-interval in progress
+    uint8_t _filled;                            ///< Complete sub-intervals in the ring (up to _subCount)
+    uint32_t _subMs;                            ///< Sub-interval length in milliseconds
+    bool _started;                              ///< _subStart is valid
+    uint32_t _subStart;                         ///< Start of the sub-interval in progress (millis)
+    float _current;                             ///< Energy of the sub-interval in progress (J)
+    float _demand;                              ///< Demand of the last complete window (W)
+    PZEMDemandPeak _peak;                       ///< Peak of the billing period
+    bool _haveSample;                           ///< _lastValue and _lastTime are valid
+    float _lastValue;                           ///< Last power (W) or energy counter (Wh)
+    uint32_t _lastTime;                         ///< Time of the last sample (millis)
+    uint32_t _maxHold;                          ///< Longest integrated power gap (ms)
+    bool _clockSet;                             ///< Wall clock known
+    uint32_t _epochBase;                        ///< Unix time at _millisBase (seconds)
+    uint32_t _millisBase;                       ///< millis() at the start of second _epochBase
+    PZEMDemandMeter* _group;                    ///< Group meter (NULL if none)
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Credit constant power over a time span, splitting it at sub-interval ends
+     * @param watts Average power over the span in W
+     * @param from Start of the span (millis)
+     * @param to End of the span (millis)
+     */
+    void integrate(float watts, uint32_t from, uint32_t to);
+
+    /**
+     * @brief Close every sub-interval ending at or before a time
+     * @param timestamp Current time (millis)
+     */
+    void advance(uint32_t timestamp);
+
+    /**
+     * @brief Store the sub-interval in progress and update demand and peak
+     */
+    void closeSubInterval();
+
+    /**
+     * @brief Sum the last window into the demand and update the peak
+     */
+    void updateDemand();
+
+    /** @} */
+};
+
+#endif // PZEMDEMAND_H
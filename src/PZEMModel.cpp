@@ -0,0 +1,41 @@
+/**
+ * @file PZEMModel.cpp
+ * @brief Register layout descriptors of the supported PZEM models
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMModel.h"
+#include <stddef.h>
+
+/**
+ * @brief Register layouts, indexed by model identifier
+ *
+ * Snapshot spans cover every measurement input register: 0x0000-0x0009 on the
+ * PZEM-004T, 0x0000-0x0007 on the PZEM-003/017 and 0x0000-0x003F on the PZEM-6L24.
+ * The liveness probe is the shortest valid exchange: one input register (voltage),
+ * an 8-byte request and a 7-byte response. Unlike getAddress() it does not touch
+ * the holding registers (on the PZEM-6L24 those also carry the address mode).
+ * Burst spans are the shortest prefix holding voltage and current: 0x0000-0x0002
+ * on the PZEM-004T (32-bit current), 0x0000-0x0001 on the PZEM-003/017 and
+ * 0x0000-0x0005 on the PZEM-6L24 (three phases). The energy register is the
+ * total (on the PZEM-6L24 combined) active energy counter, and the power register
+ * the matching active power, 0.1 W per LSB on every model. The energy counter
+ * counts Wh, except on the PZEM-6L24 (0.1 kWh).
+ */
+static const PZEMModelInfo PZEM_MODELS[PZEM_MODEL_COUNT] = {
+    { "PZEM-004T", 10, 3, true,  0x04, 0x0000, 3, 0x0005, 0x0003, 1   },
+    { "PZEM-003",  8,  3, true,  0x04, 0x0000, 2, 0x0004, 0x0002, 1   },
+    { "PZEM-017",  8,  4, true,  0x04, 0x0000, 2, 0x0004, 0x0002, 1   },
+    { "PZEM-6L24", 64, 3, false, 0x04, 0x0000, 6, 0x003A, 0x0020, 100 },
+};
+
+/**
+ * @brief Get the register layout of a model
+ */
+const PZEMModelInfo* pzemModelInfo(uint8_t model) {
+    if (model >= PZEM_MODEL_COUNT) {
+        return NULL;
+    }
+    return &PZEM_MODELS[model];
+}
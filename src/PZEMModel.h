@@ -0,0 +1,77 @@
+/**
+ * @file PZEMModel.h
+ * @brief Register layout descriptors of the supported PZEM models
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The device classes each define their own register macros, which clash when
+ * several model headers are included together. Components that handle devices
+ * of any model (caches, schedulers, tools) use these descriptors instead.
+ * This header has no Arduino dependency.
+ */
+
+#ifndef PZEMMODEL_H
+#define PZEMMODEL_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup PZEMModels PZEM Model Identifiers
+ * @{
+ */
+#define PZEM_MODEL_004T   0  ///< PZEM-004T (also PZEM-014 and PZEM-016)
+#define PZEM_MODEL_003    1  ///< PZEM-003
+#define PZEM_MODEL_017    2  ///< PZEM-017
+#define PZEM_MODEL_6L24   3  ///< PZEM-6L24
+#define PZEM_MODEL_COUNT  4  ///< Number of model identifiers
+#define PZEM_MODEL_UNKNOWN 0xFF  ///< Unknown or not yet identified model
+/** @} */
+
+/**
+ * @struct PZEMModelInfo
+ * @brief Register layout of one PZEM model
+ */
+struct PZEMModelInfo {
+    const char* name;           ///< Model name (e.g. "PZEM-004T")
+    uint8_t snapshotRegs;       ///< Input registers 0x0000.. read for a full snapshot
+    uint8_t holdingRegs;        ///< Holding registers 0x0000.. holding the settings
+    bool bigEndian;             ///< Register byte order (PZEM-6L24 is little endian)
+    uint8_t probeFunction;      ///< Function code of the liveness probe
+    uint16_t probeRegister;     ///< Register read by the liveness probe (one register)
+    uint8_t burstRegs;          ///< Input registers 0x0000.. holding voltage and current (burst reads)
+    uint16_t energyRegister;    ///< Total active energy (two registers, low word first)
+    uint16_t powerRegister;     ///< Total active power (two registers, low word first, signed, 0.1 W)
+    uint8_t energyUnitWh;       ///< Wh per count of the energy register
+};
+
+/**
+ * @defgroup PZEMSnapshotConfig PZEM Snapshot Configuration
+ * @{
+ */
+#define PZEM_SNAPSHOT_MAX_REGISTERS 64  ///< Largest snapshot span (PZEM-6L24)
+/** @} */
+
+/**
+ * @struct PZEMSnapshot
+ * @brief All measurement input registers of one device, read in a single transaction
+ *
+ * Register values are in host order (the model byte order is already applied),
+ * i.e. the values the device classes decode.
+ */
+struct PZEMSnapshot {
+    uint8_t slaveAddr;          ///< Slave device address
+    uint8_t model;              ///< Model identifier (PZEM_MODEL_*)
+    uint8_t count;              ///< Valid registers in regs
+    uint32_t timestamp;         ///< Time the response was received (millis)
+    uint16_t regs[PZEM_SNAPSHOT_MAX_REGISTERS];  ///< Input registers from 0x0000
+};
+
+/**
+ * @brief Get the register layout of a model
+ * @param model Model identifier (PZEM_MODEL_*)
+ * @return Pointer to the descriptor, or NULL for an unknown model
+ */
+const PZEMModelInfo* pzemModelInfo(uint8_t model);
+
+#endif // PZEMMODEL_H
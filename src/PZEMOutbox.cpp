@@ -0,0 +1,1190 @@
+/**
+ * @file PZEMOutbox.cpp
+ * @brief Implementation of the store-and-forward outbox
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Log layout. Each sector in use starts with a 16-byte header: magic,
+ * sector number (incremented for every sector opened), sequence number of
+ * its first record, CRC. Records follow, 4-byte aligned, each with a 12-byte
+ * header: payload length, type, cursor identifier, sequence number (or cursor
+ * position), CRC over header and payload. Records never span sectors, and the
+ * first erased header ends the records of a sector.
+ *
+ * Sectors are used in ring order, so the sectors in use are the run of
+ * consecutive sector numbers ending at the newest one. Every sector opened
+ * starts with a checkpoint of the open cursors, which is why a mount only
+ * reads the sector headers and the records of the head sector.
+ *
+ * Batch layout: magic, version, first sequence number, record count, then per
+ * record its type, codec slot, varint length and packed bytes, and a CRC.
+ * Bytes are XORed with the reference of the codec slot, then packed in groups
+ * of 8 as in Cap'n Proto: a tag with one bit per non-zero byte, followed by
+ * those bytes. A 0x00 tag is followed by the count of further all-zero groups,
+ * a 0xFF tag by the count of further groups copied verbatim.
+ */
+
+#include "PZEMOutbox.h"
+#include "ModbusProtocol.h"
+
+#define OUTBOX_MAGIC          0x424F5A50UL  ///< Sector header magic ("PZOB")
+#define OUTBOX_SECTOR_HEADER  16            ///< Sector header size
+#define OUTBOX_RECORD_HEADER  12            ///< Record header size
+#define OUTBOX_RECORD_CURSOR  0x10          ///< Record type of a cursor position
+#define OUTBOX_CURSOR_CLOSED  0xFFFFFFFFUL  ///< Cursor position of a closed cursor
+#define OUTBOX_NO_SEQ         0xFFFFFFFFUL  ///< Empty read cache
+#define OUTBOX_NO_SLOT        0xFF          ///< Record coded without a reference
+#define OUTBOX_BATCH_MAGIC    0xB5          ///< First byte of a batch
+#define OUTBOX_BATCH_VERSION  1             ///< Batch layout version
+#define OUTBOX_BATCH_HEADER   8             ///< Batch header size
+#define OUTBOX_SNAPSHOT_HEADER 11           ///< Snapshot payload bytes before the registers
+#define OUTBOX_FLASH_SECTOR   4096          ///< Erase unit of the ESP32 flash
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, value & 0xFFFF);
+    put16(p + 2, value >> 16);
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint32_t align4(uint32_t length) {
+    return (length + 3) & ~3UL;
+}
+
+/**
+ * @brief Continue a Modbus CRC over a buffer of any length
+ */
+static uint16_t crcUpdate(uint16_t crc, const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        crc = modbusCRC16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+/**
+ * @brief CRC of a record: header up to the CRC field, then the payload
+ */
+static uint16_t recordCRC(const uint8_t* record, uint16_t length) {
+    return crcUpdate(crcUpdate(0xFFFF, record, 8), record + OUTBOX_RECORD_HEADER, length);
+}
+
+/**
+ * @brief Byte of a record XORed with its reference, zero past the end
+ */
+static uint8_t deltaAt(const uint8_t* data, const uint8_t* ref, uint16_t length, uint16_t i) {
+    if (i >= length) {
+        return 0;
+    }
+    return ref ? data[i] ^ ref[i] : data[i];
+}
+
+/**
+ * @brief Count the zero bytes of an 8-byte group
+ */
+static uint8_t zeroBytes(const uint8_t* data, const uint8_t* ref, uint16_t length, uint16_t group) {
+    uint8_t zeros = 0;
+    for (uint8_t b = 0; b < 8; b++) {
+        zeros += deltaAt(data, ref, length, group * 8 + b) == 0;
+    }
+    return zeros;
+}
+
+/**
+ * @brief Code one record at the end of a batch
+ * @return Bytes written, 0 if the record may not fit
+ */
+static uint32_t encodeRecord(uint8_t* out, uint32_t room, PZEMOutboxCodec* codec, uint8_t type,
+                             const uint8_t* data, uint16_t length) {
+    uint16_t groups = (length + 7) / 8;
+    // Type, slot, 2-byte varint, then at worst a tag, a count and 8 bytes per group
+    if (room < 4u + groups * 10u) {
+        return 0;
+    }
+    uint8_t slot = codec->find(type, data, length);
+    const uint8_t* ref = (slot != OUTBOX_NO_SLOT) ? codec->get(slot) : NULL;
+    uint32_t p = 0;
+    out[p++] = type;
+    out[p++] = slot;
+    for (uint16_t value = length; ; value >>= 7) {
+        out[p++] = (value > 0x7F) ? ((value & 0x7F) | 0x80) : value;
+        if (value <= 0x7F) {
+            break;
+        }
+    }
+
+    uint16_t g = 0;
+    while (g < groups) {
+        uint32_t tagAt = p++;
+        uint8_t tag = 0;
+        for (uint8_t b = 0; b < 8; b++) {
+            uint8_t delta = deltaAt(data, ref, length, g * 8 + b);
+            if (delta != 0) {
+                tag |= 1 << b;
+                out[p++] = delta;
+            }
+        }
+        out[tagAt] = tag;
+        g++;
+        if (tag == 0x00) {
+            uint8_t count = 0;
+            while (g < groups && count < 255 && zeroBytes(data, ref, length, g) == 8) {
+                count++;
+                g++;
+            }
+            out[p++] = count;
+        } else if (tag == 0xFF) {
+            // Groups with at most one zero byte are cheaper verbatim than tagged
+            uint32_t countAt = p++;
+            uint8_t count = 0;
+            while (g < groups && count < 255 && zeroBytes(data, ref, length, g) <= 1) {
+                for (uint8_t b = 0; b < 8; b++) {
+                    out[p++] = deltaAt(data, ref, length, g * 8 + b);
+                }
+                count++;
+                g++;
+            }
+            out[countAt] = count;
+        }
+    }
+    codec->remember(slot, type, data, length);
+    return p;
+}
+
+/**
+ * @brief Decode one record of a batch
+ * @return true if decoded, false on malformed data
+ */
+static bool decodeRecord(const uint8_t* in, uint32_t end, uint32_t* position, PZEMOutboxCodec* codec,
+                         uint8_t* payload, uint8_t* type, uint16_t* length) {
+    uint32_t p = *position;
+    if (p + 3 > end) {
+        return false;
+    }
+    *type = in[p++];
+    uint8_t slot = in[p++];
+    uint32_t value = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+        if (p >= end || shift > 14) {
+            return false;
+        }
+        value |= (uint32_t)(in[p] & 0x7F) << shift;
+        if (!(in[p++] & 0x80)) {
+            break;
+        }
+    }
+    if (value > PZEM_OUTBOX_MAX_RECORD || (slot != OUTBOX_NO_SLOT && slot >= PZEM_OUTBOX_CODEC_SLOTS)) {
+        return false;
+    }
+    const uint8_t* ref = (slot != OUTBOX_NO_SLOT) ? codec->get(slot) : NULL;
+
+    uint16_t groups = (value + 7) / 8;
+    uint16_t g = 0;
+    uint8_t delta[8];
+    uint8_t repeat = 0;
+    uint8_t mode = 0;  // 0: tagged group, 1: zero groups, 2: verbatim groups
+    while (g < groups) {
+        if (repeat == 0) {
+            if (p >= end) {
+                return false;
+            }
+            uint8_t tag = in[p++];
+            for (uint8_t b = 0; b < 8; b++) {
+                if (tag & (1 << b)) {
+                    if (p >= end) {
+                        return false;
+                    }
+                    delta[b] = in[p++];
+                } else {
+                    delta[b] = 0;
+                }
+            }
+            if (tag == 0x00 || tag == 0xFF) {
+                if (p >= end) {
+                    return false;
+                }
+                repeat = in[p++];
+                mode = (tag == 0x00) ? 1 : 2;
+                repeat++;  // The tagged group itself comes first
+            }
+        } else if (mode == 2) {
+            if (p + 8 > end) {
+                return false;
+            }
+            memcpy(delta, in + p, 8);
+            p += 8;
+        } else {
+            memset(delta, 0, 8);
+        }
+        if (repeat > 0) {
+            repeat--;
+        }
+        for (uint8_t b = 0; b < 8 && g * 8 + b < (int)value; b++) {
+            uint16_t i = g * 8 + b;
+            payload[i] = ref ? delta[b] ^ ref[i] : delta[b];
+        }
+        g++;
+    }
+    if (repeat > 0) {
+        return false;
+    }
+    codec->remember(slot, *type, payload, value);
+    *length = value;
+    *position = p;
+    return true;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @brief Constructor
+ */
+PZEMOutboxPartitionStore::PZEMOutboxPartitionStore() : _partition(NULL) {
+}
+
+/**
+ * @brief Find the partition
+ */
+bool PZEMOutboxPartitionStore::begin(const char* label) {
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    return _partition != NULL;
+}
+
+uint32_t PZEMOutboxPartitionStore::getSize() const {
+    return _partition ? (_partition->size / OUTBOX_FLASH_SECTOR) * OUTBOX_FLASH_SECTOR : 0;
+}
+
+uint32_t PZEMOutboxPartitionStore::getSectorSize() const {
+    return OUTBOX_FLASH_SECTOR;
+}
+
+bool PZEMOutboxPartitionStore::read(uint32_t offset, void* data, uint32_t length) {
+    return _partition && esp_partition_read(_partition, offset, data, length) == ESP_OK;
+}
+
+bool PZEMOutboxPartitionStore::write(uint32_t offset, const void* data, uint32_t length) {
+    return _partition && esp_partition_write(_partition, offset, data, length) == ESP_OK;
+}
+
+bool PZEMOutboxPartitionStore::erase(uint32_t offset) {
+    return _partition && esp_partition_erase_range(_partition, offset, OUTBOX_FLASH_SECTOR) == ESP_OK;
+}
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+/**
+ * @brief Constructor
+ */
+PZEMOutboxFileStore::PZEMOutboxFileStore(fs::FS& fs, const char* path, uint32_t size, uint32_t sectorSize)
+    : _fs(fs), _path(path), _size(sectorSize ? (size / sectorSize) * sectorSize : 0), _sectorSize(sectorSize) {
+}
+
+/**
+ * @brief Open the file, creating it filled with 0xFF if it is missing or short
+ *
+ * The file is grown once here, so appends never change its size and the
+ * filesystem never has to allocate while the outbox runs.
+ */
+bool PZEMOutboxFileStore::begin() {
+    if (_size == 0) {
+        return false;
+    }
+    if (_fs.exists(_path)) {
+        _file = _fs.open(_path, "r+");
+    }
+    if (!_file) {
+        _file = _fs.open(_path, "w+");
+    }
+    if (!_file) {
+        return false;
+    }
+    uint32_t length = _file.size();
+    if (length < _size) {
+        uint8_t erased[64];
+        memset(erased, 0xFF, sizeof(erased));
+        if (!_file.seek(length)) {
+            return false;
+        }
+        while (length < _size) {
+            uint32_t chunk = (_size - length < sizeof(erased)) ? _size - length : sizeof(erased);
+            if (_file.write(erased, chunk) != chunk) {
+                return false;
+            }
+            length += chunk;
+        }
+        _file.flush();
+    }
+    return true;
+}
+
+uint32_t PZEMOutboxFileStore::getSize() const {
+    return _size;
+}
+
+uint32_t PZEMOutboxFileStore::getSectorSize() const {
+    return _sectorSize;
+}
+
+bool PZEMOutboxFileStore::read(uint32_t offset, void* data, uint32_t length) {
+    return _file && _file.seek(offset) && _file.read((uint8_t*)data, length) == length;
+}
+
+bool PZEMOutboxFileStore::write(uint32_t offset, const void* data, uint32_t length) {
+    return _file && _file.seek(offset) && _file.write((const uint8_t*)data, length) == length;
+}
+
+bool PZEMOutboxFileStore::erase(uint32_t offset) {
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    if (!_file || !_file.seek(offset)) {
+        return false;
+    }
+    for (uint32_t done = 0; done < _sectorSize; done += sizeof(erased)) {
+        if (_file.write(erased, sizeof(erased)) != sizeof(erased)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PZEMOutboxFileStore::sync() {
+    if (!_file) {
+        return false;
+    }
+    _file.flush();
+    return true;
+}
+#endif
+
+/**
+ * @brief Constructor, no references
+ */
+PZEMOutboxCodec::PZEMOutboxCodec() {
+    reset();
+}
+
+/**
+ * @brief Forget every reference
+ */
+void PZEMOutboxCodec::reset() {
+    memset(_type, 0, sizeof(_type));
+    _next = 0;
+}
+
+/**
+ * @brief Find the reference of a record
+ */
+uint8_t PZEMOutboxCodec::find(uint8_t type, const uint8_t* data, uint16_t length) const {
+    uint16_t key = (length < 2) ? length : 2;
+    for (uint8_t slot = 0; slot < PZEM_OUTBOX_CODEC_SLOTS; slot++) {
+        if (_type[slot] == type && _length[slot] == length && memcmp(_data[slot], data, key) == 0) {
+            return slot;
+        }
+    }
+    return OUTBOX_NO_SLOT;
+}
+
+/**
+ * @brief Get the payload of a slot
+ */
+const uint8_t* PZEMOutboxCodec::get(uint8_t slot) const {
+    return _data[slot];
+}
+
+/**
+ * @brief Make a record the reference of its kind
+ */
+void PZEMOutboxCodec::remember(uint8_t slot, uint8_t type, const uint8_t* data, uint16_t length) {
+    if (slot == OUTBOX_NO_SLOT) {
+        slot = _next;
+        _next = (_next + 1) % PZEM_OUTBOX_CODEC_SLOTS;
+    }
+    _type[slot] = type;
+    _length[slot] = length;
+    memcpy(_data[slot], data, length);
+}
+
+/**
+ * @brief Constructor
+ */
+PZEMOutbox::PZEMOutbox()
+    : _store(NULL), _sectorSize(0), _sectorCount(0), _rate(0), _burst(0), _tokens(0), _refillTime(0) {
+    clear();
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Reset the state to an empty log
+ */
+void PZEMOutbox::clear() {
+    _empty = true;
+    _tail = 0;
+    _head = 0;
+    _sectorSeq = 0;
+    _appendOffset = 0;
+    _headSeq = 0;
+    _cursorMask = 0;
+    for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS; i++) {
+        _cursor[i] = 0;
+        _liveStart[i] = 0;
+        _live[i] = 0;
+    }
+    for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS * 2; i++) {
+        _readSeq[i] = OUTBOX_NO_SEQ;
+    }
+}
+
+/**
+ * @brief Mount the log of a store, or start an empty one
+ *
+ * The head is the sector with the highest number; walking back from it, the
+ * sectors numbered one less each time are the rest of the log. Any other
+ * sector is stale and is erased before it is reused.
+ */
+bool PZEMOutbox::begin(PZEMOutboxStore* store) {
+    if (store == NULL) {
+        return false;
+    }
+    uint32_t sectorSize = store->getSectorSize();
+    uint32_t count = sectorSize ? store->getSize() / sectorSize : 0;
+    if (sectorSize < 256 || sectorSize > 65536 || count < 2 || count > PZEM_OUTBOX_MAX_SECTORS) {
+        return false;
+    }
+    _store = store;
+    _sectorSize = sectorSize;
+    _sectorCount = count;
+    clear();
+    memset(&_stats, 0, sizeof(_stats));
+
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t sectorSeq;
+    uint32_t firstSeq;
+    for (uint16_t s = 0; s < _sectorCount; s++) {
+        if (readSectorHeader(s, &sectorSeq, &firstSeq) && (!found || (int32_t)(sectorSeq - newest) > 0)) {
+            found = true;
+            newest = sectorSeq;
+            _head = s;
+            _firstSeq[s] = firstSeq;
+        }
+    }
+    if (!found) {
+        return _stats.storeErrors == 0;
+    }
+
+    _tail = _head;
+    _sectorSeq = newest;
+    for (uint16_t n = 1; n < _sectorCount; n++) {
+        uint16_t s = (_head + _sectorCount - n) % _sectorCount;
+        if (!readSectorHeader(s, &sectorSeq, &firstSeq) || sectorSeq != newest - n ||
+            (int32_t)(_firstSeq[_tail] - firstSeq) < 0) {
+            break;
+        }
+        _firstSeq[s] = firstSeq;
+        _tail = s;
+    }
+    _empty = false;
+    scanHead();
+    for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS; i++) {
+        normalize(i);
+    }
+    return _stats.storeErrors == 0;
+}
+
+/**
+ * @brief Scan the records of the head sector after a mount
+ *
+ * A record that is neither valid nor erased is a write cut by a reset. The
+ * space after it cannot be written again before an erase, so the sector is
+ * closed and the next append opens a new one.
+ */
+void PZEMOutbox::scanHead() {
+    uint32_t offset = OUTBOX_SECTOR_HEADER;
+    uint32_t end;
+    _headSeq = _firstSeq[_head];
+    while (offset + OUTBOX_RECORD_HEADER <= _sectorSize) {
+        if (!readRecord(_head, offset, &end)) {
+            bool erased = get16(_record) == 0xFFFF && _record[2] == 0xFF && _record[3] == 0xFF;
+            if (!erased) {
+                offset = _sectorSize;
+            }
+            break;
+        }
+        uint32_t seq = get32(_record + 4);
+        if (_record[2] == OUTBOX_RECORD_CURSOR) {
+            uint8_t id = _record[3];
+            if (id < PZEM_OUTBOX_MAX_CURSORS) {
+                if (seq == OUTBOX_CURSOR_CLOSED) {
+                    _cursorMask &= ~(1 << id);
+                } else {
+                    bool split = get16(_record) == 8;
+                    _cursor[id] = seq;
+                    _liveStart[id] = split ? get32(_record + OUTBOX_RECORD_HEADER) : seq;
+                    _live[id] = split ? get32(_record + OUTBOX_RECORD_HEADER + 4) : seq;
+                    _cursorMask |= 1 << id;
+                }
+            }
+        } else if (seq == _headSeq) {
+            _headSeq++;
+        } else {
+            offset = _sectorSize;
+            break;
+        }
+        offset = end;
+    }
+    _appendOffset = offset;
+}
+
+/**
+ * @brief Read and check the header of a sector
+ */
+bool PZEMOutbox::readSectorHeader(uint16_t sector, uint32_t* sectorSeq, uint32_t* firstSeq) {
+    uint8_t header[OUTBOX_SECTOR_HEADER];
+    if (!_store->read((uint32_t)sector * _sectorSize, header, sizeof(header))) {
+        _stats.storeErrors++;
+        return false;
+    }
+    if (get32(header) != OUTBOX_MAGIC || get16(header + 12) != crcUpdate(0xFFFF, header, 12)) {
+        return false;
+    }
+    *sectorSeq = get32(header + 4);
+    *firstSeq = get32(header + 8);
+    return true;
+}
+
+/**
+ * @brief Erase the whole store
+ */
+bool PZEMOutbox::format() {
+    if (_store == NULL) {
+        return false;
+    }
+    for (uint16_t s = 0; s < _sectorCount; s++) {
+        if (!_store->erase((uint32_t)s * _sectorSize)) {
+            _stats.storeErrors++;
+            return false;
+        }
+        _stats.erases++;
+    }
+    clear();
+    return true;
+}
+
+/**
+ * @brief Keep a cursor inside the stored records and join it once its backlog is delivered
+ */
+void PZEMOutbox::normalize(uint8_t id) {
+    uint32_t oldest = tailSeq();
+    uint32_t* positions[3] = { &_cursor[id], &_liveStart[id], &_live[id] };
+    for (uint8_t i = 0; i < 3; i++) {
+        uint32_t value = *positions[i];
+        *positions[i] = (value < oldest) ? oldest : (value > _headSeq ? _headSeq : value);
+    }
+    if (_liveStart[id] < _cursor[id]) {
+        _liveStart[id] = _cursor[id];
+    }
+    if (_live[id] < _liveStart[id]) {
+        _live[id] = _liveStart[id];
+    }
+    if (_cursor[id] == _liveStart[id]) {
+        _cursor[id] = _live[id];
+        _liveStart[id] = _live[id];
+    }
+}
+
+/**
+ * @brief Open the next sector, erasing the oldest one if the log is full
+ *
+ * The cursors still inside the erased sector move to the first record left,
+ * and the records they had not delivered are counted as dropped.
+ */
+bool PZEMOutbox::openSector() {
+    uint16_t next = _empty ? 0 : (_head + 1) % _sectorCount;
+    if (!_empty && next == _tail) {
+        uint32_t start = _firstSeq[_tail];
+        uint32_t end = _firstSeq[(_tail + 1) % _sectorCount];
+        uint32_t lost = 0;
+        for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS; i++) {
+            if (!(_cursorMask & (1 << i))) {
+                continue;
+            }
+            // Not delivered: the backlog [_cursor, _liveStart) and the live records from _live
+            uint32_t from = (_cursor[i] > start) ? _cursor[i] : start;
+            uint32_t to = (_liveStart[i] < end) ? _liveStart[i] : end;
+            uint32_t pending = (to > from) ? to - from : 0;
+            from = (_live[i] > start) ? _live[i] : start;
+            pending += (end > from) ? end - from : 0;
+            lost = pending > lost ? pending : lost;
+        }
+        _stats.dropped += lost;
+        _tail = (_tail + 1) % _sectorCount;
+        for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS; i++) {
+            normalize(i);
+        }
+    }
+    for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS * 2; i++) {
+        if (_readSeq[i] != OUTBOX_NO_SEQ && _readSector[i] == next) {
+            _readSeq[i] = OUTBOX_NO_SEQ;
+        }
+    }
+
+    if (!_store->erase((uint32_t)next * _sectorSize)) {
+        _stats.storeErrors++;
+        return false;
+    }
+    _stats.erases++;
+    uint8_t header[OUTBOX_SECTOR_HEADER];
+    put32(header, OUTBOX_MAGIC);
+    put32(header + 4, _sectorSeq + 1);
+    put32(header + 8, _headSeq);
+    put16(header + 12, crcUpdate(0xFFFF, header, 12));
+    header[14] = 0xFF;
+    header[15] = 0xFF;
+    if (!_store->write((uint32_t)next * _sectorSize, header, sizeof(header))) {
+        _stats.storeErrors++;
+        return false;
+    }
+
+    _sectorSeq++;
+    _head = next;
+    _firstSeq[next] = _headSeq;
+    _appendOffset = OUTBOX_SECTOR_HEADER;
+    if (_empty) {
+        _tail = next;
+        _empty = false;
+    }
+    for (uint8_t i = 0; i < PZEM_OUTBOX_MAX_CURSORS; i++) {
+        if ((_cursorMask & (1 << i)) && !putCursor(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write a record that fits the head sector
+ *
+ * Header and payload go out in one write. A failed write may have programmed
+ * part of the record, so the sector is closed.
+ */
+bool PZEMOutbox::putRecord(uint8_t type, uint8_t id, uint32_t seq, const void* data, uint16_t length) {
+    uint32_t size = align4(OUTBOX_RECORD_HEADER + length);
+    put16(_record, length);
+    _record[2] = type;
+    _record[3] = id;
+    put32(_record + 4, seq);
+    if (length > 0) {
+        memcpy(_record + OUTBOX_RECORD_HEADER, data, length);
+    }
+    memset(_record + OUTBOX_RECORD_HEADER + length, 0xFF, size - OUTBOX_RECORD_HEADER - length);
+    put16(_record + 8, recordCRC(_record, length));
+    _record[10] = 0xFF;
+    _record[11] = 0xFF;
+    if (!_store->write((uint32_t)_head * _sectorSize + _appendOffset, _record, size)) {
+        _stats.storeErrors++;
+        _appendOffset = _sectorSize;
+        return false;
+    }
+    _appendOffset += size;
+    return true;
+}
+
+/**
+ * @brief Append a data record, opening a sector if the head sector is full
+ */
+bool PZEMOutbox::appendRecord(uint8_t type, const void* data, uint16_t length) {
+    if (_store == NULL || length > PZEM_OUTBOX_MAX_RECORD) {
+        return false;
+    }
+    uint32_t size = align4(OUTBOX_RECORD_HEADER + length);
+    if ((_empty || _appendOffset + size > _sectorSize) && !openSector()) {
+        return false;
+    }
+    if (!putRecord(type, 0, _headSeq, data, length)) {
+        return false;
+    }
+    _headSeq++;
+    _stats.appended++;
+    return true;
+}
+
+/**
+ * @brief Write the position of a cursor (or its closing) to the log
+ *
+ * When the head sector is full, opening the next one is enough: its
+ * checkpoint holds every open cursor, and leaves closed ones out.
+ */
+bool PZEMOutbox::writeCursor(uint8_t id) {
+    if (_empty || _appendOffset + align4(OUTBOX_RECORD_HEADER + 8) > _sectorSize) {
+        return openSector();
+    }
+    if (!(_cursorMask & (1 << id))) {
+        return putRecord(OUTBOX_RECORD_CURSOR, id, OUTBOX_CURSOR_CLOSED, NULL, 0);
+    }
+    return putCursor(id);
+}
+
+/**
+ * @brief Write the record of an open cursor at the append position
+ *
+ * The sequence number field holds the backlog position; a split cursor adds
+ * the start and position of its live records as payload.
+ */
+bool PZEMOutbox::putCursor(uint8_t id) {
+    uint8_t payload[8];
+    if (_cursor[id] == _liveStart[id]) {
+        return putRecord(OUTBOX_RECORD_CURSOR, id, _cursor[id], NULL, 0);
+    }
+    put32(payload, _liveStart[id]);
+    put32(payload + 4, _live[id]);
+    return putRecord(OUTBOX_RECORD_CURSOR, id, _cursor[id], payload, sizeof(payload));
+}
+
+/**
+ * @brief Append an application record
+ */
+bool PZEMOutbox::append(const void* data, uint16_t length) {
+    return appendRecord(PZEM_OUTBOX_RECORD_DATA, data, length);
+}
+
+/**
+ * @brief Append a snapshot
+ *
+ * Payload: slave address, model, register count, epoch and timestamp (32-bit
+ * little endian), then the registers (16-bit little endian, host order).
+ */
+bool PZEMOutbox::appendSnapshot(const PZEMSnapshot* snapshot, uint32_t epoch) {
+    if (snapshot == NULL || snapshot->count > PZEM_SNAPSHOT_MAX_REGISTERS) {
+        return false;
+    }
+    uint8_t payload[OUTBOX_SNAPSHOT_HEADER + 2 * PZEM_SNAPSHOT_MAX_REGISTERS];
+    payload[0] = snapshot->slaveAddr;
+    payload[1] = snapshot->model;
+    payload[2] = snapshot->count;
+    put32(payload + 3, epoch);
+    put32(payload + 7, snapshot->timestamp);
+    for (uint8_t i = 0; i < snapshot->count; i++) {
+        put16(payload + OUTBOX_SNAPSHOT_HEADER + 2 * i, snapshot->regs[i]);
+    }
+    return appendRecord(PZEM_OUTBOX_RECORD_SNAPSHOT, payload, OUTBOX_SNAPSHOT_HEADER + 2 * snapshot->count);
+}
+
+/**
+ * @brief Open a consumer cursor
+ */
+bool PZEMOutbox::openCursor(uint8_t id) {
+    if (_store == NULL || id >= PZEM_OUTBOX_MAX_CURSORS) {
+        return false;
+    }
+    if (_cursorMask & (1 << id)) {
+        return true;
+    }
+    _cursorMask |= 1 << id;
+    _cursor[id] = tailSeq();
+    _liveStart[id] = _cursor[id];
+    _live[id] = _cursor[id];
+    _readSeq[2 * id] = OUTBOX_NO_SEQ;
+    _readSeq[2 * id + 1] = OUTBOX_NO_SEQ;
+    return writeCursor(id) && sync();
+}
+
+/**
+ * @brief Close a consumer cursor for good
+ */
+bool PZEMOutbox::closeCursor(uint8_t id) {
+    if (_store == NULL || id >= PZEM_OUTBOX_MAX_CURSORS) {
+        return false;
+    }
+    if (!(_cursorMask & (1 << id))) {
+        return true;
+    }
+    _cursorMask &= ~(1 << id);
+    return writeCursor(id) && sync();
+}
+
+/**
+ * @brief Mark the records of a batch delivered and make the cursor durable
+ *
+ * The batch moves whichever position it starts from; a batch that no longer
+ * covers a position (records dropped meanwhile, or committed twice) changes
+ * nothing.
+ */
+bool PZEMOutbox::commit(uint8_t id, const PZEMOutboxBatch* batch) {
+    if (_store == NULL || id >= PZEM_OUTBOX_MAX_CURSORS || !(_cursorMask & (1 << id)) || batch == NULL ||
+        batch->nextSeq > _headSeq) {
+        return false;
+    }
+    uint32_t cursor = _cursor[id];
+    uint32_t live = _live[id];
+    if (batch->firstSeq <= _cursor[id] && _cursor[id] < batch->nextSeq) {
+        _cursor[id] = batch->nextSeq;
+    } else if (batch->firstSeq <= _live[id] && _live[id] < batch->nextSeq) {
+        _live[id] = batch->nextSeq;
+    }
+    normalize(id);
+    if (_cursor[id] == cursor && _live[id] == live) {
+        return true;
+    }
+    return writeCursor(id) && sync();
+}
+
+/**
+ * @brief Move a cursor to a position
+ */
+bool PZEMOutbox::rewind(uint8_t id, uint32_t seq) {
+    if (_store == NULL || id >= PZEM_OUTBOX_MAX_CURSORS || !(_cursorMask & (1 << id)) || seq > _headSeq) {
+        return false;
+    }
+    _cursor[id] = seq;
+    _liveStart[id] = seq;
+    _live[id] = seq;
+    normalize(id);
+    return writeCursor(id) && sync();
+}
+
+/**
+ * @brief Read and check the record at a position into _record
+ */
+bool PZEMOutbox::readRecord(uint16_t sector, uint32_t offset, uint32_t* end) {
+    if (offset + OUTBOX_RECORD_HEADER > _sectorSize) {
+        memset(_record, 0xFF, OUTBOX_RECORD_HEADER);
+        return false;
+    }
+    uint32_t base = (uint32_t)sector * _sectorSize + offset;
+    if (!_store->read(base, _record, OUTBOX_RECORD_HEADER)) {
+        _stats.storeErrors++;
+        _record[0] = 0;
+        return false;
+    }
+    uint16_t length = get16(_record);
+    if (length > PZEM_OUTBOX_MAX_RECORD || offset + align4(OUTBOX_RECORD_HEADER + length) > _sectorSize) {
+        return false;
+    }
+    if (length > 0 && !_store->read(base + OUTBOX_RECORD_HEADER, _record + OUTBOX_RECORD_HEADER, length)) {
+        _stats.storeErrors++;
+        return false;
+    }
+    if (get16(_record + 8) != recordCRC(_record, length)) {
+        return false;
+    }
+    *end = offset + align4(OUTBOX_RECORD_HEADER + length);
+    return true;
+}
+
+/**
+ * @brief Find the sector and offset of a data record
+ *
+ * Batches of a cursor follow each other, so the position after the last batch
+ * is kept and the search only runs after a rewind, a mount or an erase.
+ */
+bool PZEMOutbox::locate(uint8_t cache, uint32_t seq, uint16_t* sector, uint32_t* offset) {
+    if (_readSeq[cache] == seq) {
+        *sector = _readSector[cache];
+        *offset = _readOffset[cache];
+        return true;
+    }
+    if (_empty) {
+        return false;
+    }
+    uint16_t s = _tail;
+    while (s != _head) {
+        uint16_t next = (s + 1) % _sectorCount;
+        if (seq < _firstSeq[next]) {
+            break;
+        }
+        s = next;
+    }
+    uint32_t position = OUTBOX_SECTOR_HEADER;
+    uint32_t end;
+    while (readRecord(s, position, &end)) {
+        if (_record[2] != OUTBOX_RECORD_CURSOR && get32(_record + 4) >= seq) {
+            break;
+        }
+        position = end;
+    }
+    *sector = s;
+    *offset = position;
+    return true;
+}
+
+/**
+ * @brief Add the backfill tokens earned since the last refill
+ */
+void PZEMOutbox::refill() {
+    uint32_t now = millis();
+    uint64_t earned = (uint64_t)_rate * (uint32_t)(now - _refillTime) / 1000;
+    if (earned > 0) {
+        uint64_t tokens = _tokens + earned;
+        _tokens = (tokens > _burst) ? _burst : (uint32_t)tokens;
+        _refillTime = now;
+    }
+}
+
+/**
+ * @brief Limit the bandwidth of backfill batches
+ */
+void PZEMOutbox::setBackfillRate(uint32_t bytesPerSecond, uint32_t burstBytes) {
+    _rate = bytesPerSecond;
+    _burst = (burstBytes < PZEM_OUTBOX_MIN_BATCH) ? PZEM_OUTBOX_MIN_BATCH : burstBytes;
+    _tokens = _burst;
+    _refillTime = millis();
+}
+
+/**
+ * @brief Encode the next records of a cursor into a batch
+ *
+ * A cursor lagging by more than PZEM_OUTBOX_LIVE_RECORDS splits at the head:
+ * what is stored becomes its backlog and later records are live. The split is
+ * only written to the log by the next commit; a reset before that splits the
+ * cursor again at the new head. A backfill batch waits until the tokens fill
+ * a batch and is charged for its encoded length. Records lost to a torn
+ * write end the batch, so the records of a batch always have consecutive
+ * sequence numbers.
+ */
+bool PZEMOutbox::takeBatch(uint8_t id, uint8_t* out, uint32_t size, PZEMOutboxBatch* batch) {
+    if (_store == NULL || id >= PZEM_OUTBOX_MAX_CURSORS || !(_cursorMask & (1 << id)) || out == NULL ||
+        batch == NULL || size < PZEM_OUTBOX_MIN_BATCH) {
+        return false;
+    }
+    bool split = _cursor[id] != _liveStart[id];
+    if (!split && _headSeq - _cursor[id] > PZEM_OUTBOX_LIVE_RECORDS) {
+        _liveStart[id] = _headSeq;
+        _live[id] = _headSeq;
+        split = true;
+    }
+    bool backfill = split && _live[id] >= _headSeq;
+    uint32_t seq = backfill || !split ? _cursor[id] : _live[id];
+    uint32_t stop = backfill ? _liveStart[id] : _headSeq;
+    uint8_t cache = 2 * id + (split && !backfill ? 1 : 0);
+    if (seq >= stop) {
+        return false;
+    }
+    uint32_t limit = size;
+    if (backfill && _rate > 0) {
+        refill();
+        // Wait for a full batch: few large batches code better than many small ones
+        if (_tokens < ((_burst < size) ? _burst : size)) {
+            _stats.rateLimited++;
+            return false;
+        }
+        limit = (_tokens < size) ? _tokens : size;
+    }
+    limit -= 2;  // CRC
+
+    uint16_t sector;
+    uint32_t offset;
+    if (!locate(cache, seq, &sector, &offset)) {
+        return false;
+    }
+    _codec.reset();
+    uint32_t first = seq;
+    uint32_t length = OUTBOX_BATCH_HEADER;
+    uint32_t raw = 0;
+    uint16_t count = 0;
+    uint32_t errors = _stats.storeErrors;
+    while (seq < stop && count < 0xFFFF) {
+        uint32_t end;
+        if (!readRecord(sector, offset, &end)) {
+            // A read error is retried by the next call; anything else ends the sector
+            if (sector == _head || _stats.storeErrors != errors) {
+                break;
+            }
+            sector = (sector + 1) % _sectorCount;
+            offset = OUTBOX_SECTOR_HEADER;
+            if (_firstSeq[sector] > seq) {
+                if (count > 0) {
+                    break;
+                }
+                seq = first = _firstSeq[sector];
+            }
+            continue;
+        }
+        uint32_t recordSeq = get32(_record + 4);
+        if (_record[2] == OUTBOX_RECORD_CURSOR || recordSeq < seq) {
+            offset = end;
+            continue;
+        }
+        if (recordSeq != seq) {
+            break;
+        }
+        uint16_t recordLength = get16(_record);
+        uint32_t written = encodeRecord(out + length, limit - length, &_codec, _record[2],
+                                        _record + OUTBOX_RECORD_HEADER, recordLength);
+        if (written == 0) {
+            break;
+        }
+        length += written;
+        raw += recordLength;
+        count++;
+        seq++;
+        offset = end;
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    out[0] = OUTBOX_BATCH_MAGIC;
+    out[1] = OUTBOX_BATCH_VERSION;
+    put32(out + 2, first);
+    put16(out + 6, count);
+    put16(out + length, crcUpdate(0xFFFF, out, length));
+    length += 2;
+
+    _readSeq[cache] = seq;
+    _readSector[cache] = sector;
+    _readOffset[cache] = offset;
+    if (backfill && _rate > 0) {
+        _tokens -= (length < _tokens) ? length : _tokens;
+    }
+    batch->firstSeq = first;
+    batch->nextSeq = seq;
+    batch->count = count;
+    batch->length = length;
+    batch->rawLength = raw;
+    batch->backfill = backfill;
+    return true;
+}
+
+/**
+ * @brief Make the appends so far durable
+ */
+bool PZEMOutbox::sync() {
+    if (_store == NULL) {
+        return false;
+    }
+    if (!_store->sync()) {
+        _stats.storeErrors++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the position of a cursor
+ */
+bool PZEMOutbox::getCursor(uint8_t id, PZEMOutboxCursor* cursor) const {
+    if (id >= PZEM_OUTBOX_MAX_CURSORS || !(_cursorMask & (1 << id))) {
+        return false;
+    }
+    cursor->next = _cursor[id];
+    cursor->liveStart = _liveStart[id];
+    cursor->live = _live[id];
+    return true;
+}
+
+/**
+ * @brief Get the number of records a cursor has not delivered
+ */
+uint32_t PZEMOutbox::getLag(uint8_t id) const {
+    if (id >= PZEM_OUTBOX_MAX_CURSORS || !(_cursorMask & (1 << id))) {
+        return 0;
+    }
+    return (_liveStart[id] - _cursor[id]) + (_headSeq - _live[id]);
+}
+
+/**
+ * @brief Get the counters
+ */
+void PZEMOutbox::getStats(PZEMOutboxStats* stats) const {
+    *stats = _stats;
+    stats->headSeq = _headSeq;
+    stats->tailSeq = tailSeq();
+    stats->capacityBytes = (uint32_t)_sectorCount * _sectorSize;
+    stats->usedBytes = _empty ? 0 : ((_head + _sectorCount - _tail) % _sectorCount) * _sectorSize + _appendOffset;
+}
+
+/**
+ * @brief Get the sequence number of the oldest record stored
+ */
+uint32_t PZEMOutbox::tailSeq() const {
+    return _empty ? _headSeq : _firstSeq[_tail];
+}
+
+/**
+ * @brief Decode a snapshot record
+ */
+bool PZEMOutbox::decodeSnapshot(const PZEMOutboxRecord* record, PZEMSnapshot* snapshot, uint32_t* epoch) {
+    if (record->type != PZEM_OUTBOX_RECORD_SNAPSHOT || record->length < OUTBOX_SNAPSHOT_HEADER) {
+        return false;
+    }
+    const uint8_t* data = record->data;
+    uint8_t count = data[2];
+    if (count > PZEM_SNAPSHOT_MAX_REGISTERS || record->length != OUTBOX_SNAPSHOT_HEADER + 2 * count) {
+        return false;
+    }
+    snapshot->slaveAddr = data[0];
+    snapshot->model = data[1];
+    snapshot->count = count;
+    snapshot->timestamp = get32(data + 7);
+    for (uint8_t i = 0; i < count; i++) {
+        snapshot->regs[i] = get16(data + OUTBOX_SNAPSHOT_HEADER + 2 * i);
+    }
+    if (epoch != NULL) {
+        *epoch = get32(data + 3);
+    }
+    return true;
+}
+
+/**
+ * @brief Constructor
+ */
+PZEMOutboxDecoder::PZEMOutboxDecoder()
+    : _batch(NULL), _length(0), _position(0), _firstSeq(0), _count(0), _decoded(0) {
+}
+
+/**
+ * @brief Start decoding a batch
+ */
+bool PZEMOutboxDecoder::begin(const uint8_t* batch, uint32_t length) {
+    _batch = NULL;
+    if (batch == NULL || length < OUTBOX_BATCH_HEADER + 2 || batch[0] != OUTBOX_BATCH_MAGIC ||
+        batch[1] != OUTBOX_BATCH_VERSION || get16(batch + length - 2) != crcUpdate(0xFFFF, batch, length - 2)) {
+        return false;
+    }
+    _batch = batch;
+    _length = length - 2;
+    _position = OUTBOX_BATCH_HEADER;
+    _firstSeq = get32(batch + 2);
+    _count = get16(batch + 6);
+    _decoded = 0;
+    _codec.reset();
+    return true;
+}
+
+/**
+ * @brief Decode the next record
+ */
+bool PZEMOutboxDecoder::next(PZEMOutboxRecord* record) {
+    if (_batch == NULL || _decoded >= _count ||
+        !decodeRecord(_batch, _length, &_position, &_codec, _payload, &record->type, &record->length)) {
+        return false;
+    }
+    record->seq = _firstSeq + _decoded;
+    record->data = _payload;
+    _decoded++;
+    return true;
+}
+
+/**
+ * @brief Get the sequence number of the first record
+ */
+uint32_t PZEMOutboxDecoder::getFirstSeq() const {
+    return _firstSeq;
+}
+
+/**
+ * @brief Get the number of records in the batch
+ */
+uint16_t PZEMOutboxDecoder::getCount() const {
+    return _count;
+}
@@ -0,0 +1,620 @@
+/**
+ * @file PZEMOutbox.h
+ * @brief Durable store-and-forward outbox with persistent consumer cursors
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * The outbox keeps snapshots (or any small record) in a circular log on a
+ * pluggable store: a flash partition, a file on SD or LittleFS, or a file on
+ * the host. Records are appended as they are produced, whatever the state of
+ * the uplink. Each consumer holds a cursor, the position of the records it
+ * has delivered; cursors are written to the log on commit, so after an outage
+ * or a reboot every consumer resumes where its sink last acknowledged.
+ *
+ * Records are read in batches: consecutive records, each XOR-delta coded
+ * against the previous record of the same device and zero-byte packed, since
+ * successive snapshots of a device differ in a few low bytes. When a consumer
+ * comes back with more than PZEM_OUTBOX_LIVE_RECORDS records to deliver, its
+ * cursor splits: records appended from then on are live and go first, while
+ * the backlog is sent in backfill batches charged to a token bucket
+ * (setBackfillRate()), so catching up after a long outage never holds back
+ * live data. The cursor joins again once the backlog is delivered.
+ *
+ * When the log is full, the oldest sector is erased and its records are
+ * dropped, counted in PZEMOutboxStats::dropped for records a cursor had not
+ * delivered yet.
+ */
+
+#ifndef PZEMOUTBOX_H
+#define PZEMOUTBOX_H
+
+#include <Arduino.h>
+#include "PZEMModel.h"
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#include <FS.h>
+#endif
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_partition.h>
+#endif
+
+/**
+ * @defgroup PZEMOutboxConfig Outbox Configuration
+ * @brief Compile-time sizing of the outbox (override before including)
+ * @{
+ */
+#ifndef PZEM_OUTBOX_MAX_SECTORS
+#define PZEM_OUTBOX_MAX_SECTORS     256   ///< Largest number of sectors of a store (4 bytes of RAM each)
+#endif
+#ifndef PZEM_OUTBOX_MAX_CURSORS
+#define PZEM_OUTBOX_MAX_CURSORS     4     ///< Consumer cursors, at most 8 (identifiers 0 to PZEM_OUTBOX_MAX_CURSORS - 1)
+#endif
+#ifndef PZEM_OUTBOX_CODEC_SLOTS
+#define PZEM_OUTBOX_CODEC_SLOTS     16    ///< Devices remembered by the batch codec (PZEM_OUTBOX_MAX_RECORD bytes each)
+#endif
+#ifndef PZEM_OUTBOX_LIVE_RECORDS
+#define PZEM_OUTBOX_LIVE_RECORDS    32    ///< Cursor lag (records) beyond which the backlog is sent as backfill
+#endif
+#define PZEM_OUTBOX_MAX_RECORD      160   ///< Largest record payload (a PZEM-6L24 snapshot is 139 bytes)
+#define PZEM_OUTBOX_MIN_BATCH       256   ///< Smallest batch buffer
+/** @} */
+
+/**
+ * @defgroup PZEMOutboxRecordTypes Outbox Record Types
+ * @{
+ */
+#define PZEM_OUTBOX_RECORD_DATA      1    ///< Application payload (append())
+#define PZEM_OUTBOX_RECORD_SNAPSHOT  2    ///< Snapshot (appendSnapshot(), decodeSnapshot())
+/** @} */
+
+/**
+ * @class PZEMOutboxStore
+ * @brief Byte-addressed storage with flash semantics, backing a PZEMOutbox
+ *
+ * The store is divided into sectors of getSectorSize() bytes. An erased
+ * sector reads as 0xFF and each byte is written at most once between erases,
+ * as on NOR flash, so a partition is used directly; file-backed stores
+ * emulate the erase by filling the sector with 0xFF.
+ */
+class PZEMOutboxStore {
+public:
+    virtual ~PZEMOutboxStore() {}
+
+    /**
+     * @brief Get the usable size
+     * @return Size in bytes (a multiple of the sector size)
+     */
+    virtual uint32_t getSize() const = 0;
+
+    /**
+     * @brief Get the erase unit
+     * @return Sector size in bytes
+     */
+    virtual uint32_t getSectorSize() const = 0;
+
+    /**
+     * @brief Read bytes
+     * @param offset Byte offset
+     * @param data Buffer receiving the bytes
+     * @param length Number of bytes
+     * @return true if read, false on a storage error
+     */
+    virtual bool read(uint32_t offset, void* data, uint32_t length) = 0;
+
+    /**
+     * @brief Write bytes to erased space
+     * @param offset Byte offset
+     * @param data Bytes to write
+     * @param length Number of bytes
+     * @return true if written, false on a storage error
+     */
+    virtual bool write(uint32_t offset, const void* data, uint32_t length) = 0;
+
+    /**
+     * @brief Erase one sector
+     * @param offset Offset of the sector (a multiple of the sector size)
+     * @return true if erased, false on a storage error
+     */
+    virtual bool erase(uint32_t offset) = 0;
+
+    /**
+     * @brief Make the writes so far durable
+     * @return true if synced, false on a storage error
+     */
+    virtual bool sync() { return true; }
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * @class PZEMOutboxPartitionStore
+ * @brief Outbox store on a raw data partition of the ESP32 flash
+ *
+ * Add a data partition to the partition table, e.g.
+ * `outbox, data, 0x40, , 0x100000` for 1 MB (256 sectors of 4 KB).
+ */
+class PZEMOutboxPartitionStore : public PZEMOutboxStore {
+public:
+    /**
+     * @brief Constructor
+     */
+    PZEMOutboxPartitionStore();
+
+    /**
+     * @brief Find the partition
+     * @param label Label of the data partition in the partition table
+     * @return true if found, false otherwise
+     */
+    bool begin(const char* label);
+
+    uint32_t getSize() const;
+    uint32_t getSectorSize() const;
+    bool read(uint32_t offset, void* data, uint32_t length);
+    bool write(uint32_t offset, const void* data, uint32_t length);
+    bool erase(uint32_t offset);
+
+private:
+    const esp_partition_t* _partition;          ///< Data partition (NULL before begin())
+};
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+/**
+ * @class PZEMOutboxFileStore
+ * @brief Outbox store in a preallocated file of a filesystem (SD, LittleFS, SPIFFS)
+ */
+class PZEMOutboxFileStore : public PZEMOutboxStore {
+public:
+    /**
+     * @brief Constructor
+     * @param fs Mounted filesystem (e.g. SD, LittleFS)
+     * @param path File path, e.g. "/outbox.bin"
+     * @param size File size in bytes (rounded down to whole sectors)
+     * @param sectorSize Erase unit in bytes (default: 4096)
+     */
+    PZEMOutboxFileStore(fs::FS& fs, const char* path, uint32_t size, uint32_t sectorSize = 4096);
+
+    /**
+     * @brief Open the file, creating it filled with 0xFF if it is missing or short
+     * @return true if the file is ready, false otherwise
+     */
+    bool begin();
+
+    uint32_t getSize() const;
+    uint32_t getSectorSize() const;
+    bool read(uint32_t offset, void* data, uint32_t length);
+    bool write(uint32_t offset, const void* data, uint32_t length);
+    bool erase(uint32_t offset);
+    bool sync();
+
+private:
+    fs::FS& _fs;                                ///< Filesystem
+    const char* _path;                          ///< File path
+    uint32_t _size;                             ///< Usable size in bytes
+    uint32_t _sectorSize;                       ///< Erase unit in bytes
+    fs::File _file;                             ///< Open file (after begin())
+};
+#endif
+
+/**
+ * @struct PZEMOutboxBatch
+ * @brief Description of a batch taken from the outbox
+ */
+struct PZEMOutboxBatch {
+    uint32_t firstSeq;        ///< Sequence number of the first record
+    uint32_t nextSeq;         ///< Sequence number after the last record (pass to commit() once delivered)
+    uint16_t count;           ///< Records in the batch
+    uint32_t length;          ///< Encoded length in bytes
+    uint32_t rawLength;       ///< Payload bytes before coding
+    bool backfill;            ///< Batch of the backlog of a split cursor, charged to the backfill rate
+};
+
+/**
+ * @struct PZEMOutboxRecord
+ * @brief One record decoded from a batch
+ */
+struct PZEMOutboxRecord {
+    uint32_t seq;             ///< Sequence number
+    uint8_t type;             ///< Record type (PZEM_OUTBOX_RECORD_*)
+    uint16_t length;          ///< Payload length in bytes
+    const uint8_t* data;      ///< Payload (valid until the next call to the decoder)
+};
+
+/**
+ * @struct PZEMOutboxCursor
+ * @brief Position of a consumer cursor
+ *
+ * Delivered records are those before next, plus those from liveStart up to
+ * live while the cursor is split.
+ */
+struct PZEMOutboxCursor {
+    uint32_t next;            ///< Oldest record not delivered (backlog position)
+    uint32_t liveStart;       ///< First live record (equal to next unless the cursor is split)
+    uint32_t live;            ///< Next live record to deliver (equal to next unless the cursor is split)
+};
+
+/**
+ * @struct PZEMOutboxStats
+ * @brief Counters of an outbox
+ */
+struct PZEMOutboxStats {
+    uint32_t headSeq;         ///< Sequence number of the next record appended
+    uint32_t tailSeq;         ///< Sequence number of the oldest record stored
+    uint32_t usedBytes;       ///< Bytes of the sectors in use
+    uint32_t capacityBytes;   ///< Size of the store
+    uint32_t appended;        ///< Records appended since begin()
+    uint32_t dropped;         ///< Records erased before every cursor had them acknowledged
+    uint32_t erases;          ///< Sectors erased
+    uint32_t rateLimited;     ///< takeBatch() calls that held the backlog back for the backfill rate
+    uint32_t storeErrors;     ///< Failed store operations
+};
+
+/**
+ * @class PZEMOutboxCodec
+ * @brief Reference payloads shared by the batch encoder and decoder
+ *
+ * Each record is coded against the last record with the same type, length
+ * and first two payload bytes (slave address and model for a snapshot). Both
+ * sides update the slots the same way, so the decoder rebuilds the references
+ * from the batch alone.
+ */
+class PZEMOutboxCodec {
+public:
+    /**
+     * @brief Constructor, no references
+     */
+    PZEMOutboxCodec();
+
+    /**
+     * @brief Forget every reference (start of a batch)
+     */
+    void reset();
+
+    /**
+     * @brief Find the reference of a record
+     * @param type Record type
+     * @param data Payload
+     * @param length Payload length
+     * @return Slot index, or 0xFF if there is none
+     */
+    uint8_t find(uint8_t type, const uint8_t* data, uint16_t length) const;
+
+    /**
+     * @brief Get the payload of a slot
+     * @param slot Slot index
+     * @return Payload of the slot
+     */
+    const uint8_t* get(uint8_t slot) const;
+
+    /**
+     * @brief Make a record the reference of its kind
+     * @param slot Slot returned by find() for the record, or 0xFF to take a new one
+     * @param type Record type
+     * @param data Payload
+     * @param length Payload length
+     */
+    void remember(uint8_t slot, uint8_t type, const uint8_t* data, uint16_t length);
+
+private:
+    uint8_t _type[PZEM_OUTBOX_CODEC_SLOTS];     ///< Record type of each slot (0 if free)
+    uint16_t _length[PZEM_OUTBOX_CODEC_SLOTS];  ///< Payload length of each slot
+    uint8_t _data[PZEM_OUTBOX_CODEC_SLOTS][PZEM_OUTBOX_MAX_RECORD];  ///< Reference payloads
+    uint8_t _next;                              ///< Slot taken by the next new kind (round robin)
+};
+
+/**
+ * @class PZEMOutbox
+ * @brief Durable circular log of records with persistent consumer cursors
+ *
+ * Call the methods from one task. Appends are not synced individually; call
+ * sync() at the rate the application can afford to lose (commits are synced).
+ */
+class PZEMOutbox {
+public:
+    /**
+     * @brief Constructor
+     */
+    PZEMOutbox();
+
+    /**
+     * @brief Mount the log of a store, or start an empty one
+     * @param store Store (must outlive the outbox)
+     * @return true if mounted, false if the store geometry is not supported or cannot be read
+     * @note The store needs 2 to PZEM_OUTBOX_MAX_SECTORS sectors of 256 bytes to 64 KB.
+     */
+    bool begin(PZEMOutboxStore* store);
+
+    /**
+     * @brief Erase the whole store: every record and cursor is lost
+     * @return true if erased, false on a storage error
+     */
+    bool format();
+
+    /**
+     * @brief Append an application record
+     * @param data Payload
+     * @param length Payload length (at most PZEM_OUTBOX_MAX_RECORD)
+     * @return true if stored, false if too long or on a storage error
+     */
+    bool append(const void* data, uint16_t length);
+
+    /**
+     * @brief Append a snapshot
+     * @param snapshot Snapshot from PZEMBus
+     * @param epoch Unix time of the reading in seconds, 0 if the clock is not set (default: 0)
+     * @return true if stored, false on a storage error
+     */
+    bool appendSnapshot(const PZEMSnapshot* snapshot, uint32_t epoch = 0);
+
+    /**
+     * @brief Open a consumer cursor
+     * @param id Cursor identifier (0 to PZEM_OUTBOX_MAX_CURSORS - 1)
+     * @return true if open, false on an invalid identifier or a storage error
+     * @note A cursor stays open across reboots; a new one starts at the oldest record stored.
+     */
+    bool openCursor(uint8_t id);
+
+    /**
+     * @brief Close a consumer cursor for good
+     * @param id Cursor identifier
+     * @return true if closed, false on an invalid identifier or a storage error
+     */
+    bool closeCursor(uint8_t id);
+
+    /**
+     * @brief Encode the next records of a cursor into a batch
+     * @param id Cursor identifier
+     * @param out Buffer receiving the batch
+     * @param size Buffer size (at least PZEM_OUTBOX_MIN_BATCH)
+     * @param batch Receives the description of the batch
+     * @return true if a batch was encoded, false if the cursor is caught up, the backfill rate
+     *         holds the backlog back, or on an error
+     * @note Live records come first; the backlog of a split cursor is sent when no live record is
+     *       waiting. The cursor does not move: call commit() once the sink acknowledged the batch,
+     *       or take the same records again after a failure.
+     */
+    bool takeBatch(uint8_t id, uint8_t* out, uint32_t size, PZEMOutboxBatch* batch);
+
+    /**
+     * @brief Mark the records of a batch delivered and make the cursor durable
+     * @param id Cursor identifier
+     * @param batch Batch from takeBatch() that the sink acknowledged
+     * @return true if stored, false on an invalid cursor or a storage error
+     */
+    bool commit(uint8_t id, const PZEMOutboxBatch* batch);
+
+    /**
+     * @brief Move a cursor to a position, e.g. to send records again
+     * @param id Cursor identifier
+     * @param seq Sequence number of the next record to deliver
+     * @return true if stored, false on an invalid cursor or sequence number, or a storage error
+     * @note Every record from seq on is delivered again in order (a split cursor joins). A position
+     *       older than the oldest record stored means the oldest record.
+     */
+    bool rewind(uint8_t id, uint32_t seq);
+
+    /**
+     * @brief Limit the bandwidth of backfill batches
+     * @param bytesPerSecond Average rate in bytes per second, 0 for no limit (default)
+     * @param burstBytes Bucket depth (at least PZEM_OUTBOX_MIN_BATCH); a backfill batch goes out once
+     *        this many bytes, or the batch buffer size if smaller, are available
+     * @note Only backfill batches are charged; live batches are never limited.
+     */
+    void setBackfillRate(uint32_t bytesPerSecond, uint32_t burstBytes);
+
+    /**
+     * @brief Make the appends so far durable
+     * @return true if synced, false on a storage error
+     */
+    bool sync();
+
+    /**
+     * @brief Get the position of a cursor
+     * @param id Cursor identifier
+     * @param cursor Receives the position
+     * @return true if the cursor is open, false otherwise
+     */
+    bool getCursor(uint8_t id, PZEMOutboxCursor* cursor) const;
+
+    /**
+     * @brief Get the number of records a cursor has not delivered
+     * @param id Cursor identifier
+     * @return Backlog and live records not delivered, 0 if the cursor is not open
+     */
+    uint32_t getLag(uint8_t id) const;
+
+    /**
+     * @brief Get the counters
+     * @param stats Receives the counters
+     */
+    void getStats(PZEMOutboxStats* stats) const;
+
+    /**
+     * @brief Decode a snapshot record
+     * @param record Record from PZEMOutboxDecoder
+     * @param snapshot Receives the snapshot (timestamp is the millis of the producer)
+     * @param epoch Receives the Unix time of the reading, 0 if unknown (may be NULL)
+     * @return true if the record is a valid snapshot, false otherwise
+     */
+    static bool decodeSnapshot(const PZEMOutboxRecord* record, PZEMSnapshot* snapshot, uint32_t* epoch);
+
+private:
+    PZEMOutboxStore* _store;                    ///< Store (NULL before begin())
+    uint32_t _sectorSize;                       ///< Erase unit in bytes
+    uint16_t _sectorCount;                      ///< Sectors of the store
+    uint32_t _firstSeq[PZEM_OUTBOX_MAX_SECTORS];  ///< Sequence number of the first record of each sector in use
+    bool _empty;                                ///< No sector in use
+    uint16_t _tail;                             ///< Oldest sector in use
+    uint16_t _head;                             ///< Sector being appended to
+    uint32_t _sectorSeq;                        ///< Number of the head sector (increments per sector opened)
+    uint32_t _appendOffset;                     ///< Append position in the head sector
+    uint32_t _headSeq;                          ///< Sequence number of the next record
+    uint8_t _cursorMask;                        ///< Open cursors (bit per identifier)
+    uint32_t _cursor[PZEM_OUTBOX_MAX_CURSORS];  ///< Every record before it is delivered (backlog position)
+    uint32_t _liveStart[PZEM_OUTBOX_MAX_CURSORS];  ///< Start of the live records (== _cursor unless split)
+    uint32_t _live[PZEM_OUTBOX_MAX_CURSORS];    ///< Live records from _liveStart up to it are delivered
+    uint32_t _readSeq[PZEM_OUTBOX_MAX_CURSORS * 2];     ///< Record at the cached read position, 0xFFFFFFFF if none
+    uint16_t _readSector[PZEM_OUTBOX_MAX_CURSORS * 2];  ///< Sector of the cached read position
+    uint32_t _readOffset[PZEM_OUTBOX_MAX_CURSORS * 2];  ///< Offset of the cached read position
+    uint32_t _rate;                             ///< Backfill rate in bytes per second (0: no limit)
+    uint32_t _burst;                            ///< Token bucket depth in bytes
+    uint32_t _tokens;                           ///< Backfill bytes available
+    uint32_t _refillTime;                       ///< Last token refill (millis)
+    PZEMOutboxStats _stats;                     ///< Counters
+    PZEMOutboxCodec _codec;                     ///< Batch encoder references
+    uint8_t _record[PZEM_OUTBOX_MAX_RECORD + 12];  ///< Record being written or read (header and payload)
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Reset the state to an empty log
+     */
+    void clear();
+
+    /**
+     * @brief Scan the records of the head sector after a mount
+     */
+    void scanHead();
+
+    /**
+     * @brief Open the next sector, erasing the oldest one if the log is full
+     * @return true if opened, false on a storage error
+     */
+    bool openSector();
+
+    /**
+     * @brief Append a data record, opening a sector if the head sector is full
+     * @param type Record type (PZEM_OUTBOX_RECORD_*)
+     * @param data Payload
+     * @param length Payload length
+     * @return true if written, false on a storage error
+     */
+    bool appendRecord(uint8_t type, const void* data, uint16_t length);
+
+    /**
+     * @brief Write the position of a cursor (or its closing) to the log
+     * @param id Cursor identifier
+     * @return true if written, false on a storage error
+     */
+    bool writeCursor(uint8_t id);
+
+    /**
+     * @brief Write the record of an open cursor at the append position
+     * @param id Cursor identifier
+     * @return true if written, false on a storage error
+     */
+    bool putCursor(uint8_t id);
+
+    /**
+     * @brief Keep a cursor inside the stored records and join it once its backlog is delivered
+     * @param id Cursor identifier
+     */
+    void normalize(uint8_t id);
+
+    /**
+     * @brief Write a record that fits the head sector
+     * @param type Record type
+     * @param id Cursor identifier (cursor records) or 0
+     * @param seq Sequence number (data records) or cursor position
+     * @param data Payload
+     * @param length Payload length
+     * @return true if written, false on a storage error
+     */
+    bool putRecord(uint8_t type, uint8_t id, uint32_t seq, const void* data, uint16_t length);
+
+    /**
+     * @brief Read and check the header of a sector
+     * @param sector Sector
+     * @param sectorSeq Receives the number of the sector
+     * @param firstSeq Receives the sequence number of its first record
+     * @return true if the sector is in use, false if erased, corrupt or unreadable
+     */
+    bool readSectorHeader(uint16_t sector, uint32_t* sectorSeq, uint32_t* firstSeq);
+
+    /**
+     * @brief Read and check the record at a position into _record
+     * @param sector Sector
+     * @param offset Offset in the sector
+     * @param end Receives the offset after the record
+     * @return true if a valid record was read, false at the end of the sector's records
+     *         (erased space, a torn write or a read error)
+     */
+    bool readRecord(uint16_t sector, uint32_t offset, uint32_t* end);
+
+    /**
+     * @brief Find the sector and offset of a data record
+     * @param cache Read cache to use (2 per cursor: backlog, then live records)
+     * @param seq Sequence number
+     * @param sector Receives the sector
+     * @param offset Receives the offset
+     * @return true if found, false otherwise
+     */
+    bool locate(uint8_t cache, uint32_t seq, uint16_t* sector, uint32_t* offset);
+
+    /**
+     * @brief Get the sequence number of the oldest record stored
+     * @return Sequence number
+     */
+    uint32_t tailSeq() const;
+
+    /**
+     * @brief Add the backfill tokens earned since the last refill
+     */
+    void refill();
+
+    /** @} */
+};
+
+/**
+ * @class PZEMOutboxDecoder
+ * @brief Decoder of outbox batches, for the receiving side
+ */
+class PZEMOutboxDecoder {
+public:
+    /**
+     * @brief Constructor
+     */
+    PZEMOutboxDecoder();
+
+    /**
+     * @brief Start decoding a batch
+     * @param batch Encoded batch (must stay valid while decoding)
+     * @param length Batch length in bytes
+     * @return true if the batch header and checksum are valid, false otherwise
+     */
+    bool begin(const uint8_t* batch, uint32_t length);
+
+    /**
+     * @brief Decode the next record
+     * @param record Receives the record
+     * @return true if a record was decoded, false at the end of the batch or on malformed data
+     */
+    bool next(PZEMOutboxRecord* record);
+
+    /**
+     * @brief Get the sequence number of the first record
+     * @return Sequence number
+     */
+    uint32_t getFirstSeq() const;
+
+    /**
+     * @brief Get the number of records in the batch
+     * @return Record count
+     */
+    uint16_t getCount() const;
+
+private:
+    const uint8_t* _batch;                      ///< Batch being decoded
+    uint32_t _length;                           ///< Batch length without the checksum
+    uint32_t _position;                         ///< Decode position
+    uint32_t _firstSeq;                         ///< Sequence number of the first record
+    uint16_t _count;                            ///< Records in the batch
+    uint16_t _decoded;                          ///< Records decoded so far
+    PZEMOutboxCodec _codec;                     ///< Decoder references
+    uint8_t _payload[PZEM_OUTBOX_MAX_RECORD];   ///< Last decoded payload
+};
+
+#endif // PZEMOUTBOX_H
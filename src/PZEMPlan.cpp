@@ -0,0 +1,191 @@
+/**
+ * @file PZEMPlan.cpp
+ * @brief Implementation of the plan scheduler
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMPlan.h"
+#include "ModbusProtocol.h"
+
+/**
+ * @brief Constructor for a plan scheduler
+ */
+PZEMPlanScheduler::PZEMPlanScheduler(PZEMBus& bus, const PZEMPlan& plan)
+    : _bus(bus), _plan(plan), _started(false), _busy(false), _waiting(false), _timeout(0), _reads(0),
+      _overruns(0), _cadence(NULL), _onRead(NULL), _onReadContext(NULL) {
+}
+
+/**
+ * @brief Check the plan and start its reads
+ *
+ * The tables are generated, but they live in the firmware source and can be
+ * edited by hand: a read that would overflow the response buffer or send a
+ * frame with a wrong CRC is refused here rather than on the wire.
+ */
+bool PZEMPlanScheduler::begin() {
+    _started = false;
+    if (_plan.count > PZEM_PLAN_MAX_READS || (_plan.count > 0 && _plan.reads == NULL)) {
+        return false;
+    }
+    for (uint16_t i = 0; i < _plan.count; i++) {
+        const PZEMPlanRead& read = _plan.reads[i];
+        uint8_t frame[PZEM_PLAN_REQUEST_SIZE];
+        modbusBuildReadRequest(frame, read.slaveAddr, read.function, read.startAddr, read.numRegs);
+        if (read.numRegs == 0 || read.numRegs > PZEM_PLAN_MAX_SPAN || read.periodMs == 0 ||
+            memcmp(frame, read.request, PZEM_PLAN_REQUEST_SIZE) != 0) {
+            return false;
+        }
+    }
+
+    uint32_t now = millis();
+    for (uint16_t i = 0; i < _plan.count; i++) {
+        _due[i] = now + _plan.reads[i].phaseMs;
+    }
+    _started = true;
+    trackAll();
+    return true;
+}
+
+/**
+ * @brief Set the response timeout of every read
+ */
+void PZEMPlanScheduler::setTimeout(uint32_t timeoutMs) {
+    _timeout = timeoutMs;
+}
+
+/**
+ * @brief Set callback receiving every read
+ */
+void PZEMPlanScheduler::setReadCallback(PZEMFieldReadCallback callback, void* context) {
+    _onRead = callback;
+    _onReadContext = context;
+}
+
+/**
+ * @brief Record the achieved cadence of every read of the plan
+ */
+void PZEMPlanScheduler::setCadence(PZEMCadence* cadence) {
+    _cadence = cadence;
+    trackAll();
+}
+
+/**
+ * @brief Send the due reads and advance the bus within a time budget
+ */
+bool PZEMPlanScheduler::poll(uint32_t budgetUs) {
+    if (!_busy) {
+        startNext();
+    } else if (_waiting) {
+        _waiting = !_bus.submit(&_txn);
+    }
+    return _bus.poll(budgetUs);
+}
+
+/**
+ * @brief Get number of reads completed
+ */
+uint32_t PZEMPlanScheduler::getReadCount() const {
+    return _reads;
+}
+
+/**
+ * @brief Get number of times a read came due before it was sent
+ */
+uint32_t PZEMPlanScheduler::getOverrunCount() const {
+    return _overruns;
+}
+
+/**
+ * @brief Start the earliest due read
+ *
+ * One pass over the due times. The next due time of the read is anchored to
+ * its phase; periods that already went by are skipped and counted.
+ */
+bool PZEMPlanScheduler::startNext() {
+    if (!_started) {
+        return false;
+    }
+    uint32_t now = millis();
+    uint16_t next = _plan.count;
+    int32_t latest = -1;
+    for (uint16_t i = 0; i < _plan.count; i++) {
+        int32_t late = (int32_t)(now - _due[i]);
+        if (late > latest) {
+            latest = late;
+            next = i;
+        }
+    }
+    if (next == _plan.count) {
+        return false;
+    }
+
+    const PZEMPlanRead& read = _plan.reads[next];
+    _due[next] += read.periodMs;
+    while ((int32_t)(now - _due[next]) >= 0) {
+        _due[next] += read.periodMs;
+        _overruns++;
+    }
+
+    _read.slaveAddr = read.slaveAddr;
+    _read.function = read.function;
+    _read.startAddr = read.startAddr;
+    _read.numRegs = read.numRegs;
+    _read.subscriptions = 1;
+    _read.success = false;
+    _read.timestamp = 0;
+    _txn.prepare(read.request, PZEM_PLAN_REQUEST_SIZE, _response, sizeof(_response),
+                 modbusReadResponseLength(read.numRegs), _timeout != 0 ? _timeout : read.timeoutMs);
+    _txn.onComplete = onComplete;
+    _txn.context = this;
+    _busy = true;
+    // The bus takes a bounded number of application transactions; retry on the next poll
+    _waiting = !_bus.submit(&_txn);
+    return true;
+}
+
+/**
+ * @brief Track every read of the plan in the cadence tracker
+ */
+void PZEMPlanScheduler::trackAll() {
+    if (_cadence == NULL || !_started) {
+        return;
+    }
+    for (uint16_t i = 0; i < _plan.count; i++) {
+        const PZEMPlanRead& read = _plan.reads[i];
+        _cadence->track(read.slaveAddr, read.function, read.startAddr, read.numRegs, read.periodMs);
+    }
+}
+
+/**
+ * @brief Read completion callback
+ */
+void PZEMPlanScheduler::onComplete(ModbusTransaction* txn, void* context) {
+    PZEMPlanScheduler* scheduler = static_cast<PZEMPlanScheduler*>(context);
+    PZEMFieldRead& read = scheduler->_read;
+
+    read.success = txn->status == MODBUS_TRANSACTION_OK && scheduler->_response[2] == read.numRegs * 2;
+    read.timestamp = millis();
+    PZEMRegisterCache* cache = scheduler->_bus.getRegisterCache();
+    if (read.success && cache != NULL) {
+        uint16_t raw[PZEM_PLAN_MAX_SPAN];
+        for (uint16_t i = 0; i < read.numRegs; i++) {
+            raw[i] = (scheduler->_response[3 + i * 2] << 8) | scheduler->_response[4 + i * 2];
+        }
+        cache->store(read.slaveAddr, read.function, read.startAddr, read.numRegs, raw, read.timestamp);
+    }
+    if (read.success && scheduler->_cadence != NULL) {
+        scheduler->_cadence->record(read.slaveAddr, read.function, read.startAddr, read.numRegs, read.timestamp);
+    }
+    scheduler->_reads++;
+    scheduler->_busy = false;
+
+    if (scheduler->_onRead != NULL) {
+        scheduler->_onRead(&read, scheduler->_onReadContext);
+    }
+
+    // Keep the bus busy without waiting for the next poll
+    if (!scheduler->_busy) {
+        scheduler->startNext();
+    }
+}
@@ -0,0 +1,173 @@
+/**
+ * @file PZEMPlan.h
+ * @brief Polling plans compiled offline, walked by a table-driven scheduler
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * In a fixed installation the meters, their models and the rates of their
+ * fields never change, so the polling plan can be worked out once on the
+ * host. extras/pzemplan reads a device manifest, merges the fields of each
+ * device into read spans and staggers the reads on the bus with a wire-time
+ * model, then writes a header holding the plan as constexpr tables: one
+ * PZEMPlanRead per read, with its request frame and CRC. PZEMPlanScheduler
+ * walks that table: no planning, no frame building and no allocation at run
+ * time, and its RAM is one due time per read plus one response buffer.
+ */
+
+#ifndef PZEMPLAN_H
+#define PZEMPLAN_H
+
+#include <Arduino.h>
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+#include "PZEMScheduler.h"
+
+/**
+ * @defgroup PZEMPlanConfig Plan Scheduler Configuration
+ * @brief Compile-time sizing of the plan scheduler (override before including)
+ * @{
+ */
+#ifndef PZEM_PLAN_MAX_READS
+#define PZEM_PLAN_MAX_READS     32    ///< Largest plan (one due time of 4 bytes each)
+#endif
+#define PZEM_PLAN_REQUEST_SIZE  8     ///< Request frame of a read (address, function, start, count, CRC)
+#define PZEM_PLAN_MAX_SPAN      PZEM_SCHEDULER_MAX_SPAN  ///< Largest register span of a read
+/** @} */
+
+/**
+ * @struct PZEMPlanRead
+ * @brief One periodic read of a compiled plan
+ */
+struct PZEMPlanRead {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t function;         ///< MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+    uint16_t startAddr;       ///< First register
+    uint16_t numRegs;         ///< Registers (at most PZEM_PLAN_MAX_SPAN)
+    uint16_t timeoutMs;       ///< Response timeout (wire time, frame silence and device response time)
+    uint32_t periodMs;        ///< Read period
+    uint32_t phaseMs;         ///< First read after PZEMPlanScheduler::begin()
+    uint8_t request[PZEM_PLAN_REQUEST_SIZE];  ///< Request frame with its CRC
+};
+
+/**
+ * @struct PZEMPlan
+ * @brief A compiled plan: its reads and the bus it was compiled for
+ */
+struct PZEMPlan {
+    const PZEMPlanRead* reads;  ///< Reads, by phase
+    uint16_t count;             ///< Number of reads
+    uint32_t baudrate;          ///< Line speed of the wire-time model
+    uint16_t utilization;       ///< Planned bus occupancy in permille
+};
+
+/**
+ * @class PZEMPlanScheduler
+ * @brief Reads the register spans of a compiled plan, each at its period and phase
+ *
+ * Due times are anchored to begin(): a late read does not shift the next
+ * one. When several reads are due, the earliest goes first; a read due again
+ * before it was sent is counted as an overrun and sent once. Results go to the
+ * register cache of the bus and to the read callback, like PZEMScheduler
+ * reads. Use one or the other on a bus, not both.
+ */
+class PZEMPlanScheduler {
+public:
+    /**
+     * @brief Constructor for a plan scheduler
+     * @param bus Bus carrying the reads (its register cache receives the values)
+     * @param plan Compiled plan (kept by reference, typically a constexpr table)
+     */
+    PZEMPlanScheduler(PZEMBus& bus, const PZEMPlan& plan);
+
+    /**
+     * @brief Check the plan and start its reads
+     * @return true if started, false if the plan holds more than PZEM_PLAN_MAX_READS reads or a
+     *         read is malformed (span, period or request frame CRC)
+     * @note Call again to restart the phases, e.g. after a long pause of the bus.
+     */
+    bool begin();
+
+    /**
+     * @brief Set the response timeout of every read, overriding the plan
+     * @param timeoutMs Response timeout in milliseconds, or 0 for the timeouts of the plan
+     */
+    void setTimeout(uint32_t timeoutMs);
+
+    /**
+     * @brief Set callback receiving every read
+     * @param callback Callback, or NULL to disable
+     * @param context User context passed to the callback
+     */
+    void setReadCallback(PZEMFieldReadCallback callback, void* context);
+
+    /**
+     * @brief Record the achieved cadence of every read of the plan
+     * @param cadence Cadence tracker, or NULL to disable
+     * @note Each read is tracked at its period once begin() succeeded.
+     */
+    void setCadence(PZEMCadence* cadence);
+
+    /**
+     * @brief Send the due reads and advance the bus within a time budget (replaces PZEMBus::poll())
+     * @param budgetUs Maximum time to spend in microseconds
+     * @return true if transactions are still in flight, false if the bus is idle
+     */
+    bool poll(uint32_t budgetUs);
+
+    /**
+     * @brief Get number of reads completed
+     * @return Reads since construction
+     */
+    uint32_t getReadCount() const;
+
+    /**
+     * @brief Get number of times a read came due before it was sent
+     * @return Overruns since construction (the bus does not keep up with the plan)
+     */
+    uint32_t getOverrunCount() const;
+
+private:
+    PZEMBus& _bus;                                  ///< Bus carrying the reads
+    const PZEMPlan& _plan;                          ///< Compiled plan
+    uint32_t _due[PZEM_PLAN_MAX_READS];             ///< Next due time of each read (millis)
+    bool _started;                                  ///< begin() succeeded
+    bool _busy;                                     ///< A read is in flight or waiting for the bus
+    bool _waiting;                                  ///< Not accepted by the bus yet
+    uint32_t _timeout;                              ///< Timeout override (0 = plan timeouts)
+    uint32_t _reads;                                ///< Completed reads
+    uint32_t _overruns;                             ///< Reads due again before they were sent
+    PZEMCadence* _cadence;                          ///< Cadence tracker (NULL if not used)
+    PZEMFieldReadCallback _onRead;                  ///< Read callback (NULL if not used)
+    void* _onReadContext;                           ///< Read callback context
+    PZEMFieldRead _read;                            ///< Read in flight, as reported
+    ModbusTransaction _txn;                         ///< Transaction in flight
+    uint8_t _response[5 + PZEM_PLAN_MAX_SPAN * 2];  ///< Response frame
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Start the earliest due read
+     * @return true if a read was started
+     */
+    bool startNext();
+
+    /**
+     * @brief Track every read of the plan in the cadence tracker
+     */
+    void trackAll();
+
+    /**
+     * @brief Read completion callback
+     * @param txn Completed transaction
+     * @param context Owning scheduler
+     */
+    static void onComplete(ModbusTransaction* txn, void* context);
+
+    /** @} */
+};
+
+#endif // PZEMPLAN_H
@@ -0,0 +1,306 @@
+/**
+ * @file PZEMRegisterCache.cpp
+ * @brief Implementation of the per-device Modbus register cache
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMRegisterCache.h"
+#include "ModbusProtocol.h"
+#include <string.h>
+
+/**
+ * @brief Constructor, creates an empty cache
+ */
+PZEMRegisterCache::PZEMRegisterCache() {
+    clear();
+    memset(_subscriptions, 0, sizeof(_subscriptions));
+}
+
+/**
+ * @brief Record registers read from a device
+ *
+ * The sequence counter is made odd before the image is modified and even again
+ * afterwards, so concurrent readers can detect a torn read and retry. Registers
+ * whose value differs from the image, or that were not cached yet, are flagged
+ * in the overlapping subscriptions.
+ */
+bool PZEMRegisterCache::store(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, const uint16_t* data, uint32_t timestamp) {
+    if (slaveAddr == 0 || !fits(function, startAddr, numRegs)) {
+        return false;
+    }
+
+    // Find the device image, or claim a free slot for it
+    Image* image = (Image*)find(slaveAddr);
+    if (image == NULL) {
+        for (uint8_t i = 0; i < PZEM_CACHE_MAX_DEVICES; i++) {
+            if (_images[i].slaveAddr == 0) {
+                image = &_images[i];
+                break;
+            }
+        }
+        if (image == NULL) {
+            return false; // Cache full
+        }
+    }
+
+    __atomic_store_n(&image->sequence, image->sequence + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (image->slaveAddr != slaveAddr) {
+        memset(image->inputValid, 0, sizeof(image->inputValid));
+        image->holdingValid = 0;
+        image->slaveAddr = slaveAddr;
+    }
+
+    for (uint16_t i = 0; i < numRegs; i++) {
+        uint16_t reg = startAddr + i;
+        bool changed;
+        if (function == MODBUS_READ_INPUT_REGISTERS) {
+            uint32_t bit = (uint32_t)1 << (reg % 32);
+            changed = !(image->inputValid[reg / 32] & bit) || image->input[reg] != data[i];
+            image->input[reg] = data[i];
+            image->inputAt[reg] = timestamp;
+            image->inputValid[reg / 32] |= bit;
+        } else {
+            uint32_t bit = (uint32_t)1 << reg;
+            changed = !(image->holdingValid & bit) || image->holding[reg] != data[i];
+            image->holding[reg] = data[i];
+            image->holdingAt[reg] = timestamp;
+            image->holdingValid |= bit;
+        }
+        if (changed) {
+            markChanged(slaveAddr, function, reg);
+        }
+    }
+    image->updatedAt = timestamp;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&image->sequence, image->sequence + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Read cached registers of a device
+ *
+ * Registers are stored by reads of different ranges and periods, so the age
+ * of the values is that of the least recently stored register, not the time
+ * of the last update of the device.
+ */
+bool PZEMRegisterCache::read(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint16_t* data,
+                             uint32_t* updatedAt) const {
+    if (!fits(function, startAddr, numRegs)) {
+        return false;
+    }
+
+    const Image* image = find(slaveAddr);
+    if (image == NULL) {
+        return false;
+    }
+
+    uint32_t before;
+    bool complete = false;
+    uint32_t oldest = 0;
+    do {
+        before = __atomic_load_n(&image->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue; // Update in progress
+        }
+
+        complete = (image->slaveAddr == slaveAddr);
+        for (uint16_t i = 0; i < numRegs && complete; i++) {
+            uint16_t reg = startAddr + i;
+            uint32_t at;
+            if (function == MODBUS_READ_INPUT_REGISTERS) {
+                complete = (image->inputValid[reg / 32] >> (reg % 32)) & 1;
+                data[i] = image->input[reg];
+                at = image->inputAt[reg];
+            } else {
+                complete = (image->holdingValid >> reg) & 1;
+                data[i] = image->holding[reg];
+                at = image->holdingAt[reg];
+            }
+            // Oldest in wrap-around order (millis() timestamps)
+            if (i == 0 || (int32_t)(at - oldest) < 0) {
+                oldest = at;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while ((before & 1) || __atomic_load_n(&image->sequence, __ATOMIC_ACQUIRE) != before);
+
+    if (updatedAt != NULL) {
+        *updatedAt = oldest;
+    }
+    return complete;
+}
+
+/**
+ * @brief Check whether a device has at least one cached register
+ */
+bool PZEMRegisterCache::contains(uint8_t slaveAddr) const {
+    return find(slaveAddr) != NULL;
+}
+
+/**
+ * @brief Get the time of the last update of a device
+ */
+uint32_t PZEMRegisterCache::getUpdateTime(uint8_t slaveAddr) const {
+    const Image* image = find(slaveAddr);
+    if (image == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&image->updatedAt, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Drop all cached registers of a device
+ */
+void PZEMRegisterCache::remove(uint8_t slaveAddr) {
+    Image* image = (Image*)find(slaveAddr);
+    if (image != NULL) {
+        __atomic_store_n(&image->sequence, image->sequence + 1, __ATOMIC_RELEASE);
+        image->slaveAddr = 0;
+        __atomic_store_n(&image->sequence, image->sequence + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Drop all cached registers of all devices
+ */
+void PZEMRegisterCache::clear() {
+    memset(_images, 0, sizeof(_images));
+}
+
+/**
+ * @brief Subscribe to changes of a register range
+ */
+int8_t PZEMRegisterCache::subscribe(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                                    PZEMRegisterChangeCallback callback, void* context) {
+    if (slaveAddr == 0 || !fits(function, startAddr, numRegs)) {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < PZEM_CACHE_MAX_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subscriptions[i];
+        if (sub.used) {
+            continue;
+        }
+        sub.slaveAddr = slaveAddr;
+        sub.function = function;
+        sub.startAddr = startAddr;
+        sub.numRegs = numRegs;
+        memset(sub.changed, 0, sizeof(sub.changed));
+        sub.callback = callback;
+        sub.context = context;
+
+        // Registers already cached count as changed for a new consumer
+        const Image* image = find(slaveAddr);
+        for (uint16_t r = 0; image != NULL && r < numRegs; r++) {
+            uint16_t reg = startAddr + r;
+            bool valid = function == MODBUS_READ_INPUT_REGISTERS ? (image->inputValid[reg / 32] >> (reg % 32)) & 1
+                                                                  : (image->holdingValid >> reg) & 1;
+            if (valid) {
+                sub.changed[r / 32] |= (uint32_t)1 << (r % 32);
+            }
+        }
+        __atomic_store_n(&sub.used, true, __ATOMIC_RELEASE);
+        return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Cancel a subscription
+ */
+bool PZEMRegisterCache::unsubscribe(int8_t id) {
+    if (id < 0 || id >= PZEM_CACHE_MAX_SUBSCRIPTIONS || !_subscriptions[id].used) {
+        return false;
+    }
+    __atomic_store_n(&_subscriptions[id].used, false, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Collect the changes of a subscription since its last visit
+ */
+bool PZEMRegisterCache::takeChanges(int8_t id, PZEMRegisterChange* change) {
+    if (id < 0 || id >= PZEM_CACHE_MAX_SUBSCRIPTIONS || !__atomic_load_n(&_subscriptions[id].used, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    Subscription& sub = _subscriptions[id];
+    change->slaveAddr = sub.slaveAddr;
+    change->function = sub.function;
+    change->startAddr = sub.startAddr;
+    change->numRegs = sub.numRegs;
+    bool any = false;
+    for (uint8_t w = 0; w < PZEM_CACHE_INPUT_REGISTERS / 32; w++) {
+        // Flags raised by a concurrent store() after the exchange are kept for the next visit
+        change->changed[w] = __atomic_exchange_n(&sub.changed[w], 0, __ATOMIC_ACQ_REL);
+        any = any || change->changed[w] != 0;
+    }
+    return any;
+}
+
+/**
+ * @brief Call the callback of every subscription with pending changes
+ */
+uint8_t PZEMRegisterCache::dispatch() {
+    uint8_t calls = 0;
+    PZEMRegisterChange change;
+    for (uint8_t i = 0; i < PZEM_CACHE_MAX_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subscriptions[i];
+        if (sub.callback != NULL && takeChanges(i, &change)) {
+            sub.callback(&change, sub.context);
+            calls++;
+        }
+    }
+    return calls;
+}
+
+/**
+ * @brief Flag a changed register in every overlapping subscription
+ */
+void PZEMRegisterCache::markChanged(uint8_t slaveAddr, uint8_t function, uint16_t reg) {
+    for (uint8_t i = 0; i < PZEM_CACHE_MAX_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subscriptions[i];
+        if (!__atomic_load_n(&sub.used, __ATOMIC_ACQUIRE) || sub.slaveAddr != slaveAddr || sub.function != function ||
+            reg < sub.startAddr || reg >= sub.startAddr + sub.numRegs) {
+            continue;
+        }
+        uint16_t bit = reg - sub.startAddr;
+        __atomic_fetch_or(&sub.changed[bit / 32], (uint32_t)1 << (bit % 32), __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Find the image of a device
+ */
+const PZEMRegisterCache::Image* PZEMRegisterCache::find(uint8_t slaveAddr) const {
+    if (slaveAddr == 0) {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < PZEM_CACHE_MAX_DEVICES; i++) {
+        if (_images[i].slaveAddr == slaveAddr) {
+            return &_images[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check a register range against the cache layout
+ */
+bool PZEMRegisterCache::fits(uint8_t function, uint16_t startAddr, uint16_t numRegs) {
+    if (numRegs == 0) {
+        return false;
+    }
+    if (function == MODBUS_READ_INPUT_REGISTERS) {
+        return (uint32_t)startAddr + numRegs <= PZEM_CACHE_INPUT_REGISTERS;
+    }
+    if (function == MODBUS_READ_HOLDING_REGISTERS) {
+        return (uint32_t)startAddr + numRegs <= PZEM_CACHE_HOLDING_REGISTERS;
+    }
+    return false;
+}
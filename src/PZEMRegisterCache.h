@@ -0,0 +1,224 @@
+/**
+ * @file PZEMRegisterCache.h
+ * @brief Per-device Modbus register cache shared between the poller and its consumers
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMREGISTERCACHE_H
+#define PZEMREGISTERCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup PZEMRegisterCacheLimits Register Cache Limits
+ * @brief Compile-time sizing of the register cache (override before including)
+ * @{
+ */
+#ifndef PZEM_CACHE_MAX_DEVICES
+#define PZEM_CACHE_MAX_DEVICES        8   ///< Maximum number of cached devices
+#endif
+#define PZEM_CACHE_INPUT_REGISTERS    64  ///< Input registers kept per device (PZEM-6L24 uses 0x0000-0x003F)
+#define PZEM_CACHE_HOLDING_REGISTERS  8   ///< Holding registers kept per device
+#ifndef PZEM_CACHE_MAX_SUBSCRIPTIONS
+#define PZEM_CACHE_MAX_SUBSCRIPTIONS  8   ///< Maximum number of change subscriptions
+#endif
+/** @} */
+
+/**
+ * @struct PZEMRegisterChange
+ * @brief Registers of a subscribed range that changed since the last visit
+ */
+struct PZEMRegisterChange {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t function;         ///< MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+    uint16_t startAddr;       ///< First register of the subscribed range
+    uint16_t numRegs;         ///< Registers in the subscribed range
+    uint32_t changed[PZEM_CACHE_INPUT_REGISTERS / 32];  ///< Bit i set: register startAddr + i changed
+};
+
+/**
+ * @brief Callback receiving the changes of a subscribed range
+ * @param change Changed registers (valid during the call only)
+ * @param context User context given to subscribe()
+ */
+typedef void (*PZEMRegisterChangeCallback)(const PZEMRegisterChange* change, void* context);
+
+/**
+ * @class PZEMRegisterCache
+ * @brief Fixed-size cache of the last raw register values read from each device
+ *
+ * Every successful register read can be recorded here (see RS485::setRegisterCache()),
+ * so that other consumers can be served without touching the bus. Values are stored
+ * in wire order (big endian, as transmitted), independent of the byte order used by
+ * the device class to decode them.
+ *
+ * A single writer (the polling code) and any number of readers are supported without
+ * locks: each device image carries a sequence counter that readers use to detect and
+ * retry a read that overlapped an update, so readers never delay the poller.
+ *
+ * Consumers can subscribe to register ranges. store() compares the new values
+ * with the image and flags the registers that actually changed (or became known)
+ * in every overlapping subscription; each consumer collects its own flags with
+ * takeChanges() or dispatch(), so work downstream is proportional to what changed
+ * since that consumer's last visit, not to the number of devices.
+ */
+class PZEMRegisterCache {
+public:
+    /**
+     * @brief Constructor, creates an empty cache
+     */
+    PZEMRegisterCache();
+
+    /**
+     * @brief Record registers read from a device
+     * @param slaveAddr Slave device address
+     * @param function Modbus function code (MODBUS_READ_HOLDING_REGISTERS or MODBUS_READ_INPUT_REGISTERS)
+     * @param startAddr Starting register address
+     * @param numRegs Number of registers
+     * @param data Register values in wire order
+     * @param timestamp Time of the read in milliseconds
+     * @return true if stored, false if the range does not fit or the cache is full
+     */
+    bool store(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, const uint16_t* data, uint32_t timestamp);
+
+    /**
+     * @brief Read cached registers of a device
+     * @param slaveAddr Slave device address
+     * @param function Modbus function code (MODBUS_READ_HOLDING_REGISTERS or MODBUS_READ_INPUT_REGISTERS)
+     * @param startAddr Starting register address
+     * @param numRegs Number of registers
+     * @param data Buffer receiving the register values in wire order
+     * @param updatedAt Receives the timestamp of the least recently stored register (NULL if not needed)
+     * @return true if every requested register has been cached, false otherwise
+     */
+    bool read(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint16_t* data,
+              uint32_t* updatedAt = NULL) const;
+
+    /**
+     * @brief Check whether a device has at least one cached register
+     * @param slaveAddr Slave device address
+     * @return true if the device is known to the cache
+     */
+    bool contains(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Get the time of the last update of a device
+     * @param slaveAddr Slave device address
+     * @return Timestamp passed to the last store() for this device, or 0 if unknown
+     */
+    uint32_t getUpdateTime(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Drop all cached registers of a device
+     * @param slaveAddr Slave device address
+     */
+    void remove(uint8_t slaveAddr);
+
+    /**
+     * @brief Drop all cached registers of all devices
+     */
+    void clear();
+
+    /**
+     * @brief Subscribe to changes of a register range
+     * @param slaveAddr Slave device address
+     * @param function MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+     * @param startAddr Starting register address
+     * @param numRegs Number of registers
+     * @param callback Callback called by dispatch(), or NULL to collect changes with takeChanges()
+     * @param context User context passed to the callback
+     * @return Subscription ID, or -1 if the range does not fit or the table is full
+     * @note Subscribe and unsubscribe from the writer's context (or before it starts).
+     */
+    int8_t subscribe(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs,
+                     PZEMRegisterChangeCallback callback, void* context);
+
+    /**
+     * @brief Cancel a subscription
+     * @param id Subscription ID returned by subscribe()
+     * @return true if cancelled, false if the ID is not in use
+     */
+    bool unsubscribe(int8_t id);
+
+    /**
+     * @brief Collect the changes of a subscription since its last visit
+     * @param id Subscription ID
+     * @param change Receives the range and the changed registers (flags are cleared)
+     * @return true if at least one register changed, false otherwise
+     */
+    bool takeChanges(int8_t id, PZEMRegisterChange* change);
+
+    /**
+     * @brief Call the callback of every subscription with pending changes
+     * @return Number of callbacks called
+     */
+    uint8_t dispatch();
+
+private:
+    /**
+     * @brief Cached register image of a single device
+     */
+    struct Image {
+        uint32_t sequence;                              ///< Odd while an update is in progress
+        uint8_t slaveAddr;                              ///< Slave address (0 = free slot)
+        uint32_t updatedAt;                             ///< Timestamp of last update
+        uint32_t inputValid[PZEM_CACHE_INPUT_REGISTERS / 32];  ///< Bitmap of cached input registers
+        uint32_t holdingValid;                          ///< Bitmap of cached holding registers
+        uint16_t input[PZEM_CACHE_INPUT_REGISTERS];     ///< Input register values
+        uint16_t holding[PZEM_CACHE_HOLDING_REGISTERS]; ///< Holding register values
+        uint32_t inputAt[PZEM_CACHE_INPUT_REGISTERS];   ///< Timestamp of each input register
+        uint32_t holdingAt[PZEM_CACHE_HOLDING_REGISTERS];  ///< Timestamp of each holding register
+    };
+
+    /**
+     * @brief Subscribed register range
+     */
+    struct Subscription {
+        bool used;                              ///< Entry in use
+        uint8_t slaveAddr;                      ///< Slave device address
+        uint8_t function;                       ///< Register table
+        uint16_t startAddr;                     ///< First register
+        uint16_t numRegs;                       ///< Registers in the range
+        uint32_t changed[PZEM_CACHE_INPUT_REGISTERS / 32];  ///< Changed registers (set by store(), cleared by the consumer)
+        PZEMRegisterChangeCallback callback;    ///< Callback (NULL if collected with takeChanges())
+        void* context;                          ///< Callback context
+    };
+
+    Image _images[PZEM_CACHE_MAX_DEVICES];  ///< Device images
+    Subscription _subscriptions[PZEM_CACHE_MAX_SUBSCRIPTIONS];  ///< Change subscriptions
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Find the image of a device
+     * @param slaveAddr Slave device address
+     * @return Pointer to the image, or NULL if not cached
+     */
+    const Image* find(uint8_t slaveAddr) const;
+
+    /**
+     * @brief Check a register range against the cache layout
+     * @param function Modbus function code
+     * @param startAddr Starting register address
+     * @param numRegs Number of registers
+     * @return true if the range fits the image for this function
+     */
+    static bool fits(uint8_t function, uint16_t startAddr, uint16_t numRegs);
+
+    /**
+     * @brief Flag a changed register in every overlapping subscription
+     * @param slaveAddr Slave device address
+     * @param function Register table
+     * @param reg Register address
+     */
+    void markChanged(uint8_t slaveAddr, uint8_t function, uint16_t reg);
+
+    /** @} */
+};
+
+#endif // PZEMREGISTERCACHE_H
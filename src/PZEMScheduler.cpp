@@ -0,0 +1,484 @@
+/**
+ * @file PZEMScheduler.cpp
+ * @brief Implementation of the subscription scheduler
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#include "PZEMScheduler.h"
+
+#define WHEEL_SLOTS (1 << PZEM_SCHEDULER_WHEEL_BITS)  ///< Slots per level
+#define WHEEL_MASK  (WHEEL_SLOTS - 1)                 ///< Slot index mask
+#define NO_ENTRY    0xFFFF                            ///< End of an entry list
+
+/**
+ * @brief Constructor for a subscription scheduler
+ */
+PZEMScheduler::PZEMScheduler(PZEMBus& bus)
+    : _bus(bus), _free(0), _count(0), _tick(0), _tickMs(millis()), _readyHead(0), _readyCount(0),
+      _timeout(PZEM_BUS_DEFAULT_TIMEOUT_MS), _reads(0), _overruns(0), _cadence(NULL), _onRead(NULL),
+      _onReadContext(NULL) {
+    for (uint16_t i = 0; i < PZEM_SCHEDULER_MAX_SUBSCRIPTIONS; i++) {
+        _entries[i].used = false;
+        _entries[i].queued = false;
+        _entries[i].track = PZEM_CADENCE_INVALID;
+        _entries[i].next = (i + 1 < PZEM_SCHEDULER_MAX_SUBSCRIPTIONS) ? i + 1 : NO_ENTRY;
+    }
+    for (uint8_t level = 0; level < PZEM_SCHEDULER_WHEEL_LEVELS; level++) {
+        for (uint8_t i = 0; i < WHEEL_SLOTS; i++) {
+            _wheel[level][i] = NO_ENTRY;
+        }
+    }
+    for (uint8_t i = 0; i < PZEM_SCHEDULER_MAX_DEVICES; i++) {
+        _devices[i].slaveAddr = 0;
+    }
+    for (uint8_t i = 0; i < PZEM_SCHEDULER_IN_FLIGHT; i++) {
+        _slots[i].scheduler = this;
+        _slots[i].busy = false;
+        _slots[i].waiting = false;
+    }
+}
+
+/**
+ * @brief Read a register range periodically
+ */
+int32_t PZEMScheduler::subscribe(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t periodMs) {
+    uint32_t period = (periodMs + PZEM_SCHEDULER_TICK_MS - 1) / PZEM_SCHEDULER_TICK_MS;
+    if (slaveAddr == 0 || slaveAddr > 247 || numRegs == 0 || numRegs > PZEM_SCHEDULER_MAX_SPAN ||
+        (uint32_t)startAddr + numRegs > 0x10000 || _free == NO_ENTRY ||
+        (function != MODBUS_READ_INPUT_REGISTERS && function != MODBUS_READ_HOLDING_REGISTERS) ||
+        period >= ((uint32_t)1 << (PZEM_SCHEDULER_WHEEL_BITS * PZEM_SCHEDULER_WHEEL_LEVELS))) {
+        return PZEM_SCHEDULER_INVALID;
+    }
+    if (period == 0) {
+        period = 1;
+    }
+
+    // Find the device, or claim a free entry for it
+    uint8_t device = PZEM_SCHEDULER_MAX_DEVICES;
+    for (uint8_t i = 0; i < PZEM_SCHEDULER_MAX_DEVICES; i++) {
+        if (_devices[i].slaveAddr == slaveAddr) {
+            device = i;
+            break;
+        }
+        if (_devices[i].slaveAddr == 0 && device == PZEM_SCHEDULER_MAX_DEVICES) {
+            device = i;
+        }
+    }
+    if (device == PZEM_SCHEDULER_MAX_DEVICES) {
+        return PZEM_SCHEDULER_INVALID;
+    }
+    if (_devices[device].slaveAddr == 0) {
+        _devices[device].slaveAddr = slaveAddr;
+        _devices[device].subscriptions = 0;
+        _devices[device].dueHead = NO_ENTRY;
+        _devices[device].dueTail = NO_ENTRY;
+        _devices[device].ready = false;
+    }
+
+    uint16_t index = _free;
+    Entry& entry = _entries[index];
+    _free = entry.next;
+    entry.device = device;
+    entry.function = function;
+    entry.startAddr = startAddr;
+    entry.numRegs = numRegs;
+    entry.period = period;
+    entry.due = _tick;
+    entry.used = true;
+    entry.queued = false;
+    insert(index);
+    track(index);
+
+    _devices[device].subscriptions++;
+    _count++;
+    return index;
+}
+
+/**
+ * @brief Cancel a subscription
+ */
+bool PZEMScheduler::unsubscribe(int32_t id) {
+    if (id < 0 || id >= PZEM_SCHEDULER_MAX_SUBSCRIPTIONS || !_entries[id].used) {
+        return false;
+    }
+
+    Entry& entry = _entries[id];
+    unlink(id);
+    entry.used = false;
+    _count--;
+    _devices[entry.device].subscriptions--;
+
+    untrack(id);
+
+    // A queued entry is released when its device queue is next walked
+    if (!entry.queued) {
+        release(id);
+        releaseDevice(entry.device);
+    }
+    return true;
+}
+
+/**
+ * @brief Set the response timeout of the batched reads
+ */
+void PZEMScheduler::setTimeout(uint32_t timeoutMs) {
+    _timeout = timeoutMs;
+}
+
+/**
+ * @brief Set callback receiving every batched read
+ */
+void PZEMScheduler::setReadCallback(PZEMFieldReadCallback callback, void* context) {
+    _onRead = callback;
+    _onReadContext = context;
+}
+
+/**
+ * @brief Record the achieved cadence of every subscription
+ */
+void PZEMScheduler::setCadence(PZEMCadence* cadence) {
+    for (uint16_t i = 0; i < PZEM_SCHEDULER_MAX_SUBSCRIPTIONS; i++) {
+        untrack(i);
+    }
+    _cadence = cadence;
+    for (uint16_t i = 0; i < PZEM_SCHEDULER_MAX_SUBSCRIPTIONS; i++) {
+        if (_entries[i].used) {
+            track(i);
+        }
+    }
+}
+
+/**
+ * @brief Advance the scheduler and the bus within a time budget
+ */
+bool PZEMScheduler::poll(uint32_t budgetUs) {
+    advance();
+    for (uint8_t i = 0; i < PZEM_SCHEDULER_IN_FLIGHT; i++) {
+        Slot* slot = &_slots[i];
+        if (!slot->busy && buildNext(slot)) {
+            submit(slot);
+        } else if (slot->waiting) {
+            submit(slot);
+        }
+    }
+    return _bus.poll(budgetUs);
+}
+
+/**
+ * @brief Get number of subscriptions in use
+ */
+uint16_t PZEMScheduler::getSubscriptionCount() const {
+    return _count;
+}
+
+/**
+ * @brief Get number of batched reads completed
+ */
+uint32_t PZEMScheduler::getReadCount() const {
+    return _reads;
+}
+
+/**
+ * @brief Get number of times a subscription came due while still queued
+ */
+uint32_t PZEMScheduler::getOverrunCount() const {
+    return _overruns;
+}
+
+/**
+ * @brief Put an entry in the wheel slot of its due tick
+ *
+ * The level is chosen by the distance to the due tick: an entry due within 64
+ * ticks goes to level 0, within 64^2 ticks to level 1, and so on. Its slot at a
+ * coarse level is cascaded at the start of the block holding the due tick, so
+ * the entry always reaches level 0 before it is due.
+ */
+void PZEMScheduler::insert(uint16_t index) {
+    Entry& entry = _entries[index];
+    uint32_t delta = entry.due - _tick;
+    uint8_t level = 0;
+    uint8_t slot;
+    if ((int32_t)delta < 0) {
+        slot = _tick & WHEEL_MASK; // Overdue: next tick
+    } else {
+        while (level + 1 < PZEM_SCHEDULER_WHEEL_LEVELS && delta >= ((uint32_t)1 << (PZEM_SCHEDULER_WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+        slot = (entry.due >> (PZEM_SCHEDULER_WHEEL_BITS * level)) & WHEEL_MASK;
+    }
+
+    uint16_t& head = _wheel[level][slot];
+    entry.slot = level * WHEEL_SLOTS + slot;
+    entry.prev = NO_ENTRY;
+    entry.next = head;
+    if (head != NO_ENTRY) {
+        _entries[head].prev = index;
+    }
+    head = index;
+}
+
+/**
+ * @brief Take an entry out of its wheel slot
+ */
+void PZEMScheduler::unlink(uint16_t index) {
+    Entry& entry = _entries[index];
+    if (entry.prev != NO_ENTRY) {
+        _entries[entry.prev].next = entry.next;
+    } else {
+        _wheel[entry.slot / WHEEL_SLOTS][entry.slot % WHEEL_SLOTS] = entry.next;
+    }
+    if (entry.next != NO_ENTRY) {
+        _entries[entry.next].prev = entry.prev;
+    }
+}
+
+/**
+ * @brief Move the entries of a coarse slot to finer levels
+ */
+void PZEMScheduler::cascade(uint8_t level, uint8_t slot) {
+    uint16_t index = _wheel[level][slot];
+    _wheel[level][slot] = NO_ENTRY;
+    while (index != NO_ENTRY) {
+        uint16_t next = _entries[index].next;
+        insert(index);
+        index = next;
+    }
+}
+
+/**
+ * @brief Process the wheel up to the current time
+ */
+void PZEMScheduler::advance() {
+    uint32_t now = millis();
+    while ((int32_t)(now - _tickMs) >= 0) {
+        // Entering a new block of a level: bring its entries down, coarsest last
+        for (uint8_t level = 1; level < PZEM_SCHEDULER_WHEEL_LEVELS; level++) {
+            if ((_tick >> (PZEM_SCHEDULER_WHEEL_BITS * (level - 1))) & WHEEL_MASK) {
+                break;
+            }
+            cascade(level, (_tick >> (PZEM_SCHEDULER_WHEEL_BITS * level)) & WHEEL_MASK);
+        }
+
+        uint16_t& head = _wheel[0][_tick & WHEEL_MASK];
+        while (head != NO_ENTRY) {
+            uint16_t index = head;
+            unlink(index);
+            fire(index);
+        }
+
+        _tick++;
+        _tickMs += PZEM_SCHEDULER_TICK_MS;
+    }
+}
+
+/**
+ * @brief Queue a due entry on its device and schedule its next period
+ */
+void PZEMScheduler::fire(uint16_t index) {
+    Entry& entry = _entries[index];
+    Device& device = _devices[entry.device];
+
+    if (entry.queued) {
+        _overruns++;
+    } else {
+        entry.queued = true;
+        entry.dueNext = NO_ENTRY;
+        if (device.dueTail == NO_ENTRY) {
+            device.dueHead = index;
+        } else {
+            _entries[device.dueTail].dueNext = index;
+        }
+        device.dueTail = index;
+
+        if (!device.ready) {
+            device.ready = true;
+            _ready[(_readyHead + _readyCount) % PZEM_SCHEDULER_MAX_DEVICES] = entry.device;
+            _readyCount++;
+        }
+    }
+
+    entry.due += entry.period;
+    insert(index);
+}
+
+/**
+ * @brief Build the next batched read into a slot
+ *
+ * Devices take turns: the device at the head of the ready ring gets one read
+ * covering the first queued entry and every other queued entry of the same
+ * function that keeps the span within PZEM_SCHEDULER_MAX_SPAN. Entries left
+ * over wait for its next turn.
+ */
+bool PZEMScheduler::buildNext(Slot* slot) {
+    while (_readyCount > 0) {
+        uint8_t index = _ready[_readyHead];
+        _readyHead = (_readyHead + 1) % PZEM_SCHEDULER_MAX_DEVICES;
+        _readyCount--;
+        Device& device = _devices[index];
+        device.ready = false;
+
+        bool found = false;
+        uint8_t function = 0;
+        uint16_t start = 0;
+        uint32_t end = 0;
+        uint8_t served = 0;
+        uint16_t prev = NO_ENTRY;
+        uint16_t current = device.dueHead;
+        while (current != NO_ENTRY) {
+            Entry& entry = _entries[current];
+            uint16_t next = entry.dueNext;
+            bool take = !entry.used;
+            if (entry.used && !found) {
+                found = true;
+                function = entry.function;
+                start = entry.startAddr;
+                end = (uint32_t)entry.startAddr + entry.numRegs;
+                take = true;
+            } else if (entry.used && entry.function == function) {
+                uint16_t mergedStart = entry.startAddr < start ? entry.startAddr : start;
+                uint32_t entryEnd = (uint32_t)entry.startAddr + entry.numRegs;
+                uint32_t mergedEnd = entryEnd > end ? entryEnd : end;
+                if (mergedEnd - mergedStart <= PZEM_SCHEDULER_MAX_SPAN) {
+                    start = mergedStart;
+                    end = mergedEnd;
+                    take = true;
+                }
+            }
+
+            if (take) {
+                if (prev == NO_ENTRY) {
+                    device.dueHead = next;
+                } else {
+                    _entries[prev].dueNext = next;
+                }
+                if (device.dueTail == current) {
+                    device.dueTail = prev;
+                }
+                entry.queued = false;
+                if (entry.used) {
+                    served++;
+                } else {
+                    release(current);
+                }
+            } else {
+                prev = current;
+            }
+            current = next;
+        }
+
+        if (device.dueHead != NO_ENTRY) {
+            device.ready = true;
+            _ready[(_readyHead + _readyCount) % PZEM_SCHEDULER_MAX_DEVICES] = index;
+            _readyCount++;
+        }
+        if (!found) {
+            releaseDevice(index);
+            continue;
+        }
+
+        slot->read.slaveAddr = device.slaveAddr;
+        slot->read.function = function;
+        slot->read.startAddr = start;
+        slot->read.numRegs = end - start;
+        slot->read.subscriptions = served;
+        slot->read.success = false;
+        slot->read.timestamp = 0;
+        modbusBuildReadRequest(slot->request, device.slaveAddr, function, start, end - start);
+        slot->txn.prepare(slot->request, sizeof(slot->request), slot->response, sizeof(slot->response),
+                          modbusReadResponseLength(end - start),
+                          modbusWireTimeMs(modbusReadResponseLength(end - start), _bus.getBaudRate()) + _timeout);
+        slot->txn.onComplete = onComplete;
+        slot->txn.context = slot;
+        slot->busy = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Hand a built read to the bus
+ */
+void PZEMScheduler::submit(Slot* slot) {
+    // The bus takes a bounded number of application transactions; retry on the next poll
+    slot->waiting = !_bus.submit(&slot->txn);
+}
+
+/**
+ * @brief Track the range of a subscription at its period
+ *
+ * The tracker counts the owners of a track, so subscriptions of a range at
+ * one period and the bus sweep of the same span share it without knowing
+ * of each other.
+ */
+void PZEMScheduler::track(uint16_t index) {
+    Entry& entry = _entries[index];
+    entry.track = PZEM_CADENCE_INVALID;
+    if (_cadence != NULL) {
+        entry.track = _cadence->track(_devices[entry.device].slaveAddr, entry.function, entry.startAddr,
+                                      entry.numRegs, entry.period * PZEM_SCHEDULER_TICK_MS);
+    }
+}
+
+/**
+ * @brief Release the track of a subscription
+ */
+void PZEMScheduler::untrack(uint16_t index) {
+    Entry& entry = _entries[index];
+    if (_cadence != NULL && entry.track != PZEM_CADENCE_INVALID) {
+        _cadence->untrack(_devices[entry.device].slaveAddr, entry.function, entry.startAddr, entry.numRegs,
+                          entry.period * PZEM_SCHEDULER_TICK_MS);
+    }
+    entry.track = PZEM_CADENCE_INVALID;
+}
+
+/**
+ * @brief Return an entry to the free list
+ */
+void PZEMScheduler::release(uint16_t index) {
+    _entries[index].next = _free;
+    _free = index;
+}
+
+/**
+ * @brief Forget a device without subscriptions or queued entries
+ */
+void PZEMScheduler::releaseDevice(uint8_t device) {
+    if (_devices[device].subscriptions == 0 && _devices[device].dueHead == NO_ENTRY && !_devices[device].ready) {
+        _devices[device].slaveAddr = 0;
+    }
+}
+
+/**
+ * @brief Batched read completion callback
+ */
+void PZEMScheduler::onComplete(ModbusTransaction* txn, void* context) {
+    Slot* slot = static_cast<Slot*>(context);
+    PZEMScheduler* scheduler = slot->scheduler;
+    PZEMFieldRead& read = slot->read;
+
+    read.success = txn->status == MODBUS_TRANSACTION_OK && slot->response[2] == read.numRegs * 2;
+    read.timestamp = millis();
+    PZEMRegisterCache* cache = scheduler->_bus.getRegisterCache();
+    if (read.success && cache != NULL) {
+        uint16_t raw[PZEM_SCHEDULER_MAX_SPAN];
+        for (uint16_t i = 0; i < read.numRegs; i++) {
+            raw[i] = (slot->response[3 + i * 2] << 8) | slot->response[4 + i * 2];
+        }
+        cache->store(read.slaveAddr, read.function, read.startAddr, read.numRegs, raw, read.timestamp);
+    }
+    if (read.success && scheduler->_cadence != NULL) {
+        scheduler->_cadence->record(read.slaveAddr, read.function, read.startAddr, read.numRegs, read.timestamp);
+    }
+    scheduler->_reads++;
+    slot->busy = false;
+
+    if (scheduler->_onRead != NULL) {
+        scheduler->_onRead(&read, scheduler->_onReadContext);
+    }
+
+    // Keep the bus busy without waiting for the next poll
+    if (!slot->busy && scheduler->buildNext(slot)) {
+        scheduler->submit(slot);
+    }
+}
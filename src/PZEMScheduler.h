@@ -0,0 +1,299 @@
+/**
+ * @file PZEMScheduler.h
+ * @brief Periodic register subscriptions scheduled on a hierarchical timing wheel
+ * @author Lucas Hudson
+ * @date 2025
+ */
+
+#ifndef PZEMSCHEDULER_H
+#define PZEMSCHEDULER_H
+
+#include <Arduino.h>
+#include "PZEMBus.h"
+#include "PZEMCadence.h"
+
+/**
+ * @defgroup PZEMSchedulerConfig Subscription Scheduler Configuration
+ * @brief Compile-time sizing of the subscription scheduler (override before including)
+ * @{
+ */
+#ifndef PZEM_SCHEDULER_MAX_SUBSCRIPTIONS
+#define PZEM_SCHEDULER_MAX_SUBSCRIPTIONS 32    ///< Maximum number of subscriptions (at most 65534)
+#endif
+#ifndef PZEM_SCHEDULER_MAX_DEVICES
+#define PZEM_SCHEDULER_MAX_DEVICES       PZEM_BUS_MAX_DEVICES  ///< Maximum number of subscribed devices
+#endif
+#ifndef PZEM_SCHEDULER_IN_FLIGHT
+#define PZEM_SCHEDULER_IN_FLIGHT         2     ///< Batched reads submitted to the bus at once
+#endif
+#ifndef PZEM_SCHEDULER_TICK_MS
+#define PZEM_SCHEDULER_TICK_MS           10    ///< Timing wheel resolution (ms)
+#endif
+#define PZEM_SCHEDULER_MAX_SPAN          64    ///< Largest batched register span
+#define PZEM_SCHEDULER_WHEEL_BITS        6     ///< Slots per wheel level (2^bits)
+#define PZEM_SCHEDULER_WHEEL_LEVELS      4     ///< Wheel levels (range: 2^24 ticks, 46 h at 10 ms)
+#define PZEM_SCHEDULER_INVALID           -1    ///< Subscription ID returned on failure
+/** @} */
+
+/**
+ * @struct PZEMFieldRead
+ * @brief One batched read of subscribed registers
+ */
+struct PZEMFieldRead {
+    uint8_t slaveAddr;        ///< Slave device address
+    uint8_t function;         ///< MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+    uint16_t startAddr;       ///< First register read
+    uint16_t numRegs;         ///< Registers read
+    uint8_t subscriptions;    ///< Due subscriptions served by the read
+    bool success;             ///< Read succeeded (values are in the register cache of the bus)
+    uint32_t timestamp;       ///< Completion time (millis); the age of the values is millis() - timestamp
+};
+
+/**
+ * @brief Callback receiving every batched read
+ * @param read Batched read (valid during the call only)
+ * @param context User context given to setReadCallback()
+ */
+typedef void (*PZEMFieldReadCallback)(const PZEMFieldRead* read, void* context);
+
+/**
+ * @class PZEMScheduler
+ * @brief Reads register ranges of many devices, each at its own period
+ *
+ * Due times are kept on a hierarchical timing wheel: four levels of 64 slots,
+ * the first one PZEM_SCHEDULER_TICK_MS wide, each next level 64 times coarser.
+ * A subscription sits in the slot of its due tick and moves to a finer level
+ * only when the coarser slot comes up, so adding, cancelling and firing a
+ * subscription cost O(1) whatever their number, and advancing the clock costs
+ * one slot per tick plus the subscriptions actually due.
+ *
+ * Due subscriptions are queued per device. When the bus can take a read, the
+ * next device in turn is read once for all its due subscriptions of the same
+ * function whose registers fit a PZEM_SCHEDULER_MAX_SPAN span. Results go to
+ * the register cache of the bus (see PZEMRegisterCache::subscribe() for change
+ * notifications) and to the read callback. Periods are anchored: a late read
+ * does not shift the next due time. A subscription due again while still
+ * queued is counted as an overrun and read once.
+ */
+class PZEMScheduler {
+public:
+    /**
+     * @brief Constructor for a subscription scheduler
+     * @param bus Bus carrying the reads (its register cache receives the values)
+     */
+    PZEMScheduler(PZEMBus& bus);
+
+    /**
+     * @brief Read a register range periodically
+     * @param slaveAddr Slave device address
+     * @param function MODBUS_READ_INPUT_REGISTERS or MODBUS_READ_HOLDING_REGISTERS
+     * @param startAddr Starting register address
+     * @param numRegs Number of registers (at most PZEM_SCHEDULER_MAX_SPAN)
+     * @param periodMs Read period in milliseconds (rounded up to the tick)
+     * @return Subscription ID, or PZEM_SCHEDULER_INVALID if invalid or a table is full
+     * @note The first read is due on the next tick.
+     */
+    int32_t subscribe(uint8_t slaveAddr, uint8_t function, uint16_t startAddr, uint16_t numRegs, uint32_t periodMs);
+
+    /**
+     * @brief Cancel a subscription
+     * @param id Subscription ID returned by subscribe()
+     * @return true if cancelled, false if the ID is not in use
+     */
+    bool unsubscribe(int32_t id);
+
+    /**
+     * @brief Set the response timeout of the batched reads
+     * @param timeoutMs Time a device may take to answer, in milliseconds (default: PZEM_BUS_DEFAULT_TIMEOUT_MS)
+     * @note The wire time of each response at the baud rate of the bus (PZEMBus::setBaudRate()) is added.
+     */
+    void setTimeout(uint32_t timeoutMs);
+
+    /**
+     * @brief Set callback receiving every batched read
+     * @param callback Callback, or NULL to disable
+     * @param context User context passed to the callback
+     */
+    void setReadCallback(PZEMFieldReadCallback callback, void* context);
+
+    /**
+     * @brief Record the achieved cadence of every subscription
+     * @param cadence Cadence tracker, or NULL to disable
+     * @note Each subscribed range is tracked at its period (existing subscriptions included) and
+     *       refreshed by every successful read covering it; subscriptions of the same range and
+     *       period share a track (with the bus sweep too), removed with the last of them. The
+     *       tracks of a previous tracker are released.
+     */
+    void setCadence(PZEMCadence* cadence);
+
+    /**
+     * @brief Advance the scheduler and the bus within a time budget (replaces PZEMBus::poll())
+     * @param budgetUs Maximum time to spend in microseconds
+     * @return true if transactions are still in flight, false if the bus is idle
+     */
+    bool poll(uint32_t budgetUs);
+
+    /**
+     * @brief Get number of subscriptions in use
+     * @return Active subscriptions
+     */
+    uint16_t getSubscriptionCount() const;
+
+    /**
+     * @brief Get number of batched reads completed
+     * @return Reads since construction
+     */
+    uint32_t getReadCount() const;
+
+    /**
+     * @brief Get number of times a subscription came due while still queued
+     * @return Overruns since construction (the bus cannot keep up with the periods)
+     */
+    uint32_t getOverrunCount() const;
+
+private:
+    /**
+     * @brief One subscription
+     */
+    struct Entry {
+        uint16_t next;            ///< Next entry in the wheel slot or free list
+        uint16_t prev;            ///< Previous entry in the wheel slot
+        uint16_t dueNext;         ///< Next entry in the due queue of the device
+        uint16_t slot;            ///< Wheel slot holding the entry (level * 64 + index)
+        uint8_t device;           ///< Device index
+        uint8_t function;         ///< Read function code
+        uint16_t startAddr;       ///< First register
+        uint16_t numRegs;         ///< Registers
+        uint32_t period;          ///< Period in ticks
+        uint32_t due;             ///< Next due tick
+        bool used;                ///< Subscription active
+        bool queued;              ///< In the due queue of its device
+        int8_t track;             ///< Cadence track of the range (PZEM_CADENCE_INVALID if none)
+    };
+
+    /**
+     * @brief Due queue of one device
+     */
+    struct Device {
+        uint8_t slaveAddr;        ///< Slave address (0 = free entry)
+        uint16_t subscriptions;   ///< Subscriptions of the device
+        uint16_t dueHead;         ///< First queued entry
+        uint16_t dueTail;         ///< Last queued entry
+        bool ready;               ///< In the ready ring
+    };
+
+    /**
+     * @brief Buffers of one batched read in flight
+     */
+    struct Slot {
+        PZEMScheduler* scheduler; ///< Owning scheduler (callback context)
+        bool busy;                ///< Read built (in flight or waiting)
+        bool waiting;             ///< Not accepted by the bus yet
+        PZEMFieldRead read;       ///< Batched read
+        ModbusTransaction txn;    ///< Transaction
+        uint8_t request[8];       ///< Request frame
+        uint8_t response[5 + PZEM_SCHEDULER_MAX_SPAN * 2];  ///< Response frame
+    };
+
+    PZEMBus& _bus;                                          ///< Bus carrying the reads
+    Entry _entries[PZEM_SCHEDULER_MAX_SUBSCRIPTIONS];       ///< Subscriptions
+    uint16_t _free;                                         ///< First free entry
+    uint16_t _count;                                        ///< Subscriptions in use
+    uint16_t _wheel[PZEM_SCHEDULER_WHEEL_LEVELS][1 << PZEM_SCHEDULER_WHEEL_BITS];  ///< Slot heads
+    uint32_t _tick;                                         ///< Next tick to process
+    uint32_t _tickMs;                                       ///< millis() at the start of _tick
+    Device _devices[PZEM_SCHEDULER_MAX_DEVICES];            ///< Subscribed devices
+    uint8_t _ready[PZEM_SCHEDULER_MAX_DEVICES];             ///< Devices with due entries, in turn
+    uint8_t _readyHead;                                     ///< First device in the ready ring
+    uint8_t _readyCount;                                    ///< Devices in the ready ring
+    Slot _slots[PZEM_SCHEDULER_IN_FLIGHT];                  ///< Reads in flight
+    uint32_t _timeout;                                      ///< Device response time in milliseconds
+    uint32_t _reads;                                        ///< Completed reads
+    uint32_t _overruns;                                     ///< Subscriptions due while queued
+    PZEMCadence* _cadence;                                  ///< Cadence tracker (NULL if not used)
+    PZEMFieldReadCallback _onRead;                          ///< Read callback (NULL if not used)
+    void* _onReadContext;                                   ///< Read callback context
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Put an entry in the wheel slot of its due tick
+     * @param index Entry index
+     */
+    void insert(uint16_t index);
+
+    /**
+     * @brief Take an entry out of its wheel slot
+     * @param index Entry index
+     */
+    void unlink(uint16_t index);
+
+    /**
+     * @brief Move the entries of a coarse slot to finer levels
+     * @param level Wheel level (1 and above)
+     * @param slot Slot index
+     */
+    void cascade(uint8_t level, uint8_t slot);
+
+    /**
+     * @brief Process the wheel up to the current time
+     */
+    void advance();
+
+    /**
+     * @brief Queue a due entry on its device and schedule its next period
+     * @param index Entry index
+     */
+    void fire(uint16_t index);
+
+    /**
+     * @brief Build the next batched read into a slot
+     * @param slot Free slot
+     * @return true if a read was built
+     */
+    bool buildNext(Slot* slot);
+
+    /**
+     * @brief Hand a built read to the bus
+     * @param slot Slot holding the read
+     */
+    void submit(Slot* slot);
+
+    /**
+     * @brief Track the range of a subscription at its period
+     * @param index Entry index
+     */
+    void track(uint16_t index);
+
+    /**
+     * @brief Release the track of a subscription, if it holds one
+     * @param index Entry index
+     */
+    void untrack(uint16_t index);
+
+    /**
+     * @brief Return an entry to the free list
+     * @param index Entry index
+     */
+    void release(uint16_t index);
+
+    /**
+     * @brief Forget a device without subscriptions or queued entries
+     * @param device Device index
+     */
+    void releaseDevice(uint8_t device);
+
+    /**
+     * @brief Batched read completion callback
+     * @param txn Completed transaction
+     * @param context Slot holding the transaction
+     */
+    static void onComplete(ModbusTransaction* txn, void* context);
+
+    /** @} */
+};
+
+#endif // PZEMSCHEDULER_H
@@ -0,0 +1,750 @@
+/**
+ * @file PZEMSummary.cpp
+ * @brief Implementation of the mergeable summaries and the federation
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Message layout: magic, version, source, interval start and length (4 bytes
+ * each, little endian), summary count, the summaries, and a CRC over
+ * everything before it.
+ *
+ * Summary layout: group, then varints: devices, samples, zigzagged energy and
+ * power integral, and when there are samples the zigzagged min and max power;
+ * then the sketch: varint zero count, varint bucket count n, and when n > 0
+ * the zigzagged index of the top bucket followed by the n counts up to it,
+ * starting from the lowest non-empty bucket.
+ */
+
+#include "PZEMSummary.h"
+#include "ModbusProtocol.h"
+#include <math.h>
+
+#define SUMMARY_MAGIC          0xF5  ///< First byte of a federation message
+#define SUMMARY_VERSION        1     ///< Layout version
+#define SUMMARY_HEADER         12    ///< Message header size
+#define SUMMARY_RECORD_MAX     (55 + 5 * PZEM_SKETCH_BUCKETS)  ///< Largest encoded summary
+
+static const float SKETCH_GAMMA = (1.0f + PZEM_SKETCH_ACCURACY) / (1.0f - PZEM_SKETCH_ACCURACY);
+
+static void put32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t putVarint(uint8_t* p, uint64_t value) {
+    uint32_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = value;
+    return n;
+}
+
+/**
+ * @brief Read a varint of at most 64 bits
+ * @return false if truncated or too long
+ */
+static bool getVarint(const uint8_t* data, uint32_t length, uint32_t* position, uint64_t* value) {
+    uint64_t result = 0;
+    for (uint8_t shift = 0; shift < 70; shift += 7) {
+        if (*position >= length) {
+            return false;
+        }
+        uint8_t byte = data[(*position)++];
+        if (shift == 63 && byte > 1) {
+            return false;
+        }
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Read a varint that must fit 32 bits
+ */
+static bool getVarint32(const uint8_t* data, uint32_t length, uint32_t* position, uint32_t* value) {
+    uint64_t result;
+    if (!getVarint(data, length, position, &result) || result > 0xFFFFFFFFULL) {
+        return false;
+    }
+    *value = (uint32_t)result;
+    return true;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(0 - (int64_t)((uint64_t)value >> 63));
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+/**
+ * @brief Continue a Modbus CRC over a buffer of any length
+ */
+static uint16_t crcUpdate(uint16_t crc, const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        crc = modbusCRC16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+/**
+ * @brief Constructor for an empty sketch
+ */
+PZEMQuantileSketch::PZEMQuantileSketch() {
+    clear();
+}
+
+/**
+ * @brief Remove every value
+ */
+void PZEMQuantileSketch::clear() {
+    _zero = 0;
+    _count = 0;
+    _top = 0;
+    memset(_buckets, 0, sizeof(_buckets));
+}
+
+/**
+ * @brief Count values in a bucket, raising the window first if needed
+ *
+ * The window holds the PZEM_SKETCH_BUCKETS buckets up to the highest one
+ * reached. Raising it folds the buckets that fall out into its new lowest
+ * bucket, and values below the window are counted there too, so a value
+ * always ends up in max(index, top - PZEM_SKETCH_BUCKETS + 1) whatever the
+ * order in which values and sketches arrived.
+ */
+void PZEMQuantileSketch::addToBucket(int16_t index, uint32_t count) {
+    if (_count == _zero) {
+        memset(_buckets, 0, sizeof(_buckets));
+        _top = index;
+    } else if (index > _top) {
+        uint32_t shift = index - _top;
+        uint32_t folded = 0;
+        for (uint32_t i = 0; i < shift && i < PZEM_SKETCH_BUCKETS; i++) {
+            folded += _buckets[i];
+        }
+        if (shift < PZEM_SKETCH_BUCKETS) {
+            memmove(_buckets, _buckets + shift, (PZEM_SKETCH_BUCKETS - shift) * sizeof(uint32_t));
+            memset(_buckets + PZEM_SKETCH_BUCKETS - shift, 0, shift * sizeof(uint32_t));
+        } else {
+            memset(_buckets, 0, sizeof(_buckets));
+        }
+        _buckets[0] += folded;
+        _top = index;
+    }
+    int32_t position = (int32_t)index - (_top - PZEM_SKETCH_BUCKETS + 1);
+    _buckets[position < 0 ? 0 : position] += count;
+}
+
+/**
+ * @brief Count a value
+ *
+ * Bucket i holds the values in (gamma^(i-1), gamma^i], and is read back as
+ * the value within the accuracy of both ends.
+ */
+void PZEMQuantileSketch::add(float value) {
+    if (!(value >= PZEM_SKETCH_MIN_VALUE)) {
+        _zero++;
+        _count++;
+        return;
+    }
+    addToBucket((int16_t)ceilf(logf(value) / logf(SKETCH_GAMMA)), 1);
+    _count++;
+}
+
+/**
+ * @brief Add the values of another sketch
+ *
+ * The highest bucket goes first, so the window is raised only once.
+ */
+void PZEMQuantileSketch::merge(const PZEMQuantileSketch& other) {
+    if (other._count > other._zero) {
+        int16_t low = other._top - PZEM_SKETCH_BUCKETS + 1;
+        for (int16_t i = PZEM_SKETCH_BUCKETS - 1; i >= 0; i--) {
+            if (other._buckets[i] != 0) {
+                addToBucket(low + i, other._buckets[i]);
+                _count += other._buckets[i];
+            }
+        }
+    }
+    _zero += other._zero;
+    _count += other._zero;
+}
+
+/**
+ * @brief Get a quantile
+ */
+float PZEMQuantileSketch::quantile(float q) const {
+    if (_count == 0) {
+        return 0;
+    }
+    if (q < 0) {
+        q = 0;
+    } else if (q > 1) {
+        q = 1;
+    }
+    uint32_t rank = (uint32_t)(q * (_count - 1));
+    uint32_t seen = _zero;
+    if (rank < seen) {
+        return 0;
+    }
+    int16_t index = _top;
+    for (uint16_t i = 0; i < PZEM_SKETCH_BUCKETS; i++) {
+        seen += _buckets[i];
+        if (seen > rank) {
+            index = _top - PZEM_SKETCH_BUCKETS + 1 + i;
+            break;
+        }
+    }
+    return 2.0f * powf(SKETCH_GAMMA, index) / (SKETCH_GAMMA + 1.0f);
+}
+
+/**
+ * @brief Get the number of values counted
+ */
+uint32_t PZEMQuantileSketch::getCount() const {
+    return _count;
+}
+
+/**
+ * @brief Encode the sketch
+ */
+uint32_t PZEMQuantileSketch::encode(uint8_t* out, uint32_t size) const {
+    uint16_t first = PZEM_SKETCH_BUCKETS;
+    if (_count > _zero) {
+        first = 0;
+        while (_buckets[first] == 0) {
+            first++;
+        }
+    }
+    uint16_t n = PZEM_SKETCH_BUCKETS - first;
+    if (size < 13 + 5 * (uint32_t)n) {
+        return 0;
+    }
+    uint32_t length = putVarint(out, _zero);
+    length += putVarint(out + length, n);
+    if (n != 0) {
+        length += putVarint(out + length, zigzag(_top));
+        for (uint16_t i = first; i < PZEM_SKETCH_BUCKETS; i++) {
+            length += putVarint(out + length, _buckets[i]);
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief Decode a sketch
+ *
+ * Only the canonical form is accepted: the first and the top bucket hold
+ * values, and counts do not overflow.
+ */
+bool PZEMQuantileSketch::decode(const uint8_t* data, uint32_t length, uint32_t* position) {
+    uint32_t zero, n;
+    if (!getVarint32(data, length, position, &zero) || !getVarint32(data, length, position, &n) ||
+        n > PZEM_SKETCH_BUCKETS) {
+        return false;
+    }
+    clear();
+    _zero = zero;
+    uint64_t total = zero;
+    if (n != 0) {
+        uint64_t top;
+        if (!getVarint(data, length, position, &top)) {
+            return false;
+        }
+        int64_t index = unzigzag(top);
+        if (index < -16384 || index > 16383) {
+            return false;
+        }
+        _top = (int16_t)index;
+        for (uint32_t i = PZEM_SKETCH_BUCKETS - n; i < PZEM_SKETCH_BUCKETS; i++) {
+            if (!getVarint32(data, length, position, &_buckets[i])) {
+                return false;
+            }
+            total += _buckets[i];
+        }
+        if (_buckets[PZEM_SKETCH_BUCKETS - n] == 0 || _buckets[PZEM_SKETCH_BUCKETS - 1] == 0) {
+            return false;
+        }
+    }
+    if (total > 0xFFFFFFFFULL) {
+        return false;
+    }
+    _count = (uint32_t)total;
+    return true;
+}
+
+/**
+ * @brief Reset to an empty summary
+ */
+void PZEMSummary::clear(uint8_t groupId, uint32_t intervalStart, uint32_t intervalLength) {
+    group = groupId;
+    start = intervalStart;
+    length = intervalLength;
+    devices = 0;
+    samples = 0;
+    energyWh = 0;
+    powerIntegral = 0;
+    powerMin = 0;
+    powerMax = 0;
+    power.clear();
+}
+
+/**
+ * @brief Merge another summary of the same group
+ */
+bool PZEMSummary::merge(const PZEMSummary& other) {
+    if (other.group != group) {
+        return false;
+    }
+    if (length == 0) {
+        start = other.start;
+        length = other.length;
+    } else if (other.length != 0) {
+        uint32_t end = start + length > other.start + other.length ? start + length : other.start + other.length;
+        start = start < other.start ? start : other.start;
+        length = end - start;
+    }
+    if (other.samples != 0) {
+        if (samples == 0 || other.powerMin < powerMin) {
+            powerMin = other.powerMin;
+        }
+        if (samples == 0 || other.powerMax > powerMax) {
+            powerMax = other.powerMax;
+        }
+    }
+    devices += other.devices;
+    samples += other.samples;
+    energyWh += other.energyWh;
+    powerIntegral += other.powerIntegral;
+    power.merge(other.power);
+    return true;
+}
+
+/**
+ * @brief Get the demand
+ *
+ * The integral is in 0.1 W x ms and doubled by the trapezoidal rule.
+ */
+float PZEMSummary::getDemand() const {
+    if (length == 0) {
+        return 0;
+    }
+    return (float)((double)powerIntegral / (20000.0 * length));
+}
+
+/**
+ * @brief Encode the fields of a summary (the interval is in the message header)
+ */
+static uint32_t encodeSummary(uint8_t* out, uint32_t size, const PZEMSummary* summary) {
+    if (size < SUMMARY_RECORD_MAX) {
+        return 0;
+    }
+    uint32_t length = 0;
+    out[length++] = summary->group;
+    length += putVarint(out + length, summary->devices);
+    length += putVarint(out + length, summary->samples);
+    length += putVarint(out + length, zigzag(summary->energyWh));
+    length += putVarint(out + length, zigzag(summary->powerIntegral));
+    if (summary->samples != 0) {
+        length += putVarint(out + length, zigzag(summary->powerMin));
+        length += putVarint(out + length, zigzag(summary->powerMax));
+    }
+    uint32_t sketch = summary->power.encode(out + length, size - length);
+    return sketch != 0 ? length + sketch : 0;
+}
+
+/**
+ * @brief Decode the fields of a summary
+ */
+static bool decodeSummary(const uint8_t* data, uint32_t length, uint32_t* position, PZEMSummary* summary,
+                          uint32_t start, uint32_t interval) {
+    if (*position >= length || data[*position] >= PZEM_SUMMARY_MAX_GROUPS) {
+        return false;
+    }
+    summary->clear(data[(*position)++], start, interval);
+    uint64_t energy, integral, minimum = 0, maximum = 0;
+    if (!getVarint32(data, length, position, &summary->devices) ||
+        !getVarint32(data, length, position, &summary->samples) ||
+        !getVarint(data, length, position, &energy) || !getVarint(data, length, position, &integral)) {
+        return false;
+    }
+    if (summary->samples != 0 &&
+        (!getVarint(data, length, position, &minimum) || !getVarint(data, length, position, &maximum) ||
+         unzigzag(minimum) < INT32_MIN || unzigzag(maximum) > INT32_MAX || unzigzag(minimum) > unzigzag(maximum))) {
+        return false;
+    }
+    summary->energyWh = unzigzag(energy);
+    summary->powerIntegral = unzigzag(integral);
+    summary->powerMin = (int32_t)unzigzag(minimum);
+    summary->powerMax = (int32_t)unzigzag(maximum);
+    return summary->power.decode(data, length, position);
+}
+
+/**
+ * @brief Constructor for a summarizer with 60-second intervals
+ */
+PZEMSummarizer::PZEMSummarizer()
+    : _interval(60), _start(0), _maxHold(PZEM_SUMMARY_DEFAULT_MAX_HOLD_MS), _callback(NULL), _context(NULL) {
+    memset(_devices, 0, sizeof(_devices));
+}
+
+/**
+ * @brief Set the interval length
+ */
+bool PZEMSummarizer::setInterval(uint32_t seconds) {
+    if (seconds == 0) {
+        return false;
+    }
+    _interval = seconds;
+    _start = 0;
+    return true;
+}
+
+/**
+ * @brief Set the longest gap between two power samples that is integrated
+ */
+void PZEMSummarizer::setMaxHold(uint32_t ms) {
+    _maxHold = ms;
+}
+
+/**
+ * @brief Set the callback receiving the summaries of every interval that ends
+ */
+void PZEMSummarizer::setCallback(PZEMSummaryCallback callback, void* context) {
+    _callback = callback;
+    _context = context;
+}
+
+/**
+ * @brief Hand over the interval in progress and start another
+ */
+void PZEMSummarizer::closeInterval(uint32_t start) {
+    if (_start != 0 && _callback != NULL) {
+        _callback(_summaries, PZEM_SUMMARY_MAX_GROUPS, _context);
+    }
+    _start = start;
+    for (uint8_t g = 0; g < PZEM_SUMMARY_MAX_GROUPS; g++) {
+        _summaries[g].clear(g, start, _interval);
+    }
+    for (uint8_t i = 0; i < PZEM_SUMMARY_MAX_DEVICES; i++) {
+        _devices[i].counted = 0;
+    }
+}
+
+/**
+ * @brief Add a snapshot
+ *
+ * Power is integrated with the trapezoidal rule between consecutive samples
+ * of the device, in exact integers; the segment counts in the interval of its
+ * later sample. Energy is the increase of the device counter since its
+ * previous snapshot (a counter reset adds nothing). A snapshot older than the
+ * interval in progress counts in it.
+ */
+bool PZEMSummarizer::addSnapshot(uint16_t device, uint32_t groups, const PZEMSnapshot* snapshot, uint32_t epoch) {
+    const PZEMModelInfo* info = snapshot != NULL ? pzemModelInfo(snapshot->model) : NULL;
+    if (info == NULL || snapshot->count < info->powerRegister + 2 || snapshot->count < info->energyRegister + 2) {
+        return false;
+    }
+
+    Device* state = NULL;
+    Device* free = NULL;
+    for (uint8_t i = 0; i < PZEM_SUMMARY_MAX_DEVICES && state == NULL; i++) {
+        if (_devices[i].used && _devices[i].device == device) {
+            state = &_devices[i];
+        } else if (!_devices[i].used && free == NULL) {
+            free = &_devices[i];
+        }
+    }
+    if (state == NULL) {
+        if (free == NULL) {
+            return false;
+        }
+        state = free;
+        memset(state, 0, sizeof(Device));
+        state->used = true;
+        state->device = device;
+    }
+
+    uint32_t start = epoch - epoch % _interval;
+    if (_start == 0 || start > _start) {
+        closeInterval(start);
+    }
+
+    uint16_t reg = info->powerRegister;
+    int32_t power = (int32_t)(((uint32_t)snapshot->regs[reg + 1] << 16) | snapshot->regs[reg]);
+    int64_t integral = 0;
+    if (state->hasPower && snapshot->timestamp - state->lastTime <= _maxHold) {
+        integral = ((int64_t)state->lastPower + power) * (int64_t)(snapshot->timestamp - state->lastTime);
+    }
+    state->hasPower = true;
+    state->lastPower = power;
+    state->lastTime = snapshot->timestamp;
+
+    reg = info->energyRegister;
+    uint32_t counter = ((uint32_t)snapshot->regs[reg + 1] << 16) | snapshot->regs[reg];
+    int64_t energy = 0;
+    if (state->hasEnergy && counter >= state->lastEnergy) {
+        energy = (int64_t)(counter - state->lastEnergy) * info->energyUnitWh;
+    }
+    state->hasEnergy = true;
+    state->lastEnergy = counter;
+
+    for (uint8_t g = 0; g < PZEM_SUMMARY_MAX_GROUPS; g++) {
+        if (!(groups & (1UL << g))) {
+            continue;
+        }
+        PZEMSummary& summary = _summaries[g];
+        if (!(state->counted & (1UL << g))) {
+            state->counted |= 1UL << g;
+            summary.devices++;
+        }
+        if (summary.samples == 0 || power < summary.powerMin) {
+            summary.powerMin = power;
+        }
+        if (summary.samples == 0 || power > summary.powerMax) {
+            summary.powerMax = power;
+        }
+        summary.samples++;
+        summary.energyWh += energy;
+        summary.powerIntegral += integral;
+        summary.power.add(power * 0.1f);
+    }
+    return true;
+}
+
+/**
+ * @brief End the interval in progress if the clock has passed its end
+ */
+void PZEMSummarizer::tick(uint32_t epoch) {
+    if (_start != 0 && epoch >= _start + _interval) {
+        closeInterval(epoch - epoch % _interval);
+    }
+}
+
+/**
+ * @brief Constructor for a federation of one gateway with 30-second lateness
+ */
+PZEMFederation::PZEMFederation()
+    : _expected(1), _lateness(30), _watermark(0), _now(0), _callback(NULL), _context(NULL) {
+    for (uint8_t i = 0; i < PZEM_FEDERATION_MAX_INTERVALS; i++) {
+        _views[i].length = 0;
+    }
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Set the expected gateways
+ */
+void PZEMFederation::setSources(uint8_t count) {
+    _expected = count >= 32 ? 0xFFFFFFFFUL : (1UL << count) - 1;
+}
+
+/**
+ * @brief Set how long an interval waits for late gateways
+ */
+void PZEMFederation::setLateness(uint32_t seconds) {
+    _lateness = seconds;
+}
+
+/**
+ * @brief Set the callback receiving the site views
+ */
+void PZEMFederation::setCallback(PZEMSiteViewCallback callback, void* context) {
+    _callback = callback;
+    _context = context;
+}
+
+/**
+ * @brief Encode the summaries of an interval for the federation
+ */
+uint32_t PZEMFederation::encode(uint8_t* out, uint32_t size, uint8_t source, const PZEMSummary* summaries,
+                                uint8_t count) {
+    if (out == NULL || summaries == NULL || count == 0 || source >= 32 || summaries[0].length == 0 ||
+        size < SUMMARY_HEADER + 2) {
+        return 0;
+    }
+    uint32_t length = SUMMARY_HEADER;
+    uint8_t records = 0;
+    uint8_t record[SUMMARY_RECORD_MAX];
+    for (uint8_t i = 0; i < count; i++) {
+        const PZEMSummary* summary = &summaries[i];
+        if (summary->start != summaries[0].start || summary->length != summaries[0].length) {
+            return 0;
+        }
+        if (summary->devices == 0 && summary->samples == 0) {
+            continue;
+        }
+        uint32_t n = encodeSummary(record, sizeof(record), summary);
+        if (n == 0 || length + n + 2 > size) {
+            return 0;
+        }
+        memcpy(out + length, record, n);
+        length += n;
+        records++;
+    }
+    out[0] = SUMMARY_MAGIC;
+    out[1] = SUMMARY_VERSION;
+    out[2] = source;
+    put32(out + 3, summaries[0].start);
+    put32(out + 7, summaries[0].length);
+    out[11] = records;
+    uint16_t crc = crcUpdate(0xFFFF, out, length);
+    out[length] = crc & 0xFF;
+    out[length + 1] = crc >> 8;
+    return length + 2;
+}
+
+/**
+ * @brief Merge or check the summaries of a message
+ *
+ * A group may only appear once per message.
+ */
+bool PZEMFederation::mergeSummaries(const uint8_t* data, uint32_t length, uint8_t count, uint32_t start,
+                                    uint32_t interval, PZEMSiteView* view) {
+    uint32_t position = 0;
+    uint32_t seen = 0;
+    for (uint8_t n = 0; n < count; n++) {
+        if (!decodeSummary(data, length, &position, &_decoded, start, interval) ||
+            (seen & (1UL << _decoded.group))) {
+            return false;
+        }
+        seen |= 1UL << _decoded.group;
+        if (view != NULL) {
+            view->groups[_decoded.group].merge(_decoded);
+            _stats.summaries++;
+        }
+    }
+    return position == length;
+}
+
+/**
+ * @brief Merge a gateway message
+ *
+ * The message is checked in full before anything is merged. When every slot
+ * holds an open view, the oldest one is handed over as it is.
+ */
+bool PZEMFederation::receive(const uint8_t* data, uint32_t length) {
+    if (data == NULL || length < SUMMARY_HEADER + 2 || data[0] != SUMMARY_MAGIC || data[1] != SUMMARY_VERSION ||
+        crcUpdate(0xFFFF, data, length - 2) != (uint16_t)(data[length - 2] | (data[length - 1] << 8))) {
+        _stats.malformed++;
+        return false;
+    }
+    uint8_t source = data[2];
+    uint32_t start = get32(data + 3);
+    uint32_t interval = get32(data + 7);
+    uint8_t count = data[11];
+    const uint8_t* summaries = data + SUMMARY_HEADER;
+    uint32_t summariesLength = length - SUMMARY_HEADER - 2;
+    if (source >= 32 || interval == 0 || !mergeSummaries(summaries, summariesLength, count, start, interval, NULL)) {
+        _stats.malformed++;
+        return false;
+    }
+
+    PZEMSiteView* view = NULL;
+    while (view == NULL) {
+        if (start < _watermark) {
+            _stats.late++;
+            return false;
+        }
+        PZEMSiteView* free = NULL;
+        for (uint8_t i = 0; i < PZEM_FEDERATION_MAX_INTERVALS; i++) {
+            if (_views[i].length != 0 && _views[i].start == start) {
+                view = &_views[i];
+            } else if (_views[i].length == 0 && free == NULL) {
+                free = &_views[i];
+            }
+        }
+        if (view == NULL && free != NULL) {
+            view = free;
+            view->start = start;
+            view->length = interval;
+            view->sources = 0;
+            view->complete = false;
+            for (uint8_t g = 0; g < PZEM_SUMMARY_MAX_GROUPS; g++) {
+                view->groups[g].clear(g, start, interval);
+            }
+        } else if (view == NULL) {
+            handOver(true);
+        }
+    }
+    if (view->length != interval) {
+        _stats.malformed++;
+        return false;
+    }
+    if (view->sources & (1UL << source)) {
+        _stats.duplicates++;
+        return false;
+    }
+    mergeSummaries(summaries, summariesLength, count, start, interval, view);
+    view->sources |= 1UL << source;
+    _stats.messages++;
+    handOver(false);
+    return true;
+}
+
+/**
+ * @brief Hand over the oldest views that are complete or overdue
+ *
+ * Views go out in interval order: a complete view waits for the older ones.
+ */
+void PZEMFederation::handOver(bool force) {
+    for (;;) {
+        PZEMSiteView* oldest = NULL;
+        for (uint8_t i = 0; i < PZEM_FEDERATION_MAX_INTERVALS; i++) {
+            if (_views[i].length != 0 && (oldest == NULL || _views[i].start < oldest->start)) {
+                oldest = &_views[i];
+            }
+        }
+        if (oldest == NULL) {
+            return;
+        }
+        oldest->complete = (oldest->sources & _expected) == _expected;
+        bool overdue = _now != 0 && _now >= oldest->start + oldest->length + _lateness;
+        if (!oldest->complete && !overdue && !force) {
+            return;
+        }
+        force = false;
+        if (oldest->complete) {
+            _stats.complete++;
+        } else {
+            _stats.incomplete++;
+        }
+        if (_callback != NULL) {
+            _callback(oldest, _context);
+        }
+        _watermark = oldest->start + oldest->length;
+        oldest->length = 0;
+    }
+}
+
+/**
+ * @brief Hand over the views whose lateness limit has passed
+ */
+void PZEMFederation::tick(uint32_t epoch) {
+    _now = epoch;
+    handOver(false);
+}
+
+/**
+ * @brief Get the counters
+ */
+void PZEMFederation::getStats(PZEMFederationStats* stats) const {
+    if (stats != NULL) {
+        *stats = _stats;
+    }
+}
@@ -0,0 +1,414 @@
+/**
+ * @file PZEMSummary.h
+ * @brief Mergeable interval summaries and their federation into site views
+ * @author Lucas Hudson
+ * @date 2025
+ *
+ * @details
+ * Each gateway summarizes the devices it polls per group and per interval
+ * (PZEMSummarizer): device count, energy from the counters, the integral of
+ * active power (hence the demand), min/max power and a quantile sketch of
+ * power. Summaries merge exactly: every field is a sum, a min or a max of
+ * integers, and sketches add bucket counts, so merging in any order and any
+ * grouping gives the same result as summarizing all devices in one place.
+ *
+ * A site collector (PZEMFederation) merges the summaries of every gateway
+ * for the same interval into a site view, and hands it over once every
+ * gateway has reported or a lateness limit has passed. Views of consecutive
+ * intervals merge the same way, e.g. fifteen 1-minute views into the 15-minute
+ * demand window.
+ */
+
+#ifndef PZEMSUMMARY_H
+#define PZEMSUMMARY_H
+
+#include <Arduino.h>
+#include "PZEMModel.h"
+
+/**
+ * @defgroup PZEMSummaryConfig Summary Configuration
+ * @brief Compile-time sizing of summaries and federation (override before including)
+ * @{
+ */
+#ifndef PZEM_SKETCH_BUCKETS
+#define PZEM_SKETCH_BUCKETS          128    ///< Buckets of a quantile sketch (a 167:1 range at 2%)
+#endif
+#ifndef PZEM_SKETCH_ACCURACY
+#define PZEM_SKETCH_ACCURACY         0.02f  ///< Relative accuracy of the quantiles
+#endif
+#define PZEM_SKETCH_MIN_VALUE        0.1f   ///< Smaller values (and negative ones) count as 0
+#ifndef PZEM_SUMMARY_MAX_GROUPS
+#define PZEM_SUMMARY_MAX_GROUPS      8      ///< Groups per summarizer and per site view (at most 32)
+#endif
+#ifndef PZEM_SUMMARY_MAX_DEVICES
+#define PZEM_SUMMARY_MAX_DEVICES     32     ///< Devices tracked by a summarizer
+#endif
+#ifndef PZEM_FEDERATION_MAX_INTERVALS
+#define PZEM_FEDERATION_MAX_INTERVALS 4     ///< Intervals a federation keeps open at once
+#endif
+#define PZEM_SUMMARY_DEFAULT_MAX_HOLD_MS 30000  ///< Default longest gap between power samples that is integrated
+/** @} */
+
+/**
+ * @class PZEMQuantileSketch
+ * @brief Mergeable quantile sketch with relative accuracy (DDSketch)
+ *
+ * Values are counted in logarithmic buckets, so every quantile is within
+ * PZEM_SKETCH_ACCURACY of the exact one. When the values span more than the
+ * buckets cover, the lowest buckets are folded into the lowest one kept: the
+ * high quantiles stay exact while the low ones lose accuracy. The folding
+ * only depends on the highest bucket ever reached, so merged sketches are
+ * identical whatever the merge order.
+ */
+class PZEMQuantileSketch {
+public:
+    /**
+     * @brief Constructor, empty sketch
+     */
+    PZEMQuantileSketch();
+
+    /**
+     * @brief Remove every value
+     */
+    void clear();
+
+    /**
+     * @brief Count a value
+     * @param value Value (values below PZEM_SKETCH_MIN_VALUE count as 0)
+     */
+    void add(float value);
+
+    /**
+     * @brief Add the values of another sketch
+     * @param other Sketch to merge
+     */
+    void merge(const PZEMQuantileSketch& other);
+
+    /**
+     * @brief Get a quantile
+     * @param q Quantile, 0 to 1 (0.5 for the median)
+     * @return Estimated value, 0 if the sketch is empty
+     */
+    float quantile(float q) const;
+
+    /**
+     * @brief Get the number of values counted
+     * @return Value count
+     */
+    uint32_t getCount() const;
+
+    /**
+     * @brief Encode the sketch
+     * @param out Output buffer
+     * @param size Buffer size in bytes
+     * @return Encoded length in bytes, 0 if the buffer is too small
+     */
+    uint32_t encode(uint8_t* out, uint32_t size) const;
+
+    /**
+     * @brief Decode a sketch
+     * @param data Encoded data
+     * @param length Data length in bytes
+     * @param position Read position, advanced past the sketch
+     * @return true if decoded, false on malformed data
+     */
+    bool decode(const uint8_t* data, uint32_t length, uint32_t* position);
+
+private:
+    uint32_t _zero;                         ///< Values counted as 0
+    uint32_t _count;                        ///< Values counted
+    int16_t _top;                           ///< Highest bucket reached (valid if a bucket is used)
+    uint32_t _buckets[PZEM_SKETCH_BUCKETS]; ///< Bucket _top - PZEM_SKETCH_BUCKETS + 1 + i at i
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Count values in a bucket, raising the window first if needed
+     * @param index Bucket index
+     * @param count Values to count
+     */
+    void addToBucket(int16_t index, uint32_t count);
+
+    /** @} */
+};
+
+/**
+ * @struct PZEMSummary
+ * @brief Mergeable summary of one group over one interval
+ *
+ * Power values are raw register units (0.1 W). Empty summaries (no sample)
+ * are valid and merge as the identity.
+ */
+struct PZEMSummary {
+    uint8_t group;            ///< Group identifier (0 to PZEM_SUMMARY_MAX_GROUPS - 1)
+    uint32_t start;           ///< Interval start (Unix time, seconds)
+    uint32_t length;          ///< Interval length in seconds
+    uint32_t devices;         ///< Devices summarized (device intervals once merged over time)
+    uint32_t samples;         ///< Power samples
+    int64_t energyWh;         ///< Energy counted by the device counters (Wh)
+    int64_t powerIntegral;    ///< Sum of (P1 + P2) x dt over sample pairs (0.1 W x ms, twice the energy)
+    int32_t powerMin;         ///< Lowest device power (0.1 W), valid if samples > 0
+    int32_t powerMax;         ///< Highest device power (0.1 W), valid if samples > 0
+    PZEMQuantileSketch power; ///< Distribution of device power (W)
+
+    /**
+     * @brief Reset to an empty summary
+     * @param groupId Group identifier
+     * @param intervalStart Interval start (Unix time, seconds)
+     * @param intervalLength Interval length in seconds
+     */
+    void clear(uint8_t groupId, uint32_t intervalStart, uint32_t intervalLength);
+
+    /**
+     * @brief Merge another summary of the same group (same interval, or an adjacent one)
+     * @param other Summary to merge
+     * @return true if merged, false if the groups differ
+     * @note The result spans both intervals.
+     */
+    bool merge(const PZEMSummary& other);
+
+    /**
+     * @brief Get the demand, the average active power over the interval
+     * @return Demand in W (sum over the devices)
+     */
+    float getDemand() const;
+};
+
+/**
+ * @brief Callback receiving the summaries of an interval that ended
+ * @param summaries Summary of every group, indexed by group (empty ones have no devices)
+ * @param count Number of groups (PZEM_SUMMARY_MAX_GROUPS)
+ * @param context User context given to setCallback()
+ */
+typedef void (*PZEMSummaryCallback)(const PZEMSummary* summaries, uint8_t count, void* context);
+
+/**
+ * @class PZEMSummarizer
+ * @brief Gateway side: summarizes snapshots per group and per interval
+ *
+ * Feed every snapshot with the groups of its device; intervals are aligned
+ * on the wall clock. When an interval ends (a snapshot or tick() past its
+ * end), its summaries go to the callback, ready for PZEMFederation::encode().
+ */
+class PZEMSummarizer {
+public:
+    /**
+     * @brief Constructor, 60-second intervals
+     */
+    PZEMSummarizer();
+
+    /**
+     * @brief Set the interval length
+     * @param seconds Interval length in seconds (default: 60)
+     * @return true if set, false if 0
+     * @note Drops the interval in progress.
+     */
+    bool setInterval(uint32_t seconds);
+
+    /**
+     * @brief Set the longest gap between two power samples that is integrated
+     * @param ms Gap in ms (default: 30000)
+     */
+    void setMaxHold(uint32_t ms);
+
+    /**
+     * @brief Set the callback receiving the summaries of every interval that ends
+     * @param callback Callback function (NULL to disable)
+     * @param context User context passed to the callback
+     */
+    void setCallback(PZEMSummaryCallback callback, void* context);
+
+    /**
+     * @brief Add a snapshot
+     * @param device Device identifier unique on this gateway (e.g. bus * 256 + address)
+     * @param groups Groups of the device (bit i: group i)
+     * @param snapshot Snapshot of any model (its timestamp times the power integral)
+     * @param epoch Unix time of the snapshot in seconds (selects the interval)
+     * @return true if added, false if the model has no power register or no device slot is free
+     */
+    bool addSnapshot(uint16_t device, uint32_t groups, const PZEMSnapshot* snapshot, uint32_t epoch);
+
+    /**
+     * @brief End the interval in progress if the clock has passed its end
+     * @param epoch Current Unix time in seconds
+     */
+    void tick(uint32_t epoch);
+
+private:
+    /**
+     * @brief Integration state of one device
+     */
+    struct Device {
+        bool used;                ///< Slot in use
+        uint16_t device;          ///< Device identifier
+        bool hasPower;            ///< lastPower and lastTime are set
+        int32_t lastPower;        ///< Previous power sample (0.1 W)
+        uint32_t lastTime;        ///< Time of the previous power sample (millis)
+        bool hasEnergy;           ///< lastEnergy is set
+        uint32_t lastEnergy;      ///< Previous energy counter
+        uint32_t counted;         ///< Groups that counted the device in this interval
+    };
+
+    Device _devices[PZEM_SUMMARY_MAX_DEVICES];       ///< Device states
+    PZEMSummary _summaries[PZEM_SUMMARY_MAX_GROUPS]; ///< Summaries of the interval in progress
+    uint32_t _interval;                              ///< Interval length in seconds
+    uint32_t _start;                                 ///< Start of the interval in progress (0: none)
+    uint32_t _maxHold;                               ///< Longest integrated gap (ms)
+    PZEMSummaryCallback _callback;                   ///< Interval callback
+    void* _context;                                  ///< Callback context
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Hand over the interval in progress and start another
+     * @param start Start of the next interval
+     */
+    void closeInterval(uint32_t start);
+
+    /** @} */
+};
+
+/**
+ * @struct PZEMSiteView
+ * @brief Summaries of every gateway merged for one interval
+ */
+struct PZEMSiteView {
+    uint32_t start;           ///< Interval start (Unix time, seconds)
+    uint32_t length;          ///< Interval length in seconds
+    uint32_t sources;         ///< Gateways that reported (bit per source identifier)
+    bool complete;            ///< Every expected gateway reported
+    PZEMSummary groups[PZEM_SUMMARY_MAX_GROUPS];  ///< Site summary of each group
+};
+
+/**
+ * @brief Callback receiving every site view
+ * @param view Merged view (valid during the call only)
+ * @param context User context given to setCallback()
+ */
+typedef void (*PZEMSiteViewCallback)(const PZEMSiteView* view, void* context);
+
+/**
+ * @struct PZEMFederationStats
+ * @brief Counters of a federation
+ */
+struct PZEMFederationStats {
+    uint32_t messages;        ///< Valid messages merged
+    uint32_t summaries;       ///< Summaries merged
+    uint32_t duplicates;      ///< Messages of a gateway that already reported the interval
+    uint32_t late;            ///< Messages of an interval already handed over
+    uint32_t malformed;       ///< Messages rejected
+    uint32_t complete;        ///< Views handed over with every gateway
+    uint32_t incomplete;      ///< Views handed over after the lateness limit
+};
+
+/**
+ * @class PZEMFederation
+ * @brief Site side: merges the summaries of several gateways into site views
+ *
+ * Each gateway sends the message of encode() for every interval. Views are
+ * handed over in interval order, once every expected gateway reported or the
+ * lateness limit passed. A message sent twice is only merged once.
+ */
+class PZEMFederation {
+public:
+    /**
+     * @brief Constructor, one gateway, 30-second lateness
+     */
+    PZEMFederation();
+
+    /**
+     * @brief Set the expected gateways
+     * @param count Gateways, identified 0 to count - 1 (at most 32)
+     */
+    void setSources(uint8_t count);
+
+    /**
+     * @brief Set how long an interval waits for late gateways
+     * @param seconds Time after the end of the interval (default: 30)
+     */
+    void setLateness(uint32_t seconds);
+
+    /**
+     * @brief Set the callback receiving the site views
+     * @param callback Callback function (NULL to disable)
+     * @param context User context passed to the callback
+     */
+    void setCallback(PZEMSiteViewCallback callback, void* context);
+
+    /**
+     * @brief Merge a gateway message
+     * @param data Message from encode()
+     * @param length Message length in bytes
+     * @return true if merged, false if malformed, late or a duplicate
+     */
+    bool receive(const uint8_t* data, uint32_t length);
+
+    /**
+     * @brief Hand over the views whose lateness limit has passed
+     * @param epoch Current Unix time in seconds
+     */
+    void tick(uint32_t epoch);
+
+    /**
+     * @brief Get the counters
+     * @param stats Receives the counters
+     */
+    void getStats(PZEMFederationStats* stats) const;
+
+    /**
+     * @brief Encode the summaries of an interval for the federation
+     * @param out Output buffer
+     * @param size Buffer size in bytes
+     * @param source Gateway identifier (0 to 31)
+     * @param summaries Summaries from the PZEMSummarizer callback
+     * @param count Number of summaries
+     * @return Message length in bytes, 0 if the buffer is too small or the summaries are invalid
+     * @note Empty summaries are left out; a message without summaries still reports the gateway.
+     */
+    static uint32_t encode(uint8_t* out, uint32_t size, uint8_t source, const PZEMSummary* summaries, uint8_t count);
+
+private:
+    uint32_t _expected;                     ///< Expected gateways (bit per source)
+    uint32_t _lateness;                     ///< Wait after the end of an interval (s)
+    uint32_t _watermark;                    ///< Intervals starting before it were handed over
+    uint32_t _now;                          ///< Latest time given to tick()
+    PZEMSiteView _views[PZEM_FEDERATION_MAX_INTERVALS];  ///< Open views (length 0: free)
+    PZEMSiteViewCallback _callback;         ///< View callback
+    void* _context;                         ///< Callback context
+    PZEMFederationStats _stats;             ///< Counters
+    PZEMSummary _decoded;                   ///< Summary being decoded
+
+    /**
+     * @name Internal Methods
+     * @{
+     */
+
+    /**
+     * @brief Merge or check the summaries of a message
+     * @param data Summaries
+     * @param length Length of the summaries in bytes
+     * @param count Summary count
+     * @param start Interval start of the message
+     * @param interval Interval length of the message
+     * @param view View to merge into, NULL to only check the layout
+     * @return true if every summary is well formed, false otherwise
+     */
+    bool mergeSummaries(const uint8_t* data, uint32_t length, uint8_t count, uint32_t start, uint32_t interval,
+                        PZEMSiteView* view);
+
+    /**
+     * @brief Hand over the oldest views that are complete or overdue
+     * @param force Also hand over the oldest view even if it can still wait
+     */
+    void handOver(bool force);
+
+    /** @} */
+};
+
+#endif // PZEMSUMMARY_H
@@ -11,7 +11,7 @@
  * @brief Constructor for RS485 communication class
  */
 RS485::RS485(Stream* serial)
-    : _serial(serial), _responseTimeout(100), _rs485_en(255) {
+    : _rtu(serial), _transport(&_rtu), _responseTimeout(100), _cache(NULL) {
 }
 
 /**
@@ -31,66 +31,17 @@ bool RS485::readHoldingRegisters(uint8_t slaveAddr, uint16_t startAddr, uint16_t
     request[6] = crc & 0xFF;               // CRC Low byte
     request[7] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, 8);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response
     uint8_t response[256];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // Calculate minimum expected bytes: 3 (header) + 2*numRegs (data) + 2 (CRC)
     uint8_t minBytesExpected = 3 + (2 * numRegs) + 2;
-
-    bool foundSlaveAddr = false;
     
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all expected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
-
-    if (responseLength == 0) {
-        return false;
-    }
-    
-    // Check if it is an error response
-    if (response[1] & 0x80) {
-        return false;
-    }
+    ModbusTransaction txn;
+    txn.prepare(request, 8, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
+    // Send request and wait for a response with valid CRC and no exception
+    if (!_transport->execute(&txn)) {
         return false;
     }
     
@@ -98,6 +49,15 @@ bool RS485::readHoldingRegisters(uint8_t slaveAddr, uint16_t startAddr, uint16_t
     uint8_t byteCount = response[2];
     uint8_t dataIndex = 0;
     
+    // Record raw registers (wire order) for cache consumers
+    if (_cache != NULL && byteCount == 2 * numRegs) {
+        uint16_t raw[MODBUS_MAX_READ_REGISTERS];
+        for (uint16_t r = 0; r < numRegs && r < MODBUS_MAX_READ_REGISTERS; r++) {
+            raw[r] = (response[3 + 2 * r] << 8) | response[4 + 2 * r];
+        }
+        _cache->store(slaveAddr, MODBUS_READ_HOLDING_REGISTERS, startAddr, numRegs, raw, millis());
+    }
+    
     for (uint8_t i = 3; i < 3 + byteCount; i += 2) {
         if (dataIndex < numRegs) {
             if (big_endian) {
@@ -131,66 +91,17 @@ bool RS485::readInputRegisters(uint8_t slaveAddr, uint16_t startAddr, uint16_t n
     request[6] = crc & 0xFF;               // CRC Low byte
     request[7] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, 8);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response - exit when all bytes received
     uint8_t response[256];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // Calculate minimum expected bytes: 3 (header) + 2*numRegs (data) + 2 (CRC)
     uint8_t minBytesExpected = 3 + (2 * numRegs) + 2;
-
-    bool foundSlaveAddr = false;
-    
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-            
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all expected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
-
-    if (responseLength == 0) {
-        return false;
-    }
     
-    // Check if it is an error response
-    if (response[1] & 0x80) {
-        return false;
-    }
+    ModbusTransaction txn;
+    txn.prepare(request, 8, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
+    // Send request and wait for a response with valid CRC and no exception
+    if (!_transport->execute(&txn)) {
         return false;
     }
     
@@ -198,6 +109,15 @@ bool RS485::readInputRegisters(uint8_t slaveAddr, uint16_t startAddr, uint16_t n
     uint8_t byteCount = response[2];
     uint8_t dataIndex = 0;
     
+    // Record raw registers (wire order) for cache consumers
+    if (_cache != NULL && byteCount == 2 * numRegs) {
+        uint16_t raw[MODBUS_MAX_READ_REGISTERS];
+        for (uint16_t r = 0; r < numRegs && r < MODBUS_MAX_READ_REGISTERS; r++) {
+            raw[r] = (response[3 + 2 * r] << 8) | response[4 + 2 * r];
+        }
+        _cache->store(slaveAddr, MODBUS_READ_INPUT_REGISTERS, startAddr, numRegs, raw, millis());
+    }
+    
     for (uint8_t i = 3; i < 3 + byteCount; i += 2) {
         if (dataIndex < numRegs) {
             if (big_endian) {
@@ -238,69 +158,25 @@ bool RS485::writeSingleRegister(uint8_t slaveAddr, uint16_t regAddr, uint16_t va
     request[6] = crc & 0xFF;               // CRC Low byte
     request[7] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, 8);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response
     uint8_t response[8];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // For writeSingleRegister: 1 (address) + 1 (function) + 2 (register addr) + 2 (register value) + 2 (CRC) = 8 bytes minimum
     uint8_t minBytesExpected = 8;
-
-    bool foundSlaveAddr = false;
-    
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-            
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all expected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
     
-    if (responseLength == 0) {
-        return false;
-    }
+    ModbusTransaction txn;
+    txn.prepare(request, 8, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    // Check if it is an error response
-    if (response[1] & 0x80) {
+    // Send request and wait for a response with valid CRC and no exception
+    if (!_transport->execute(&txn)) {
         return false;
     }
     
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
-        return false;
+    // Keep the cached holding register in step with the device (wire order)
+    if (_cache != NULL) {
+        uint16_t raw = (request[4] << 8) | request[5];
+        _cache->store(slaveAddr, MODBUS_READ_HOLDING_REGISTERS, regAddr, 1, &raw, millis());
     }
-    
     return true;
 }
 
@@ -344,68 +220,28 @@ bool RS485::writeMultipleRegisters(uint8_t slaveAddr, uint16_t startAddr, uint16
     request[totalBytes - 2] = crc & 0xFF;               // CRC Low byte
     request[totalBytes - 1] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, totalBytes);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response
     uint8_t response[8];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // For writeMultipleRegisters: 1 (address) + 1 (function) + 2 (register addr) + 2 (register quantity) + 2 (CRC) = 8 bytes minimum
     uint8_t minBytesExpected = 8;
-
-    bool foundSlaveAddr = false;
-    
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-            
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all exected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
-
-    if (responseLength == 0) {
-        return false;
-    }
     
-    // Check if it is an error response
-    if (response[1] & 0x80) {
-        return false;
-    }
+    ModbusTransaction txn;
+    txn.prepare(request, totalBytes, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
+    // Send request and wait for a response with valid CRC and no exception
+    if (!_transport->execute(&txn)) {
         return false;
     }
     
+    // Keep the cached holding registers in step with the device (wire order)
+    if (_cache != NULL && numRegs <= PZEM_CACHE_HOLDING_REGISTERS) {
+        uint16_t raw[PZEM_CACHE_HOLDING_REGISTERS];
+        for (uint16_t r = 0; r < numRegs; r++) {
+            raw[r] = (request[7 + 2 * r] << 8) | request[8 + 2 * r];
+        }
+        _cache->store(slaveAddr, MODBUS_READ_HOLDING_REGISTERS, startAddr, numRegs, raw, millis());
+    }
     return true;
 }
 
@@ -421,76 +257,22 @@ bool RS485::resetEnergy(uint8_t slaveAddr) {
     request[2] = crc & 0xFF;               // CRC Low byte
     request[3] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, 4);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response
     uint8_t response[4];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // For resetEnergy: 1 (address) + 1 (function) + 2 (CRC) = 4 bytes minimum
     uint8_t minBytesExpected = 4;
-
-    bool foundSlaveAddr = false;
-    
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-            
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all expected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
-    
     
-    if (responseLength == 0) {
-        return false;
-    }
+    ModbusTransaction txn;
+    txn.prepare(request, 4, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    // Check if it is an error response
-    if (response[1] & 0x80) {
-        return false;
-    }
-    
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
-        return false;
-    }
-    
-    return true;
+    // Send request and wait for a response with valid CRC and no exception
+    return _transport->execute(&txn);
 }
 
 /**
  * @brief Reset energy counter with phase selection (function code 0x42)
- * 
+ *
  * This overload is used for PZEM-6L24 devices that support selective
  * phase energy reset.
  */
@@ -505,94 +287,26 @@ bool RS485::resetEnergy(uint8_t slaveAddr, uint8_t phaseSequence) {
     request[4] = crc & 0xFF;               // CRC Low byte
     request[5] = (crc >> 8) & 0xFF;        // CRC High byte
     
-    
-    // Clear any remaining data in buffer before sending
-    clearBuffer();
-    
-    // Enable transmit mode for sending
-    enableTransmit();
-    
-    // Send request
-    _serial->write(request, 6);
-    _serial->flush();
-    delay(10);
-    
-    // Switch to receive mode
-    enableReceive();
-    
     // Receive optimized response
     uint8_t response[6];
-    uint8_t responseLength = 0;
-    uint32_t startTime = millis();
-    uint32_t lastByteTime = 0;
     
     // For resetEnergy with phase: 1 (address) + 1 (function) + 1 (reserved) + 1 (phase) + 2 (CRC) = 6 bytes minimum
     uint8_t minBytesExpected = 6;
-
-    bool foundSlaveAddr = false;
-    
-    while (millis() - startTime < _responseTimeout) {
-        yield();
-        if (_serial->available()) {
-            uint8_t byte = _serial->read();
-            
-            if (!foundSlaveAddr && byte == slaveAddr)
-                foundSlaveAddr = true;
-            
-            if (foundSlaveAddr) {
-                if (responseLength < sizeof(response)) {
-                    response[responseLength] = byte;
-                    responseLength++;
-                    lastByteTime = millis();
-                }
-            }
-        }
-        
-        // If received all expected bytes and passed time without new bytes
-        if (responseLength >= minBytesExpected && (millis() - lastByteTime) > 10) {
-            break;
-        }
-    }
     
+    ModbusTransaction txn;
+    txn.prepare(request, 6, response, sizeof(response), minBytesExpected, _responseTimeout);
     
-    if (responseLength == 0) {
-        return false;
-    }
-    
-    // Check if it is an error response (0xC2 indicates error)
-    if (response[1] == 0xC2) {
-        return false;
-    }
-    
-    // Verify CRC
-    if (!verifyCRC16(response, responseLength)) {
-        return false;
-    }
-    
-    return true;
+    // Send request and wait for a response with valid CRC and no exception (0xC2 indicates error)
+    return _transport->execute(&txn);
 }
 
 /**
  * @brief Calculate Modbus CRC16 checksum
- * 
+ *
  * Implements the standard Modbus CRC16 algorithm with polynomial 0xA001.
  */
 uint16_t RS485::calculateCRC16(uint8_t* data, uint8_t length) {
-    uint16_t crc = 0xFFFF;
-    
-    for (uint8_t i = 0; i < length; i++) {
-        crc ^= data[i];
-        
-        for (uint8_t j = 0; j < 8; j++) {
-            if (crc & 0x0001) {
-                crc = (crc >> 1) ^ 0xA001;
-            } else {
-                crc = crc >> 1;
-            }
-        }
-    }
-    
-    return crc;
+    return modbusCRC16(data, length);
 }
 
 /**
@@ -619,39 +333,25 @@ void RS485::setTimeouts(uint32_t responseTimeout) {
 /**
  * @brief Set RS485 enable pin for MAX485 transceiver
  */
-bool RS485::setEnable(uint8_t enablePin) {
-    _rs485_en = enablePin;
-    pinMode(_rs485_en, OUTPUT);
-    enableReceive(); // Start in receive mode
+bool RS485::setEnable(uint8_t enablePin, uint32_t guardUs) {
+    _rtu.setEnable(enablePin, guardUs);
     return true;
 }
 
 /**
- * @brief Enable RS485 transmit mode (DE/RE = HIGH)
- */
-void RS485::enableTransmit() {
-    if (_rs485_en != 255) {
-        digitalWrite(_rs485_en, HIGH);
-        delay(1); // Small delay to ensure mode change
-    }
-}
-
-/**
- * @brief Enable RS485 receive mode (DE/RE = LOW)
+ * @brief Set the direction-control strategy of the RS485 transceiver
  */
-void RS485::enableReceive() {
-    if (_rs485_en != 255) {
-        digitalWrite(_rs485_en, LOW);
-        delay(1); // Small delay to ensure mode change
-    }
+void RS485::setDirectionControl(ModbusDirectionControl* direction) {
+    _rtu.setDirectionControl(direction);
 }
 
 /**
  * @brief Clear serial buffer
  */
 void RS485::clearBuffer() {
-    while (_serial->available()) {
-        _serial->read();
+    Stream* serial = _rtu.getSerial();
+    while (serial->available()) {
+        serial->read();
     }
 }
 
@@ -673,5 +373,26 @@ uint32_t RS485::combineRegisters(uint16_t low, uint16_t high, bool signed_result
  * @brief Get serial stream pointer
  */
 Stream* RS485::getSerial() {
-    return _serial;
+    return _rtu.getSerial();
+}
+
+/**
+ * @brief Record every successful register read into a cache
+ */
+void RS485::setRegisterCache(PZEMRegisterCache* cache) {
+    _cache = cache;
+}
+
+/**
+ * @brief Route all transactions through another transport
+ */
+void RS485::setTransport(ModbusTransport* transport) {
+    _transport = (transport != NULL) ? transport : &_rtu;
+}
+
+/**
+ * @brief Get the transport used for transactions
+ */
+ModbusTransport* RS485::getTransport() {
+    return _transport;
 }
@@ -10,18 +10,9 @@
 
 #include <Arduino.h>
 #include <SoftwareSerial.h>
-
-/**
- * @defgroup ModbusFunctionCodes Modbus-RTU Function Codes
- * @brief Modbus-RTU protocol function codes
- * @{
- */
-#define MODBUS_READ_HOLDING_REGISTERS   0x03  ///< Read holding registers function code
-#define MODBUS_READ_INPUT_REGISTERS     0x04  ///< Read input registers function code
-#define MODBUS_WRITE_SINGLE_REGISTER    0x06  ///< Write single register function code
-#define MODBUS_WRITE_MULTIPLE_REGISTERS 0x10  ///< Write multiple registers function code
-#define MODBUS_RESET_ENERGY             0x42  ///< Reset energy counter function code
-/** @} */
+#include "ModbusProtocol.h"
+#include "ModbusTransport.h"
+#include "PZEMRegisterCache.h"
 
 /**
  * @class RS485
@@ -30,6 +21,10 @@
  * This class provides low-level Modbus-RTU communication functions including
  * reading/writing registers, CRC calculation, and RS485 enable pin control.
  * It serves as the base class for all PZEM device implementations.
+ * 
+ * Transactions go through a ModbusTransport: by default the serial Stream given
+ * to the constructor, or any transport set with setTransport() (Modbus-TCP,
+ * RTU-over-TCP), so device classes work unchanged over every transport.
  */
 class RS485 {
 public:
@@ -155,9 +150,17 @@ public:
     /**
      * @brief Set RS485 enable pin for MAX485 transceiver
      * @param enablePin GPIO pin number for DE/RE control
+     * @param guardUs Wait after flush() before listening, in microseconds (default: one character at 9600 baud)
      * @return true if successful, false otherwise
+     * @note See ModbusRTUTransport::setEnable() for the guard time.
      */
-    bool setEnable(uint8_t enablePin);
+    bool setEnable(uint8_t enablePin, uint32_t guardUs = MODBUS_RTU_ENABLE_GUARD_US);
+    
+    /**
+     * @brief Set the direction-control strategy of the RS485 transceiver
+     * @param direction Strategy (e.g. ModbusSplitDirection), or NULL for none (automatic direction)
+     */
+    void setDirectionControl(ModbusDirectionControl* direction);
     
     /**
      * @brief Get serial stream pointer
@@ -165,29 +168,31 @@ public:
      */
     Stream* getSerial();
     
-    /** @} */
-
-private:
-    Stream* _serial;        ///< Pointer to serial communication stream
-    uint32_t _responseTimeout;  ///< Response timeout in milliseconds
-    uint8_t _rs485_en;      ///< RS485 enable pin number (-1 if not used)
-    
     /**
-     * @name Internal Methods
-     * @{
+     * @brief Record every successful register read into a cache
+     * @param cache Pointer to the register cache, or NULL to stop recording
      */
+    void setRegisterCache(PZEMRegisterCache* cache);
     
     /**
-     * @brief Enable RS485 transmit mode (DE/RE = HIGH)
+     * @brief Route all transactions through another transport
+     * @param transport Pointer to transport (e.g. ModbusTCPTransport), or NULL to use the serial port again
      */
-    void enableTransmit();
+    void setTransport(ModbusTransport* transport);
     
     /**
-     * @brief Enable RS485 receive mode (DE/RE = LOW)
+     * @brief Get the transport used for transactions
+     * @return Pointer to the active transport
      */
-    void enableReceive();
+    ModbusTransport* getTransport();
     
     /** @} */
+
+private:
+    ModbusRTUTransport _rtu;    ///< Serial transport (Stream given to the constructor)
+    ModbusTransport* _transport;    ///< Transport used for transactions
+    uint32_t _responseTimeout;  ///< Response timeout in milliseconds
+    PZEMRegisterCache* _cache;  ///< Register cache fed by successful reads (NULL if not used)
 };
 
 #endif // RS485_H
\ No newline at end of file